@@ -69,6 +69,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359644 $")
 #include <sys/signal.h>
 #include <netinet/in.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "asterisk/lock.h"
 #include "asterisk/file.h"
@@ -99,6 +100,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359644 $")
 #include "asterisk/callerid.h"
 #include "asterisk/cel.h"
 #include "asterisk/data.h"
+#include "asterisk/test.h"
 
 /* Define, to debug reference counts on queues, without debugging reference counts on queue members */
 /* #define REF_DEBUG_ONLY_QUEUES */
@@ -734,6 +736,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359644 $")
 			<parameter name="Member" />
 		</syntax>
 		<description>
+			<para>The <literal>QueueParams</literal> event of each queue has a
+			<literal>WaitHistogram</literal> of the seconds callers waited for
+			their first turn to call members, and a <literal>DispatchHistogram</literal>
+			of the milliseconds callers took to act on their turn once it was given.
+			Both list the upper bound of each bucket with its count, as in
+			<literal>5:12,10:3,...,inf:0</literal>, and are cleared by <literal>QueueReset</literal>.</para>
 		</description>
 	</manager>
 	<manager name="QueueSummary" language="en_US">
@@ -978,6 +986,7 @@ static struct ast_taskprocessor *devicestate_tps;
 #define DEFAULT_MIN_ANNOUNCE_FREQUENCY 15       /*!< The minimum number of seconds between position announcements \
                                                      The default value of 15 provides backwards compatibility */
 #define MAX_QUEUE_BUCKETS 53
+#define QUEUE_HISTOGRAM_BUCKETS 7               /*!< Buckets of the queue wait and dispatch latency histograms */
 
 #define	RES_OKAY	0		/*!< Action completed */
 #define	RES_EXISTS	(-1)		/*!< Entry already exists */
@@ -1118,6 +1127,11 @@ struct queue_ent {
 	time_t start;                          /*!< When we started holding */
 	time_t expire;                         /*!< When this entry should expire (time out of queue) */
 	int cancel_answered_elsewhere;	       /*!< Whether we should force the CAE flag on this call (C) option*/
+	int turn;                              /*!< Non-zero if the dispatcher gave us our turn to call members */
+	int wake_avl;                          /*!< Members available when we last started calling them, we are only woken for more */
+	int waited;                            /*!< Non-zero once our wait for our first turn is in the histogram */
+	struct timeval dispatched;             /*!< When the dispatcher last gave us our turn */
+	int wake_pipe[2];                      /*!< Written by the dispatcher to wake us up, or -1 to poll */
 	struct ast_channel *chan;              /*!< Our channel */
 	AST_LIST_HEAD_NOLOCK(,penalty_rule) qe_rules; /*!< Local copy of the queue's penalty rules */
 	struct penalty_rule *pr;               /*!< Pointer to the next penalty rule to implement */
@@ -1268,6 +1282,12 @@ struct call_queue {
 	int rrpos;                          /*!< Round Robin - position */
 	int memberdelay;                    /*!< Seconds to delay connecting member to caller */
 	int autofill;                       /*!< Ignore the head call status and ring an available agent */
+
+	/* Dispatcher things */
+	int dispatch_avl;                   /*!< Available members at the last dispatch */
+	int dispatch_turns;                 /*!< Callers given their turn by the last dispatch */
+	unsigned int wait_histogram[QUEUE_HISTOGRAM_BUCKETS];     /*!< Callers by time waited for their first turn */
+	unsigned int dispatch_histogram[QUEUE_HISTOGRAM_BUCKETS]; /*!< Turns by time until the caller acted on them */
 	
 	struct ao2_container *members;             /*!< Head of the list of members */
 	struct queue_ent *head;             /*!< Head of the list of callers */
@@ -1286,6 +1306,7 @@ static AST_LIST_HEAD_STATIC(rule_lists, rule_list);
 static struct ao2_container *queues;
 
 static void update_realtime_members(struct call_queue *q);
+static void queue_dispatch(struct call_queue *q);
 static struct member *interface_exists(struct call_queue *q, const char *interface);
 static int set_member_paused(const char *queuename, const char *interface, const char *reason, int paused);
 
@@ -1543,6 +1564,174 @@ static int get_member_status(struct call_queue *q, int max_penalty, int min_pena
 	return -1;
 }
 
+/*! \brief Initial number of buckets in each of the member indexes, they grow with the members */
+#define MEMBER_INDEX_BUCKETS 37
+
+/*!
+ * \brief A member of a queue, as found in the member indexes
+ *
+ * Every member of a queue has one of these linked into both member_devices,
+ * by the device its state is read from, and member_interfaces, by the
+ * interface it is dialed on.  Device and extension state changes and weight
+ * checks look a member up in the index to visit only the queues it is in,
+ * instead of every member of every queue.
+ *
+ * \note The queue is not referenced.  It is only compared with the queue of
+ * the same name found in queues, which is how the queue is looked up.
+ */
+struct member_index_entry {
+	const struct call_queue *queue;   /*!< Queue the member is in, not referenced */
+	const char *device;               /*!< Device the member's state is read from */
+	const char *interface;            /*!< Interface the member is dialed on */
+	char name[0];                     /*!< Name of the queue, followed by the device and interface */
+};
+
+/*! \brief Members of all queues by the device their state is read from */
+static struct ao2_container *member_devices;
+
+/*! \brief Members of all queues by the interface they are dialed on */
+static struct ao2_container *member_interfaces;
+
+/*! \brief Size of the device a member's state is read from, including a hint */
+#define MEMBER_DEVICE_LEN (sizeof("hint:@") + AST_MAX_EXTENSION + AST_MAX_CONTEXT)
+
+/*!
+ * \internal
+ * \brief Copy the device of a state interface the way device state changes name it
+ *
+ * Local channels report the state of Local/exten@context without the options.
+ */
+static void member_state_device(const char *state_interface, char *buf, size_t len)
+{
+	char *slash_pos;
+
+	ast_copy_string(buf, state_interface, len);
+	if ((slash_pos = strchr(buf, '/'))) {
+		if (!strncasecmp(buf, "Local/", 6) && (slash_pos = strchr(slash_pos + 1, '/'))) {
+			*slash_pos = '\0';
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Copy the key of a member in member_devices
+ *
+ * Members using a hint are keyed by the extension whose state changes they
+ * follow, all other members by their device.
+ */
+static void member_index_device(const struct member *m, char *buf, size_t len)
+{
+	if (!ast_strlen_zero(m->state_exten)) {
+		snprintf(buf, len, "hint:%s@%s", m->state_exten, m->state_context);
+	} else {
+		member_state_device(m->state_interface, buf, len);
+	}
+}
+
+static int member_device_hash_fn(const void *obj, const int flags)
+{
+	const struct member_index_entry *entry = obj;
+
+	return ast_str_case_hash((flags & OBJ_KEY) ? obj : entry->device);
+}
+
+static int member_device_cmp_fn(void *obj, void *arg, int flags)
+{
+	struct member_index_entry *entry = obj, *entry2 = arg;
+
+	if (flags & OBJ_KEY) {
+		return strcasecmp(entry->device, arg) ? 0 : CMP_MATCH;
+	}
+	return entry->queue == entry2->queue && !strcasecmp(entry->device, entry2->device)
+		&& !strcasecmp(entry->interface, entry2->interface) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static int member_interface_hash_fn(const void *obj, const int flags)
+{
+	const struct member_index_entry *entry = obj;
+
+	return ast_str_case_hash((flags & OBJ_KEY) ? obj : entry->interface);
+}
+
+static int member_interface_cmp_fn(void *obj, void *arg, int flags)
+{
+	struct member_index_entry *entry = obj, *entry2 = arg;
+
+	if (flags & OBJ_KEY) {
+		return strcasecmp(entry->interface, arg) ? 0 : CMP_MATCH;
+	}
+	return entry->queue == entry2->queue
+		&& !strcasecmp(entry->interface, entry2->interface) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*! \brief Add a member of a queue to the member indexes */
+static void member_index_add(const struct call_queue *q, const struct member *m)
+{
+	struct member_index_entry *entry;
+	char device[MEMBER_DEVICE_LEN];
+	size_t name_len = strlen(q->name) + 1, device_len;
+
+	member_index_device(m, device, sizeof(device));
+	device_len = strlen(device) + 1;
+	if (!(entry = ao2_alloc(sizeof(*entry) + name_len + device_len + strlen(m->interface) + 1, NULL))) {
+		return;
+	}
+	entry->queue = q;
+	strcpy(entry->name, q->name);
+	entry->device = strcpy(entry->name + name_len, device);
+	entry->interface = strcpy(entry->name + name_len + device_len, m->interface);
+
+	ao2_link(member_devices, entry);
+	ao2_link(member_interfaces, entry);
+	ao2_ref(entry, -1);
+}
+
+/*! \brief Remove a member of a queue from the member indexes */
+static void member_index_remove(const struct call_queue *q, const struct member *m)
+{
+	struct member_index_entry tmp = { .queue = q, .interface = m->interface, }, *entry;
+	char device[MEMBER_DEVICE_LEN];
+
+	member_index_device(m, device, sizeof(device));
+	tmp.device = device;
+	if ((entry = ao2_find(member_devices, &tmp, OBJ_POINTER | OBJ_UNLINK))) {
+		ao2_unlink(member_interfaces, entry);
+		ao2_ref(entry, -1);
+	}
+}
+
+/*!
+ * \brief Find the queue of a member in the member indexes
+ * \return the queue with a reference, or NULL if it is no longer in queues
+ */
+static struct call_queue *member_index_queue(const struct member_index_entry *entry)
+{
+	struct call_queue *q, tmpq = {
+		.name = entry->name,
+	};
+
+	if ((q = ao2_t_find(queues, &tmpq, OBJ_POINTER, "Find queue of indexed member")) && q != entry->queue) {
+		queue_t_unref(q, "Queue of the same name replaced the indexed one");
+		q = NULL;
+	}
+	return q;
+}
+
+/*! \brief Link a member into a queue and the member indexes */
+static void member_add_to_queue(struct call_queue *q, struct member *m)
+{
+	ao2_link(q->members, m);
+	member_index_add(q, m);
+}
+
+/*! \brief Unlink a member from a queue and the member indexes */
+static void member_remove_from_queue(struct call_queue *q, struct member *m)
+{
+	member_index_remove(q, m);
+	ao2_unlink(q->members, m);
+}
+
 struct statechange {
 	AST_LIST_ENTRY(statechange) entry;
 	int state;
@@ -1557,6 +1746,7 @@ struct statechange {
 static int update_status(struct call_queue *q, struct member *m, const int status)
 {
 	m->status = status;
+	queue_dispatch(q);
 
 	if (q->maskmemberstatus)
 		return 0;
@@ -1579,43 +1769,51 @@ static int update_status(struct call_queue *q, struct member *m, const int statu
 	return 0;
 }
 
-/*! \brief set a member's status based on device state of that member's interface*/
-static int handle_statechange(void *datap)
+/*!
+ * \brief set the status of the members of all queues whose state is read from a device
+ * \return the number of members updated
+ */
+static int update_device_status(const char *device, int state)
 {
-	struct statechange *sc = datap;
-	struct ao2_iterator miter, qiter;
+	struct ao2_iterator *entries;
+	struct member_index_entry *entry;
 	struct member *m;
 	struct call_queue *q;
-	char interface[80], *slash_pos;
+	char interface[80];
 	int found = 0;
 
-	qiter = ao2_iterator_init(queues, 0);
-	while ((q = ao2_t_iterator_next(&qiter, "Iterate over queues"))) {
+	if (!(entries = ao2_find(member_devices, device, OBJ_KEY | OBJ_MULTIPLE))) {
+		return 0;
+	}
+	for (; (entry = ao2_iterator_next(entries)); ao2_ref(entry, -1)) {
+		if (!(q = member_index_queue(entry))) {
+			continue;
+		}
 		ao2_lock(q);
 
-		miter = ao2_iterator_init(q->members, 0);
-		for (; (m = ao2_iterator_next(&miter)); ao2_ref(m, -1)) {
-			ast_copy_string(interface, m->state_interface, sizeof(interface));
-
-			if ((slash_pos = strchr(interface, '/')))
-				if (!strncasecmp(interface, "Local/", 6) && (slash_pos = strchr(slash_pos + 1, '/')))
-					*slash_pos = '\0';
-
-			if (!strcasecmp(interface, sc->dev)) {
-				found = 1;
-				update_status(q, m, sc->state);
-				ao2_ref(m, -1);
-				break;
+		if ((m = ao2_find(q->members, entry->interface, OBJ_KEY))) {
+			member_state_device(m->state_interface, interface, sizeof(interface));
+			if (!strcasecmp(interface, device)) {
+				found++;
+				update_status(q, m, state);
 			}
+			ao2_ref(m, -1);
 		}
-		ao2_iterator_destroy(&miter);
 
 		ao2_unlock(q);
-		queue_t_unref(q, "Done with iterator");
+		queue_t_unref(q, "Done with indexed queue");
 	}
-	ao2_iterator_destroy(&qiter);
+	ao2_iterator_destroy(entries);
 
-	if (found)
+	return found;
+}
+
+/*! \brief set a member's status based on device state of that member's interface*/
+static int handle_statechange(void *datap)
+{
+	struct statechange *sc = datap;
+
+	if (update_device_status(sc->dev, sc->state))
 		ast_debug(1, "Device '%s' changed to state '%d' (%s)\n", sc->dev, sc->state, ast_devstate2str(sc->state));
 	else
 		ast_debug(3, "Device '%s' changed to state '%d' (%s) but we don't care because they're not a member of any queue.\n", sc->dev, sc->state, ast_devstate2str(sc->state));
@@ -1684,30 +1882,34 @@ static int extensionstate2devicestate(int state)
 
 static int extension_state_cb(const char *context, const char *exten, enum ast_extension_states state, void *data)
 {
-	struct ao2_iterator miter, qiter;
+	struct ao2_iterator *entries;
+	struct member_index_entry *entry;
 	struct member *m;
 	struct call_queue *q;
+	char device[MEMBER_DEVICE_LEN];
 	int found = 0, device_state = extensionstate2devicestate(state);
 
-	qiter = ao2_iterator_init(queues, 0);
-	while ((q = ao2_t_iterator_next(&qiter, "Iterate through queues"))) {
-		ao2_lock(q);
+	snprintf(device, sizeof(device), "hint:%s@%s", exten, context);
+	if ((entries = ao2_find(member_devices, device, OBJ_KEY | OBJ_MULTIPLE))) {
+		for (; (entry = ao2_iterator_next(entries)); ao2_ref(entry, -1)) {
+			if (!(q = member_index_queue(entry))) {
+				continue;
+			}
+			ao2_lock(q);
 
-		miter = ao2_iterator_init(q->members, 0);
-		for (; (m = ao2_iterator_next(&miter)); ao2_ref(m, -1)) {
-			if (!strcmp(m->state_context, context) && !strcmp(m->state_exten, exten)) {
-				update_status(q, m, device_state);
+			if ((m = ao2_find(q->members, entry->interface, OBJ_KEY))) {
+				if (!strcmp(m->state_context, context) && !strcmp(m->state_exten, exten)) {
+					update_status(q, m, device_state);
+					found = 1;
+				}
 				ao2_ref(m, -1);
-				found = 1;
-				break;
 			}
-		}
-		ao2_iterator_destroy(&miter);
 
-		ao2_unlock(q);
-		queue_t_unref(q, "Done with iterator");
+			ao2_unlock(q);
+			queue_t_unref(q, "Done with indexed queue");
+		}
+		ao2_iterator_destroy(entries);
 	}
-	ao2_iterator_destroy(&qiter);
 
         if (found) {
 		ast_debug(1, "Extension '%s@%s' changed to state '%d' (%s)\n", exten, context, device_state, ast_devstate2str(device_state));
@@ -1884,6 +2086,8 @@ static void clear_queue(struct call_queue *q)
 	q->callsabandoned = 0;
 	q->callscompletedinsl = 0;
 	q->talktime = 0;
+	memset(q->wait_histogram, 0, sizeof(q->wait_histogram));
+	memset(q->dispatch_histogram, 0, sizeof(q->dispatch_histogram));
 
 	if (q->members) {
 		struct member *mem;
@@ -2279,7 +2483,9 @@ static void rt_handle_member_record(struct call_queue *q, char *interface, struc
 				m->paused = paused;
 			}
 			if (strcasecmp(state_interface, m->state_interface)) {
+				member_index_remove(q, m);
 				ast_copy_string(m->state_interface, state_interface, sizeof(m->state_interface));
+				member_index_add(q, m);
 			}
 			m->penalty = penalty;
 			m->ignorebusy = ignorebusy;
@@ -2303,7 +2509,7 @@ static void rt_handle_member_record(struct call_queue *q, char *interface, struc
 			} else {
 				ast_queue_log(q->name, "REALTIME", m->membername, "ADDMEMBER", "%s", paused ? "PAUSED" : "");
 			}
-			ao2_link(q->members, m);
+			member_add_to_queue(q, m);
 			ao2_ref(m, -1);
 			m = NULL;
 		}
@@ -2319,7 +2525,7 @@ static void free_members(struct call_queue *q, int all)
 
 	while ((cur = ao2_iterator_next(&mem_iter))) {
 		if (all || !cur->dynamic) {
-			ao2_unlink(q->members, cur);
+			member_remove_from_queue(q, cur);
 		}
 		ao2_ref(cur, -1);
 	}
@@ -2486,12 +2692,13 @@ static struct call_queue *find_queue_by_name_rt(const char *queuename, struct as
 			} else {
 				ast_queue_log(q->name, "REALTIME", m->membername, "REMOVEMEMBER", "%s", "");
 			}
-			ao2_unlink(q->members, m);
+			member_remove_from_queue(q, m);
 		}
 		ao2_ref(m, -1);
 	}
 	ao2_iterator_destroy(&mem_iter);
 
+	queue_dispatch(q);
 	ao2_unlock(q);
 
 	return q;
@@ -2614,11 +2821,12 @@ static void update_realtime_members(struct call_queue *q)
 			} else {
 				ast_queue_log(q->name, "REALTIME", m->membername, "REMOVEMEMBER", "%s", "");
 			}
-			ao2_unlink(q->members, m);
+			member_remove_from_queue(q, m);
 		}
 		ao2_ref(m, -1);
 	}
 	ao2_iterator_destroy(&mem_iter);
+	queue_dispatch(q);
 	ao2_unlock(q);
 	ast_config_destroy(member_config);
 }
@@ -2703,6 +2911,7 @@ static int join_queue(char *queuename, struct queue_ent *qe, enum queue_result *
 			S_COR(ast_channel_connected(qe->chan)->id.name.valid, ast_channel_connected(qe->chan)->id.name.str, "unknown"),
 			q->name, qe->pos, q->count, ast_channel_uniqueid(qe->chan));
 		ast_debug(1, "Queue '%s' Join, Channel '%s', Position '%d'\n", q->name, ast_channel_name(qe->chan), qe->pos );
+		queue_dispatch(q);
 	}
 	ao2_unlock(q);
 	queue_t_unref(q, "Done with realtime queue");
@@ -2964,6 +3173,10 @@ static void leave_queue(struct queue_ent *qe)
 				prev->next = current->next;
 			else
 				q->head = current->next;
+			if (qe->turn) {
+				qe->turn = 0;
+				q->dispatch_turns--;
+			}
 			/* Free penalty rules */
 			while ((pr_iter = AST_LIST_REMOVE_HEAD(&qe->qe_rules, list)))
 				ast_free(pr_iter);
@@ -2975,6 +3188,7 @@ static void leave_queue(struct queue_ent *qe)
 			prev = current;
 		}
 	}
+	queue_dispatch(q);
 	ao2_unlock(q);
 
 	/*If the queue is a realtime queue, check to see if it's still defined in real time*/
@@ -3090,19 +3304,229 @@ static int num_available_members(struct call_queue *q)
 	return avl;
 }
 
-/* traverse all defined queues which have calls waiting and contain this member
+/*! \brief Upper bounds of the buckets of the queue wait histogram, in seconds */
+static const int queue_wait_bounds[QUEUE_HISTOGRAM_BUCKETS - 1] = { 5, 10, 30, 60, 120, 300 };
+
+/*! \brief Upper bounds of the buckets of the dispatch latency histogram, in milliseconds */
+static const int queue_dispatch_bounds[QUEUE_HISTOGRAM_BUCKETS - 1] = { 1, 5, 10, 50, 100, 500 };
+
+static void queue_histogram_add(unsigned int *histogram, const int *bounds, int64_t value)
+{
+	int i;
+
+	for (i = 0; i < QUEUE_HISTOGRAM_BUCKETS - 1 && value >= bounds[i]; i++) {
+	}
+	histogram[i]++;
+}
+
+/*!
+ * \brief Format a histogram as a list of bucket upper bounds and counts
+ *
+ * The counts of "5:3,10:1,inf:0" are of values below 5, below 10 and the rest.
+ */
+static char *queue_histogram_str(const unsigned int *histogram, const int *bounds, char *buf, size_t len)
+{
+	char *pos = buf;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < QUEUE_HISTOGRAM_BUCKETS - 1; i++) {
+		ast_build_string(&pos, &len, "%d:%u,", bounds[i], histogram[i]);
+	}
+	ast_build_string(&pos, &len, "inf:%u", histogram[i]);
+
+	return buf;
+}
+
+/*! \brief Wake up a caller waiting for the dispatcher */
+static void queue_wake(struct queue_ent *qe)
+{
+	if (qe->wake_pipe[1] > -1 && write(qe->wake_pipe[1], "", 1) < 0 && errno != EAGAIN) {
+		ast_log(LOG_WARNING, "Unable to wake up caller: %s\n", strerror(errno));
+	}
+}
+
+/*! \brief Create the pipe the dispatcher wakes a caller up with */
+static void queue_wake_init(struct queue_ent *qe)
+{
+	int flags;
+
+	if (pipe(qe->wake_pipe)) {
+		ast_log(LOG_WARNING, "Unable to create wake up pipe, caller will poll for its turn: %s\n", strerror(errno));
+		qe->wake_pipe[0] = qe->wake_pipe[1] = -1;
+		return;
+	}
+	flags = fcntl(qe->wake_pipe[0], F_GETFL);
+	fcntl(qe->wake_pipe[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(qe->wake_pipe[1], F_GETFL);
+	fcntl(qe->wake_pipe[1], F_SETFL, flags | O_NONBLOCK);
+}
+
+static void queue_wake_destroy(struct queue_ent *qe)
+{
+	if (qe->wake_pipe[0] > -1) {
+		close(qe->wake_pipe[0]);
+		close(qe->wake_pipe[1]);
+		qe->wake_pipe[0] = qe->wake_pipe[1] = -1;
+	}
+}
+
+/*!
+ * \brief Give the callers of a queue their turn to call members
+ *
+ * As many callers from the head of the queue as there are members available,
+ * not counting callers already calling members, get their turn.  Callers
+ * getting their turn are woken up, and so are all callers who have it when
+ * more members became available, so a caller waiting to retry can call them.
+ * Either way a caller is only woken when more members are available than when
+ * it last started calling members, so the members it just rang becoming free
+ * again do not cut its retry wait short.
+ *
+ * This is run whenever something is done that can change whose turn it is:
+ * callers joining, leaving or calling members, and members changing state,
+ * being paused or being added and removed.
+ */
+static void queue_dispatch(struct call_queue *q)
+{
+	struct queue_ent *qe;
+	int avl, idx = 0, seen = 0, turns = 0, more;
+
+	ao2_lock(q);
+	if (!q->head) {
+		q->dispatch_avl = 0;
+		ao2_unlock(q);
+		return;
+	}
+
+	avl = num_available_members(q);
+	more = avl > q->dispatch_avl;
+	q->dispatch_avl = avl;
+
+	/* The callers with their turn are at the head of the queue */
+	for (qe = q->head; qe && (idx < avl || seen < q->dispatch_turns); qe = qe->next) {
+		if (qe->turn) {
+			seen++;
+		}
+		if (idx < avl && (q->autofill || qe->pos == 1)) {
+			turns++;
+			if (!qe->turn) {
+				qe->turn = 1;
+				qe->dispatched = ast_tvnow();
+				if (avl > qe->wake_avl) {
+					queue_wake(qe);
+				}
+			} else if (more && avl > qe->wake_avl) {
+				queue_wake(qe);
+			}
+		} else {
+			qe->turn = 0;
+		}
+		if (!qe->pending) {
+			idx++;
+		}
+	}
+	q->dispatch_turns = turns;
+
+	ao2_unlock(q);
+}
+
+/*! \brief Forget about wakeups sent by the dispatcher before now */
+static void drain_dispatch(struct queue_ent *qe)
+{
+	char buf[16];
+
+	if (qe->wake_pipe[0] > -1) {
+		while (read(qe->wake_pipe[0], buf, sizeof(buf)) > 0) {
+		}
+	}
+}
+
+/*!
+ * \brief Wait for a digit, or for the dispatcher to wake us up
+ *
+ * \retval 0 if the time is up or the dispatcher woke us up
+ * \retval >0 the digit pressed
+ * \retval -1 on hangup
+ */
+static int wait_for_dispatch(struct queue_ent *qe, int ms)
+{
+	struct ast_channel *chan = qe->chan, *rchan;
+	struct ast_frame *f;
+	int outfd, res = 0;
+
+	if (qe->wake_pipe[0] < 0) {
+		return ast_waitfordigit(chan, ms);
+	}
+
+	/* Stop if we're a zombie or need a soft hangup */
+	if (ast_test_flag(ast_channel_flags(chan), AST_FLAG_ZOMBIE) || ast_check_hangup(chan)) {
+		return -1;
+	}
+
+	/* Only look for the end of DTMF, the same as waiting for a digit */
+	ast_set_flag(ast_channel_flags(chan), AST_FLAG_END_DTMF_ONLY);
+
+	while (ms && !res) {
+		outfd = -1;
+		errno = 0;
+		rchan = ast_waitfor_nandfds(&chan, 1, &qe->wake_pipe[0], 1, NULL, &outfd, &ms);
+		if (outfd > -1) {
+			drain_dispatch(qe);
+			break;
+		} else if (rchan) {
+			if (!(f = ast_read(chan))) {
+				res = -1;
+				break;
+			}
+			if (f->frametype == AST_FRAME_DTMF_END) {
+				res = f->subclass.integer;
+			} else if (f->frametype == AST_FRAME_CONTROL && f->subclass.integer == AST_CONTROL_HANGUP) {
+				res = -1;
+			}
+			ast_frfree(f);
+		} else if (ms && errno && errno != EINTR) {
+			ast_log(LOG_WARNING, "Wait failed (%s)\n", strerror(errno));
+			res = -1;
+		}
+	}
+
+	ast_clear_flag(ast_channel_flags(chan), AST_FLAG_END_DTMF_ONLY);
+
+	return res;
+}
+
+/*! \brief Add a caller acting on its turn to the histograms of its queue */
+static void queue_record_turn(struct queue_ent *qe)
+{
+	struct call_queue *q = qe->parent;
+
+	ao2_lock(q);
+	if (!qe->waited) {
+		qe->waited = 1;
+		queue_histogram_add(q->wait_histogram, queue_wait_bounds, time(NULL) - qe->start);
+	}
+	queue_histogram_add(q->dispatch_histogram, queue_dispatch_bounds, ast_tvdiff_ms(ast_tvnow(), qe->dispatched));
+	ao2_unlock(q);
+}
+
+/* traverse all queues which have calls waiting and contain this member
    return 0 if no other queue has precedence (higher weight) or 1 if found  */
 static int compare_weight(struct call_queue *rq, struct member *member)
 {
 	struct call_queue *q;
 	struct member *mem;
 	int found = 0;
-	struct ao2_iterator queue_iter;
+	struct ao2_iterator *entries;
+	struct member_index_entry *entry;
 
-	queue_iter = ao2_iterator_init(queues, 0);
-	while ((q = ao2_t_iterator_next(&queue_iter, "Iterate through queues"))) {
-		if (q == rq) { /* don't check myself, could deadlock */
-			queue_t_unref(q, "Done with iterator");
+	if (!(entries = ao2_find(member_interfaces, member->interface, OBJ_KEY | OBJ_MULTIPLE))) {
+		return 0;
+	}
+	for (; !found && (entry = ao2_iterator_next(entries)); ao2_ref(entry, -1)) {
+		if (entry->queue == rq) { /* don't check myself, could deadlock */
+			continue;
+		}
+		if (!(q = member_index_queue(entry))) {
 			continue;
 		}
 		ao2_lock(q);
@@ -3117,12 +3541,9 @@ static int compare_weight(struct call_queue *rq, struct member *member)
 			}
 		}
 		ao2_unlock(q);
-		queue_t_unref(q, "Done with iterator");
-		if (found) {
-			break;
-		}
+		queue_t_unref(q, "Done with indexed queue");
 	}
-	ao2_iterator_destroy(&queue_iter);
+	ao2_iterator_destroy(entries);
 	return found;
 }
 
@@ -4076,39 +4497,14 @@ static struct callattempt *wait_for_answer(struct queue_ent *qe, struct callatte
  */
 static int is_our_turn(struct queue_ent *qe)
 {
-	struct queue_ent *ch;
-	int res;
-	int avl;
-	int idx = 0;
-	/* This needs a lock. How many members are available to be served? */
-	ao2_lock(qe->parent);
-
-	avl = num_available_members(qe->parent);
-
-	ch = qe->parent->head;
-
-	ast_debug(1, "There %s %d available %s.\n", avl != 1 ? "are" : "is", avl, avl != 1 ? "members" : "member");
-
-	while ((idx < avl) && (ch) && (ch != qe)) {
-		if (!ch->pending)
-			idx++;
-		ch = ch->next;			
-	}
-
-	ao2_unlock(qe->parent);
-	/* If the queue entry is within avl [the number of available members] calls from the top ... 
-	 * Autofill and position check added to support autofill=no (as only calls
-	 * from the front of the queue are valid when autofill is disabled)
-	 */
-	if (ch && idx < avl && (qe->parent->autofill || qe->pos == 1)) {
+	/* The dispatcher gives callers their turn as members and callers come and go */
+	if (qe->turn) {
 		ast_debug(1, "It's our turn (%s).\n", ast_channel_name(qe->chan));
-		res = 1;
-	} else {
-		ast_debug(1, "It's not our turn (%s).\n", ast_channel_name(qe->chan));
-		res = 0;
+		return 1;
 	}
 
-	return res;
+	ast_debug(1, "It's not our turn (%s).\n", ast_channel_name(qe->chan));
+	return 0;
 }
 
 /*!
@@ -4156,8 +4552,10 @@ static int wait_our_turn(struct queue_ent *qe, int ringing, enum queue_result *r
 	/* This is the holding pen for callers 2 through maxlen */
 	for (;;) {
 
-		if (is_our_turn(qe))
+		if (is_our_turn(qe)) {
+			queue_record_turn(qe);
 			break;
+		}
 
 		/* If we have timed out, break out */
 		if (qe->expire && (time(NULL) >= qe->expire)) {
@@ -4203,8 +4601,8 @@ static int wait_our_turn(struct queue_ent *qe, int ringing, enum queue_result *r
 			break;
 		}
 		
-		/* Wait a second before checking again */
-		if ((res = ast_waitfordigit(qe->chan, RECHECK * 1000))) {
+		/* Wait a second, or until the dispatcher gives us our turn */
+		if ((res = wait_for_dispatch(qe, RECHECK * 1000))) {
 			if (res > 0 && !valid_exit(qe, res))
 				res = 0;
 			else
@@ -4785,7 +5183,9 @@ static int try_calling(struct queue_ent *qe, const struct ast_flags opts, char *
 		}
 	}
 	orig = to;
+	qe->wake_avl = num_available_members(qe->parent);
 	++qe->pending;
+	queue_dispatch(qe->parent);
 	ao2_unlock(qe->parent);
 	ring_one(qe, outgoing, &numbusies);
 	lpeer = wait_for_answer(qe, outgoing, &to, &digit, numbusies, ast_test_flag(&(bridge_config.features_caller), AST_FEATURE_DISCONNECT), forwardsallowed, update_connectedline);
@@ -4811,7 +5211,10 @@ static int try_calling(struct queue_ent *qe, const struct ast_flags opts, char *
 	ao2_unlock(qe->parent);
 	peer = lpeer ? lpeer->chan : NULL;
 	if (!peer) {
+		ao2_lock(qe->parent);
 		qe->pending = 0;
+		queue_dispatch(qe->parent);
+		ao2_unlock(qe->parent);
 		if (to) {
 			/* Must gotten hung up */
 			res = -1;
@@ -5357,8 +5760,11 @@ static int wait_a_bit(struct queue_ent *qe)
 {
 	/* Don't need to hold the lock while we setup the outgoing calls */
 	int retrywait = qe->parent->retry * 1000;
+	int res;
 
-	int res = ast_waitfordigit(qe->chan, retrywait);
+	/* Retry early only if members become available while we wait */
+	drain_dispatch(qe);
+	res = wait_for_dispatch(qe, retrywait);
 	if (res > 0 && !valid_exit(qe, res))
 		res = 0;
 
@@ -5465,8 +5871,9 @@ static int remove_from_queue(const char *queuename, const char *interface)
 				"Location: %s\r\n"
 				"MemberName: %s\r\n",
 				q->name, mem->interface, mem->membername);
-			ao2_unlink(q->members, mem);
+			member_remove_from_queue(q, mem);
 			ao2_ref(mem, -1);
+			queue_dispatch(q);
 
 			if (queue_persistent_members)
 				dump_queue_members(q);
@@ -5505,7 +5912,8 @@ static int add_to_queue(const char *queuename, const char *interface, const char
 	if ((old_member = interface_exists(q, interface)) == NULL) {
 		if ((new_member = create_queue_member(interface, membername, penalty, paused, state_interface))) {
 			new_member->dynamic = 1;
-			ao2_link(q->members, new_member);
+			member_add_to_queue(q, new_member);
+			queue_dispatch(q);
 			manager_event(EVENT_FLAG_AGENT, "QueueMemberAdded",
 				"Queue: %s\r\n"
 				"Location: %s\r\n"
@@ -5579,6 +5987,7 @@ static int set_member_paused(const char *queuename, const char *interface, const
 				}
 				found++;
 				mem->paused = paused;
+				queue_dispatch(q);
 
 				if (queue_persistent_members)
 					dump_queue_members(q);
@@ -6261,9 +6670,11 @@ static int queue_exec(struct ast_channel *chan, const char *data)
 	qe.last_periodic_announce_time = time(NULL);
 	qe.last_periodic_announce_sound = 0;
 	qe.valid_digits = 0;
+	queue_wake_init(&qe);
 	if (join_queue(args.queuename, &qe, &reason, position)) {
 		ast_log(LOG_WARNING, "Unable to join queue '%s'\n", args.queuename);
 		set_queue_result(chan, reason);
+		queue_wake_destroy(&qe);
 		return 0;
 	}
 	ast_queue_log(args.queuename, ast_channel_uniqueid(chan), "NONE", "ENTERQUEUE", "%s|%s|%d",
@@ -6417,6 +6828,7 @@ stop:
 	set_queue_variables(qe.parent, qe.chan);
 
 	leave_queue(&qe);
+	queue_wake_destroy(&qe);
 	if (reason != QUEUE_UNKNOWN)
 		set_queue_result(chan, reason);
 
@@ -6660,6 +7072,7 @@ static int queue_function_mem_write(struct ast_channel *chan, const char *cmd, c
 				ao2_ref(q, -1);
 				return -1;
 			}
+			queue_dispatch(q);
 			ao2_ref(m, -1);
 		} else {
 			ao2_unlock(q);
@@ -7066,8 +7479,11 @@ static void reload_single_member(const char *memberdata, struct call_queue *q)
 	/* Find the old position in the list */
 	ast_copy_string(tmpmem.interface, interface, sizeof(tmpmem.interface));
 	cur = ao2_find(q->members, &tmpmem, OBJ_POINTER | OBJ_UNLINK);
+	if (cur) {
+		member_index_remove(q, cur);
+	}
 	if ((newm = create_queue_member(interface, membername, penalty, cur ? cur->paused : 0, state_interface))) {
-		ao2_link(q->members, newm);
+		member_add_to_queue(q, newm);
 		ao2_ref(newm, -1);
 	}
 	newm = NULL;
@@ -7094,6 +7510,7 @@ static int kill_dead_members(void *obj, void *arg, int flags)
 		member->status = get_queue_member_status(member);
 		return 0;
 	} else {
+		member_index_remove(arg, member);
 		return CMP_MATCH;
 	}
 }
@@ -7199,6 +7616,7 @@ static void reload_single_queue(struct ast_config *cfg, struct ast_flags *mask,
 	if (new) {
 		queues_t_link(queues, q, "Add queue to container");
 	} else {
+		queue_dispatch(q);
 		ao2_unlock(q);
 	}
 	queue_t_unref(q, "Expiring creation reference");
@@ -7674,6 +8092,7 @@ static int manager_queues_status(struct mansession *s, const struct message *m)
 	const char *queuefilter = astman_get_header(m,"Queue");
 	const char *memberfilter = astman_get_header(m,"Member");
 	char idText[256] = "";
+	char wait_histogram[128], dispatch_histogram[128];
 	struct call_queue *q;
 	struct queue_ent *qe;
 	float sl = 0;
@@ -7705,10 +8124,15 @@ static int manager_queues_status(struct mansession *s, const struct message *m)
 				"ServiceLevel: %d\r\n"
 				"ServicelevelPerf: %2.1f\r\n"
 				"Weight: %d\r\n"
+				"WaitHistogram: %s\r\n"
+				"DispatchHistogram: %s\r\n"
 				"%s"
 				"\r\n",
 				q->name, q->maxlen, int2strat(q->strategy), q->count, q->holdtime, q->talktime, q->callscompleted,
-				q->callsabandoned, q->servicelevel, sl, q->weight, idText);
+				q->callsabandoned, q->servicelevel, sl, q->weight,
+				queue_histogram_str(q->wait_histogram, queue_wait_bounds, wait_histogram, sizeof(wait_histogram)),
+				queue_histogram_str(q->dispatch_histogram, queue_dispatch_bounds, dispatch_histogram, sizeof(dispatch_histogram)),
+				idText);
 			/* List Queue Members */
 			mem_iter = ao2_iterator_init(q->members, 0);
 			while ((mem = ao2_iterator_next(&mem_iter))) {
@@ -8493,6 +8917,434 @@ static const char qum_cmd_usage[] =
 static const char qsmp_cmd_usage[] =
 "Usage: queue set member penalty <channel> from <queue> <penalty>\n";
 
+#ifdef TEST_FRAMEWORK
+/*!
+ * \internal
+ * \brief Create a queue for testing and link it into queues
+ */
+static struct call_queue *queue_test_alloc(const char *name)
+{
+	struct call_queue *q;
+
+	if (!(q = alloc_queue(name))) {
+		return NULL;
+	}
+	init_queue(q);
+	q->maskmemberstatus = 1;
+	queues_t_link(queues, q, "Add test queue to container");
+	return q;
+}
+
+/*!
+ * \internal
+ * \brief Unlink a queue created for testing and release it
+ */
+static void queue_test_destroy(struct call_queue *q)
+{
+	queues_t_unlink(queues, q, "Remove test queue from container");
+	queue_t_unref(q, "Done with test queue");
+}
+
+/*!
+ * \internal
+ * \brief Add a member to a queue created for testing
+ */
+static int queue_test_add_member(struct call_queue *q, const char *interface, const char *state_interface)
+{
+	struct member *m;
+
+	if (!(m = create_queue_member(interface, NULL, 0, 0, state_interface))) {
+		return -1;
+	}
+	ao2_lock(q);
+	member_add_to_queue(q, m);
+	ao2_unlock(q);
+	ao2_ref(m, -1);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Get the status of a member of a queue created for testing
+ */
+static int queue_test_member_status(struct call_queue *q, const char *interface)
+{
+	struct member *m;
+	int status = -1;
+
+	if ((m = ao2_find(q->members, interface, OBJ_KEY))) {
+		status = m->status;
+		ao2_ref(m, -1);
+	}
+	return status;
+}
+
+AST_TEST_DEFINE(member_index_test)
+{
+	struct call_queue *q1 = NULL, *q2 = NULL;
+	struct member *m;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "member_index_test";
+		info->category = "/apps/app_queue/";
+		info->summary = "Test the index of queue members by device and interface";
+		info->description =
+			"This test ensures that device and extension state changes update "
+			"the members of every queue following the device, that the members "
+			"of other queues are found for weight checks, and that removed "
+			"members are removed from the index.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(q1 = queue_test_alloc("__member_index_test_1")) || !(q2 = queue_test_alloc("__member_index_test_2"))) {
+		ast_test_status_update(test, "Failed to allocate test queues\n");
+		goto return_cleanup;
+	}
+	if (queue_test_add_member(q1, "QueueTest/1", NULL) || queue_test_add_member(q2, "QueueTest/1", NULL)
+		|| queue_test_add_member(q1, "QueueTest/2", "Local/200@queue-test/n")
+		|| queue_test_add_member(q2, "QueueTest/3", "hint:300@queue-test")) {
+		ast_test_status_update(test, "Failed to add test members\n");
+		goto return_cleanup;
+	}
+
+	if (update_device_status("QUEUETEST/1", AST_DEVICE_INUSE) != 2
+		|| queue_test_member_status(q1, "QueueTest/1") != AST_DEVICE_INUSE
+		|| queue_test_member_status(q2, "QueueTest/1") != AST_DEVICE_INUSE) {
+		ast_test_status_update(test, "A device state change did not update the member in both queues\n");
+		goto return_cleanup;
+	}
+	if (update_device_status("Local/200@queue-test", AST_DEVICE_BUSY) != 1
+		|| queue_test_member_status(q1, "QueueTest/2") != AST_DEVICE_BUSY) {
+		ast_test_status_update(test, "A device state change did not update the member following a Local channel\n");
+		goto return_cleanup;
+	}
+	extension_state_cb("queue-test", "300", AST_EXTENSION_RINGING, NULL);
+	if (queue_test_member_status(q2, "QueueTest/3") != AST_DEVICE_RINGING) {
+		ast_test_status_update(test, "An extension state change did not update the member following the hint\n");
+		goto return_cleanup;
+	}
+	if (update_device_status("QueueTest/3", AST_DEVICE_NOT_INUSE)) {
+		ast_test_status_update(test, "A device state change updated a member following a hint\n");
+		goto return_cleanup;
+	}
+
+	/* The member is busy in a queue with more weight and calls waiting */
+	m = ao2_find(q1->members, "QueueTest/1", OBJ_KEY);
+	q2->weight = 10;
+	q2->count = 1;
+	if (!m || !compare_weight(q1, m)) {
+		ast_test_status_update(test, "The member was not found in the queue with more weight\n");
+		if (m) {
+			ao2_ref(m, -1);
+		}
+		goto return_cleanup;
+	}
+	ao2_ref(m, -1);
+
+	if ((m = ao2_find(q2->members, "QueueTest/1", OBJ_KEY))) {
+		ao2_lock(q2);
+		member_remove_from_queue(q2, m);
+		ao2_unlock(q2);
+		ao2_ref(m, -1);
+	}
+	m = ao2_find(q1->members, "QueueTest/1", OBJ_KEY);
+	if (!m || compare_weight(q1, m) || update_device_status("QueueTest/1", AST_DEVICE_NOT_INUSE) != 1) {
+		ast_test_status_update(test, "A removed member was still found in its queue\n");
+		if (m) {
+			ao2_ref(m, -1);
+		}
+		goto return_cleanup;
+	}
+	ao2_ref(m, -1);
+	q2->count = 0;
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	if (q1) {
+		queue_test_destroy(q1);
+	}
+	if (q2) {
+		queue_test_destroy(q2);
+	}
+	if (update_device_status("QueueTest/1", AST_DEVICE_NOT_INUSE)) {
+		ast_test_status_update(test, "Members of destroyed queues were left in the index\n");
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Check that the dispatcher woke a caller up since the last check
+ */
+static int queue_test_woken(struct queue_ent *qe)
+{
+	char buf[16];
+	int woken = 0;
+
+	while (read(qe->wake_pipe[0], buf, sizeof(buf)) > 0) {
+		woken = 1;
+	}
+	return woken;
+}
+
+AST_TEST_DEFINE(queue_dispatch_test)
+{
+	struct call_queue *q;
+	struct queue_ent callers[3];
+	char histogram[128];
+	int i;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "queue_dispatch_test";
+		info->category = "/apps/app_queue/";
+		info->summary = "Test giving callers their turn as members become available";
+		info->description =
+			"This test ensures that the dispatcher gives as many callers from "
+			"the head of the queue their turn as there are members available, "
+			"not counting callers already calling members, that it wakes up "
+			"callers whose turn it is but not for the members they just rang, "
+			"and that its histograms are bucketed.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	memset(callers, 0, sizeof(callers));
+	for (i = 0; i < ARRAY_LEN(callers); i++) {
+		queue_wake_init(&callers[i]);
+	}
+	if (!(q = queue_test_alloc("__queue_dispatch_test"))) {
+		ast_test_status_update(test, "Failed to allocate test queue\n");
+		goto return_cleanup;
+	}
+	q->autofill = 1;
+	q->strategy = QUEUE_STRATEGY_LEASTRECENT;
+	if (queue_test_add_member(q, "QueueTest/1", NULL) || queue_test_add_member(q, "QueueTest/2", NULL)) {
+		ast_test_status_update(test, "Failed to add test members\n");
+		goto return_cleanup;
+	}
+	update_device_status("QueueTest/1", AST_DEVICE_UNAVAILABLE);
+	update_device_status("QueueTest/2", AST_DEVICE_UNAVAILABLE);
+
+	ao2_lock(q);
+	for (i = 0; i < ARRAY_LEN(callers); i++) {
+		callers[i].parent = q;
+		callers[i].pos = i + 1;
+		callers[i].next = i + 1 < ARRAY_LEN(callers) ? &callers[i + 1] : NULL;
+	}
+	q->head = &callers[0];
+	queue_dispatch(q);
+	ao2_unlock(q);
+	if (callers[0].turn || callers[1].turn || callers[2].turn || queue_test_woken(&callers[0])) {
+		ast_test_status_update(test, "A caller got its turn with no members available\n");
+		goto return_cleanup;
+	}
+
+	update_device_status("QueueTest/1", AST_DEVICE_NOT_INUSE);
+	if (!callers[0].turn || callers[1].turn || !queue_test_woken(&callers[0]) || queue_test_woken(&callers[1])) {
+		ast_test_status_update(test, "The head caller did not get its turn from the first available member\n");
+		goto return_cleanup;
+	}
+	update_device_status("QueueTest/2", AST_DEVICE_NOT_INUSE);
+	if (!callers[1].turn || callers[2].turn || !queue_test_woken(&callers[1]) || !queue_test_woken(&callers[0])) {
+		ast_test_status_update(test, "The next caller did not get its turn from the second available member\n");
+		goto return_cleanup;
+	}
+
+	/* A caller calling members leaves its member to the callers after it */
+	ao2_lock(q);
+	callers[0].pending = 1;
+	queue_dispatch(q);
+	ao2_unlock(q);
+	if (!callers[0].turn || !callers[2].turn || !queue_test_woken(&callers[2])) {
+		ast_test_status_update(test, "A caller calling members held on to its member\n");
+		goto return_cleanup;
+	}
+	update_device_status("QueueTest/1", AST_DEVICE_INUSE);
+	if (!callers[0].turn || !callers[1].turn || callers[2].turn || queue_test_woken(&callers[1])) {
+		ast_test_status_update(test, "A caller kept its turn when its member became busy\n");
+		goto return_cleanup;
+	}
+
+	/* A caller waiting to retry is not woken by the member it just rang */
+	ao2_lock(q);
+	callers[1].wake_avl = num_available_members(q);
+	callers[1].pending = 1;
+	queue_dispatch(q);
+	ao2_unlock(q);
+	update_device_status("QueueTest/2", AST_DEVICE_RINGING);
+	ao2_lock(q);
+	callers[1].pending = 0;
+	queue_dispatch(q);
+	ao2_unlock(q);
+	queue_test_woken(&callers[1]);
+	update_device_status("QueueTest/2", AST_DEVICE_NOT_INUSE);
+	if (!callers[1].turn || queue_test_woken(&callers[1])) {
+		ast_test_status_update(test, "A caller was woken by the member it just rang\n");
+		goto return_cleanup;
+	}
+	update_device_status("QueueTest/1", AST_DEVICE_NOT_INUSE);
+	if (!callers[1].turn || !queue_test_woken(&callers[1])) {
+		ast_test_status_update(test, "A caller waiting to retry was not woken by another member\n");
+		goto return_cleanup;
+	}
+
+	queue_histogram_add(q->dispatch_histogram, queue_dispatch_bounds, 0);
+	queue_histogram_add(q->dispatch_histogram, queue_dispatch_bounds, 5);
+	queue_histogram_add(q->dispatch_histogram, queue_dispatch_bounds, 499);
+	queue_histogram_add(q->dispatch_histogram, queue_dispatch_bounds, 10000);
+	queue_histogram_str(q->dispatch_histogram, queue_dispatch_bounds, histogram, sizeof(histogram));
+	if (strcmp(histogram, "1:1,5:0,10:1,50:0,100:0,500:1,inf:1")) {
+		ast_test_status_update(test, "Unexpected dispatch histogram '%s'\n", histogram);
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	if (q) {
+		ao2_lock(q);
+		q->head = NULL;
+		q->dispatch_turns = 0;
+		ao2_unlock(q);
+		queue_test_destroy(q);
+	}
+	for (i = 0; i < ARRAY_LEN(callers); i++) {
+		queue_wake_destroy(&callers[i]);
+	}
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Update the members following a device the way it was done before the
+ * member index, by searching every member of every queue.
+ */
+static int queue_bench_scan(const char *device, int state)
+{
+	struct ao2_iterator miter, qiter;
+	struct member *m;
+	struct call_queue *q;
+	char interface[80];
+	int found = 0;
+
+	qiter = ao2_iterator_init(queues, 0);
+	while ((q = ao2_t_iterator_next(&qiter, "Iterate over queues"))) {
+		ao2_lock(q);
+
+		miter = ao2_iterator_init(q->members, 0);
+		for (; (m = ao2_iterator_next(&miter)); ao2_ref(m, -1)) {
+			member_state_device(m->state_interface, interface, sizeof(interface));
+			if (!strcasecmp(interface, device)) {
+				found++;
+				update_status(q, m, state);
+				ao2_ref(m, -1);
+				break;
+			}
+		}
+		ao2_iterator_destroy(&miter);
+
+		ao2_unlock(q);
+		queue_t_unref(q, "Done with iterator");
+	}
+	ao2_iterator_destroy(&qiter);
+
+	return found;
+}
+
+static void queue_bench_run(int fd, const char *name, int (*update)(const char *, int),
+	unsigned int devices, unsigned int changes)
+{
+	char device[80];
+	struct timeval start;
+	unsigned int i, updated = 0;
+	int64_t us;
+
+	start = ast_tvnow();
+	for (i = 0; i < changes; i++) {
+		snprintf(device, sizeof(device), "QueueBench/%u", (unsigned int) ast_random() % devices);
+		updated += update(device, i & 1 ? AST_DEVICE_INUSE : AST_DEVICE_NOT_INUSE);
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+
+	ast_cli(fd, "%-6s %u changes updated %u members - %" PRIi64 " us, %.0f changes per second\n",
+		name, changes, updated, us, us ? (double) changes * 1000000 / us : 0.0);
+}
+
+static char *handle_queue_benchmark(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct call_queue **bench_queues;
+	char name[80], interface[80];
+	unsigned int num, members, changes = 10000, devices, i, j;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "queue benchmark statechange";
+		e->usage =
+			"Usage: queue benchmark statechange <queues> <members> [<changes>]\n"
+			"       Creates <queues> queues of <members> members each, with every\n"
+			"       device a member of two queues, and applies <changes> (default\n"
+			"       10000) device state changes of random devices on the calling\n"
+			"       thread.  Times searching every member of every queue for the\n"
+			"       device against looking its members up in the member index.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 2 && a->argc != e->args + 3) {
+		return CLI_SHOWUSAGE;
+	}
+	if (sscanf(a->argv[e->args], "%u", &num) != 1 || !num
+		|| sscanf(a->argv[e->args + 1], "%u", &members) != 1 || !members
+		|| (a->argc == e->args + 3 && sscanf(a->argv[e->args + 2], "%u", &changes) != 1)) {
+		return CLI_SHOWUSAGE;
+	}
+	devices = MAX(members, num * members / 2);
+
+	if (!(bench_queues = ast_calloc(num, sizeof(*bench_queues)))) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+	for (i = 0; i < num; i++) {
+		snprintf(name, sizeof(name), "__queue_benchmark_%u", i);
+		if (!(bench_queues[i] = queue_test_alloc(name))) {
+			break;
+		}
+		for (j = 0; j < members; j++) {
+			snprintf(interface, sizeof(interface), "QueueBench/%u", (i * members + j) % devices);
+			queue_test_add_member(bench_queues[i], interface, NULL);
+		}
+	}
+
+	if (i == num) {
+		ast_cli(a->fd, "Testing queue member state updates - %u queues of %u members, %u devices\n",
+			num, members, devices);
+		queue_bench_run(a->fd, "scan", queue_bench_scan, devices, changes);
+		queue_bench_run(a->fd, "index", update_device_status, devices, changes);
+	} else {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+	}
+
+	for (i = 0; i < num && bench_queues[i]; i++) {
+		queue_test_destroy(bench_queues[i]);
+	}
+	ast_free(bench_queues);
+
+	return i == num ? CLI_SUCCESS : CLI_FAILURE;
+}
+#endif /* defined(TEST_FRAMEWORK) */
+
 static struct ast_cli_entry cli_queue[] = {
 	AST_CLI_DEFINE(queue_show, "Show status of a specified queue"),
 	AST_CLI_DEFINE(handle_queue_add_member, "Add a channel to a specified queue"),
@@ -8502,6 +9354,9 @@ static struct ast_cli_entry cli_queue[] = {
 	AST_CLI_DEFINE(handle_queue_rule_show, "Show the rules defined in queuerules.conf"),
 	AST_CLI_DEFINE(handle_queue_reload, "Reload queues, members, queue rules, or parameters"),
 	AST_CLI_DEFINE(handle_queue_reset, "Reset statistics for a queue"),
+#ifdef TEST_FRAMEWORK
+	AST_CLI_DEFINE(handle_queue_benchmark, "Benchmark queue member state updates"),
+#endif
 };
 
 /* struct call_queue astdata mapping. */
@@ -8782,6 +9637,10 @@ static int unload_module(void)
 	struct call_queue *q = NULL;
 
 	ast_cli_unregister_multiple(cli_queue, ARRAY_LEN(cli_queue));
+#ifdef TEST_FRAMEWORK
+	AST_TEST_UNREGISTER(member_index_test);
+	AST_TEST_UNREGISTER(queue_dispatch_test);
+#endif
 	res = ast_manager_unregister("QueueStatus");
 	res |= ast_manager_unregister("Queues");
 	res |= ast_manager_unregister("QueueRule");
@@ -8824,6 +9683,8 @@ static int unload_module(void)
 	}
 	ao2_iterator_destroy(&q_iter);
 	ao2_ref(queues, -1);
+	ao2_ref(member_devices, -1);
+	ao2_ref(member_interfaces, -1);
 	devicestate_tps = ast_taskprocessor_unreference(devicestate_tps);
 	ast_unload_realtime("queue_members");
 	return res;
@@ -8836,6 +9697,13 @@ static int load_module(void)
 	struct ast_flags mask = {AST_FLAGS_ALL, };
 
 	queues = ao2_container_alloc(MAX_QUEUE_BUCKETS, queue_hash_cb, queue_cmp_cb);
+	member_devices = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		MEMBER_INDEX_BUCKETS, member_device_hash_fn, member_device_cmp_fn);
+	member_interfaces = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		MEMBER_INDEX_BUCKETS, member_interface_hash_fn, member_interface_cmp_fn);
+	if (!queues || !member_devices || !member_interfaces) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
 
 	use_weight = 0;
 
@@ -8854,6 +9722,10 @@ static int load_module(void)
 	ast_data_register_multiple(queue_data_providers, ARRAY_LEN(queue_data_providers));
 
 	ast_cli_register_multiple(cli_queue, ARRAY_LEN(cli_queue));
+#ifdef TEST_FRAMEWORK
+	AST_TEST_REGISTER(member_index_test);
+	AST_TEST_REGISTER(queue_dispatch_test);
+#endif
 	res = ast_register_application_xml(app, queue_exec);
 	res |= ast_register_application_xml(app_aqm, aqm_exec);
 	res |= ast_register_application_xml(app_rqm, rqm_exec);
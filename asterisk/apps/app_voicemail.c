@@ -102,6 +102,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358908 $")
 #if defined(__FreeBSD__) || defined(__OpenBSD__)
 #include <sys/wait.h>
 #endif
+#if defined(HAVE_INOTIFY) && !(defined(IMAP_STORAGE) || defined(ODBC_STORAGE))
+/*! Message counts of file storage mailboxes may be kept up to date through inotify(7) */
+#define MAILBOX_WATCH
+#include <sys/inotify.h>
+#include <fcntl.h>
+#endif
 
 #include "asterisk/logger.h"
 #include "asterisk/lock.h"
@@ -890,6 +896,71 @@ static ast_cond_t poll_cond = PTHREAD_COND_INITIALIZER;
 static pthread_t poll_thread = AST_PTHREADT_NULL;
 static unsigned char poll_thread_run;
 
+#ifdef MAILBOX_WATCH
+/*! Keep the message counts of mailboxes in memory, updated through inotify(7)
+ *  instead of polling the mailboxes. */
+static unsigned int watch_mailboxes;
+
+/*! The folders whose messages are counted in a watched mailbox */
+enum watch_folder {
+	WATCH_INBOX,
+	WATCH_OLD,
+	WATCH_URGENT,
+	WATCH_FOLDERS,
+};
+
+static const char * const watch_folder_names[WATCH_FOLDERS] = { "INBOX", "Old", "Urgent" };
+
+/*! Watched mailboxes are reconciled with the disk in this many slices, one
+ *  every pollfreq / WATCH_SLICES seconds. */
+#define WATCH_SLICES 10
+#define WATCH_BUCKETS 563
+/*! The events on a folder that may change its message count */
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+/*! Seconds to count on disk after a folder could not be watched, before trying again */
+#define WATCH_RETRY 60
+
+/*!
+ * \brief A mailbox whose message counts are kept in memory
+ *
+ * Everything but the name is protected by watch_lock.
+ */
+struct watched_mailbox {
+	int counts[WATCH_FOLDERS];   /*!< Messages in each folder */
+	int notified[WATCH_FOLDERS]; /*!< Counts last sent to the subscribers */
+	int wd[WATCH_FOLDERS];       /*!< inotify watch on each folder, -1 if not watched */
+	unsigned int subscribed;     /*!< Number of MWI subscriptions to the mailbox */
+	unsigned int slice;          /*!< Reconciliation slice of the mailbox */
+	unsigned int dirty;          /*!< Folders to recount, one bit per folder */
+	unsigned int stale:1;        /*!< Events may have been missed, recount before use */
+	unsigned int queued:1;       /*!< On the list of mailboxes to recount */
+	unsigned int pending:1;      /*!< On the list of mailboxes to send MWI for */
+	AST_LIST_ENTRY(watched_mailbox) dirty_entry;
+	AST_LIST_ENTRY(watched_mailbox) notify_entry;
+	char context[AST_MAX_CONTEXT];
+	char mailbox[AST_MAX_EXTENSION];
+};
+
+/*! \brief A watched folder, found by its inotify watch descriptor */
+struct watched_folder {
+	int wd;
+	enum watch_folder folder;
+	struct watched_mailbox *mb;
+};
+
+AST_MUTEX_DEFINE_STATIC(watch_lock);
+static int watch_fd = -1;
+static int watch_pipe[2] = { -1, -1 };
+static unsigned int watch_slice;
+/*! No folder is watched before this, after inotify ran out of watches */
+static struct timeval watch_retry;
+static unsigned int watch_failing;
+static struct ao2_container *watched_mailboxes;
+static struct ao2_container *watched_folders;
+static AST_LIST_HEAD_NOLOCK_STATIC(watch_dirty, watched_mailbox);
+static AST_LIST_HEAD_NOLOCK_STATIC(watch_notify, watched_mailbox);
+#endif
+
 /*! Subscription to ... MWI event subscriptions */
 static struct ast_event_sub *mwi_sub_sub;
 /*! Subscription to ... MWI event un-subscriptions */
@@ -5471,28 +5542,21 @@ static int messagecount(const char *context, const char *mailbox, const char *fo
 	return __has_voicemail(context, mailbox, folder, 0) + (folder && strcmp(folder, "INBOX") ? 0 : __has_voicemail(context, mailbox, "Urgent", 0));
 }
 
-static int __has_voicemail(const char *context, const char *mailbox, const char *folder, int shortcircuit)
+/*!
+ * \brief Counts the messages in a mailbox folder on disk.
+ * \param dir The folder directory.
+ * \param shortcircuit Stop at the first message, returning 1.
+ */
+static int count_folder_messages(const char *dir, int shortcircuit)
 {
-	DIR *dir;
+	DIR *d;
 	struct dirent *de;
-	char fn[256];
 	int ret = 0;
 
-	/* If no mailbox, return immediately */
-	if (ast_strlen_zero(mailbox))
+	if (!(d = opendir(dir)))
 		return 0;
 
-	if (ast_strlen_zero(folder))
-		folder = "INBOX";
-	if (ast_strlen_zero(context))
-		context = "default";
-
-	snprintf(fn, sizeof(fn), "%s%s/%s/%s", VM_SPOOL_DIR, context, mailbox, folder);
-
-	if (!(dir = opendir(fn)))
-		return 0;
-
-	while ((de = readdir(dir))) {
+	while ((de = readdir(d))) {
 		if (!strncasecmp(de->d_name, "msg", 3)) {
 			if (shortcircuit) {
 				ret = 1;
@@ -5503,11 +5567,439 @@ static int __has_voicemail(const char *context, const char *mailbox, const char
 		}
 	}
 
-	closedir(dir);
+	closedir(d);
 
 	return ret;
 }
 
+#ifdef MAILBOX_WATCH
+static int watched_mailbox_hash(const void *obj, const int flags)
+{
+	const struct watched_mailbox *mb = obj;
+
+	return ast_str_hash_add(mb->context, ast_str_hash(mb->mailbox));
+}
+
+static int watched_mailbox_cmp(void *obj, void *arg, int flags)
+{
+	struct watched_mailbox *mb = obj, *mb2 = arg;
+
+	return !strcmp(mb->mailbox, mb2->mailbox) && !strcmp(mb->context, mb2->context) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static int watched_folder_hash(const void *obj, const int flags)
+{
+	const struct watched_folder *folder = obj;
+
+	return folder->wd;
+}
+
+static int watched_folder_cmp(void *obj, void *arg, int flags)
+{
+	struct watched_folder *folder = obj, *folder2 = arg;
+
+	return folder->wd == folder2->wd ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static void watched_folder_destructor(void *obj)
+{
+	struct watched_folder *folder = obj;
+
+	ao2_ref(folder->mb, -1);
+}
+
+static int watch_folder_index(const char *folder)
+{
+	int f;
+
+	for (f = 0; f < WATCH_FOLDERS; f++) {
+		if (!strcmp(folder, watch_folder_names[f])) {
+			return f;
+		}
+	}
+	return -1;
+}
+
+/*!
+ * \internal
+ * \brief Watches a folder of a mailbox.
+ *
+ * A folder that does not exist yet is tried again on its next lookup.  On any
+ * other failure, typically running out of inotify watches, no folder is
+ * watched for WATCH_RETRY seconds and unwatched folders are counted on disk.
+ *
+ * \note Called with watch_lock held
+ */
+static void watch_add_folder(struct watched_mailbox *mb, enum watch_folder f)
+{
+	struct watched_folder *folder;
+	char dir[PATH_MAX];
+
+	if (ast_tvcmp(watch_retry, ast_tvnow()) > 0) {
+		return;
+	}
+	make_dir(dir, sizeof(dir), mb->context, mb->mailbox, watch_folder_names[f]);
+	if ((mb->wd[f] = inotify_add_watch(watch_fd, dir, WATCH_EVENTS)) < 0) {
+		if (errno == ENOENT) {
+			return;
+		}
+		if (!watch_failing) {
+			ast_log(LOG_WARNING, "Unable to watch '%s': %s.  Counting messages on disk until watches are available%s\n",
+				dir, strerror(errno), errno == ENOSPC ? ", see fs.inotify.max_user_watches" : "");
+			watch_failing = 1;
+		}
+		watch_retry = ast_tvadd(ast_tvnow(), ast_samp2tv(WATCH_RETRY, 1));
+		return;
+	}
+	if (watch_failing) {
+		ast_log(LOG_NOTICE, "Watching mailbox folders again\n");
+		watch_failing = 0;
+	}
+	if (!(folder = ao2_alloc(sizeof(*folder), watched_folder_destructor))) {
+		inotify_rm_watch(watch_fd, mb->wd[f]);
+		mb->wd[f] = -1;
+		return;
+	}
+	folder->wd = mb->wd[f];
+	folder->folder = f;
+	ao2_ref(mb, +1);
+	folder->mb = mb;
+	ao2_link(watched_folders, folder);
+	ao2_ref(folder, -1);
+}
+
+/*! \note Called with watch_lock held */
+static void watch_queue_notify(struct watched_mailbox *mb)
+{
+	if (!mb->subscribed || mb->pending || !memcmp(mb->counts, mb->notified, sizeof(mb->counts))) {
+		return;
+	}
+	mb->pending = 1;
+	ao2_ref(mb, +1);
+	AST_LIST_INSERT_TAIL(&watch_notify, mb, notify_entry);
+	if (write(watch_pipe[1], "", 1) < 0) {
+		/* The pipe is full, so the watch thread is woken already */
+	}
+}
+
+/*!
+ * \internal
+ * \brief Watches any folder of a mailbox that is not watched and recounts them all.
+ *
+ * Folders that still are not watched are counted on disk when they are looked
+ * up, and recounted here when the mailbox is reconciled.
+ *
+ * \note Called with watch_lock held
+ */
+static void watch_refresh(struct watched_mailbox *mb)
+{
+	char dir[PATH_MAX];
+	int f;
+
+	mb->stale = 0;
+	for (f = 0; f < WATCH_FOLDERS; f++) {
+		/* Watch before counting, so no message goes unnoticed in between */
+		if (mb->wd[f] < 0) {
+			watch_add_folder(mb, f);
+		}
+		make_dir(dir, sizeof(dir), mb->context, mb->mailbox, watch_folder_names[f]);
+		mb->counts[f] = count_folder_messages(dir, 0);
+	}
+	mb->dirty = 0;
+	watch_queue_notify(mb);
+}
+
+/*! \note Called with watch_lock held */
+static void watch_unlink(struct watched_mailbox *mb)
+{
+	struct watched_folder key;
+	int f;
+
+	for (f = 0; f < WATCH_FOLDERS; f++) {
+		if (mb->wd[f] < 0) {
+			continue;
+		}
+		inotify_rm_watch(watch_fd, mb->wd[f]);
+		key.wd = mb->wd[f];
+		ao2_find(watched_folders, &key, OBJ_POINTER | OBJ_UNLINK | OBJ_NODATA);
+		mb->wd[f] = -1;
+	}
+	ao2_unlink(watched_mailboxes, mb);
+}
+
+/*!
+ * \internal
+ * \brief Finds a watched mailbox, starting to watch it if needed.
+ * \param create Start watching the mailbox even if it has no directory yet,
+ *        making its folders.  A plain lookup never makes any directory.
+ * \note Called with watch_lock held
+ * \return The mailbox with a reference, or NULL if it does not exist.
+ */
+static struct watched_mailbox *watch_find(const char *context, const char *mailbox, int create)
+{
+	struct watched_mailbox *mb, key;
+	char dir[PATH_MAX];
+	int f;
+
+	if (strlen(context) >= sizeof(key.context) || strlen(mailbox) >= sizeof(key.mailbox)) {
+		return NULL;
+	}
+	strcpy(key.context, context);
+	strcpy(key.mailbox, mailbox);
+	if ((mb = ao2_find(watched_mailboxes, &key, OBJ_POINTER))) {
+		return mb;
+	}
+
+	/* Looking up a mailbox must not create it */
+	make_dir(dir, sizeof(dir), context, mailbox, "");
+	if (!create && access(dir, F_OK)) {
+		return NULL;
+	}
+
+	if (!(mb = ao2_alloc(sizeof(*mb), NULL))) {
+		return NULL;
+	}
+	strcpy(mb->context, context);
+	strcpy(mb->mailbox, mailbox);
+	for (f = 0; f < WATCH_FOLDERS; f++) {
+		mb->wd[f] = -1;
+		if (create) {
+			create_dirpath(dir, sizeof(dir), context, mailbox, watch_folder_names[f]);
+		}
+	}
+	mb->slice = watch_slice++ % WATCH_SLICES;
+	watch_refresh(mb);
+	ao2_link(watched_mailboxes, mb);
+
+	return mb;
+}
+
+static int watch_mark_stale(void *obj, void *arg, int flags)
+{
+	struct watched_mailbox *mb = obj;
+
+	mb->stale = 1;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Applies the pending inotify events to the message counts.
+ *
+ * Events are queued as the files are created, moved and removed, so once they
+ * are read the counts reflect every change made to the folders before.  Each
+ * folder with an event is recounted once, however many events it had.
+ *
+ * \note Called with watch_lock held
+ */
+static void watch_read_events(void)
+{
+	char buf[8192] __attribute__((aligned (sizeof(int))));
+	struct inotify_event *iev;
+	struct watched_folder *folder, key;
+	struct watched_mailbox *mb;
+	char dir[PATH_MAX];
+	ssize_t res;
+	char *ptr;
+	int f;
+
+	while ((res = read(watch_fd, buf, sizeof(buf))) >= (ssize_t) sizeof(*iev)) {
+		for (ptr = buf; ptr + sizeof(*iev) <= buf + res; ptr += sizeof(*iev) + iev->len) {
+			iev = (struct inotify_event *) ptr;
+			if (iev->mask & IN_Q_OVERFLOW) {
+				/* Events were lost, recount everything */
+				ao2_callback(watched_mailboxes, OBJ_NODATA, watch_mark_stale, NULL);
+				continue;
+			}
+			key.wd = iev->wd;
+			if (!(folder = ao2_find(watched_folders, &key, OBJ_POINTER))) {
+				continue;
+			}
+			mb = folder->mb;
+			if (iev->mask & IN_IGNORED) {
+				/* The folder is gone, watch it again once it is back */
+				ao2_unlink(watched_folders, folder);
+				mb->wd[folder->folder] = -1;
+				mb->stale = 1;
+				mb->dirty |= 1 << folder->folder;
+			} else if (iev->len && !strncasecmp(iev->name, "msg", 3)) {
+				mb->dirty |= 1 << folder->folder;
+			}
+			if (mb->dirty && !mb->queued) {
+				mb->queued = 1;
+				ao2_ref(mb, +1);
+				AST_LIST_INSERT_TAIL(&watch_dirty, mb, dirty_entry);
+			}
+			ao2_ref(folder, -1);
+		}
+	}
+
+	while ((mb = AST_LIST_REMOVE_HEAD(&watch_dirty, dirty_entry))) {
+		mb->queued = 0;
+		for (f = 0; f < WATCH_FOLDERS; f++) {
+			if (mb->dirty & (1 << f)) {
+				make_dir(dir, sizeof(dir), mb->context, mb->mailbox, watch_folder_names[f]);
+				mb->counts[f] = count_folder_messages(dir, 0);
+			}
+		}
+		mb->dirty = 0;
+		watch_queue_notify(mb);
+		ao2_ref(mb, -1);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Gets the message count of a folder of a watched mailbox.
+ * \retval -1 if the folder is not watched and has to be counted on disk.
+ */
+static int watched_count(const char *context, const char *mailbox, const char *folder)
+{
+	struct watched_mailbox *mb;
+	char dir[PATH_MAX];
+	int f, count = -1;
+
+	if ((f = watch_folder_index(folder)) < 0) {
+		return -1;
+	}
+
+	ast_mutex_lock(&watch_lock);
+	if (watch_fd > -1) {
+		watch_read_events();
+		if ((mb = watch_find(context, mailbox, 0))) {
+			if (mb->stale) {
+				watch_refresh(mb);
+			} else if (mb->wd[f] < 0) {
+				/* Watch and count just this folder, the others are counted already */
+				watch_add_folder(mb, f);
+				if (mb->wd[f] > -1) {
+					make_dir(dir, sizeof(dir), mb->context, mb->mailbox, watch_folder_names[f]);
+					mb->counts[f] = count_folder_messages(dir, 0);
+				}
+			}
+			if (mb->wd[f] > -1) {
+				count = mb->counts[f];
+			}
+			ao2_ref(mb, -1);
+		}
+	}
+	ast_mutex_unlock(&watch_lock);
+
+	return count;
+}
+
+/*!
+ * \brief Starts keeping the message counts of mailboxes in memory.
+ * \return zero on success, -1 if the mailboxes have to be polled instead.
+ */
+static int watch_start(void)
+{
+	int flags;
+
+	ast_mutex_lock(&watch_lock);
+	if (watch_fd > -1) {
+		ast_mutex_unlock(&watch_lock);
+		return 0;
+	}
+	if (!(watched_mailboxes = ao2_container_alloc(WATCH_BUCKETS, watched_mailbox_hash, watched_mailbox_cmp))
+		|| !(watched_folders = ao2_container_alloc(WATCH_BUCKETS * WATCH_FOLDERS, watched_folder_hash, watched_folder_cmp))
+		|| pipe(watch_pipe)) {
+		ast_log(LOG_WARNING, "Unable to watch mailboxes, polling them instead\n");
+		goto watch_failed;
+	}
+	if ((watch_fd = inotify_init()) < 0) {
+		ast_log(LOG_WARNING, "Unable to watch mailboxes, polling them instead: %s\n", strerror(errno));
+		goto watch_failed;
+	}
+	watch_retry = ast_tv(0, 0);
+	watch_failing = 0;
+	flags = fcntl(watch_fd, F_GETFL);
+	fcntl(watch_fd, F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(watch_pipe[0], F_GETFL);
+	fcntl(watch_pipe[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(watch_pipe[1], F_GETFL);
+	fcntl(watch_pipe[1], F_SETFL, flags | O_NONBLOCK);
+	ast_mutex_unlock(&watch_lock);
+
+	return 0;
+
+watch_failed:
+	if (watched_mailboxes) {
+		ao2_ref(watched_mailboxes, -1);
+		watched_mailboxes = NULL;
+	}
+	if (watched_folders) {
+		ao2_ref(watched_folders, -1);
+		watched_folders = NULL;
+	}
+	if (watch_pipe[0] > -1) {
+		close(watch_pipe[0]);
+		close(watch_pipe[1]);
+		watch_pipe[0] = watch_pipe[1] = -1;
+	}
+	ast_mutex_unlock(&watch_lock);
+	return -1;
+}
+
+/*! \brief Stops keeping the message counts of mailboxes in memory. */
+static void watch_stop(void)
+{
+	struct watched_mailbox *mb;
+
+	ast_mutex_lock(&watch_lock);
+	if (watch_fd < 0) {
+		ast_mutex_unlock(&watch_lock);
+		return;
+	}
+	while ((mb = AST_LIST_REMOVE_HEAD(&watch_dirty, dirty_entry))) {
+		mb->queued = 0;
+		ao2_ref(mb, -1);
+	}
+	while ((mb = AST_LIST_REMOVE_HEAD(&watch_notify, notify_entry))) {
+		mb->pending = 0;
+		ao2_ref(mb, -1);
+	}
+	/* Closing the inotify descriptor removes all of its watches */
+	close(watch_fd);
+	watch_fd = -1;
+	ao2_ref(watched_folders, -1);
+	watched_folders = NULL;
+	ao2_ref(watched_mailboxes, -1);
+	watched_mailboxes = NULL;
+	close(watch_pipe[0]);
+	close(watch_pipe[1]);
+	watch_pipe[0] = watch_pipe[1] = -1;
+	ast_mutex_unlock(&watch_lock);
+}
+#endif
+
+static int __has_voicemail(const char *context, const char *mailbox, const char *folder, int shortcircuit)
+{
+	char fn[PATH_MAX];
+#ifdef MAILBOX_WATCH
+	int ret;
+#endif
+
+	/* If no mailbox, return immediately */
+	if (ast_strlen_zero(mailbox))
+		return 0;
+
+	if (ast_strlen_zero(folder))
+		folder = "INBOX";
+	if (ast_strlen_zero(context))
+		context = "default";
+
+#ifdef MAILBOX_WATCH
+	if ((ret = watched_count(context, mailbox, folder)) > -1) {
+		return shortcircuit ? !!ret : ret;
+	}
+#endif
+
+	snprintf(fn, sizeof(fn), "%s%s/%s/%s", VM_SPOOL_DIR, context, mailbox, folder);
+
+	return count_folder_messages(fn, shortcircuit);
+}
+
 /** 
  * \brief Determines if the given folder has messages.
  * \param mailbox The @ delimited string for user@context. If no context is found, uses 'default' for the context.
@@ -11651,6 +12143,141 @@ static void *mb_poll_thread(void *data)
 	return NULL;
 }
 
+#ifdef MAILBOX_WATCH
+/*!
+ * \internal
+ * \brief Counts an MWI subscription to a watched mailbox, so it is sent the changes.
+ * \param box The mailbox, as mailbox@context.
+ * \param delta 1 for a new subscription, -1 when it goes away.
+ */
+static void watch_subscribe(const char *box, int delta)
+{
+	struct ast_vm_user *vmu, svm;
+	struct watched_mailbox *mb;
+	char *mailbox, *context;
+	int create = 0;
+
+	context = mailbox = ast_strdupa(box);
+	strsep(&context, "@");
+	if (ast_strlen_zero(context))
+		context = "default";
+
+	/* Mailboxes of users are watched before their first message arrives */
+	if (delta > 0 && (vmu = find_user(&svm, context, mailbox))) {
+		create = 1;
+		free_user(vmu);
+	}
+
+	ast_mutex_lock(&watch_lock);
+	if (watch_fd > -1 && (mb = watch_find(context, mailbox, create))) {
+		if (delta > 0) {
+			mb->subscribed++;
+			memcpy(mb->notified, mb->counts, sizeof(mb->notified));
+		} else if (mb->subscribed) {
+			mb->subscribed--;
+		}
+		ao2_ref(mb, -1);
+	}
+	ast_mutex_unlock(&watch_lock);
+}
+
+/*! \brief Sends MWI for the watched mailboxes whose message counts changed. */
+static void watch_notify_changed(void)
+{
+	AST_LIST_HEAD_NOLOCK(, watched_mailbox) changed;
+	struct watched_mailbox *mb;
+	int counts[WATCH_FOLDERS];
+	char box[AST_MAX_EXTENSION + AST_MAX_CONTEXT + 1];
+	unsigned int subscribed;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&changed);
+	ast_mutex_lock(&watch_lock);
+	AST_LIST_APPEND_LIST(&changed, &watch_notify, notify_entry);
+	ast_mutex_unlock(&watch_lock);
+
+	while ((mb = AST_LIST_REMOVE_HEAD(&changed, notify_entry))) {
+		ast_mutex_lock(&watch_lock);
+		mb->pending = 0;
+		memcpy(counts, mb->counts, sizeof(counts));
+		memcpy(mb->notified, mb->counts, sizeof(mb->notified));
+		subscribed = mb->subscribed;
+		ast_mutex_unlock(&watch_lock);
+
+		if (subscribed) {
+			snprintf(box, sizeof(box), "%s@%s", mb->mailbox, mb->context);
+			queue_mwi_event(box, counts[WATCH_URGENT], counts[WATCH_INBOX], counts[WATCH_OLD]);
+			run_externnotify(NULL, box, NULL);
+		}
+		ao2_ref(mb, -1);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Reconciles one slice of the watched mailboxes, and any stale one, with the disk.
+ *
+ * This catches whatever inotify cannot tell, such as a mailbox directory
+ * being replaced, and forgets mailboxes that are gone.
+ */
+static void watch_sweep(unsigned int slice)
+{
+	struct ao2_iterator i;
+	struct watched_mailbox *mb;
+	char dir[PATH_MAX];
+
+	i = ao2_iterator_init(watched_mailboxes, 0);
+	while ((mb = ao2_iterator_next(&i))) {
+		ast_mutex_lock(&watch_lock);
+		if (mb->slice == slice || mb->stale) {
+			make_dir(dir, sizeof(dir), mb->context, mb->mailbox, "");
+			if (!mb->subscribed && access(dir, F_OK)) {
+				watch_unlink(mb);
+			} else {
+				watch_refresh(mb);
+			}
+		}
+		ast_mutex_unlock(&watch_lock);
+		ao2_ref(mb, -1);
+	}
+	ao2_iterator_destroy(&i);
+}
+
+static void *mb_watch_thread(void *data)
+{
+	struct pollfd pfds[2] = {
+		{ .fd = watch_fd, .events = POLLIN, },
+		{ .fd = watch_pipe[0], .events = POLLIN, },
+	};
+	struct timeval sweep = ast_tvnow();
+	unsigned int slice = 0;
+	char buf[32];
+	int ms;
+
+	while (poll_thread_run) {
+		if ((ms = ast_tvdiff_ms(sweep, ast_tvnow())) <= 0) {
+			watch_sweep(slice);
+			slice = (slice + 1) % WATCH_SLICES;
+			ms = MAX(poll_freq * 1000 / WATCH_SLICES, 100);
+			sweep = ast_tvadd(ast_tvnow(), ast_samp2tv(ms, 1000));
+		}
+
+		if (ast_poll(pfds, ARRAY_LEN(pfds), ms) > 0) {
+			while (read(watch_pipe[0], buf, sizeof(buf)) > 0);
+			ast_mutex_lock(&watch_lock);
+			watch_read_events();
+			ast_mutex_unlock(&watch_lock);
+		}
+
+		if (!poll_thread_run)
+			break;
+
+		watch_notify_changed();
+	}
+
+	return NULL;
+}
+#endif
+
 static void mwi_sub_destroy(struct mwi_sub *mwi_sub)
 {
 	ast_free(mwi_sub);
@@ -11671,8 +12298,12 @@ static int handle_unsubscribe(void *datap)
 	AST_RWLIST_TRAVERSE_SAFE_END
 	AST_RWLIST_UNLOCK(&mwi_subs);
 
-	if (mwi_sub)
+	if (mwi_sub) {
+#ifdef MAILBOX_WATCH
+		watch_subscribe(mwi_sub->mailbox, -1);
+#endif
 		mwi_sub_destroy(mwi_sub);
+	}
 
 	ast_free(uniqueid);	
 	return 0;
@@ -11709,6 +12340,9 @@ static int handle_subscribe(void *datap)
 	ast_free((void *) p->mailbox);
 	ast_free((void *) p->context);
 	ast_free(p);
+#ifdef MAILBOX_WATCH
+	watch_subscribe(mwi_sub->mailbox, 1);
+#endif
 	poll_subscribed_mailbox(mwi_sub);
 	return 0;
 }
@@ -11754,6 +12388,11 @@ static void mwi_sub_event_cb(const struct ast_event *event, void *userdata)
 
 static void start_poll_thread(void)
 {
+#ifdef MAILBOX_WATCH
+	/* Watch before subscribing, so every subscription is counted */
+	int watching = watch_mailboxes && !watch_start();
+#endif
+
 	mwi_sub_sub = ast_event_subscribe(AST_EVENT_SUB, mwi_sub_event_cb, "Voicemail MWI subscription", NULL,
 		AST_EVENT_IE_EVENTTYPE, AST_EVENT_IE_PLTYPE_UINT, AST_EVENT_MWI,
 		AST_EVENT_IE_END);
@@ -11767,6 +12406,12 @@ static void start_poll_thread(void)
 
 	poll_thread_run = 1;
 
+#ifdef MAILBOX_WATCH
+	if (watching) {
+		ast_pthread_create(&poll_thread, NULL, mb_watch_thread, NULL);
+		return;
+	}
+#endif
 	ast_pthread_create(&poll_thread, NULL, mb_poll_thread, NULL);
 }
 
@@ -11787,10 +12432,18 @@ static void stop_poll_thread(void)
 	ast_mutex_lock(&poll_lock);
 	ast_cond_signal(&poll_cond);
 	ast_mutex_unlock(&poll_lock);
+#ifdef MAILBOX_WATCH
+	if (watch_pipe[1] > -1 && write(watch_pipe[1], "", 1) < 0) {
+		/* The pipe is full, so the watch thread is woken already */
+	}
+#endif
 
 	pthread_join(poll_thread, NULL);
 
 	poll_thread = AST_PTHREADT_NULL;
+#ifdef MAILBOX_WATCH
+	watch_stop();
+#endif
 }
 
 /*! \brief Manager list voicemail users command */
@@ -12542,6 +13195,18 @@ static int actual_load_config(int reload, struct ast_config *cfg, struct ast_con
 		if ((val = ast_variable_retrieve(cfg, "general", "pollmailboxes")))
 			poll_mailboxes = ast_true(val);
 
+#ifdef MAILBOX_WATCH
+		watch_mailboxes = 0;
+		if ((val = ast_variable_retrieve(cfg, "general", "watchmailboxes")) && ast_true(val)) {
+			watch_mailboxes = 1;
+			poll_mailboxes = 1;
+		}
+#else
+		if ((val = ast_variable_retrieve(cfg, "general", "watchmailboxes")) && ast_true(val)) {
+			ast_log(AST_LOG_WARNING, "Mailboxes cannot be watched with this storage, use pollmailboxes instead\n");
+		}
+#endif
+
 		memset(fromstring, 0, sizeof(fromstring));
 		memset(pagerfromstring, 0, sizeof(pagerfromstring));
 		strcpy(charset, "ISO-8859-1");
@@ -12673,6 +13338,11 @@ static int actual_load_config(int reload, struct ast_config *cfg, struct ast_con
 
 		AST_LIST_UNLOCK(&users);
 
+#ifdef MAILBOX_WATCH
+		/* Switch between watching and polling the mailboxes */
+		if (poll_thread != AST_PTHREADT_NULL && watch_mailboxes != (watch_fd > -1))
+			stop_poll_thread();
+#endif
 		if (poll_mailboxes && poll_thread == AST_PTHREADT_NULL)
 			start_poll_thread();
 		if (!poll_mailboxes && poll_thread != AST_PTHREADT_NULL)
@@ -13037,6 +13707,161 @@ AST_TEST_DEFINE(test_voicemail_msgcount)
 	return res;
 }
 
+#ifdef MAILBOX_WATCH
+AST_TEST_DEFINE(test_voicemail_watch)
+{
+	int res = AST_TEST_FAIL, syserr, started = 0, count;
+	struct watched_mailbox *mb = NULL;
+	char inbox[PATH_MAX], old[PATH_MAX], msg[PATH_MAX + 32], moved[PATH_MAX + 32];
+	char syscmd[PATH_MAX + 32];
+	const char testcontext[] = "test";
+	const char testmailbox[] = "00000001";
+	FILE *txt;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "test_voicemail_watch";
+		info->category = "/apps/app_voicemail/";
+		info->summary = "Test watched mailbox message counts";
+		info->description =
+			"Verify that message counts kept through inotify follow messages "
+			"being left, moved and deleted outside of app_voicemail, and that "
+			"subscribed mailboxes are queued for MWI when they change";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	snprintf(syscmd, sizeof(syscmd), "rm -rf \"%s%s/%s\"", VM_SPOOL_DIR, testcontext, testmailbox);
+	if ((syserr = ast_safe_system(syscmd))) {
+		ast_test_status_update(test, "Unable to clear test directory: %s\n",
+			syserr > 0 ? strerror(syserr) : "unable to fork()");
+		return AST_TEST_FAIL;
+	}
+
+	ast_mutex_lock(&watch_lock);
+	started = watch_fd < 0;
+	ast_mutex_unlock(&watch_lock);
+	if (started && watch_start()) {
+		ast_test_status_update(test, "Unable to watch mailboxes\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (messagecount(testcontext, testmailbox, "INBOX")) {
+		ast_test_status_update(test, "A mailbox that does not exist has messages\n");
+		goto watch_cleanup;
+	}
+	ast_mutex_lock(&watch_lock);
+	mb = watch_find(testcontext, testmailbox, 0);
+	ast_mutex_unlock(&watch_lock);
+	if (mb) {
+		ast_test_status_update(test, "Looking up a mailbox that does not exist watched it\n");
+		goto watch_cleanup;
+	}
+
+	create_dirpath(inbox, sizeof(inbox), testcontext, testmailbox, "INBOX");
+	create_dirpath(old, sizeof(old), testcontext, testmailbox, "Old");
+	if (messagecount(testcontext, testmailbox, "INBOX")) {
+		ast_test_status_update(test, "An empty mailbox has messages\n");
+		goto watch_cleanup;
+	}
+	ast_mutex_lock(&watch_lock);
+	if ((mb = watch_find(testcontext, testmailbox, 0))) {
+		mb->subscribed++;
+	}
+	ast_mutex_unlock(&watch_lock);
+	if (!mb || mb->stale) {
+		ast_test_status_update(test, "The mailbox is not watched\n");
+		goto watch_cleanup;
+	}
+	make_dir(msg, sizeof(msg), testcontext, testmailbox, "Urgent");
+	if (!access(msg, F_OK)) {
+		ast_test_status_update(test, "Looking up the mailbox made its Urgent folder\n");
+		goto watch_cleanup;
+	}
+
+	/* Leave a message the way app_voicemail does, through a temporary file */
+	snprintf(msg, sizeof(msg), "%s/msg0000.txt", inbox);
+	snprintf(moved, sizeof(moved), "%s/msg0000.txt.tmp", inbox);
+	if (!(txt = fopen(moved, "w"))) {
+		ast_test_status_update(test, "Unable to write message file '%s'\n", moved);
+		goto watch_cleanup;
+	}
+	fprintf(txt, "; just a stub\n[message]\n");
+	fclose(txt);
+	if (rename(moved, msg)) {
+		ast_test_status_update(test, "Unable to move message file '%s'\n", moved);
+		goto watch_cleanup;
+	}
+	if ((count = messagecount(testcontext, testmailbox, "INBOX")) != 1) {
+		ast_test_status_update(test, "INBOX has %d messages and we expected 1\n", count);
+		goto watch_cleanup;
+	}
+	/* Unless the watch thread runs and sent it already */
+	ast_mutex_lock(&watch_lock);
+	count = mb->pending;
+	ast_mutex_unlock(&watch_lock);
+	if (started && !count) {
+		ast_test_status_update(test, "The change to a subscribed mailbox is not sent\n");
+		goto watch_cleanup;
+	}
+
+	/* Mark it read */
+	snprintf(moved, sizeof(moved), "%s/msg0000.txt", old);
+	if (rename(msg, moved)) {
+		ast_test_status_update(test, "Unable to move message file '%s'\n", msg);
+		goto watch_cleanup;
+	}
+	if ((count = messagecount(testcontext, testmailbox, "INBOX")) || (count = messagecount(testcontext, testmailbox, "Old")) != 1) {
+		ast_test_status_update(test, "The message moved to Old is counted %d times there\n", count);
+		goto watch_cleanup;
+	}
+
+	unlink(moved);
+	if ((count = messagecount(testcontext, testmailbox, "Old"))) {
+		ast_test_status_update(test, "Old has %d messages after deleting the message\n", count);
+		goto watch_cleanup;
+	}
+
+	/* A folder removed and made again is watched again */
+	rmdir(inbox);
+	create_dirpath(inbox, sizeof(inbox), testcontext, testmailbox, "INBOX");
+	if ((txt = fopen(msg, "w"))) {
+		fclose(txt);
+	}
+	if ((count = messagecount(testcontext, testmailbox, "INBOX")) != 1) {
+		ast_test_status_update(test, "INBOX made again has %d messages and we expected 1\n", count);
+		goto watch_cleanup;
+	}
+	ast_mutex_lock(&watch_lock);
+	count = mb->wd[WATCH_INBOX];
+	ast_mutex_unlock(&watch_lock);
+	if (count < 0) {
+		ast_test_status_update(test, "INBOX made again is not watched\n");
+		goto watch_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+watch_cleanup:
+	if (mb) {
+		ast_mutex_lock(&watch_lock);
+		mb->subscribed--;
+		ast_mutex_unlock(&watch_lock);
+		ao2_ref(mb, -1);
+	}
+	if (started) {
+		watch_stop();
+	}
+	if ((syserr = ast_safe_system(syscmd))) {
+		ast_test_status_update(test, "Unable to clear test directory: %s\n",
+			syserr > 0 ? strerror(syserr) : "unable to fork()");
+	}
+
+	return res;
+}
+#endif
+
 AST_TEST_DEFINE(test_voicemail_notify_endl)
 {
 	int res = AST_TEST_PASS;
@@ -13326,6 +14151,9 @@ static int unload_module(void)
 #ifdef TEST_FRAMEWORK
 	res |= AST_TEST_UNREGISTER(test_voicemail_vmsayname);
 	res |= AST_TEST_UNREGISTER(test_voicemail_msgcount);
+#ifdef MAILBOX_WATCH
+	res |= AST_TEST_UNREGISTER(test_voicemail_watch);
+#endif
 	res |= AST_TEST_UNREGISTER(test_voicemail_vmuser);
 	res |= AST_TEST_UNREGISTER(test_voicemail_notify_endl);
 	res |= AST_TEST_UNREGISTER(test_voicemail_load_config);
@@ -13378,6 +14206,9 @@ static int load_module(void)
 #ifdef TEST_FRAMEWORK
 	res |= AST_TEST_REGISTER(test_voicemail_vmsayname);
 	res |= AST_TEST_REGISTER(test_voicemail_msgcount);
+#ifdef MAILBOX_WATCH
+	res |= AST_TEST_REGISTER(test_voicemail_watch);
+#endif
 	res |= AST_TEST_REGISTER(test_voicemail_vmuser);
 	res |= AST_TEST_REGISTER(test_voicemail_notify_endl);
 	res |= AST_TEST_REGISTER(test_voicemail_load_config);
@@ -54,6 +54,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 356573 $")
 #include "asterisk/astobj2.h"
 #include "asterisk/timing.h"
 #include "asterisk/translate.h"
+#include "asterisk/taskprocessor.h"
 
 #define MAX_DATALEN 8096
 
@@ -76,6 +77,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 356573 $")
 
 #define DEFAULT_ENERGY_HISTORY_LEN 150
 
+/*! \brief Least number of channels a worker delivers the mix to */
+#define SOFTMIX_WORKER_CHUNK 32
+
+/*! \brief Most workers the mix of a bridge is delivered by */
+#define SOFTMIX_MAX_WORKERS 8
+
 struct video_follow_talker_data {
 	/*! audio energy history */
 	int energy_history[DEFAULT_ENERGY_HISTORY_LEN];
@@ -136,12 +143,55 @@ struct softmix_stats {
 		unsigned int locked_rate;
 };
 
+struct softmix_participant {
+	struct ast_bridge_channel *bridge_channel;
+	/*! The shared translation of the mix for the channel, if it is not talking */
+	struct softmix_translate_helper_entry *entry;
+	/*! Set when the channel's own audio is to be removed from its mix */
+	int mix_out;
+};
+
 struct softmix_mixing_array {
 	int max_num_entries;
 	int used_entries;
 	int16_t **buffers;
+	/*! The channels the mix is delivered to, room for max_num_entries */
+	struct softmix_participant *participants;
+	int num_participants;
 };
 
+/*! \brief The delivery of one mix to the channels of a bridge */
+struct softmix_delivery {
+	struct softmix_participant *participants;
+	int16_t *buf;
+	enum ast_format_id slin_id;
+	unsigned int samples;
+	unsigned int datalen;
+	/*! Lock protecting pending */
+	ast_mutex_t lock;
+	/*! Signalled when the workers have delivered their chunks */
+	ast_cond_t cond;
+	/*! Number of chunks the workers have yet to deliver */
+	int pending;
+};
+
+/*! \brief A range of participants delivered by one worker */
+struct softmix_delivery_chunk {
+	struct softmix_delivery *delivery;
+	int start;
+	int end;
+};
+
+/*!
+ * \brief Workers delivering the mix of large bridges, none on a single CPU
+ *
+ * \note Each worker has a thread of its own rather than running on the shared
+ * taskprocessor pool, since the mixing thread waits for them with the bridge
+ * locked and must not queue behind tasks that block.
+ */
+static struct ast_taskprocessor *softmix_workers[SOFTMIX_MAX_WORKERS];
+static int softmix_num_workers;
+
 struct softmix_translate_helper_entry {
 	int num_times_requested; /*!< Once this entry is no longer requested, free the trans_pvt
 	                              and re-init if it was usable. */
@@ -231,55 +281,63 @@ static int16_t *softmix_process_read_audio(struct softmix_channel *sc, unsigned
 
 /*!
  * \internal
- * \brief Process a softmix channel's write audio
+ * \brief Request the shared translation of the mix to a write format
+ *
+ * \details Called for each channel that is not talking, and so receives the
+ * same mix as every other such channel.  Once more than one channel has asked
+ * for the same format, the mix is translated once for all of them.
  *
- * \details This function will remove the channel's talking from its own audio if present and
- * possibly even do the channel's write translation for it depending on how many other
- * channels use the same write format.
+ * \return The entry for the format, or NULL on allocation failure
  */
-static void softmix_process_write_audio(struct softmix_translate_helper *trans_helper,
-	struct ast_format *raw_write_fmt,
-	struct softmix_channel *sc)
+static struct softmix_translate_helper_entry *softmix_translate_helper_request(struct softmix_translate_helper *trans_helper,
+	struct ast_format *raw_write_fmt)
 {
-	struct softmix_translate_helper_entry *entry = NULL;
-	int i;
-
-	/* If we provided audio that was not determined to be silence,
-	 * then take it out while in slinear format. */
-	if (sc->have_audio && sc->talking) {
-		for (i = 0; i < sc->write_frame.samples; i++) {
-			ast_slinear_saturated_subtract(&sc->final_buf[i], &sc->our_buf[i]);
-		}
-		/* do not do any special write translate optimization if we had to make
-		 * a special mix for them to remove their own audio. */
-		return;
-	}
+	struct softmix_translate_helper_entry *entry;
 
 	AST_LIST_TRAVERSE(&trans_helper->entries, entry, entry) {
 		if (ast_format_cmp(&entry->dst_format, raw_write_fmt) == AST_FORMAT_CMP_EQUAL) {
-			entry->num_times_requested++;
-		} else {
-			continue;
-		}
-		if (!entry->trans_pvt && (entry->num_times_requested > 1)) {
-			entry->trans_pvt = ast_translator_build_path(&entry->dst_format, &trans_helper->slin_src);
-		}
-		if (entry->trans_pvt && !entry->out_frame) {
-			entry->out_frame = ast_translate(entry->trans_pvt, &sc->write_frame, 0);
-		}
-		if (entry->out_frame && (entry->out_frame->datalen < MAX_DATALEN)) {
-			ast_format_copy(&sc->write_frame.subclass.format, &entry->out_frame->subclass.format);
-			memcpy(sc->final_buf, entry->out_frame->data.ptr, entry->out_frame->datalen);
-			sc->write_frame.datalen = entry->out_frame->datalen;
-			sc->write_frame.samples = entry->out_frame->samples;
+			break;
 		}
-		break;
 	}
 
 	/* add new entry into list if this format destination was not matched. */
 	if (!entry && (entry = softmix_translate_helper_entry_alloc(raw_write_fmt))) {
 		AST_LIST_INSERT_HEAD(&trans_helper->entries, entry, entry);
 	}
+	if (entry) {
+		entry->num_times_requested++;
+	}
+	return entry;
+}
+
+/*!
+ * \internal
+ * \brief Translate the mix once for each write format shared by several channels
+ *
+ * \details After this the entries are only read until the next cleanup, so
+ * the mix may be delivered to the channels from several threads.
+ */
+static void softmix_translate_helper_translate(struct softmix_translate_helper *trans_helper,
+	int16_t *buf, unsigned int samples, unsigned int datalen)
+{
+	struct softmix_translate_helper_entry *entry;
+	struct ast_frame frame = {
+		.frametype = AST_FRAME_VOICE,
+		.data.ptr = buf,
+		.datalen = datalen,
+		.samples = samples,
+		.src = "softmix",
+	};
+
+	ast_format_copy(&frame.subclass.format, &trans_helper->slin_src);
+	AST_LIST_TRAVERSE(&trans_helper->entries, entry, entry) {
+		if (!entry->trans_pvt && (entry->num_times_requested > 1)) {
+			entry->trans_pvt = ast_translator_build_path(&entry->dst_format, &trans_helper->slin_src);
+		}
+		if (entry->trans_pvt && entry->num_times_requested && !entry->out_frame) {
+			entry->out_frame = ast_translate(entry->trans_pvt, &frame, 0);
+		}
+	}
 }
 
 static void softmix_translate_helper_cleanup(struct softmix_translate_helper *trans_helper)
@@ -713,7 +771,8 @@ static int softmix_mixing_array_init(struct softmix_mixing_array *mixing_array,
 {
 	memset(mixing_array, 0, sizeof(*mixing_array));
 	mixing_array->max_num_entries = starting_num_entries;
-	if (!(mixing_array->buffers = ast_calloc(mixing_array->max_num_entries, sizeof(int16_t *)))) {
+	if (!(mixing_array->buffers = ast_calloc(mixing_array->max_num_entries, sizeof(int16_t *)))
+		|| !(mixing_array->participants = ast_calloc(mixing_array->max_num_entries, sizeof(struct softmix_participant)))) {
 		ast_log(LOG_NOTICE, "Failed to allocate softmix mixing structure. \n");
 		return -1;
 	}
@@ -723,11 +782,13 @@ static int softmix_mixing_array_init(struct softmix_mixing_array *mixing_array,
 static void softmix_mixing_array_destroy(struct softmix_mixing_array *mixing_array)
 {
 	ast_free(mixing_array->buffers);
+	ast_free(mixing_array->participants);
 }
 
 static int softmix_mixing_array_grow(struct softmix_mixing_array *mixing_array, unsigned int num_entries)
 {
 	int16_t **tmp;
+	struct softmix_participant *participants;
 	/* give it some room to grow since memory is cheap but allocations can be expensive */
 	mixing_array->max_num_entries = num_entries;
 	if (!(tmp = ast_realloc(mixing_array->buffers, (mixing_array->max_num_entries * sizeof(int16_t *))))) {
@@ -735,24 +796,150 @@ static int softmix_mixing_array_grow(struct softmix_mixing_array *mixing_array,
 		return -1;
 	}
 	mixing_array->buffers = tmp;
+	if (!(participants = ast_realloc(mixing_array->participants, (mixing_array->max_num_entries * sizeof(*participants))))) {
+		ast_log(LOG_NOTICE, "Failed to re-allocate softmix mixing structure. \n");
+		return -1;
+	}
+	mixing_array->participants = participants;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Give a range of participants their mix and poke their threads
+ *
+ * \details The participants that are talking get the mix without their own
+ * audio, the others the shared translation of the mix to their write format
+ * if there is one, or else the mix itself.
+ */
+static void softmix_deliver(struct softmix_delivery *delivery, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		struct softmix_participant *participant = &delivery->participants[i];
+		struct ast_bridge_channel *bridge_channel = participant->bridge_channel;
+		struct softmix_channel *sc = bridge_channel->bridge_pvt;
+		struct softmix_translate_helper_entry *entry = participant->entry;
+
+		ast_mutex_lock(&sc->lock);
+
+		/* Make SLINEAR write frame from the mix */
+		if (sc->write_frame.subclass.format.id != delivery->slin_id) {
+			ast_format_set(&sc->write_frame.subclass.format, delivery->slin_id, 0);
+		}
+		sc->write_frame.datalen = delivery->datalen;
+		sc->write_frame.samples = delivery->samples;
+
+		if (participant->mix_out) {
+			/* If we provided audio that was not determined to be silence,
+			 * then take it out while in slinear format. */
+			memcpy(sc->final_buf, delivery->buf, delivery->datalen);
+			ast_slinear_saturated_subtract_buf(sc->final_buf, sc->our_buf, delivery->samples);
+		} else if (entry && entry->out_frame && (entry->out_frame->datalen < MAX_DATALEN)) {
+			ast_format_copy(&sc->write_frame.subclass.format, &entry->out_frame->subclass.format);
+			memcpy(sc->final_buf, entry->out_frame->data.ptr, entry->out_frame->datalen);
+			sc->write_frame.datalen = entry->out_frame->datalen;
+			sc->write_frame.samples = entry->out_frame->samples;
+		} else {
+			memcpy(sc->final_buf, delivery->buf, delivery->datalen);
+		}
+
+		/* The frame is now ready for use... */
+		sc->have_frame = 1;
+
+		ast_mutex_unlock(&sc->lock);
+
+		/* Poke bridged channel thread just in case */
+		pthread_kill(bridge_channel->thread, SIGURG);
+	}
+}
+
+static int softmix_deliver_task(void *data)
+{
+	struct softmix_delivery_chunk *chunk = data;
+	struct softmix_delivery *delivery = chunk->delivery;
+
+	softmix_deliver(delivery, chunk->start, chunk->end);
+
+	ast_mutex_lock(&delivery->lock);
+	if (!--delivery->pending) {
+		ast_cond_signal(&delivery->cond);
+	}
+	ast_mutex_unlock(&delivery->lock);
+
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Deliver the mix to all participants
+ *
+ * \details Large bridges are split in chunks of at least SOFTMIX_WORKER_CHUNK
+ * participants, which the workers deliver while the mixing thread does the
+ * first.  The bridge stays locked until all chunks are delivered, so no
+ * channel can leave meanwhile.
+ */
+static void softmix_deliver_all(struct softmix_delivery *delivery, int num)
+{
+	struct softmix_delivery_chunk chunks[SOFTMIX_MAX_WORKERS];
+	int num_chunks = MIN(softmix_num_workers + 1, (num + SOFTMIX_WORKER_CHUNK - 1) / SOFTMIX_WORKER_CHUNK);
+	int i, first_end;
+
+	if (num_chunks <= 1) {
+		softmix_deliver(delivery, 0, num);
+		return;
+	}
+
+	first_end = num / num_chunks;
+	delivery->pending = 0;
+	for (i = 1; i < num_chunks; i++) {
+		struct softmix_delivery_chunk *chunk = &chunks[i - 1];
+
+		chunk->delivery = delivery;
+		chunk->start = (num * i) / num_chunks;
+		chunk->end = (num * (i + 1)) / num_chunks;
+
+		ast_mutex_lock(&delivery->lock);
+		delivery->pending++;
+		ast_mutex_unlock(&delivery->lock);
+		if (ast_taskprocessor_push(softmix_workers[i - 1], softmix_deliver_task, chunk)) {
+			ast_mutex_lock(&delivery->lock);
+			delivery->pending--;
+			ast_mutex_unlock(&delivery->lock);
+			softmix_deliver(delivery, chunk->start, chunk->end);
+		}
+	}
+
+	softmix_deliver(delivery, 0, first_end);
+
+	ast_mutex_lock(&delivery->lock);
+	while (delivery->pending) {
+		ast_cond_wait(&delivery->cond, &delivery->lock);
+	}
+	ast_mutex_unlock(&delivery->lock);
+}
+
 /*! \brief Function which acts as the mixing thread */
 static int softmix_bridge_thread(struct ast_bridge *bridge)
 {
 	struct softmix_stats stats = { { 0 }, };
-	struct softmix_mixing_array mixing_array;
+	struct softmix_mixing_array mixing_array = { 0, };
 	struct softmix_bridge_data *softmix_data = bridge->bridge_pvt;
 	struct ast_timer *timer;
 	struct softmix_translate_helper trans_helper;
+	struct softmix_delivery delivery = { 0, };
 	int16_t buf[MAX_DATALEN] = { 0, };
 	unsigned int stat_iteration_counter = 0; /* counts down, gather stats at zero and reset. */
 	int timingfd;
 	int update_all_rates = 0; /* set this when the internal sample rate has changed */
-	int i, x;
+	int i;
 	int res = -1;
 
+	ast_mutex_init(&delivery.lock);
+	ast_cond_init(&delivery.cond, NULL);
+	delivery.buf = buf;
+
 	if (!(softmix_data = bridge->bridge_pvt)) {
 		goto softmix_cleanup;
 	}
@@ -793,6 +980,7 @@ static int softmix_bridge_thread(struct ast_bridge *bridge)
 		/* init the number of buffers stored in the mixing array to 0.
 		 * As buffers are added for mixing, this number is incremented. */
 		mixing_array.used_entries = 0;
+		mixing_array.num_participants = 0;
 
 		/* These variables help determine if a rate change is required */
 		if (!stat_iteration_counter) {
@@ -808,6 +996,7 @@ static int softmix_bridge_thread(struct ast_bridge *bridge)
 		/* Go through pulling audio from each factory that has it available */
 		AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
 			struct softmix_channel *sc = bridge_channel->bridge_pvt;
+			struct softmix_participant *participant;
 
 			/* Update the sample rate to match the bridge's native sample rate if necessary. */
 			if (update_all_rates) {
@@ -825,50 +1014,36 @@ static int softmix_bridge_thread(struct ast_bridge *bridge)
 			}
 
 			/* Try to get audio from the factory if available */
+			participant = &mixing_array.participants[mixing_array.num_participants++];
+			participant->bridge_channel = bridge_channel;
+			participant->entry = NULL;
 			ast_mutex_lock(&sc->lock);
 			if ((mixing_array.buffers[mixing_array.used_entries] = softmix_process_read_audio(sc, softmix_samples))) {
 				mixing_array.used_entries++;
 			}
+			/* Channels talking get a mix of their own, the others share one
+			 * translation of the mix for each write format. */
+			participant->mix_out = sc->have_audio && sc->talking;
 			ast_mutex_unlock(&sc->lock);
+			if (!participant->mix_out) {
+				participant->entry = softmix_translate_helper_request(&trans_helper, ast_channel_rawwriteformat(bridge_channel->chan));
+			}
 		}
 
 		/* mix it like crazy */
 		memset(buf, 0, softmix_datalen);
 		for (i = 0; i < mixing_array.used_entries; i++) {
-			for (x = 0; x < softmix_samples; x++) {
-				ast_slinear_saturated_add(buf + x, mixing_array.buffers[i] + x);
-			}
+			ast_slinear_saturated_add_buf(buf, mixing_array.buffers[i], softmix_samples);
 		}
 
-		/* Next step go through removing the channel's own audio and creating a good frame... */
-		AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
-			struct softmix_channel *sc = bridge_channel->bridge_pvt;
-
-			if (bridge_channel->suspended) {
-				continue;
-			}
-
-			ast_mutex_lock(&sc->lock);
-
-			/* Make SLINEAR write frame from local buffer */
-			if (sc->write_frame.subclass.format.id != cur_slin_id) {
-				ast_format_set(&sc->write_frame.subclass.format, cur_slin_id, 0);
-			}
-			sc->write_frame.datalen = softmix_datalen;
-			sc->write_frame.samples = softmix_samples;
-			memcpy(sc->final_buf, buf, softmix_datalen);
-
-			/* process the softmix channel's new write audio */
-			softmix_process_write_audio(&trans_helper, ast_channel_rawwriteformat(bridge_channel->chan), sc);
-
-			/* The frame is now ready for use... */
-			sc->have_frame = 1;
-
-			ast_mutex_unlock(&sc->lock);
+		softmix_translate_helper_translate(&trans_helper, buf, softmix_samples, softmix_datalen);
 
-			/* Poke bridged channel thread just in case */
-			pthread_kill(bridge_channel->thread, SIGURG);
-		}
+		/* Next step go through removing the channel's own audio and creating a good frame... */
+		delivery.participants = mixing_array.participants;
+		delivery.slin_id = cur_slin_id;
+		delivery.samples = softmix_samples;
+		delivery.datalen = softmix_datalen;
+		softmix_deliver_all(&delivery, mixing_array.num_participants);
 
 		update_all_rates = 0;
 		if (!stat_iteration_counter) {
@@ -898,6 +1073,8 @@ static int softmix_bridge_thread(struct ast_bridge *bridge)
 softmix_cleanup:
 	softmix_translate_helper_destroy(&trans_helper);
 	softmix_mixing_array_destroy(&mixing_array);
+	ast_mutex_destroy(&delivery.lock);
+	ast_cond_destroy(&delivery.cond);
 	if (softmix_data) {
 		ao2_ref(softmix_data, -1);
 	}
@@ -917,16 +1094,47 @@ static struct ast_bridge_technology softmix_bridge = {
 	.poke = softmix_bridge_poke,
 };
 
+static void softmix_workers_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < softmix_num_workers; i++) {
+		softmix_workers[i] = ast_taskprocessor_unreference(softmix_workers[i]);
+	}
+	softmix_num_workers = 0;
+}
+
+static int softmix_workers_create(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	char name[32];
+	int num = MIN(MAX(cpus - 1, 0), SOFTMIX_MAX_WORKERS);
+
+	for (softmix_num_workers = 0; softmix_num_workers < num; softmix_num_workers++) {
+		snprintf(name, sizeof(name), "softmix/worker-%d", softmix_num_workers);
+		if (!(softmix_workers[softmix_num_workers] = ast_taskprocessor_get(name, TPS_REF_DEFAULT))) {
+			softmix_workers_destroy();
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int unload_module(void)
 {
 	ast_format_cap_destroy(softmix_bridge.format_capabilities);
+	softmix_workers_destroy();
 	return ast_bridge_technology_unregister(&softmix_bridge);
 }
 
 static int load_module(void)
 {
 	struct ast_format tmp;
+	if (softmix_workers_create()) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
 	if (!(softmix_bridge.format_capabilities = ast_format_cap_alloc())) {
+		softmix_workers_destroy();
 		return AST_MODULE_LOAD_DECLINE;
 	}
 	ast_format_cap_add(softmix_bridge.format_capabilities, ast_format_set(&tmp, AST_FORMAT_SLINEAR, 0));
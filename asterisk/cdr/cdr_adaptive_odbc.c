@@ -74,6 +74,9 @@ struct tables {
 	char *table;
 	char *schema;
 	unsigned int usegmtime:1;
+	unsigned int backslash_is_escape:1;
+	/*! Writes the records in batches, if set */
+	struct odbc_batch *batch;
 	AST_LIST_HEAD_NOLOCK(odbc_columns, columns) columns;
 	AST_RWLIST_ENTRY(tables) list;
 };
@@ -93,6 +96,9 @@ static int load_config(void)
 	char table[40];
 	char schema[40];
 	int lenconnection, lentable, lenschema, usegmtime = 0;
+	unsigned int batch_size, batch_latency, batch_retries;
+	int batch_multirow;
+	char batch_name[80];
 	SQLLEN sqlptr;
 	int res = 0;
 	SQLHSTMT stmt = NULL;
@@ -120,6 +126,29 @@ static int load_config(void)
 			usegmtime = ast_true(tmp);
 		}
 
+		batch_size = 0;
+		if (!ast_strlen_zero(tmp = ast_variable_retrieve(cfg, catg, "batch_size"))
+			&& sscanf(tmp, "%30u", &batch_size) != 1) {
+			ast_log(LOG_WARNING, "Invalid batch_size '%s' in '%s'.  Not writing in batches.\n", tmp, catg);
+			batch_size = 0;
+		}
+		batch_latency = 1000;
+		if (!ast_strlen_zero(tmp = ast_variable_retrieve(cfg, catg, "batch_latency"))
+			&& sscanf(tmp, "%30u", &batch_latency) != 1) {
+			ast_log(LOG_WARNING, "Invalid batch_latency '%s' in '%s'.  Using 1000.\n", tmp, catg);
+			batch_latency = 1000;
+		}
+		batch_retries = 3;
+		if (!ast_strlen_zero(tmp = ast_variable_retrieve(cfg, catg, "batch_retries"))
+			&& sscanf(tmp, "%30u", &batch_retries) != 1) {
+			ast_log(LOG_WARNING, "Invalid batch_retries '%s' in '%s'.  Using 3.\n", tmp, catg);
+			batch_retries = 3;
+		}
+		batch_multirow = 1;
+		if (!ast_strlen_zero(tmp = ast_variable_retrieve(cfg, catg, "batch_multirow"))) {
+			batch_multirow = ast_true(tmp);
+		}
+
 		/* When loading, we want to be sure we can connect. */
 		obj = ast_odbc_request_obj(connection, 1);
 		if (!obj) {
@@ -166,6 +195,7 @@ static int load_config(void)
 		}
 
 		tableptr->usegmtime = usegmtime;
+		tableptr->backslash_is_escape = ast_odbc_backslash_is_escape(obj) ? 1 : 0;
 		tableptr->connection = (char *)tableptr + sizeof(*tableptr);
 		tableptr->table = (char *)tableptr + sizeof(*tableptr) + lenconnection + 1;
 		tableptr->schema = (char *)tableptr + sizeof(*tableptr) + lenconnection + 1 + lentable + 1;
@@ -281,9 +311,18 @@ static int load_config(void)
 		SQLFreeHandle(SQL_HANDLE_STMT, stmt);
 		ast_odbc_release_obj(obj);
 
-		if (AST_LIST_FIRST(&(tableptr->columns)))
+		if (AST_LIST_FIRST(&(tableptr->columns))) {
+			if (batch_size) {
+				snprintf(batch_name, sizeof(batch_name), "cdr_adaptive_odbc-%s", catg);
+				if ((tableptr->batch = ast_odbc_batch_create(connection, batch_name, batch_size,
+					batch_latency, batch_retries, batch_multirow))) {
+					ast_verb(3, "Writing CDRs to %s@%s in batches of %u\n", tableptr->table, tableptr->connection, batch_size);
+				} else {
+					ast_log(LOG_WARNING, "Unable to write CDRs to %s@%s in batches.  Writing them one by one.\n", tableptr->table, tableptr->connection);
+				}
+			}
 			AST_RWLIST_INSERT_TAIL(&odbc_tables, tableptr, list);
-		else
+		} else
 			ast_free(tableptr);
 	}
 	return res;
@@ -294,6 +333,9 @@ static int free_config(void)
 	struct tables *table;
 	struct columns *entry;
 	while ((table = AST_RWLIST_REMOVE_HEAD(&odbc_tables, list))) {
+		if (table->batch) {
+			ast_odbc_batch_destroy(table->batch);
+		}
 		while ((entry = AST_LIST_REMOVE_HEAD(&(table->columns), list))) {
 			ast_free(entry);
 		}
@@ -398,7 +440,8 @@ static int odbc_log(struct ast_cdr *cdr)
 		ast_str_set(&sql2, 0, " VALUES (");
 
 		/* No need to check the connection now; we'll handle any failure in prepare_and_execute */
-		if (!(obj = ast_odbc_request_obj(tableptr->connection, 0))) {
+		obj = NULL;
+		if (!tableptr->batch && !(obj = ast_odbc_request_obj(tableptr->connection, 0))) {
 			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Unable to retrieve database handle for '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, ast_str_buffer(sql));
 			continue;
 		}
@@ -482,7 +525,7 @@ static int odbc_log(struct ast_cdr *cdr)
 					for (tmp = colptr; *tmp; tmp++) {
 						if (*tmp == '\'') {
 							ast_str_append(&sql2, 0, "''");
-						} else if (*tmp == '\\' && ast_odbc_backslash_is_escape(obj)) {
+						} else if (*tmp == '\\' && (obj ? ast_odbc_backslash_is_escape(obj) : tableptr->backslash_is_escape)) {
 							ast_str_append(&sql2, 0, "\\\\");
 						} else {
 							ast_str_append(&sql2, 0, "%c", *tmp);
@@ -713,6 +756,16 @@ static int odbc_log(struct ast_cdr *cdr)
 			}
 		}
 
+		if (tableptr->batch) {
+			/* The batch thread puts the statement together, pass the values without " VALUES ". */
+			ast_str_append(&sql, 0, ")");
+			ast_str_append(&sql2, 0, ")");
+			if (ast_odbc_batch_add(tableptr->batch, ast_str_buffer(sql), ast_str_buffer(sql2) + strlen(" VALUES "))) {
+				ast_log(LOG_WARNING, "cdr_adaptive_odbc: Unable to queue CDR for '%s:%s'\n", tableptr->connection, tableptr->table);
+			}
+			continue;
+		}
+
 		/* Concatenate the two constructed buffers */
 		LENGTHEN_BUF1(ast_str_strlen(sql2));
 		ast_str_append(&sql, 0, ")");
@@ -730,7 +783,9 @@ static int odbc_log(struct ast_cdr *cdr)
 			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert failed on '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, ast_str_buffer(sql));
 		}
 early_release:
-		ast_odbc_release_obj(obj);
+		if (obj) {
+			ast_odbc_release_obj(obj);
+		}
 	}
 	AST_RWLIST_UNLOCK(&odbc_tables);
 
@@ -67,6 +67,11 @@
  * sipsock_read() function parses the packet and matches an existing
  * dialog or starts a new SIP dialog.
  *
+ * When udpthreads is set in sip.conf, sipsock_read() only reads the
+ * datagram and hands it to one of a pool of receive workers chosen by a
+ * hash of the Call-ID, so all packets for one dialog are processed in order
+ * by the same worker while different dialogs are processed in parallel.
+ *
  * sipsock_read sends the packet to handle_incoming(), that parses a bit more.
  * If it is a response to an outbound request, the packet is sent to handle_response().
  * If it is a request, handle_incoming() sends it to one of a list of functions
@@ -265,6 +270,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359651 $")
 #include "asterisk/data.h"
 #include "asterisk/aoc.h"
 #include "asterisk/message.h"
+#include "asterisk/taskprocessor.h"
 #include "sip/include/sip.h"
 #include "sip/include/globals.h"
 #include "sip/include/config_parser.h"
@@ -277,6 +283,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359651 $")
 #include "sip/include/dialog.h"
 #include "sip/include/dialplan_functions.h"
 #include "sip/include/security_events.h"
+#include "sip/include/timer_wheel.h"
 
 
 /*** DOCUMENTATION
@@ -537,6 +544,18 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359651 $")
 			events followed by a final event called <literal>RegistrationsComplete</literal>.</para>
 		</description>
 	</manager>
+	<manager name="SIPshowtimers" language="en_US">
+		<synopsis>
+			Show SIP retransmission timer statistics.
+		</synopsis>
+		<syntax>
+			<xi:include xpointer="xpointer(/docs/manager[@name='Login']/syntax/parameter[@name='ActionID'])" />
+		</syntax>
+		<description>
+			<para>Shows how many packet retransmission timers are scheduled, how many have fired,
+			and how late they fired.  Lag is given in milliseconds.</para>
+		</description>
+	</manager>
 	<manager name="SIPnotify" language="en_US">
 		<synopsis>
 			Send a SIP notify.
@@ -782,6 +801,27 @@ static char used_context[AST_MAX_CONTEXT];        /*!< name of automatically cre
 
 AST_MUTEX_DEFINE_STATIC(netlock);
 
+/*! \brief UDP receive workers (sip.conf udpthreads)
+ *
+ * Packets are assigned to a worker by a hash of their Call-ID.  The same hash
+ * selects the dialog lock taken around find_call() in handle_request_do(), so
+ * each worker normally only ever takes its own lock.  Without workers, all
+ * requests are serialized on netlock as before.
+ * \note The number of workers is only changed when the module is loaded.
+ * The dialog locks live as long as the module, since a TCP thread may still
+ * be about to take one after the workers stopped.
+ */
+static int global_udp_threads = DEFAULT_UDP_THREADS;  /*!< Configured number of UDP receive workers */
+static int sip_udp_threads;                           /*!< Number of UDP receive workers running */
+static struct ast_taskprocessor *sip_udp_workers[MAX_UDP_THREADS];
+static ast_mutex_t sip_dialog_locks[MAX_UDP_THREADS];
+
+/*! \brief A UDP packet queued by sipsock_read() to a receive worker */
+struct sip_udp_packet {
+	struct ast_sockaddr addr;   /*!< Source address */
+	struct ast_str *data;       /*!< Packet contents, handed to the request */
+};
+
 /*! \brief Protect the monitoring thread, so only one process can kill or start it, and not
    when it's doing something critical. */
 AST_MUTEX_DEFINE_STATIC(monlock);
@@ -796,6 +836,7 @@ static int sip_reloading = FALSE;                       /*!< Flag for avoiding m
 static enum channelreloadreason sip_reloadreason;       /*!< Reason for last reload/load of configuration */
 
 struct ast_sched_context *sched;     /*!< The scheduling context */
+static struct sip_timer_wheel *sip_timers; /*!< Millisecond timers for packet retransmission */
 static struct io_context *io;           /*!< The IO context */
 static int *sipsock_read_id;            /*!< ID of IO entry for sipsock FD */
 struct sip_pkt;
@@ -1155,16 +1196,19 @@ AST_MUTEX_DEFINE_STATIC(authl_lock);
  * requests), the udp io handler (sipsock_read()) and the user routines that
  * issue udp writes (using __sip_xmit()).
  * The socket is -1 only when opening fails (this is a permanent condition),
- * or when we are handling a reload() that changes its address (this is
- * a transient situation during which we might have a harmless race, see
- * below). Because the conditions for the race to be possible are extremely
- * rare, we don't want to pay the cost of locking on every I/O.
- * Rather, we remember that when the race may occur, communication is
- * bound to fail anyways, so we just live with this event and let
- * the protocol handle this above us.
+ * or when we are handling a reload() that changes its address.
+ * Writes take sipsock_lock for reading, so that they never use a socket
+ * the reload has closed, and communication during the change is left to
+ * the protocol above us to retry.
  */
 static int sipsock  = -1;
 
+/*! \brief Held for writing by reload_config() while it replaces sipsock
+ *
+ * UDP receive workers send responses while the monitor thread reloads.
+ */
+AST_RWLOCK_DEFINE_STATIC(sipsock_lock);
+
 struct ast_sockaddr bindaddr;	/*!< UDP: The address we bind to */
 
 /*! \brief our (internal) default address/port to put in SIP/SDP messages
@@ -3011,7 +3055,7 @@ void dialog_unlink_all(struct sip_pvt *dialog)
 	/* remove all current packets in this dialog */
 	while((cp = dialog->packets)) {
 		dialog->packets = dialog->packets->next;
-		AST_SCHED_DEL(sched, cp->retransid);
+		SIP_TIMER_WHEEL_DEL(sip_timers, cp->retransid);
 		dialog_unref(cp->owner, "remove all current packets in this dialog, and the pointer to the dialog too as part of __sip_destroy");
 		if (cp->data) {
 			ast_free(cp->data);
@@ -3373,7 +3417,10 @@ static int __sip_xmit(struct sip_pvt *p, struct ast_str *data)
 	}
 
 	if (p->socket.type == SIP_TRANSPORT_UDP) {
-		res = ast_sendto(p->socket.fd, data->str, ast_str_strlen(data), 0, dst);
+		/* p->socket.fd may be a socket a reload has closed since. */
+		ast_rwlock_rdlock(&sipsock_lock);
+		res = ast_sendto(sipsock, data->str, ast_str_strlen(data), 0, dst);
+		ast_rwlock_unlock(&sipsock_lock);
 	} else if (p->socket.tcptls_session) {
 		res = sip_tcptls_write(p->socket.tcptls_session, data->str, ast_str_strlen(data));
 	} else {
@@ -3571,7 +3618,7 @@ static void append_history_full(struct sip_pvt *p, const char *fmt, ...)
 	return;
 }
 
-/*! \brief Retransmit SIP message if no answer (Called from scheduler) */
+/*! \brief Retransmit SIP message if no answer (Called from the transaction timer wheel) */
 static int retrans_pkt(const void *data)
 {
 	struct sip_pkt *pkt = (struct sip_pkt *)data, *prev, *cur = NULL;
@@ -3659,7 +3706,7 @@ static int retrans_pkt(const void *data)
 	/* At this point, either the packet's retransmission timed out, or there was a
 	 * transmission error, either way destroy the scheduler item and this packet. */
 
-	pkt->retransid = -1; /* Kill this scheduler item */
+	pkt->retransid = -1; /* Kill this timer */
 
 	if (pkt->owner && pkt->method != SIP_OPTIONS && xmitres == 0) {
 		if (pkt->is_fatal || sipdebug) { /* Tell us if it's critical or if we're debugging */
@@ -3821,7 +3868,7 @@ static enum sip_result __sip_reliable_xmit(struct sip_pvt *p, uint32_t seqno, in
 	pkt->retrans_stop_time = 64 * (pkt->timer_t1 ? pkt->timer_t1 : DEFAULT_TIMER_T1); /* time in ms after pkt->time_sent to stop retransmission */
 
 	/* Schedule retransmission */
-	AST_SCHED_REPLACE_VARIABLE(pkt->retransid, sched, siptimer_a, retrans_pkt, pkt, 1);
+	pkt->retransid = sip_timer_wheel_add(sip_timers, siptimer_a, retrans_pkt, pkt);
 	if (sipdebug) {
 		ast_debug(4, "*** SIP TIMER: Initializing retransmit timer on packet: Id  #%d\n", pkt->retransid);
 	}
@@ -3831,20 +3878,13 @@ static enum sip_result __sip_reliable_xmit(struct sip_pvt *p, uint32_t seqno, in
 	if (xmitres == XMIT_ERROR) {	/* Serious network trouble, no need to try again */
 		append_history(pkt->owner, "XmitErr", "%s", pkt->is_fatal ? "(Critical)" : "(Non-critical)");
 		ast_log(LOG_ERROR, "Serious Network Trouble; __sip_xmit returns error for pkt data\n");
-		AST_SCHED_DEL(sched, pkt->retransid);
+		SIP_TIMER_WHEEL_DEL(sip_timers, pkt->retransid);
 		p->packets = pkt->next;
 		pkt->owner = dialog_unref(pkt->owner,"pkt is being freed, its dialog ref is dead now");
 		ast_free(pkt->data);
 		ast_free(pkt);
 		return AST_FAILURE;
 	} else {
-		/* This is odd, but since the retrans timer starts at 500ms and the do_monitor thread
-		 * only wakes up every 1000ms by default, we have to poke the thread here to make
-		 * sure it successfully detects this must be retransmitted in less time than
-		 * it usually sleeps for. Otherwise it might not retransmit this packet for 1000ms. */
-		if (monitor_thread != AST_PTHREADT_NULL) {
-			pthread_kill(monitor_thread, SIGURG);
-		}
 		return AST_SUCCESS;
 	}
 }
@@ -4036,7 +4076,7 @@ int __sip_ack(struct sip_pvt *p, uint32_t seqno, int resp, int sipmethod)
 			 * the packet's retransid will be set to -1. The atomicity of the setting and checking
 			 * of the retransid to -1 is ensured since in both cases p's lock is held.
 			 */
-			while (cur->retransid > -1 && ast_sched_del(sched, cur->retransid)) {
+			while (cur->retransid > -1 && sip_timer_wheel_del(sip_timers, cur->retransid)) {
 				sip_pvt_unlock(p);
 				usleep(1);
 				sip_pvt_lock(p);
@@ -4087,7 +4127,7 @@ int __sip_semi_ack(struct sip_pvt *p, uint32_t seqno, int resp, int sipmethod)
 				if (sipdebug)
 					ast_debug(4, "*** SIP TIMER: Cancelling retransmission #%d - %s (got response)\n", cur->retransid, sip_methods[sipmethod].text);
 			}
-			AST_SCHED_DEL(sched, cur->retransid);
+			SIP_TIMER_WHEEL_DEL(sip_timers, cur->retransid);
 			res = TRUE;
 			break;
 		}
@@ -17268,6 +17308,35 @@ static char *sip_show_users(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 #undef FORMAT
 }
 
+/*! \brief Show SIP retransmission timer statistics in the manager API */
+static int manager_sip_show_timers(struct mansession *s, const struct message *m)
+{
+	const char *id = astman_get_header(m, "ActionID");
+	char idtext[256] = "";
+	struct sip_timer_wheel_stats stats;
+
+	if (!ast_strlen_zero(id))
+		snprintf(idtext, sizeof(idtext), "ActionID: %s\r\n", id);
+
+	sip_timer_wheel_get_stats(sip_timers, &stats);
+	astman_append(s, "Response: Success\r\n"
+		"%s"
+		"Scheduled: %u\r\n"
+		"Fired: %u\r\n"
+		"FiredLate: %u\r\n"
+		"AverageLag: %ld\r\n"
+		"MaximumLag: %ld\r\n"
+		"\r\n",
+		idtext,
+		stats.scheduled,
+		stats.fired,
+		stats.late,
+		stats.fired ? (long) (stats.total_lag / stats.fired) : 0L,
+		(long) stats.max_lag);
+
+	return 0;
+}
+
 /*! \brief Show SIP registrations in the manager API */
 static int manager_show_registry(struct mansession *s, const struct message *m)
 {
@@ -18520,8 +18589,8 @@ static char *sip_show_user(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 static char *sip_show_sched(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	struct ast_str *cbuf;
-	struct ast_cb_names cbnames = {9, { "retrans_pkt",
-                                        "__sip_autodestruct",
+	struct sip_timer_wheel_stats stats;
+	struct ast_cb_names cbnames = {8, { "__sip_autodestruct",
                                         "expire_register",
                                         "auto_congest",
                                         "sip_reg_timeout",
@@ -18529,8 +18598,7 @@ static char *sip_show_sched(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
                                         "sip_poke_noanswer",
                                         "sip_reregister",
                                         "sip_reinvite_retry"},
-								   { retrans_pkt,
-                                     __sip_autodestruct,
+								   { __sip_autodestruct,
                                      expire_register,
                                      auto_congest,
                                      sip_reg_timeout,
@@ -18544,7 +18612,8 @@ static char *sip_show_sched(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 		e->command = "sip show sched";
 		e->usage =
 			"Usage: sip show sched\n"
-			"       Shows stats on what's in the sched queue at the moment\n";
+			"       Shows stats on what's in the sched queue at the moment,\n"
+			"       and on the timers used for packet retransmission\n";
 		return NULL;
 	case CLI_GENERATE:
 		return NULL;
@@ -18556,6 +18625,15 @@ static char *sip_show_sched(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 	ast_sched_report(sched, &cbuf, &cbnames);
 	ast_cli(a->fd, "%s", cbuf->str);
 
+	sip_timer_wheel_get_stats(sip_timers, &stats);
+	ast_cli(a->fd, "Retransmission timers\n");
+	ast_cli(a->fd, "=====================\n");
+	ast_cli(a->fd, "  Scheduled:          %u\n", stats.scheduled);
+	ast_cli(a->fd, "  Fired:              %u\n", stats.fired);
+	ast_cli(a->fd, "  Fired late:         %u\n", stats.late);
+	ast_cli(a->fd, "  Average lag:        %ld ms\n", stats.fired ? (long) (stats.total_lag / stats.fired) : 0L);
+	ast_cli(a->fd, "  Maximum lag:        %ld ms\n", (long) stats.max_lag);
+
 	return CLI_SUCCESS;
 }
 
@@ -18779,6 +18857,7 @@ static char *sip_show_settings(struct ast_cli_entry *e, int cmd, struct ast_cli_
 		ast_cli(a->fd, "  ** Additional Info:\n");
 		ast_cli(a->fd, "     [::] may include IPv4 in addition to IPv6, if such a feature is enabled in the OS.\n");
 	}
+	ast_cli(a->fd, "  UDP receive workers:    %d\n", sip_udp_threads);
 	ast_cli(a->fd, "  TCP SIP Bindaddress:    %s\n",
 		sip_cfg.tcp_enabled != FALSE ?
 				ast_sockaddr_stringify(&sip_tcp_desc.local_address) :
@@ -24628,7 +24707,7 @@ static int handle_request_cancel(struct sip_pvt *p, struct sip_request *req)
 		 */
 		for (pkt = p->packets, prev_pkt = NULL; pkt; prev_pkt = pkt, pkt = pkt->next) {
 			if (pkt->seqno == p->lastinvite && pkt->response_code == 487) {
-				AST_SCHED_DEL(sched, pkt->retransid);
+				SIP_TIMER_WHEEL_DEL(sip_timers, pkt->retransid);
 				UNLINK(pkt, p->packets, prev_pkt);
 				dialog_unref(pkt->owner, "unref packet->owner from dialog");
 				if (pkt->data) {
@@ -26303,10 +26382,221 @@ static int handle_incoming(struct sip_pvt *p, struct sip_request *req, struct as
 	return res;
 }
 
+/*! \brief Fill in the socket data of a request received on the UDP socket */
+static void set_udp_socket_data(struct sip_request *req)
+{
+	req->socket.fd = sipsock;
+	set_socket_transport(&req->socket, SIP_TRANSPORT_UDP);
+	req->socket.tcptls_session	= NULL;
+	req->socket.port = htons(ast_sockaddr_port(&bindaddr));
+}
+
+/*! \brief Return the lock serializing dialog lookups for a Call-ID hash */
+static ast_mutex_t *sip_dialog_lock(int callid_hash)
+{
+	int threads = sip_udp_threads;
+
+	if (!threads) {
+		return &netlock;
+	}
+	return &sip_dialog_locks[(unsigned int) callid_hash % threads];
+}
+
+/*! \brief Hash the Call-ID of a raw SIP message without parsing it
+ *
+ * The result matches ast_str_hash() of the header value returned by
+ * sip_get_header() once the message has been parsed.
+ *
+ * \return the hash, or 0 if the message has no Call-ID header.
+ */
+static int sip_raw_callid_hash(const char *buf)
+{
+	char callid[256];
+	const char *line;
+	const char *value;
+	const char *end;
+
+	for (line = strchr(buf, '\n'); line; line = strchr(line, '\n')) {
+		line++;
+		if (*line == '\r' || *line == '\n' || *line == '\0') {
+			/* End of the headers */
+			break;
+		}
+		if (!strncasecmp(line, "Call-ID", 7)) {
+			value = line + 7;
+		} else if (*line == 'i' || *line == 'I') {
+			/* Compact form */
+			value = line + 1;
+		} else {
+			continue;
+		}
+		while (*value == ' ' || *value == '\t') {
+			value++;
+		}
+		if (*value != ':') {
+			continue;
+		}
+		value = ast_skip_blanks(value + 1);
+		for (end = value; *end && *end != '\r' && *end != '\n'; end++);
+		while (end > value && isspace(end[-1])) {
+			end--;
+		}
+		ast_copy_string(callid, value, MIN(end - value + 1, sizeof(callid)));
+		return ast_str_hash(callid);
+	}
+	return 0;
+}
+
+/*! \brief Receive worker task: handle one UDP packet read by sipsock_read() */
+static int sip_udp_packet_process(void *data)
+{
+	struct sip_udp_packet *packet = data;
+	struct sip_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.data = packet->data;
+	set_udp_socket_data(&req);
+
+	handle_request_do(&req, &packet->addr);
+	deinit_req(&req);
+	ast_free(packet);
+
+	return 0;
+}
+
+/*! \brief Queue a UDP packet to the receive worker owning its Call-ID */
+static int sip_udp_packet_dispatch(const char *buf, const struct ast_sockaddr *addr)
+{
+	struct sip_udp_packet *packet;
+	int threads = sip_udp_threads;
+
+	if (!(packet = ast_calloc(1, sizeof(*packet)))) {
+		return -1;
+	}
+	if (!(packet->data = ast_str_create(SIP_MIN_PACKET))
+		|| ast_str_set(&packet->data, 0, "%s", buf) == AST_DYNSTR_BUILD_FAILED) {
+		ast_free(packet->data);
+		ast_free(packet);
+		return -1;
+	}
+	ast_sockaddr_copy(&packet->addr, addr);
+
+	if (!threads || ast_taskprocessor_push(sip_udp_workers[(unsigned int) sip_raw_callid_hash(buf) % threads],
+		sip_udp_packet_process, packet)) {
+		ast_free(packet->data);
+		ast_free(packet);
+		return -1;
+	}
+	return 0;
+}
+
+/*! \brief Initialize the dialog locks, once for the life of the module */
+static void sip_dialog_locks_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(sip_dialog_locks); i++) {
+		ast_mutex_init(&sip_dialog_locks[i]);
+	}
+}
+
+/*! \brief Destroy the dialog locks, once the TCP threads are gone */
+static void sip_dialog_locks_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(sip_dialog_locks); i++) {
+		ast_mutex_destroy(&sip_dialog_locks[i]);
+	}
+}
+
+/*! \brief Start the UDP receive workers configured with udpthreads */
+static int sip_udp_workers_start(void)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < global_udp_threads; i++) {
+		snprintf(name, sizeof(name), "SIP/udp-%d", i);
+		if (!(sip_udp_workers[i] = ast_taskprocessor_get(name, TPS_REF_DEFAULT))) {
+			ast_log(LOG_ERROR, "Unable to create SIP UDP receive worker %d\n", i);
+			break;
+		}
+	}
+	sip_udp_threads = i;
+	if (sip_udp_threads) {
+		ast_verb(2, "SIP handling UDP packets on %d receive worker(s)\n", sip_udp_threads);
+	}
+
+	return sip_udp_threads == global_udp_threads ? 0 : -1;
+}
+
+/*! \brief Packets still queued to the UDP receive workers while they stop */
+struct sip_udp_drain {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	int pending;    /*!< Workers that have not reached the drain task yet */
+};
+
+/*! \brief Receive worker task queued behind all the packets of the worker */
+static int sip_udp_drain_task(void *data)
+{
+	struct sip_udp_drain *drain = data;
+
+	ast_mutex_lock(&drain->lock);
+	if (!--drain->pending) {
+		ast_cond_signal(&drain->cond);
+	}
+	ast_mutex_unlock(&drain->lock);
+
+	return 0;
+}
+
+/*! \brief Stop the UDP receive workers, after the monitor thread has stopped
+ *
+ * The packets already queued are handled first, since a taskprocessor drops
+ * the tasks still queued when it goes away.
+ */
+static void sip_udp_workers_stop(void)
+{
+	struct sip_udp_drain drain;
+	int i;
+	int count = sip_udp_threads;
+
+	if (!count) {
+		return;
+	}
+
+	ast_mutex_init(&drain.lock);
+	ast_cond_init(&drain.cond, NULL);
+	drain.pending = count;
+	for (i = 0; i < count; i++) {
+		if (ast_taskprocessor_push(sip_udp_workers[i], sip_udp_drain_task, &drain)) {
+			sip_udp_drain_task(&drain);
+		}
+	}
+	ast_mutex_lock(&drain.lock);
+	while (drain.pending) {
+		ast_cond_wait(&drain.cond, &drain.lock);
+	}
+	ast_mutex_unlock(&drain.lock);
+	ast_cond_destroy(&drain.cond);
+	ast_mutex_destroy(&drain.lock);
+
+	/* Fall back to netlock, then wait for TCP threads still holding a dialog lock */
+	sip_udp_threads = 0;
+	for (i = 0; i < count; i++) {
+		sip_udp_workers[i] = ast_taskprocessor_unreference(sip_udp_workers[i]);
+		ast_mutex_lock(&sip_dialog_locks[i]);
+		ast_mutex_unlock(&sip_dialog_locks[i]);
+	}
+}
+
 /*! \brief Read data from SIP UDP socket
 \note sipsock_read locks the owner channel while we are processing the SIP message
 \return 1 on error, 0 on success
-\note Successful messages is connected to SIP call and forwarded to handle_incoming()
+\note Successful messages is connected to SIP call and forwarded to handle_incoming(),
+	either directly or through a UDP receive worker
 */
 static int sipsock_read(int *id, int fd, short events, void *ignore)
 {
@@ -26330,6 +26620,13 @@ static int sipsock_read(int *id, int fd, short events, void *ignore)
 
 	readbuf[res] = '\0';
 
+	if (sip_udp_threads) {
+		if (sip_udp_packet_dispatch(readbuf, &addr)) {
+			ast_log(LOG_WARNING, "Unable to queue SIP packet from %s\n", ast_sockaddr_stringify(&addr));
+		}
+		return 1;
+	}
+
 	if (!(req.data = ast_str_create(SIP_MIN_PACKET))) {
 		return 1;
 	}
@@ -26338,10 +26635,7 @@ static int sipsock_read(int *id, int fd, short events, void *ignore)
 		return -1;
 	}
 
-	req.socket.fd = sipsock;
-	set_socket_transport(&req.socket, SIP_TRANSPORT_UDP);
-	req.socket.tcptls_session	= NULL;
-	req.socket.port = htons(ast_sockaddr_port(&bindaddr));
+	set_udp_socket_data(&req);
 
 	handle_request_do(&req, &addr);
 	deinit_req(&req);
@@ -26357,6 +26651,7 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 {
 	struct sip_pvt *p;
 	struct ast_channel *owner_chan_ref = NULL;
+	ast_mutex_t *dialog_lock;
 	int recount = 0;
 	int nounlock = 0;
 
@@ -26382,13 +26677,14 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 		ast_str_reset(req->data); /* nulling this out is NOT a good idea here. */
 		return 1;
 	}
-	ast_mutex_lock(&netlock);
+	dialog_lock = sip_dialog_lock(ast_str_hash(sip_get_header(req, "Call-ID")));
+	ast_mutex_lock(dialog_lock);
 
 	/* Find the active SIP dialog or create a new one */
 	p = find_call(req, addr, req->method);	/* returns p with a reference only. _NOT_ locked*/
 	if (p == NULL) {
 		ast_debug(1, "Invalid SIP message - rejected , no callid, len %zu\n", ast_str_strlen(req->data));
-		ast_mutex_unlock(&netlock);
+		ast_mutex_unlock(dialog_lock);
 		return 1;
 	}
 
@@ -26424,7 +26720,7 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 	}
 	sip_pvt_unlock(p);
 	ao2_t_ref(p, -1, "throw away dialog ptr from find_call at end of routine"); /* p is gone after the return */
-	ast_mutex_unlock(&netlock);
+	ast_mutex_unlock(dialog_lock);
 
 	return 1;
 }
@@ -26901,7 +27197,9 @@ static void *do_monitor(void *data)
 		 * synchronization being done between running the scheduler and places
 		 * scheduling tasks.  As it is written, any scheduled item may not run
 		 * any sooner than about  1 second, regardless of whether a sooner time
-		 * was asked for. */
+		 * was asked for.  Packet retransmissions do not go through this
+		 * scheduler; they run on the sip_timers wheel with millisecond
+		 * precision. */
 
 		pthread_testcancel();
 		/* Wait for sched or io */
@@ -29267,6 +29565,7 @@ static int reload_config(enum channelreloadreason reason)
 	global_t38_maxdatagram = -1;
 	global_shrinkcallerid = 1;
 	authlimit = DEFAULT_AUTHLIMIT;
+	global_udp_threads = DEFAULT_UDP_THREADS;
 	authtimeout = DEFAULT_AUTHTIMEOUT;
 	global_store_sip_cause = DEFAULT_STORE_SIP_CAUSE;
 
@@ -29571,6 +29870,12 @@ static int reload_config(enum channelreloadreason reason)
 				ast_log(LOG_WARNING, "Invalid %s '%s' at line %d of %s\n",
 					v->name, v->value, v->lineno, config);
 			}
+		} else if (!strcasecmp(v->name, "udpthreads")) {
+			if (ast_parse_arg(v->value, PARSE_INT32|PARSE_DEFAULT|PARSE_IN_RANGE,
+					  &global_udp_threads, DEFAULT_UDP_THREADS, 0, MAX_UDP_THREADS)) {
+				ast_log(LOG_WARNING, "Invalid %s '%s' at line %d of %s\n",
+					v->name, v->value, v->lineno, config);
+			}
 		} else if (!strcasecmp(v->name, "sipdebug")) {
 			if (ast_true(v->value))
 				sipdebug |= sip_debug_config;
@@ -29823,6 +30128,11 @@ static int reload_config(enum channelreloadreason reason)
 		network_change_event_unsubscribe();
 	}
 
+	if (reason != CHANNEL_MODULE_LOAD && global_udp_threads != sip_udp_threads) {
+		ast_log(LOG_NOTICE, "'udpthreads' changed from %d to %d; this takes effect when chan_sip is next loaded\n",
+			sip_udp_threads, global_udp_threads);
+	}
+
 	if (global_t1 < global_t1min) {
 		ast_log(LOG_WARNING, "'t1min' (%d) cannot be greater than 't1timer' (%d).  Resetting 't1timer' to the value of 't1min'\n", global_t1min, global_t1);
 		global_t1 = global_t1min;
@@ -29893,6 +30203,7 @@ static int reload_config(enum channelreloadreason reason)
 	}
 
 	ast_mutex_lock(&netlock);
+	ast_rwlock_wrlock(&sipsock_lock);
 	if ((sipsock > -1) && (ast_sockaddr_cmp(&old_bindaddr, &bindaddr))) {
 		close(sipsock);
 		sipsock = -1;
@@ -29903,6 +30214,7 @@ static int reload_config(enum channelreloadreason reason)
 		if (sipsock < 0) {
 			ast_log(LOG_WARNING, "Unable to create SIP socket: %s\n", strerror(errno));
 			ast_config_destroy(cfg);
+			ast_rwlock_unlock(&sipsock_lock);
 			ast_mutex_unlock(&netlock);
 			return -1;
 		} else {
@@ -29928,6 +30240,7 @@ static int reload_config(enum channelreloadreason reason)
 	} else {
 		ast_set_qos(sipsock, global_tos_sip, global_cos_sip, "SIP");
 	}
+	ast_rwlock_unlock(&sipsock_lock);
 	ast_mutex_unlock(&netlock);
 
 	/* Start TCP server */
@@ -31439,17 +31752,22 @@ static int load_module(void)
 {
 	ast_verbose("SIP channel loading...\n");
 
+	sip_dialog_locks_init();
+
 	if (!(sip_tech.capabilities = ast_format_cap_alloc())) {
 		return AST_MODULE_LOAD_FAILURE;
 	}
 
-	/* the fact that ao2_containers can't resize automatically is a major worry! */
-	/* if the number of objects gets above MAX_XXX_BUCKETS, things will slow down */
-	peers = ao2_t_container_alloc(HASH_PEER_SIZE, peer_hash_cb, peer_cmp_cb, "allocate peers");
-	peers_by_ip = ao2_t_container_alloc(HASH_PEER_SIZE, peer_iphash_cb, peer_ipcmp_cb, "allocate peers_by_ip");
-	dialogs = ao2_t_container_alloc(HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs");
+	/* the peer and dialog containers grow with the number of objects in them */
+	peers = ao2_t_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		HASH_PEER_SIZE, peer_hash_cb, peer_cmp_cb, "allocate peers");
+	peers_by_ip = ao2_t_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		HASH_PEER_SIZE, peer_iphash_cb, peer_ipcmp_cb, "allocate peers_by_ip");
+	dialogs = ao2_t_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs");
 	dialogs_needdestroy = ao2_t_container_alloc(1, NULL, NULL, "allocate dialogs_needdestroy");
-	dialogs_rtpcheck = ao2_t_container_alloc(HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs for rtpchecks");
+	dialogs_rtpcheck = ao2_t_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs for rtpchecks");
 	threadt = ao2_t_container_alloc(HASH_DIALOG_SIZE, threadt_hash_cb, threadt_cmp_cb, "allocate threadt table");
 	if (!peers || !peers_by_ip || !dialogs || !dialogs_needdestroy || !dialogs_rtpcheck
 		|| !threadt) {
@@ -31470,8 +31788,15 @@ static int load_module(void)
 		return AST_MODULE_LOAD_FAILURE;
 	}
 
+	if (!(sip_timers = sip_timer_wheel_create())) {
+		ast_log(LOG_ERROR, "Unable to create retransmission timers\n");
+		ast_sched_context_destroy(sched);
+		return AST_MODULE_LOAD_FAILURE;
+	}
+
 	if (!(io = io_context_create())) {
 		ast_log(LOG_ERROR, "Unable to create I/O context\n");
+		sip_timer_wheel_destroy(sip_timers);
 		ast_sched_context_destroy(sched);
 		return AST_MODULE_LOAD_FAILURE;
 	}
@@ -31499,6 +31824,7 @@ static int load_module(void)
 	if (ast_channel_register(&sip_tech)) {
 		ast_log(LOG_ERROR, "Unable to register channel type 'SIP'\n");
 		io_context_destroy(io);
+		sip_timer_wheel_destroy(sip_timers);
 		ast_sched_context_destroy(sched);
 		return AST_MODULE_LOAD_FAILURE;
 	}
@@ -31537,6 +31863,7 @@ static int load_module(void)
 	ast_manager_register_xml("SIPqualifypeer", EVENT_FLAG_SYSTEM | EVENT_FLAG_REPORTING, manager_sip_qualify_peer);
 	ast_manager_register_xml("SIPshowregistry", EVENT_FLAG_SYSTEM | EVENT_FLAG_REPORTING, manager_show_registry);
 	ast_manager_register_xml("SIPnotify", EVENT_FLAG_SYSTEM, manager_sipnotify);
+	ast_manager_register_xml("SIPshowtimers", EVENT_FLAG_SYSTEM | EVENT_FLAG_REPORTING, manager_sip_show_timers);
 	sip_poke_all_peers();	
 	sip_send_all_registers();
 	sip_send_all_mwi_subscriptions();
@@ -31566,6 +31893,10 @@ static int load_module(void)
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
+	if (sip_udp_workers_start()) {
+		ast_log(LOG_WARNING, "Only %d of %d SIP UDP receive workers started\n", sip_udp_threads, global_udp_threads);
+	}
+
 	/* And start the monitor for the first time */
 	restart_monitor();
 
@@ -31639,6 +31970,7 @@ static int unload_module(void)
 	ast_manager_unregister("SIPqualifypeer");
 	ast_manager_unregister("SIPshowregistry");
 	ast_manager_unregister("SIPnotify");
+	ast_manager_unregister("SIPshowtimers");
 	
 	/* Kill TCP/TLS server threads */
 	if (sip_tcp_desc.master) {
@@ -31678,6 +32010,9 @@ static int unload_module(void)
 	monitor_thread = AST_PTHREADT_STOP;
 	ast_mutex_unlock(&monlock);
 
+	/* The UDP receive workers handle what the monitor queued, then stop */
+	sip_udp_workers_stop();
+
 	/* Destroy all the dialogs and free their memory */
 	i = ao2_iterator_init(dialogs, 0);
 	while ((p = ao2_t_iterator_next(&i, "iterate thru dialogs"))) {
@@ -31743,10 +32078,12 @@ static int unload_module(void)
 	ao2_t_ref(dialogs_rtpcheck, -1, "unref dialogs_rtpcheck");
 	ao2_t_ref(threadt, -1, "unref the thread table");
 	ao2_t_ref(sip_monitor_instances, -1, "unref the sip_monitor_instances table");
+	sip_dialog_locks_destroy();
 
 	clear_sip_domains();
 	ast_free_ha(sip_cfg.contact_ha);
 	close(sipsock);
+	sip_timer_wheel_destroy(sip_timers);
 	ast_sched_context_destroy(sched);
 	con = ast_context_find(used_context);
 	if (con) {
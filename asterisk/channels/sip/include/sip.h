@@ -65,6 +65,9 @@
 #define DEFAULT_AUTHLIMIT            100
 #define DEFAULT_AUTHTIMEOUT          30
 
+#define DEFAULT_UDP_THREADS          0     /*!< UDP packets are handled on the monitor thread */
+#define MAX_UDP_THREADS              64    /*!< Upper limit for sip.conf udpthreads */
+
 /* guard limit must be larger than guard secs */
 /* guard min must be < 1000, and should be >= 250 */
 #define EXPIRY_GUARD_SECS    15   /*!< How long before expiry do we reregister */
@@ -0,0 +1,97 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ * \brief sip transaction timer wheel header file
+ */
+
+#ifndef _SIP_TIMER_WHEEL_H
+#define _SIP_TIMER_WHEEL_H
+
+#include "asterisk/sched.h"
+
+struct sip_timer_wheel;
+
+/*! \brief Counters kept by a timer wheel */
+struct sip_timer_wheel_stats {
+	unsigned int scheduled;     /*!< Timers currently scheduled */
+	unsigned int fired;         /*!< Callbacks run since the wheel was created */
+	unsigned int late;          /*!< Callbacks run more than one tick after they were due */
+	int64_t total_lag;          /*!< Sum of the lag of all callbacks run, in ms */
+	int64_t max_lag;            /*!< Largest lag of any callback run, in ms */
+};
+
+/*!
+ * \brief Create a timer wheel and start the thread that runs it
+ *
+ * The wheel has a resolution of one millisecond.  Adding and cancelling a
+ * timer takes constant time regardless of how many timers are scheduled.
+ *
+ * \retval NULL on failure
+ */
+struct sip_timer_wheel *sip_timer_wheel_create(void);
+
+/*!
+ * \brief Stop the thread of a timer wheel and free it
+ *
+ * \note Timers still scheduled are dropped without running their callbacks.
+ */
+void sip_timer_wheel_destroy(struct sip_timer_wheel *wheel);
+
+/*!
+ * \brief Schedule a callback on a timer wheel
+ *
+ * \param wheel the timer wheel
+ * \param when number of milliseconds from now to run the callback
+ * \param callback function to run.  As with ast_sched_add_variable(), a
+ *        non-zero return value reschedules the timer that many milliseconds
+ *        later under the same id.
+ * \param data passed to the callback
+ *
+ * \return the id of the timer, or -1 on failure
+ */
+int sip_timer_wheel_add(struct sip_timer_wheel *wheel, int when, ast_sched_cb callback, const void *data);
+
+/*!
+ * \brief Cancel a timer
+ *
+ * \retval 0 the timer was cancelled
+ * \retval -1 the timer was not found, either because it already ran or
+ *         because its callback is running right now
+ */
+int sip_timer_wheel_del(struct sip_timer_wheel *wheel, int id);
+
+/*! \brief Get a snapshot of the counters of a timer wheel */
+void sip_timer_wheel_get_stats(struct sip_timer_wheel *wheel, struct sip_timer_wheel_stats *stats);
+
+/*!
+ * \brief Cancel a timer, retrying briefly if its callback is running
+ *
+ * Works like AST_SCHED_DEL(): the id is passed by name and set to -1.
+ */
+#define SIP_TIMER_WHEEL_DEL(wheel, id) \
+	({ \
+		int _count = 0; \
+		int _del_res = -1; \
+		while (id > -1 && (_del_res = sip_timer_wheel_del(wheel, id)) && ++_count < 10) \
+			usleep(1); \
+		if (_count == 10) { \
+			ast_debug(3, "Unable to cancel timer ID %d.\n", id); \
+		} \
+		id = -1; \
+		(_del_res); \
+	})
+
+#endif /* _SIP_TIMER_WHEEL_H */
@@ -0,0 +1,325 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ * \brief Hierarchical timer wheel for SIP transaction timers
+ *
+ * Timers are kept in WHEEL_LEVELS levels of WHEEL_SIZE slots.  A slot on
+ * level 0 holds the timers due on one tick (one millisecond); a slot on level
+ * n holds the timers due within WHEEL_SIZE^n ticks, and is cascaded down to
+ * the level below when the wheel reaches it.  Timers are also hashed by id so
+ * that cancelling one does not require searching the wheel.
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/utils.h"
+#include "asterisk/lock.h"
+#include "asterisk/dlinkedlists.h"
+#include "include/timer_wheel.h"
+
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  4
+/*! Timers further away than this many ticks are clamped to it (about 4.6 hours) */
+#define WHEEL_MAX_DELTA ((1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+#define ID_BUCKETS    4096
+
+struct wheel_timer;
+
+AST_DLLIST_HEAD_NOLOCK(wheel_slot, wheel_timer);
+
+struct wheel_timer {
+	int id;
+	int64_t expires;                          /*!< Tick the timer is due on */
+	ast_sched_cb callback;
+	const void *data;
+	struct wheel_slot *slot;                  /*!< Slot the timer is linked into */
+	AST_DLLIST_ENTRY(wheel_timer) slot_list;
+	AST_DLLIST_ENTRY(wheel_timer) id_list;
+};
+
+struct sip_timer_wheel {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	pthread_t thread;
+	unsigned int stop:1;
+	struct timeval start;                     /*!< Time of tick 0 */
+	int64_t tick;                             /*!< Last tick processed */
+	int last_id;
+	struct sip_timer_wheel_stats stats;
+	struct wheel_slot slots[WHEEL_LEVELS][WHEEL_SIZE];
+	struct wheel_slot ids[ID_BUCKETS];
+};
+
+/*! \brief Current tick, i.e. milliseconds since the wheel was created */
+static int64_t wheel_now(struct sip_timer_wheel *wheel)
+{
+	return ast_tvdiff_ms(ast_tvnow(), wheel->start);
+}
+
+/*! \brief Link a timer into the slot for its expiry tick.  Called with the wheel locked. */
+static void wheel_insert(struct sip_timer_wheel *wheel, struct wheel_timer *timer)
+{
+	int64_t delta = timer->expires - wheel->tick;
+	int level;
+
+	if (delta < 0) {
+		/* Already due; run it on the current tick */
+		timer->expires = wheel->tick;
+		delta = 0;
+	} else if (delta > WHEEL_MAX_DELTA) {
+		timer->expires = wheel->tick + WHEEL_MAX_DELTA;
+		delta = WHEEL_MAX_DELTA;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (1 << (WHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	timer->slot = &wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	AST_DLLIST_INSERT_TAIL(timer->slot, timer, slot_list);
+}
+
+/*! \brief Move the timers of a slot down to the levels below.  Called with the wheel locked. */
+static void wheel_cascade(struct sip_timer_wheel *wheel, int level)
+{
+	struct wheel_slot *slot = &wheel->slots[level][(wheel->tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	struct wheel_timer *timer;
+
+	while ((timer = AST_DLLIST_REMOVE_HEAD(slot, slot_list))) {
+		wheel_insert(wheel, timer);
+	}
+}
+
+/*! \brief Run the callbacks due on the current tick.  Called with the wheel locked. */
+static void wheel_run_tick(struct sip_timer_wheel *wheel)
+{
+	struct wheel_slot *slot;
+	struct wheel_timer *timer;
+	int64_t lag;
+	int level;
+	int res;
+
+	/* Cascade each level whose slot index wrapped around */
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if (wheel->tick & ((1 << (WHEEL_BITS * level)) - 1)) {
+			break;
+		}
+	}
+	while (--level > 0) {
+		wheel_cascade(wheel, level);
+	}
+
+	/* Timers added while a callback runs are due on a later tick, so this terminates */
+	slot = &wheel->slots[0][wheel->tick & WHEEL_MASK];
+	while ((timer = AST_DLLIST_REMOVE_HEAD(slot, slot_list))) {
+		AST_DLLIST_REMOVE(&wheel->ids[timer->id % ID_BUCKETS], timer, id_list);
+		timer->slot = NULL;
+		wheel->stats.scheduled--;
+
+		lag = wheel_now(wheel) - timer->expires;
+		wheel->stats.fired++;
+		wheel->stats.total_lag += lag;
+		if (lag > 1) {
+			wheel->stats.late++;
+		}
+		if (lag > wheel->stats.max_lag) {
+			wheel->stats.max_lag = lag;
+		}
+
+		ast_mutex_unlock(&wheel->lock);
+		res = timer->callback(timer->data);
+		ast_mutex_lock(&wheel->lock);
+
+		if (res && !wheel->stop) {
+			timer->expires = wheel_now(wheel) + res;
+			wheel_insert(wheel, timer);
+			AST_DLLIST_INSERT_TAIL(&wheel->ids[timer->id % ID_BUCKETS], timer, id_list);
+			wheel->stats.scheduled++;
+		} else {
+			ast_free(timer);
+		}
+	}
+}
+
+/*! \brief Number of ticks until the next timer on level 0, or until the next cascade */
+static int wheel_next_wait(struct sip_timer_wheel *wheel)
+{
+	int ticks;
+
+	for (ticks = 1; ticks < WHEEL_SIZE; ticks++) {
+		int index = (wheel->tick + ticks) & WHEEL_MASK;
+
+		if (!index || !AST_DLLIST_EMPTY(&wheel->slots[0][index])) {
+			break;
+		}
+	}
+	return ticks;
+}
+
+static void *wheel_thread(void *data)
+{
+	struct sip_timer_wheel *wheel = data;
+	struct timeval next;
+	struct timespec ts;
+	int64_t now;
+
+	ast_mutex_lock(&wheel->lock);
+	while (!wheel->stop) {
+		now = wheel_now(wheel);
+		while (wheel->tick < now && !wheel->stop) {
+			wheel->tick++;
+			wheel_run_tick(wheel);
+		}
+		if (wheel->stop) {
+			break;
+		}
+
+		if (!wheel->stats.scheduled) {
+			ast_cond_wait(&wheel->cond, &wheel->lock);
+			continue;
+		}
+		next = ast_tvadd(wheel->start, ast_samp2tv(wheel->tick + wheel_next_wait(wheel), 1000));
+		ts.tv_sec = next.tv_sec;
+		ts.tv_nsec = next.tv_usec * 1000;
+		ast_cond_timedwait(&wheel->cond, &wheel->lock, &ts);
+	}
+	ast_mutex_unlock(&wheel->lock);
+
+	return NULL;
+}
+
+struct sip_timer_wheel *sip_timer_wheel_create(void)
+{
+	struct sip_timer_wheel *wheel;
+
+	if (!(wheel = ast_calloc(1, sizeof(*wheel)))) {
+		return NULL;
+	}
+
+	ast_mutex_init(&wheel->lock);
+	ast_cond_init(&wheel->cond, NULL);
+	wheel->start = ast_tvnow();
+	wheel->thread = AST_PTHREADT_NULL;
+
+	if (ast_pthread_create_background(&wheel->thread, NULL, wheel_thread, wheel)) {
+		ast_log(LOG_ERROR, "Unable to start SIP timer wheel thread\n");
+		ast_cond_destroy(&wheel->cond);
+		ast_mutex_destroy(&wheel->lock);
+		ast_free(wheel);
+		return NULL;
+	}
+
+	return wheel;
+}
+
+void sip_timer_wheel_destroy(struct sip_timer_wheel *wheel)
+{
+	struct wheel_timer *timer;
+	int i;
+
+	if (!wheel) {
+		return;
+	}
+
+	ast_mutex_lock(&wheel->lock);
+	wheel->stop = 1;
+	ast_cond_signal(&wheel->cond);
+	ast_mutex_unlock(&wheel->lock);
+	pthread_join(wheel->thread, NULL);
+
+	for (i = 0; i < ID_BUCKETS; i++) {
+		while ((timer = AST_DLLIST_REMOVE_HEAD(&wheel->ids[i], id_list))) {
+			ast_free(timer);
+		}
+	}
+
+	ast_cond_destroy(&wheel->cond);
+	ast_mutex_destroy(&wheel->lock);
+	ast_free(wheel);
+}
+
+int sip_timer_wheel_add(struct sip_timer_wheel *wheel, int when, ast_sched_cb callback, const void *data)
+{
+	struct wheel_timer *timer;
+	int64_t now;
+
+	if (!(timer = ast_calloc(1, sizeof(*timer)))) {
+		return -1;
+	}
+	timer->callback = callback;
+	timer->data = data;
+
+	ast_mutex_lock(&wheel->lock);
+	if (++wheel->last_id <= 0) {
+		wheel->last_id = 1;
+	}
+	timer->id = wheel->last_id;
+
+	now = wheel_now(wheel);
+	if (!wheel->stats.scheduled && wheel->tick < now) {
+		/* The thread does not advance an empty wheel; nothing is due in between */
+		wheel->tick = now;
+	}
+	/* A timer added now must not run on a tick that has already been processed */
+	timer->expires = MAX(now + MAX(when, 0), wheel->tick + 1);
+	wheel_insert(wheel, timer);
+	AST_DLLIST_INSERT_TAIL(&wheel->ids[timer->id % ID_BUCKETS], timer, id_list);
+	if (!wheel->stats.scheduled++ || timer->expires - wheel->tick < WHEEL_SIZE) {
+		/* The thread may be sleeping past this timer */
+		ast_cond_signal(&wheel->cond);
+	}
+	ast_mutex_unlock(&wheel->lock);
+
+	return timer->id;
+}
+
+int sip_timer_wheel_del(struct sip_timer_wheel *wheel, int id)
+{
+	struct wheel_timer *timer;
+
+	if (id <= 0) {
+		return -1;
+	}
+
+	ast_mutex_lock(&wheel->lock);
+	AST_DLLIST_TRAVERSE(&wheel->ids[id % ID_BUCKETS], timer, id_list) {
+		if (timer->id == id) {
+			break;
+		}
+	}
+	if (!timer) {
+		ast_mutex_unlock(&wheel->lock);
+		return -1;
+	}
+	AST_DLLIST_REMOVE(&wheel->ids[id % ID_BUCKETS], timer, id_list);
+	AST_DLLIST_REMOVE(timer->slot, timer, slot_list);
+	wheel->stats.scheduled--;
+	ast_mutex_unlock(&wheel->lock);
+
+	ast_free(timer);
+	return 0;
+}
+
+void sip_timer_wheel_get_stats(struct sip_timer_wheel *wheel, struct sip_timer_wheel_stats *stats)
+{
+	ast_mutex_lock(&wheel->lock);
+	*stats = wheel->stats;
+	ast_mutex_unlock(&wheel->lock);
+}
@@ -774,6 +774,48 @@ typedef int (ao2_hash_fn)(const void *obj, const int flags);
 /*@{ */
 struct ao2_container;
 
+/*!
+ * \brief Options available when allocating an ao2 container.
+ *
+ * \details
+ * These are or'ed with the enum ao2_alloc_opts lock option of the
+ * container.
+ */
+enum ao2_container_opts {
+	/*!
+	 * \brief Grow the hash table as objects are added.
+	 *
+	 * \details
+	 * When the number of objects exceeds twice the number of buckets
+	 * a table about twice as large is allocated, and the objects are
+	 * moved to it a few buckets at a time by the following links and
+	 * unlinks, so no single operation pays for the whole rehash.
+	 * Moving is paused while an ao2_iterator on the container exists.
+	 *
+	 * \note The initial number of buckets is only a starting size.
+	 */
+	AO2_CONTAINER_ALLOC_OPT_RESIZE = (1 << 2),
+	/*!
+	 * \brief Let lookups, links and unlinks by key run in parallel.
+	 *
+	 * \details
+	 * Operations on a single key (OBJ_POINTER or OBJ_KEY without
+	 * OBJ_MULTIPLE or OBJ_CONTINUE, ao2_link() and ao2_unlink()) hold
+	 * the container lock in read mode plus a lock for the group of
+	 * buckets the key hashes to, so operations on keys in different
+	 * groups do not contend.  Every other operation, including
+	 * iterating, holds the container lock in write mode.
+	 *
+	 * \note Only has an effect on containers that also have the
+	 * AO2_ALLOC_OPT_LOCK_RWLOCK option.
+	 *
+	 * \note The ao2_hash_fn and ao2_callback_fn of a key operation are
+	 * called with the bucket group locked, so they must not operate on
+	 * other keys of the same container.
+	 */
+	AO2_CONTAINER_ALLOC_OPT_STRIPED = (1 << 3),
+};
+
 /*!
  * \brief Allocate and initialize a hash container with the desired number of buckets.
  *
@@ -781,7 +823,8 @@ struct ao2_container;
  * We allocate space for a struct astobj_container, struct container
  * and the buckets[] array.
  *
- * \param options Container ao2 object options (See enum ao2_alloc_opts)
+ * \param options Container ao2 object options (See enum ao2_alloc_opts
+ *        and enum ao2_container_opts)
  * \param n_buckets Number of buckets for hash
  * \param hash_fn Pointer to a function computing a hash value.
  * \param cmp_fn Pointer to a compare function used by ao2_find. (NULL to match everything)
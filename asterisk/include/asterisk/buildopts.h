@@ -0,0 +1,21 @@
+/*
+ * buildopts.h 
+ * Automatically generated
+ */
+
+#define TEST_FRAMEWORK 1
+#define LOADABLE_MODULES 1
+#define AST_MODULE_CHAN_LOCAL 1
+#define AST_MODULE_APP_VOICEMAIL 1
+#define AST_MODULE_APP_CONFBRIDGE 1
+#define AST_MODULE_RES_MONITOR 1
+#define AST_MODULE_RES_AGI 1
+#define AST_MODULE_RES_ADSI 1
+#define AST_MODULE_RES_SMDI 1
+#define AST_MODULE_RES_AEL_SHARE 1
+#define AST_MODULE_TEST_FRAMEWORK 1
+#define AST_MODULE_FUNC_CURL 1
+#define AST_MODULE_G711_NEW_ALGORITHM 1
+#define AST_MODULE_DEBUG_THREADS 1
+#define AST_BUILDOPT_SUM "692bbf805bb9914f99dcd1ebc08465dc"
+#define AST_BUILDOPTS "TEST_FRAMEWORK, LOADABLE_MODULES"
@@ -67,6 +67,17 @@ struct ast_dsp_busy_pattern {
 	int pattern[4];
 };
 
+/*! \brief How the tone detectors run their Goertzel filters */
+enum ast_dsp_kernel {
+	/*! All the frequencies of a detector at once in fixed point, with the
+	 *  same results as the scalar kernel.  The default. */
+	AST_DSP_KERNEL_FIXED = 0,
+	/*! All the frequencies of a detector at once in floating point */
+	AST_DSP_KERNEL_FLOAT,
+	/*! One frequency and one sample at a time, as the detectors always did */
+	AST_DSP_KERNEL_SCALAR,
+};
+
 enum threshold {
 	/* Array offsets */
 	THRESHOLD_SILENCE = 0,
@@ -149,6 +160,18 @@ int ast_dsp_set_digitmode(struct ast_dsp *dsp, int digitmode);
 /*! \brief Set fax mode */
 int ast_dsp_set_faxmode(struct ast_dsp *dsp, int faxmode);
 
+/*!
+ * \brief Set how the tone detectors run their Goertzel filters
+ *
+ * The detectors of the DSP are reset.  New DSPs use the kernel set with the
+ * goertzel option in dsp.conf.
+ *
+ * \retval 0 on success
+ * \retval -1 if the kernel is not known
+ * \since 11
+ */
+int ast_dsp_set_kernel(struct ast_dsp *dsp, enum ast_dsp_kernel kernel);
+
 /*!
  * \brief Returns true if DSP code was muting any fragment of the last processed frame.
  * Muting (squelching) happens when DSP code removes DTMF/MF/generic tones from the audio
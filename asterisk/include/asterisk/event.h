@@ -309,6 +309,44 @@ enum ast_event_subscriber_res ast_event_check_subscriber(enum ast_event_type eve
  */
 void ast_event_report_subs(const struct ast_event_sub *sub);
 
+/*!
+ * \brief Give subscriptions to an event type queues of their own
+ * \since 11
+ *
+ * \param type the event type
+ * \param size most events allowed to wait for a subscription, 0 to stop
+ *        queueing
+ *
+ * Subscribers are normally called one after the other from the thread that
+ * dispatches all events, so a subscriber that takes long to handle an event
+ * delays every other subscriber.  With this set, each subscription to the
+ * event type, now and later, gets a queue and a thread of its own, and
+ * events are dropped for a subscription that has size events waiting.
+ * Subscriptions still get their events in order.  When queueing stops, a
+ * subscription keeps its queue until the events waiting in it are delivered,
+ * and this returns once they all are.
+ *
+ * \note ast_event_unsubscribe() delivers the events still waiting for the
+ *       subscription before it returns.
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_event_queue_subs(enum ast_event_type type, unsigned int size);
+
+/*!
+ * \brief Get the statistics of the queued subscriptions to an event type
+ * \since 11
+ *
+ * \param type the event type
+ * \param cb called with the statistics of each subscription with a queue
+ * \param data passed to cb
+ *
+ * \return nothing
+ */
+void ast_event_sub_queue_stats(enum ast_event_type type,
+	void (*cb)(const struct ast_event_sub_stats *stats, void *data), void *data);
+
 /*!
  * \brief Dump the event cache for the subscriber
  * \since 1.6.1
@@ -326,6 +326,31 @@ struct ast_event_ie;
 struct ast_event_sub;
 struct ast_event_iterator;
 
+/*!
+ * \brief Statistics of a subscription with a queue of its own
+ * \since 11
+ *
+ * \see ast_event_queue_subs()
+ */
+struct ast_event_sub_stats {
+	/*! Description of the subscription */
+	const char *description;
+	/*! Events waiting to be delivered */
+	unsigned int depth;
+	/*! Most events that were waiting at once */
+	unsigned int max_depth;
+	/*! Most events allowed to wait before more are dropped */
+	unsigned int size;
+	/*! Events delivered */
+	unsigned int delivered;
+	/*! Events dropped because the queue was full */
+	unsigned int dropped;
+	/*! Average milliseconds from queueing an event until it was handled */
+	unsigned int latency;
+	/*! Most milliseconds from queueing an event until it was handled */
+	unsigned int max_latency;
+};
+
 /*!
  * \brief supposed to be an opaque type
  *
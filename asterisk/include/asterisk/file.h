@@ -123,6 +123,19 @@ int ast_filedelete(const char *filename, const char *fmt);
  */
 int ast_filecopy(const char *oldname, const char *newname, const char *fmt);
 
+/*!
+ * \brief Drops a sound from the sound cache after it changed
+ * \param filename name of the sound (minus extension), as it is played, or
+ * NULL to drop every sound
+ *
+ * Sounds changed through the file API are dropped from the cache by it.  Modules
+ * changing sound files by other means call this to have the change seen at
+ * once, rather than when the cache next checks the sound against the disk.
+ *
+ * \since 11
+ */
+void ast_sound_cache_invalidate(const char *filename);
+
 /*! 
  * \brief Waits for a stream to stop or digit to be pressed
  * \param c channel to waitstream on
@@ -242,6 +255,22 @@ struct ast_filestream *ast_openstream(struct ast_channel *chan, const char *file
  * \retval NULL on error.
  */
 struct ast_filestream *ast_openstream_full(struct ast_channel *chan, const char *filename, const char *preflang, int asis);
+
+/*!
+ * \brief Opens stream for reading without a channel
+ * \param filename to use
+ * \param preflang prefered language to use
+ *
+ * The file is found as for a channel, and opened in the best format it
+ * exists in, for audio Asterisk reads itself, such as a stream played to
+ * many channels.  Read it with ast_readframe().
+ *
+ * \retval a ast_filestream pointer if it opens the file.
+ * \retval NULL on error.
+ * \since 11
+ */
+struct ast_filestream *ast_openstream_nochan(const char *filename, const char *preflang);
+
 /*! 
  * \brief Opens stream for use in seeking, playing 
  * \param chan channel to work with
@@ -52,6 +52,16 @@ extern "C" {
 
 struct io_context;
 
+/*! \brief How an I/O context waits for events */
+enum ast_io_backend {
+	/*! epoll where available, unless the iobackend option in asterisk.conf says otherwise */
+	AST_IO_BACKEND_DEFAULT = 0,
+	/*! poll() on an array of all file descriptors */
+	AST_IO_BACKEND_POLL,
+	/*! epoll(7), falling back to poll() where it is not available */
+	AST_IO_BACKEND_EPOLL,
+};
+
 /*! 
  * \brief Creates a context 
  * Create a context for I/O operations
@@ -60,6 +70,26 @@ struct io_context;
  */
 struct io_context *io_context_create(void);
 
+/*!
+ * \brief Creates a context using a specific backend
+ * \param backend how the context waits for events
+ *
+ * With the epoll backend ast_io_wait() only looks at the file descriptors
+ * that are ready, so its cost does not grow with the number of descriptors
+ * in the context.  Descriptors must be removed from the context before they
+ * are closed.
+ *
+ * \return an allocated io_context structure
+ * \since 11
+ */
+struct io_context *io_context_create_backend(enum ast_io_backend backend);
+
+/*!
+ * \brief Name of the backend used by a context, "poll" or "epoll"
+ * \since 11
+ */
+const char *io_context_backend(struct io_context *ioc);
+
 /*! 
  * \brief Destroys a context 
  * \param ioc structure to destroy
@@ -119,6 +119,8 @@ struct ast_filestream {
 	void *_private;	/*!< pointer to private buffer */
 	const char *orig_chan_name;
 	char *write_buffer;
+	/*! Sound cache entry the stream is read from, if any */
+	struct ast_sound_cache_file *cache;
 };
 
 /*! 
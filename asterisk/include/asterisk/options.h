@@ -58,6 +58,8 @@ enum ast_option_flags {
 	AST_OPT_FLAG_FULLY_BOOTED = (1 << 9),
 	/*! Trascode via signed linear */
 	AST_OPT_FLAG_TRANSCODE_VIA_SLIN = (1 << 10),
+	/*! Use poll() instead of epoll for I/O contexts */
+	AST_OPT_FLAG_IO_POLL = (1 << 11),
 	/*! Dump core on a seg fault */
 	AST_OPT_FLAG_DUMP_CORE = (1 << 12),
 	/*! Cache sound files */
@@ -134,6 +136,7 @@ enum ast_option_flags {
 #define ast_opt_hide_connect		ast_test_flag(&ast_options, AST_OPT_FLAG_HIDE_CONSOLE_CONNECT)
 #define ast_opt_lock_confdir		ast_test_flag(&ast_options, AST_OPT_FLAG_LOCK_CONFIG_DIR)
 #define ast_opt_generic_plc         ast_test_flag(&ast_options, AST_OPT_FLAG_GENERIC_PLC)
+#define ast_opt_io_poll			ast_test_flag(&ast_options, AST_OPT_FLAG_IO_POLL)
 
 extern struct ast_flags ast_options;
 
@@ -168,6 +171,8 @@ extern char dahdi_chan_name[AST_CHANNEL_NAME];
 extern int dahdi_chan_name_len;
 
 extern int ast_language_is_prefix;
+extern unsigned int ast_sound_cache_size;	/*!< Memory in MB the sound cache may use, 0 if sounds are not cached */
+extern int ast_sound_cache_encode;		/*!< Keep cached sounds encoded in the formats channels play them in */
 
 #if defined(__cplusplus) || defined(c_plusplus)
 }
@@ -206,6 +206,56 @@ struct odbc_cache_columns *ast_odbc_find_column(struct odbc_cache_tables *table,
  */
 int ast_odbc_clear_cache(const char *database, const char *tablename);
 
+/*!
+ * \brief Rows queued for insertion into a table, written by a thread of their own
+ * \since 11
+ */
+struct odbc_batch;
+
+/*!
+ * \brief Start writing rows into a table in batches
+ * \param connection Name of the ODBC class to write with
+ * \param name Name of the batch, shown by "odbc show batches" and used to name its spool file
+ * \param size Most rows written in one transaction.  A batch is written once it has this many rows.
+ * \param latency Milliseconds a row may wait for the batch to fill up
+ * \param retries Times a batch is tried again while the connection is down, before its rows are spooled to disk
+ * \param multirow Whether rows with the same columns are inserted with one multi-row INSERT
+ * statement, rather than one statement each within the transaction
+ *
+ * A batch the database refuses is written one row at a time, and the rows
+ * still refused are logged and dropped.  Rows that could not be written
+ * because the connection is down, and rows queued while 100 full batches
+ * are already waiting, are appended to a spool file in the odbc
+ * directory of the Asterisk spool directory.  The thread of the batch writes
+ * them once the database takes rows again.
+ *
+ * \retval The batch, to be destroyed with ast_odbc_batch_destroy()
+ * \retval NULL on error
+ * \since 11
+ */
+struct odbc_batch *ast_odbc_batch_create(const char *connection, const char *name, unsigned int size,
+	unsigned int latency, unsigned int retries, int multirow);
+
+/*!
+ * \brief Queue a row for insertion
+ * \param batch Batch of the table
+ * \param insert Start of the statement inserting the row, "INSERT INTO table (column, ...)"
+ * \param values Values of the row, "(value, ...)"
+ * \retval 0 on success
+ * \retval -1 on error
+ * \since 11
+ */
+int ast_odbc_batch_add(struct odbc_batch *batch, const char *insert, const char *values);
+
+/*!
+ * \brief Write the rows still queued and stop a batch
+ * \param batch Batch to destroy
+ *
+ * Rows that can not be written at once are spooled to disk.
+ * \since 11
+ */
+void ast_odbc_batch_destroy(struct odbc_batch *batch);
+
 /*!
  * \brief Release a table returned from ast_odbc_find_table
  */
@@ -38,6 +38,12 @@
  * destruction of the taskprocessor if the taskprocessor's reference count reaches zero.  Tasks waiting
  * to be processed in the taskprocessor queue when the taskprocessor reference count reaches zero
  * will be purged and released from the taskprocessor queue without being processed.
+ *
+ * A taskprocessor created with the TPS_POOLED option has no thread of its own.  Its tasks
+ * are run by a thread pool shared with the other pooled taskprocessors, still one at a time
+ * and in the order they were pushed.  The pool has only a thread per CPU, so a pooled task
+ * that blocks, on I/O or on another thread, holds up the tasks of every pooled taskprocessor.
+ * Only use TPS_POOLED for short tasks that do not block.
  */
 
 #ifndef __AST_TASKPROCESSOR_H__
@@ -58,6 +64,13 @@ enum ast_tps_options {
 	TPS_REF_DEFAULT = 0,
 	/*! \brief return a reference to a taskprocessor ONLY if it already exists */
 	TPS_REF_IF_EXISTS = (1 << 0),
+	/*!
+	 * \brief when creating the taskprocessor, run its tasks on the shared thread pool
+	 * instead of a thread of its own
+	 * \note Only for short tasks that do not block
+	 * \since 11
+	 */
+	TPS_POOLED = (1 << 1),
 };
 
 /*!
@@ -67,7 +80,7 @@ enum ast_tps_options {
  * disabled by specifying the TPS_REF_IF_EXISTS ast_tps_options as the second argument to ast_taskprocessor_get().
  * \param name The name of the taskprocessor
  * \param create Use 0 by default or specify TPS_REF_IF_EXISTS to return NULL if the taskprocessor does 
- * not already exist
+ * not already exist.  Add TPS_POOLED to run the tasks of a new taskprocessor on the shared thread pool.
  * return A pointer to a reference counted taskprocessor under normal conditions, or NULL if the
  * TPS_REF_IF_EXISTS reference type is specified and the taskprocessor does not exist
  * \since 1.6.1
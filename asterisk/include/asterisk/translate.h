@@ -348,6 +348,53 @@ void ast_translate_available_formats(struct ast_format_cap *dest, struct ast_for
  */
 const char *ast_translate_path_to_str(struct ast_trans_pvt *t, struct ast_str **str);
 
+/*!
+ * \brief A cache sharing the translation of one stream among its consumers
+ *
+ * When many channels are sent the same audio, such as the members of a
+ * music on hold class, the producer of the audio allocates a cache and each
+ * channel translates through it to its write format.  A frame the same as
+ * the last one translated to a format is not translated again, but shared.
+ *
+ * \since 11
+ */
+struct ast_trans_cache;
+
+/*!
+ * \brief Allocate a translation cache for a stream
+ * \param name Name of the stream, shown by 'core show translation'
+ * \return The cache, or NULL on failure
+ * \since 11
+ */
+struct ast_trans_cache *ast_trans_cache_alloc(const char *name);
+
+/*!
+ * \brief Destroy a translation cache
+ * \param cache The cache, which may be NULL
+ * \retval NULL
+ *
+ * \note Frames returned by the cache stay valid until they are released.
+ * \since 11
+ */
+struct ast_trans_cache *ast_trans_cache_destroy(struct ast_trans_cache *cache);
+
+/*!
+ * \brief Translate a frame of a stream, sharing the result
+ * \param cache The cache of the stream
+ * \param f Frame to translate
+ * \param dst Format to translate it to
+ *
+ * \retval NULL if the frame is already in the destination format, or was
+ * not sent in step with the other consumers of the stream, and should be
+ * translated by the caller as usual.
+ * \return otherwise the translated frame, which may be shared with other
+ * consumers and must not be modified.  It has no space for headers before
+ * its data.  Release it with ao2_ref(frame, -1) rather than ast_frfree().
+ *
+ * \since 11
+ */
+struct ast_frame *ast_trans_cache_translate(struct ast_trans_cache *cache, struct ast_frame *f, struct ast_format *dst);
+
 /*!
  * \brief Initialize the translation matrix and index to format conversion table.
  * \retval 0 on success
@@ -347,6 +347,34 @@ static force_inline void ast_slinear_saturated_divide(short *input, short *value
 	*input /= *value;
 }
 
+/*!
+ * \brief Add a buffer of signed linear samples to another, saturating
+ *
+ * \param input Samples to add to, which receive the result
+ * \param value Samples to add
+ * \param samples Number of samples in each buffer
+ *
+ * The result is the same as calling ast_slinear_saturated_add() on each
+ * sample, but SSE2 or AVX2 instructions are used when the build targets them.
+ *
+ * \since 11
+ */
+void ast_slinear_saturated_add_buf(short *input, const short *value, unsigned int samples);
+
+/*!
+ * \brief Subtract a buffer of signed linear samples from another, saturating
+ *
+ * \param input Samples to subtract from, which receive the result
+ * \param value Samples to subtract
+ * \param samples Number of samples in each buffer
+ *
+ * The result is the same as calling ast_slinear_saturated_subtract() on each
+ * sample, but SSE2 or AVX2 instructions are used when the build targets them.
+ *
+ * \since 11
+ */
+void ast_slinear_saturated_subtract_buf(short *input, const short *value, unsigned int samples);
+
 #ifdef localtime_r
 #undef localtime_r
 #endif
@@ -481,12 +481,17 @@ static char *handle_show_settings(struct ast_cli_entry *e, int cmd, struct ast_c
 	ast_cli(a->fd, "  Entity ID:                   %s\n", eid_str);
 	ast_cli(a->fd, "  Default language:            %s\n", defaultlanguage);
 	ast_cli(a->fd, "  Language prefix:             %s\n", ast_language_is_prefix ? "Enabled" : "Disabled");
+	if (ast_sound_cache_size)
+		ast_cli(a->fd, "  Sound cache:                 %u MB%s\n", ast_sound_cache_size, ast_sound_cache_encode ? ", pre-encoded" : "");
+	else
+		ast_cli(a->fd, "  Sound cache:                 Disabled\n");
 	ast_cli(a->fd, "  User name and group:         %s/%s\n", ast_config_AST_RUN_USER, ast_config_AST_RUN_GROUP);
 	ast_cli(a->fd, "  Executable includes:         %s\n", ast_test_flag(&ast_options, AST_OPT_FLAG_EXEC_INCLUDES) ? "Enabled" : "Disabled");
 	ast_cli(a->fd, "  Transcode via SLIN:          %s\n", ast_test_flag(&ast_options, AST_OPT_FLAG_TRANSCODE_VIA_SLIN) ? "Enabled" : "Disabled");
 	ast_cli(a->fd, "  Internal timing:             %s\n", ast_test_flag(&ast_options, AST_OPT_FLAG_INTERNAL_TIMING) ? "Enabled" : "Disabled");
 	ast_cli(a->fd, "  Transmit silence during rec: %s\n", ast_test_flag(&ast_options, AST_OPT_FLAG_TRANSMIT_SILENCE) ? "Enabled" : "Disabled");
 	ast_cli(a->fd, "  Generic PLC:                 %s\n", ast_test_flag(&ast_options, AST_OPT_FLAG_GENERIC_PLC) ? "Enabled" : "Disabled");
+	ast_cli(a->fd, "  I/O context backend:         %s\n", ast_opt_io_poll ? "poll" : "epoll");
 
 	ast_cli(a->fd, "\n* Subsystems\n");
 	ast_cli(a->fd, "  -------------\n");
@@ -3195,6 +3200,13 @@ static void ast_readconfig(void)
 			}
 		} else if (!strcasecmp(v->name, "languageprefix")) {
 			ast_language_is_prefix = ast_true(v->value);
+		} else if (!strcasecmp(v->name, "soundcachesize")) {
+			if (sscanf(v->value, "%30u", &ast_sound_cache_size) != 1) {
+				ast_log(LOG_WARNING, "'%s' is not a valid setting for the soundcachesize option\n", v->value);
+				ast_sound_cache_size = 0;
+			}
+		} else if (!strcasecmp(v->name, "soundcacheencode")) {
+			ast_sound_cache_encode = ast_true(v->value);
 		} else if (!strcasecmp(v->name, "defaultlanguage")) {
 			ast_copy_string(defaultlanguage, v->value, MAX_LANGUAGE);
  		} else if (!strcasecmp(v->name, "lockmode")) {
@@ -3230,6 +3242,14 @@ static void ast_readconfig(void)
 			ast_set2_flag(&ast_options, ast_true(v->value), AST_OPT_FLAG_HIDE_CONSOLE_CONNECT);
 		} else if (!strcasecmp(v->name, "lockconfdir")) {
 			ast_set2_flag(&ast_options, ast_true(v->value),	AST_OPT_FLAG_LOCK_CONFIG_DIR);
+		} else if (!strcasecmp(v->name, "iobackend")) {
+			if (!strcasecmp(v->value, "poll")) {
+				ast_set_flag(&ast_options, AST_OPT_FLAG_IO_POLL);
+			} else if (!strcasecmp(v->value, "epoll")) {
+				ast_clear_flag(&ast_options, AST_OPT_FLAG_IO_POLL);
+			} else {
+				ast_log(LOG_WARNING, "Invalid iobackend '%s', must be 'epoll' or 'poll'\n", v->value);
+			}
 		}
 	}
 	for (v = ast_variable_browse(cfg, "compat"); v; v = v->next) {
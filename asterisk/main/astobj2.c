@@ -654,6 +654,40 @@ struct bucket_entry {
 /* each bucket in the container is a tailq. */
 AST_LIST_HEAD_NOLOCK(bucket, bucket_entry);
 
+/*! Number of bucket locks of an AO2_CONTAINER_ALLOC_OPT_STRIPED container */
+#define AO2_STRIPES		16
+/*! A resizable container grows when it holds more than this many objects per bucket */
+#define AO2_LOAD_FACTOR		2
+/*! Number of buckets moved to the new table by each link or unlink while resizing */
+#define AO2_MIGRATE_STEP	4
+/*! Number of bucket entries in the first and the largest slab of a stripe */
+#define AO2_SLAB_MIN		4
+#define AO2_SLAB_MAX		128
+
+/*!
+ * A block of bucket entries allocated at once.
+ * Slabs are only freed when the container is destroyed.
+ */
+struct bucket_slab {
+	struct bucket_slab *next;
+	struct bucket_entry entries[0];
+};
+
+/*!
+ * A group of buckets sharing a lock and a pool of free bucket entries.
+ * A container that is not striped has a single stripe whose lock is
+ * not used, as the container lock protects it.
+ */
+struct bucket_stripe {
+	ast_mutex_t lock;
+	/*! Bucket entries ready to be linked */
+	struct bucket freelist;
+	/*! Slabs allocated by this stripe */
+	struct bucket_slab *slabs;
+	/*! Number of entries in the last slab allocated */
+	int slab_size;
+};
+
 /*!
  * A container; stores the hash and callback functions, information on
  * the size, the hash bucket heads, and a version number, starting at 0
@@ -669,12 +703,15 @@ AST_LIST_HEAD_NOLOCK(bucket, bucket_entry);
  * Since all objects have a version >0, we can use 0 as a marker for
  * 'we need the first object in the bucket'.
  *
- * \todo Linking and unlink objects is typically expensive, as it
- * involves a malloc() of a small object which is very inefficient.
- * To optimize this, we allocate larger arrays of bucket_entry's
- * when we run out of them, and then manage our own freelist.
- * This will be more efficient as we can do the freelist management while
- * we hold the lock (that we need anyways).
+ * Bucket entries are allocated in slabs and kept on a freelist, so
+ * linking an object does not normally need a malloc().
+ *
+ * While a resizable container is growing, the buckets of the old table
+ * at index migrated and above still hold their objects, and the rest
+ * have been moved to the new table.  Scans see the buckets through a
+ * single index: the old buckets not yet moved come first, followed by
+ * the buckets of the new table.  Moving objects would confuse a scan in
+ * progress, so nothing is moved while there are traversals.
  */
 struct ao2_container {
 	ao2_hash_fn *hash_fn;
@@ -684,8 +721,23 @@ struct ao2_container {
 	int elements;
 	/*! described above */
 	int version;
-	/*! variable size */
-	struct bucket buckets[0];
+	/*! Options from enum ao2_container_opts */
+	unsigned int options;
+	/*! Number of iterators and callback scans on the container */
+	int traversals;
+	/*! The hash table */
+	struct bucket *buckets;
+	/*! The table being moved to buckets, NULL when not resizing */
+	struct bucket *old_buckets;
+	int old_n_buckets;
+	/*! Number of old_buckets already moved */
+	int migrated;
+	int n_stripes;
+	struct bucket_stripe *stripes;
+	/*! The only stripe of a container that is not striped */
+	struct bucket_stripe stripe;
+	/*! variable size, the initial hash table */
+	struct bucket initial[0];
 };
 
 /*!
@@ -702,12 +754,147 @@ static int hash_zero(const void *user_obj, const int flags)
 	return 0;
 }
 
+/*! \brief Number of buckets seen by a scan of the container */
+static int container_total_buckets(struct ao2_container *c)
+{
+	return c->old_buckets ? c->old_n_buckets - c->migrated + c->n_buckets : c->n_buckets;
+}
+
+/*! \brief Get a bucket by its scan index (see struct ao2_container) */
+static struct bucket *container_bucket(struct ao2_container *c, int i)
+{
+	int remaining;
+
+	if (!c->old_buckets) {
+		return &c->buckets[i];
+	}
+	remaining = c->old_n_buckets - c->migrated;
+	return i < remaining ? &c->old_buckets[c->migrated + i] : &c->buckets[i - remaining];
+}
+
+/*! \brief Get the scan index of the bucket holding the objects with a hash value */
+static int container_hash_index(struct ao2_container *c, unsigned int hash)
+{
+	int i;
+
+	if (c->old_buckets) {
+		i = hash % c->old_n_buckets;
+		if (i >= c->migrated) {
+			return i - c->migrated;
+		}
+		return c->old_n_buckets - c->migrated + hash % c->n_buckets;
+	}
+	return hash % c->n_buckets;
+}
+
+/*! \brief Get the stripe of a bucket by its scan index */
+static struct bucket_stripe *container_stripe(struct ao2_container *c, int i)
+{
+	return &c->stripes[i % c->n_stripes];
+}
+
+/*! \brief Take a bucket entry from the freelist of a stripe, allocating a slab if empty */
+static struct bucket_entry *bucket_entry_alloc(struct bucket_stripe *stripe)
+{
+	struct bucket_entry *p;
+	struct bucket_slab *slab;
+	int size;
+	int i;
+
+	if ((p = AST_LIST_REMOVE_HEAD(&stripe->freelist, entry))) {
+		return p;
+	}
+
+	size = stripe->slab_size ? MIN(stripe->slab_size * 2, AO2_SLAB_MAX) : AO2_SLAB_MIN;
+	if (!(slab = ast_calloc(1, sizeof(*slab) + size * sizeof(slab->entries[0])))) {
+		return NULL;
+	}
+	slab->next = stripe->slabs;
+	stripe->slabs = slab;
+	stripe->slab_size = size;
+
+	for (i = 1; i < size; i++) {
+		AST_LIST_INSERT_HEAD(&stripe->freelist, &slab->entries[i], entry);
+	}
+	return &slab->entries[0];
+}
+
+/*! \brief Return a bucket entry to the freelist of a stripe */
+static void bucket_entry_free(struct bucket_stripe *stripe, struct bucket_entry *p)
+{
+	p->astobj = NULL;
+	AST_LIST_INSERT_HEAD(&stripe->freelist, p, entry);
+}
+
+/*!
+ * \brief Whether linking one more object should start growing the container.
+ */
+static int container_needs_growth(struct ao2_container *c)
+{
+	return (c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE)
+		&& !c->old_buckets
+		&& c->elements >= c->n_buckets * AO2_LOAD_FACTOR;
+}
+
+/*!
+ * \brief Start growing the container if needed and move a few old buckets
+ * to the new table.
+ *
+ * \note Called with the container write locked.
+ */
+static void container_resize_step(struct ao2_container *c)
+{
+	struct bucket *new_buckets;
+	struct bucket_entry *p;
+	int step;
+	int i;
+
+	if (!(c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE) || c->traversals) {
+		return;
+	}
+
+	if (!c->old_buckets) {
+		if (c->elements <= c->n_buckets * AO2_LOAD_FACTOR) {
+			return;
+		}
+		/* An odd size keeps hash functions with a common factor spread out */
+		if (!(new_buckets = ast_calloc(c->n_buckets * 2 + 1, sizeof(*new_buckets)))) {
+			return;
+		}
+		c->old_buckets = c->buckets;
+		c->old_n_buckets = c->n_buckets;
+		c->migrated = 0;
+		c->buckets = new_buckets;
+		c->n_buckets = c->n_buckets * 2 + 1;
+	}
+
+	for (step = 0; step < AO2_MIGRATE_STEP && c->migrated < c->old_n_buckets; step++, c->migrated++) {
+		while ((p = AST_LIST_REMOVE_HEAD(&c->old_buckets[c->migrated], entry))) {
+			i = (unsigned int) abs(c->hash_fn(EXTERNAL_OBJ(p->astobj), OBJ_POINTER)) % c->n_buckets;
+			/* A new version keeps the objects of each bucket in version order */
+			p->version = ast_atomic_fetchadd_int(&c->version, 1);
+			AST_LIST_INSERT_TAIL(&c->buckets[i], p, entry);
+		}
+	}
+
+	if (c->migrated == c->old_n_buckets) {
+		if (c->old_buckets != c->initial) {
+			ast_free(c->old_buckets);
+		}
+		c->old_buckets = NULL;
+		c->old_n_buckets = 0;
+		c->migrated = 0;
+	}
+}
+
 /*
  * A container is just an object, after all!
  */
 static struct ao2_container *internal_ao2_container_alloc(struct ao2_container *c,
-	unsigned int n_buckets, ao2_hash_fn *hash_fn, ao2_callback_fn *cmp_fn)
+	unsigned int options, unsigned int n_buckets, ao2_hash_fn *hash_fn, ao2_callback_fn *cmp_fn)
 {
+	int i;
+
 	/* XXX maybe consistency check on arguments ? */
 	/* compute the container size */
 
@@ -719,11 +906,32 @@ static struct ao2_container *internal_ao2_container_alloc(struct ao2_container *
 	c->n_buckets = hash_fn ? n_buckets : 1;
 	c->hash_fn = hash_fn ? hash_fn : hash_zero;
 	c->cmp_fn = cmp_fn;
+	c->buckets = c->initial;
+	c->options = options & ~AO2_ALLOC_OPT_LOCK_MASK;
+	if (!hash_fn) {
+		/* A list does not need more buckets */
+		c->options &= ~AO2_CONTAINER_ALLOC_OPT_RESIZE;
+	}
 
 #ifdef AO2_DEBUG
 	ast_atomic_fetchadd_int(&ao2.total_containers, 1);
 #endif
 
+	c->n_stripes = 1;
+	c->stripes = &c->stripe;
+	if ((c->options & AO2_CONTAINER_ALLOC_OPT_STRIPED)
+		&& (options & AO2_ALLOC_OPT_LOCK_MASK) == AO2_ALLOC_OPT_LOCK_RWLOCK) {
+		if (!(c->stripes = ast_calloc(AO2_STRIPES, sizeof(*c->stripes)))) {
+			c->stripes = &c->stripe;
+			ao2_ref(c, -1);
+			return NULL;
+		}
+		c->n_stripes = AO2_STRIPES;
+		for (i = 0; i < c->n_stripes; i++) {
+			ast_mutex_init(&c->stripes[i].lock);
+		}
+	}
+
 	return c;
 }
 
@@ -737,7 +945,7 @@ struct ao2_container *__ao2_container_alloc_debug(unsigned int options,
 	size_t container_size = sizeof(struct ao2_container) + num_buckets * sizeof(struct bucket);
 	struct ao2_container *c = __ao2_alloc_debug(container_size, container_destruct_debug, options, tag, file, line, funcname, ref_debug);
 
-	return internal_ao2_container_alloc(c, num_buckets, hash_fn, cmp_fn);
+	return internal_ao2_container_alloc(c, options, num_buckets, hash_fn, cmp_fn);
 }
 
 struct ao2_container *__ao2_container_alloc(unsigned int options,
@@ -749,7 +957,7 @@ struct ao2_container *__ao2_container_alloc(unsigned int options,
 	size_t container_size = sizeof(struct ao2_container) + num_buckets * sizeof(struct bucket);
 	struct ao2_container *c = __ao2_alloc(container_size, container_destruct, options);
 
-	return internal_ao2_container_alloc(c, num_buckets, hash_fn, cmp_fn);
+	return internal_ao2_container_alloc(c, options, num_buckets, hash_fn, cmp_fn);
 }
 
 /*!
@@ -766,7 +974,10 @@ int ao2_container_count(struct ao2_container *c)
 static struct bucket_entry *internal_ao2_link(struct ao2_container *c, void *user_data, int flags, const char *tag, const char *file, int line, const char *funcname)
 {
 	int i;
+	unsigned int hash;
+	int striped = 0;
 	enum ao2_lock_req orig_lock;
+	struct bucket_stripe *stripe;
 	/* create a new list entry */
 	struct bucket_entry *p;
 	struct astobj2 *obj = INTERNAL_OBJ(user_data);
@@ -779,30 +990,48 @@ static struct bucket_entry *internal_ao2_link(struct ao2_container *c, void *use
 		return NULL;
 	}
 
-	p = ast_calloc(1, sizeof(*p));
-	if (!p) {
-		return NULL;
-	}
-
-	i = abs(c->hash_fn(user_data, OBJ_POINTER));
+	hash = abs(c->hash_fn(user_data, OBJ_POINTER));
 
 	if (flags & OBJ_NOLOCK) {
 		orig_lock = adjust_lock(c, AO2_LOCK_REQ_WRLOCK, 1);
+	} else if (c->n_stripes > 1) {
+		/* Only the bucket needs to be locked unless the table is about to change */
+		ao2_rdlock(c);
+		orig_lock = AO2_LOCK_REQ_MUTEX;
+		striped = 1;
+		if (c->old_buckets || container_needs_growth(c)) {
+			ao2_unlock(c);
+			ao2_wrlock(c);
+			striped = 0;
+		}
 	} else {
 		ao2_wrlock(c);
 		orig_lock = AO2_LOCK_REQ_MUTEX;
 	}
 
-	i %= c->n_buckets;
-	p->astobj = obj;
-	p->version = ast_atomic_fetchadd_int(&c->version, 1);
-	AST_LIST_INSERT_TAIL(&c->buckets[i], p, entry);
-	ast_atomic_fetchadd_int(&c->elements, 1);
+	i = container_hash_index(c, hash);
+	stripe = container_stripe(c, i);
+	if (striped) {
+		ast_mutex_lock(&stripe->lock);
+	}
 
-	if (tag) {
-		__ao2_ref_debug(user_data, +1, tag, file, line, funcname);
-	} else {
-		__ao2_ref(user_data, +1);
+	if ((p = bucket_entry_alloc(stripe))) {
+		p->astobj = obj;
+		p->version = ast_atomic_fetchadd_int(&c->version, 1);
+		AST_LIST_INSERT_TAIL(container_bucket(c, i), p, entry);
+		ast_atomic_fetchadd_int(&c->elements, 1);
+
+		if (tag) {
+			__ao2_ref_debug(user_data, +1, tag, file, line, funcname);
+		} else {
+			__ao2_ref(user_data, +1);
+		}
+	}
+
+	if (striped) {
+		ast_mutex_unlock(&stripe->lock);
+	} else if (p) {
+		container_resize_step(c);
 	}
 
 	if (flags & OBJ_NOLOCK) {
@@ -890,12 +1119,17 @@ static void *internal_ao2_callback(struct ao2_container *c, enum search_flags fl
 	const char *file, int line, const char *funcname)
 {
 	int i, start, last;	/* search boundaries */
+	int total;
+	int hash = -1;
+	int striped = 0;
 	enum ao2_lock_req orig_lock;
 	void *ret = NULL;
+	void *unlinked = NULL;
 	ao2_callback_fn *cb_default = NULL;
 	ao2_callback_data_fn *cb_withdata = NULL;
 	struct ao2_container *multi_container = NULL;
 	struct ao2_iterator *multi_iterator = NULL;
+	struct bucket_stripe *stripe = NULL;
 
 	if (INTERNAL_OBJ(c) == NULL) {	/* safety check on the argument */
 		return NULL;
@@ -949,43 +1183,72 @@ static void *internal_ao2_callback(struct ao2_container *c, enum search_flags fl
 	 */
 	if ((flags & (OBJ_POINTER | OBJ_KEY))) {
 		/* we know hash can handle this case */
-		start = i = c->hash_fn(arg, flags & (OBJ_POINTER | OBJ_KEY)) % c->n_buckets;
-	} else {
-		/* don't know, let's scan all buckets */
-		start = i = -1;		/* XXX this must be fixed later. */
+		hash = abs(c->hash_fn(arg, flags & (OBJ_POINTER | OBJ_KEY)));
 	}
 
-	/* determine the search boundaries: i..last-1 */
-	if (i < 0) {
-		start = i = 0;
-		last = c->n_buckets;
-	} else if ((flags & OBJ_CONTINUE)) {
-		last = c->n_buckets;
-	} else {
-		last = i + 1;
+	/*
+	 * A striped container only needs the bucket locked to find or
+	 * unlink a single object by key.  Anything else, or an unlink
+	 * while the table is changing, needs the container write locked.
+	 */
+	if (c->n_stripes > 1 && hash >= 0 && !(flags & (OBJ_MULTIPLE | OBJ_CONTINUE))
+		&& !((flags & OBJ_NOLOCK) && (flags & OBJ_UNLINK))) {
+		striped = 1;
 	}
 
 	/* avoid modifications to the content */
 	if (flags & OBJ_NOLOCK) {
-		if (flags & OBJ_UNLINK) {
+		if (striped) {
+			/* The caller holds at least a read lock, keep whichever it holds */
+			orig_lock = adjust_lock(c, AO2_LOCK_REQ_RDLOCK, 1);
+		} else if ((flags & OBJ_UNLINK) || c->n_stripes > 1) {
 			orig_lock = adjust_lock(c, AO2_LOCK_REQ_WRLOCK, 1);
 		} else {
 			orig_lock = adjust_lock(c, AO2_LOCK_REQ_RDLOCK, 1);
 		}
 	} else {
 		orig_lock = AO2_LOCK_REQ_MUTEX;
-		if (flags & OBJ_UNLINK) {
+		if (striped) {
+			ao2_rdlock(c);
+			if ((flags & OBJ_UNLINK) && c->old_buckets) {
+				ao2_unlock(c);
+				ao2_wrlock(c);
+				striped = 0;
+			}
+		} else if ((flags & OBJ_UNLINK) || c->n_stripes > 1) {
 			ao2_wrlock(c);
 		} else {
 			ao2_rdlock(c);
 		}
 	}
 
+	/* determine the search boundaries: i..last-1 */
+	total = container_total_buckets(c);
+	if (hash < 0) {
+		start = i = 0;
+		last = total;
+	} else {
+		start = i = container_hash_index(c, hash);
+		if ((flags & OBJ_CONTINUE)) {
+			last = total;
+		} else {
+			last = i + 1;
+		}
+	}
+
+	if (striped) {
+		stripe = container_stripe(c, i);
+		ast_mutex_lock(&stripe->lock);
+	} else if (c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE) {
+		/* Keep the table still while callbacks may link or unlink */
+		ast_atomic_fetchadd_int(&c->traversals, 1);
+	}
+
 	for (; i < last ; i++) {
 		/* scan the list with prev-cur pointers */
 		struct bucket_entry *cur;
 
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&c->buckets[i], cur, entry) {
+		AST_LIST_TRAVERSE_SAFE_BEGIN(container_bucket(c, i), cur, entry) {
 			int match = (CMP_MATCH | CMP_STOP);
 
 			if (type == WITH_DATA) {
@@ -1040,12 +1303,15 @@ static void *internal_ao2_callback(struct ao2_container *c, enum search_flags fl
 				 * returned in a new container that already holds its own ref for the object. If the ref
 				 * from the original container is not accounted for here a memory leak occurs. */
 				if (flags & (OBJ_NODATA | OBJ_MULTIPLE)) {
-					if (tag)
+					if (striped) {
+						/* Not with the bucket locked, the destructor may use the container */
+						unlinked = EXTERNAL_OBJ(cur->astobj);
+					} else if (tag)
 						__ao2_ref_debug(EXTERNAL_OBJ(cur->astobj), -1, tag, file, line, funcname);
 					else
 						__ao2_ref(EXTERNAL_OBJ(cur->astobj), -1);
 				}
-				ast_free(cur);	/* free the link record */
+				bucket_entry_free(container_stripe(c, i), cur);	/* free the link record */
 			}
 
 			if ((match & CMP_STOP) || !(flags & OBJ_MULTIPLE)) {
@@ -1061,19 +1327,36 @@ static void *internal_ao2_callback(struct ao2_container *c, enum search_flags fl
 			break;
 		}
 
-		if (i == c->n_buckets - 1 && (flags & OBJ_POINTER) && (flags & OBJ_CONTINUE)) {
+		if (i == total - 1 && (flags & OBJ_POINTER) && (flags & OBJ_CONTINUE)) {
 			/* Move to the beginning to ensure we check every bucket */
 			i = -1;
 			last = start;
 		}
 	}
 
+	if (striped) {
+		ast_mutex_unlock(&stripe->lock);
+	} else if (c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE) {
+		ast_atomic_fetchadd_int(&c->traversals, -1);
+		if (flags & OBJ_UNLINK) {
+			container_resize_step(c);
+		}
+	}
+
 	if (flags & OBJ_NOLOCK) {
 		adjust_lock(c, orig_lock, 0);
 	} else {
 		ao2_unlock(c);
 	}
 
+	if (unlinked) {
+		if (tag) {
+			__ao2_ref_debug(unlinked, -1, tag, file, line, funcname);
+		} else {
+			__ao2_ref(unlinked, -1);
+		}
+	}
+
 	/* if multi_container was created, we are returning multiple objects */
 	if (multi_container != NULL) {
 		*multi_iterator = ao2_iterator_init(multi_container,
@@ -1140,6 +1423,9 @@ struct ao2_iterator ao2_iterator_init(struct ao2_container *c, int flags)
 	};
 
 	ao2_ref(c, +1);
+	if (c && (c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE)) {
+		ast_atomic_fetchadd_int(&c->traversals, 1);
+	}
 
 	return a;
 }
@@ -1149,6 +1435,9 @@ struct ao2_iterator ao2_iterator_init(struct ao2_container *c, int flags)
  */
 void ao2_iterator_destroy(struct ao2_iterator *i)
 {
+	if (i->c && (i->c->options & AO2_CONTAINER_ALLOC_OPT_RESIZE)) {
+		ast_atomic_fetchadd_int(&i->c->traversals, -1);
+	}
 	ao2_ref(i->c, -1);
 	if (i->flags & AO2_ITERATOR_MALLOCD) {
 		ast_free(i);
@@ -1171,15 +1460,16 @@ static void *internal_ao2_iterator_next(struct ao2_iterator *a, const char *tag,
 		return NULL;
 	}
 
+	/* A striped container allows changes under a read lock */
 	if (a->flags & AO2_ITERATOR_DONTLOCK) {
-		if (a->flags & AO2_ITERATOR_UNLINK) {
+		if ((a->flags & AO2_ITERATOR_UNLINK) || a->c->n_stripes > 1) {
 			orig_lock = adjust_lock(a->c, AO2_LOCK_REQ_WRLOCK, 1);
 		} else {
 			orig_lock = adjust_lock(a->c, AO2_LOCK_REQ_RDLOCK, 1);
 		}
 	} else {
 		orig_lock = AO2_LOCK_REQ_MUTEX;
-		if (a->flags & AO2_ITERATOR_UNLINK) {
+		if ((a->flags & AO2_ITERATOR_UNLINK) || a->c->n_stripes > 1) {
 			ao2_wrlock(a->c);
 		} else {
 			ao2_rdlock(a->c);
@@ -1199,7 +1489,7 @@ static void *internal_ao2_iterator_next(struct ao2_iterator *a, const char *tag,
 		a->obj = NULL;
 	}
 
-	lim = a->c->n_buckets;
+	lim = container_total_buckets(a->c);
 
 	/* Browse the buckets array, moving to the next
 	 * buckets if we don't find the entry in the current one.
@@ -1209,7 +1499,7 @@ static void *internal_ao2_iterator_next(struct ao2_iterator *a, const char *tag,
 	 */
 	for (; a->bucket < lim; a->bucket++, a->version = 0) {
 		/* scan the current bucket */
-		AST_LIST_TRAVERSE(&a->c->buckets[a->bucket], p, entry) {
+		AST_LIST_TRAVERSE(container_bucket(a->c, a->bucket), p, entry) {
 			if (p->version > a->version) {
 				goto found;
 			}
@@ -1222,13 +1512,13 @@ found:
 		if (a->flags & AO2_ITERATOR_UNLINK) {
 			/* we are going to modify the container, so update version */
 			ast_atomic_fetchadd_int(&a->c->version, 1);
-			AST_LIST_REMOVE(&a->c->buckets[a->bucket], p, entry);
+			AST_LIST_REMOVE(container_bucket(a->c, a->bucket), p, entry);
 			/* update number of elements */
 			ast_atomic_fetchadd_int(&a->c->elements, -1);
 			a->version = 0;
 			a->obj = NULL;
 			a->c_version = a->c->version;
-			ast_free(p);
+			bucket_entry_free(container_stripe(a->c, a->bucket), p);
 		} else {
 			a->version = p->version;
 			a->obj = p;
@@ -1279,20 +1569,40 @@ static int cd_cb_debug(void *obj, void *arg, int flag)
 	return 0;
 }
 
-static void container_destruct(void *_c)
+/*! \brief Free the hash tables, bucket entries and stripes of a container */
+static void container_free_buckets(struct ao2_container *c)
 {
-	struct ao2_container *c = _c;
+	struct bucket_slab *slab;
 	int i;
 
-	__ao2_callback(c, OBJ_UNLINK, cd_cb, NULL);
-
-	for (i = 0; i < c->n_buckets; i++) {
-		struct bucket_entry *current;
+	if (c->buckets != c->initial) {
+		ast_free(c->buckets);
+	}
+	if (c->old_buckets && c->old_buckets != c->initial) {
+		ast_free(c->old_buckets);
+	}
 
-		while ((current = AST_LIST_REMOVE_HEAD(&c->buckets[i], entry))) {
-			ast_free(current);
+	for (i = 0; i < c->n_stripes; i++) {
+		while ((slab = c->stripes[i].slabs)) {
+			c->stripes[i].slabs = slab->next;
+			ast_free(slab);
 		}
+		if (c->stripes != &c->stripe) {
+			ast_mutex_destroy(&c->stripes[i].lock);
+		}
+	}
+	if (c->stripes != &c->stripe) {
+		ast_free(c->stripes);
 	}
+}
+
+static void container_destruct(void *_c)
+{
+	struct ao2_container *c = _c;
+
+	__ao2_callback(c, OBJ_UNLINK, cd_cb, NULL);
+
+	container_free_buckets(c);
 
 #ifdef AO2_DEBUG
 	ast_atomic_fetchadd_int(&ao2.total_containers, -1);
@@ -1302,17 +1612,10 @@ static void container_destruct(void *_c)
 static void container_destruct_debug(void *_c)
 {
 	struct ao2_container *c = _c;
-	int i;
 
 	__ao2_callback_debug(c, OBJ_UNLINK, cd_cb_debug, NULL, "container_destruct_debug called", __FILE__, __LINE__, __PRETTY_FUNCTION__);
 
-	for (i = 0; i < c->n_buckets; i++) {
-		struct bucket_entry *current;
-
-		while ((current = AST_LIST_REMOVE_HEAD(&c->buckets[i], entry))) {
-			ast_free(current);
-		}
-	}
+	container_free_buckets(c);
 
 #ifdef AO2_DEBUG
 	ast_atomic_fetchadd_int(&ao2.total_containers, -1);
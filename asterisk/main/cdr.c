@@ -50,15 +50,61 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 357542 $")
 #include "asterisk/cli.h"
 #include "asterisk/stringfields.h"
 #include "asterisk/data.h"
+#include "asterisk/test.h"
 
 /*! Default AMA flag for billing records (CDR's) */
 int ast_default_amaflags = AST_CDR_DOCUMENTATION;
 char ast_default_accountcode[AST_MAX_ACCOUNT_CODE];
 
+/*! \brief A CDR record waiting in the queue of a backend */
+struct cdr_be_queue_entry {
+	/*! Copy of the record of the backend's own, backends may change it */
+	struct ast_cdr *cdr;
+	/*! When the record was queued */
+	struct timeval queued;
+	AST_LIST_ENTRY(cdr_be_queue_entry) list;
+};
+
+/*!
+ * \brief Queue of a CDR backend
+ *
+ * A thread of the queue posts the records to the backend, so that a slow
+ * backend neither holds up the others nor the channel posting the record.
+ */
+struct cdr_be_queue {
+	ast_mutex_t lock;
+	/*! Signalled when a record is queued or the thread has to stop */
+	ast_cond_t cond;
+	/*! Signalled when the queue is empty */
+	ast_cond_t drained;
+	pthread_t thread;
+	ast_cdrbe be;
+	AST_LIST_HEAD_NOLOCK(, cdr_be_queue_entry) entries;
+	/*! Most records allowed to wait */
+	unsigned int size;
+	/*! Records waiting, including the one being posted */
+	unsigned int depth;
+	unsigned int max_depth;
+	unsigned int posted;
+	unsigned int dropped;
+	/*! Records dropped since the queue was last full */
+	unsigned int lost;
+	unsigned int max_latency;
+	/*! Milliseconds the posted records took in all */
+	uint64_t latency_total;
+	/*! Set once the queue is full, until a record fits again */
+	unsigned int full:1;
+	/*! Set when the thread has to stop once the queue is empty */
+	unsigned int stop:1;
+	AST_LIST_ENTRY(cdr_be_queue) list;
+};
+
 struct ast_cdr_beitem {
 	char name[20];
 	char desc[80];
 	ast_cdrbe be;
+	/*! Queue of the backend, NULL if records are posted to it directly */
+	struct cdr_be_queue *queue;
 	AST_RWLIST_ENTRY(ast_cdr_beitem) list;
 };
 
@@ -108,6 +154,9 @@ static const int BATCH_SCHEDULER_ONLY_DEFAULT = 0;
 static int batchsafeshutdown;
 static const int BATCH_SAFE_SHUTDOWN_DEFAULT = 1;
 
+static int queuesize;
+static const int QUEUE_SIZE_DEFAULT = 0;
+
 AST_MUTEX_DEFINE_STATIC(cdr_batch_lock);
 
 /* these are used to wake up the CDR thread when there's work to do */
@@ -119,6 +168,220 @@ int check_cdr_enabled(void)
 	return enabled;
 }
 
+/*!
+ * \internal
+ * \brief Post the records of a backend queue to the backend.
+ *
+ * \param data Backend queue.
+ *
+ * \return NULL
+ */
+static void *cdr_be_queue_thread(void *data)
+{
+	struct cdr_be_queue *queue = data;
+	struct cdr_be_queue_entry *entry;
+	int64_t latency;
+
+	ast_mutex_lock(&queue->lock);
+	for (;;) {
+		while (!(entry = AST_LIST_REMOVE_HEAD(&queue->entries, list))) {
+			if (queue->stop) {
+				ast_mutex_unlock(&queue->lock);
+				return NULL;
+			}
+			ast_cond_wait(&queue->cond, &queue->lock);
+		}
+		ast_mutex_unlock(&queue->lock);
+
+		queue->be(entry->cdr);
+		latency = ast_tvdiff_ms(ast_tvnow(), entry->queued);
+		ast_cdr_free(entry->cdr);
+		ast_free(entry);
+
+		ast_mutex_lock(&queue->lock);
+		if (!--queue->depth) {
+			ast_cond_broadcast(&queue->drained);
+		}
+		++queue->posted;
+		queue->latency_total += latency;
+		if (queue->max_latency < latency) {
+			queue->max_latency = latency;
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Create the queue of a backend and start its thread.
+ *
+ * \param beitem Backend.
+ * \param size Most records allowed to wait.
+ *
+ * \retval queue on success.
+ * \retval NULL on error.
+ */
+static struct cdr_be_queue *cdr_be_queue_alloc(struct ast_cdr_beitem *beitem, unsigned int size)
+{
+	struct cdr_be_queue *queue;
+
+	if (!(queue = ast_calloc(1, sizeof(*queue)))) {
+		return NULL;
+	}
+	ast_mutex_init(&queue->lock);
+	ast_cond_init(&queue->cond, NULL);
+	ast_cond_init(&queue->drained, NULL);
+	queue->be = beitem->be;
+	queue->size = size;
+	if (ast_pthread_create_background(&queue->thread, NULL, cdr_be_queue_thread, queue)) {
+		ast_log(LOG_WARNING, "Unable to start the queue thread of CDR backend '%s', posting directly\n", beitem->name);
+		ast_cond_destroy(&queue->drained);
+		ast_cond_destroy(&queue->cond);
+		ast_mutex_destroy(&queue->lock);
+		ast_free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+/*!
+ * \internal
+ * \brief Post the records left in a backend queue and destroy it.
+ *
+ * \param queue Backend queue, no longer used by its backend.
+ *
+ * \return Nothing
+ */
+static void cdr_be_queue_destroy(struct cdr_be_queue *queue)
+{
+	ast_mutex_lock(&queue->lock);
+	queue->stop = 1;
+	ast_cond_signal(&queue->cond);
+	ast_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	ast_cond_destroy(&queue->drained);
+	ast_cond_destroy(&queue->cond);
+	ast_mutex_destroy(&queue->lock);
+	ast_free(queue);
+}
+
+/*!
+ * \internal
+ * \brief Queue a copy of a record for a backend with a queue.
+ *
+ * \param beitem Backend.
+ * \param cdr Record to post, without the records chained to it.
+ *
+ * \retval 0 on success.
+ * \retval -1 if no copy could be made, the record is not queued or dropped.
+ */
+static int cdr_be_queue_push(struct ast_cdr_beitem *beitem, struct ast_cdr *cdr)
+{
+	struct cdr_be_queue *queue = beitem->queue;
+	struct cdr_be_queue_entry *entry;
+
+	if (!(entry = ast_calloc(1, sizeof(*entry)))) {
+		return -1;
+	}
+	/* The record is freed once posted, and backends may change their copy. */
+	if (!(entry->cdr = ast_cdr_dup(cdr))) {
+		ast_free(entry);
+		return -1;
+	}
+
+	ast_mutex_lock(&queue->lock);
+	if (queue->size <= queue->depth) {
+		++queue->dropped;
+		++queue->lost;
+		if (!queue->full) {
+			queue->full = 1;
+			ast_log(LOG_WARNING, "Queue of CDR backend '%s' is full, dropping records\n", beitem->name);
+		}
+		ast_mutex_unlock(&queue->lock);
+		ast_cdr_free(entry->cdr);
+		ast_free(entry);
+		return 0;
+	}
+	if (queue->full) {
+		ast_log(LOG_WARNING, "Queue of CDR backend '%s' takes records again, %u record%s dropped\n",
+			beitem->name, queue->lost, ESS(queue->lost));
+		queue->full = 0;
+		queue->lost = 0;
+	}
+
+	entry->queued = ast_tvnow();
+	AST_LIST_INSERT_TAIL(&queue->entries, entry, list);
+	if (queue->max_depth < ++queue->depth) {
+		queue->max_depth = queue->depth;
+	}
+	ast_cond_signal(&queue->cond);
+	ast_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Give the backends queues of the configured size, or none.
+ *
+ * \return Nothing
+ */
+static void cdr_be_queues_update(void)
+{
+	AST_LIST_HEAD_NOLOCK(, cdr_be_queue) stopped;
+	struct cdr_be_queue *queue;
+	struct ast_cdr_beitem *i;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&stopped);
+
+	AST_RWLIST_WRLOCK(&be_list);
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		if (!queuesize) {
+			if (i->queue) {
+				AST_LIST_INSERT_TAIL(&stopped, i->queue, list);
+				i->queue = NULL;
+			}
+		} else if (i->queue) {
+			ast_mutex_lock(&i->queue->lock);
+			i->queue->size = queuesize;
+			ast_mutex_unlock(&i->queue->lock);
+		} else {
+			i->queue = cdr_be_queue_alloc(i, queuesize);
+		}
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+
+	while ((queue = AST_LIST_REMOVE_HEAD(&stopped, list))) {
+		cdr_be_queue_destroy(queue);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Wait until the backend queues are empty.
+ *
+ * \return Nothing
+ */
+static void cdr_be_queues_drain(void)
+{
+	struct ast_cdr_beitem *i;
+
+	AST_RWLIST_RDLOCK(&be_list);
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		if (!i->queue) {
+			continue;
+		}
+		ast_mutex_lock(&i->queue->lock);
+		while (i->queue->depth) {
+			ast_cond_wait(&i->queue->drained, &i->queue->lock);
+		}
+		ast_mutex_unlock(&i->queue->lock);
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+}
+
 /*!
  * \brief Register a CDR driver. Each registered CDR driver generates a CDR
  * \retval 0 on success.
@@ -151,6 +414,9 @@ int ast_cdr_register(const char *name, const char *desc, ast_cdrbe be)
 	i->be = be;
 	ast_copy_string(i->name, name, sizeof(i->name));
 	ast_copy_string(i->desc, desc, sizeof(i->desc));
+	if (queuesize) {
+		i->queue = cdr_be_queue_alloc(i, queuesize);
+	}
 
 	AST_RWLIST_INSERT_HEAD(&be_list, i, list);
 	AST_RWLIST_UNLOCK(&be_list);
@@ -174,6 +440,10 @@ void ast_cdr_unregister(const char *name)
 	AST_RWLIST_UNLOCK(&be_list);
 
 	if (i) {
+		if (i->queue) {
+			/* Post what is left while the backend is still there. */
+			cdr_be_queue_destroy(i->queue);
+		}
 		ast_verb(2, "Unregistered '%s' CDR backend\n", name);
 		ast_free(i);
 	}
@@ -1170,7 +1440,9 @@ static void post_cdr(struct ast_cdr *cdr)
 			continue;
 		AST_RWLIST_RDLOCK(&be_list);
 		AST_RWLIST_TRAVERSE(&be_list, i, list) {
-			i->be(cdr);
+			if (!i->queue || cdr_be_queue_push(i, cdr)) {
+				i->be(cdr);
+			}
 		}
 		AST_RWLIST_UNLOCK(&be_list);
 	}
@@ -1475,10 +1747,33 @@ static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_
 		AST_RWLIST_RDLOCK(&be_list);
 		if (AST_RWLIST_EMPTY(&be_list)) {
 			ast_cli(a->fd, "    (none)\n");
-		} else {
+		} else if (!queuesize) {
 			AST_RWLIST_TRAVERSE(&be_list, beitem, list) {
 				ast_cli(a->fd, "    %s\n", beitem->name);
 			}
+		} else {
+			ast_cli(a->fd, "    Maximum queue size: %d record%s\n", queuesize, ESS(queuesize));
+			ast_cli(a->fd, "    %-20s %8s %8s %10s %8s %8s %8s\n",
+				"Name", "Queued", "Most", "Posted", "Dropped", "Avg ms", "Max ms");
+			AST_RWLIST_TRAVERSE(&be_list, beitem, list) {
+				struct cdr_be_queue *queue = beitem->queue;
+				unsigned int depth, max_depth, posted, dropped, latency, max_latency;
+
+				if (!queue) {
+					ast_cli(a->fd, "    %-20s (posted directly)\n", beitem->name);
+					continue;
+				}
+				ast_mutex_lock(&queue->lock);
+				depth = queue->depth;
+				max_depth = queue->max_depth;
+				posted = queue->posted;
+				dropped = queue->dropped;
+				latency = posted ? queue->latency_total / posted : 0;
+				max_latency = queue->max_latency;
+				ast_mutex_unlock(&queue->lock);
+				ast_cli(a->fd, "    %-20s %8u %8u %10u %8u %8u %8u\n", beitem->name,
+					depth, max_depth, posted, dropped, latency, max_latency);
+			}
 		}
 		AST_RWLIST_UNLOCK(&be_list);
 		ast_cli(a->fd, "\n");
@@ -1517,6 +1812,7 @@ static int do_reload(int reload)
 	struct ast_variable *v;
 	int cfg_size;
 	int cfg_time;
+	int cfg_queuesize;
 	int was_enabled;
 	int was_batchmode;
 	int res = 0;
@@ -1539,9 +1835,11 @@ static int do_reload(int reload)
 	batchmode = BATCHMODE_DEFAULT;
 	unanswered = UNANSWERED_DEFAULT;
 	congestion = CONGESTION_DEFAULT;
+	queuesize = QUEUE_SIZE_DEFAULT;
 
 	if (config == CONFIG_STATUS_FILEMISSING || config == CONFIG_STATUS_FILEINVALID) {
 		ast_mutex_unlock(&cdr_batch_lock);
+		cdr_be_queues_update();
 		return 0;
 	}
 
@@ -1577,6 +1875,14 @@ static int do_reload(int reload)
 			} else {
 				batchtime = cfg_time;
 			}
+		} else if (!strcasecmp(v->name, "queuesize")) {
+			if (sscanf(v->value, "%30d", &cfg_queuesize) < 1) {
+				ast_log(LOG_WARNING, "Unable to convert '%s' to a numeric value.\n", v->value);
+			} else if (cfg_queuesize < 0) {
+				ast_log(LOG_WARNING, "Invalid backend queue size '%d' specified, using default\n", cfg_queuesize);
+			} else {
+				queuesize = cfg_queuesize;
+			}
 		} else if (!strcasecmp(v->name, "endbeforehexten")) {
 			ast_set2_flag(&ast_options, ast_true(v->value), AST_OPT_FLAG_END_CDR_BEFORE_H_EXTEN);
 		} else if (!strcasecmp(v->name, "initiatedseconds")) {
@@ -1602,7 +1908,6 @@ static int do_reload(int reload)
 			AST_SCHED_DEL(sched, cdr_sched);
 		} else {
 			ast_cli_register(&cli_submit);
-			ast_register_atexit(ast_cdr_engine_term);
 			res = 0;
 		}
 	/* if this reload disabled the CDR and/or batch mode and there is a background thread,
@@ -1615,7 +1920,6 @@ static int do_reload(int reload)
 		cdr_thread = AST_PTHREADT_NULL;
 		ast_cond_destroy(&cdr_pending_cond);
 		ast_cli_unregister(&cli_submit);
-		ast_unregister_atexit(ast_cdr_engine_term);
 		res = 0;
 		/* if leaving batch mode, then post the CDRs in the batch,
 		   and don't reschedule, since we are stopping CDR logging */
@@ -1628,11 +1932,129 @@ static int do_reload(int reload)
 
 	ast_mutex_unlock(&cdr_batch_lock);
 	ast_config_destroy(config);
+	cdr_be_queues_update();
 	manager_event(EVENT_FLAG_SYSTEM, "Reload", "Module: CDR\r\nMessage: CDR subsystem reload requested\r\n");
 
 	return res;
 }
 
+#if defined(TEST_FRAMEWORK)
+AST_MUTEX_DEFINE_STATIC(test_be_lock);
+static ast_cond_t test_be_cond;
+/*! Whether the test backend may post records */
+static int test_be_open;
+static char test_be_posted[8][AST_MAX_EXTENSION];
+static int test_be_count;
+
+/*! \brief A backend that waits until the test lets it post, and changes the records like cdr_mysql */
+static int test_be(struct ast_cdr *cdr)
+{
+	ast_mutex_lock(&test_be_lock);
+	while (!test_be_open) {
+		ast_cond_wait(&test_be_cond, &test_be_lock);
+	}
+	if (test_be_count < ARRAY_LEN(test_be_posted)) {
+		ast_copy_string(test_be_posted[test_be_count++], cdr->src, sizeof(test_be_posted[0]));
+	}
+	ast_mutex_unlock(&test_be_lock);
+	ast_cdr_setvar(cdr, "test_posted", "yes", 0);
+
+	return 0;
+}
+
+AST_TEST_DEFINE(cdr_be_queue_test)
+{
+	static const char * const expected[] = { "1", "2", "3", "6" };
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct ast_cdr_beitem beitem = { .name = "test", .be = test_be, };
+	struct ast_cdr *cdr;
+	unsigned int dropped;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "cdr_be_queue_test";
+		info->category = "/main/cdr/";
+		info->summary = "Test the queue of a CDR backend";
+		info->description =
+			"Queues records for a backend that is held up, and checks that "
+			"the records beyond the queue size are dropped, that the queue "
+			"takes records again once posted, that the backend gets copies "
+			"of its own, and that the records are posted in order.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(cdr = ast_cdr_alloc())) {
+		return AST_TEST_FAIL;
+	}
+	ast_cond_init(&test_be_cond, NULL);
+	test_be_open = 0;
+	test_be_count = 0;
+	if (!(beitem.queue = cdr_be_queue_alloc(&beitem, 3))) {
+		ast_cond_destroy(&test_be_cond);
+		ast_cdr_free(cdr);
+		return AST_TEST_FAIL;
+	}
+
+	/* The backend is held up, so the queue holds three records and drops the rest */
+	for (i = 1; i <= 5; i++) {
+		snprintf(cdr->src, sizeof(cdr->src), "%d", i);
+		if (cdr_be_queue_push(&beitem, cdr)) {
+			res = AST_TEST_FAIL;
+		}
+	}
+	ast_mutex_lock(&beitem.queue->lock);
+	dropped = beitem.queue->dropped;
+	ast_mutex_unlock(&beitem.queue->lock);
+	if (dropped != 2) {
+		ast_test_status_update(test, "A full queue dropped %u records, not 2\n", dropped);
+		res = AST_TEST_FAIL;
+	}
+
+	/* Once the backend posts them, the queue takes records again */
+	ast_mutex_lock(&test_be_lock);
+	test_be_open = 1;
+	ast_cond_broadcast(&test_be_cond);
+	ast_mutex_unlock(&test_be_lock);
+	ast_mutex_lock(&beitem.queue->lock);
+	while (beitem.queue->depth) {
+		ast_cond_wait(&beitem.queue->drained, &beitem.queue->lock);
+	}
+	ast_mutex_unlock(&beitem.queue->lock);
+	snprintf(cdr->src, sizeof(cdr->src), "%d", 6);
+	cdr_be_queue_push(&beitem, cdr);
+	ast_mutex_lock(&beitem.queue->lock);
+	if (beitem.queue->full || beitem.queue->lost || beitem.queue->dropped != 2) {
+		ast_test_status_update(test, "The queue did not take records again once it had room\n");
+		res = AST_TEST_FAIL;
+	}
+	ast_mutex_unlock(&beitem.queue->lock);
+	cdr_be_queue_destroy(beitem.queue);
+
+	if (test_be_count != ARRAY_LEN(expected)) {
+		ast_test_status_update(test, "%d records were posted, not %d\n", test_be_count, (int) ARRAY_LEN(expected));
+		res = AST_TEST_FAIL;
+	}
+	for (i = 0; i < test_be_count && i < ARRAY_LEN(expected); i++) {
+		if (strcmp(test_be_posted[i], expected[i])) {
+			ast_test_status_update(test, "Record %d posted was '%s', not '%s'\n", i, test_be_posted[i], expected[i]);
+			res = AST_TEST_FAIL;
+		}
+	}
+	if (ast_cdr_getvar_internal(cdr, "test_posted", 0)) {
+		ast_test_status_update(test, "The backend changed the record instead of a copy\n");
+		res = AST_TEST_FAIL;
+	}
+
+	ast_cond_destroy(&test_be_cond);
+	ast_cdr_free(cdr);
+
+	return res;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
 int ast_cdr_engine_init(void)
 {
 	int res;
@@ -1644,6 +2066,11 @@ int ast_cdr_engine_init(void)
 	}
 
 	ast_cli_register(&cli_status);
+	/* Also posts the records left in the batch and the backend queues at exit */
+	ast_register_atexit(ast_cdr_engine_term);
+#if defined(TEST_FRAMEWORK)
+	AST_TEST_REGISTER(cdr_be_queue_test);
+#endif
 
 	res = do_reload(0);
 	if (res) {
@@ -1660,6 +2087,9 @@ int ast_cdr_engine_init(void)
 void ast_cdr_engine_term(void)
 {
 	ast_cdr_submit_batch(batchsafeshutdown);
+	if (batchsafeshutdown) {
+		cdr_be_queues_drain();
+	}
 }
 
 int ast_cdr_engine_reload(void)
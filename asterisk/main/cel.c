@@ -49,6 +49,12 @@ static unsigned char cel_enabled;
 /*! \brief CEL is off by default */
 #define CEL_ENABLED_DEFAULT		0
 
+/*! Most events allowed to wait for each backend, 0 to not queue them */
+static unsigned int cel_queuesize;
+
+/*! \brief Let 1000 events wait for each backend by default */
+#define CEL_QUEUE_SIZE_DEFAULT	0
+
 /*! 
  * \brief which events we want to track 
  *
@@ -150,6 +156,17 @@ static void print_cel_sub(const struct ast_event *event, void *data)
 			ast_event_get_ie_str(event, AST_EVENT_IE_DESCRIPTION));
 }
 
+#define CEL_QUEUE_FORMAT "%-30.30s %8u %8u %10u %8u %8u %8u\n"
+#define CEL_QUEUE_HEADER "%-30.30s %8s %8s %10s %8s %8s %8s\n"
+
+static void print_cel_queue(const struct ast_event_sub_stats *stats, void *data)
+{
+	struct ast_cli_args *a = data;
+
+	ast_cli(a->fd, CEL_QUEUE_FORMAT, stats->description, stats->depth, stats->max_depth,
+		stats->delivered, stats->dropped, stats->latency, stats->max_latency);
+}
+
 static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	unsigned int i;
@@ -201,6 +218,13 @@ static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_
 	ast_event_sub_destroy(sub);
 	sub = NULL;
 
+	if (cel_queuesize) {
+		ast_cli(a->fd, "\nCEL Backend Queues (at most %u events each):\n", cel_queuesize);
+		ast_cli(a->fd, CEL_QUEUE_HEADER, "Subscriber", "Queued", "Most", "Delivered",
+			"Dropped", "Avg ms", "Max ms");
+		ast_event_sub_queue_stats(AST_EVENT_CEL, print_cel_queue, a);
+	}
+
 	return CLI_SUCCESS;
 }
 
@@ -294,11 +318,13 @@ static int do_reload(void)
 	int res = 0;
 	struct ast_flags config_flags = { 0, };
 	const char *s;
+	int queuesize;
 
 	ast_mutex_lock(&reload_lock);
 
 	/* Reset all settings before reloading configuration */
 	cel_enabled = CEL_ENABLED_DEFAULT;
+	cel_queuesize = CEL_QUEUE_SIZE_DEFAULT;
 	eventset = CEL_DEFAULT_EVENTS;
 	*cel_dateformat = '\0';
 	ao2_callback(appset, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
@@ -331,9 +357,23 @@ static int do_reload(void)
 		parse_apps(val);
 	}
 
+	if ((val = ast_variable_retrieve(config, "general", "queuesize"))) {
+		/* %u would take "-1" as a huge queue */
+		if (sscanf(val, "%30d", &queuesize) != 1 || queuesize < 0) {
+			ast_log(LOG_WARNING, "Invalid queuesize '%s', using %d\n", val, CEL_QUEUE_SIZE_DEFAULT);
+		} else {
+			cel_queuesize = queuesize;
+		}
+	}
+
 return_cleanup:
 	ast_verb(3, "CEL logging %sabled.\n", cel_enabled ? "en" : "dis");
 
+	/* Disabled CEL posts no events, so its backends need no queues */
+	if (ast_event_queue_subs(AST_EVENT_CEL, cel_enabled ? cel_queuesize : 0)) {
+		ast_log(LOG_WARNING, "Not all CEL backends got an event queue of their own\n");
+	}
+
 	ast_mutex_unlock(&reload_lock);
 
 	if (config) {
@@ -7958,8 +7958,8 @@ static const struct ast_data_entry channel_providers[] = {
 
 void ast_channels_init(void)
 {
-	channels = ao2_container_alloc(NUM_CHANNEL_BUCKETS,
-			ast_channel_hash_cb, ast_channel_cmp_cb);
+	channels = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+			NUM_CHANNEL_BUCKETS, ast_channel_hash_cb, ast_channel_cmp_cb);
 
 	ast_cli_register_multiple(cli_channel, ARRAY_LEN(cli_channel));
 
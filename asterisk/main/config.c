@@ -48,6 +48,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 355413 $")
 #include "asterisk/astobj2.h"
 #include "asterisk/strings.h"	/* for the ast_str_*() API */
 #include "asterisk/netsock2.h"
+#include "asterisk/test.h"
 
 #define MAX_NESTED_COMMENTS 128
 #define COMMENT_START ";--"
@@ -2060,9 +2061,496 @@ int ast_config_text_file_save(const char *configfile, const struct ast_config *c
 	return 0;
 }
 
+/*! Default number of lookups a realtime family cache keeps */
+#define REALTIME_CACHE_MAX_ENTRIES	1000
+/*! Number of buckets in the entry table of a realtime family cache */
+#define REALTIME_CACHE_BUCKETS		563
+
+/*!
+ * \brief A cached realtime lookup.
+ *
+ * \note The key is 'S' for ast_load_realtime() or 'M' for
+ * ast_load_realtime_multientry() followed by the lookup fields, each
+ * as name \001 value \002.
+ */
+struct realtime_cache_entry {
+	AST_LIST_ENTRY(realtime_cache_entry) list;
+	/*! When the lookup has to be made again */
+	struct timeval expires;
+	/*! Result of ast_load_realtime(), NULL if nothing was found */
+	struct ast_variable *var;
+	/*! Result of ast_load_realtime_multientry(), NULL if nothing was found */
+	struct ast_config *cfg;
+	char key[0];
+};
+
+/*!
+ * \brief Lookups of a realtime family, as set up in the [cache] section of extconfig.conf.
+ *
+ * \note The entries container and list are protected by the lock of the
+ * realtime_cache object.
+ */
+struct realtime_cache {
+	/*! Seconds a found lookup is kept */
+	unsigned int ttl;
+	/*! Seconds a lookup that found nothing is kept, 0 to not keep them */
+	unsigned int negative_ttl;
+	/*! Most lookups kept, the oldest are dropped to make room */
+	unsigned int max_entries;
+	/*! Drop the lookups a write to the family can change */
+	unsigned int invalidate:1;
+	/*! Bumped when lookups are dropped, so lookups made meanwhile are not kept */
+	unsigned int generation;
+	/*! Number of lookups kept */
+	unsigned int count;
+	unsigned int hits;
+	unsigned int negative_hits;
+	unsigned int misses;
+	unsigned int evicted;
+	unsigned int invalidated;
+	/*! Lookups by key */
+	struct ao2_container *entries;
+	/*! Lookups oldest first */
+	AST_LIST_HEAD_NOLOCK(, realtime_cache_entry) list;
+	char family[0];
+};
+
+/*! Realtime family caches by family, replaced on every read_config_maps(). Protected by config_lock. */
+static struct ao2_container *realtime_caches;
+
+AST_THREADSTORAGE(realtime_cache_key_buf);
+
+static int realtime_cache_hash(const void *obj, const int flags)
+{
+	const struct realtime_cache *cache = obj;
+
+	return ast_str_case_hash(flags & OBJ_KEY ? obj : cache->family);
+}
+
+static int realtime_cache_cmp(void *obj, void *arg, int flags)
+{
+	struct realtime_cache *cache = obj;
+	const char *family = flags & OBJ_KEY ? arg : ((struct realtime_cache *) arg)->family;
+
+	return !strcasecmp(cache->family, family) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static int realtime_cache_entry_hash(const void *obj, const int flags)
+{
+	const struct realtime_cache_entry *entry = obj;
+
+	return ast_str_hash(flags & OBJ_KEY ? obj : entry->key);
+}
+
+static int realtime_cache_entry_cmp(void *obj, void *arg, int flags)
+{
+	struct realtime_cache_entry *entry = obj;
+	const char *key = flags & OBJ_KEY ? arg : ((struct realtime_cache_entry *) arg)->key;
+
+	return !strcmp(entry->key, key) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static void realtime_cache_entry_destroy(void *obj)
+{
+	struct realtime_cache_entry *entry = obj;
+
+	ast_variables_destroy(entry->var);
+	if (entry->cfg) {
+		ast_config_destroy(entry->cfg);
+	}
+}
+
+static void realtime_cache_destroy(void *obj)
+{
+	struct realtime_cache *cache = obj;
+
+	if (cache->entries) {
+		ao2_ref(cache->entries, -1);
+	}
+}
+
+/*! \brief Copy the categories and variables of a realtime multientry result */
+static struct ast_config *realtime_config_dup(const struct ast_config *cfg)
+{
+	struct ast_config *dup;
+	struct ast_category *cat;
+	struct ast_category *new_cat;
+	struct ast_variable *var;
+
+	if (!(dup = ast_config_new())) {
+		return NULL;
+	}
+	for (cat = cfg->root; cat; cat = cat->next) {
+		if (!(new_cat = ast_category_new(cat->name, "", 0))) {
+			ast_config_destroy(dup);
+			return NULL;
+		}
+		ast_category_append(dup, new_cat);
+		if (cat->root) {
+			if (!(new_cat->root = ast_variables_dup(cat->root))) {
+				ast_config_destroy(dup);
+				return NULL;
+			}
+			for (var = new_cat->root; var->next; var = var->next) {
+			}
+			new_cat->last = var;
+		}
+	}
+	return dup;
+}
+
+/*!
+ * \brief Set up the cache of a realtime family.
+ *
+ * \param family Realtime family.
+ * \param options Comma separated ttl, negative_ttl, max_entries and invalidate options.
+ *
+ * \return The cache, NULL on error.
+ */
+static struct realtime_cache *realtime_cache_alloc(const char *family, const char *options)
+{
+	struct realtime_cache *cache;
+	char *buf = ast_strdupa(options);
+	char *name;
+	char *value;
+
+	if (!(cache = ao2_alloc(sizeof(*cache) + strlen(family) + 1, realtime_cache_destroy))) {
+		return NULL;
+	}
+	strcpy(cache->family, family);
+	cache->max_entries = REALTIME_CACHE_MAX_ENTRIES;
+	cache->invalidate = 1;
+	AST_LIST_HEAD_INIT_NOLOCK(&cache->list);
+
+	while ((value = strsep(&buf, ","))) {
+		name = ast_strip(strsep(&value, "="));
+		value = ast_strip(S_OR(value, ""));
+		if (!strcasecmp(name, "ttl")) {
+			if (sscanf(value, "%30u", &cache->ttl) != 1) {
+				ast_log(LOG_WARNING, "Invalid ttl '%s' for realtime cache of '%s'\n", value, family);
+			}
+		} else if (!strcasecmp(name, "negative_ttl")) {
+			if (sscanf(value, "%30u", &cache->negative_ttl) != 1) {
+				ast_log(LOG_WARNING, "Invalid negative_ttl '%s' for realtime cache of '%s'\n", value, family);
+			}
+		} else if (!strcasecmp(name, "max_entries")) {
+			if (sscanf(value, "%30u", &cache->max_entries) != 1 || !cache->max_entries) {
+				ast_log(LOG_WARNING, "Invalid max_entries '%s' for realtime cache of '%s'\n", value, family);
+				cache->max_entries = REALTIME_CACHE_MAX_ENTRIES;
+			}
+		} else if (!strcasecmp(name, "invalidate")) {
+			cache->invalidate = ast_true(value) ? 1 : 0;
+		} else if (!ast_strlen_zero(name)) {
+			ast_log(LOG_WARNING, "Unknown option '%s' for realtime cache of '%s'\n", name, family);
+		}
+	}
+
+	if (!cache->ttl) {
+		ast_log(LOG_WARNING, "Realtime cache of '%s' needs a ttl, not caching it\n", family);
+		ao2_ref(cache, -1);
+		return NULL;
+	}
+
+	if (!(cache->entries = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_NOLOCK,
+		REALTIME_CACHE_BUCKETS, realtime_cache_entry_hash, realtime_cache_entry_cmp))) {
+		ao2_ref(cache, -1);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/*! \brief Find the cache of a realtime family, if it has one */
+static struct realtime_cache *realtime_cache_find(const char *family)
+{
+	struct realtime_cache *cache = NULL;
+
+	ast_mutex_lock(&config_lock);
+	if (realtime_caches) {
+		cache = ao2_find(realtime_caches, family, OBJ_KEY);
+	}
+	ast_mutex_unlock(&config_lock);
+
+	return cache;
+}
+
+/*!
+ * \brief Build the cache key of a realtime lookup.
+ *
+ * \param type 'S' for a single row lookup, 'M' for a multientry lookup.
+ * \param ap Lookup fields, name and value pairs ending with a NULL name.
+ *
+ * \return The key, in a thread local buffer. NULL on error.
+ */
+static const char *realtime_cache_key(char type, va_list ap)
+{
+	struct ast_str *key;
+	const char *name;
+	const char *value;
+
+	if (!(key = ast_str_thread_get(&realtime_cache_key_buf, 128))) {
+		return NULL;
+	}
+	ast_str_set(&key, 0, "%c", type);
+	while ((name = va_arg(ap, const char *))) {
+		value = va_arg(ap, const char *);
+		ast_str_append(&key, 0, "%s\001%s\002", name, S_OR(value, ""));
+	}
+
+	return ast_str_buffer(key);
+}
+
+static void realtime_cache_unlink(struct realtime_cache *cache, struct realtime_cache_entry *entry)
+{
+	AST_LIST_REMOVE(&cache->list, entry, list);
+	--cache->count;
+	ao2_unlink(cache->entries, entry);
+}
+
+/*!
+ * \brief Look a realtime lookup up in the cache of its family.
+ *
+ * \param cache Cache of the family.
+ * \param key Key of the lookup.
+ * \param var Set to a copy of the single row result.
+ * \param cfg Set to a copy of the multientry result.
+ * \param generation Set to the generation of the cache when the lookup is not cached.
+ *
+ * \retval 1 if the lookup was cached. *var or *cfg are NULL if it found nothing.
+ * \retval 0 if the lookup has to be made.
+ */
+static int realtime_cache_get(struct realtime_cache *cache, const char *key,
+	struct ast_variable **var, struct ast_config **cfg, unsigned int *generation)
+{
+	struct realtime_cache_entry *entry;
+	int found = 0;
+
+	ao2_lock(cache);
+	if ((entry = ao2_find(cache->entries, key, OBJ_KEY))) {
+		if (ast_tvcmp(entry->expires, ast_tvnow()) <= 0) {
+			realtime_cache_unlink(cache, entry);
+		} else if (entry->var) {
+			found = (*var = ast_variables_dup(entry->var)) ? 1 : 0;
+		} else if (entry->cfg) {
+			found = (*cfg = realtime_config_dup(entry->cfg)) ? 1 : 0;
+		} else {
+			++cache->negative_hits;
+			found = 1;
+		}
+		ao2_ref(entry, -1);
+	}
+	if (found) {
+		++cache->hits;
+	} else {
+		++cache->misses;
+		*generation = cache->generation;
+	}
+	ao2_unlock(cache);
+
+	return found;
+}
+
+/*!
+ * \brief Keep the result of a realtime lookup in the cache of its family.
+ *
+ * \param cache Cache of the family.
+ * \param key Key of the lookup.
+ * \param generation Generation of the cache when the lookup was started.
+ * \param var Single row result to copy, NULL if none.
+ * \param cfg Multientry result to copy, NULL if none.
+ *
+ * \return Nothing
+ */
+static void realtime_cache_put(struct realtime_cache *cache, const char *key, unsigned int generation,
+	const struct ast_variable *var, const struct ast_config *cfg)
+{
+	struct realtime_cache_entry *entry;
+	struct realtime_cache_entry *old;
+	struct timeval now;
+
+	if (!var && !cfg && !cache->negative_ttl) {
+		return;
+	}
+
+	if (!(entry = ao2_alloc(sizeof(*entry) + strlen(key) + 1, realtime_cache_entry_destroy))) {
+		return;
+	}
+	strcpy(entry->key, key);
+	if ((var && !(entry->var = ast_variables_dup((struct ast_variable *) var)))
+		|| (cfg && !(entry->cfg = realtime_config_dup(cfg)))) {
+		ao2_ref(entry, -1);
+		return;
+	}
+	now = ast_tvnow();
+	entry->expires = ast_tvadd(now, ast_tv(var || cfg ? cache->ttl : cache->negative_ttl, 0));
+
+	ao2_lock(cache);
+	if (generation != cache->generation) {
+		/* The family was written while the lookup was made. */
+		ao2_unlock(cache);
+		ao2_ref(entry, -1);
+		return;
+	}
+	if ((old = ao2_find(cache->entries, key, OBJ_KEY))) {
+		realtime_cache_unlink(cache, old);
+		ao2_ref(old, -1);
+	}
+	/* Drop the expired lookups in front, then the oldest ones to make room. */
+	while ((old = AST_LIST_FIRST(&cache->list))
+		&& (ast_tvcmp(old->expires, now) <= 0 || cache->max_entries <= cache->count)) {
+		if (ast_tvcmp(old->expires, now) > 0) {
+			++cache->evicted;
+		}
+		realtime_cache_unlink(cache, old);
+	}
+	ao2_link(cache->entries, entry);
+	AST_LIST_INSERT_TAIL(&cache->list, entry, list);
+	++cache->count;
+	ao2_unlock(cache);
+	ao2_ref(entry, -1);
+}
+
+/*!
+ * \brief Check if a written row can not be in the result of a cached lookup.
+ *
+ * The lookup can not have the row if it looks for a field the row has
+ * with another value, and the write did not change that field.
+ *
+ * \param key Key of the cached lookup.
+ * \param known Fields known of the rows written.
+ * \param changed Fields the write changed.
+ *
+ * \retval 1 if the lookup is not affected by the write.
+ * \retval 0 if it may be.
+ */
+static int realtime_cache_excludes(const char *key, const struct ast_variable *known, const struct ast_variable *changed)
+{
+	const struct ast_variable *field;
+	const char *name;
+	const char *value;
+	size_t name_len;
+	size_t value_len;
+
+	for (name = key + 1; *name; name = value + value_len + 1) {
+		value = strchr(name, '\001');
+		name_len = value - name;
+		++value;
+		value_len = strchr(value, '\002') - value;
+
+		for (field = changed; field; field = field->next) {
+			if (strlen(field->name) == name_len && !strncasecmp(field->name, name, name_len)) {
+				break;
+			}
+		}
+		if (field) {
+			continue;
+		}
+		for (field = known; field; field = field->next) {
+			if (strlen(field->name) == name_len && !strncasecmp(field->name, name, name_len)
+				&& (strlen(field->value) != value_len || strncasecmp(field->value, value, value_len))) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Drop the cached lookups of a realtime family a write can change.
+ *
+ * \param cache Cache of the family.
+ * \param known Fields known of the rows written, NULL to drop all lookups.
+ * \param changed Fields the write changed.
+ *
+ * \return Nothing
+ */
+static void realtime_cache_invalidate(struct realtime_cache *cache, const struct ast_variable *known,
+	const struct ast_variable *changed)
+{
+	struct realtime_cache_entry *entry;
+
+	ao2_lock(cache);
+	++cache->generation;
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&cache->list, entry, list) {
+		if (!known || !realtime_cache_excludes(entry->key, known, changed)) {
+			AST_LIST_REMOVE_CURRENT(list);
+			--cache->count;
+			++cache->invalidated;
+			ao2_unlink(cache->entries, entry);
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	ao2_unlock(cache);
+}
+
+/*!
+ * \brief Make lists of the name and value pairs of a realtime call.
+ *
+ * \param ap Name and value pairs ending with a NULL name.
+ * \param first Set to the list of the pairs.
+ * \param second If not NULL, set to the list of a second set of pairs
+ * following the first, as given to ast_update2_realtime().
+ *
+ * \retval 0 on success.
+ * \retval -1 on error, both lists are empty.
+ */
+static int realtime_cache_fields(va_list ap, struct ast_variable **first, struct ast_variable **second)
+{
+	struct ast_variable *lists[2] = { NULL, NULL };
+	struct ast_variable *var;
+	const char *name;
+	const char *value;
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < (second ? 2 : 1); ++i) {
+		while ((name = va_arg(ap, const char *))) {
+			value = va_arg(ap, const char *);
+			if (!(var = ast_variable_new(name, S_OR(value, ""), ""))) {
+				failed = 1;
+				continue;
+			}
+			var->next = lists[i];
+			lists[i] = var;
+		}
+	}
+	if (failed) {
+		ast_variables_destroy(lists[0]);
+		ast_variables_destroy(lists[1]);
+		lists[0] = lists[1] = NULL;
+	}
+	*first = lists[0];
+	if (second) {
+		*second = lists[1];
+	}
+
+	return failed ? -1 : 0;
+}
+
+/*!
+ * \brief Drop the lookups a realtime write can change and release the family cache.
+ *
+ * \param cache Cache of the family written.
+ * \param known Fields known of the rows written, NULL to drop all lookups.
+ * \param changed Fields the write changed.
+ *
+ * \return Nothing
+ */
+static void realtime_cache_written(struct realtime_cache *cache, struct ast_variable *known, struct ast_variable *changed)
+{
+	if (cache->invalidate) {
+		realtime_cache_invalidate(cache, known, changed);
+	}
+	ast_variables_destroy(known);
+	ast_variables_destroy(changed);
+	ao2_ref(cache, -1);
+}
+
 static void clear_config_maps(void) 
 {
 	struct ast_config_map *map;
+	struct ao2_container *caches;
 
 	ast_mutex_lock(&config_lock);
 
@@ -2071,8 +2559,14 @@ static void clear_config_maps(void)
 		config_maps = config_maps->next;
 		ast_free(map);
 	}
+	caches = realtime_caches;
+	realtime_caches = NULL;
 		
 	ast_mutex_unlock(&config_lock);
+
+	if (caches) {
+		ao2_ref(caches, -1);
+	}
 }
 
 static int append_mapping(const char *name, const char *driver, const char *database, const char *table, int priority)
@@ -2116,6 +2610,8 @@ int read_config_maps(void)
 	struct ast_variable *v;
 	char *driver, *table, *database, *textpri, *stringp, *tmp;
 	struct ast_flags flags = { CONFIG_FLAG_NOREALTIME };
+	struct ao2_container *caches;
+	struct realtime_cache *cache;
 	int pri;
 
 	clear_config_maps();
@@ -2182,6 +2678,23 @@ int read_config_maps(void)
 		} else 
 			append_mapping(v->name, driver, database, table, pri);
 	}
+
+	if ((caches = ao2_container_alloc(17, realtime_cache_hash, realtime_cache_cmp))) {
+		for (v = ast_variable_browse(config, "cache"); v; v = v->next) {
+			if ((cache = realtime_cache_alloc(v->name, v->value))) {
+				ao2_link(caches, cache);
+				ast_verb(2, "Caching realtime lookups of %s for %u seconds\n", cache->family, cache->ttl);
+				ao2_ref(cache, -1);
+			}
+		}
+		if (ao2_container_count(caches)) {
+			ast_mutex_lock(&config_lock);
+			realtime_caches = caches;
+			ast_mutex_unlock(&config_lock);
+		} else {
+			ao2_ref(caches, -1);
+		}
+	}
 		
 	ast_config_destroy(config);
 	return 0;
@@ -2330,16 +2843,38 @@ static struct ast_variable *ast_load_realtime_helper(const char *family, va_list
 	char db[256];
 	char table[256];
 	struct ast_variable *res=NULL;
+	struct realtime_cache *cache;
+	const char *key = NULL;
+	unsigned int generation = 0;
+	va_list aq;
 	int i;
 
+	if ((cache = realtime_cache_find(family))) {
+		va_copy(aq, ap);
+		key = realtime_cache_key('S', aq);
+		va_end(aq);
+		key = key ? ast_strdupa(key) : NULL;
+		if (key && realtime_cache_get(cache, key, &res, NULL, &generation)) {
+			ao2_ref(cache, -1);
+			return res;
+		}
+	}
+
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			if (eng->realtime_func && (res = eng->realtime_func(db, table, ap))) {
-				return res;
+				break;
 			}
 		} else {
-			return NULL;
+			break;
+		}
+	}
+
+	if (cache) {
+		if (key) {
+			realtime_cache_put(cache, key, generation, res, NULL);
 		}
+		ao2_ref(cache, -1);
 	}
 
 	return res;
@@ -2444,8 +2979,14 @@ int ast_unload_realtime(const char *family)
 	struct ast_config_engine *eng;
 	char db[256];
 	char table[256];
+	struct realtime_cache *cache;
 	int res = -1, i;
 
+	if ((cache = realtime_cache_find(family))) {
+		realtime_cache_invalidate(cache, NULL, NULL);
+		ao2_ref(cache, -1);
+	}
+
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			if (eng->unload_func) {
@@ -2465,10 +3006,26 @@ struct ast_config *ast_load_realtime_multientry(const char *family, ...)
 	char db[256];
 	char table[256];
 	struct ast_config *res = NULL;
+	struct realtime_cache *cache;
+	const char *key = NULL;
+	unsigned int generation = 0;
 	va_list ap;
+	va_list aq;
 	int i;
 
 	va_start(ap, family);
+	if ((cache = realtime_cache_find(family))) {
+		va_copy(aq, ap);
+		key = realtime_cache_key('M', aq);
+		va_end(aq);
+		key = key ? ast_strdupa(key) : NULL;
+		if (key && realtime_cache_get(cache, key, NULL, &res, &generation)) {
+			ao2_ref(cache, -1);
+			va_end(ap);
+			return res;
+		}
+	}
+
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			if (eng->realtime_multi_func && (res = eng->realtime_multi_func(db, table, ap))) {
@@ -2485,6 +3042,13 @@ struct ast_config *ast_load_realtime_multientry(const char *family, ...)
 	}
 	va_end(ap);
 
+	if (cache) {
+		if (key) {
+			realtime_cache_put(cache, key, generation, NULL, res);
+		}
+		ao2_ref(cache, -1);
+	}
+
 	return res;
 }
 
@@ -2494,9 +3058,20 @@ int ast_update_realtime(const char *family, const char *keyfield, const char *lo
 	int res = -1, i;
 	char db[256];
 	char table[256];
+	struct realtime_cache *cache;
+	struct ast_variable *known = NULL;
+	struct ast_variable *changed = NULL;
 	va_list ap;
+	va_list aq;
 
 	va_start(ap, lookup);
+	if ((cache = realtime_cache_find(family)) && cache->invalidate) {
+		va_copy(aq, ap);
+		if (!realtime_cache_fields(aq, &changed, NULL)) {
+			known = ast_variable_new(keyfield, S_OR(lookup, ""), "");
+		}
+		va_end(aq);
+	}
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			/* If the update succeeds, it returns 0. */
@@ -2509,6 +3084,10 @@ int ast_update_realtime(const char *family, const char *keyfield, const char *lo
 	}
 	va_end(ap);
 
+	if (cache) {
+		realtime_cache_written(cache, known, changed);
+	}
+
 	return res;
 }
 
@@ -2518,9 +3097,18 @@ int ast_update2_realtime(const char *family, ...)
 	int res = -1, i;
 	char db[256];
 	char table[256];
+	struct realtime_cache *cache;
+	struct ast_variable *known = NULL;
+	struct ast_variable *changed = NULL;
 	va_list ap;
+	va_list aq;
 
 	va_start(ap, family);
+	if ((cache = realtime_cache_find(family)) && cache->invalidate) {
+		va_copy(aq, ap);
+		realtime_cache_fields(aq, &known, &changed);
+		va_end(aq);
+	}
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			if (eng->update2_func && !(res = eng->update2_func(db, table, ap))) {
@@ -2532,6 +3120,10 @@ int ast_update2_realtime(const char *family, ...)
 	}
 	va_end(ap);
 
+	if (cache) {
+		realtime_cache_written(cache, known, changed);
+	}
+
 	return res;
 }
 
@@ -2541,9 +3133,17 @@ int ast_store_realtime(const char *family, ...)
 	int res = -1, i;
 	char db[256];
 	char table[256];
+	struct realtime_cache *cache;
+	struct ast_variable *known = NULL;
 	va_list ap;
+	va_list aq;
 
 	va_start(ap, family);
+	if ((cache = realtime_cache_find(family)) && cache->invalidate) {
+		va_copy(aq, ap);
+		realtime_cache_fields(aq, &known, NULL);
+		va_end(aq);
+	}
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			/* If the store succeeds, it returns 0. */
@@ -2556,6 +3156,10 @@ int ast_store_realtime(const char *family, ...)
 	}
 	va_end(ap);
 
+	if (cache) {
+		realtime_cache_written(cache, known, NULL);
+	}
+
 	return res;
 }
 
@@ -2565,9 +3169,26 @@ int ast_destroy_realtime(const char *family, const char *keyfield, const char *l
 	int res = -1, i;
 	char db[256];
 	char table[256];
+	struct realtime_cache *cache;
+	struct ast_variable *known = NULL;
+	struct ast_variable *var;
 	va_list ap;
+	va_list aq;
 
 	va_start(ap, lookup);
+	if ((cache = realtime_cache_find(family)) && cache->invalidate) {
+		va_copy(aq, ap);
+		if (!realtime_cache_fields(aq, &known, NULL)) {
+			if ((var = ast_variable_new(keyfield, S_OR(lookup, ""), ""))) {
+				var->next = known;
+				known = var;
+			} else {
+				ast_variables_destroy(known);
+				known = NULL;
+			}
+		}
+		va_end(aq);
+	}
 	for (i = 1; ; i++) {
 		if ((eng = find_engine(family, i, db, sizeof(db), table, sizeof(table)))) {
 			if (eng->destroy_func && !(res = eng->destroy_func(db, table, keyfield, lookup, ap))) {
@@ -2579,6 +3200,10 @@ int ast_destroy_realtime(const char *family, const char *keyfield, const char *l
 	}
 	va_end(ap);
 
+	if (cache) {
+		realtime_cache_written(cache, known, NULL);
+	}
+
 	return res;
 }
 
@@ -2891,14 +3516,276 @@ static char *handle_cli_config_list(struct ast_cli_entry *e, int cmd, struct ast
 	return CLI_SUCCESS;
 }
 
+static char *handle_cli_realtime_show_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-20.20s %6s %6s %7s %7s %10s %10s %10s %6s %8s %11s\n"
+#define FORMAT2 "%-20.20s %6u %6u %7u %7u %10u %10u %10u %5u%% %8u %11u\n"
+	struct ao2_container *caches;
+	struct ao2_iterator i;
+	struct realtime_cache *cache;
+	unsigned int lookups;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "realtime show cache";
+		e->usage =
+			"Usage: realtime show cache\n"
+			"	Shows the realtime families whose lookups are cached, as set up in\n"
+			"	the [cache] section of extconfig.conf, with how well each cache does.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_mutex_lock(&config_lock);
+	if ((caches = realtime_caches)) {
+		ao2_ref(caches, +1);
+	}
+	ast_mutex_unlock(&config_lock);
+
+	if (!caches) {
+		ast_cli(a->fd, "No realtime families are cached.\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, FORMAT, "Family", "TTL", "NegTTL", "Entries", "Max", "Hits", "NegHits", "Misses", "Ratio", "Evicted", "Invalidated");
+	i = ao2_iterator_init(caches, 0);
+	while ((cache = ao2_iterator_next(&i))) {
+		ao2_lock(cache);
+		lookups = cache->hits + cache->misses;
+		ast_cli(a->fd, FORMAT2, cache->family, cache->ttl, cache->negative_ttl, cache->count,
+			cache->max_entries, cache->hits, cache->negative_hits, cache->misses,
+			lookups ? (unsigned int) (100ULL * cache->hits / lookups) : 0,
+			cache->evicted, cache->invalidated);
+		ao2_unlock(cache);
+		ao2_ref(cache, -1);
+	}
+	ao2_iterator_destroy(&i);
+	ao2_ref(caches, -1);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static char *handle_cli_realtime_flush_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct realtime_cache *cache;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "realtime flush cache";
+		e->usage =
+			"Usage: realtime flush cache <family>\n"
+			"	Drops the cached lookups of a realtime family, so they are made\n"
+			"	again the next time.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!(cache = realtime_cache_find(a->argv[3]))) {
+		ast_cli(a->fd, "Realtime family '%s' is not cached.\n", a->argv[3]);
+		return CLI_SUCCESS;
+	}
+	realtime_cache_invalidate(cache, NULL, NULL);
+	ao2_ref(cache, -1);
+	ast_cli(a->fd, "Flushed the realtime cache of '%s'.\n", a->argv[3]);
+
+	return CLI_SUCCESS;
+}
+
 static struct ast_cli_entry cli_config[] = {
 	AST_CLI_DEFINE(handle_cli_core_show_config_mappings, "Display config mappings (file names to config engines)"),
 	AST_CLI_DEFINE(handle_cli_config_reload, "Force a reload on modules using a particular configuration file"),
 	AST_CLI_DEFINE(handle_cli_config_list, "Show all files that have loaded a configuration file"),
+	AST_CLI_DEFINE(handle_cli_realtime_show_cache, "Show the realtime lookup caches"),
+	AST_CLI_DEFINE(handle_cli_realtime_flush_cache, "Drop the cached lookups of a realtime family"),
 };
 
+#if defined(TEST_FRAMEWORK)
+AST_TEST_DEFINE(realtime_cache_excludes_test)
+{
+	static const struct {
+		const char *key;
+		const char *known_name;
+		const char *known_value;
+		const char *changed;
+		int excludes;
+	} writes[] = {
+		/* A row known to have another value for a field looked for */
+		{ "Sname\001bob\002", "name", "alice", "secret", 1 },
+		{ "Sname\001bob\002", "NAME", "alice", "secret", 1 },
+		{ "Mcontext\001default\002name\001bob\002", "name", "alice", "secret", 1 },
+		{ "Sname\001bob\002", "name", "bobby", "secret", 1 },
+		/* A row that may be the one looked for */
+		{ "Sname\001bob\002", "name", "bob", "secret", 0 },
+		{ "Sname\001bob\002", "name", "BOB", "secret", 0 },
+		{ "Sname\001bob\002", "host", "dynamic", "secret", 0 },
+		{ "S", "name", "alice", "secret", 0 },
+		/* The write changes a field looked for, so the row may now match */
+		{ "Sname\001bob\002", "name", "alice", "name", 0 },
+		{ "Scontext\001default\002name\001bob\002", "name", "alice", "name", 0 },
+	};
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct ast_variable *known;
+	struct ast_variable *changed;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "realtime_cache_excludes_test";
+		info->category = "/main/config/";
+		info->summary = "Test which cached realtime lookups a write can change";
+		info->description =
+			"Checks the cached lookups a realtime write leaves alone are the "
+			"ones looking for a field the row written has another value of, "
+			"and that the write does not change.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (i = 0; i < ARRAY_LEN(writes); i++) {
+		known = ast_variable_new(writes[i].known_name, writes[i].known_value, "");
+		changed = ast_variable_new(writes[i].changed, "x", "");
+		if (!known || !changed) {
+			ast_variables_destroy(known);
+			ast_variables_destroy(changed);
+			return AST_TEST_FAIL;
+		}
+		if (realtime_cache_excludes(writes[i].key, known, changed) != writes[i].excludes) {
+			ast_test_status_update(test, "A write of %s=%s changing %s %s lookup %d\n",
+				writes[i].known_name, writes[i].known_value, writes[i].changed,
+				writes[i].excludes ? "can change" : "can not change", i);
+			res = AST_TEST_FAIL;
+		}
+		ast_variables_destroy(known);
+		ast_variables_destroy(changed);
+	}
+
+	return res;
+}
+
+/*! \brief Whether a lookup is cached, and if so whether it found a row */
+static int realtime_cache_test_get(struct realtime_cache *cache, const char *key, int *found)
+{
+	struct ast_variable *var = NULL;
+	unsigned int generation;
+	int cached = realtime_cache_get(cache, key, &var, NULL, &generation);
+
+	*found = var ? 1 : 0;
+	ast_variables_destroy(var);
+
+	return cached;
+}
+
+AST_TEST_DEFINE(realtime_cache_invalidate_test)
+{
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct realtime_cache *cache;
+	struct ast_variable *row;
+	struct ast_variable *known;
+	struct ast_variable *changed;
+	unsigned int generation;
+	int found;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "realtime_cache_invalidate_test";
+		info->category = "/main/config/";
+		info->summary = "Test keeping and dropping cached realtime lookups";
+		info->description =
+			"Keeps lookups in a realtime cache and checks that writes drop "
+			"the ones they can change, that a lookup made while the family "
+			"was written is not kept, that lookups finding nothing are kept, "
+			"and that the oldest lookups make room for new ones.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(cache = realtime_cache_alloc("test", "ttl=60,negative_ttl=60,max_entries=3"))) {
+		return AST_TEST_FAIL;
+	}
+	row = ast_variable_new("secret", "1234", "");
+	known = ast_variable_new("name", "alice", "");
+	changed = ast_variable_new("regseconds", "0", "");
+	if (!row || !known || !changed) {
+		res = AST_TEST_FAIL;
+		goto cleanup;
+	}
+
+	realtime_cache_put(cache, "Sname\001alice\002", cache->generation, row, NULL);
+	realtime_cache_put(cache, "Sname\001bob\002", cache->generation, row, NULL);
+	realtime_cache_put(cache, "Sname\001carol\002", cache->generation, NULL, NULL);
+	if (cache->count != 3 || !realtime_cache_test_get(cache, "Sname\001bob\002", &found) || !found
+		|| !realtime_cache_test_get(cache, "Sname\001carol\002", &found) || found
+		|| cache->negative_hits != 1) {
+		ast_test_status_update(test, "The lookups kept were not found\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* A write to alice drops her lookup only */
+	realtime_cache_invalidate(cache, known, changed);
+	if (realtime_cache_test_get(cache, "Sname\001alice\002", &found)
+		|| !realtime_cache_test_get(cache, "Sname\001bob\002", &found)
+		|| cache->count != 2 || cache->invalidated != 1) {
+		ast_test_status_update(test, "A write did not drop just the lookup it can change\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* A lookup made while the family is written is not kept */
+	realtime_cache_test_get(cache, "Sname\001dave\002", &found);
+	generation = cache->generation;
+	realtime_cache_invalidate(cache, known, changed);
+	realtime_cache_put(cache, "Sname\001dave\002", generation, row, NULL);
+	if (realtime_cache_test_get(cache, "Sname\001dave\002", &found)) {
+		ast_test_status_update(test, "A lookup made during a write was kept\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* The oldest lookup makes room */
+	realtime_cache_put(cache, "Sname\001dave\002", cache->generation, row, NULL);
+	realtime_cache_put(cache, "Sname\001erin\002", cache->generation, row, NULL);
+	if (cache->count != 3 || cache->evicted != 1
+		|| realtime_cache_test_get(cache, "Sname\001bob\002", &found)
+		|| !realtime_cache_test_get(cache, "Sname\001erin\002", &found)) {
+		ast_test_status_update(test, "The oldest lookup did not make room for a new one\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* A write of unknown rows drops every lookup */
+	realtime_cache_invalidate(cache, NULL, NULL);
+	if (cache->count || ao2_container_count(cache->entries) || !AST_LIST_EMPTY(&cache->list)) {
+		ast_test_status_update(test, "Flushing the cache left %u lookups\n", cache->count);
+		res = AST_TEST_FAIL;
+	}
+
+cleanup:
+	ast_variables_destroy(row);
+	ast_variables_destroy(known);
+	ast_variables_destroy(changed);
+	ao2_ref(cache, -1);
+
+	return res;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
 int register_config_cli(void)
 {
 	ast_cli_register_multiple(cli_config, ARRAY_LEN(cli_config));
+#if defined(TEST_FRAMEWORK)
+	AST_TEST_REGISTER(realtime_cache_excludes_test);
+	AST_TEST_REGISTER(realtime_cache_invalidate_test);
+#endif
 	return 0;
 }
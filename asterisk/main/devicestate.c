@@ -126,6 +126,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358945 $")
 #include "asterisk/pbx.h"
 #include "asterisk/app.h"
 #include "asterisk/event.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/taskprocessor.h"
+#include "asterisk/sched.h"
+#include "asterisk/cli.h"
 
 /*! \brief Device state strings for printing */
 static const char * const devstatestring[][2] = {
@@ -168,20 +172,45 @@ struct devstate_prov {
 /*! \brief A list of providers */
 static AST_RWLIST_HEAD_STATIC(devstate_provs, devstate_prov);
 
-struct state_change {
-	AST_LIST_ENTRY(state_change) list;
-	char device[1];
+/*! \brief Number of queues device state changes are spread across */
+#define STATE_CHANGE_QUEUES 8
+
+/*! \brief Milliseconds changes to a device are collected for before its state is found out */
+#define STATE_CHANGE_WINDOW 20
+
+/*!
+ * \brief A queue of device state changes
+ *
+ * \details
+ * Devices are spread across the queues by the hash of their name, so the
+ * changes of a device are handled in order while those of different devices
+ * are handled in parallel by the taskprocessor pool.  A device with a change
+ * queued is in \a pending until its state is found out, and any change to it
+ * in the meantime is coalesced with the queued one.  The states of all the
+ * devices pending are found out together, STATE_CHANGE_WINDOW ms after the
+ * first of them was queued.
+ */
+struct state_change_queue {
+	struct ast_taskprocessor *tps;		/*!< Finds out the state of the devices */
+	struct ao2_container *pending;		/*!< Devices with a change queued */
+	int scheduled;				/*!< Set while the pending devices are due to be handled */
+	int queued;				/*!< Changes queued */
+	int coalesced;				/*!< Changes coalesced with a queued one */
+	int processed;				/*!< Device states found out */
+	int64_t latency_total;			/*!< Microseconds from the changes to finding out the states */
+	int64_t latency_max;			/*!< Longest time a change was queued */
 };
 
-/*! \brief The state change queue. State changes are queued
-	for processing by a separate thread */
-static AST_LIST_HEAD_STATIC(state_changes, state_change);
+static struct state_change_queue state_change_queues[STATE_CHANGE_QUEUES];
 
-/*! \brief The device state change notification thread */
-static pthread_t change_thread = AST_PTHREADT_NULL;
+/*! \brief Hands the pending devices of the queues to their taskprocessors */
+static struct ast_sched_context *state_change_sched;
 
-/*! \brief Flag for the queue */
-static ast_cond_t change_pending;
+/*! \brief A device whose state is to be found out */
+struct state_change {
+	struct timeval queued;			/*!< When the change was queued */
+	char device[1];
+};
 
 struct devstate_change {
 	AST_LIST_ENTRY(devstate_change) entry;
@@ -460,16 +489,129 @@ static void do_state_change(const char *device)
 	devstate_event(device, state);
 }
 
-int ast_devstate_changed_literal(enum ast_device_state state, const char *device)
+static int state_change_hash(const void *obj, const int flags)
+{
+	const struct state_change *change = obj;
+	const char *device = (flags & OBJ_KEY) ? obj : change->device;
+
+	return ast_str_case_hash(device);
+}
+
+static int state_change_cmp(void *obj, void *arg, int flags)
+{
+	struct state_change *change = obj;
+	const char *device = (flags & OBJ_KEY) ? arg : ((struct state_change *) arg)->device;
+
+	return !strcasecmp(change->device, device) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*! \brief Find out the state of the devices pending in a queue */
+static int state_change_task(void *data)
 {
+	struct state_change_queue *queue = data;
 	struct state_change *change;
+	struct ao2_iterator *changes;
+	int64_t latency;
+
+	/* Changes from here on need the states found out again */
+	ao2_lock(queue->pending);
+	queue->scheduled = 0;
+	changes = ao2_callback(queue->pending, OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NOLOCK, NULL, NULL);
+	ao2_unlock(queue->pending);
+	if (!changes) {
+		return 0;
+	}
+
+	while ((change = ao2_iterator_next(changes))) {
+		do_state_change(change->device);
+
+		latency = ast_tvdiff_us(ast_tvnow(), change->queued);
+		queue->latency_total += latency;
+		if (latency > queue->latency_max) {
+			queue->latency_max = latency;
+		}
+		ast_atomic_fetchadd_int(&queue->processed, +1);
+
+		ao2_ref(change, -1);
+	}
+	ao2_iterator_destroy(changes);
+
+	return 0;
+}
+
+static int state_change_window_expire(const void *data)
+{
+	struct state_change_queue *queue = (struct state_change_queue *) data;
+
+	if (ast_taskprocessor_push(queue->tps, state_change_task, queue)) {
+		state_change_task(queue);
+	}
 
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Queue finding out the state of a device, unless it already is.
+ *
+ * \retval 0 the change was queued or coalesced with one queued
+ * \retval -1 the change must be handled by the caller
+ */
+static int state_change_queue(const char *device)
+{
+	struct state_change_queue *queue;
+	struct state_change *change;
+
+	if (!state_change_queues[0].tps) {
+		return -1;
+	}
+	queue = &state_change_queues[ast_str_case_hash(device) % STATE_CHANGE_QUEUES];
+
+	ao2_lock(queue->pending);
+	if ((change = ao2_find(queue->pending, device, OBJ_KEY | OBJ_NOLOCK))) {
+		ao2_unlock(queue->pending);
+		ao2_ref(change, -1);
+		ast_atomic_fetchadd_int(&queue->coalesced, +1);
+		return 0;
+	}
+	if (!(change = ao2_alloc(sizeof(*change) + strlen(device), NULL))) {
+		ao2_unlock(queue->pending);
+		return -1;
+	}
+	change->queued = ast_tvnow();
+	strcpy(change->device, device);
+	ao2_link_flags(queue->pending, change, OBJ_NOLOCK);
+	ao2_ref(change, -1);
+	ast_atomic_fetchadd_int(&queue->queued, +1);
+
+	/* The first change pending opens the window */
+	if (!queue->scheduled) {
+		queue->scheduled = 1;
+		if (ast_sched_add(state_change_sched, STATE_CHANGE_WINDOW, state_change_window_expire, queue) < 0
+			&& ast_taskprocessor_push(queue->tps, state_change_task, queue)) {
+			/* Nothing will handle it, so leave it to the caller */
+			queue->scheduled = 0;
+			ao2_unlink_flags(queue->pending, change, OBJ_NOLOCK);
+			ast_atomic_fetchadd_int(&queue->queued, -1);
+			ao2_unlock(queue->pending);
+			return -1;
+		}
+	}
+	ao2_unlock(queue->pending);
+
+	return 0;
+}
+
+int ast_devstate_changed_literal(enum ast_device_state state, const char *device)
+{
 	/* 
 	 * If we know the state change (how nice of the caller of this function!)
 	 * then we can just generate a device state event. 
 	 *
 	 * Otherwise, we do the following:
-	 *   - Queue an event up to another thread that the state has changed
+	 *   - Queue an event up to another thread that the state has changed,
+	 *     unless one is already queued for the device and has not been
+	 *     processed yet
 	 *   - In the processing thread, it calls the callback provided by the
 	 *     device state provider (which may or may not be a channel driver)
 	 *     to determine the state.
@@ -482,17 +624,10 @@ int ast_devstate_changed_literal(enum ast_device_state state, const char *device
 
 	if (state != AST_DEVICE_UNKNOWN) {
 		devstate_event(device, state);
-	} else if (change_thread == AST_PTHREADT_NULL || !(change = ast_calloc(1, sizeof(*change) + strlen(device)))) {
-		/* we could not allocate a change struct, or */
-		/* there is no background thread, so process the change now */
+	} else if (state_change_queue(device)) {
+		/* we could not queue the change, or */
+		/* there are no queues, so process the change now */
 		do_state_change(device);
-	} else {
-		/* queue the change */
-		strcpy(change->device, device);
-		AST_LIST_LOCK(&state_changes);
-		AST_LIST_INSERT_TAIL(&state_changes, change, list);
-		ast_cond_signal(&change_pending);
-		AST_LIST_UNLOCK(&state_changes);
 	}
 
 	return 1;
@@ -527,31 +662,56 @@ int ast_device_state_changed(const char *fmt, ...)
 	return ast_devstate_changed_literal(AST_DEVICE_UNKNOWN, buf);
 }
 
-/*! \brief Go through the dev state change queue and update changes in the dev state thread */
-static void *do_devstate_changes(void *data)
+static char *handle_show_devstate_queues(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
-	struct state_change *next, *current;
+#define FORMAT "%-24s %10s %10s %8s %12s %12s\n"
+#define FORMAT2 "%-24s %10d %10d %8d %12" PRIi64 " %12" PRIi64 "\n"
+	int i, queued = 0, coalesced = 0, backlog = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show devstate queues";
+		e->usage =
+			"Usage: core show devstate queues\n"
+			"       Shows how many device state changes each queue was given,\n"
+			"       how many were coalesced with a change already queued for\n"
+			"       the device, how many are still queued, and the average and\n"
+			"       longest time in microseconds from a change to its device\n"
+			"       state being found out.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
 
-	for (;;) {
-		/* This basically pops off any state change entries, resets the list back to NULL, unlocks, and processes each state change */
-		AST_LIST_LOCK(&state_changes);
-		if (AST_LIST_EMPTY(&state_changes))
-			ast_cond_wait(&change_pending, &state_changes.lock);
-		next = AST_LIST_FIRST(&state_changes);
-		AST_LIST_HEAD_INIT_NOLOCK(&state_changes);
-		AST_LIST_UNLOCK(&state_changes);
-
-		/* Process each state change */
-		while ((current = next)) {
-			next = AST_LIST_NEXT(current, list);
-			do_state_change(current->device);
-			ast_free(current);
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Queue", "Queued", "Coalesced", "Backlog", "Avg latency", "Max latency");
+	for (i = 0; i < STATE_CHANGE_QUEUES; i++) {
+		struct state_change_queue *queue = &state_change_queues[i];
+
+		if (!queue->tps) {
+			continue;
 		}
+		ast_cli(a->fd, FORMAT2, ast_taskprocessor_name(queue->tps), queue->queued, queue->coalesced,
+			queue->queued - queue->processed,
+			queue->processed ? queue->latency_total / queue->processed : 0, queue->latency_max);
+		queued += queue->queued;
+		coalesced += queue->coalesced;
+		backlog += queue->queued - queue->processed;
 	}
+	ast_cli(a->fd, "%d changes queued, %d coalesced, %d still queued\n", queued, coalesced, backlog);
 
-	return NULL;
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
 }
 
+static struct ast_cli_entry cli_devstate[] = {
+	AST_CLI_DEFINE(handle_show_devstate_queues, "Show the device state change queues"),
+};
+
 static void destroy_devstate_change(struct devstate_change *sc)
 {
 	ast_free(sc);
@@ -720,12 +880,29 @@ static void devstate_change_collector_cb(const struct ast_event *event, void *da
 /*! \brief Initialize the device state engine in separate thread */
 int ast_device_state_engine_init(void)
 {
-	ast_cond_init(&change_pending, NULL);
-	if (ast_pthread_create_background(&change_thread, NULL, do_devstate_changes, NULL) < 0) {
-		ast_log(LOG_ERROR, "Unable to start device state change thread.\n");
+	char name[AST_MAX_EXTENSION];
+	int i;
+
+	if (!(state_change_sched = ast_sched_context_create())
+		|| ast_sched_start_thread(state_change_sched)) {
+		ast_log(LOG_ERROR, "Unable to start device state change scheduler.\n");
 		return -1;
 	}
 
+	for (i = 0; i < STATE_CHANGE_QUEUES; i++) {
+		struct state_change_queue *queue = &state_change_queues[i];
+
+		snprintf(name, sizeof(name), "devicestate/changes-%d", i);
+		if (!(queue->pending = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+				37, state_change_hash, state_change_cmp))
+			|| !(queue->tps = ast_taskprocessor_get(name, TPS_POOLED))) {
+			ast_log(LOG_ERROR, "Unable to create device state change queue.\n");
+			return -1;
+		}
+	}
+
+	ast_cli_register_multiple(cli_devstate, ARRAY_LEN(cli_devstate));
+
 	return 0;
 }
 
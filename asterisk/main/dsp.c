@@ -45,6 +45,13 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 357721 $")
 
 #include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "asterisk/frame.h"
 #include "asterisk/channel.h"
@@ -226,6 +233,31 @@ typedef struct {
 	int power;
 } goertzel_result_t;
 
+/*! Frequencies a goertzel bank runs over the samples in one pass */
+#define GOERTZEL_BANK_BINS	8
+
+/*!
+ * \brief Goertzel filters for the frequencies of a detector, side by side
+ *
+ * Each frequency has a lane in the arrays, so a block of samples is run
+ * through all of them at once with SIMD instructions.  The fixed point lanes
+ * step exactly as goertzel_sample() does.  scale is 1 << (16 - chunky), so
+ * the samples are scaled down by a multiply instead of by a shift that
+ * differs from lane to lane; the filters never grow enough for chunky to
+ * pass 16.  The lanes past bins are run too, and ignored.
+ */
+typedef struct {
+	int v2[GOERTZEL_BANK_BINS];
+	int v3[GOERTZEL_BANK_BINS];
+	int fac[GOERTZEL_BANK_BINS];
+	int chunky[GOERTZEL_BANK_BINS];
+	int scale[GOERTZEL_BANK_BINS];
+	float fv2[GOERTZEL_BANK_BINS];	/* Floating point lanes */
+	float fv3[GOERTZEL_BANK_BINS];
+	float coef[GOERTZEL_BANK_BINS];
+	int bins;
+} goertzel_bank_t;
+
 typedef struct
 {
 	int freq;
@@ -246,8 +278,7 @@ typedef struct
 
 typedef struct
 {
-	goertzel_state_t row_out[4];
-	goertzel_state_t col_out[4];
+	goertzel_bank_t bank;		/* Rows in bins 0 to 3, columns in bins 4 to 7 */
 	int hits_to_begin;		/* How many successive hits needed to consider begin of a digit */
 	int misses_to_end;		/* How many successive misses needed to consider end of a digit */
 	int hits;			/* How many successive hits we have seen already */
@@ -261,7 +292,7 @@ typedef struct
 
 typedef struct
 {
-	goertzel_state_t tone_out[6];
+	goertzel_bank_t bank;
 	int current_hit;
 	int hits[5];
 	int current_sample;
@@ -282,11 +313,9 @@ typedef struct
 	} td;
 } digit_detect_state_t;
 
-static const float dtmf_row[] = {
-	697.0,  770.0,  852.0,  941.0
-};
-static const float dtmf_col[] = {
-	1209.0, 1336.0, 1477.0, 1633.0
+static const float dtmf_tones[] = {
+	697.0,  770.0,  852.0,  941.0,		/* Rows */
+	1209.0, 1336.0, 1477.0, 1633.0		/* Columns */
 };
 static const float mf_tones[] = {
 	700.0, 900.0, 1100.0, 1300.0, 1500.0, 1700.0
@@ -294,6 +323,7 @@ static const float mf_tones[] = {
 static const char dtmf_positions[] = "123A" "456B" "789C" "*0#D";
 static const char bell_mf_positions[] = "1247C-358A--69*---0B----#";
 static int thresholds[THRESHOLD_MAX];
+static enum ast_dsp_kernel default_kernel = AST_DSP_KERNEL_FIXED;
 
 static inline void goertzel_sample(goertzel_state_t *s, short sample)
 {
@@ -343,6 +373,410 @@ static inline void goertzel_reset(goertzel_state_t *s)
 	s->v2 = s->v3 = s->chunky = 0.0;
 }
 
+/*! \brief Clears the filters of a bank, but not how much they were scaled down */
+static void goertzel_bank_clear(goertzel_bank_t *b)
+{
+	int i;
+
+	for (i = 0; i < GOERTZEL_BANK_BINS; i++) {
+		b->v2[i] = b->v3[i] = 0;
+		b->fv2[i] = b->fv3[i] = 0.0;
+	}
+}
+
+static void goertzel_bank_reset(goertzel_bank_t *b)
+{
+	int i;
+
+	goertzel_bank_clear(b);
+	for (i = 0; i < GOERTZEL_BANK_BINS; i++) {
+		b->chunky[i] = 0;
+		b->scale[i] = 1 << 16;
+	}
+}
+
+/*! \brief Sets up a bank for frequencies, as goertzel_init() does for one; a frequency of 0 leaves its lane unused */
+static void goertzel_bank_init(goertzel_bank_t *b, const float *freqs, int bins, unsigned int sample_rate)
+{
+	int i;
+
+	memset(b, 0, sizeof(*b));
+	b->bins = bins;
+	for (i = 0; i < bins; i++) {
+		if (freqs[i]) {
+			b->fac[i] = (int)(32768.0 * 2.0 * cos(2.0 * M_PI * freqs[i] / sample_rate));
+			b->coef[i] = 2.0 * cos(2.0 * M_PI * freqs[i] / sample_rate);
+		}
+	}
+	goertzel_bank_reset(b);
+}
+
+/*! \brief Runs a sample through each filter of a bank in turn with goertzel_sample() arithmetic */
+static inline void goertzel_bank_sample(goertzel_bank_t *b, short sample)
+{
+	int i;
+	int v1;
+
+	for (i = 0; i < b->bins; i++) {
+		v1 = b->v2[i];
+		b->v2[i] = b->v3[i];
+
+		b->v3[i] = (b->fac[i] * b->v2[i]) >> 15;
+		b->v3[i] = b->v3[i] - v1 + (sample >> b->chunky[i]);
+		if (abs(b->v3[i]) > 32768) {
+			b->chunky[i]++;
+			b->scale[i] >>= 1;
+			b->v3[i] = b->v3[i] >> 1;
+			b->v2[i] = b->v2[i] >> 1;
+		}
+	}
+}
+
+#if defined(__SSE2__) && !defined(__AVX2__)
+/*! \brief The low 32 bits of the products of 32 bit lanes, as _mm_mullo_epi32() of SSE4.1 */
+static inline __m128i goertzel_mullo_epi32(__m128i a, __m128i b)
+{
+#if defined(__SSE4_1__)
+	return _mm_mullo_epi32(a, b);
+#else
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+#endif
+
+/*!
+ * \brief Runs samples through all the fixed point filters of a bank at once
+ *
+ * The results are those of goertzel_bank_sample() on each sample.  A lane
+ * is scaled down where it grew past 32768 by masking in its value shifted.
+ */
+static void goertzel_bank_update_fixed(goertzel_bank_t *b, const int16_t *amp, int count)
+{
+	int j;
+#if defined(__AVX2__)
+	__m256i v2 = _mm256_loadu_si256((const __m256i *) b->v2);
+	__m256i v3 = _mm256_loadu_si256((const __m256i *) b->v3);
+	__m256i chunky = _mm256_loadu_si256((const __m256i *) b->chunky);
+	__m256i scale = _mm256_loadu_si256((const __m256i *) b->scale);
+	const __m256i fac = _mm256_loadu_si256((const __m256i *) b->fac);
+	const __m256i limit = _mm256_set1_epi32(32768);
+	const __m256i one = _mm256_set1_epi32(1);
+
+	for (j = 0; j < count; j++) {
+		__m256i v1 = v2, grow;
+
+		v2 = v3;
+		v3 = _mm256_sub_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(fac, v2), 15), v1);
+		v3 = _mm256_add_epi32(v3, _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(amp[j]), scale), 16));
+		grow = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_abs_epi32(v3), limit), one);
+		chunky = _mm256_add_epi32(chunky, grow);
+		scale = _mm256_srav_epi32(scale, grow);
+		v3 = _mm256_srav_epi32(v3, grow);
+		v2 = _mm256_srav_epi32(v2, grow);
+	}
+
+	_mm256_storeu_si256((__m256i *) b->v2, v2);
+	_mm256_storeu_si256((__m256i *) b->v3, v3);
+	_mm256_storeu_si256((__m256i *) b->chunky, chunky);
+	_mm256_storeu_si256((__m256i *) b->scale, scale);
+#elif defined(__SSE2__)
+	__m128i v2[2], v3[2], chunky[2], scale[2], fac[2];
+	const __m128i limit = _mm_set1_epi32(32768);
+	int h;
+
+	for (h = 0; h < 2; h++) {
+		v2[h] = _mm_loadu_si128((const __m128i *) (b->v2 + 4 * h));
+		v3[h] = _mm_loadu_si128((const __m128i *) (b->v3 + 4 * h));
+		chunky[h] = _mm_loadu_si128((const __m128i *) (b->chunky + 4 * h));
+		scale[h] = _mm_loadu_si128((const __m128i *) (b->scale + 4 * h));
+		fac[h] = _mm_loadu_si128((const __m128i *) (b->fac + 4 * h));
+	}
+
+	for (j = 0; j < count; j++) {
+		const __m128i sample = _mm_set1_epi32(amp[j]);
+
+		for (h = 0; h < 2; h++) {
+			__m128i v1 = v2[h], sign, grow;
+
+			v2[h] = v3[h];
+			v3[h] = _mm_sub_epi32(_mm_srai_epi32(goertzel_mullo_epi32(fac[h], v2[h]), 15), v1);
+			v3[h] = _mm_add_epi32(v3[h], _mm_srai_epi32(goertzel_mullo_epi32(sample, scale[h]), 16));
+			sign = _mm_srai_epi32(v3[h], 31);
+			grow = _mm_cmpgt_epi32(_mm_sub_epi32(_mm_xor_si128(v3[h], sign), sign), limit);
+			chunky[h] = _mm_sub_epi32(chunky[h], grow);
+			scale[h] = _mm_xor_si128(scale[h], _mm_and_si128(_mm_xor_si128(scale[h], _mm_srai_epi32(scale[h], 1)), grow));
+			v3[h] = _mm_xor_si128(v3[h], _mm_and_si128(_mm_xor_si128(v3[h], _mm_srai_epi32(v3[h], 1)), grow));
+			v2[h] = _mm_xor_si128(v2[h], _mm_and_si128(_mm_xor_si128(v2[h], _mm_srai_epi32(v2[h], 1)), grow));
+		}
+	}
+
+	for (h = 0; h < 2; h++) {
+		_mm_storeu_si128((__m128i *) (b->v2 + 4 * h), v2[h]);
+		_mm_storeu_si128((__m128i *) (b->v3 + 4 * h), v3[h]);
+		_mm_storeu_si128((__m128i *) (b->chunky + 4 * h), chunky[h]);
+		_mm_storeu_si128((__m128i *) (b->scale + 4 * h), scale[h]);
+	}
+#elif defined(__ARM_NEON)
+	int32x4_t v2[2], v3[2], chunky[2], scale[2], fac[2];
+	const int32x4_t limit = vdupq_n_s32(32768);
+	int h;
+
+	for (h = 0; h < 2; h++) {
+		v2[h] = vld1q_s32(b->v2 + 4 * h);
+		v3[h] = vld1q_s32(b->v3 + 4 * h);
+		chunky[h] = vld1q_s32(b->chunky + 4 * h);
+		scale[h] = vld1q_s32(b->scale + 4 * h);
+		fac[h] = vld1q_s32(b->fac + 4 * h);
+	}
+
+	for (j = 0; j < count; j++) {
+		const int32x4_t sample = vdupq_n_s32(amp[j]);
+
+		for (h = 0; h < 2; h++) {
+			int32x4_t v1 = v2[h];
+			uint32x4_t grow;
+
+			v2[h] = v3[h];
+			v3[h] = vsubq_s32(vshrq_n_s32(vmulq_s32(fac[h], v2[h]), 15), v1);
+			v3[h] = vaddq_s32(v3[h], vshrq_n_s32(vmulq_s32(sample, scale[h]), 16));
+			grow = vcgtq_s32(vabsq_s32(v3[h]), limit);
+			chunky[h] = vsubq_s32(chunky[h], vreinterpretq_s32_u32(grow));
+			scale[h] = vbslq_s32(grow, vshrq_n_s32(scale[h], 1), scale[h]);
+			v3[h] = vbslq_s32(grow, vshrq_n_s32(v3[h], 1), v3[h]);
+			v2[h] = vbslq_s32(grow, vshrq_n_s32(v2[h], 1), v2[h]);
+		}
+	}
+
+	for (h = 0; h < 2; h++) {
+		vst1q_s32(b->v2 + 4 * h, v2[h]);
+		vst1q_s32(b->v3 + 4 * h, v3[h]);
+		vst1q_s32(b->chunky + 4 * h, chunky[h]);
+		vst1q_s32(b->scale + 4 * h, scale[h]);
+	}
+#else
+	for (j = 0; j < count; j++) {
+		goertzel_bank_sample(b, amp[j]);
+	}
+#endif
+}
+
+/*! \brief Runs samples through all the floating point filters of a bank at once */
+static void goertzel_bank_update_float(goertzel_bank_t *b, const int16_t *amp, int count)
+{
+	int j;
+#if defined(__AVX__)
+	__m256 v2 = _mm256_loadu_ps(b->fv2);
+	__m256 v3 = _mm256_loadu_ps(b->fv3);
+	const __m256 coef = _mm256_loadu_ps(b->coef);
+
+	for (j = 0; j < count; j++) {
+		__m256 v1 = v2;
+
+		v2 = v3;
+		v3 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(coef, v2), v1), _mm256_set1_ps(amp[j]));
+	}
+
+	_mm256_storeu_ps(b->fv2, v2);
+	_mm256_storeu_ps(b->fv3, v3);
+#elif defined(__SSE2__)
+	__m128 v2[2], v3[2], coef[2];
+	int h;
+
+	for (h = 0; h < 2; h++) {
+		v2[h] = _mm_loadu_ps(b->fv2 + 4 * h);
+		v3[h] = _mm_loadu_ps(b->fv3 + 4 * h);
+		coef[h] = _mm_loadu_ps(b->coef + 4 * h);
+	}
+
+	for (j = 0; j < count; j++) {
+		const __m128 sample = _mm_set1_ps(amp[j]);
+
+		for (h = 0; h < 2; h++) {
+			__m128 v1 = v2[h];
+
+			v2[h] = v3[h];
+			v3[h] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(coef[h], v2[h]), v1), sample);
+		}
+	}
+
+	for (h = 0; h < 2; h++) {
+		_mm_storeu_ps(b->fv2 + 4 * h, v2[h]);
+		_mm_storeu_ps(b->fv3 + 4 * h, v3[h]);
+	}
+#elif defined(__ARM_NEON)
+	float32x4_t v2[2], v3[2], coef[2];
+	int h;
+
+	for (h = 0; h < 2; h++) {
+		v2[h] = vld1q_f32(b->fv2 + 4 * h);
+		v3[h] = vld1q_f32(b->fv3 + 4 * h);
+		coef[h] = vld1q_f32(b->coef + 4 * h);
+	}
+
+	for (j = 0; j < count; j++) {
+		const float32x4_t sample = vdupq_n_f32(amp[j]);
+
+		for (h = 0; h < 2; h++) {
+			float32x4_t v1 = v2[h];
+
+			v2[h] = v3[h];
+			v3[h] = vaddq_f32(vsubq_f32(vmulq_f32(coef[h], v2[h]), v1), sample);
+		}
+	}
+
+	for (h = 0; h < 2; h++) {
+		vst1q_f32(b->fv2 + 4 * h, v2[h]);
+		vst1q_f32(b->fv3 + 4 * h, v3[h]);
+	}
+#else
+	int i;
+
+	for (j = 0; j < count; j++) {
+		for (i = 0; i < b->bins; i++) {
+			float v1 = b->fv2[i];
+
+			b->fv2[i] = b->fv3[i];
+			b->fv3[i] = b->coef[i] * b->fv2[i] - v1 + amp[j];
+		}
+	}
+#endif
+}
+
+static void goertzel_bank_update(goertzel_bank_t *b, enum ast_dsp_kernel kernel, const int16_t *amp, int count)
+{
+	int j;
+
+	switch (kernel) {
+	case AST_DSP_KERNEL_FLOAT:
+		goertzel_bank_update_float(b, amp, count);
+		break;
+	case AST_DSP_KERNEL_SCALAR:
+		for (j = 0; j < count; j++) {
+			goertzel_bank_sample(b, amp[j]);
+		}
+		break;
+	case AST_DSP_KERNEL_FIXED:
+	default:
+		goertzel_bank_update_fixed(b, amp, count);
+		break;
+	}
+}
+
+/*! \brief The energy of a frequency of a bank, as goertzel_result() gives it */
+static inline float goertzel_bank_result(const goertzel_bank_t *b, enum ast_dsp_kernel kernel, int i)
+{
+	goertzel_result_t r;
+
+	if (kernel == AST_DSP_KERNEL_FLOAT) {
+		return b->fv3[i] * b->fv3[i] + b->fv2[i] * b->fv2[i] - b->coef[i] * b->fv2[i] * b->fv3[i];
+	}
+	r.value = (b->v3[i] * b->v3[i]) + (b->v2[i] * b->v2[i]);
+	r.value -= ((b->v2[i] * b->v3[i]) >> 15) * b->fac[i];
+	r.power = b->chunky[i] * 2;
+	return (float)r.value * (float)(1 << r.power);
+}
+
+/*! \brief The sum of the squares of samples */
+static int64_t dsp_sum_squares(const int16_t *amp, int count)
+{
+	int64_t sum = 0;
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	int64_t lanes[2];
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (amp + i));
+		/* A pair of squares reaches 2^31 only for two -32768, so read it unsigned */
+		__m128i pairs = _mm_madd_epi16(a, a);
+
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(pairs, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(pairs, zero));
+	}
+	_mm_storeu_si128((__m128i *) lanes, acc);
+	sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON)
+	int64x2_t acc = vdupq_n_s64(0);
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t a = vld1q_s16(amp + i);
+
+		acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(a), vget_low_s16(a)));
+		acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(a), vget_high_s16(a)));
+	}
+	sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+#endif
+	for (; i < count; i++) {
+		sum += (int32_t) amp[i] * (int32_t) amp[i];
+	}
+
+	return sum;
+}
+
+/*!
+ * \brief Adds the energy of samples to that of a block
+ *
+ * The scalar kernel adds each square on its own, as the detectors always
+ * did; the others add the exact sum of the squares at once.
+ */
+static inline float dsp_energy(enum ast_dsp_kernel kernel, float energy, const int16_t *amp, int count)
+{
+	int i;
+
+	if (kernel != AST_DSP_KERNEL_SCALAR) {
+		return energy + dsp_sum_squares(amp, count);
+	}
+	for (i = 0; i < count; i++) {
+		energy += (int32_t) amp[i] * (int32_t) amp[i];
+	}
+	return energy;
+}
+
+/*! \brief The sum of the magnitudes of samples, for fewer than 65536 of them */
+static int dsp_sum_abs(const int16_t *amp, int count)
+{
+	int sum = 0;
+	int i = 0;
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+	int lanes[4];
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (amp + i));
+		__m128i sign = _mm_srai_epi16(a, 15);
+		__m128i lo = _mm_unpacklo_epi16(a, sign);
+		__m128i hi = _mm_unpackhi_epi16(a, sign);
+		__m128i slo = _mm_srai_epi32(lo, 31);
+		__m128i shi = _mm_srai_epi32(hi, 31);
+
+		acc = _mm_add_epi32(acc, _mm_sub_epi32(_mm_xor_si128(lo, slo), slo));
+		acc = _mm_add_epi32(acc, _mm_sub_epi32(_mm_xor_si128(hi, shi), shi));
+	}
+	_mm_storeu_si128((__m128i *) lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t a = vld1q_s16(amp + i);
+
+		acc = vabal_s16(acc, vget_low_s16(a), vdup_n_s16(0));
+		acc = vabal_s16(acc, vget_high_s16(a), vdup_n_s16(0));
+	}
+	sum = vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) + vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#endif
+	for (; i < count; i++) {
+		sum += abs(amp[i]);
+	}
+
+	return sum;
+}
+
 typedef struct {
 	int start;
 	int end;
@@ -373,7 +807,7 @@ struct ast_dsp {
 	struct ast_dsp_busy_pattern busy_cadence;
 	int historicnoise[DSP_HISTORY];
 	int historicsilence[DSP_HISTORY];
-	goertzel_state_t freqs[7];
+	goertzel_bank_t freqs;
 	int freqcount;
 	int gsamps;
 	enum gsamp_size gsamp_size;
@@ -387,6 +821,7 @@ struct ast_dsp {
 	float genergy;
 	int mute_fragments;
 	unsigned int sample_rate;
+	enum ast_dsp_kernel kernel;
 	fragment_t mute_data[5];
 	digit_detect_state_t digit_state;
 	tone_detect_state_t cng_tone_state;
@@ -477,15 +912,10 @@ static void ast_fax_detect_init(struct ast_dsp *s)
 
 static void ast_dtmf_detect_init (dtmf_detect_state_t *s, unsigned int sample_rate)
 {
-	int i;
-
 	s->lasthit = 0;
 	s->current_hit = 0;
-	for (i = 0;  i < 4;  i++) {
-		goertzel_init(&s->row_out[i], dtmf_row[i], DTMF_GSIZE, sample_rate);
-		goertzel_init(&s->col_out[i], dtmf_col[i], DTMF_GSIZE, sample_rate);
-		s->energy = 0.0;
-	}
+	goertzel_bank_init(&s->bank, dtmf_tones, ARRAY_LEN(dtmf_tones), sample_rate);
+	s->energy = 0.0;
 	s->current_sample = 0;
 	s->hits = 0;
 	s->misses = 0;
@@ -496,11 +926,8 @@ static void ast_dtmf_detect_init (dtmf_detect_state_t *s, unsigned int sample_ra
 
 static void ast_mf_detect_init (mf_detect_state_t *s, unsigned int sample_rate)
 {
-	int i;
 	s->hits[0] = s->hits[1] = s->hits[2] = s->hits[3] = s->hits[4] = 0;
-	for (i = 0;  i < 6;  i++) {
-		goertzel_init (&s->tone_out[i], mf_tones[i], 160, sample_rate);
-	}
+	goertzel_bank_init(&s->bank, mf_tones, ARRAY_LEN(mf_tones), sample_rate);
 	s->current_sample = 0;
 	s->current_hit = 0;
 }
@@ -543,10 +970,8 @@ static int tone_detect(struct ast_dsp *dsp, tone_detect_state_t *s, int16_t *amp
 		}
 		end = start + limit;
 
+		s->energy = dsp_energy(dsp->kernel, s->energy, amp, limit);
 		for (i = limit, ptr = amp ; i > 0; i--, ptr++) {
-			/* signed 32 bit int should be enough to suqare any possible signed 16 bit value */
-			s->energy += (int32_t) *ptr * (int32_t) *ptr;
-
 			goertzel_sample(&s->tone, *ptr);
 		}
 
@@ -640,9 +1065,7 @@ static int dtmf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp
 {
 	float row_energy[4];
 	float col_energy[4];
-	float famp;
 	int i;
-	int j;
 	int sample;
 	int best_row;
 	int best_col;
@@ -663,37 +1086,24 @@ static int dtmf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp
 		} else {
 			limit = samples;
 		}
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
-		for (j = sample; j < limit; j++) {
-			famp = amp[j];
-			s->td.dtmf.energy += famp*famp;
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			goertzel_sample(s->td.dtmf.row_out, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 1, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 1, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 2, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 2, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 3, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 3, amp[j]);
-		}
+		/* All eight frequencies are run over the block at once */
+		s->td.dtmf.energy = dsp_energy(dsp->kernel, s->td.dtmf.energy, amp + sample, limit - sample);
+		goertzel_bank_update(&s->td.dtmf.bank, dsp->kernel, amp + sample, limit - sample);
 		s->td.dtmf.current_sample += (limit - sample);
 		if (s->td.dtmf.current_sample < DTMF_GSIZE) {
 			continue;
 		}
 		/* We are at the end of a DTMF detection block */
 		/* Find the peak row and the peak column */
-		row_energy[0] = goertzel_result (&s->td.dtmf.row_out[0]);
-		col_energy[0] = goertzel_result (&s->td.dtmf.col_out[0]);
+		row_energy[0] = goertzel_bank_result(&s->td.dtmf.bank, dsp->kernel, 0);
+		col_energy[0] = goertzel_bank_result(&s->td.dtmf.bank, dsp->kernel, 4);
 
 		for (best_row = best_col = 0, i = 1;  i < 4;  i++) {
-			row_energy[i] = goertzel_result (&s->td.dtmf.row_out[i]);
+			row_energy[i] = goertzel_bank_result(&s->td.dtmf.bank, dsp->kernel, i);
 			if (row_energy[i] > row_energy[best_row]) {
 				best_row = i;
 			}
-			col_energy[i] = goertzel_result (&s->td.dtmf.col_out[i]);
+			col_energy[i] = goertzel_bank_result(&s->td.dtmf.bank, dsp->kernel, i + 4);
 			if (col_energy[i] > col_energy[best_col]) {
 				best_col = i;
 			}
@@ -767,10 +1177,7 @@ static int dtmf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp
 		}
 
 		/* Reinitialise the detector for the next block */
-		for (i = 0; i < 4; i++) {
-			goertzel_reset(&s->td.dtmf.row_out[i]);
-			goertzel_reset(&s->td.dtmf.col_out[i]);
-		}
+		goertzel_bank_reset(&s->td.dtmf.bank);
 		s->td.dtmf.energy = 0.0;
 		s->td.dtmf.current_sample = 0;
 	}
@@ -793,7 +1200,6 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 	int best;
 	int second_best;
 	int i;
-	int j;
 	int sample;
 	int hit;
 	int limit;
@@ -813,18 +1219,8 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		} else {
 			limit = samples;
 		}
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
-		for (j = sample;  j < limit;  j++) {
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			goertzel_sample(s->td.mf.tone_out, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 1, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 2, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 3, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 4, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 5, amp[j]);
-		}
+		/* All six frequencies are run over the block at once */
+		goertzel_bank_update(&s->td.mf.bank, dsp->kernel, amp + sample, limit - sample);
 		s->td.mf.current_sample += (limit - sample);
 		if (s->td.mf.current_sample < MF_GSIZE) {
 			continue;
@@ -836,8 +1232,8 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		   well. The sinc function mess, due to rectangular windowing
 		   ensure that! Find the two highest energies and ensure they
 		   are considerably stronger than any of the others. */
-		energy[0] = goertzel_result(&s->td.mf.tone_out[0]);
-		energy[1] = goertzel_result(&s->td.mf.tone_out[1]);
+		energy[0] = goertzel_bank_result(&s->td.mf.bank, dsp->kernel, 0);
+		energy[1] = goertzel_bank_result(&s->td.mf.bank, dsp->kernel, 1);
 		if (energy[0] > energy[1]) {
 			best = 0;
 			second_best = 1;
@@ -847,7 +1243,7 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		}
 		/*endif*/
 		for (i = 2; i < 6; i++) {
-			energy[i] = goertzel_result(&s->td.mf.tone_out[i]);
+			energy[i] = goertzel_bank_result(&s->td.mf.bank, dsp->kernel, i);
 			if (energy[i] >= energy[best]) {
 				second_best = best;
 				best = i;
@@ -918,9 +1314,7 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		}
 
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 6;  i++) {
-			goertzel_reset(&s->td.mf.tone_out[i]);
-		}
+		goertzel_bank_reset(&s->td.mf.bank);
 		s->td.mf.current_sample = 0;
 	}
 
@@ -960,7 +1354,6 @@ static inline int pair_there(float p1, float p2, float i1, float i2, float e)
 
 static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 {
-	int x;
 	int y;
 	int pass;
 	int newstate = DSP_TONE_STATE_SILENCE;
@@ -971,19 +1364,15 @@ static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 		if (pass > dsp->gsamp_size - dsp->gsamps) {
 			pass = dsp->gsamp_size - dsp->gsamps;
 		}
-		for (x = 0; x < pass; x++) {
-			for (y = 0; y < dsp->freqcount; y++) {
-				goertzel_sample(&dsp->freqs[y], s[x]);
-			}
-			dsp->genergy += s[x] * s[x];
-		}
+		goertzel_bank_update(&dsp->freqs, dsp->kernel, s, pass);
+		dsp->genergy = dsp_energy(dsp->kernel, dsp->genergy, s, pass);
 		s += pass;
 		dsp->gsamps += pass;
 		len -= pass;
 		if (dsp->gsamps == dsp->gsamp_size) {
-			float hz[7];
-			for (y = 0; y < 7; y++) {
-				hz[y] = goertzel_result(&dsp->freqs[y]);
+			float hz[7] = { 0, };
+			for (y = 0; y < dsp->freqcount; y++) {
+				hz[y] = goertzel_bank_result(&dsp->freqs, dsp->kernel, y);
 			}
 			switch (dsp->progmode) {
 			case PROG_MODE_NA:
@@ -1085,9 +1474,7 @@ static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 			}
 
 			/* Reset goertzel */
-			for (x = 0; x < 7; x++) {
-				dsp->freqs[x].v2 = dsp->freqs[x].v3 = 0.0;
-			}
+			goertzel_bank_clear(&dsp->freqs);
 			dsp->gsamps = 0;
 			dsp->genergy = 0.0;
 		}
@@ -1112,16 +1499,12 @@ int ast_dsp_call_progress(struct ast_dsp *dsp, struct ast_frame *inf)
 static int __ast_dsp_silence_noise(struct ast_dsp *dsp, short *s, int len, int *totalsilence, int *totalnoise, int *frames_energy)
 {
 	int accum;
-	int x;
 	int res = 0;
 
 	if (!len) {
 		return 0;
 	}
-	accum = 0;
-	for (x = 0; x < len; x++) {
-		accum += abs(s[x]);
-	}
+	accum = dsp_sum_abs(s, len);
 	accum /= len;
 	if (accum < dsp->threshold) {
 		/* Silent */
@@ -1576,17 +1959,19 @@ done:
 
 static void ast_dsp_prog_reset(struct ast_dsp *dsp)
 {
+	float freqs[ARRAY_LEN(modes[0].freqs)];
 	int max = 0;
 	int x;
 
 	dsp->gsamp_size = modes[dsp->progmode].size;
 	dsp->gsamps = 0;
 	for (x = 0; x < ARRAY_LEN(modes[dsp->progmode].freqs); x++) {
+		freqs[x] = modes[dsp->progmode].freqs[x];
 		if (modes[dsp->progmode].freqs[x]) {
-			goertzel_init(&dsp->freqs[x], (float)modes[dsp->progmode].freqs[x], dsp->gsamp_size, dsp->sample_rate);
 			max = x + 1;
 		}
 	}
+	goertzel_bank_init(&dsp->freqs, freqs, max, dsp->sample_rate);
 	dsp->freqcount = max;
 	dsp->ringtimeout= 0;
 }
@@ -1607,6 +1992,7 @@ static struct ast_dsp *__ast_dsp_new(unsigned int sample_rate)
 		dsp->digitmode = DSP_DIGITMODE_DTMF;
 		dsp->faxmode = DSP_FAXMODE_DETECT_CNG;
 		dsp->sample_rate = sample_rate;
+		dsp->kernel = default_kernel;
 		/* Initialize digit detector */
 		ast_digit_detect_init(&dsp->digit_state, dsp->digitmode & DSP_DIGITMODE_MF, dsp->sample_rate);
 		dsp->display_inband_dtmf_warning = 1;
@@ -1665,24 +2051,17 @@ void ast_dsp_set_busy_pattern(struct ast_dsp *dsp, const struct ast_dsp_busy_pat
 
 void ast_dsp_digitreset(struct ast_dsp *dsp)
 {
-	int i;
-
 	dsp->dtmf_began = 0;
 	if (dsp->digitmode & DSP_DIGITMODE_MF) {
 		mf_detect_state_t *s = &dsp->digit_state.td.mf;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 6;  i++) {
-			goertzel_reset(&s->tone_out[i]);
-		}
+		goertzel_bank_reset(&s->bank);
 		s->hits[4] = s->hits[3] = s->hits[2] = s->hits[1] = s->hits[0] = s->current_hit = 0;
 		s->current_sample = 0;
 	} else {
 		dtmf_detect_state_t *s = &dsp->digit_state.td.dtmf;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 4;  i++) {
-			goertzel_reset(&s->row_out[i]);
-			goertzel_reset(&s->col_out[i]);
-		}
+		goertzel_bank_reset(&s->bank);
 		s->lasthit = s->current_hit = 0;
 		s->energy = 0.0;
 		s->current_sample = 0;
@@ -1696,13 +2075,9 @@ void ast_dsp_digitreset(struct ast_dsp *dsp)
 
 void ast_dsp_reset(struct ast_dsp *dsp)
 {
-	int x;
-
 	dsp->totalsilence = 0;
 	dsp->gsamps = 0;
-	for (x = 0; x < 4; x++) {
-		dsp->freqs[x].v2 = dsp->freqs[x].v3 = 0.0;
-	}
+	goertzel_bank_clear(&dsp->freqs);
 	memset(dsp->historicsilence, 0, sizeof(dsp->historicsilence));
 	memset(dsp->historicnoise, 0, sizeof(dsp->historicnoise));
 	dsp->ringtimeout= 0;
@@ -1746,6 +2121,25 @@ int ast_dsp_set_call_progress_zone(struct ast_dsp *dsp, char *zone)
 	return -1;
 }
 
+int ast_dsp_set_kernel(struct ast_dsp *dsp, enum ast_dsp_kernel kernel)
+{
+	switch (kernel) {
+	case AST_DSP_KERNEL_FIXED:
+	case AST_DSP_KERNEL_FLOAT:
+	case AST_DSP_KERNEL_SCALAR:
+		break;
+	default:
+		return -1;
+	}
+
+	/* The filters of one kernel cannot carry on from those of another */
+	dsp->kernel = kernel;
+	ast_digit_detect_init(&dsp->digit_state, dsp->digitmode & DSP_DIGITMODE_MF, dsp->sample_rate);
+	ast_dsp_prog_reset(dsp);
+	ast_fax_detect_init(dsp);
+	return 0;
+}
+
 int ast_dsp_was_muted(struct ast_dsp *dsp)
 {
 	return (dsp->mute_fragments > 0);
@@ -1773,6 +2167,7 @@ static int _dsp_init(int reload)
 	}
 
 	thresholds[THRESHOLD_SILENCE] = DEFAULT_SILENCE_THRESHOLD;
+	default_kernel = AST_DSP_KERNEL_FIXED;
 
 	if (cfg == CONFIG_STATUS_FILEMISSING || cfg == CONFIG_STATUS_FILEINVALID) {
 		return 0;
@@ -1787,6 +2182,16 @@ static int _dsp_init(int reload)
 			} else {
 				thresholds[THRESHOLD_SILENCE] = cfg_threshold;
 			}
+		} else if (!strcasecmp(v->name, "goertzel")) {
+			if (!strcasecmp(v->value, "fixed")) {
+				default_kernel = AST_DSP_KERNEL_FIXED;
+			} else if (!strcasecmp(v->value, "float")) {
+				default_kernel = AST_DSP_KERNEL_FLOAT;
+			} else if (!strcasecmp(v->value, "scalar")) {
+				default_kernel = AST_DSP_KERNEL_SCALAR;
+			} else {
+				ast_log(LOG_WARNING, "Unknown goertzel kernel '%s', using fixed\n", v->value);
+			}
 		}
 	}
 	ast_config_destroy(cfg);
@@ -0,0 +1,40 @@
+/* Automatically generated file, do not edit */
+#ifndef _h_vi_c
+#define _h_vi_c
+protected el_action_t	vi_paste_next (EditLine *, int);
+protected el_action_t	vi_paste_prev (EditLine *, int);
+protected el_action_t	vi_prev_space_word (EditLine *, int);
+protected el_action_t	vi_prev_word (EditLine *, int);
+protected el_action_t	vi_next_space_word (EditLine *, int);
+protected el_action_t	vi_next_word (EditLine *, int);
+protected el_action_t	vi_change_case (EditLine *, int);
+protected el_action_t	vi_change_meta (EditLine *, int);
+protected el_action_t	vi_insert_at_bol (EditLine *, int);
+protected el_action_t	vi_replace_char (EditLine *, int);
+protected el_action_t	vi_replace_mode (EditLine *, int);
+protected el_action_t	vi_substitute_char (EditLine *, int);
+protected el_action_t	vi_substitute_line (EditLine *, int);
+protected el_action_t	vi_change_to_eol (EditLine *, int);
+protected el_action_t	vi_insert (EditLine *, int);
+protected el_action_t	vi_add (EditLine *, int);
+protected el_action_t	vi_add_at_eol (EditLine *, int);
+protected el_action_t	vi_delete_meta (EditLine *, int);
+protected el_action_t	vi_end_word (EditLine *, int);
+protected el_action_t	vi_to_end_word (EditLine *, int);
+protected el_action_t	vi_undo (EditLine *, int);
+protected el_action_t	vi_command_mode (EditLine *, int);
+protected el_action_t	vi_zero (EditLine *, int);
+protected el_action_t	vi_delete_prev_char (EditLine *, int);
+protected el_action_t	vi_list_or_eof (EditLine *, int);
+protected el_action_t	vi_kill_line_prev (EditLine *, int);
+protected el_action_t	vi_search_prev (EditLine *, int);
+protected el_action_t	vi_search_next (EditLine *, int);
+protected el_action_t	vi_repeat_search_next (EditLine *, int);
+protected el_action_t	vi_repeat_search_prev (EditLine *, int);
+protected el_action_t	vi_next_char (EditLine *, int);
+protected el_action_t	vi_prev_char (EditLine *, int);
+protected el_action_t	vi_to_next_char (EditLine *, int);
+protected el_action_t	vi_to_prev_char (EditLine *, int);
+protected el_action_t	vi_repeat_next_char (EditLine *, int);
+protected el_action_t	vi_repeat_prev_char (EditLine *, int);
+#endif /* _h_vi_c */
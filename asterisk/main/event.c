@@ -116,6 +116,45 @@ struct ast_event_ie_val {
 	size_t raw_datalen;
 };
 
+/*! \brief An event waiting in the queue of a subscription */
+struct ast_event_sub_queue_entry {
+	struct ast_event_ref *event_ref;
+	/*! When the event was queued */
+	struct timeval queued;
+	AST_LIST_ENTRY(ast_event_sub_queue_entry) entry;
+};
+
+/*!
+ * \brief Queue of a subscription
+ *
+ * A thread of the queue calls the subscriber with the events queued by the
+ * event dispatcher, so that a slow subscriber does not hold up the others.
+ */
+struct ast_event_sub_queue {
+	ast_mutex_t lock;
+	/*! Signalled when an event is queued or the thread has to stop */
+	ast_cond_t cond;
+	pthread_t thread;
+	ast_event_cb_t cb;
+	void *userdata;
+	AST_LIST_HEAD_NOLOCK(, ast_event_sub_queue_entry) entries;
+	/*! Most events allowed to wait */
+	unsigned int size;
+	/*! Events waiting, including the one being delivered */
+	unsigned int depth;
+	unsigned int max_depth;
+	unsigned int delivered;
+	unsigned int dropped;
+	unsigned int max_latency;
+	/*! Milliseconds the delivered events took in all */
+	uint64_t latency_total;
+	/*! Set once the queue is full, until an event fits again */
+	unsigned int full:1;
+	/*! Set when the thread has to stop once the queue is empty */
+	unsigned int stop:1;
+	AST_LIST_ENTRY(ast_event_sub_queue) entry;
+};
+
 /*! \brief Event subscription */
 struct ast_event_sub {
 	enum ast_event_type type;
@@ -123,6 +162,8 @@ struct ast_event_sub {
 	char description[64];
 	void *userdata;
 	uint32_t uniqueid;
+	/*! Queue delivering the events, NULL if called from the event dispatcher */
+	struct ast_event_sub_queue *queue;
 	AST_LIST_HEAD_NOLOCK(, ast_event_ie_val) ie_vals;
 	AST_RWDLLIST_ENTRY(ast_event_sub) entry;
 };
@@ -133,6 +174,13 @@ static uint32_t sub_uniqueid;
  * The event subscribers are indexed by which event they are subscribed to */
 static AST_RWDLLIST_HEAD(ast_event_sub_list, ast_event_sub) ast_event_subs[AST_EVENT_TOTAL];
 
+/*!
+ * \brief Queue sizes of the subscriptions to each event type
+ * 0 if the subscribers are called from the event dispatcher.  Protected by the
+ * lock of the subscription list of the event type.
+ */
+static unsigned int sub_queue_sizes[AST_EVENT_TOTAL];
+
 static int ast_event_cmp(void *obj, void *arg, int flags);
 static int ast_event_hash_mwi(const void *obj, const int flags);
 static int ast_event_hash_devstate(const void *obj, const int flags);
@@ -735,6 +783,256 @@ void ast_event_report_subs(const struct ast_event_sub *event_sub)
 	AST_RWDLLIST_UNLOCK(&ast_event_subs[event_type]);
 }
 
+/*!
+ * \internal
+ * \brief Deliver the events of a subscription queue.
+ *
+ * \param data Subscription queue.
+ *
+ * \return NULL
+ */
+static void *sub_queue_thread(void *data)
+{
+	struct ast_event_sub_queue *queue = data;
+	struct ast_event_sub_queue_entry *entry;
+	int64_t latency;
+
+	ast_mutex_lock(&queue->lock);
+	for (;;) {
+		while (!(entry = AST_LIST_REMOVE_HEAD(&queue->entries, entry))) {
+			if (queue->stop) {
+				ast_mutex_unlock(&queue->lock);
+				return NULL;
+			}
+			ast_cond_wait(&queue->cond, &queue->lock);
+		}
+		ast_mutex_unlock(&queue->lock);
+
+		queue->cb(entry->event_ref->event, queue->userdata);
+		latency = ast_tvdiff_ms(ast_tvnow(), entry->queued);
+		ao2_ref(entry->event_ref, -1);
+		ast_free(entry);
+
+		ast_mutex_lock(&queue->lock);
+		--queue->depth;
+		++queue->delivered;
+		queue->latency_total += latency;
+		if (queue->max_latency < latency) {
+			queue->max_latency = latency;
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Create the queue of a subscription and start its thread.
+ *
+ * \param sub Subscription.
+ * \param size Most events allowed to wait.
+ *
+ * \retval queue on success.
+ * \retval NULL on error.
+ */
+static struct ast_event_sub_queue *sub_queue_alloc(struct ast_event_sub *sub, unsigned int size)
+{
+	struct ast_event_sub_queue *queue;
+
+	if (!(queue = ast_calloc(1, sizeof(*queue)))) {
+		return NULL;
+	}
+	ast_mutex_init(&queue->lock);
+	ast_cond_init(&queue->cond, NULL);
+	queue->cb = sub->cb;
+	queue->userdata = sub->userdata;
+	queue->size = size;
+	if (ast_pthread_create_background(&queue->thread, NULL, sub_queue_thread, queue)) {
+		ast_log(LOG_WARNING, "Unable to start the event queue thread of '%s'\n", sub->description);
+		ast_cond_destroy(&queue->cond);
+		ast_mutex_destroy(&queue->lock);
+		ast_free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+/*!
+ * \internal
+ * \brief Deliver the events left in a subscription queue and destroy it.
+ *
+ * \param queue Subscription queue, no longer used by its subscription.
+ *
+ * \return Nothing
+ */
+static void sub_queue_destroy(struct ast_event_sub_queue *queue)
+{
+	ast_mutex_lock(&queue->lock);
+	queue->stop = 1;
+	ast_cond_signal(&queue->cond);
+	ast_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	ast_cond_destroy(&queue->cond);
+	ast_mutex_destroy(&queue->lock);
+	ast_free(queue);
+}
+
+/*!
+ * \internal
+ * \brief Queue an event for a subscription with a queue.
+ *
+ * \param sub Subscription.
+ * \param event_ref Event to deliver.
+ *
+ * \return Nothing
+ */
+static void sub_queue_push(struct ast_event_sub *sub, struct ast_event_ref *event_ref)
+{
+	struct ast_event_sub_queue *queue = sub->queue;
+	struct ast_event_sub_queue_entry *entry;
+
+	ast_mutex_lock(&queue->lock);
+	if (queue->size <= queue->depth || !(entry = ast_calloc(1, sizeof(*entry)))) {
+		++queue->dropped;
+		if (!queue->full) {
+			queue->full = 1;
+			ast_log(LOG_WARNING, "Event queue of '%s' is full, dropping events\n", sub->description);
+		}
+		ast_mutex_unlock(&queue->lock);
+		return;
+	}
+	queue->full = 0;
+
+	ao2_ref(event_ref, +1);
+	entry->event_ref = event_ref;
+	entry->queued = ast_tvnow();
+	AST_LIST_INSERT_TAIL(&queue->entries, entry, entry);
+	if (queue->max_depth < ++queue->depth) {
+		queue->max_depth = queue->depth;
+	}
+	ast_cond_signal(&queue->cond);
+	ast_mutex_unlock(&queue->lock);
+}
+
+/*!
+ * \internal
+ * \brief Take the queues that are empty off the subscriptions to an event type.
+ *
+ * \param type Event type, whose subscriptions are no longer queued.
+ *
+ * A subscription keeps its queue until the events in it are delivered,
+ * so that it gets its events in order, and ast_event_unsubscribe() still
+ * waits for them.
+ *
+ * \retval 0 if no subscription has a queue left.
+ * \retval 1 if some queues still have events.
+ */
+static int sub_queues_stop(enum ast_event_type type)
+{
+	AST_LIST_HEAD_NOLOCK(, ast_event_sub_queue) stopped;
+	struct ast_event_sub_queue *queue;
+	struct ast_event_sub *sub;
+	int pending = 0;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&stopped);
+
+	/* No event is queued while the list is locked for writing. */
+	AST_RWDLLIST_WRLOCK(&ast_event_subs[type]);
+	if (sub_queue_sizes[type]) {
+		/* Queued again meanwhile. */
+		AST_RWDLLIST_UNLOCK(&ast_event_subs[type]);
+		return 0;
+	}
+	AST_RWDLLIST_TRAVERSE(&ast_event_subs[type], sub, entry) {
+		if (!(queue = sub->queue)) {
+			continue;
+		}
+		ast_mutex_lock(&queue->lock);
+		if (queue->depth) {
+			pending = 1;
+		} else {
+			sub->queue = NULL;
+		}
+		ast_mutex_unlock(&queue->lock);
+		if (!sub->queue) {
+			AST_LIST_INSERT_TAIL(&stopped, queue, entry);
+		}
+	}
+	AST_RWDLLIST_UNLOCK(&ast_event_subs[type]);
+
+	while ((queue = AST_LIST_REMOVE_HEAD(&stopped, entry))) {
+		sub_queue_destroy(queue);
+	}
+
+	return pending;
+}
+
+int ast_event_queue_subs(enum ast_event_type type, unsigned int size)
+{
+	struct ast_event_sub *sub;
+	int res = 0;
+
+	if (type < 0 || type >= AST_EVENT_TOTAL) {
+		ast_log(LOG_ERROR, "%u is an invalid type!\n", type);
+		return -1;
+	}
+
+	AST_RWDLLIST_WRLOCK(&ast_event_subs[type]);
+	sub_queue_sizes[type] = size;
+	AST_RWDLLIST_TRAVERSE(&ast_event_subs[type], sub, entry) {
+		if (sub->queue) {
+			ast_mutex_lock(&sub->queue->lock);
+			sub->queue->size = size ? size : sub->queue->size;
+			ast_mutex_unlock(&sub->queue->lock);
+		} else if (size && !(sub->queue = sub_queue_alloc(sub, size))) {
+			res = -1;
+		}
+	}
+	AST_RWDLLIST_UNLOCK(&ast_event_subs[type]);
+
+	/*
+	 * Waiting for the subscribers without the list locked, as they may
+	 * check for subscriptions while delivering the rest.
+	 */
+	while (!size && sub_queues_stop(type)) {
+		usleep(10000);
+	}
+
+	return res;
+}
+
+void ast_event_sub_queue_stats(enum ast_event_type type,
+	void (*cb)(const struct ast_event_sub_stats *stats, void *data), void *data)
+{
+	struct ast_event_sub_stats stats;
+	struct ast_event_sub_queue *queue;
+	struct ast_event_sub *sub;
+
+	if (type < 0 || type >= AST_EVENT_TOTAL) {
+		return;
+	}
+
+	AST_RWDLLIST_RDLOCK(&ast_event_subs[type]);
+	AST_RWDLLIST_TRAVERSE(&ast_event_subs[type], sub, entry) {
+		if (!(queue = sub->queue)) {
+			continue;
+		}
+		ast_mutex_lock(&queue->lock);
+		stats.description = sub->description;
+		stats.depth = queue->depth;
+		stats.max_depth = queue->max_depth;
+		stats.size = queue->size;
+		stats.delivered = queue->delivered;
+		stats.dropped = queue->dropped;
+		stats.latency = queue->delivered ? queue->latency_total / queue->delivered : 0;
+		stats.max_latency = queue->max_latency;
+		ast_mutex_unlock(&queue->lock);
+		cb(&stats, data);
+	}
+	AST_RWDLLIST_UNLOCK(&ast_event_subs[type]);
+}
+
 struct ast_event_sub *ast_event_subscribe_new(enum ast_event_type type,
 	ast_event_cb_t cb, void *userdata)
 {
@@ -899,6 +1197,9 @@ int ast_event_sub_activate(struct ast_event_sub *sub)
 	}
 
 	AST_RWDLLIST_WRLOCK(&ast_event_subs[sub->type]);
+	if (sub_queue_sizes[sub->type] && !sub->queue) {
+		sub->queue = sub_queue_alloc(sub, sub_queue_sizes[sub->type]);
+	}
 	AST_RWDLLIST_INSERT_TAIL(&ast_event_subs[sub->type], sub, entry);
 	AST_RWDLLIST_UNLOCK(&ast_event_subs[sub->type]);
 
@@ -971,6 +1272,10 @@ void ast_event_sub_destroy(struct ast_event_sub *sub)
 {
 	struct ast_event_ie_val *ie_val;
 
+	if (sub->queue) {
+		sub_queue_destroy(sub->queue);
+	}
+
 	while ((ie_val = AST_LIST_REMOVE_HEAD(&sub->ie_vals, entry))) {
 		ast_event_ie_val_destroy(ie_val);
 	}
@@ -1498,7 +1803,11 @@ static int handle_event(void *data)
 				/* The event did not match this subscription. */
 				continue;
 			}
-			sub->cb(event_ref->event, sub->userdata);
+			if (sub->queue) {
+				sub_queue_push(sub, event_ref);
+			} else {
+				sub->cb(event_ref->event, sub->userdata);
+			}
 		}
 		AST_RWDLLIST_UNLOCK(&ast_event_subs[event_types[i]]);
 	}
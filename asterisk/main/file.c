@@ -31,6 +31,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <math.h>
+#include <fcntl.h>
 
 #include "asterisk/_private.h"	/* declare ast_file_init() */
 #include "asterisk/paths.h"	/* use ast_config_AST_DATA_DIR */
@@ -47,6 +48,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 #include "asterisk/module.h"
 #include "asterisk/astobj2.h"
 #include "asterisk/test.h"
+#include "asterisk/taskprocessor.h"
 
 /*! \brief
  * The following variable controls the layout of localized sound files.
@@ -60,6 +62,16 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
  */
 int ast_language_is_prefix = 1;
 
+/*! \brief
+ * Memory in MB the sound cache may use to keep the sounds played most in
+ * memory, 0 if sounds are not cached, and whether it also keeps them encoded
+ * in the formats channels play them in.
+ *
+ * These are settable in asterisk.conf.
+ */
+unsigned int ast_sound_cache_size;
+int ast_sound_cache_encode;
+
 static AST_RWLIST_HEAD_STATIC(formats, ast_format_def);
 
 int __ast_format_def_register(const struct ast_format_def *f, struct ast_module *mod)
@@ -357,6 +369,10 @@ static void filestream_destructor(void *arg)
 	if (f->orig_chan_name)
 		free((void *) f->orig_chan_name);
 	ast_module_unref(f->fmt->module);
+	/* Pre-encoded streams take their format from the cached sound, so it goes last */
+	if (f->cache) {
+		ao2_ref(f->cache, -1);
+	}
 }
 
 static struct ast_filestream *get_filestream(struct ast_format_def *fmt, FILE *bfile)
@@ -411,6 +427,783 @@ static int open_wrapper(struct ast_filestream *s)
 	return fn_wrapper(s, NULL, WRAP_OPEN);
 }
 
+static int is_absolute_path(const char *filename)
+{
+	return filename[0] == '/';
+}
+
+/*! Cached sounds and lookups are checked against the disk after this many seconds.
+ *  Sounds that are not found are not remembered, as they may be added at any time. */
+#define SOUND_CACHE_REVALIDATE 5
+#define SOUND_CACHE_BUCKETS 127
+/*! Most lookups remembered, a new one then replaces another of its hash bucket */
+#define SOUND_CACHE_MAX_NAMES 8192
+
+/*! \brief One frame of a cached sound encoded in another format */
+struct sound_cache_frame {
+	size_t offset;
+	unsigned int datalen;
+	unsigned int samples;
+};
+
+/*! \brief A cached sound encoded in the format a channel plays it in */
+struct sound_cache_frames {
+	/*! Format of streams playing the frames, it must come first */
+	struct ast_format_def def;
+	struct sound_cache_frame *frames;
+	unsigned int count;
+	unsigned int alloc;
+	off_t samples;		/*!< Samples in all frames */
+	unsigned char *data;
+	size_t datalen;
+	size_t dataalloc;
+	int hits;
+	AST_LIST_ENTRY(sound_cache_frames) list;
+};
+
+/*! \brief Position of a stream playing an encoded sound */
+struct sound_cache_pos {
+	unsigned int frame;
+	off_t sample;
+};
+
+/*! \brief A sound file kept in memory */
+struct ast_sound_cache_file {
+	unsigned char *data;	/*!< Contents of the file */
+	size_t size;
+	size_t encoded;		/*!< Memory used by its encodings */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	struct timeval validated;	/*!< When it was last checked against the disk */
+	struct timeval used;	/*!< When it was last played */
+	int hits;
+	unsigned int linked:1;	/*!< Still in the cache, protected by sound_cache_lock */
+	unsigned int encoding:1;	/*!< Being encoded, protected by the object lock */
+	/*! Encodings of the sound, protected by the object lock */
+	AST_LIST_HEAD_NOLOCK(, sound_cache_frames) encodings;
+	char name[0];
+};
+
+/*! \brief Where a sound was found, for a name, language and format */
+struct sound_cache_name {
+	/*! Formats the sound was found in */
+	struct ast_format_cap *cap;
+	struct timeval validated;
+	const char *preflang;
+	const char *fmt;
+	const char *resolved;
+	char filename[0];
+};
+
+struct sound_cache_name_key {
+	const char *filename;
+	const char *preflang;
+	const char *fmt;
+};
+
+/*! Protects the memory used by the cache and the cached files in it */
+AST_MUTEX_DEFINE_STATIC(sound_cache_lock);
+static size_t sound_cache_used;
+static struct ao2_container *sound_cache_files;
+static struct ao2_container *sound_cache_names;
+/*! Encodes cached sounds, so that channels do not wait for it */
+static struct ast_taskprocessor *sound_cache_encoder;
+
+static struct {
+	int lookups_cached;	/*!< Lookups answered from the cache */
+	int lookups_searched;	/*!< Lookups searching the disk */
+	int plays;		/*!< Sounds played from memory */
+	int loads;		/*!< Sounds read into memory */
+	int evictions;		/*!< Sounds dropped for room */
+	int invalidations;	/*!< Sounds dropped as they changed */
+	int encoded_plays;	/*!< Sounds played pre-encoded */
+	int encodings;		/*!< Sounds encoded */
+} sound_cache_stats;
+
+static int sound_cache_file_hash(const void *obj, const int flags)
+{
+	const struct ast_sound_cache_file *file = obj;
+
+	return ast_str_hash(flags & OBJ_KEY ? (const char *) obj : file->name);
+}
+
+static int sound_cache_file_cmp(void *obj, void *arg, int flags)
+{
+	struct ast_sound_cache_file *file = obj, *file2 = arg;
+
+	return !strcmp(file->name, flags & OBJ_KEY ? (const char *) arg : file2->name) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static void sound_cache_file_destructor(void *obj)
+{
+	struct ast_sound_cache_file *file = obj;
+	struct sound_cache_frames *frames;
+
+	while ((frames = AST_LIST_REMOVE_HEAD(&file->encodings, list))) {
+		ast_free(frames->frames);
+		ast_free(frames->data);
+		ast_free(frames);
+	}
+	ast_free(file->data);
+}
+
+static int sound_cache_name_hash(const void *obj, const int flags)
+{
+	const struct sound_cache_name *name = obj;
+	const struct sound_cache_name_key *key = obj;
+
+	if (flags & OBJ_KEY) {
+		return ast_str_hash_add(key->fmt, ast_str_hash_add(key->preflang, ast_str_hash(key->filename)));
+	}
+	return ast_str_hash_add(name->fmt, ast_str_hash_add(name->preflang, ast_str_hash(name->filename)));
+}
+
+static int sound_cache_name_cmp(void *obj, void *arg, int flags)
+{
+	struct sound_cache_name *name = obj, *name2 = arg;
+	struct sound_cache_name_key *key = arg;
+
+	if (flags & OBJ_KEY) {
+		return !strcmp(name->filename, key->filename) && !strcmp(name->preflang, key->preflang)
+			&& !strcmp(name->fmt, key->fmt) ? CMP_MATCH | CMP_STOP : 0;
+	}
+	return !strcmp(name->filename, name2->filename) && !strcmp(name->preflang, name2->preflang)
+		&& !strcmp(name->fmt, name2->fmt) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static void sound_cache_name_destructor(void *obj)
+{
+	struct sound_cache_name *name = obj;
+
+	if (name->cap) {
+		ast_format_cap_destroy(name->cap);
+	}
+}
+
+/*! \note Called with sound_cache_lock held */
+static void sound_cache_unlink(struct ast_sound_cache_file *file)
+{
+	if (!file->linked) {
+		return;
+	}
+	file->linked = 0;
+	sound_cache_used -= file->size + file->encoded;
+	ao2_unlink(sound_cache_files, file);
+}
+
+/*!
+ * \internal
+ * \brief Drops the sounds played least recently until the cache fits its size
+ * \note Called with sound_cache_lock held
+ */
+static void sound_cache_evict(void)
+{
+	struct ao2_iterator i;
+	struct ast_sound_cache_file *file, *oldest;
+
+	while (sound_cache_used > (size_t) ast_sound_cache_size * 1024 * 1024) {
+		oldest = NULL;
+		i = ao2_iterator_init(sound_cache_files, 0);
+		while ((file = ao2_iterator_next(&i))) {
+			if (!oldest || ast_tvcmp(file->used, oldest->used) < 0) {
+				if (oldest) {
+					ao2_ref(oldest, -1);
+				}
+				oldest = file;
+			} else {
+				ao2_ref(file, -1);
+			}
+		}
+		ao2_iterator_destroy(&i);
+		if (!oldest) {
+			break;
+		}
+		sound_cache_unlink(oldest);
+		ao2_ref(oldest, -1);
+		ast_atomic_fetchadd_int(&sound_cache_stats.evictions, +1);
+	}
+}
+
+/*! \brief Reads a sound file into memory */
+static struct ast_sound_cache_file *sound_cache_load(const char *fn, const struct stat *st)
+{
+	struct ast_sound_cache_file *file;
+	size_t len = 0;
+	ssize_t res;
+	int fd;
+
+	if (!(file = ao2_alloc(sizeof(*file) + strlen(fn) + 1, sound_cache_file_destructor))) {
+		return NULL;
+	}
+	strcpy(file->name, fn); /* SAFE */
+	file->size = st->st_size;
+	file->dev = st->st_dev;
+	file->ino = st->st_ino;
+	file->mtime = st->st_mtime;
+	file->validated = file->used = ast_tvnow();
+
+	if (!(file->data = ast_malloc(file->size)) || (fd = open(fn, O_RDONLY)) < 0) {
+		ao2_ref(file, -1);
+		return NULL;
+	}
+	while (len < file->size && (res = read(fd, file->data + len, file->size - len)) > 0) {
+		len += res;
+	}
+	close(fd);
+	if (len < file->size) {
+		/* It was truncated while being read, better not cache it */
+		ao2_ref(file, -1);
+		return NULL;
+	}
+
+	return file;
+}
+
+/*!
+ * \internal
+ * \brief Gets a sound file from the cache, reading it into memory if needed
+ * \param fn Full name of the file
+ * \param[out] missing Set if the file does not exist
+ * \return The cached file with a reference, or NULL if it is not cached
+ */
+static struct ast_sound_cache_file *sound_cache_get(const char *fn, int *missing)
+{
+	struct ast_sound_cache_file *file, *cached;
+	struct timeval now = ast_tvnow();
+	struct stat st;
+
+	*missing = 0;
+	if ((file = ao2_find(sound_cache_files, fn, OBJ_KEY))) {
+		if (ast_tvdiff_ms(now, file->validated) < SOUND_CACHE_REVALIDATE * 1000) {
+			goto cache_hit;
+		}
+		if (!stat(fn, &st) && st.st_dev == file->dev && st.st_ino == file->ino
+			&& st.st_size == file->size && st.st_mtime == file->mtime) {
+			file->validated = now;
+			goto cache_hit;
+		}
+		/* It changed on disk */
+		ast_mutex_lock(&sound_cache_lock);
+		sound_cache_unlink(file);
+		ast_mutex_unlock(&sound_cache_lock);
+		ao2_ref(file, -1);
+		ast_atomic_fetchadd_int(&sound_cache_stats.invalidations, +1);
+	}
+
+	if (stat(fn, &st)) {
+		*missing = 1;
+		return NULL;
+	}
+	/* Long sounds, such as music on hold, are better left on disk */
+	if (!S_ISREG(st.st_mode) || !st.st_size || st.st_size > (off_t) ast_sound_cache_size * 1024 * 1024 / 16) {
+		return NULL;
+	}
+	if (!(file = sound_cache_load(fn, &st))) {
+		return NULL;
+	}
+	ast_atomic_fetchadd_int(&sound_cache_stats.loads, +1);
+
+	ast_mutex_lock(&sound_cache_lock);
+	if ((cached = ao2_find(sound_cache_files, fn, OBJ_KEY))) {
+		/* Somebody else read it meanwhile */
+		ast_mutex_unlock(&sound_cache_lock);
+		ao2_ref(file, -1);
+		file = cached;
+		goto cache_hit;
+	}
+	file->linked = 1;
+	ao2_link(sound_cache_files, file);
+	sound_cache_used += file->size;
+	sound_cache_evict();
+	ast_mutex_unlock(&sound_cache_lock);
+
+	return file;
+
+cache_hit:
+	file->used = now;
+	ast_atomic_fetchadd_int(&file->hits, +1);
+	ast_atomic_fetchadd_int(&sound_cache_stats.plays, +1);
+	return file;
+}
+
+/*! \brief Opens a cached sound file for reading from memory */
+static FILE *sound_cache_fopen(struct ast_sound_cache_file *file)
+{
+#ifdef HAVE_FMEMOPEN
+	return fmemopen(file->data, file->size, "r");
+#else
+	return fopen(file->name, "r");
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Opens a sound file for reading, from memory if it is cached
+ * \param fn Full name of the file
+ * \param cacheable Whether the file may be kept in the sound cache
+ * \param[out] cached The cached file read from, with a reference, or NULL
+ * \return The open file, or NULL if it does not exist or cannot be opened
+ */
+static FILE *sound_open(const char *fn, int cacheable, struct ast_sound_cache_file **cached)
+{
+	struct stat st;
+	FILE *bfile;
+	int missing;
+
+	*cached = NULL;
+	if (cacheable && ast_sound_cache_size) {
+		if ((*cached = sound_cache_get(fn, &missing))) {
+			if ((bfile = sound_cache_fopen(*cached))) {
+				return bfile;
+			}
+			ao2_ref(*cached, -1);
+			*cached = NULL;
+		} else if (missing) {
+			return NULL;
+		}
+	}
+
+	if (stat(fn, &st) || !(bfile = fopen(fn, "r"))) {
+		return NULL;
+	}
+	if (st.st_size == 0) {
+		ast_log(LOG_WARNING, "File %s detected to have zero size.\n", fn);
+	}
+	return bfile;
+}
+
+static struct ast_frame *sound_cache_frames_read(struct ast_filestream *s, int *whennext)
+{
+	struct sound_cache_frames *frames = (struct sound_cache_frames *) s->fmt;
+	struct sound_cache_pos *pos = s->_private;
+	struct sound_cache_frame *frame;
+
+	if (pos->frame >= frames->count) {
+		return NULL;
+	}
+	frame = &frames->frames[pos->frame++];
+	pos->sample += frame->samples;
+
+	/* The frame is copied by read_frame() before it is written anywhere */
+	s->fr.frametype = AST_FRAME_VOICE;
+	ast_format_copy(&s->fr.subclass.format, &frames->def.format);
+	s->fr.mallocd = 0;
+	s->fr.offset = 0;
+	s->fr.data.ptr = frames->data + frame->offset;
+	s->fr.datalen = frame->datalen;
+	s->fr.samples = frame->samples;
+	*whennext = frame->samples;
+	return &s->fr;
+}
+
+static int sound_cache_frames_seek(struct ast_filestream *s, off_t sample_offset, int whence)
+{
+	struct sound_cache_frames *frames = (struct sound_cache_frames *) s->fmt;
+	struct sound_cache_pos *pos = s->_private;
+	off_t target;
+
+	if (whence == SEEK_SET) {
+		target = sample_offset;
+	} else if (whence == SEEK_CUR || whence == SEEK_FORCECUR) {
+		target = pos->sample + sample_offset;
+	} else if (whence == SEEK_END) {
+		target = frames->samples + sample_offset;
+	} else {
+		return -1;
+	}
+	target = MAX(0, MIN(target, frames->samples));
+
+	/* Frames are played whole, so stop at the one holding the sample */
+	pos->frame = 0;
+	pos->sample = 0;
+	while (pos->frame < frames->count && pos->sample + frames->frames[pos->frame].samples <= target) {
+		pos->sample += frames->frames[pos->frame++].samples;
+	}
+	return 0;
+}
+
+static int sound_cache_frames_trunc(struct ast_filestream *s)
+{
+	return -1;
+}
+
+static off_t sound_cache_frames_tell(struct ast_filestream *s)
+{
+	struct sound_cache_pos *pos = s->_private;
+
+	return pos->sample;
+}
+
+/*! \note Called with the cached file locked */
+static int sound_cache_frames_add(struct sound_cache_frames *frames, struct ast_frame *f)
+{
+	struct sound_cache_frame *frame;
+
+	if (frames->count == frames->alloc) {
+		unsigned int alloc = frames->alloc ? frames->alloc * 2 : 64;
+
+		if (!(frame = ast_realloc(frames->frames, alloc * sizeof(*frame)))) {
+			return -1;
+		}
+		frames->frames = frame;
+		frames->alloc = alloc;
+	}
+	if (frames->datalen + f->datalen > frames->dataalloc) {
+		size_t alloc = MAX(frames->dataalloc * 2, frames->datalen + f->datalen);
+		unsigned char *data;
+
+		if (!(data = ast_realloc(frames->data, alloc))) {
+			return -1;
+		}
+		frames->data = data;
+		frames->dataalloc = alloc;
+	}
+
+	frame = &frames->frames[frames->count++];
+	frame->offset = frames->datalen;
+	frame->datalen = f->datalen;
+	frame->samples = f->samples;
+	memcpy(frames->data + frames->datalen, f->data.ptr, f->datalen);
+	frames->datalen += f->datalen;
+	frames->samples += f->samples;
+	return 0;
+}
+
+/*! \brief Gets a cached sound encoded in another format, if it is */
+static struct sound_cache_frames *sound_cache_encoded(struct ast_sound_cache_file *file, struct ast_format *dst)
+{
+	struct sound_cache_frames *frames;
+
+	ao2_lock(file);
+	AST_LIST_TRAVERSE(&file->encodings, frames, list) {
+		if (ast_format_cmp(&frames->def.format, dst) == AST_FORMAT_CMP_EQUAL) {
+			ast_atomic_fetchadd_int(&frames->hits, +1);
+			ast_atomic_fetchadd_int(&sound_cache_stats.encoded_plays, +1);
+			break;
+		}
+	}
+	ao2_unlock(file);
+
+	return frames;
+}
+
+/*! \brief A cached sound to encode in another format */
+struct sound_cache_encoding {
+	struct ast_sound_cache_file *file;
+	/*! The file format of the sound, whose module is held */
+	struct ast_format_def *fmt;
+	struct ast_format dst;
+};
+
+/*!
+ * \internal
+ * \brief Encodes a cached sound in another format
+ *
+ * Runs on the encoder taskprocessor.  Channels keep playing the sound
+ * through the translator meanwhile.
+ */
+static int sound_cache_encode(void *data)
+{
+	struct sound_cache_encoding *encoding = data;
+	struct ast_sound_cache_file *file = encoding->file;
+	struct ast_format_def *fmt = encoding->fmt;
+	struct sound_cache_frames *frames;
+	struct ast_trans_pvt *trans = NULL;
+	struct ast_filestream *s = NULL;
+	struct ast_frame *fr, *out, *cur;
+	FILE *bfile;
+	int whennext = 0, res = 0;
+
+	if (!(frames = ast_calloc(1, sizeof(*frames)))
+		|| !(trans = ast_translator_build_path(&encoding->dst, &fmt->format))
+		|| !(bfile = sound_cache_fopen(file))) {
+		goto encode_failed;
+	}
+	if (!(s = get_filestream(fmt, bfile))) {
+		fclose(bfile);
+		goto encode_failed;
+	}
+	if (open_wrapper(s)) {
+		ast_closestream(s);
+		s = NULL;
+		goto encode_failed;
+	}
+
+	while (!res && (fr = fmt->read(s, &whennext))) {
+		if (!(out = ast_translate(trans, fr, 0))) {
+			continue;
+		}
+		for (cur = out; cur && !res; cur = AST_LIST_NEXT(cur, frame_list)) {
+			res = sound_cache_frames_add(frames, cur);
+		}
+		ast_frfree(out);
+	}
+	if (res || !frames->count) {
+		goto encode_failed;
+	}
+	ast_closestream(s);
+	ast_translator_free_path(trans);
+
+	ast_copy_string(frames->def.name, "sound cache", sizeof(frames->def.name));
+	ast_format_copy(&frames->def.format, &encoding->dst);
+	frames->def.read = sound_cache_frames_read;
+	frames->def.seek = sound_cache_frames_seek;
+	frames->def.trunc = sound_cache_frames_trunc;
+	frames->def.tell = sound_cache_frames_tell;
+	frames->def.desc_size = sizeof(struct sound_cache_pos);
+	ao2_lock(file);
+	AST_LIST_INSERT_TAIL(&file->encodings, frames, list);
+	file->encoding = 0;
+	ao2_unlock(file);
+
+	ast_mutex_lock(&sound_cache_lock);
+	if (file->linked) {
+		file->encoded += frames->datalen + frames->count * sizeof(*frames->frames);
+		sound_cache_used += frames->datalen + frames->count * sizeof(*frames->frames);
+		sound_cache_evict();
+	}
+	ast_mutex_unlock(&sound_cache_lock);
+	ast_atomic_fetchadd_int(&sound_cache_stats.encodings, +1);
+
+	ast_module_unref(fmt->module);
+	ao2_ref(file, -1);
+	ast_free(encoding);
+	return 0;
+
+encode_failed:
+	if (s) {
+		ast_closestream(s);
+	}
+	if (trans) {
+		ast_translator_free_path(trans);
+	}
+	if (frames) {
+		ast_free(frames->frames);
+		ast_free(frames->data);
+		ast_free(frames);
+	}
+	/* Not tried again until the sound is read into the cache again */
+	ast_module_unref(fmt->module);
+	ao2_ref(file, -1);
+	ast_free(encoding);
+	return -1;
+}
+
+/*!
+ * \internal
+ * \brief Has a cached sound encoded in another format, unless it is being encoded already
+ * \note Called with the formats list locked
+ */
+static void sound_cache_encode_queue(struct ast_sound_cache_file *file, struct ast_format_def *fmt, struct ast_format *dst)
+{
+	struct sound_cache_encoding *encoding;
+
+	ao2_lock(file);
+	if (file->encoding) {
+		ao2_unlock(file);
+		return;
+	}
+	file->encoding = 1;
+	ao2_unlock(file);
+
+	if (!(encoding = ast_calloc(1, sizeof(*encoding)))) {
+		goto queue_failed;
+	}
+	ao2_ref(file, +1);
+	encoding->file = file;
+	ast_module_ref(fmt->module);
+	encoding->fmt = fmt;
+	ast_format_copy(&encoding->dst, dst);
+	if (ast_taskprocessor_push(sound_cache_encoder, sound_cache_encode, encoding)) {
+		ast_module_unref(fmt->module);
+		ao2_ref(file, -1);
+		ast_free(encoding);
+		goto queue_failed;
+	}
+	return;
+
+queue_failed:
+	ao2_lock(file);
+	file->encoding = 0;
+	ao2_unlock(file);
+}
+
+/*!
+ * \internal
+ * \brief Opens a sound pre-encoded in the format the channel is written in
+ *
+ * The channel write format is already set to the best format the sound
+ * exists in.  If the channel would transcode it, the cached sound encoded
+ * in the native format of the channel is played instead.  A sound not
+ * encoded yet is encoded in the background, and transcoded this time.
+ *
+ * \return The stream, set as the audio stream of the channel, or NULL
+ */
+static struct ast_filestream *sound_cache_open_encoded(struct ast_channel *chan, const char *filename)
+{
+	struct ast_format src, dst;
+	struct ast_format_def *f;
+	struct ast_sound_cache_file *file = NULL;
+	struct sound_cache_frames *frames = NULL;
+	struct ast_filestream *s;
+	int missing;
+
+	ast_format_copy(&src, ast_channel_writeformat(chan));
+	ast_format_copy(&dst, ast_channel_rawwriteformat(chan));
+	if (ast_format_cmp(&src, &dst) != AST_FORMAT_CMP_NOT_EQUAL
+		|| AST_FORMAT_GET_TYPE(dst.id) != AST_FORMAT_TYPE_AUDIO) {
+		return NULL;
+	}
+
+	AST_RWLIST_RDLOCK(&formats);
+	AST_RWLIST_TRAVERSE(&formats, f, list) {
+		char *stringp, *ext;
+
+		if (ast_format_cmp(&f->format, &src) == AST_FORMAT_CMP_NOT_EQUAL) {
+			continue;
+		}
+		stringp = ast_strdupa(f->exts);
+		while (!file && (ext = strsep(&stringp, "|"))) {
+			char *fn = build_filename(filename, ext);
+
+			if (fn) {
+				file = sound_cache_get(fn, &missing);
+				ast_free(fn);
+			}
+		}
+		if (file) {
+			if (!(frames = sound_cache_encoded(file, &dst))) {
+				sound_cache_encode_queue(file, f, &dst);
+			}
+			break;
+		}
+	}
+	AST_RWLIST_UNLOCK(&formats);
+
+	if (!frames || !(s = get_filestream(&frames->def, NULL))) {
+		if (file) {
+			ao2_ref(file, -1);
+		}
+		return NULL;
+	}
+	/* The stream keeps the sound, and so its encoding, alive */
+	s->cache = file;
+	s->lasttimeout = -1;
+	if (ast_set_write_format(chan, &dst)) {
+		ast_closestream(s);
+		return NULL;
+	}
+	if (ast_channel_stream(chan)) {
+		ast_closestream(ast_channel_stream(chan));
+	}
+	ast_channel_stream_set(chan, s);
+
+	return s;
+}
+
+/*! \brief Whether a stream is at its end */
+static int stream_eof(struct ast_filestream *fs)
+{
+	int eoftest;
+
+	if (!fs->f) {
+		return ast_tellstream(fs) >= ((struct sound_cache_frames *) fs->fmt)->samples;
+	}
+	eoftest = fgetc(fs->f);
+	if (feof(fs->f)) {
+		return 1;
+	}
+	ungetc(eoftest, fs->f);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Whether a sound is a language variant of a name, or the name itself
+ * \param name Name of a cached sound, relative to the sounds directory
+ * \param base Name invalidated, relative to the sounds directory
+ *
+ * The language is one more directory in the path, first with the new layout
+ * (en/digits/1) and before the file with the old one (digits/en/1).  Any
+ * other directory added matches too, which costs no more than a reload.
+ */
+static int sound_cache_is_variant(const char *name, const char *base)
+{
+	const char *start = name, *slash;
+	size_t len;
+
+	if (!strncmp(name, base, strlen(base))) {
+		return 1;
+	}
+	while ((slash = strchr(start, '/'))) {
+		len = start - name;
+		if (!strncmp(name, base, len) && !strncmp(slash + 1, base + len, strlen(base + len))) {
+			return 1;
+		}
+		start = slash + 1;
+	}
+	return 0;
+}
+
+struct sound_cache_invalidate_args {
+	const char *prefix;	/*!< Full name of the sound, without the extension */
+	const char *sounds;	/*!< The sounds directory, if the sound is in it */
+};
+
+static int sound_cache_invalidate_cb(void *obj, void *arg, int flags)
+{
+	struct ast_sound_cache_file *file = obj;
+	struct sound_cache_invalidate_args *args = arg;
+
+	if (args->prefix) {
+		size_t len = args->sounds ? strlen(args->sounds) : 0;
+
+		if (!len || strncmp(file->name, args->sounds, len)) {
+			if (strncmp(file->name, args->prefix, strlen(args->prefix))) {
+				return 0;
+			}
+		} else if (!sound_cache_is_variant(file->name + len, args->prefix + len)) {
+			return 0;
+		}
+	}
+	file->linked = 0;
+	sound_cache_used -= file->size + file->encoded;
+	ast_atomic_fetchadd_int(&sound_cache_stats.invalidations, +1);
+	return CMP_MATCH;
+}
+
+void ast_sound_cache_invalidate(const char *filename)
+{
+	struct sound_cache_invalidate_args args = { NULL, NULL };
+	char sounds[PATH_MAX], *prefix = NULL;
+
+	if (!sound_cache_files) {
+		return;
+	}
+	if (filename && !(prefix = build_filename(filename, ""))) {
+		return;
+	}
+	args.prefix = prefix;
+
+	/* Any lookup of a relative name may have found the sound, in any language */
+	if (!prefix || !strncmp(prefix, ast_config_AST_DATA_DIR, strlen(ast_config_AST_DATA_DIR))) {
+		ao2_callback(sound_cache_names, OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA, NULL, NULL);
+	}
+
+	/* And every language variant of a sound may be cached */
+	snprintf(sounds, sizeof(sounds), "%s/sounds/", ast_config_AST_DATA_DIR);
+	if (prefix && !strncmp(prefix, sounds, strlen(sounds))) {
+		args.sounds = sounds;
+	}
+
+	ast_mutex_lock(&sound_cache_lock);
+	ao2_callback(sound_cache_files, OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA, sound_cache_invalidate_cb, &args);
+	ast_mutex_unlock(&sound_cache_lock);
+
+	ast_free(prefix);
+}
+
 enum file_action {
 	ACTION_EXISTS = 1, /* return matching format if file exists, 0 otherwise */
 	ACTION_DELETE,	/* delete file, return 0 on success, -1 on error */
@@ -455,15 +1248,12 @@ static int filehelper(const char *filename, const void *arg2, const char *fmt, c
 			if (fn == NULL)
 				continue;
 
-			if ( stat(fn, &st) ) { /* file not existent */
-				ast_free(fn);
-				continue;
-			}
 			/* for 'OPEN' we need to be sure that the format matches
 			 * what the channel can process
 			 */
 			if (action == ACTION_OPEN) {
 				struct ast_channel *chan = (struct ast_channel *)arg2;
+				struct ast_sound_cache_file *cached;
 				FILE *bfile;
 				struct ast_filestream *s;
 
@@ -473,24 +1263,25 @@ static int filehelper(const char *filename, const void *arg2, const char *fmt, c
 					ast_free(fn);
 					continue;	/* not a supported format */
 				}
-				if ( (bfile = fopen(fn, "r")) == NULL) {
+				if ( (bfile = sound_open(fn, !is_absolute_path(filename), &cached)) == NULL) {
 					ast_free(fn);
-					continue;	/* cannot open file */
+					continue;	/* file not existent or cannot open file */
 				}
 				s = get_filestream(f, bfile);
 				if (!s) {
 					fclose(bfile);
+					if (cached) {
+						ao2_ref(cached, -1);
+					}
 					ast_free(fn);	/* cannot allocate descriptor */
 					continue;
 				}
+				s->cache = cached;
 				if (open_wrapper(s)) {
 					ast_free(fn);
 					ast_closestream(s);
 					continue;	/* cannot run open on file */
 				}
-				if (st.st_size == 0) {
-					ast_log(LOG_WARNING, "File %s detected to have zero size.\n", fn);
-				}
 				/* ok this is good for OPEN */
 				res = 1;	/* found */
 				s->lasttimeout = -1;
@@ -509,6 +1300,10 @@ static int filehelper(const char *filename, const void *arg2, const char *fmt, c
 				ast_free(fn);
 				break;
 			}
+			if ( stat(fn, &st) ) { /* file not existent */
+				ast_free(fn);
+				continue;
+			}
 			switch (action) {
 			case ACTION_OPEN:
 				break;	/* will never get here */
@@ -553,11 +1348,6 @@ static int filehelper(const char *filename, const void *arg2, const char *fmt, c
 	return res;
 }
 
-static int is_absolute_path(const char *filename)
-{
-	return filename[0] == '/';
-}
-
 /*!
  * \brief test if a file exists for a given format.
  * \note result_cap is OPTIONAL
@@ -610,7 +1400,7 @@ static int fileexists_test(const char *filename, const char *fmt, const char *la
  * \retval 1, true. file exists and result format is set
  * \retval 0, false. file does not exist.
  */
-static int fileexists_core(const char *filename, const char *fmt, const char *preflang,
+static int fileexists_scan(const char *filename, const char *fmt, const char *preflang,
 			   char *buf, int buflen, struct ast_format_cap *result_cap)
 {
 	char *lang;
@@ -659,6 +1449,104 @@ static int fileexists_core(const char *filename, const char *fmt, const char *pr
 	return 0;
 }
 
+static int sound_cache_name_stale(void *obj, void *arg, void *data, int flags)
+{
+	struct sound_cache_name *name = obj;
+	struct timeval *now = data;
+
+	return ast_tvdiff_ms(*now, name->validated) >= SOUND_CACHE_REVALIDATE * 1000 ? (CMP_MATCH | CMP_STOP) : 0;
+}
+
+/*!
+ * \brief Forget a lookup to make room for the one with the given key
+ *
+ * Only the hash bucket of the key is searched, for a stale lookup or else
+ * any, so that a full cache costs no more than a bucket per lookup.  The
+ * first lookup of the cache goes if that bucket is empty.
+ */
+static void sound_cache_names_evict(struct sound_cache_name_key *key, struct timeval *now)
+{
+	struct sound_cache_name *name;
+
+	if ((name = ao2_callback_data(sound_cache_names, OBJ_KEY | OBJ_UNLINK, sound_cache_name_stale, key, now))
+		|| (name = ao2_callback(sound_cache_names, OBJ_KEY | OBJ_UNLINK, NULL, key))
+		|| (name = ao2_callback(sound_cache_names, OBJ_UNLINK, NULL, NULL))) {
+		ao2_ref(name, -1);
+	}
+}
+
+/*!
+ * \brief helper routine to locate a file, remembering where sounds were found
+ *
+ * Sounds with relative names are looked up in the sound cache, if enabled,
+ * instead of searching the disk for every language and format each time.
+ * The arguments and result are those of fileexists_scan().
+ */
+static int fileexists_core(const char *filename, const char *fmt, const char *preflang,
+			   char *buf, int buflen, struct ast_format_cap *result_cap)
+{
+	struct sound_cache_name_key key = { filename, S_OR(preflang, ""), S_OR(fmt, "") };
+	struct sound_cache_name *name;
+	struct ast_format_cap *cap;
+	struct timeval now;
+	size_t len;
+	int res;
+
+	if (buf == NULL) {
+		return 0;
+	}
+	if (!ast_sound_cache_size || !sound_cache_names || is_absolute_path(filename)) {
+		return fileexists_scan(filename, fmt, preflang, buf, buflen, result_cap);
+	}
+
+	now = ast_tvnow();
+	if ((name = ao2_find(sound_cache_names, &key, OBJ_KEY))) {
+		if (ast_tvdiff_ms(now, name->validated) < SOUND_CACHE_REVALIDATE * 1000) {
+			ast_copy_string(buf, name->resolved, buflen);
+			if (result_cap) {
+				ast_format_cap_append(result_cap, name->cap);
+			}
+			ao2_ref(name, -1);
+			ast_atomic_fetchadd_int(&sound_cache_stats.lookups_cached, +1);
+			return 1;
+		}
+		ao2_unlink(sound_cache_names, name);
+		ao2_ref(name, -1);
+	}
+
+	ast_atomic_fetchadd_int(&sound_cache_stats.lookups_searched, +1);
+	if (!(cap = ast_format_cap_alloc_nolock())) {
+		return fileexists_scan(filename, fmt, preflang, buf, buflen, result_cap);
+	}
+	if (!(res = fileexists_scan(filename, fmt, preflang, buf, buflen, cap))) {
+		ast_format_cap_destroy(cap);
+		return 0;
+	}
+	if (result_cap) {
+		ast_format_cap_append(result_cap, cap);
+	}
+
+	len = strlen(key.filename) + strlen(key.preflang) + strlen(key.fmt) + strlen(buf) + 4;
+	if (!(name = ao2_alloc(sizeof(*name) + len, sound_cache_name_destructor))) {
+		ast_format_cap_destroy(cap);
+		return res;
+	}
+	strcpy(name->filename, key.filename); /* SAFE */
+	name->preflang = strcpy(name->filename + strlen(key.filename) + 1, key.preflang); /* SAFE */
+	name->fmt = strcpy((char *) name->preflang + strlen(key.preflang) + 1, key.fmt); /* SAFE */
+	name->resolved = strcpy((char *) name->fmt + strlen(key.fmt) + 1, buf); /* SAFE */
+	name->cap = cap;
+	name->validated = now;
+
+	if (ao2_container_count(sound_cache_names) >= SOUND_CACHE_MAX_NAMES) {
+		sound_cache_names_evict(&key, &now);
+	}
+	ao2_link(sound_cache_names, name);
+	ao2_ref(name, -1);
+
+	return res;
+}
+
 struct ast_filestream *ast_openstream(struct ast_channel *chan, const char *filename, const char *preflang)
 {
 	return ast_openstream_full(chan, filename, preflang, 0);
@@ -710,12 +1598,85 @@ struct ast_filestream *ast_openstream_full(struct ast_channel *chan, const char
 	if (res == -1) {	/* No format available that works with this channel */
 		return NULL;
 	}
+	if (ast_sound_cache_size && ast_sound_cache_encode && !is_absolute_path(buf)
+		&& sound_cache_open_encoded(chan, buf)) {
+		return ast_channel_stream(chan);
+	}
 	res = filehelper(buf, chan, NULL, ACTION_OPEN);
 	if (res >= 0)
 		return ast_channel_stream(chan);
 	return NULL;
 }
 
+struct ast_filestream *ast_openstream_nochan(const char *filename, const char *preflang)
+{
+	struct ast_format_cap *file_fmt_cap;
+	struct ast_format best;
+	struct ast_format_def *f;
+	struct ast_filestream *s = NULL;
+	int buflen;
+	char *buf;
+
+	if (preflang == NULL)
+		preflang = "";
+	buflen = strlen(preflang) + strlen(filename) + 4;
+	buf = alloca(buflen);
+	if (buf == NULL)
+		return NULL;
+
+	if (!(file_fmt_cap = ast_format_cap_alloc_nolock())) {
+		return NULL;
+	}
+	if (!fileexists_core(filename, NULL, preflang, buf, buflen, file_fmt_cap)
+		|| !ast_format_cap_has_type(file_fmt_cap, AST_FORMAT_TYPE_AUDIO)) {
+		ast_log(LOG_WARNING, "File %s does not exist in any format\n", filename);
+		ast_format_cap_destroy(file_fmt_cap);
+		return NULL;
+	}
+	ast_best_codec(file_fmt_cap, &best);
+	file_fmt_cap = ast_format_cap_destroy(file_fmt_cap);
+
+	AST_RWLIST_RDLOCK(&formats);
+	AST_RWLIST_TRAVERSE(&formats, f, list) {
+		char *stringp, *ext;
+
+		if (ast_format_cmp(&f->format, &best) == AST_FORMAT_CMP_NOT_EQUAL) {
+			continue;
+		}
+		stringp = ast_strdupa(f->exts);
+		while (!s && (ext = strsep(&stringp, "|"))) {
+			struct ast_sound_cache_file *cached;
+			char *fn = build_filename(buf, ext);
+			FILE *bfile;
+
+			if (!fn) {
+				continue;
+			}
+			if ((bfile = sound_open(fn, !is_absolute_path(buf), &cached))) {
+				if ((s = get_filestream(f, bfile))) {
+					s->cache = cached;
+					if (open_wrapper(s)) {
+						ast_closestream(s);
+						s = NULL;
+					}
+				} else {
+					fclose(bfile);
+					if (cached) {
+						ao2_ref(cached, -1);
+					}
+				}
+			}
+			ast_free(fn);
+		}
+		if (s) {
+			break;
+		}
+	}
+	AST_RWLIST_UNLOCK(&formats);
+
+	return s;
+}
+
 struct ast_filestream *ast_openvstream(struct ast_channel *chan, const char *filename, const char *preflang)
 {
 	/* As above, but for video. But here we don't have translators
@@ -991,16 +1952,20 @@ int ast_fileexists(const char *filename, const char *fmt, const char *preflang)
 
 int ast_filedelete(const char *filename, const char *fmt)
 {
+	ast_sound_cache_invalidate(filename);
 	return filehelper(filename, NULL, fmt, ACTION_DELETE);
 }
 
 int ast_filerename(const char *filename, const char *filename2, const char *fmt)
 {
+	ast_sound_cache_invalidate(filename);
+	ast_sound_cache_invalidate(filename2);
 	return filehelper(filename, filename2, fmt, ACTION_RENAME);
 }
 
 int ast_filecopy(const char *filename, const char *filename2, const char *fmt)
 {
+	ast_sound_cache_invalidate(filename2);
 	return filehelper(filename, filename2, fmt, ACTION_COPY);
 }
 
@@ -1021,18 +1986,20 @@ int ast_streamfile(struct ast_channel *chan, const char *filename, const char *p
 
 	/* check to see if there is any data present (not a zero length file),
 	 * done this way because there is no where for ast_openstream_full to
-	 * return the file had no data. */
-	pos = ftello(fs->f);
-	seekattempt = fseeko(fs->f, -1, SEEK_END);
-	if (seekattempt) {
-		if (errno == EINVAL) {
-			/* Zero-length file, as opposed to a pipe */
-			return 0;
+	 * return the file had no data.  Pre-encoded sounds are never empty. */
+	if (fs->f) {
+		pos = ftello(fs->f);
+		seekattempt = fseeko(fs->f, -1, SEEK_END);
+		if (seekattempt) {
+			if (errno == EINVAL) {
+				/* Zero-length file, as opposed to a pipe */
+				return 0;
+			} else {
+				ast_seekstream(fs, 0, SEEK_SET);
+			}
 		} else {
-			ast_seekstream(fs, 0, SEEK_SET);
+			fseeko(fs->f, pos, SEEK_SET);
 		}
-	} else {
-		fseeko(fs->f, pos, SEEK_SET);
 	}
 
 	vfs = ast_openvstream(chan, filename, preflang);
@@ -1113,6 +2080,8 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 	size_t size = 0;
 	int format_found = 0;
 
+	ast_sound_cache_invalidate(filename);
+
 	AST_RWLIST_RDLOCK(&formats);
 
 	/* set the O_TRUNC flag if and only if there is no O_APPEND specified */
@@ -1320,13 +2289,9 @@ static int waitstream_core(struct ast_channel *c, const char *breakon,
 				} else {
 					res = fr->subclass.integer;
 					if (strchr(forward, res)) {
-						int eoftest;
 						ast_stream_fastforward(ast_channel_stream(c), skip_ms);
-						eoftest = fgetc(ast_channel_stream(c)->f);
-						if (feof(ast_channel_stream(c)->f)) {
+						if (stream_eof(ast_channel_stream(c))) {
 							ast_stream_rewind(ast_channel_stream(c), skip_ms);
-						} else {
-							ungetc(eoftest, ast_channel_stream(c)->f);
 						}
 					} else if (strchr(reverse, res)) {
 						ast_stream_rewind(ast_channel_stream(c), skip_ms);
@@ -1542,12 +2507,83 @@ static char *handle_cli_core_show_file_formats(struct ast_cli_entry *e, int cmd,
 #undef FORMAT2
 }
 
+static char *handle_cli_core_show_sound_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-50s %10s %8s %-20s\n"
+	struct ast_sound_cache_file *file;
+	struct sound_cache_frames *frames;
+	struct ao2_iterator i;
+	char bytes[16], plays[16], encodings[64];
+	size_t used;
+	int count = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show sound cache";
+		e->usage =
+			"Usage: core show sound cache\n"
+			"       Displays the sounds kept in memory by the sound cache, how\n"
+			"       often they were played and the formats they are kept encoded\n"
+			"       in, and how well the cache is doing.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4)
+		return CLI_SHOWUSAGE;
+
+	if (!ast_sound_cache_size) {
+		ast_cli(a->fd, "The sound cache is disabled, set soundcachesize in asterisk.conf to enable it.\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, FORMAT, "Sound", "Bytes", "Plays", "Encodings");
+	i = ao2_iterator_init(sound_cache_files, 0);
+	while ((file = ao2_iterator_next(&i))) {
+		encodings[0] = '\0';
+		ao2_lock(file);
+		AST_LIST_TRAVERSE(&file->encodings, frames, list) {
+			snprintf(encodings + strlen(encodings), sizeof(encodings) - strlen(encodings), "%s%s(%d)",
+				encodings[0] ? "," : "", ast_getformatname(&frames->def.format), frames->hits);
+		}
+		ao2_unlock(file);
+		snprintf(bytes, sizeof(bytes), "%zu", file->size + file->encoded);
+		snprintf(plays, sizeof(plays), "%d", file->hits + 1);
+		ast_cli(a->fd, FORMAT, file->name, bytes, plays, S_OR(encodings, "-"));
+		ao2_ref(file, -1);
+		count++;
+	}
+	ao2_iterator_destroy(&i);
+
+	ast_mutex_lock(&sound_cache_lock);
+	used = sound_cache_used;
+	ast_mutex_unlock(&sound_cache_lock);
+
+	ast_cli(a->fd, "%d sounds cached, %.1f of %u MB used.\n", count, (double) used / (1024 * 1024), ast_sound_cache_size);
+	ast_cli(a->fd, "Lookups: %d from the cache, %d searching the disk (%d names remembered)\n",
+		sound_cache_stats.lookups_cached, sound_cache_stats.lookups_searched, ao2_container_count(sound_cache_names));
+	ast_cli(a->fd, "Plays: %d from memory, %d pre-encoded\n",
+		sound_cache_stats.plays + sound_cache_stats.loads, sound_cache_stats.encoded_plays);
+	ast_cli(a->fd, "Sounds read: %d, encoded: %d, evicted: %d, changed: %d\n",
+		sound_cache_stats.loads, sound_cache_stats.encodings, sound_cache_stats.evictions, sound_cache_stats.invalidations);
+	return CLI_SUCCESS;
+#undef FORMAT
+}
+
 static struct ast_cli_entry cli_file[] = {
-	AST_CLI_DEFINE(handle_cli_core_show_file_formats, "Displays file formats")
+	AST_CLI_DEFINE(handle_cli_core_show_file_formats, "Displays file formats"),
+	AST_CLI_DEFINE(handle_cli_core_show_sound_cache, "Displays the sound cache"),
 };
 
 int ast_file_init(void)
 {
+	sound_cache_files = ao2_container_alloc(SOUND_CACHE_BUCKETS, sound_cache_file_hash, sound_cache_file_cmp);
+	sound_cache_names = ao2_container_alloc(SOUND_CACHE_BUCKETS, sound_cache_name_hash, sound_cache_name_cmp);
+	if (!sound_cache_files || !sound_cache_names
+		|| !(sound_cache_encoder = ast_taskprocessor_get("sound_cache_encoder", TPS_REF_DEFAULT))) {
+		return -1;
+	}
 	ast_cli_register_multiple(cli_file, ARRAY_LEN(cli_file));
 	return 0;
 }
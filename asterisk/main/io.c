@@ -32,6 +32,14 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 182847 $")
 
 #include "asterisk/io.h"
 #include "asterisk/utils.h"
+#include "asterisk/options.h"
+#include "asterisk/dlinkedlists.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+/*! epoll(7) is available as an I/O context backend */
+#define IO_EPOLL
+#endif
 
 #ifdef DEBUG_IO
 #define DEBUG DEBUG_M
@@ -57,6 +65,28 @@ struct io_rec {
 
 #define GROW_SHRINK_SIZE 512
 
+#ifdef IO_EPOLL
+/*! \brief
+ * Kept for each file descriptor of an epoll backed context.  The epoll
+ * event points straight at it, so dispatching does not depend on the
+ * number of file descriptors that are not ready.
+ */
+struct io_epoll_rec {
+	int id;                                 /*!< ID number, ast_io_add() hands out its address */
+	int fd;                                 /*!< File descriptor */
+	short events;                           /*!< Event mask */
+	ast_io_cb callback;                     /*!< What is to be called */
+	void *data;                             /*!< Data to be passed */
+	struct io_context *ioc;                 /*!< Owning context, NULL once removed */
+	AST_DLLIST_ENTRY(io_epoll_rec) list;
+};
+
+/*! \brief Number of events fetched by one epoll_wait() call at first */
+#define EPOLL_EVENTS_MIN 64
+/*! \brief Largest number of events fetched by one epoll_wait() call */
+#define EPOLL_EVENTS_MAX 4096
+#endif
+
 /*! \brief Global IO variables are now in a struct in order to be
    made threadsafe */
 struct io_context {
@@ -66,21 +96,56 @@ struct io_context {
 	unsigned int maxfdcnt;        /*!< Maximum available fd */
 	int current_ioc;              /*!< Currently used io callback */
 	int needshrink;               /*!< Whether something has been deleted */
+	int epfd;                     /*!< epoll descriptor, -1 if the context uses poll() */
+#ifdef IO_EPOLL
+	struct epoll_event *events;   /*!< Events returned by epoll_wait() */
+	int maxevents;                /*!< Size of the events array */
+	AST_DLLIST_HEAD_NOLOCK(, io_epoll_rec) recs;    /*!< Registered records */
+	AST_DLLIST_HEAD_NOLOCK(, io_epoll_rec) removed; /*!< Records removed while dispatching */
+#endif
 };
 
-/*! \brief Create an I/O context */
-struct io_context *io_context_create(void)
+#ifdef IO_EPOLL
+static int io_epoll_create(struct io_context *ioc)
+{
+	if ((ioc->epfd = epoll_create(GROW_SHRINK_SIZE)) < 0) {
+		ast_log(LOG_WARNING, "Unable to create epoll descriptor, using poll(): %s\n", strerror(errno));
+		return -1;
+	}
+	if (!(ioc->events = ast_calloc(EPOLL_EVENTS_MIN, sizeof(*ioc->events)))) {
+		close(ioc->epfd);
+		ioc->epfd = -1;
+		return -1;
+	}
+	ioc->maxevents = EPOLL_EVENTS_MIN;
+	AST_DLLIST_HEAD_INIT_NOLOCK(&ioc->recs);
+	AST_DLLIST_HEAD_INIT_NOLOCK(&ioc->removed);
+	return 0;
+}
+#endif
+
+struct io_context *io_context_create_backend(enum ast_io_backend backend)
 {
 	struct io_context *tmp = NULL;
 
-	if (!(tmp = ast_malloc(sizeof(*tmp))))
+	if (!(tmp = ast_calloc(1, sizeof(*tmp))))
 		return NULL;
 	
 	tmp->needshrink = 0;
 	tmp->fdcnt = 0;
-	tmp->maxfdcnt = GROW_SHRINK_SIZE/2;
 	tmp->current_ioc = -1;
-	
+	tmp->epfd = -1;
+
+	if (backend == AST_IO_BACKEND_DEFAULT) {
+		backend = ast_opt_io_poll ? AST_IO_BACKEND_POLL : AST_IO_BACKEND_EPOLL;
+	}
+#ifdef IO_EPOLL
+	if (backend == AST_IO_BACKEND_EPOLL && !io_epoll_create(tmp)) {
+		return tmp;
+	}
+#endif
+
+	tmp->maxfdcnt = GROW_SHRINK_SIZE/2;
 	if (!(tmp->fds = ast_calloc(1, (GROW_SHRINK_SIZE / 2) * sizeof(*tmp->fds)))) {
 		ast_free(tmp);
 		tmp = NULL;
@@ -95,8 +160,33 @@ struct io_context *io_context_create(void)
 	return tmp;
 }
 
+/*! \brief Create an I/O context */
+struct io_context *io_context_create(void)
+{
+	return io_context_create_backend(AST_IO_BACKEND_DEFAULT);
+}
+
+const char *io_context_backend(struct io_context *ioc)
+{
+	return ioc->epfd > -1 ? "epoll" : "poll";
+}
+
 void io_context_destroy(struct io_context *ioc)
 {
+#ifdef IO_EPOLL
+	struct io_epoll_rec *rec;
+
+	if (ioc->epfd > -1) {
+		while ((rec = AST_DLLIST_REMOVE_HEAD(&ioc->recs, list))) {
+			ast_free(rec);
+		}
+		while ((rec = AST_DLLIST_REMOVE_HEAD(&ioc->removed, list))) {
+			ast_free(rec);
+		}
+		ast_free(ioc->events);
+		close(ioc->epfd);
+	}
+#endif
 	/* Free associated memory with an I/O context */
 	if (ioc->fds)
 		ast_free(ioc->fds);
@@ -106,6 +196,137 @@ void io_context_destroy(struct io_context *ioc)
 	ast_free(ioc);
 }
 
+#ifdef IO_EPOLL
+static int *io_epoll_add(struct io_context *ioc, int fd, ast_io_cb callback, short events, void *data)
+{
+	struct io_epoll_rec *rec;
+	struct epoll_event ev = { .events = events, };
+
+	if (!(rec = ast_calloc(1, sizeof(*rec)))) {
+		return NULL;
+	}
+	rec->id = fd;
+	rec->fd = fd;
+	rec->events = events;
+	rec->callback = callback;
+	rec->data = data;
+	rec->ioc = ioc;
+
+	ev.data.ptr = rec;
+	if (epoll_ctl(ioc->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		ast_log(LOG_WARNING, "Unable to watch fd %d: %s\n", fd, strerror(errno));
+		ast_free(rec);
+		return NULL;
+	}
+	AST_DLLIST_INSERT_TAIL(&ioc->recs, rec, list);
+	ioc->fdcnt++;
+
+	return &rec->id;
+}
+
+static int *io_epoll_change(struct io_context *ioc, int *id, int fd, ast_io_cb callback, short events, void *data)
+{
+	struct io_epoll_rec *rec = (struct io_epoll_rec *) id;
+	struct epoll_event ev = { 0, };
+
+	if (rec->ioc != ioc) {
+		return NULL;
+	}
+
+	if (callback)
+		rec->callback = callback;
+	if (events)
+		rec->events = events;
+	if (data)
+		rec->data = data;
+
+	ev.events = rec->events;
+	ev.data.ptr = rec;
+	if (fd > -1) {
+		if (fd != rec->fd) {
+			/* The old descriptor may already be closed, which removed it from the set */
+			epoll_ctl(ioc->epfd, EPOLL_CTL_DEL, rec->fd, &ev);
+			rec->fd = fd;
+			rec->id = fd;
+		}
+		/* A socket closed and reopened under the same number has left the set too */
+		if (epoll_ctl(ioc->epfd, EPOLL_CTL_MOD, fd, &ev)
+			&& (errno != ENOENT || epoll_ctl(ioc->epfd, EPOLL_CTL_ADD, fd, &ev))) {
+			ast_log(LOG_WARNING, "Unable to watch fd %d: %s\n", fd, strerror(errno));
+			return NULL;
+		}
+	} else if (events && epoll_ctl(ioc->epfd, EPOLL_CTL_MOD, rec->fd, &ev)) {
+		ast_log(LOG_WARNING, "Unable to change events of fd %d: %s\n", rec->fd, strerror(errno));
+		return NULL;
+	}
+
+	return id;
+}
+
+static int io_epoll_remove(struct io_context *ioc, int *id)
+{
+	struct io_epoll_rec *rec = (struct io_epoll_rec *) id;
+	struct epoll_event ev = { 0, };
+
+	if (rec->ioc != ioc) {
+		ast_log(LOG_NOTICE, "Unable to remove unknown id %p\n", id);
+		return -1;
+	}
+
+	epoll_ctl(ioc->epfd, EPOLL_CTL_DEL, rec->fd, &ev);
+	AST_DLLIST_REMOVE(&ioc->recs, rec, list);
+	ioc->fdcnt--;
+	rec->ioc = NULL;
+	if (ioc->current_ioc == -1) {
+		ast_free(rec);
+	} else {
+		/* Events fetched by the same epoll_wait() may still point at it */
+		AST_DLLIST_INSERT_TAIL(&ioc->removed, rec, list);
+	}
+	return 0;
+}
+
+static int io_epoll_wait(struct io_context *ioc, int howlong)
+{
+	struct io_epoll_rec *rec;
+	void *tmp;
+	int res, x;
+
+	if ((res = epoll_wait(ioc->epfd, ioc->events, ioc->maxevents, howlong)) <= 0) {
+		return res;
+	}
+
+	for (x = 0; x < res; x++) {
+		rec = ioc->events[x].data.ptr;
+		if (!rec->ioc) {
+			/* Removed by a callback run earlier in this pass */
+			continue;
+		}
+		ioc->current_ioc = rec->id;
+		if (rec->callback) {
+			if (!rec->callback(&rec->id, rec->fd, ioc->events[x].events, rec->data) && rec->ioc) {
+				/* Time to delete them since they returned a 0 */
+				io_epoll_remove(ioc, &rec->id);
+			}
+		}
+		ioc->current_ioc = -1;
+	}
+
+	while ((rec = AST_DLLIST_REMOVE_HEAD(&ioc->removed, list))) {
+		ast_free(rec);
+	}
+
+	if (res == ioc->maxevents && ioc->maxevents < EPOLL_EVENTS_MAX
+		&& (tmp = ast_realloc(ioc->events, 2 * ioc->maxevents * sizeof(*ioc->events)))) {
+		/* Fetch more at once next time */
+		ioc->events = tmp;
+		ioc->maxevents *= 2;
+	}
+
+	return res;
+}
+#endif
+
 /*! \brief
  * Grow the size of our arrays.  
  * \return 0 on success or -1 on failure
@@ -156,6 +377,12 @@ int *ast_io_add(struct io_context *ioc, int fd, ast_io_cb callback, short events
 
 	DEBUG(ast_debug(1, "ast_io_add()\n"));
 
+#ifdef IO_EPOLL
+	if (ioc->epfd > -1) {
+		return io_epoll_add(ioc, fd, callback, events, data);
+	}
+#endif
+
 	if (ioc->fdcnt >= ioc->maxfdcnt) {
 		/* 
 		 * We don't have enough space for this entry.  We need to
@@ -190,6 +417,12 @@ int *ast_io_add(struct io_context *ioc, int fd, ast_io_cb callback, short events
 
 int *ast_io_change(struct io_context *ioc, int *id, int fd, ast_io_cb callback, short events, void *data)
 {
+#ifdef IO_EPOLL
+	if (ioc->epfd > -1) {
+		return io_epoll_change(ioc, id, fd, callback, events, data);
+	}
+#endif
+
 	/* If this id exceeds our file descriptor count it doesn't exist here */
 	if (*id > ioc->fdcnt)
 		return NULL;
@@ -242,6 +475,12 @@ int ast_io_remove(struct io_context *ioc, int *_id)
 		return -1;
 	}
 
+#ifdef IO_EPOLL
+	if (ioc->epfd > -1) {
+		return io_epoll_remove(ioc, _id);
+	}
+#endif
+
 	for (x = 0; x < ioc->fdcnt; x++) {
 		if (ioc->ior[x].id == _id) {
 			/* Free the int immediately and set to NULL so we know it's unused now */
@@ -272,6 +511,12 @@ int ast_io_wait(struct io_context *ioc, int howlong)
 
 	DEBUG(ast_debug(1, "ast_io_wait()\n"));
 
+#ifdef IO_EPOLL
+	if (ioc->epfd > -1) {
+		return io_epoll_wait(ioc, howlong);
+	}
+#endif
+
 	if ((res = ast_poll(ioc->fds, ioc->fdcnt, howlong)) <= 0) {
 		return res;
 	}
@@ -307,6 +552,26 @@ void ast_io_dump(struct io_context *ioc)
 	 * the logger interface
 	 */
 	int x;
+#ifdef IO_EPOLL
+	struct io_epoll_rec *rec;
+
+	if (ioc->epfd > -1) {
+		ast_debug(1, "Asterisk IO Dump: %d entries, epoll\n", ioc->fdcnt);
+		ast_debug(1, "================================================\n");
+		ast_debug(1, "| ID    FD     Callback    Data        Events  |\n");
+		ast_debug(1, "+------+------+-----------+-----------+--------+\n");
+		AST_DLLIST_TRAVERSE(&ioc->recs, rec, list) {
+			ast_debug(1, "| %.4d | %.4d | %p | %p | %.6x |\n",
+					rec->id,
+					rec->fd,
+					rec->callback,
+					rec->data,
+					rec->events);
+		}
+		ast_debug(1, "================================================\n");
+		return;
+	}
+#endif
 
 	ast_debug(1, "Asterisk IO Dump: %d entries, %d max entries\n", ioc->fdcnt, ioc->maxfdcnt);
 	ast_debug(1, "================================================\n");
@@ -54,6 +54,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359261 $")
 #include <signal.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #ifdef HAVE_BKTR
 #include <execinfo.h>
@@ -65,6 +66,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359261 $")
 #endif
 
 static char dateformat[256] = "%b %e %T";		/* Original Asterisk Format */
+/*! Bumped whenever dateformat changes, so threads know to drop their cached date */
+static unsigned int dateformat_generation;
+/*! Set if dateformat prints fractions of a second, so a date is only good for one message */
+static int dateformat_subsecond;
 
 static char queue_log_name[256] = QUEUELOG;
 static char exec_after_rotate[256] = "";
@@ -88,6 +93,9 @@ static struct {
 
 static char hostname[MAXHOSTNAMELEN];
 
+/*! \brief Most lines a file channel collects before writing them out with one writev() */
+#define LOGCHANNEL_PENDING_MAX 64
+
 enum logtypes {
 	LOGTYPE_SYSLOG,
 	LOGTYPE_FILE,
@@ -113,6 +121,14 @@ struct logchannel {
 	AST_LIST_ENTRY(logchannel) list;
 	/*! Line number from configuration file */
 	int lineno;
+	/*! Messages written to this channel */
+	unsigned int written;
+	/*! Messages for this channel dropped because the logger queue was full */
+	volatile int dropped;
+	/*! Lines waiting to be written to the file, see logchannel_flush() */
+	struct iovec pending[LOGCHANNEL_PENDING_MAX];
+	/*! Number of lines in pending */
+	int npending;
 	/*! Components (levels) from last config load */
 	char components[0];
 };
@@ -136,14 +152,75 @@ struct logmsg {
 		AST_STRING_FIELD(message);
 		AST_STRING_FIELD(level_name);
 	);
-	AST_LIST_ENTRY(logmsg) list;
+	/*! The line as written to file channels, built by the logger thread when first needed */
+	char *fileline;
+	/*! Length of fileline */
+	int filelen;
+	/*! Next message in the queue, then in the logger thread's batch */
+	struct logmsg *volatile next;
 };
 
-static AST_LIST_HEAD_STATIC(logmsgs, logmsg);
+/*!
+ * \brief Messages waiting for the logger thread
+ *
+ * Any thread may push a message, only the logger thread pops them.  A push
+ * swaps the head atomically and then links the previous head to the new
+ * message, so ast_log() never waits for another logging thread.  The logger
+ * thread follows the links from the tail.  The stub message keeps the queue
+ * from ever running out of messages to link to.
+ */
+static struct {
+	/*! The message pushed last */
+	struct logmsg *volatile head;
+	/*! The message to pop next, only used by the logger thread */
+	struct logmsg *tail;
+	/*! Placeholder message, never logged */
+	struct logmsg stub;
+} logmsgs = {
+	.head = &logmsgs.stub,
+	.tail = &logmsgs.stub,
+};
+
+/*! Protects the sleep of the logger thread and of threads waiting for room in the queue */
+AST_MUTEX_DEFINE_STATIC(logmsgs_lock);
+/*! Number of messages pushed but not yet logged */
+static volatile int logmsgs_queued;
+/*! Number of messages dropped because the queue was full */
+static volatile int logmsgs_dropped;
+/*! Number of threads waiting for room in the queue */
+static volatile int logmsgs_waiters;
 static pthread_t logthread = AST_PTHREADT_NULL;
 static ast_cond_t logcond;
+/*! Signalled when the logger thread makes room in a full queue */
+static ast_cond_t logspace;
 static int close_logger_thread = 0;
 
+/*! \brief What ast_log() does when max_queued_messages are already waiting */
+static enum logger_overflow {
+	/*! Throw the message away and count it */
+	LOGGER_OVERFLOW_DROP,
+	/*! Wait, up to LOGGER_BLOCK_MAX_MS, for the logger thread to catch up */
+	LOGGER_OVERFLOW_BLOCK,
+} logger_overflow = LOGGER_OVERFLOW_DROP;
+
+/*! Longest a logging thread blocks for room in the queue before queueing anyway */
+#define LOGGER_BLOCK_MAX_MS 1000
+/*! Most messages the logger thread handles in one pass over the log channels */
+#define LOGGER_BATCH_MAX 256
+#define DEFAULT_FLUSH_SIZE 65536
+
+/*! Most messages waiting for the logger thread, 0 for no limit */
+static int logger_max_queued;
+/*! Write file channels out once this many bytes are waiting */
+static int logger_flush_size = DEFAULT_FLUSH_SIZE;
+/*! Longest, in milliseconds, the logger thread holds lines back once it runs out of messages */
+static int logger_flush_interval;
+
+#if !defined(HAVE_GCC_ATOMICS)
+/*! Serializes pushes on platforms without atomic exchange */
+AST_MUTEX_DEFINE_STATIC(logmsgs_push_lock);
+#endif
+
 static FILE *qlog;
 
 /*! \brief Logging channels used in the Asterisk logging system
@@ -209,8 +286,38 @@ AST_THREADSTORAGE(verbose_buf);
 AST_THREADSTORAGE(log_buf);
 #define LOG_BUF_INIT_SIZE       256
 
+/*! \brief The date a thread stamped its last message with */
+struct log_date {
+	/*! dateformat_generation the date was formatted for */
+	unsigned int generation;
+	/*! The second the date is for */
+	time_t sec;
+	char date[256];
+};
+
+AST_THREADSTORAGE(log_date_buf);
+
 static void logger_queue_init(void);
 
+/*! \brief Whether a date format prints fractions of a second (%q, %1q .. %6q) */
+static int dateformat_has_subsecond(const char *format)
+{
+	for (; *format; format++) {
+		if (*format != '%') {
+			continue;
+		}
+		if (*++format >= '1' && *format <= '6') {
+			format++;
+		}
+		if (*format == 'q') {
+			return 1;
+		} else if (!*format) {
+			break;
+		}
+	}
+	return 0;
+}
+
 static unsigned int make_components(const char *s, int lineno, int *verbosity)
 {
 	char *w;
@@ -377,6 +484,37 @@ static void init_logger_chain(int locked, const char *altconf)
 		ast_copy_string(dateformat, s, sizeof(dateformat));
 	else
 		ast_copy_string(dateformat, "%b %e %T", sizeof(dateformat));
+	dateformat_subsecond = dateformat_has_subsecond(dateformat);
+	dateformat_generation++;
+	logger_max_queued = 0;
+	if ((s = ast_variable_retrieve(cfg, "general", "max_queued_messages"))) {
+		if (sscanf(s, "%30d", &logger_max_queued) != 1 || logger_max_queued < 0) {
+			fprintf(stderr, "Invalid max_queued_messages '%s', the logger queue is not limited\n", s);
+			logger_max_queued = 0;
+		}
+	}
+	logger_overflow = LOGGER_OVERFLOW_DROP;
+	if ((s = ast_variable_retrieve(cfg, "general", "overflow"))) {
+		if (!strcasecmp(s, "block")) {
+			logger_overflow = LOGGER_OVERFLOW_BLOCK;
+		} else if (strcasecmp(s, "drop")) {
+			fprintf(stderr, "Unknown overflow: %s\n", s);
+		}
+	}
+	logger_flush_size = DEFAULT_FLUSH_SIZE;
+	if ((s = ast_variable_retrieve(cfg, "general", "flush_size"))) {
+		if (sscanf(s, "%30d", &logger_flush_size) != 1 || logger_flush_size < 0) {
+			fprintf(stderr, "Invalid flush_size '%s', using %d\n", s, DEFAULT_FLUSH_SIZE);
+			logger_flush_size = DEFAULT_FLUSH_SIZE;
+		}
+	}
+	logger_flush_interval = 0;
+	if ((s = ast_variable_retrieve(cfg, "general", "flush_interval"))) {
+		if (sscanf(s, "%30d", &logger_flush_interval) != 1 || logger_flush_interval < 0) {
+			fprintf(stderr, "Invalid flush_interval '%s', lines are written as soon as the logger is idle\n", s);
+			logger_flush_interval = 0;
+		}
+	}
 	if ((s = ast_variable_retrieve(cfg, "general", "queue_log"))) {
 		logfiles.queue_log = ast_true(s);
 	}
@@ -735,6 +873,66 @@ static int logger_queue_restart(int queue_rotate)
 	return res;
 }
 
+/*!
+ * \internal
+ * \brief Write out the lines a file channel has collected.
+ *
+ * \note Assumes logchannels is locked on entry.  Only the logger thread adds
+ * lines, and it holds the lock from adding a line until the message is freed,
+ * so a write lock is needed from any other thread.
+ */
+static void logchannel_flush(struct logchannel *chan)
+{
+	struct iovec *iov = chan->pending;
+	int iovcnt = chan->npending;
+	ssize_t res;
+
+	while (iovcnt && chan->fileptr && !chan->disabled) {
+		if ((res = writev(fileno(chan->fileptr), iov, iovcnt)) <= 0) {
+			if (res < 0 && errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "**** Asterisk Logging Error: ***********\n");
+			if (errno == ENOMEM || errno == ENOSPC) {
+				fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
+			} else {
+				fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+			}
+			manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
+			chan->disabled = 1;
+			break;
+		}
+		/* Skip over what was written, a short write can end mid-line */
+		while (iovcnt && (size_t) res >= iov->iov_len) {
+			res -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+	chan->npending = 0;
+}
+
+/*!
+ * \internal
+ * \brief Write out every file channel.
+ *
+ * \note Assumes logchannels is locked on entry.
+ */
+static void logchannels_flush(void)
+{
+	struct logchannel *chan;
+
+	AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->npending) {
+			logchannel_flush(chan);
+		}
+	}
+}
+
 static int reload_logger(int rotate, const char *altconf)
 {
 	int queue_rotate = rotate;
@@ -762,6 +960,9 @@ static int reload_logger(int rotate, const char *altconf)
 
 	ast_mkdir(ast_config_AST_LOG_DIR, 0777);
 
+	/* Lines still held by the logger thread go to the old files */
+	logchannels_flush();
+
 	AST_RWLIST_TRAVERSE(&logchannels, f, list) {
 		if (f->disabled) {
 			f->disabled = 0;	/* Re-enable logging at reload */
@@ -892,20 +1093,39 @@ static char *handle_logger_set_level(struct ast_cli_entry *e, int cmd, struct as
 static char *handle_logger_show_channels(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 #define FORMATL	"%-35.35s %-8.8s %-9.9s "
+#define FORMATC	"%10s %10s %7s "
+#define FORMATCD	"%10u %10d %7d "
 	struct logchannel *chan;
 	switch (cmd) {
 	case CLI_INIT:
 		e->command = "logger show channels";
 		e->usage = 
 			"Usage: logger show channels\n"
-			"       List configured logger channels.\n";
+			"       List configured logger channels, with the messages each\n"
+			"       has written, has dropped because the logger queue was full,\n"
+			"       and is holding back to write out in one go.\n";
 		return NULL;
 	case CLI_GENERATE:
 		return NULL;	
 	}
+	ast_cli(a->fd, "Logger queue: %d queued, %d dropped, ", logmsgs_queued, logmsgs_dropped);
+	if (logger_max_queued) {
+		ast_cli(a->fd, "limit %d (%s when full)\n", logger_max_queued,
+			logger_overflow == LOGGER_OVERFLOW_BLOCK ? "block" : "drop");
+	} else {
+		ast_cli(a->fd, "no limit\n");
+	}
+	ast_cli(a->fd, "Flushing every %d bytes, ", logger_flush_size);
+	if (logger_flush_interval) {
+		ast_cli(a->fd, "or after %d ms\n\n", logger_flush_interval);
+	} else {
+		ast_cli(a->fd, "or when idle\n\n");
+	}
 	ast_cli(a->fd, FORMATL, "Channel", "Type", "Status");
+	ast_cli(a->fd, FORMATC, "Written", "Dropped", "Queued");
 	ast_cli(a->fd, "Configuration\n");
 	ast_cli(a->fd, FORMATL, "-------", "----", "------");
+	ast_cli(a->fd, FORMATC, "-------", "-------", "------");
 	ast_cli(a->fd, "-------------\n");
 	AST_RWLIST_RDLOCK(&logchannels);
 	AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
@@ -913,6 +1133,7 @@ static char *handle_logger_show_channels(struct ast_cli_entry *e, int cmd, struc
 
 		ast_cli(a->fd, FORMATL, chan->filename, chan->type == LOGTYPE_CONSOLE ? "Console" : (chan->type == LOGTYPE_SYSLOG ? "Syslog" : "File"),
 			chan->disabled ? "Disabled" : "Enabled");
+		ast_cli(a->fd, FORMATCD, chan->written, chan->dropped, chan->npending);
 		ast_cli(a->fd, " - ");
 		for (level = 0; level < ARRAY_LEN(levels); level++) {
 			if ((chan->logmask & (1 << level)) && levels[level]) {
@@ -976,7 +1197,38 @@ static void ast_log_vsyslog(struct logmsg *msg)
 #define VERBOSE_MAGIC2LEVEL(x) (((char) -*(signed char *) (x)) - 1)
 #define VERBOSE_HASMAGIC(x)	(*(signed char *) (x) < 0)
 
-/*! \brief Print a normal log message to the channels */
+/*! \brief Build the line file channels log a message as */
+static int logmsg_fileline(struct logmsg *logmsg)
+{
+	char buf[BUFSIZ];
+
+	if (!logmsg->fileline) {
+		logmsg->filelen = ast_asprintf(&logmsg->fileline, "[%s] %s[%d] %s: %s",
+			logmsg->date, logmsg->level_name, logmsg->lwp, logmsg->file,
+			term_strip(buf, logmsg->message, sizeof(buf)));
+		if (logmsg->filelen < 0) {
+			logmsg->fileline = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void logmsg_free(struct logmsg *logmsg)
+{
+	ast_free(logmsg->fileline);
+	ast_string_field_free_memory(logmsg);
+	ast_free(logmsg);
+}
+
+/*!
+ * \brief Print a normal log message to the channels
+ *
+ * Lines for file channels are only collected, logchannel_flush() writes them
+ * out.  The message must stay allocated until then.
+ *
+ * \note Assumes logchannels is read locked on entry.
+ */
 static void logger_print_normal(struct logmsg *logmsg)
 {
 	struct logchannel *chan = NULL;
@@ -995,8 +1247,6 @@ static void logger_print_normal(struct logmsg *logmsg)
 		ast_string_field_set(logmsg, message, tmpmsg);
 	}
 
-	AST_RWLIST_RDLOCK(&logchannels);
-
 	if (!AST_RWLIST_EMPTY(&logchannels)) {
 		AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
 			/* If the channel is disabled, then move on to the next one */
@@ -1010,6 +1260,7 @@ static void logger_print_normal(struct logmsg *logmsg)
 			/* Check syslog channels */
 			if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << logmsg->level))) {
 				ast_log_vsyslog(logmsg);
+				chan->written++;
 			/* Console channels */
 			} else if (chan->type == LOGTYPE_CONSOLE && (chan->logmask & (1 << logmsg->level))) {
 				char linestr[128];
@@ -1032,79 +1283,251 @@ static void logger_print_normal(struct logmsg *logmsg)
 					 logmsg->message);
 				/* Print out */
 				ast_console_puts_mutable(buf, logmsg->level);
+				chan->written++;
 			/* File channels */
 			} else if (chan->type == LOGTYPE_FILE && (chan->logmask & (1 << logmsg->level))) {
-				int res = 0;
-
 				/* If no file pointer exists, skip it */
 				if (!chan->fileptr) {
 					continue;
 				}
 
-				/* Print out to the file */
-				res = fprintf(chan->fileptr, "[%s] %s[%d] %s: %s",
-					      logmsg->date, logmsg->level_name, logmsg->lwp, logmsg->file, term_strip(buf, logmsg->message, BUFSIZ));
-				if (res <= 0 && !ast_strlen_zero(logmsg->message)) {
-					fprintf(stderr, "**** Asterisk Logging Error: ***********\n");
-					if (errno == ENOMEM || errno == ENOSPC)
-						fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
-					else
-						fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
-					manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
-					chan->disabled = 1;
-				} else if (res > 0) {
-					fflush(chan->fileptr);
+				if (logmsg_fileline(logmsg)) {
+					continue;
+				}
+				if (chan->npending == LOGCHANNEL_PENDING_MAX) {
+					logchannel_flush(chan);
 				}
+				chan->pending[chan->npending].iov_base = logmsg->fileline;
+				chan->pending[chan->npending].iov_len = logmsg->filelen;
+				chan->npending++;
+				chan->written++;
 			}
 		}
 	} else if (logmsg->level != __LOG_VERBOSE) {
 		fputs(logmsg->message, stdout);
 	}
+}
 
+/*! \brief Log a message right away, for when there is no logger thread */
+static void logger_print_now(struct logmsg *logmsg)
+{
+	AST_RWLIST_RDLOCK(&logchannels);
+	logger_print_normal(logmsg);
+	logchannels_flush();
 	AST_RWLIST_UNLOCK(&logchannels);
 
+	logmsg_free(logmsg);
+
 	/* If we need to reload because of the file size, then do so */
 	if (filesize_reload_needed) {
 		reload_logger(-1, NULL);
 		ast_verb(1, "Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
 	}
+}
 
-	return;
+/* append a message to the queue, safe to call from any number of threads at once */
+static void logmsg_queue_push(struct logmsg *logmsg)
+{
+	struct logmsg *prev;
+
+	logmsg->next = NULL;
+#if defined(HAVE_GCC_ATOMICS)
+	/* The NULL next must be visible before the message can be reached */
+	__sync_synchronize();
+	prev = __sync_lock_test_and_set(&logmsgs.head, logmsg);
+	prev->next = logmsg;
+#else
+	ast_mutex_lock(&logmsgs_push_lock);
+	prev = logmsgs.head;
+	logmsgs.head = logmsg;
+	prev->next = logmsg;
+	ast_mutex_unlock(&logmsgs_push_lock);
+#endif
+}
+
+/* the message pushed last */
+static struct logmsg *logmsg_queue_head(void)
+{
+#if defined(HAVE_GCC_ATOMICS)
+	__sync_synchronize();
+	return logmsgs.head;
+#else
+	struct logmsg *head;
+
+	ast_mutex_lock(&logmsgs_push_lock);
+	head = logmsgs.head;
+	ast_mutex_unlock(&logmsgs_push_lock);
+	return head;
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Remove the oldest message from the queue
+ *
+ * \note Only the logger thread may call this.
+ *
+ * \return The message, or NULL if the queue is empty or the message at the
+ * front is still being linked in by logmsg_queue_push().
+ */
+static struct logmsg *logmsg_queue_pop(void)
+{
+	struct logmsg *tail = logmsgs.tail;
+	struct logmsg *next = tail->next;
+
+	if (tail == &logmsgs.stub) {
+		if (!next) {
+			return NULL;
+		}
+		logmsgs.tail = next;
+		tail = next;
+		next = next->next;
+	}
+	if (next) {
+		logmsgs.tail = next;
+		return tail;
+	}
+	if (tail != logmsg_queue_head()) {
+		/* A push is half done */
+		return NULL;
+	}
+	/* tail is the last message, put the stub behind it so it can be removed */
+	logmsg_queue_push(&logmsgs.stub);
+	if ((next = tail->next)) {
+		logmsgs.tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Apply the overflow policy when the queue is full.
+ *
+ * \retval 0 queue the message
+ * \retval -1 drop the message
+ */
+static int logger_queue_full(int level)
+{
+	struct timeval start;
+	struct logchannel *chan;
+
+	/* The logger thread itself must never wait for room */
+	if (logger_overflow == LOGGER_OVERFLOW_BLOCK && !pthread_equal(pthread_self(), logthread)) {
+		start = ast_tvnow();
+		ast_mutex_lock(&logmsgs_lock);
+		ast_atomic_fetchadd_int(&logmsgs_waiters, 1);
+		while (logmsgs_queued >= logger_max_queued && !close_logger_thread) {
+			struct timeval wait = ast_tvadd(ast_tvnow(), ast_samp2tv(100, 1000));
+			struct timespec ts = { .tv_sec = wait.tv_sec, .tv_nsec = wait.tv_usec * 1000 };
+
+			/* Whoever logs while holding a lock the logger thread needs must not
+			 * wait forever, the message is queued anyway after a while */
+			if (ast_tvdiff_ms(ast_tvnow(), start) >= LOGGER_BLOCK_MAX_MS) {
+				break;
+			}
+			ast_cond_timedwait(&logspace, &logmsgs_lock, &ts);
+		}
+		ast_atomic_fetchadd_int(&logmsgs_waiters, -1);
+		ast_mutex_unlock(&logmsgs_lock);
+		return 0;
+	}
+
+	ast_atomic_fetchadd_int(&logmsgs_dropped, 1);
+	AST_RWLIST_RDLOCK(&logchannels);
+	AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->logmask & (1 << level)) {
+			ast_atomic_fetchadd_int(&chan->dropped, 1);
+		}
+	}
+	AST_RWLIST_UNLOCK(&logchannels);
+	return -1;
 }
 
 /*! \brief Actual logging thread */
 static void *logger_thread(void *data)
 {
-	struct logmsg *next = NULL, *msg = NULL;
+	struct logmsg *msg, *batch = NULL, **batch_tail = &batch;
+	struct timeval deadline = { 0, };
+	int batch_bytes = 0;
+	int processed;
+	int flush = 0;
 
 	for (;;) {
-		/* We lock the message list, and see if any message exists... if not we wait on the condition to be signalled */
-		AST_LIST_LOCK(&logmsgs);
-		if (AST_LIST_EMPTY(&logmsgs)) {
-			if (close_logger_thread) {
-				break;
+		/* Wait for messages, or until collected lines are due to be written */
+		ast_mutex_lock(&logmsgs_lock);
+		while (!logmsgs_queued && !close_logger_thread && !flush) {
+			if (!batch) {
+				ast_cond_wait(&logcond, &logmsgs_lock);
+			} else if (ast_tvdiff_ms(deadline, ast_tvnow()) > 0) {
+				struct timespec ts = { .tv_sec = deadline.tv_sec, .tv_nsec = deadline.tv_usec * 1000 };
+
+				ast_cond_timedwait(&logcond, &logmsgs_lock, &ts);
 			} else {
-				ast_cond_wait(&logcond, &logmsgs.lock);
+				flush = 1;
 			}
 		}
-		next = AST_LIST_FIRST(&logmsgs);
-		AST_LIST_HEAD_INIT_NOLOCK(&logmsgs);
-		AST_LIST_UNLOCK(&logmsgs);
-
-		/* Otherwise go through and process each message in the order added */
-		while ((msg = next)) {
-			/* Get the next entry now so that we can free our current structure later */
-			next = AST_LIST_NEXT(msg, list);
+		ast_mutex_unlock(&logmsgs_lock);
 
-			/* Depending on the type, send it to the proper function */
+		AST_RWLIST_RDLOCK(&logchannels);
+		for (processed = 0; processed < LOGGER_BATCH_MAX && (msg = logmsg_queue_pop()); processed++) {
 			logger_print_normal(msg);
+			ast_atomic_fetchadd_int(&logmsgs_queued, -1);
 
-			/* Free the data since we are done */
-			ast_free(msg);
+			if (!msg->fileline) {
+				/* No file channel holds on to it */
+				logmsg_free(msg);
+				continue;
+			}
+			if (!batch) {
+				deadline = ast_tvadd(ast_tvnow(), ast_samp2tv(logger_flush_interval, 1000));
+			}
+			msg->next = NULL;
+			*batch_tail = msg;
+			batch_tail = (struct logmsg **) &msg->next;
+			if ((batch_bytes += msg->filelen) >= logger_flush_size) {
+				flush = 1;
+				break;
+			}
+		}
+		if (!logmsgs_queued && !logger_flush_interval) {
+			/* Idle, write out whatever has been collected */
+			flush = 1;
+		}
+		if (flush || close_logger_thread) {
+			logchannels_flush();
+		}
+		AST_RWLIST_UNLOCK(&logchannels);
+
+		if (flush || close_logger_thread) {
+			while ((msg = batch)) {
+				batch = msg->next;
+				logmsg_free(msg);
+			}
+			batch_tail = &batch;
+			batch_bytes = 0;
+			flush = 0;
+		}
+
+		if (logmsgs_waiters) {
+			ast_mutex_lock(&logmsgs_lock);
+			ast_cond_broadcast(&logspace);
+			ast_mutex_unlock(&logmsgs_lock);
+		}
+
+		/* If we need to reload because of the file size, then do so */
+		if (filesize_reload_needed) {
+			reload_logger(-1, NULL);
+			ast_verb(1, "Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
+		}
+
+		if (!processed && logmsgs_queued) {
+			/* A push is half done, give it a moment to finish */
+			sched_yield();
 		}
 
 		/* If we should stop, then stop */
-		if (close_logger_thread)
+		if (close_logger_thread && !logmsgs_queued)
 			break;
 	}
 
@@ -1150,8 +1573,10 @@ int init_logger(void)
 
 	/* start logger thread */
 	ast_cond_init(&logcond, NULL);
+	ast_cond_init(&logspace, NULL);
 	if (ast_pthread_create(&logthread, NULL, logger_thread, NULL) < 0) {
 		ast_cond_destroy(&logcond);
+		ast_cond_destroy(&logspace);
 		return -1;
 	}
 
@@ -1174,10 +1599,11 @@ void close_logger(void)
 	logger_initialized = 0;
 
 	/* Stop logger thread */
-	AST_LIST_LOCK(&logmsgs);
+	ast_mutex_lock(&logmsgs_lock);
 	close_logger_thread = 1;
 	ast_cond_signal(&logcond);
-	AST_LIST_UNLOCK(&logmsgs);
+	ast_cond_broadcast(&logspace);
+	ast_mutex_unlock(&logmsgs_lock);
 
 	if (logthread != AST_PTHREADT_NULL)
 		pthread_join(logthread, NULL);
@@ -1212,9 +1638,9 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	struct ast_str *buf = NULL;
 	struct ast_tm tm;
 	struct timeval now = ast_tvnow();
+	struct log_date *date;
 	int res = 0;
 	va_list ap;
-	char datestring[256];
 
 	if (!(buf = ast_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE)))
 		return;
@@ -1239,6 +1665,12 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	if (level != __LOG_VERBOSE && !(global_logmask & (1 << level)))
 		return;
 
+	/* Back off before doing any work if the logger thread is falling behind */
+	if (logger_max_queued && logmsgs_queued >= logger_max_queued
+		&& logthread != AST_PTHREADT_NULL && logger_queue_full(level)) {
+		return;
+	}
+
 	/* Build string */
 	va_start(ap, fmt);
 	res = ast_str_set_va(&buf, BUFSIZ, fmt, ap);
@@ -1262,10 +1694,18 @@ void ast_log(int level, const char *file, int line, const char *function, const
 		logmsg->type = LOGMSG_NORMAL;
 	}
 
-	/* Create our date/time */
-	ast_localtime(&now, &tm, NULL);
-	ast_strftime(datestring, sizeof(datestring), dateformat, &tm);
-	ast_string_field_set(logmsg, date, datestring);
+	/* Create our date/time, formatting it only once a second per thread */
+	if (!(date = ast_threadstorage_get(&log_date_buf, sizeof(*date)))) {
+		logmsg_free(logmsg);
+		return;
+	}
+	if (dateformat_subsecond || date->generation != dateformat_generation || date->sec != now.tv_sec) {
+		ast_localtime(&now, &tm, NULL);
+		ast_strftime(date->date, sizeof(date->date), dateformat, &tm);
+		date->generation = dateformat_generation;
+		date->sec = now.tv_sec;
+	}
+	ast_string_field_set(logmsg, date, date->date);
 
 	/* Copy over data */
 	logmsg->level = level;
@@ -1275,15 +1715,17 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	ast_string_field_set(logmsg, function, function);
 	logmsg->lwp = ast_get_tid();
 
-	/* If the logger thread is active, append it to the tail end of the list - otherwise skip that step */
+	/* If the logger thread is active, queue the message for it - otherwise print it here */
 	if (logthread != AST_PTHREADT_NULL) {
-		AST_LIST_LOCK(&logmsgs);
-		AST_LIST_INSERT_TAIL(&logmsgs, logmsg, list);
-		ast_cond_signal(&logcond);
-		AST_LIST_UNLOCK(&logmsgs);
+		logmsg_queue_push(logmsg);
+		if (!ast_atomic_fetchadd_int(&logmsgs_queued, 1)) {
+			/* The logger thread may be asleep */
+			ast_mutex_lock(&logmsgs_lock);
+			ast_cond_signal(&logcond);
+			ast_mutex_unlock(&logmsgs_lock);
+		}
 	} else {
-		logger_print_normal(logmsg);
-		ast_free(logmsg);
+		logger_print_now(logmsg);
 	}
 
 	return;
@@ -82,6 +82,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 #include "asterisk/security_events.h"
 #include "asterisk/aoc.h"
 #include "asterisk/stringfields.h"
+#include "asterisk/test.h"
 
 /*** DOCUMENTATION
 	<manager name="Ping" language="en_US">
@@ -145,6 +146,24 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 			<parameter name="Secret">
 				<para>Secret to login with as specified in manager.conf.</para>
 			</parameter>
+			<parameter name="Encoding">
+				<para>How events are sent to this session. Valid values are:</para>
+				<enumlist>
+					<enum name="text">
+						<para>As lines of text, the default.</para>
+					</enum>
+					<enum name="compact">
+						<para>Each event as a frame of a NUL byte, the 32 bit length of the rest
+						of the frame in network byte order, and the headers of the event.  Each
+						header is a byte with its id, then for id 0 a byte with the length of its
+						name and its name, and then its value preceded by its 16 bit length in network
+						byte order.  The names of ids 1 and up are listed, comma separated, in the
+						<literal>CompactHeaders</literal> header of the response.  Only available on
+						AMI sockets; responses to actions, including the events listing their results,
+						are still sent as text.</para>
+					</enum>
+				</enumlist>
+			</parameter>
 		</syntax>
 		<description>
 			<para>Login Manager.</para>
@@ -866,6 +885,41 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 			filters defined in manager.conf</para>
 		</description>
 	</manager>
+	<manager name="Subscribe" language="en_US">
+		<synopsis>
+			Subscribe the current manager session to events.
+		</synopsis>
+		<syntax>
+			<xi:include xpointer="xpointer(/docs/manager[@name='Login']/syntax/parameter[@name='ActionID'])" />
+			<parameter name="Operation">
+				<enumlist>
+					<enum name="Add">
+						<para>Add a subscription, the default.</para>
+					</enum>
+					<enum name="Clear">
+						<para>Remove every subscription.</para>
+					</enum>
+				</enumlist>
+			</parameter>
+			<parameter name="Events">
+				<para>Comma separated names of the events subscribed to.  All events if not given.</para>
+			</parameter>
+			<parameter name="Match">
+				<para>A header the events must have, as <literal>Header: value</literal>.  A value
+				ending in <literal>*</literal> matches any value starting with the rest.  May be
+				given more than once; events must have all of them.</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>Once a session has subscriptions it is only sent the events matching one of
+			them, which is checked before any event filter.  Subscriptions narrow down the
+			events a session may read, so they need no permission.  Combined with the compact
+			encoding of Login, they keep clients from receiving and parsing events they do not
+			use.</para>
+			<para>Example: <literal>Events: Newchannel,Hangup</literal> and
+			<literal>Match: Channel: SIP/1*</literal></para>
+		</description>
+	</manager>
 	<manager name="FilterList" language="en_US">
 		<synopsis>
 			Show current event filters for this session
@@ -898,34 +952,118 @@ enum add_filter_result {
 };
 
 /*!
- * Linked list of events.
- * Global events are appended to the list by append_event().
- * The usecount is the number of stored pointers to the element,
- * excluding the list pointers. So an element that is only in
- * the list has a usecount of 0, not 1.
+ * Ring of events.
+ * Global events are formatted once and written to the ring by
+ * append_event(). Each client reads them from its own position
+ * in the ring, so events need no reference counting and are never
+ * freed: the ring is simply written over.
  *
- * Clients have a pointer to the last event processed, and for each
- * of these clients we track the usecount of the elements.
- * If we have a pointer to an entry in the list, it is safe to navigate
- * it forward because elements will not be deleted, but only appended.
- * The worst that can happen is seeing the pointer still NULL.
+ * Nothing is locked. A writer claims the bytes of its event by moving
+ * the head of the ring forward atomically, copies the event in, and then
+ * marks it complete by storing its position in the event header.
+ * A client reads the event at its position once the header holds that
+ * position, and checks afterwards that the head did not move a whole
+ * ring past the event while it was copied out. A client left that far
+ * behind has lost events; it is moved to the head of the ring.
  *
- * When the usecount of an element drops to 0, and the element is the
- * first in the list, we can remove it. Removal is done within the
- * main thread, which is woken up for the purpose.
- *
- * For simplicity of implementation, we make sure the list is never empty.
+ * Positions only grow, wrapping at 2^32, and index the ring modulo
+ * its size, which is a power of two.
  */
-struct eventqent {
-	int usecount;		/*!< # of clients who still need the event */
+struct event_ring {
+	char *buf;
+	unsigned int size;	/*!< size of buf, a power of two */
+	volatile int head;	/*!< position the next event is written at */
+};
+
+/*! \brief Header of an event in the ring, followed by the event text */
+struct event_ring_hdr {
+	volatile unsigned int pos;	/*!< position of the event, set once it is complete */
+	unsigned int len;	/*!< bytes the event takes in the ring, header included */
+	unsigned int datalen;	/*!< length of the event text */
+	unsigned int compactlen;	/*!< length of the compact encoding after the text, 0 if not encoded */
 	int category;
-	unsigned int seq;	/*!< sequence number */
-	struct timeval tv;  /*!< When event was allocated */
-	AST_RWLIST_ENTRY(eventqent) eq_next;
-	char eventdata[1];	/*!< really variable size, allocated by append_event() */
 };
 
-static AST_RWLIST_HEAD_STATIC(all_events, eventqent);
+/*!
+ * Events are aligned to a power of two no smaller than their header,
+ * so headers never wrap
+ */
+#define EVENT_RING_ALIGN	32
+
+/*! Default size of the event ring in kB */
+#define DEFAULT_EVENTQUEUESIZE	4096
+/*! Largest event ring in kB.  Positions in the ring must stay far from wrapping around. */
+#define MAX_EVENTQUEUESIZE	(1024 * 1024)
+
+static struct event_ring event_ring;
+static int loaded_eventqueuesize;	/*!< eventqueuesize the event ring was allocated with */
+/*! Sessions using the compact encoding.  While there are any, events are encoded once as they are queued. */
+static int compact_sessions;
+
+#if defined(HAVE_GCC_ATOMICS)
+#define event_ring_barrier() __sync_synchronize()
+#else
+AST_MUTEX_DEFINE_STATIC(event_ring_barrier_lock);
+
+/* taking a lock is a full memory barrier */
+static void event_ring_barrier(void)
+{
+	ast_mutex_lock(&event_ring_barrier_lock);
+	ast_mutex_unlock(&event_ring_barrier_lock);
+}
+#endif
+
+/*! \brief A compiled event filter */
+struct event_filter {
+	int is_regex;		/*!< whether regex is used, or literal searched for */
+	regex_t regex;
+	char literal[0];
+};
+
+#define SUBSCRIPTION_MAX_EVENTS		32
+#define SUBSCRIPTION_MAX_MATCHES	8
+
+/*! \brief A header an event must have to match a subscription */
+struct subscription_match {
+	const char *header;
+	size_t headerlen;
+	const char *value;
+	size_t valuelen;
+	int prefix;		/*!< the value is a prefix, it was given ending with '*' */
+};
+
+/*! \brief Events a session subscribed to with the Subscribe action */
+struct event_subscription {
+	AST_LIST_ENTRY(event_subscription) list;
+	int nevents;		/*!< number of events, 0 for any event */
+	int nmatches;
+	const char *events[SUBSCRIPTION_MAX_EVENTS];
+	struct subscription_match matches[SUBSCRIPTION_MAX_MATCHES];
+	char data[0];		/*!< the strings pointed to */
+};
+
+/*!
+ * \brief Header names with an id in the compact event encoding
+ *
+ * The id of a name is its index plus one.  Clients are given the list at
+ * Login, but only ever append to it all the same.
+ */
+static const char * const compact_headers[] = {
+	"Event", "Privilege", "Channel", "Uniqueid", "ChannelState", "ChannelStateDesc",
+	"CallerIDNum", "CallerIDName", "ConnectedLineNum", "ConnectedLineName", "AccountCode",
+	"Context", "Exten", "Priority", "Application", "AppData", "Cause", "Cause-txt",
+	"Variable", "Value", "Channel1", "Channel2", "Uniqueid1", "Uniqueid2", "Bridgestate",
+	"Bridgetype", "Digit", "Direction", "Begin", "End", "Queue", "Interface", "MemberName",
+	"Status", "Paused", "Position", "Count", "Peer", "PeerStatus", "ChannelType", "Address",
+	"Mailbox", "Waiting", "New", "Old", "Device", "State", "Hint", "UserEvent", "Timestamp",
+	"SequenceNumber", "File", "Line", "Func",
+};
+
+/*! \brief Ids of compact_headers by hash of the name, 0 for none */
+static unsigned char compact_header_ids[256];
+
+/*! \brief compact_headers, comma separated, for the Login response */
+static char compact_header_list[1024];
 
 static int displayconnects = 1;
 static int allowmultiplelogin = 1;
@@ -1019,7 +1157,7 @@ struct mansession_session {
 	struct ao2_container *whitefilters;	/*!< Manager event filters - white list */
 	struct ao2_container *blackfilters;	/*!< Manager event filters - black list */
 	int send_events;	/*!<  XXX what ? */
-	struct eventqent *last_ev;	/*!< last event processed. */
+	unsigned int event_pos;	/*!< position of the next event to process in the event ring */
 	int writetimeout;	/*!< Timeout for ast_carefulwrite() */
 	time_t authstart;
 	int pending_event;         /*!< Pending events indicator in case when waiting_thread is NULL */
@@ -1027,6 +1165,8 @@ struct mansession_session {
 	unsigned long oldnonce;	/*!< Stale nonce value */
 	unsigned long nc;	/*!< incremental  nonce counter */
 	AST_LIST_HEAD_NOLOCK(mansession_datastores, ast_datastore) datastores; /*!< Data stores on the session */
+	int compact;		/*!< Events are sent in the compact encoding */
+	AST_LIST_HEAD_NOLOCK(, event_subscription) subscriptions; /*!< Events subscribed to, none for all events */
 	AST_LIST_ENTRY(mansession_session) list;
 };
 
@@ -1139,56 +1279,183 @@ int check_webmanager_enabled(void)
 	return (webmanager_enabled && manager_enabled);
 }
 
+/*! \brief Allocate an event ring of at least size bytes, up to MAX_EVENTQUEUESIZE kB */
+static int event_ring_init(struct event_ring *ring, size_t size)
+{
+	size_t bytes = EVENT_RING_ALIGN * 32;
+
+	if (size > (size_t) MAX_EVENTQUEUESIZE * 1024) {
+		return -1;
+	}
+	while (bytes < size) {
+		bytes <<= 1;
+	}
+	if (!(ring->buf = ast_calloc(1, bytes))) {
+		return -1;
+	}
+	ring->size = bytes;
+	/* Start a lap in, so no header of the zeroed ring holds its position */
+	ring->head = bytes;
+
+	return 0;
+}
+
+/*! \brief The position of the next event written to the ring */
+static unsigned int event_ring_head(struct event_ring *ring)
+{
+	event_ring_barrier();
+	return ring->head;
+}
+
+static void event_ring_copy_in(struct event_ring *ring, unsigned int pos, const char *data, unsigned int len)
+{
+	unsigned int offset = pos & (ring->size - 1);
+	unsigned int first = MIN(len, ring->size - offset);
+
+	memcpy(ring->buf + offset, data, first);
+	memcpy(ring->buf, data + first, len - first);
+}
+
+static void event_ring_copy_out(struct event_ring *ring, unsigned int pos, char *data, unsigned int len)
+{
+	unsigned int offset = pos & (ring->size - 1);
+	unsigned int first = MIN(len, ring->size - offset);
+
+	memcpy(data, ring->buf + offset, first);
+	memcpy(data + first, ring->buf, len - first);
+}
+
 /*!
- * Grab a reference to the last event, update usecount as needed.
- * Can handle a NULL pointer.
+ * \brief Write an event to the ring
+ * \param ring the event ring
+ * \param str the event text
+ * \param compact the event in the compact encoding, or NULL
+ * \param compactlen the length of compact
+ * \param category the category of the event
+ * \note Safe to call from any number of threads at once.
+ * \retval 0 success
+ * \retval -1 the event does not fit the ring
  */
-static struct eventqent *grab_last(void)
+static int event_ring_write(struct event_ring *ring, const char *str, const char *compact, unsigned int compactlen, int category)
 {
-	struct eventqent *ret;
+	struct event_ring_hdr *hdr;
+	unsigned int datalen = strlen(str);
+	unsigned int len;
+	unsigned int pos;
 
-	AST_RWLIST_WRLOCK(&all_events);
-	ret = AST_RWLIST_LAST(&all_events);
-	/* the list is never empty now, but may become so when
-	 * we optimize it in the future, so be prepared.
-	 */
-	if (ret) {
-		ast_atomic_fetchadd_int(&ret->usecount, 1);
+	if (!compact) {
+		compactlen = 0;
 	}
-	AST_RWLIST_UNLOCK(&all_events);
-	return ret;
+	len = (sizeof(*hdr) + datalen + compactlen + EVENT_RING_ALIGN - 1) & ~(EVENT_RING_ALIGN - 1);
+
+	if (len > ring->size / 2) {
+		return -1;
+	}
+
+	pos = ast_atomic_fetchadd_int(&ring->head, len);
+	hdr = (struct event_ring_hdr *) (ring->buf + (pos & (ring->size - 1)));
+	hdr->len = len;
+	hdr->datalen = datalen;
+	hdr->compactlen = compactlen;
+	hdr->category = category;
+	event_ring_copy_in(ring, pos + sizeof(*hdr), str, datalen);
+	event_ring_copy_in(ring, pos + sizeof(*hdr) + datalen, compact, compactlen);
+
+	/* Everything must be in place before the event is marked complete */
+	event_ring_barrier();
+	hdr->pos = pos;
+
+	return 0;
 }
 
 /*!
- * Purge unused events. Remove elements from the head
- * as long as their usecount is 0 and there is a next element.
+ * \brief Read the event at a position in the ring
+ *
+ * \param ring the event ring
+ * \param pos position to read at, moved past the event read
+ * \param buf the event text is read into this buffer
+ * \param category the category of the event read
+ * \param compactlen if not NULL, the compact encoding of the event is read into
+ *        buf after the terminating NUL of the text, and its length stored here,
+ *        0 if the event was queued without it
+ *
+ * \retval 1 an event was read
+ * \retval 0 there is no complete event at the position yet
+ * \retval -1 the event at the position was written over, pos is moved to the head
  */
-static void purge_events(void)
+static int event_ring_read(struct event_ring *ring, unsigned int *pos, struct ast_str **buf, int *category, size_t *compactlen)
 {
-	struct eventqent *ev;
-	struct timeval now = ast_tvnow();
+	struct event_ring_hdr *hdr;
+	unsigned int head, len, datalen, encodedlen;
 
-	AST_RWLIST_WRLOCK(&all_events);
-	while ( (ev = AST_RWLIST_FIRST(&all_events)) &&
-	    ev->usecount == 0 && AST_RWLIST_NEXT(ev, eq_next)) {
-		AST_RWLIST_REMOVE_HEAD(&all_events, eq_next);
-		ast_free(ev);
+	if (!ring->buf || (head = event_ring_head(ring)) == *pos) {
+		return 0;
+	}
+	if (head - *pos > ring->size) {
+		*pos = head;
+		return -1;
 	}
 
-	AST_RWLIST_TRAVERSE_SAFE_BEGIN(&all_events, ev, eq_next) {
-		/* Never release the last event */
-		if (!AST_RWLIST_NEXT(ev, eq_next)) {
-			break;
-		}
+	hdr = (struct event_ring_hdr *) (ring->buf + (*pos & (ring->size - 1)));
+	if (hdr->pos != *pos) {
+		/* still being written */
+		return 0;
+	}
+	event_ring_barrier();
+	len = hdr->len;
+	datalen = hdr->datalen;
+	encodedlen = compactlen ? hdr->compactlen : 0;
+	*category = hdr->category;
 
-		/* 2.5 times whatever the HTTP timeout is (maximum 2.5 hours) is the maximum time that we will definitely cache an event */
-		if (ev->usecount == 0 && ast_tvdiff_sec(now, ev->tv) > (httptimeout > 3600 ? 3600 : httptimeout) * 2.5) {
-			AST_RWLIST_REMOVE_CURRENT(eq_next);
-			ast_free(ev);
-		}
+	if (len > ring->size / 2 || datalen + encodedlen + sizeof(*hdr) > len) {
+		/* Only a writer lapping us can have left such a header */
+		*pos = event_ring_head(ring);
+		return -1;
 	}
-	AST_RWLIST_TRAVERSE_SAFE_END;
-	AST_RWLIST_UNLOCK(&all_events);
+	if (ast_str_make_space(buf, datalen + 1 + encodedlen)) {
+		return 0;
+	}
+	event_ring_copy_out(ring, *pos + sizeof(*hdr), ast_str_buffer(*buf), datalen);
+	event_ring_copy_out(ring, *pos + sizeof(*hdr) + datalen, ast_str_buffer(*buf) + datalen + 1, encodedlen);
+
+	if (event_ring_head(ring) - *pos > ring->size) {
+		*pos = event_ring_head(ring);
+		return -1;
+	}
+	ast_str_buffer(*buf)[datalen] = '\0';
+	ast_str_update(*buf);
+	if (compactlen) {
+		*compactlen = encodedlen;
+	}
+	*pos += len;
+
+	return 1;
+}
+
+AST_THREADSTORAGE(manager_event_read_buf);
+
+/*!
+ * \brief Read the next event for a session from the event ring
+ * \note The session must be locked.
+ * \note compactlen is as for event_ring_read()
+ * \retval 1 an event was read into buf
+ * \retval 0 the session has read every event
+ */
+static int session_next_event(struct mansession_session *session, struct ast_str **buf, int *category, size_t *compactlen)
+{
+	int res;
+
+	while ((res = event_ring_read(&event_ring, &session->event_pos, buf, category, compactlen)) < 0) {
+		ast_log(LOG_WARNING, "Manager session of '%s' fell a whole event queue behind and lost events. "
+			"Consider raising eventqueuesize in manager.conf\n", S_OR(session->username, "unauthenticated"));
+	}
+	return res;
+}
+
+/*! \brief Whether there are events for the session it has not read */
+static int session_has_events(struct mansession_session *session)
+{
+	return event_ring.buf && event_ring_head(&event_ring) != session->event_pos;
 }
 
 /*!
@@ -1327,15 +1594,18 @@ static struct mansession_session *unref_mansession(struct mansession_session *s)
 
 static void event_filter_destructor(void *obj)
 {
-	regex_t *regex_filter = obj;
-	regfree(regex_filter);
+	struct event_filter *filter = obj;
+
+	if (filter->is_regex) {
+		regfree(&filter->regex);
+	}
 }
 
 static void session_destructor(void *obj)
 {
 	struct mansession_session *session = obj;
-	struct eventqent *eqe = session->last_ev;
 	struct ast_datastore *datastore;
+	struct event_subscription *subscription;
 
 	/* Get rid of each of the data stores on the session */
 	while ((datastore = AST_LIST_REMOVE_HEAD(&session->datastores, entry))) {
@@ -1343,13 +1613,17 @@ static void session_destructor(void *obj)
 		ast_datastore_free(datastore);
 	}
 
-	if (session->f != NULL) {
-		fclose(session->f);
+	while ((subscription = AST_LIST_REMOVE_HEAD(&session->subscriptions, list))) {
+		ast_free(subscription);
 	}
-	if (eqe) {
-		ast_atomic_fetchadd_int(&eqe->usecount, -1);
+
+	if (session->compact) {
+		ast_atomic_fetchadd_int(&compact_sessions, -1);
 	}
 
+	if (session->f != NULL) {
+		fclose(session->f);
+	}
 	if (session->whitefilters) {
 		ao2_t_callback(session->whitefilters, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL, "unlink all white filters");
 		ao2_t_ref(session->whitefilters, -1 , "decrement ref for white container, should be last one");
@@ -1732,7 +2006,12 @@ static char *handle_showmanconn(struct ast_cli_entry *e, int cmd, struct ast_cli
 /* Should change to "manager show connected" */
 static char *handle_showmaneventq(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
-	struct eventqent *s;
+	struct mansession_session *session;
+	struct ao2_iterator i;
+	struct ast_str *buf;
+	unsigned int head, pos;
+	int category;
+
 	switch (cmd) {
 	case CLI_INIT:
 		e->command = "manager show eventq";
@@ -1744,13 +2023,31 @@ static char *handle_showmaneventq(struct ast_cli_entry *e, int cmd, struct ast_c
 	case CLI_GENERATE:
 		return NULL;
 	}
-	AST_RWLIST_RDLOCK(&all_events);
-	AST_RWLIST_TRAVERSE(&all_events, s, eq_next) {
-		ast_cli(a->fd, "Usecount: %d\n", s->usecount);
-		ast_cli(a->fd, "Category: %d\n", s->category);
-		ast_cli(a->fd, "Event:\n%s", s->eventdata);
+	if (!(buf = ast_str_create(256))) {
+		return CLI_FAILURE;
+	}
+
+	/* The events pending are those after the session furthest behind */
+	pos = head = event_ring_head(&event_ring);
+	if (sessions) {
+		i = ao2_iterator_init(sessions, 0);
+		while ((session = ao2_iterator_next(&i))) {
+			ao2_lock(session);
+			if (head - session->event_pos <= event_ring.size && head - session->event_pos > head - pos) {
+				pos = session->event_pos;
+			}
+			ao2_unlock(session);
+			unref_mansession(session);
+		}
+		ao2_iterator_destroy(&i);
+	}
+
+	ast_cli(a->fd, "Queue size: %u kB, pending: %u bytes\n", event_ring.size / 1024, head - pos);
+	while (event_ring_read(&event_ring, &pos, &buf, &category, NULL) > 0) {
+		ast_cli(a->fd, "Category: %d\n", category);
+		ast_cli(a->fd, "Event:\n%s", ast_str_buffer(buf));
 	}
-	AST_RWLIST_UNLOCK(&all_events);
+	ast_free(buf);
 
 	return CLI_SUCCESS;
 }
@@ -1775,19 +2072,6 @@ static char *handle_manager_reload(struct ast_cli_entry *e, int cmd, struct ast_
 	return CLI_SUCCESS;
 }
 
-static struct eventqent *advance_event(struct eventqent *e)
-{
-	struct eventqent *next;
-
-	AST_RWLIST_RDLOCK(&all_events);
-	if ((next = AST_RWLIST_NEXT(e, eq_next))) {
-		ast_atomic_fetchadd_int(&next->usecount, 1);
-		ast_atomic_fetchadd_int(&e->usecount, -1);
-	}
-	AST_RWLIST_UNLOCK(&all_events);
-	return next;
-}
-
 #define	GET_HEADER_FIRST_MATCH	0
 #define	GET_HEADER_LAST_MATCH	1
 #define	GET_HEADER_SKIP_EMPTY	2
@@ -2015,6 +2299,198 @@ static int send_string(struct mansession *s, char *string)
 	return res;
 }
 
+/*! \brief Hash of a header name for compact_header_ids */
+static unsigned int compact_header_hash(const char *name, size_t len)
+{
+	unsigned int hash = 5381;
+
+	while (len--) {
+		hash = hash * 33 ^ (unsigned char) *name++;
+	}
+	return hash;
+}
+
+/*! \brief Fill compact_header_ids and compact_header_list from compact_headers */
+static void compact_headers_init(void)
+{
+	char *list = compact_header_list;
+	size_t space = sizeof(compact_header_list);
+	unsigned int i, slot;
+
+	for (i = 0; i < ARRAY_LEN(compact_headers); i++) {
+		slot = compact_header_hash(compact_headers[i], strlen(compact_headers[i])) % ARRAY_LEN(compact_header_ids);
+		while (compact_header_ids[slot]) {
+			slot = (slot + 1) % ARRAY_LEN(compact_header_ids);
+		}
+		compact_header_ids[slot] = i + 1;
+		ast_build_string(&list, &space, "%s%s", i ? "," : "", compact_headers[i]);
+	}
+}
+
+/*! \brief The id of a header name in the compact encoding, 0 if it has none */
+static unsigned char compact_header_id(const char *name, size_t len)
+{
+	unsigned int slot = compact_header_hash(name, len) % ARRAY_LEN(compact_header_ids);
+	unsigned char id;
+
+	while ((id = compact_header_ids[slot])) {
+		if (!strncmp(compact_headers[id - 1], name, len) && !compact_headers[id - 1][len]) {
+			return id;
+		}
+		slot = (slot + 1) % ARRAY_LEN(compact_header_ids);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Encode the text of an event in the compact encoding
+ * \return the length of the frame written to buf, 0 on failure
+ */
+static size_t compact_encode(const char *eventdata, struct ast_str **buf)
+{
+	const char *line, *end, *colon, *value;
+	unsigned char *out;
+	size_t len = 5, namelen, valuelen;
+
+	/* At most one byte more than the text per header, and the frame header */
+	if (ast_str_make_space(buf, strlen(eventdata) * 2 + 5)) {
+		return 0;
+	}
+	out = (unsigned char *) ast_str_buffer(*buf);
+
+	for (line = eventdata; *line && *line != '\r' && *line != '\n'; line = end + 1) {
+		if (!(end = strchr(line, '\n'))) {
+			end = line + strlen(line) - 1;
+		}
+		if (!(colon = memchr(line, ':', end - line))) {
+			continue;
+		}
+		namelen = MIN(colon - line, 255);
+		value = colon + 1;
+		if (*value == ' ') {
+			value++;
+		}
+		valuelen = end - value + (*end != '\n');
+		if (valuelen && value[valuelen - 1] == '\r') {
+			valuelen--;
+		}
+		valuelen = MIN(valuelen, 65535);
+
+		if (!(out[len++] = compact_header_id(line, namelen))) {
+			out[len++] = namelen;
+			memcpy(out + len, line, namelen);
+			len += namelen;
+		}
+		out[len++] = valuelen >> 8;
+		out[len++] = valuelen & 0xff;
+		memcpy(out + len, value, valuelen);
+		len += valuelen;
+	}
+
+	out[0] = '\0';
+	out[1] = (len - 5) >> 24;
+	out[2] = (len - 5) >> 16;
+	out[3] = (len - 5) >> 8;
+	out[4] = (len - 5) & 0xff;
+
+	return len;
+}
+
+AST_THREADSTORAGE(manager_compact_buf);
+
+/*!
+ * \brief Send an event to a session in the compact encoding
+ * \param s the session
+ * \param eventdata the text of the event
+ * \param compact the event already encoded, or NULL to encode it here
+ * \param len the length of compact
+ */
+static int send_compact(struct mansession *s, const char *eventdata, const char *compact, size_t len)
+{
+	FILE *f = s->f ? s->f : s->session->f;
+	int fd = s->f ? s->fd : s->session->fd;
+	int res;
+
+	if (!compact || !len) {
+		struct ast_str *buf = ast_str_thread_get(&manager_compact_buf, 256);
+
+		if (!buf || !(len = compact_encode(eventdata, &buf))) {
+			return 0;
+		}
+		compact = ast_str_buffer(buf);
+	}
+	if ((res = ast_careful_fwrite(f, fd, compact, len, s->session->writetimeout))) {
+		s->write_error = 1;
+	}
+
+	return res;
+}
+
+/*!
+ * \brief Find a header in the text of an event
+ * \return the value of the header, with its length in valuelen, or NULL
+ */
+static const char *event_header_value(const char *eventdata, const char *header, size_t headerlen, size_t *valuelen)
+{
+	const char *line = eventdata, *value;
+
+	while (*line && *line != '\r' && *line != '\n') {
+		if (!strncasecmp(line, header, headerlen) && line[headerlen] == ':') {
+			value = line + headerlen + 1;
+			if (*value == ' ') {
+				value++;
+			}
+			*valuelen = strcspn(value, "\r\n");
+			return value;
+		}
+		if (!(line = strchr(line, '\n'))) {
+			break;
+		}
+		line++;
+	}
+	return NULL;
+}
+
+/*! \brief Whether a session subscribed to an event, or has no subscriptions */
+static int session_subscribed(struct mansession_session *session, const char *eventdata)
+{
+	struct event_subscription *subscription;
+	const char *event, *value;
+	size_t eventlen, valuelen;
+	int i;
+
+	if (AST_LIST_EMPTY(&session->subscriptions)) {
+		return 1;
+	}
+	if (!(event = event_header_value(eventdata, "Event", 5, &eventlen))) {
+		return 0;
+	}
+
+	AST_LIST_TRAVERSE(&session->subscriptions, subscription, list) {
+		for (i = 0; i < subscription->nevents; i++) {
+			if (!strncasecmp(subscription->events[i], event, eventlen) && !subscription->events[i][eventlen]) {
+				break;
+			}
+		}
+		if (subscription->nevents && i == subscription->nevents) {
+			continue;
+		}
+		for (i = 0; i < subscription->nmatches; i++) {
+			const struct subscription_match *match = &subscription->matches[i];
+
+			if (!(value = event_header_value(eventdata, match->header, match->headerlen, &valuelen))
+				|| (match->prefix ? valuelen < match->valuelen : valuelen != match->valuelen)
+				|| strncmp(value, match->value, match->valuelen)) {
+				break;
+			}
+		}
+		if (i == subscription->nmatches) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*!
  * \brief thread local buffer for astman_append
  *
@@ -2394,7 +2870,7 @@ static int authenticate(struct mansession *s, const struct message *m)
 	const char *password = astman_get_header(m, "Secret");
 	int error = -1;
 	struct ast_manager_user *user = NULL;
-	regex_t *regex_filter;
+	struct event_filter *regex_filter;
 	struct ao2_iterator filter_iter;
 	struct ast_sockaddr addr;
 
@@ -2958,7 +3434,7 @@ static int action_waitevent(struct mansession *s, const struct message *m)
 
 	for (x = 0; x < timeout || timeout < 0; x++) {
 		ao2_lock(s->session);
-		if (AST_RWLIST_NEXT(s->session->last_ev, eq_next)) {
+		if (session_has_events(s->session)) {
 			needexit = 1;
 		}
 		/* We can have multiple HTTP session point to the same mansession entry.
@@ -2987,14 +3463,15 @@ static int action_waitevent(struct mansession *s, const struct message *m)
 
 	ao2_lock(s->session);
 	if (s->session->waiting_thread == pthread_self()) {
-		struct eventqent *eqe = s->session->last_ev;
+		struct ast_str *buf = ast_str_thread_get(&manager_event_read_buf, 256);
+		int category;
+
 		astman_send_response(s, m, "Success", "Waiting for Event completed.");
-		while ((eqe = advance_event(eqe))) {
-			if (((s->session->readperm & eqe->category) == eqe->category) &&
-			    ((s->session->send_events & eqe->category) == eqe->category)) {
-				astman_append(s, "%s", eqe->eventdata);
+		while (buf && session_next_event(s->session, &buf, &category, NULL)) {
+			if (((s->session->readperm & category) == category) &&
+			    ((s->session->send_events & category) == category)) {
+				astman_append(s, "%s", ast_str_buffer(buf));
 			}
-			s->session->last_ev = eqe;
 		}
 		astman_append(s,
 			"Event: WaitEventComplete\r\n"
@@ -3080,6 +3557,8 @@ static int action_logoff(struct mansession *s, const struct message *m)
 
 static int action_login(struct mansession *s, const struct message *m)
 {
+	const char *encoding = astman_get_header(m, "Encoding");
+	int compact = 0;
 
 	/* still authenticated - don't process again */
 	if (s->session->authenticated) {
@@ -3087,6 +3566,17 @@ static int action_login(struct mansession *s, const struct message *m)
 		return 0;
 	}
 
+	if (!strcasecmp(encoding, "compact")) {
+		if (s->session->managerid) {
+			astman_send_error(s, m, "The compact encoding is only available on AMI sockets");
+			return 0;
+		}
+		compact = 1;
+	} else if (!ast_strlen_zero(encoding) && strcasecmp(encoding, "text")) {
+		astman_send_error(s, m, "Unknown encoding");
+		return 0;
+	}
+
 	if (authenticate(s, m)) {
 		sleep(1);
 		astman_send_error(s, m, "Authentication failed");
@@ -3097,14 +3587,35 @@ static int action_login(struct mansession *s, const struct message *m)
 	if (manager_displayconnects(s->session)) {
 		ast_verb(2, "%sManager '%s' logged on from %s\n", (s->session->managerid ? "HTTP " : ""), s->session->username, ast_inet_ntoa(s->session->sin.sin_addr));
 	}
-	astman_send_ack(s, m, "Authentication accepted");
+	if (compact) {
+		astman_start_ack(s, m);
+		astman_append(s, "Message: Authentication accepted\r\n"
+			"Encoding: compact\r\n"
+			"CompactHeaders: %s\r\n\r\n", compact_header_list);
+		ao2_lock(s->session);
+		s->session->compact = 1;
+		ao2_unlock(s->session);
+		ast_atomic_fetchadd_int(&compact_sessions, +1);
+	} else {
+		astman_send_ack(s, m, "Authentication accepted");
+	}
 	if ((s->session->send_events & EVENT_FLAG_SYSTEM)
 		&& ast_test_flag(&ast_options, AST_OPT_FLAG_FULLY_BOOTED)) {
 		struct ast_str *auth = ast_str_alloca(80);
 		const char *cat_str = authority_to_str(EVENT_FLAG_SYSTEM, &auth);
-		astman_append(s, "Event: FullyBooted\r\n"
-			"Privilege: %s\r\n"
-			"Status: Fully Booted\r\n\r\n", cat_str);
+
+		if (compact) {
+			char event[256];
+
+			snprintf(event, sizeof(event), "Event: FullyBooted\r\n"
+				"Privilege: %s\r\n"
+				"Status: Fully Booted\r\n\r\n", cat_str);
+			send_compact(s, event, NULL, 0);
+		} else {
+			astman_append(s, "Event: FullyBooted\r\n"
+				"Privilege: %s\r\n"
+				"Status: Fully Booted\r\n\r\n", cat_str);
+		}
 	}
 	return 0;
 }
@@ -4266,13 +4777,22 @@ static int action_timeout(struct mansession *s, const struct message *m)
 	return 0;
 }
 
+/*! \brief Whether an event filter matches somewhere in an event */
+static int event_filter_match(const struct event_filter *filter, const char *eventdata)
+{
+	if (filter->is_regex) {
+		return !regexec(&filter->regex, eventdata, 0, NULL, 0);
+	}
+	return strstr(eventdata, filter->literal) != NULL;
+}
+
 static int whitefilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 {
-	regex_t *regex_filter = obj;
+	struct event_filter *filter = obj;
 	const char *eventdata = arg;
 	int *result = data;
 
-	if (!regexec(regex_filter, eventdata, 0, NULL, 0)) {
+	if (event_filter_match(filter, eventdata)) {
 		*result = 1;
 		return (CMP_MATCH | CMP_STOP);
 	}
@@ -4282,11 +4802,11 @@ static int whitefilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 
 static int blackfilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 {
-	regex_t *regex_filter = obj;
+	struct event_filter *filter = obj;
 	const char *eventdata = arg;
 	int *result = data;
 
-	if (!regexec(regex_filter, eventdata, 0, NULL, 0)) {
+	if (event_filter_match(filter, eventdata)) {
 		*result = 0;
 		return (CMP_MATCH | CMP_STOP);
 	}
@@ -4329,6 +4849,98 @@ static int action_filter(struct mansession *s, const struct message *m)
 	return 0;
 }
 
+/*!
+ * \brief Manager command to subscribe a manager session to events
+ */
+static int action_subscribe(struct mansession *s, const struct message *m)
+{
+	const char *operation = astman_get_header(m, "Operation");
+	const char *events = astman_get_header(m, "Events");
+	struct event_subscription *subscription;
+	size_t size = sizeof(*subscription) + strlen(events) + 1;
+	char *data, *event;
+	int x;
+
+	if (!strcasecmp(operation, "Clear")) {
+		ao2_lock(s->session);
+		while ((subscription = AST_LIST_REMOVE_HEAD(&s->session->subscriptions, list))) {
+			ast_free(subscription);
+		}
+		ao2_unlock(s->session);
+		astman_send_ack(s, m, "Subscriptions cleared");
+		return 0;
+	} else if (!ast_strlen_zero(operation) && strcasecmp(operation, "Add")) {
+		astman_send_error(s, m, "Unknown operation");
+		return 0;
+	}
+
+	for (x = 0; x < m->hdrcount; x++) {
+		if (!strncasecmp(m->headers[x], "Match:", 6)) {
+			size += strlen(m->headers[x]) + 1;
+		}
+	}
+	if (!(subscription = ast_calloc(1, size))) {
+		astman_send_error(s, m, "Internal Error. Failed to allocate subscription");
+		return 0;
+	}
+
+	data = subscription->data;
+	strcpy(data, events);
+	while ((event = strsep(&data, ","))) {
+		event = ast_strip(event);
+		if (ast_strlen_zero(event) || !strcmp(event, "*")) {
+			continue;
+		}
+		if (subscription->nevents == SUBSCRIPTION_MAX_EVENTS) {
+			ast_free(subscription);
+			astman_send_error(s, m, "Too many events in one subscription");
+			return 0;
+		}
+		subscription->events[subscription->nevents++] = event;
+	}
+
+	data = subscription->data + strlen(events) + 1;
+	for (x = 0; x < m->hdrcount; x++) {
+		struct subscription_match *match = &subscription->matches[subscription->nmatches];
+		char *header, *value;
+
+		if (strncasecmp(m->headers[x], "Match:", 6)) {
+			continue;
+		}
+		if (subscription->nmatches == SUBSCRIPTION_MAX_MATCHES) {
+			ast_free(subscription);
+			astman_send_error(s, m, "Too many matches in one subscription");
+			return 0;
+		}
+		strcpy(data, m->headers[x] + 6);
+		header = ast_strip(data);
+		data += strlen(m->headers[x] + 6) + 1;
+		if (!(value = strchr(header, ':')) || value == header) {
+			ast_free(subscription);
+			astman_send_error(s, m, "Match must be given as 'Header: value'");
+			return 0;
+		}
+		*value++ = '\0';
+		value = ast_skip_blanks(value);
+		match->header = ast_strip(header);
+		match->headerlen = strlen(match->header);
+		match->valuelen = strlen(value);
+		if (match->valuelen && value[match->valuelen - 1] == '*') {
+			match->prefix = 1;
+			match->valuelen--;
+		}
+		match->value = value;
+		subscription->nmatches++;
+	}
+
+	ao2_lock(s->session);
+	AST_LIST_INSERT_TAIL(&s->session->subscriptions, subscription, list);
+	ao2_unlock(s->session);
+
+	astman_send_ack(s, m, "Subscription added");
+	return 0;
+}
+
 /*
  * \brief Add an event filter to a manager session
  *
@@ -4347,14 +4959,14 @@ static int action_filter(struct mansession *s, const struct message *m)
  * \example filter_pattern = "Event: New.*"
  * \example filter_pattern = "!Channel: DAHDI.*"
  *
+ * Filters which use no special characters of a basic regular expression,
+ * but for a trailing ".*", are searched for as plain strings instead,
+ * which matches the same events without running a regex on every event.
  */
 static enum add_filter_result manager_add_filter(const char *filter_pattern, struct ao2_container *whitefilters, struct ao2_container *blackfilters) {
-	regex_t *new_filter = ao2_t_alloc(sizeof(*new_filter), event_filter_destructor, "event_filter allocation");
+	struct event_filter *new_filter;
 	int is_blackfilter;
-
-	if (!new_filter) {
-		return FILTER_ALLOC_FAILED;
-	}
+	size_t len;
 
 	if (filter_pattern[0] == '!') {
 		is_blackfilter = 1;
@@ -4363,9 +4975,24 @@ static enum add_filter_result manager_add_filter(const char *filter_pattern, str
 		is_blackfilter = 0;
 	}
 
-	if (regcomp(new_filter, filter_pattern, 0)) {
-		ao2_t_ref(new_filter, -1, "failed to make regx");
-		return FILTER_COMPILE_FAIL;
+	/* An unanchored match of "X.*" is a match of "X" */
+	len = strlen(filter_pattern);
+	while (len >= 2 && filter_pattern[len - 2] == '.' && filter_pattern[len - 1] == '*'
+		&& (len == 2 || filter_pattern[len - 3] != '\\')) {
+		len -= 2;
+	}
+
+	if (!(new_filter = ao2_t_alloc(sizeof(*new_filter) + len + 1, event_filter_destructor, "event_filter allocation"))) {
+		return FILTER_ALLOC_FAILED;
+	}
+
+	ast_copy_string(new_filter->literal, filter_pattern, len + 1);
+	if (strpbrk(new_filter->literal, ".[]*^$\\")) {
+		if (regcomp(&new_filter->regex, filter_pattern, 0)) {
+			ao2_t_ref(new_filter, -1, "failed to make regx");
+			return FILTER_COMPILE_FAIL;
+		}
+		new_filter->is_regex = 1;
 	}
 
 	if (is_blackfilter) {
@@ -4402,6 +5029,31 @@ static int match_filter(struct mansession *s, char *eventdata)
 	return result;
 }
 
+/*!
+ * \brief Send an event to a session, if the session may read it and wants it
+ * \param s the session
+ * \param eventdata the text of the event
+ * \param compact the event in the compact encoding, or NULL
+ * \param compactlen the length of compact
+ * \param category the category of the event
+ * \note The session must be locked.
+ * \retval -1 the event could not be sent
+ */
+static int send_event(struct mansession *s, char *eventdata, const char *compact, size_t compactlen, int category)
+{
+	if (!s->session->authenticated ||
+	    (s->session->readperm & category) != category ||
+	    (s->session->send_events & category) != category ||
+	    !session_subscribed(s->session, eventdata) ||
+	    !match_filter(s, eventdata)) {
+		return 0;
+	}
+	if (s->session->compact) {
+		return send_compact(s, eventdata, compact, compactlen);
+	}
+	return send_string(s, eventdata);
+}
+
 /*!
  * Send any applicable events to the client listening on this socket.
  * Wait only for a finite time on each event, and drop all events whether
@@ -4413,18 +5065,16 @@ static int process_events(struct mansession *s)
 
 	ao2_lock(s->session);
 	if (s->session->f != NULL) {
-		struct eventqent *eqe = s->session->last_ev;
-
-		while ((eqe = advance_event(eqe))) {
-			if (!ret && s->session->authenticated &&
-			    (s->session->readperm & eqe->category) == eqe->category &&
-			    (s->session->send_events & eqe->category) == eqe->category) {
-					if (match_filter(s, eqe->eventdata)) {
-						if (send_string(s, eqe->eventdata) < 0)
-							ret = -1;	/* don't send more */
-					}
+		struct ast_str *buf = ast_str_thread_get(&manager_event_read_buf, 256);
+		size_t compactlen = 0;
+		int category;
+
+		while (buf && session_next_event(s->session, &buf, &category, s->session->compact ? &compactlen : NULL)) {
+			char *eventdata = ast_str_buffer(buf);
+
+			if (!ret && send_event(s, eventdata, eventdata + ast_str_strlen(buf) + 1, compactlen, category) < 0) {
+				ret = -1;	/* don't send more */
 			}
-			s->session->last_ev = eqe;
 		}
 	}
 	ao2_unlock(s->session);
@@ -5064,7 +5714,7 @@ static void *session_do(void *data)
 
 	ao2_lock(session);
 	/* Hook to the tail of the event queue */
-	session->last_ev = grab_last();
+	session->event_pos = event_ring_head(&event_ring);
 
 	ast_mutex_init(&s.lock);
 
@@ -5144,25 +5794,20 @@ static void purge_sessions(int n_max)
  */
 static int append_event(const char *str, int category)
 {
-	struct eventqent *tmp = ast_malloc(sizeof(*tmp) + strlen(str));
-	static int seq;	/* sequence number */
+	struct ast_str *compact = NULL;
+	size_t compactlen = 0;
 
-	if (!tmp) {
+	if (!event_ring.buf) {
+		return -1;
+	}
+	/* Encode the event once here rather than once for every session */
+	if (compact_sessions && (compact = ast_str_thread_get(&manager_compact_buf, 256))) {
+		compactlen = compact_encode(str, &compact);
+	}
+	if (event_ring_write(&event_ring, str, compactlen ? ast_str_buffer(compact) : NULL, compactlen, category)) {
+		ast_log(LOG_WARNING, "Manager event of %zu bytes does not fit the event queue, dropped\n", strlen(str));
 		return -1;
 	}
-
-	/* need to init all fields, because ast_malloc() does not */
-	tmp->usecount = 0;
-	tmp->category = category;
-	tmp->seq = ast_atomic_fetchadd_int(&seq, 1);
-	tmp->tv = ast_tvnow();
-	AST_RWLIST_NEXT(tmp, eq_next) = NULL;
-	strcpy(tmp->eventdata, str);
-
-	AST_RWLIST_WRLOCK(&all_events);
-	AST_RWLIST_INSERT_TAIL(&all_events, tmp, eq_next);
-	AST_RWLIST_UNLOCK(&all_events);
-
 	return 0;
 }
 
@@ -5924,7 +6569,7 @@ static int generic_http_callback(struct ast_tcptls_session_instance *ser,
 		 * won't happen twice in a row.
 		 */
 		while ((session->managerid = ast_random() ^ (unsigned long) session) == 0);
-		session->last_ev = grab_last();
+		session->event_pos = event_ring_head(&event_ring);
 		AST_LIST_HEAD_INIT_NOLOCK(&session->datastores);
 	}
 	ao2_unlock(session);
@@ -6218,7 +6863,7 @@ static int auth_http_callback(struct ast_tcptls_session_instance *ser,
 
 		ast_copy_string(session->username, u_username, sizeof(session->username));
 		session->managerid = nonce;
-		session->last_ev = grab_last();
+		session->event_pos = event_ring_head(&event_ring);
 		AST_LIST_HEAD_INIT_NOLOCK(&session->datastores);
 
 		session->readperm = u_readperm;
@@ -6524,7 +7169,6 @@ static int webregged = 0;
 static void purge_old_stuff(void *data)
 {
 	purge_sessions(1);
-	purge_events();
 }
 
 static struct ast_tls_config ami_tls_cfg;
@@ -6590,6 +7234,315 @@ static char *handle_manager_show_settings(struct ast_cli_entry *e, int cmd, stru
 	return CLI_SUCCESS;
 }
 
+#if defined(TEST_FRAMEWORK)
+/*! \brief The event stream replayed by the manager benchmark */
+struct manager_bench_replay {
+	char **events;
+	struct ast_str **compact;	/*!< the events in the compact encoding, as queued */
+	size_t *compactlen;
+	unsigned int count;
+};
+
+/*! \brief A client of the manager benchmark: the session and its end of the socket */
+struct manager_bench_client {
+	struct mansession s;
+	const struct manager_bench_replay *replay;
+	pthread_t sender;
+	pthread_t reader;
+	int fd;
+	unsigned long long bytes;
+	int started;
+};
+
+/*! \brief Format the events of a number of calls as __ast_manager_event_multichan() would */
+static int manager_bench_replay_init(struct manager_bench_replay *replay, unsigned int calls)
+{
+	static const char * const states[] = { "Ring", "Ringing", "Up" };
+	struct ast_str *buf;
+	char channel[64], uniqueid[32];
+	unsigned int call, i;
+
+	replay->count = 0;
+	replay->compact = NULL;
+	replay->compactlen = NULL;
+	if (!(replay->events = ast_calloc(calls * 10, sizeof(*replay->events))) || !(buf = ast_str_create(512))) {
+		return -1;
+	}
+
+#define BENCH_EVENT(fmt, ...) do { \
+		ast_str_set(&buf, 0, "Event: " fmt "\r\n", __VA_ARGS__); \
+		replay->events[replay->count++] = ast_strdup(ast_str_buffer(buf)); \
+	} while (0)
+
+	for (call = 0; call < calls; call++) {
+		snprintf(channel, sizeof(channel), "SIP/%u-%08x", 100 + call % 200, call);
+		snprintf(uniqueid, sizeof(uniqueid), "1334234567.%u", call);
+		BENCH_EVENT("Newchannel\r\nPrivilege: call,all\r\nChannel: %s\r\nChannelState: 0\r\n"
+			"ChannelStateDesc: Down\r\nCallerIDNum: %u\r\nCallerIDName: Bench %u\r\nAccountCode: \r\n"
+			"Exten: 2000\r\nContext: from-internal\r\nUniqueid: %s\r\n",
+			channel, 100 + call % 200, 100 + call % 200, uniqueid);
+		BENCH_EVENT("VarSet\r\nPrivilege: dialplan,all\r\nChannel: %s\r\nVariable: SIPCALLID\r\n"
+			"Value: %08x@127.0.0.1\r\nUniqueid: %s\r\n", channel, call, uniqueid);
+		for (i = 1; i <= 3; i++) {
+			BENCH_EVENT("Newexten\r\nPrivilege: dialplan,all\r\nChannel: %s\r\nContext: from-internal\r\n"
+				"Extension: 2000\r\nPriority: %u\r\nApplication: %s\r\nAppData: %s\r\nUniqueid: %s\r\n",
+				channel, i, i == 3 ? "Dial" : "NoOp", i == 3 ? "SIP/2000,30" : "", uniqueid);
+		}
+		for (i = 0; i < ARRAY_LEN(states); i++) {
+			BENCH_EVENT("Newstate\r\nPrivilege: call,all\r\nChannel: %s\r\nChannelState: %u\r\n"
+				"ChannelStateDesc: %s\r\nCallerIDNum: %u\r\nCallerIDName: Bench %u\r\n"
+				"ConnectedLineNum: 2000\r\nConnectedLineName: \r\nUniqueid: %s\r\n",
+				channel, i + 4, states[i], 100 + call % 200, 100 + call % 200, uniqueid);
+		}
+		BENCH_EVENT("Hangup\r\nPrivilege: call,all\r\nChannel: %s\r\nUniqueid: %s\r\nCallerIDNum: %u\r\n"
+			"CallerIDName: Bench %u\r\nConnectedLineNum: 2000\r\nConnectedLineName: \r\n"
+			"AccountCode: \r\nCause: 16\r\nCause-txt: Normal Clearing\r\n",
+			channel, uniqueid, 100 + call % 200, 100 + call % 200);
+	}
+
+#undef BENCH_EVENT
+
+	ast_free(buf);
+	for (i = 0; i < replay->count; i++) {
+		if (!replay->events[i]) {
+			return -1;
+		}
+	}
+
+	/* append_event() encodes each event once for all compact sessions */
+	if (!(replay->compact = ast_calloc(replay->count, sizeof(*replay->compact)))
+		|| !(replay->compactlen = ast_calloc(replay->count, sizeof(*replay->compactlen)))) {
+		return -1;
+	}
+	for (i = 0; i < replay->count; i++) {
+		if (!(replay->compact[i] = ast_str_create(512))
+			|| !(replay->compactlen[i] = compact_encode(replay->events[i], &replay->compact[i]))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void manager_bench_replay_destroy(struct manager_bench_replay *replay)
+{
+	unsigned int i;
+
+	for (i = 0; i < replay->count; i++) {
+		ast_free(replay->events[i]);
+		if (replay->compact && replay->compact[i]) {
+			ast_free(replay->compact[i]);
+		}
+	}
+	ast_free(replay->events);
+	if (replay->compact) {
+		ast_free(replay->compact);
+	}
+	if (replay->compactlen) {
+		ast_free(replay->compactlen);
+	}
+}
+
+/*! \brief Send the replayed events to the client session, as its session thread would */
+static void *manager_bench_sender(void *data)
+{
+	struct manager_bench_client *client = data;
+	unsigned int i;
+
+	ao2_lock(client->s.session);
+	for (i = 0; i < client->replay->count; i++) {
+		if (send_event(&client->s, client->replay->events[i], ast_str_buffer(client->replay->compact[i]),
+			client->replay->compactlen[i], EVENT_FLAG_CALL) < 0) {
+			break;
+		}
+	}
+	ao2_unlock(client->s.session);
+	shutdown(client->s.session->fd, SHUT_WR);
+
+	return NULL;
+}
+
+/*! \brief Read what the client is sent */
+static void *manager_bench_reader(void *data)
+{
+	struct manager_bench_client *client = data;
+	char buf[16384];
+	ssize_t res;
+
+	while ((res = read(client->fd, buf, sizeof(buf))) > 0 || (res < 0 && errno == EINTR)) {
+		if (res > 0) {
+			client->bytes += res;
+		}
+	}
+
+	return NULL;
+}
+
+/*! \brief A logged in session writing to one end of a socket pair */
+static struct mansession_session *manager_bench_session(int fd, const char *mode)
+{
+	struct mansession_session *session;
+	struct event_subscription *subscription;
+
+	if (!(session = ao2_alloc(sizeof(*session), session_destructor))) {
+		close(fd);
+		return NULL;
+	}
+	session->whitefilters = ao2_container_alloc(1, NULL, NULL);
+	session->blackfilters = ao2_container_alloc(1, NULL, NULL);
+	if (!session->whitefilters || !session->blackfilters || !(session->f = fdopen(fd, "w"))) {
+		close(fd);
+		ao2_ref(session, -1);
+		return NULL;
+	}
+	session->fd = fd;
+	session->authenticated = 1;
+	session->readperm = -1;
+	session->send_events = -1;
+	session->writetimeout = 10000;
+
+	if (!strcmp(mode, "filter")) {
+		if (manager_add_filter("Event: Hangup.*Channel: SIP/1", session->whitefilters, session->blackfilters) != FILTER_SUCCESS) {
+			ao2_ref(session, -1);
+			return NULL;
+		}
+	} else if (!strcmp(mode, "compact")) {
+		if (!(subscription = ast_calloc(1, sizeof(*subscription)))) {
+			ao2_ref(session, -1);
+			return NULL;
+		}
+		subscription->events[subscription->nevents++] = "Hangup";
+		subscription->matches[0].header = "Channel";
+		subscription->matches[0].headerlen = strlen("Channel");
+		subscription->matches[0].value = "SIP/1";
+		subscription->matches[0].valuelen = strlen("SIP/1");
+		subscription->matches[0].prefix = 1;
+		subscription->nmatches = 1;
+		AST_LIST_INSERT_TAIL(&session->subscriptions, subscription, list);
+		session->compact = 1;
+		ast_atomic_fetchadd_int(&compact_sessions, +1);
+	}
+
+	return session;
+}
+
+/*! \brief Replay the events to a number of clients at once, each sent events by a thread of its own */
+static int manager_bench_run(int fd, const char *mode, const struct manager_bench_replay *replay, unsigned int count)
+{
+	struct manager_bench_client *clients;
+	unsigned long long bytes = 0;
+	struct timeval start;
+	unsigned int i;
+	int64_t us;
+	int sv[2], res = 0;
+
+	if (!(clients = ast_calloc(count, sizeof(*clients)))) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		clients[i].fd = -1;
+		clients[i].replay = replay;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+			res = -1;
+			break;
+		}
+		clients[i].fd = sv[1];
+		if (!(clients[i].s.session = manager_bench_session(sv[0], mode))) {
+			res = -1;
+			break;
+		}
+	}
+
+	start = ast_tvnow();
+	for (i = 0; !res && i < count; i++) {
+		if (ast_pthread_create(&clients[i].reader, NULL, manager_bench_reader, &clients[i])) {
+			res = -1;
+		} else if (ast_pthread_create(&clients[i].sender, NULL, manager_bench_sender, &clients[i])) {
+			shutdown(clients[i].fd, SHUT_RDWR);
+			pthread_join(clients[i].reader, NULL);
+			res = -1;
+		} else {
+			clients[i].started = 1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (clients[i].started) {
+			pthread_join(clients[i].sender, NULL);
+			pthread_join(clients[i].reader, NULL);
+			bytes += clients[i].bytes;
+		}
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+
+	for (i = 0; i < count; i++) {
+		if (clients[i].s.session) {
+			ao2_ref(clients[i].s.session, -1);
+		}
+		if (clients[i].fd != -1) {
+			close(clients[i].fd);
+		}
+	}
+	ast_free(clients);
+
+	if (res) {
+		ast_cli(fd, "%-8s %3u clients - test failed, could not set up the clients\n", mode, count);
+		return -1;
+	}
+	ast_cli(fd, "%-8s %3u clients %9.1f kB each - %8" PRIi64 " us, %10.0f events/s\n",
+		mode, count, (double) bytes / count / 1024, us,
+		us ? (double) replay->count * count * 1000000 / us : 0.0);
+
+	return 0;
+}
+
+static char *handle_manager_benchmark(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	static const char * const modes[] = { "text", "filter", "compact" };
+	static const unsigned int default_clients[] = { 10, 50, 100 };
+	struct manager_bench_replay replay;
+	unsigned int clients = 0, calls = 2000, i, j;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "manager benchmark replay";
+		e->usage =
+			"Usage: manager benchmark replay [<clients> [<calls>]]\n"
+			"       Replays the events of <calls> (default 2000) calls to\n"
+			"       <clients> (default 10, 50 and 100) sessions at once, each\n"
+			"       sent events by a thread of its own and read through a socket.\n"
+			"       Compares text sessions sent every event, text sessions with an\n"
+			"       eventfilter for the hangups of SIP/1* channels, and compact\n"
+			"       sessions subscribed to them, in events replayed per second.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc > e->args + 2
+		|| (a->argc > e->args && (sscanf(a->argv[e->args], "%u", &clients) != 1 || !clients))
+		|| (a->argc > e->args + 1 && (sscanf(a->argv[e->args + 1], "%u", &calls) != 1 || !calls))) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (manager_bench_replay_init(&replay, calls)) {
+		manager_bench_replay_destroy(&replay);
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, "Replaying %u events of %u calls\n", replay.count, calls);
+	for (i = 0; i < (clients ? 1 : ARRAY_LEN(default_clients)); i++) {
+		for (j = 0; j < ARRAY_LEN(modes); j++) {
+			manager_bench_run(a->fd, modes[j], &replay, clients ? clients : default_clients[i]);
+		}
+	}
+
+	manager_bench_replay_destroy(&replay);
+
+	return CLI_SUCCESS;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
 static struct ast_cli_entry cli_manager[] = {
 	AST_CLI_DEFINE(handle_showmancmd, "Show a manager interface command"),
 	AST_CLI_DEFINE(handle_showmancmds, "List manager interface commands"),
@@ -6600,6 +7553,9 @@ static struct ast_cli_entry cli_manager[] = {
 	AST_CLI_DEFINE(handle_mandebug, "Show, enable, disable debugging of the manager code"),
 	AST_CLI_DEFINE(handle_manager_reload, "Reload manager configurations"),
 	AST_CLI_DEFINE(handle_manager_show_settings, "Show manager global settings"),
+#if defined(TEST_FRAMEWORK)
+	AST_CLI_DEFINE(handle_manager_benchmark, "Benchmark manager event delivery"),
+#endif	/* defined(TEST_FRAMEWORK) */
 };
 
 /*!
@@ -6639,12 +7595,375 @@ static void load_channelvars(struct ast_variable *var)
 	AST_RWLIST_UNLOCK(&channelvars);
 }
 
+#if defined(TEST_FRAMEWORK)
+#define EVENT_RING_TEST_WRITERS	4
+#define EVENT_RING_TEST_EVENTS	5000
+
+static struct event_ring test_ring;
+static volatile int test_writers_done;
+
+static void *event_ring_test_writer(void *data)
+{
+	char event[128];
+	int writer = (long) data, seq;
+
+	for (seq = 0; seq < EVENT_RING_TEST_EVENTS; seq++) {
+		snprintf(event, sizeof(event), "Event: Test\r\nWriter: %d\r\nSeq: %d\r\n%.*s\r\n",
+			writer, seq, seq % 40, "........................................");
+		event_ring_write(&test_ring, event, NULL, 0, writer);
+	}
+	ast_atomic_fetchadd_int(&test_writers_done, 1);
+	return NULL;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
+#if defined(TEST_FRAMEWORK)
+AST_TEST_DEFINE(manager_event_ring_test)
+{
+	pthread_t writers[EVENT_RING_TEST_WRITERS];
+	int next_seq[EVENT_RING_TEST_WRITERS] = { 0, };
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct ast_str *buf;
+	char event[768];
+	unsigned int pos;
+	int i, category, writer, seq, read = 0, lost = 0, started = 0;
+	size_t compactlen;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "manager_event_ring_test";
+		info->category = "/main/manager/";
+		info->summary = "Test the manager event queue";
+		info->description =
+			"Writes events to a small event ring and checks they read back "
+			"whole and in order across laps, that a reader left a lap behind "
+			"is told so, that the compact encoding of an event reads back "
+			"with it, and that events written by several threads at once "
+			"are all read, whole and in order.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(buf = ast_str_create(16))) {
+		return AST_TEST_FAIL;
+	}
+	if (event_ring_init(&test_ring, 1024)) {
+		ast_free(buf);
+		return AST_TEST_FAIL;
+	}
+
+	/* Events of every length read back across many laps */
+	pos = event_ring_head(&test_ring);
+	for (i = 0; i < 200 && res == AST_TEST_PASS; i++) {
+		snprintf(event, sizeof(event), "Event: Lap\r\nCount: %d\r\n%.*s\r\n", i, i % 150,
+			"0123456789012345678901234567890123456789012345678901234567890123456789"
+			"0123456789012345678901234567890123456789012345678901234567890123456789"
+			"0123456789");
+		if (event_ring_write(&test_ring, event, NULL, 0, i)) {
+			ast_test_status_update(test, "Event %d did not fit the ring\n", i);
+			res = AST_TEST_FAIL;
+		} else if (event_ring_read(&test_ring, &pos, &buf, &category, NULL) != 1
+			|| strcmp(ast_str_buffer(buf), event) || category != i) {
+			ast_test_status_update(test, "Event %d did not read back\n", i);
+			res = AST_TEST_FAIL;
+		} else if (event_ring_read(&test_ring, &pos, &buf, &category, NULL)) {
+			ast_test_status_update(test, "Event %d read more than was written\n", i);
+			res = AST_TEST_FAIL;
+		}
+	}
+
+	/* An event too large for the ring is refused */
+	memset(event, 'x', sizeof(event) - 1);
+	event[sizeof(event) - 1] = '\0';
+	if (!event_ring_write(&test_ring, event, NULL, 0, 0)) {
+		ast_test_status_update(test, "An event larger than half the ring was written\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* A reader a lap behind loses its events and goes on from the head */
+	pos = event_ring_head(&test_ring);
+	for (i = 0; i < 40; i++) {
+		event_ring_write(&test_ring, "Event: Overrun\r\n\r\n", NULL, 0, 0);
+	}
+	if (event_ring_read(&test_ring, &pos, &buf, &category, NULL) != -1 || pos != event_ring_head(&test_ring)) {
+		ast_test_status_update(test, "A reader a lap behind was not told so\n");
+		res = AST_TEST_FAIL;
+	}
+	event_ring_write(&test_ring, "Event: After\r\n\r\n", NULL, 0, 0);
+	if (event_ring_read(&test_ring, &pos, &buf, &category, NULL) != 1 || strcmp(ast_str_buffer(buf), "Event: After\r\n\r\n")) {
+		ast_test_status_update(test, "A reader did not go on after losing events\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* The compact encoding queued with an event reads back after its text */
+	event_ring_write(&test_ring, "Event: Encoded\r\n\r\n", "\0\0\0\0\3\1\0\0", 8, 0);
+	if (event_ring_read(&test_ring, &pos, &buf, &category, &compactlen) != 1
+		|| strcmp(ast_str_buffer(buf), "Event: Encoded\r\n\r\n") || compactlen != 8
+		|| memcmp(ast_str_buffer(buf) + ast_str_strlen(buf) + 1, "\0\0\0\0\3\1\0\0", 8)) {
+		ast_test_status_update(test, "The compact encoding of an event did not read back\n");
+		res = AST_TEST_FAIL;
+	}
+	ast_free(test_ring.buf);
+
+	/* Writers at once, read as they write, into a ring that holds all they write */
+	if (event_ring_init(&test_ring, 4 * 1024 * 1024)) {
+		ast_free(buf);
+		return AST_TEST_FAIL;
+	}
+	test_writers_done = 0;
+	pos = event_ring_head(&test_ring);
+	for (i = 0; i < EVENT_RING_TEST_WRITERS; i++) {
+		if (ast_pthread_create(&writers[i], NULL, event_ring_test_writer, (void *) (long) i)) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+		started++;
+	}
+	while (res == AST_TEST_PASS) {
+		int done = test_writers_done == started;
+		int r = event_ring_read(&test_ring, &pos, &buf, &category, NULL);
+
+		if (r < 0) {
+			lost++;
+			continue;
+		} else if (!r) {
+			if (done) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+		if (sscanf(ast_str_buffer(buf), "Event: Test\r\nWriter: %d\r\nSeq: %d\r\n", &writer, &seq) != 2
+			|| writer != category || writer < 0 || writer >= EVENT_RING_TEST_WRITERS
+			|| seq != next_seq[writer]
+			|| ast_str_strlen(buf) != strlen(ast_str_buffer(buf))
+			|| strncmp(ast_str_buffer(buf) + ast_str_strlen(buf) - 2, "\r\n", 2)) {
+			ast_test_status_update(test, "Read a torn event: %s\n", ast_str_buffer(buf));
+			res = AST_TEST_FAIL;
+			break;
+		}
+		next_seq[writer] = seq + 1;
+		read++;
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(writers[i], NULL);
+	}
+	if (read != EVENT_RING_TEST_WRITERS * EVENT_RING_TEST_EVENTS || lost) {
+		ast_test_status_update(test, "Read %d of the events written at once, fell behind %d times\n", read, lost);
+		res = AST_TEST_FAIL;
+	}
+
+	ast_free(test_ring.buf);
+	ast_free(buf);
+	return res;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
+#if defined(TEST_FRAMEWORK)
+AST_TEST_DEFINE(manager_event_filter_test)
+{
+	static const char * const events[] = {
+		"Event: Newchannel\r\nChannel: SIP/100-00000001\r\n\r\n",
+		"Event: Newstate\r\nChannel: DAHDI/1-1\r\n\r\n",
+		"Event: Hangup\r\nChannel: SIP/100-00000001\r\nCause: 16\r\n\r\n",
+		"Event: VarSet\r\nVariable: a.*b\r\n\r\n",
+	};
+	static const struct {
+		const char *pattern;
+		int is_regex;
+	} filters[] = {
+		{ "Event: Newchannel", 0 },
+		{ "Event: New.*", 0 },
+		{ "Channel: DAHDI.*", 0 },
+		{ ".*", 0 },
+		{ "Channel: SIP/[0-9]*-", 1 },
+		{ "^Event: Hangup", 1 },
+		{ "a\\.*", 1 },
+		{ "Cause: 1.$", 1 },
+	};
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct ao2_container *whitefilters, *blackfilters;
+	struct event_filter *filter;
+	regex_t regex;
+	int i, j;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "manager_event_filter_test";
+		info->category = "/main/manager/";
+		info->summary = "Test the compiled manager event filters";
+		info->description =
+			"Compiles manager event filters and checks they match the very "
+			"events their regular expressions match, and that filters "
+			"which need no regular expression are searched for as plain strings.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	whitefilters = ao2_container_alloc(1, NULL, NULL);
+	blackfilters = ao2_container_alloc(1, NULL, NULL);
+	if (!whitefilters || !blackfilters) {
+		if (whitefilters) {
+			ao2_ref(whitefilters, -1);
+		}
+		if (blackfilters) {
+			ao2_ref(blackfilters, -1);
+		}
+		return AST_TEST_FAIL;
+	}
+
+	for (i = 0; i < ARRAY_LEN(filters); i++) {
+		if (manager_add_filter(filters[i].pattern, whitefilters, blackfilters) != FILTER_SUCCESS
+			|| !(filter = ao2_callback(whitefilters, OBJ_UNLINK, NULL, NULL))) {
+			ast_test_status_update(test, "Filter '%s' did not compile\n", filters[i].pattern);
+			res = AST_TEST_FAIL;
+			continue;
+		}
+		if (filter->is_regex != filters[i].is_regex) {
+			ast_test_status_update(test, "Filter '%s' %s a regex\n", filters[i].pattern,
+				filter->is_regex ? "is" : "is not");
+			res = AST_TEST_FAIL;
+		}
+		regcomp(&regex, filters[i].pattern, 0);
+		for (j = 0; j < ARRAY_LEN(events); j++) {
+			if (event_filter_match(filter, events[j]) != !regexec(&regex, events[j], 0, NULL, 0)) {
+				ast_test_status_update(test, "Filter '%s' does not match event %d as its regex does\n",
+					filters[i].pattern, j);
+				res = AST_TEST_FAIL;
+			}
+		}
+		regfree(&regex);
+		ao2_ref(filter, -1);
+	}
+
+	if (manager_add_filter("!Channel: DAHDI", whitefilters, blackfilters) != FILTER_SUCCESS
+		|| ao2_container_count(blackfilters) != 1 || ao2_container_count(whitefilters)) {
+		ast_test_status_update(test, "A black filter was not added as one\n");
+		res = AST_TEST_FAIL;
+	}
+	if (manager_add_filter("Channel: [", whitefilters, blackfilters) != FILTER_COMPILE_FAIL) {
+		ast_test_status_update(test, "A broken regex compiled\n");
+		res = AST_TEST_FAIL;
+	}
+
+	ao2_callback(blackfilters, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
+	ao2_ref(whitefilters, -1);
+	ao2_ref(blackfilters, -1);
+	return res;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
+#if defined(TEST_FRAMEWORK)
+AST_TEST_DEFINE(manager_compact_test)
+{
+	static const char event[] =
+		"Event: Hangup\r\nPrivilege: call,all\r\nChannel: SIP/100-00000001\r\n"
+		"X-Custom: \r\nCause-txt: Normal Clearing\r\n\r\n";
+	static const unsigned char expected[] = {
+		0, 0, 0, 0, 0,
+		1, 0, 6, 'H', 'a', 'n', 'g', 'u', 'p',
+		2, 0, 8, 'c', 'a', 'l', 'l', ',', 'a', 'l', 'l',
+		3, 0, 16, 'S', 'I', 'P', '/', '1', '0', '0', '-', '0', '0', '0', '0', '0', '0', '0', '1',
+		0, 8, 'X', '-', 'C', 'u', 's', 't', 'o', 'm', 0, 0,
+		18, 0, 15, 'N', 'o', 'r', 'm', 'a', 'l', ' ', 'C', 'l', 'e', 'a', 'r', 'i', 'n', 'g',
+	};
+	static const struct {
+		const char *events;
+		const char *header;
+		const char *value;
+		int prefix;
+		int subscribed;
+	} subscriptions[] = {
+		{ "Hangup", NULL, NULL, 0, 1 },
+		{ "newchannel,hangup", NULL, NULL, 0, 1 },
+		{ "Newchannel", NULL, NULL, 0, 0 },
+		{ "Hang", NULL, NULL, 0, 0 },
+		{ NULL, "Channel", "SIP/1", 1, 1 },
+		{ NULL, "Channel", "SIP/1", 0, 0 },
+		{ "Hangup", "channel", "SIP/100-00000001", 0, 1 },
+		{ "Hangup", "X-Custom", "", 0, 1 },
+		{ "Hangup", "Cause", "16", 0, 0 },
+	};
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct mansession_session session = { 0, };
+	struct event_subscription subscription;
+	struct ast_str *buf;
+	uint32_t framelen;
+	size_t len;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "manager_compact_test";
+		info->category = "/main/manager/";
+		info->summary = "Test the compact event encoding and event subscriptions";
+		info->description =
+			"Encodes an event in the compact encoding and checks it byte "
+			"for byte, and checks which subscriptions the event matches.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(buf = ast_str_create(16))) {
+		return AST_TEST_FAIL;
+	}
+	if ((len = compact_encode(event, &buf)) == sizeof(expected)) {
+		memcpy(&framelen, ast_str_buffer(buf) + 1, sizeof(framelen));
+	}
+	if (len != sizeof(expected)
+		|| memcmp(ast_str_buffer(buf) + 5, expected + 5, len - 5)
+		|| ast_str_buffer(buf)[0] || ntohl(framelen) != len - 5) {
+		ast_test_status_update(test, "The event was encoded in %zu bytes, not as expected in %zu\n",
+			len, sizeof(expected));
+		res = AST_TEST_FAIL;
+	}
+	ast_free(buf);
+
+	if (!session_subscribed(&session, (char *) event)) {
+		ast_test_status_update(test, "A session without subscriptions was not sent the event\n");
+		res = AST_TEST_FAIL;
+	}
+	for (i = 0; i < ARRAY_LEN(subscriptions); i++) {
+		char events[64] = "", *name, *names = events;
+
+		memset(&subscription, 0, sizeof(subscription));
+		ast_copy_string(events, S_OR(subscriptions[i].events, ""), sizeof(events));
+		while ((name = strsep(&names, ","))) {
+			if (!ast_strlen_zero(name)) {
+				subscription.events[subscription.nevents++] = name;
+			}
+		}
+		if (subscriptions[i].header) {
+			subscription.matches[0].header = subscriptions[i].header;
+			subscription.matches[0].headerlen = strlen(subscriptions[i].header);
+			subscription.matches[0].value = subscriptions[i].value;
+			subscription.matches[0].valuelen = strlen(subscriptions[i].value);
+			subscription.matches[0].prefix = subscriptions[i].prefix;
+			subscription.nmatches = 1;
+		}
+		AST_LIST_HEAD_INIT_NOLOCK(&session.subscriptions);
+		AST_LIST_INSERT_TAIL(&session.subscriptions, &subscription, list);
+		if (session_subscribed(&session, (char *) event) != subscriptions[i].subscribed) {
+			ast_test_status_update(test, "Subscription %d %s the event\n", i,
+				subscriptions[i].subscribed ? "did not match" : "matched");
+			res = AST_TEST_FAIL;
+		}
+	}
+
+	return res;
+}
+#endif	/* defined(TEST_FRAMEWORK) */
+
 static int __init_manager(int reload)
 {
 	struct ast_config *ucfg = NULL, *cfg = NULL;
 	const char *val;
 	char *cat = NULL;
 	int newhttptimeout = 60;
+	int eventqueuesize = DEFAULT_EVENTQUEUESIZE;
 	struct ast_manager_user *user = NULL;
 	struct ast_variable *var;
 	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
@@ -6692,12 +8011,17 @@ static int __init_manager(int reload)
 		ast_manager_register_xml("ModuleCheck", EVENT_FLAG_SYSTEM, manager_modulecheck);
 		ast_manager_register_xml("AOCMessage", EVENT_FLAG_AOC, action_aocmessage);
 		ast_manager_register_xml("Filter", EVENT_FLAG_SYSTEM, action_filter);
+		ast_manager_register_xml("Subscribe", 0, action_subscribe);
 
 		ast_cli_register_multiple(cli_manager, ARRAY_LEN(cli_manager));
 		ast_extension_state_add(NULL, NULL, manager_state_cb, NULL);
+		compact_headers_init();
+#if defined(TEST_FRAMEWORK)
+		AST_TEST_REGISTER(manager_event_ring_test);
+		AST_TEST_REGISTER(manager_event_filter_test);
+		AST_TEST_REGISTER(manager_compact_test);
+#endif	/* defined(TEST_FRAMEWORK) */
 		registered = 1;
-		/* Append placeholder event so master_eventq never runs dry */
-		append_event("Event: Placeholder\r\n\r\n", 0);
 	}
 	if ((cfg = ast_config_load2("manager.conf", "manager", config_flags)) == CONFIG_STATUS_FILEUNCHANGED) {
 		return 0;
@@ -6775,6 +8099,15 @@ static int __init_manager(int reload)
 			manager_debug = ast_true(val);
 		} else if (!strcasecmp(var->name, "httptimeout")) {
 			newhttptimeout = atoi(val);
+		} else if (!strcasecmp(var->name, "eventqueuesize")) {
+			if (sscanf(val, "%30d", &eventqueuesize) != 1 || eventqueuesize < 64) {
+				ast_log(LOG_WARNING, "Invalid eventqueuesize value '%s', using default value\n", val);
+				eventqueuesize = DEFAULT_EVENTQUEUESIZE;
+			} else if (eventqueuesize > MAX_EVENTQUEUESIZE) {
+				ast_log(LOG_WARNING, "eventqueuesize %d is larger than the maximum of %d kB, using that\n",
+					eventqueuesize, MAX_EVENTQUEUESIZE);
+				eventqueuesize = MAX_EVENTQUEUESIZE;
+			}
 		} else if (!strcasecmp(var->name, "authtimeout")) {
 			int timeout = atoi(var->value);
 
@@ -6816,6 +8149,16 @@ static int __init_manager(int reload)
 		ast_sockaddr_from_sin(&amis_desc.local_address, &amis_desc_local_address_tmp);
 	}
 
+	/* Sessions read the event queue without locks, so its size is only set once */
+	if (!event_ring.buf) {
+		if (event_ring_init(&event_ring, (size_t) eventqueuesize * 1024)) {
+			ast_log(LOG_ERROR, "Unable to allocate the manager event queue\n");
+		}
+		loaded_eventqueuesize = eventqueuesize;
+	} else if (eventqueuesize != loaded_eventqueuesize) {
+		ast_log(LOG_NOTICE, "A new eventqueuesize in manager.conf takes effect on restart\n");
+	}
+
 	AST_RWLIST_WRLOCK(&users);
 
 	/* First, get users from users.conf */
@@ -805,6 +805,7 @@ static struct ast_taskprocessor *device_state_tps;
 
 AST_THREADSTORAGE(switch_data);
 AST_THREADSTORAGE(extensionstate_buf);
+AST_THREADSTORAGE(exten_cache_buf);
 
 /*!
    \brief ast_exten: An extension
@@ -895,6 +896,7 @@ struct ast_context {
 	int refcount;                   /*!< each module that would have created this context should inc/dec this as appropriate */
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;	/*!< Alternative switches */
 	ast_mutex_t macrolock;			/*!< A lock to implement "exclusive" macros - held whilst a call is executing in the macro */
+	int has_cidmatch;			/*!< Set once an extension matching on Caller*ID is added */
 	char name[0];				/*!< Name of the context */
 };
 
@@ -1260,6 +1262,23 @@ static struct varshead globals = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
 
 static int autofallthrough = 1;
 static int extenpatternmatchnew = 0;
+
+/*!
+ * \brief Dialplan generation
+ *
+ * \details
+ * Bumped whenever an extension is added or freed, a context is freed or
+ * replaced, or the match algorithm changes.  Matches remembered by the
+ * per-thread extension caches are only valid for the generation they were
+ * found in.
+ */
+static int dialplan_version;
+
+static void dialplan_changed(void)
+{
+	ast_atomic_fetchadd_int(&dialplan_version, +1);
+}
+
 static char *overrideswitch = NULL;
 
 /*! \brief Subscription for device state change events */
@@ -2771,6 +2790,7 @@ struct fake_context /* this struct is purely for matching in the hashtab */
 	int refcount;
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;
 	ast_mutex_t macrolock;
+	int has_cidmatch;
 	char name[256];
 };
 
@@ -2816,6 +2836,68 @@ static int matchcid(const char *cidpattern, const char *callerid)
 	return ast_extension_match(cidpattern, callerid);
 }
 
+/*! \brief Number of matches each thread remembers */
+#define EXTEN_CACHE_SIZE 16
+
+/*! \brief A match remembered by a thread */
+struct exten_cache_entry {
+	int version;			/*!< Dialplan generation the match was found in */
+	struct ast_context *context;	/*!< Context searched */
+	struct ast_exten *eroot;	/*!< First extension of the context matching exten */
+	char exten[AST_MAX_EXTENSION];	/*!< Extension searched for */
+};
+
+/*!
+ * \brief Per-thread extension cache
+ *
+ * \details
+ * A channel runs the priorities of an extension one at a time, and each of
+ * them searches the context for the extension again.  For a pattern that
+ * means matching every extension sorted before it, so the first match found
+ * in a context is remembered here and later searches for the same extension
+ * only look up the priority.  Contexts matching on Caller*ID are not cached.
+ */
+struct exten_cache {
+	struct exten_cache_entry entries[EXTEN_CACHE_SIZE];
+};
+
+static struct exten_cache_entry *exten_cache_slot(struct ast_context *con, const char *exten)
+{
+	struct exten_cache *cache;
+
+	if (!(cache = ast_threadstorage_get(&exten_cache_buf, sizeof(*cache)))) {
+		return NULL;
+	}
+
+	return &cache->entries[(ast_hashtab_hash_string(exten) ^ ((uintptr_t) con >> 4)) % EXTEN_CACHE_SIZE];
+}
+
+static struct ast_exten *exten_cache_find(struct ast_context *con, const char *exten)
+{
+	struct exten_cache_entry *entry = exten_cache_slot(con, exten);
+
+	if (!entry || entry->context != con || entry->version != dialplan_version
+		|| strcmp(entry->exten, exten)) {
+		return NULL;
+	}
+
+	return entry->eroot;
+}
+
+static void exten_cache_store(struct ast_context *con, const char *exten, struct ast_exten *eroot, int version)
+{
+	struct exten_cache_entry *entry;
+
+	if (strlen(exten) >= sizeof(entry->exten) || !(entry = exten_cache_slot(con, exten))) {
+		return;
+	}
+
+	entry->version = version;
+	entry->context = con;
+	entry->eroot = eroot;
+	strcpy(entry->exten, exten);
+}
+
 struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	struct ast_context *bypass, struct pbx_find_info *q,
 	const char *context, const char *exten, int priority,
@@ -2829,6 +2911,7 @@ struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	struct ast_exten pattern = {NULL, };
 	struct scoreboard score = {0, };
 	struct ast_str *tmpdata = NULL;
+	int version = dialplan_version, cacheable;
 
 	pattern.label = label;
 	pattern.priority = priority;
@@ -2942,9 +3025,44 @@ struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 		}
 	} while (0);
 
+	/*
+	 * An exact match, or a match this thread found before, only needs the
+	 * priority looked up.  If it is not there the context is searched.
+	 */
+	cacheable = (action & E_MATCH_MASK) == E_MATCH && !tmp->has_cidmatch;
+	if (cacheable) {
+		eroot = NULL;
+		if (!extenpatternmatchnew && exten[0] != '_' && tmp->root_table) {
+			/* Literal extensions sort first and only match themselves */
+			struct ast_exten key = { .exten = (char *) exten, };
+
+			eroot = ast_hashtab_lookup(tmp->root_table, &key);
+		}
+		if (!eroot) {
+			eroot = exten_cache_find(tmp, exten);
+		}
+		if (eroot) {
+			if (action == E_FINDLABEL && label) {
+				e = ast_hashtab_lookup(eroot->peer_label_table, &pattern);
+			} else {
+				e = ast_hashtab_lookup(eroot->peer_table, &pattern);
+			}
+			if (e) {
+				q->status = STATUS_SUCCESS;
+				q->foundcontext = context;
+				return e;
+			}
+			eroot = NULL;
+		}
+	}
+
 	if (extenpatternmatchnew) {
 		new_find_extension(exten, &score, tmp->pattern_tree, 0, 0, callerid, label, action);
 		eroot = score.exten;
+		if (eroot && cacheable && action != E_FINDLABEL) {
+			/* The best match does not depend on the priority, but can on the label */
+			exten_cache_store(tmp, exten, eroot, version);
+		}
 
 		if (score.last_char == '!' && action == E_MATCHMORE) {
 			/* We match an extension ending in '!'.
@@ -3022,6 +3140,11 @@ struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 
 			if (!match || (eroot->matchcid && !matchcid(eroot->cidmatch, callerid)))
 				continue;	/* keep trying */
+			if (cacheable) {
+				/* Only the first match is the same whatever the priority */
+				exten_cache_store(tmp, exten, eroot, version);
+				cacheable = 0;
+			}
 			if (match == 2 && action == E_MATCHMORE) {
 				/* We match an extension ending in '!'.
 				 * The decision in this case is final and is NULL (no match).
@@ -5462,6 +5585,8 @@ static void decrease_call_count(void)
 
 static void destroy_exten(struct ast_exten *e)
 {
+	dialplan_changed();
+
 	if (e->priority == PRIORITY_HINT)
 		ast_remove_hint(e);
 
@@ -5567,6 +5692,7 @@ int pbx_set_extenpatternmatchnew(int newval)
 {
 	int oldval = extenpatternmatchnew;
 	extenpatternmatchnew = newval;
+	dialplan_changed();
 	return oldval;
 }
 
@@ -7617,6 +7743,7 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 	/* move in the new table and list */
 	contexts_table = exttable;
 	contexts = *extcontexts;
+	dialplan_changed();
 
 	/*
 	 * Restore the watchers for hints that can be found; notify
@@ -8722,6 +8849,10 @@ static int ast_add_extension2_lockopt(struct ast_context *con,
 		ast_wrlock_context(con);
 	}
 
+	if (tmp->matchcid) {
+		con->has_cidmatch = 1;
+	}
+
 	if (con->pattern_tree) { /* usually, on initial load, the pattern_tree isn't formed until the first find_exten; so if we are adding
 								an extension, and the trie exists, then we need to incrementally add this pattern to it. */
 		ast_copy_string(dummy_name, extension, sizeof(dummy_name));
@@ -8819,6 +8950,7 @@ static int ast_add_extension2_lockopt(struct ast_context *con,
 			ast_add_hint(tmp);
 		}
 	}
+	dialplan_changed();
 	if (option_debug) {
 		if (tmp->matchcid) {
 			ast_debug(1, "Added extension '%s' priority %d (CID match '%s') to %s (%p)\n",
@@ -9263,6 +9395,8 @@ static void __ast_internal_context_destroy( struct ast_context *con)
 	if (tmp->pattern_tree)
 		destroy_pattern_tree(tmp->pattern_tree);
 
+	dialplan_changed();
+
 	while ((sw = AST_LIST_REMOVE_HEAD(&tmp->alts, list)))
 		ast_free(sw);
 	for (e = tmp->root; e;) {
@@ -47,16 +47,45 @@ struct tps_task {
 	int (*execute)(void *datap);
 	/*! \brief The data pointer for the task execute() function */
 	void *datap;
-	/*! \brief AST_LIST_ENTRY overhead */
-	AST_LIST_ENTRY(tps_task) list;
+	/*! \brief When the task was pushed */
+	struct timeval when;
+	/*! \brief The next task in the queue or in a task cache */
+	struct tps_task *volatile next;
 };
 
+/*!
+ * \brief A task queue that any number of threads push to and a single thread pops from
+ *
+ * Pushing swaps the new task in as the head without a lock.  The consumer pops
+ * from the tail.  The stub task keeps the queue from ever running out of tasks
+ * to link to.
+ */
+struct tps_queue {
+	/*! \brief The task pushed last */
+	struct tps_task *volatile head;
+	/*! \brief The task to pop next, only used by the consumer */
+	struct tps_task *tail;
+	/*! \brief Placeholder task, never executed */
+	struct tps_task stub;
+#if !defined(HAVE_GCC_ATOMICS)
+	/*! \brief Serializes producers on platforms without atomic exchange */
+	ast_mutex_t lock;
+#endif
+};
+
+/*! \brief Number of queue latency histogram buckets, the last one is about 16 seconds */
+#define TPS_LATENCY_BUCKETS 25
+
 /*! \brief tps_taskprocessor_stats maintain statistics for a taskprocessor. */
 struct tps_taskprocessor_stats {
 	/*! \brief This is the maximum number of tasks queued at any one time */
 	unsigned long max_qsize;
 	/*! \brief This is the current number of tasks processed */
 	unsigned long _tasks_processed_count;
+	/*! \brief Bucket n counts the tasks that waited less than 2^n microseconds in the queue */
+	unsigned long latency[TPS_LATENCY_BUCKETS];
+	/*! \brief The longest time a task waited in the queue, in microseconds */
+	int64_t max_latency;
 };
 
 /*! \brief A ast_taskprocessor structure is a singleton by name */
@@ -71,15 +100,88 @@ struct ast_taskprocessor {
 	ast_mutex_t taskprocessor_lock;
 	/*! \brief Taskprocesor thread run flag */
 	unsigned char poll_thread_run;
+	/*! \brief Tasks run on the shared thread pool instead of poll_thread */
+	unsigned char pooled;
+	/*! \brief Number of pool threads running tasks of this taskprocessor */
+	int executing;
+	/*! \brief The pool thread that last started running tasks of this taskprocessor */
+	pthread_t executor;
+	/*! \brief Number of references handed out by ast_taskprocessor_get() */
+	int users;
 	/*! \brief Taskprocessor statistics */
 	struct tps_taskprocessor_stats *stats;
 	/*! \brief Taskprocessor current queue size */
-	long tps_queue_size;
+	int tps_queue_size;
 	/*! \brief Taskprocessor queue */
-	AST_LIST_HEAD_NOLOCK(tps_queue, tps_task) tps_queue;
+	struct tps_queue tps_queue;
 	/*! \brief Taskprocessor singleton list entry */
 	AST_LIST_ENTRY(ast_taskprocessor) list;
+	/*! \brief Entry in the ready list of a pool thread */
+	AST_LIST_ENTRY(ast_taskprocessor) pool_list;
+};
+
+/*! \brief A thread of the taskprocessor pool and its list of taskprocessors ready to run */
+struct tps_pool_worker {
+	pthread_t thread;
+	ast_mutex_t lock;
+	AST_LIST_HEAD_NOLOCK(, ast_taskprocessor) ready;
+	int index;
+};
+
+/*!
+ * \brief The thread pool shared by the taskprocessors created with TPS_POOLED
+ *
+ * A taskprocessor with queued tasks is on the ready list of exactly one pool
+ * thread, or is being run by one, so its tasks still run one at a time in FIFO
+ * order.  A pool thread with nothing ready takes taskprocessors from the ready
+ * lists of the others before going to sleep.  A pooled task that blocks holds
+ * up its pool thread, so pooled tasks must be short and must not block.
+ */
+static struct {
+	struct tps_pool_worker *workers;
+	int n_workers;
+	/*! \brief Round robin choice of the pool thread to schedule on */
+	int next;
+	/*! \brief Number of pool threads waiting for work */
+	int idle;
+	ast_mutex_t lock;
+	ast_cond_t cond;
+} tps_pool;
+
+/*! \brief Largest number of pool threads */
+#define TPS_POOL_MAX_THREADS 64
+/*! \brief Tasks a pool thread runs from one taskprocessor before moving on to the next */
+#define TPS_POOL_BATCH 32
+
+/*!
+ * \brief A per-thread cache of tps_task structures
+ *
+ * Tasks are usually freed by a different thread than the one that allocated
+ * them, so full caches hand half their tasks to a global cache, and empty ones
+ * refill from it, a batch at a time.
+ */
+struct tps_thread_cache {
+	struct tps_task *tasks;
+	int count;
+	/*! \brief Set if this thread is a pool thread */
+	struct tps_pool_worker *worker;
 };
+
+#if !defined(LOW_MEMORY)
+#define TPS_TASK_CACHE_MAX 64
+#define TPS_TASK_CACHE_BATCH (TPS_TASK_CACHE_MAX / 2)
+#define TPS_TASK_GLOBAL_CACHE_MAX 4096
+
+/*! \brief The global task cache */
+AST_MUTEX_DEFINE_STATIC(tps_task_cache_lock);
+static struct tps_task *tps_task_cache;
+static int tps_task_cache_count;
+#endif
+
+static void tps_thread_cache_cleanup(void *data);
+
+AST_THREADSTORAGE_CUSTOM(tps_thread_cache, NULL, tps_thread_cache_cleanup);
+
 #define TPS_MAX_BUCKETS 7
 /*! \brief tps_singletons is the astobj2 container for taskprocessor singletons */
 static struct ao2_container *tps_singletons;
@@ -104,12 +206,6 @@ static void tps_taskprocessor_destroy(void *tps);
 /*! \brief CLI <example>taskprocessor ping &lt;blah&gt;</example> handler function */
 static int tps_ping_handler(void *datap);
 
-/*! \brief Remove the front task off the taskprocessor queue */
-static struct tps_task *tps_taskprocessor_pop(struct ast_taskprocessor *tps);
-
-/*! \brief Return the size of the taskprocessor queue */
-static int tps_taskprocessor_depth(struct ast_taskprocessor *tps);
-
 static char *cli_tps_ping(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
 static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
 
@@ -127,31 +223,285 @@ int ast_tps_init(void)
 	}
 
 	ast_cond_init(&cli_ping_cond, NULL);
+	ast_mutex_init(&tps_pool.lock);
+	ast_cond_init(&tps_pool.cond, NULL);
 
 	ast_cli_register_multiple(taskprocessor_clis, ARRAY_LEN(taskprocessor_clis));
 	return 0;
 }
 
+#if !defined(LOW_MEMORY)
+/* return the tasks cached by an exiting thread to the global cache */
+static void tps_thread_cache_cleanup(void *data)
+{
+	struct tps_thread_cache *cache = data;
+	struct tps_task *t;
+
+	while ((t = cache->tasks)) {
+		cache->tasks = t->next;
+		ast_mutex_lock(&tps_task_cache_lock);
+		if (tps_task_cache_count < TPS_TASK_GLOBAL_CACHE_MAX) {
+			t->next = tps_task_cache;
+			tps_task_cache = t;
+			tps_task_cache_count++;
+			t = NULL;
+		}
+		ast_mutex_unlock(&tps_task_cache_lock);
+		ast_free(t);
+	}
+	ast_free(cache);
+}
+#else
+static void tps_thread_cache_cleanup(void *data)
+{
+	ast_free(data);
+}
+#endif
+
 /* allocate resources for the task */
 static struct tps_task *tps_task_alloc(int (*task_exe)(void *datap), void *datap)
 {
-	struct tps_task *t;
-	if ((t = ast_calloc(1, sizeof(*t)))) {
-		t->execute = task_exe;
-		t->datap = datap;
+	struct tps_task *t = NULL;
+#if !defined(LOW_MEMORY)
+	struct tps_thread_cache *cache;
+
+	if ((cache = ast_threadstorage_get(&tps_thread_cache, sizeof(*cache)))) {
+		if (!cache->tasks && tps_task_cache_count) {
+			/* Refill a batch from the global cache */
+			ast_mutex_lock(&tps_task_cache_lock);
+			while (tps_task_cache && cache->count < TPS_TASK_CACHE_BATCH) {
+				t = tps_task_cache;
+				tps_task_cache = t->next;
+				tps_task_cache_count--;
+				t->next = cache->tasks;
+				cache->tasks = t;
+				cache->count++;
+			}
+			ast_mutex_unlock(&tps_task_cache_lock);
+		}
+		if ((t = cache->tasks)) {
+			cache->tasks = t->next;
+			cache->count--;
+		}
+	}
+#endif
+	if (!t && !(t = ast_malloc(sizeof(*t)))) {
+		return NULL;
 	}
+	t->execute = task_exe;
+	t->datap = datap;
+	t->next = NULL;
 	return t;
 }
 
 /* release task resources */	
 static void *tps_task_free(struct tps_task *task)
 {
-	if (task) {
-		ast_free(task);
+#if !defined(LOW_MEMORY)
+	struct tps_thread_cache *cache;
+	struct tps_task *t;
+#endif
+
+	if (!task) {
+		return NULL;
+	}
+#if !defined(LOW_MEMORY)
+	if ((cache = ast_threadstorage_get(&tps_thread_cache, sizeof(*cache)))) {
+		task->next = cache->tasks;
+		cache->tasks = task;
+		if (++cache->count > TPS_TASK_CACHE_MAX) {
+			/* Hand a batch to the global cache, free what does not fit */
+			ast_mutex_lock(&tps_task_cache_lock);
+			while (cache->count > TPS_TASK_CACHE_BATCH) {
+				t = cache->tasks;
+				cache->tasks = t->next;
+				cache->count--;
+				if (tps_task_cache_count < TPS_TASK_GLOBAL_CACHE_MAX) {
+					t->next = tps_task_cache;
+					tps_task_cache = t;
+					tps_task_cache_count++;
+				} else {
+					ast_free(t);
+				}
+			}
+			ast_mutex_unlock(&tps_task_cache_lock);
+		}
+		return NULL;
+	}
+#endif
+	ast_free(task);
+	return NULL;
+}
+
+/* initialize an empty task queue */
+static void tps_queue_init(struct tps_queue *q)
+{
+	q->stub.next = NULL;
+	q->head = &q->stub;
+	q->tail = &q->stub;
+#if !defined(HAVE_GCC_ATOMICS)
+	ast_mutex_init(&q->lock);
+#endif
+}
+
+/* append a task to the queue, safe to call from any number of threads at once */
+static void tps_queue_push(struct tps_queue *q, struct tps_task *t)
+{
+	struct tps_task *prev;
+
+	t->next = NULL;
+#if defined(HAVE_GCC_ATOMICS)
+	/* The NULL next must be visible before the task can be reached */
+	__sync_synchronize();
+	prev = __sync_lock_test_and_set(&q->head, t);
+	prev->next = t;
+#else
+	ast_mutex_lock(&q->lock);
+	prev = q->head;
+	q->head = t;
+	prev->next = t;
+	ast_mutex_unlock(&q->lock);
+#endif
+}
+
+/* the task pushed last */
+static struct tps_task *tps_queue_head(struct tps_queue *q)
+{
+#if defined(HAVE_GCC_ATOMICS)
+	__sync_synchronize();
+	return q->head;
+#else
+	struct tps_task *head;
+
+	ast_mutex_lock(&q->lock);
+	head = q->head;
+	ast_mutex_unlock(&q->lock);
+	return head;
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Remove the front task off the taskprocessor queue
+ *
+ * \note Only the thread running the tasks of the taskprocessor may call this.
+ *
+ * \return The task, or NULL if the queue is empty or the task at the front is
+ * still being linked in by tps_queue_push().
+ */
+static struct tps_task *tps_taskprocessor_pop(struct ast_taskprocessor *tps)
+{
+	struct tps_queue *q = &tps->tps_queue;
+	struct tps_task *tail = q->tail;
+	struct tps_task *next = tail->next;
+
+	if (tail == &q->stub) {
+		if (!next) {
+			return NULL;
+		}
+		q->tail = next;
+		tail = next;
+		next = next->next;
+	}
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+	if (tail != tps_queue_head(q)) {
+		/* A push is half done */
+		return NULL;
+	}
+	/* tail is the last task, put the stub behind it so it can be removed */
+	tps_queue_push(q, &q->stub);
+	if ((next = tail->next)) {
+		q->tail = next;
+		return tail;
 	}
 	return NULL;
 }
 
+/* account for the time a task waited in the queue */
+static void tps_stats_latency(struct tps_taskprocessor_stats *stats, struct timeval when)
+{
+	int64_t usecs = ast_tvdiff_us(ast_tvnow(), when);
+	int bucket;
+
+	if (usecs > stats->max_latency) {
+		stats->max_latency = usecs;
+	}
+	for (bucket = 0; bucket < TPS_LATENCY_BUCKETS - 1 && usecs >= (1LL << bucket); bucket++);
+	stats->latency[bucket]++;
+}
+
+/*!
+ * \internal
+ * \brief Get a queue latency percentile from the histogram of a taskprocessor
+ *
+ * \return The upper bound in microseconds of the histogram bucket holding the
+ * percentile, or 0 if no tasks were processed
+ */
+static int64_t tps_stats_percentile(const struct tps_taskprocessor_stats *stats, int percent)
+{
+	unsigned long total = 0;
+	unsigned long count = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < TPS_LATENCY_BUCKETS; bucket++) {
+		total += stats->latency[bucket];
+	}
+	if (!total) {
+		return 0;
+	}
+	for (bucket = 0; bucket < TPS_LATENCY_BUCKETS - 1; bucket++) {
+		count += stats->latency[bucket];
+		if (count * 100 >= total * percent) {
+			break;
+		}
+	}
+	return bucket < TPS_LATENCY_BUCKETS - 1 ? (1LL << bucket) : stats->max_latency;
+}
+
+/*!
+ * \internal
+ * \brief Run the queued tasks of a taskprocessor
+ *
+ * \param tps The taskprocessor
+ * \param limit Largest number of tasks to run, or 0 to run until the queue is empty
+ *
+ * \retval 0 the queue is empty
+ * \retval 1 tasks remain, or the taskprocessor is being stopped
+ */
+static int tps_taskprocessor_run(struct ast_taskprocessor *tps, int limit)
+{
+	struct tps_task *t;
+	int size;
+	int count;
+
+	for (count = 0; !limit || count < limit; count++) {
+		if (!tps->poll_thread_run) {
+			return 1;
+		}
+		if (!(t = tps_taskprocessor_pop(tps))) {
+			return 1;
+		}
+		size = tps->tps_queue_size;
+
+		/* Only this thread updates the statistics */
+		tps_stats_latency(tps->stats, t->when);
+		t->execute(t->datap);
+		tps->stats->_tasks_processed_count++;
+		if (size > tps->stats->max_qsize) {
+			tps->stats->max_qsize = size;
+		}
+		tps_task_free(t);
+
+		if (ast_atomic_dec_and_test(&tps->tps_queue_size)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /* taskprocessor tab completion */
 static char *tps_taskprocessor_tab_complete(struct ast_taskprocessor *p, struct ast_cli_args *a) 
 {
@@ -220,8 +570,9 @@ static char *cli_tps_ping(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 	ts.tv_nsec = when.tv_usec * 1000;
 	ast_mutex_lock(&cli_ping_cond_lock);
 	if (ast_taskprocessor_push(tps, tps_ping_handler, 0) < 0) {
+		ast_mutex_unlock(&cli_ping_cond_lock);
 		ast_cli(a->fd, "\nping failed: could not push task to %s\n\n", name);
-		ao2_ref(tps, -1);
+		ast_taskprocessor_unreference(tps);
 		return CLI_FAILURE;
 	}
 	ast_cond_timedwait(&cli_ping_cond, &cli_ping_cond_lock, &ts);
@@ -229,7 +580,7 @@ static char *cli_tps_ping(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 	end = ast_tvnow();
 	delta = ast_tvsub(end, begin);
 	ast_cli(a->fd, "\n\t%24s ping time: %.1ld.%.6ld sec\n\n", name, (long)delta.tv_sec, (long int)delta.tv_usec);
-	ao2_ref(tps, -1);
+	ast_taskprocessor_unreference(tps);
 	return CLI_SUCCESS;	
 }
 
@@ -237,6 +588,7 @@ static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 {
 	char name[256];
 	int tcount;
+	int pooled = 0;
 	unsigned long qsize;
 	unsigned long maxqsize;
 	unsigned long processed;
@@ -248,7 +600,11 @@ static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 		e->command = "core show taskprocessors";
 		e->usage = 
 			"Usage: core show taskprocessors\n"
-			"	Shows a list of instantiated task processors and their statistics\n";
+			"	Shows a list of instantiated task processors and their statistics.\n"
+			"	The queue latency columns are the time that 50%, 90% and 99% of\n"
+			"	the tasks waited in the queue, rounded up to a power of two, and\n"
+			"	the longest wait, in microseconds.  Task processors marked with\n"
+			"	a * run on the shared thread pool.\n";
 		return NULL;
 	case CLI_GENERATE:
 		return NULL;	
@@ -257,19 +613,25 @@ static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 	if (a->argc != e->args)
 		return CLI_SHOWUSAGE;
 
-	ast_cli(a->fd, "\n\t+----- Processor -----+--- Processed ---+- In Queue -+- Max Depth -+");
+	ast_cli(a->fd, "\n\t+----- Processor -----+--- Processed ---+- In Queue -+- Max Depth -+----------- Queue Latency (usec) ----------+");
+	ast_cli(a->fd, "\n\t%70s %10s %10s %10s", "p50", "p90", "p99", "max");
 	i = ao2_iterator_init(tps_singletons, 0);
 	while ((p = ao2_iterator_next(&i))) {
 		ast_copy_string(name, p->name, sizeof(name));
 		qsize = p->tps_queue_size;
 		maxqsize = p->stats->max_qsize;
 		processed = p->stats->_tasks_processed_count;
-		ast_cli(a->fd, "\n%24s   %17ld %12ld %12ld", name, processed, qsize, maxqsize);
+		ast_cli(a->fd, "\n%23s%c   %17ld %12ld %12ld %10ld %10ld %10ld %10ld", name, p->pooled ? '*' : ' ',
+			processed, qsize, maxqsize,
+			(long) tps_stats_percentile(p->stats, 50), (long) tps_stats_percentile(p->stats, 90),
+			(long) tps_stats_percentile(p->stats, 99), (long) p->stats->max_latency);
+		pooled += p->pooled;
 		ao2_ref(p, -1);
 	}
 	ao2_iterator_destroy(&i);
 	tcount = ao2_container_count(tps_singletons); 
-	ast_cli(a->fd, "\n\t+---------------------+-----------------+------------+-------------+\n\t%d taskprocessors\n\n", tcount);
+	ast_cli(a->fd, "\n\t+---------------------+-----------------+------------+-------------+-------------------------------------------+\n\t%d taskprocessors, %d on a pool of %d threads\n\n",
+		tcount, pooled, tps_pool.n_workers);
 	return CLI_SUCCESS;	
 }
 
@@ -277,8 +639,6 @@ static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 static void *tps_processing_function(void *data)
 {
 	struct ast_taskprocessor *i = data;
-	struct tps_task *t;
-	int size;
 
 	if (!i) {
 		ast_log(LOG_ERROR, "cannot start thread_function loop without a ast_taskprocessor structure.\n");
@@ -286,48 +646,175 @@ static void *tps_processing_function(void *data)
 	}
 
 	while (i->poll_thread_run) {
- 		ast_mutex_lock(&i->taskprocessor_lock);
- 		if (!i->poll_thread_run) {
-  			ast_mutex_unlock(&i->taskprocessor_lock);
- 			break;
-  		}
- 		if (!(size = tps_taskprocessor_depth(i))) {
- 			ast_cond_wait(&i->poll_cond, &i->taskprocessor_lock);
-  			if (!i->poll_thread_run) {
-  				ast_mutex_unlock(&i->taskprocessor_lock);
-	  			break;
+		ast_mutex_lock(&i->taskprocessor_lock);
+		while (i->poll_thread_run && !i->tps_queue_size) {
+			ast_cond_wait(&i->poll_cond, &i->taskprocessor_lock);
+		}
+		ast_mutex_unlock(&i->taskprocessor_lock);
+
+		/* stuff is in the queue */
+		if (tps_taskprocessor_run(i, 0)) {
+			/* A push is half done, give it a chance to finish */
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/* pick the next taskprocessor to run, stealing from the other pool threads if there is none of our own */
+static struct ast_taskprocessor *tps_pool_next(struct tps_pool_worker *self)
+{
+	struct tps_pool_worker *w;
+	struct ast_taskprocessor *tps;
+	int n;
+
+	for (n = 0; n < tps_pool.n_workers; n++) {
+		w = &tps_pool.workers[(self->index + n) % tps_pool.n_workers];
+		ast_mutex_lock(&w->lock);
+		tps = AST_LIST_REMOVE_HEAD(&w->ready, pool_list);
+		ast_mutex_unlock(&w->lock);
+		if (tps) {
+			return tps;
+		}
+	}
+	return NULL;
+}
+
+/* put a taskprocessor on the ready list of a pool thread and wake a sleeping one */
+static void tps_pool_ready(struct tps_pool_worker *w, struct ast_taskprocessor *tps)
+{
+	ast_mutex_lock(&w->lock);
+	AST_LIST_INSERT_TAIL(&w->ready, tps, pool_list);
+	ast_mutex_unlock(&w->lock);
+
+	ast_mutex_lock(&tps_pool.lock);
+	if (tps_pool.idle) {
+		ast_cond_signal(&tps_pool.cond);
+	}
+	ast_mutex_unlock(&tps_pool.lock);
+}
+
+/* schedule a pooled taskprocessor whose queue just became non-empty */
+static void tps_pool_schedule(struct ast_taskprocessor *tps)
+{
+	struct tps_thread_cache *cache = ast_threadstorage_get(&tps_thread_cache, sizeof(*cache));
+	struct tps_pool_worker *w;
+
+	/* The pool holds a reference while the taskprocessor is ready or running */
+	ao2_ref(tps, +1);
+	if (cache && cache->worker) {
+		/* Pushed from a task on the pool, keep it on this thread */
+		w = cache->worker;
+	} else {
+		w = &tps_pool.workers[(unsigned int) ast_atomic_fetchadd_int(&tps_pool.next, 1) % tps_pool.n_workers];
+	}
+	tps_pool_ready(w, tps);
+}
+
+/* run a batch of tasks of a pooled taskprocessor */
+static void tps_pool_run(struct tps_pool_worker *self, struct ast_taskprocessor *tps)
+{
+	int more;
+
+	ast_mutex_lock(&tps->taskprocessor_lock);
+	if (!tps->poll_thread_run) {
+		ast_mutex_unlock(&tps->taskprocessor_lock);
+		ao2_ref(tps, -1);
+		return;
+	}
+	tps->executing++;
+	tps->executor = pthread_self();
+	ast_mutex_unlock(&tps->taskprocessor_lock);
+
+	more = tps_taskprocessor_run(tps, TPS_POOL_BATCH);
+
+	ast_mutex_lock(&tps->taskprocessor_lock);
+	tps->executing--;
+	if (!tps->poll_thread_run) {
+		ast_cond_broadcast(&tps->poll_cond);
+		more = 0;
+	}
+	ast_mutex_unlock(&tps->taskprocessor_lock);
+
+	if (more) {
+		/* Let the other ready taskprocessors run before the rest of the queue */
+		tps_pool_ready(self, tps);
+	} else {
+		ao2_ref(tps, -1);
+	}
+}
+
+/* this is the function run by the threads of the pool */
+static void *tps_pool_function(void *data)
+{
+	struct tps_pool_worker *self = data;
+	struct tps_thread_cache *cache;
+	struct ast_taskprocessor *tps;
+	int n;
+
+	if ((cache = ast_threadstorage_get(&tps_thread_cache, sizeof(*cache)))) {
+		cache->worker = self;
+	}
+
+	for (;;) {
+		if ((tps = tps_pool_next(self))) {
+			tps_pool_run(self, tps);
+			continue;
+		}
+
+		ast_mutex_lock(&tps_pool.lock);
+		tps_pool.idle++;
+		/* Check again now that a push will see us idle */
+		for (n = 0; n < tps_pool.n_workers; n++) {
+			if (!AST_LIST_EMPTY(&tps_pool.workers[n].ready)) {
+				break;
 			}
-  		}
-  		ast_mutex_unlock(&i->taskprocessor_lock);
- 		/* stuff is in the queue */
- 		if (!(t = tps_taskprocessor_pop(i))) {
- 			ast_log(LOG_ERROR, "Wtf?? %d tasks in the queue, but we're popping blanks!\n", size);
- 			continue;
- 		}
- 		if (!t->execute) {
- 			ast_log(LOG_WARNING, "Task is missing a function to execute!\n");
- 			tps_task_free(t);
- 			continue;
- 		}
- 		t->execute(t->datap);
- 
- 		ast_mutex_lock(&i->taskprocessor_lock);
- 		if (i->stats) {
- 			i->stats->_tasks_processed_count++;
- 			if (size > i->stats->max_qsize) {
- 				i->stats->max_qsize = size;
- 			}
- 		}
- 		ast_mutex_unlock(&i->taskprocessor_lock);
- 
- 		tps_task_free(t);
-  	}
-	while ((t = tps_taskprocessor_pop(i))) {
-		tps_task_free(t);
+		}
+		if (n == tps_pool.n_workers) {
+			ast_cond_wait(&tps_pool.cond, &tps_pool.lock);
+		}
+		tps_pool.idle--;
+		ast_mutex_unlock(&tps_pool.lock);
 	}
+
 	return NULL;
 }
 
+/* start the thread pool, called with the taskprocessor container locked */
+static int tps_pool_start(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n;
+
+	if (tps_pool.n_workers) {
+		return 0;
+	}
+
+	n = MAX(2, MIN(cpus, TPS_POOL_MAX_THREADS));
+	if (!(tps_pool.workers = ast_calloc(n, sizeof(*tps_pool.workers)))) {
+		return -1;
+	}
+	for (tps_pool.n_workers = 0; tps_pool.n_workers < n; tps_pool.n_workers++) {
+		struct tps_pool_worker *w = &tps_pool.workers[tps_pool.n_workers];
+
+		w->index = tps_pool.n_workers;
+		ast_mutex_init(&w->lock);
+		if (ast_pthread_create_background(&w->thread, NULL, tps_pool_function, w)) {
+			ast_log(LOG_WARNING, "Taskprocessor pool started with %d threads instead of %d\n",
+				tps_pool.n_workers, n);
+			ast_mutex_destroy(&w->lock);
+			break;
+		}
+	}
+	if (!tps_pool.n_workers) {
+		ast_free(tps_pool.workers);
+		tps_pool.workers = NULL;
+		return -1;
+	}
+	ast_verb(3, "Started taskprocessor pool with %d threads\n", tps_pool.n_workers);
+	return 0;
+}
+
 /* hash callback for astobj2 */
 static int tps_hash_cb(const void *obj, const int flags)
 {
@@ -348,6 +835,7 @@ static int tps_cmp_cb(void *obj, void *arg, int flags)
 static void tps_taskprocessor_destroy(void *tps)
 {
 	struct ast_taskprocessor *t = tps;
+	struct tps_task *task;
 
 	if (!tps) {
 		ast_log(LOG_ERROR, "missing taskprocessor\n");
@@ -359,10 +847,19 @@ static void tps_taskprocessor_destroy(void *tps)
 	t->poll_thread_run = 0;
 	ast_cond_signal(&t->poll_cond);
 	ast_mutex_unlock(&t->taskprocessor_lock);
-	pthread_join(t->poll_thread, NULL);
+	if (t->poll_thread != AST_PTHREADT_NULL) {
+		pthread_join(t->poll_thread, NULL);
+	}
 	t->poll_thread = AST_PTHREADT_NULL;
+	/* tasks still queued are not run */
+	while ((task = tps_taskprocessor_pop(t))) {
+		tps_task_free(task);
+	}
 	ast_mutex_destroy(&t->taskprocessor_lock);
 	ast_cond_destroy(&t->poll_cond);
+#if !defined(HAVE_GCC_ATOMICS)
+	ast_mutex_destroy(&t->tps_queue.lock);
+#endif
 	/* free it */
 	if (t->stats) {
 		ast_free(t->stats);
@@ -371,28 +868,6 @@ static void tps_taskprocessor_destroy(void *tps)
 	ast_free((char *) t->name);
 }
 
-/* pop the front task and return it */
-static struct tps_task *tps_taskprocessor_pop(struct ast_taskprocessor *tps)
-{
-	struct tps_task *task;
-
-	if (!tps) {
-		ast_log(LOG_ERROR, "missing taskprocessor\n");
-		return NULL;
-	}
-	ast_mutex_lock(&tps->taskprocessor_lock);
-	if ((task = AST_LIST_REMOVE_HEAD(&tps->tps_queue, list))) {
-		tps->tps_queue_size--;
-	}
-	ast_mutex_unlock(&tps->taskprocessor_lock);
-	return task;
-}
-
-static int tps_taskprocessor_depth(struct ast_taskprocessor *tps)
-{
-	return (tps) ? tps->tps_queue_size : -1;
-}
-
 /* taskprocessor name accessor */
 const char *ast_taskprocessor_name(struct ast_taskprocessor *tps)
 {
@@ -419,6 +894,7 @@ struct ast_taskprocessor *ast_taskprocessor_get(const char *name, enum ast_tps_o
 	ao2_lock(tps_singletons);
 	p = ao2_find(tps_singletons, &tmp_tps, OBJ_POINTER);
 	if (p) {
+		p->users++;
 		ao2_unlock(tps_singletons);
 		return p;
 	}
@@ -427,6 +903,11 @@ struct ast_taskprocessor *ast_taskprocessor_get(const char *name, enum ast_tps_o
 		ao2_unlock(tps_singletons);
 		return NULL;
 	}
+	if ((create & TPS_POOLED) && tps_pool_start()) {
+		ao2_unlock(tps_singletons);
+		ast_log(LOG_WARNING, "failed to start the taskprocessor pool for '%s'\n", name);
+		return NULL;
+	}
 	/* create a new taskprocessor */
 	if (!(p = ao2_alloc(sizeof(*p), tps_taskprocessor_destroy))) {
 		ao2_unlock(tps_singletons);
@@ -436,6 +917,9 @@ struct ast_taskprocessor *ast_taskprocessor_get(const char *name, enum ast_tps_o
 
 	ast_cond_init(&p->poll_cond, NULL);
 	ast_mutex_init(&p->taskprocessor_lock);
+	tps_queue_init(&p->tps_queue);
+	p->poll_thread = AST_PTHREADT_NULL;
+	p->users = 1;
 
 	if (!(p->stats = ast_calloc(1, sizeof(*p->stats)))) {
 		ao2_unlock(tps_singletons);
@@ -449,8 +933,9 @@ struct ast_taskprocessor *ast_taskprocessor_get(const char *name, enum ast_tps_o
 		return NULL;
 	}
 	p->poll_thread_run = 1;
-	p->poll_thread = AST_PTHREADT_NULL;
-	if (ast_pthread_create(&p->poll_thread, NULL, tps_processing_function, p) < 0) {
+	if (create & TPS_POOLED) {
+		p->pooled = 1;
+	} else if (ast_pthread_create(&p->poll_thread, NULL, tps_processing_function, p) < 0) {
 		ao2_unlock(tps_singletons);
 		ast_log(LOG_ERROR, "Taskprocessor '%s' failed to create the processing thread.\n", p->name);
 		ao2_ref(p, -1);
@@ -471,11 +956,25 @@ void *ast_taskprocessor_unreference(struct ast_taskprocessor *tps)
 {
 	if (tps) {
 		ao2_lock(tps_singletons);
-		ao2_unlink(tps_singletons, tps);
-		if (ao2_ref(tps, -1) > 1) {
-			ao2_link(tps_singletons, tps);
+		if (--tps->users) {
+			ao2_unlock(tps_singletons);
+			ao2_ref(tps, -1);
+			return NULL;
 		}
+		ao2_unlink(tps_singletons, tps);
 		ao2_unlock(tps_singletons);
+
+		if (tps->pooled) {
+			/* Like the thread of a taskprocessor, the pool stops running its tasks now */
+			ast_mutex_lock(&tps->taskprocessor_lock);
+			tps->poll_thread_run = 0;
+			while (tps->executing
+				&& !(tps->executing == 1 && pthread_equal(tps->executor, pthread_self()))) {
+				ast_cond_wait(&tps->poll_cond, &tps->taskprocessor_lock);
+			}
+			ast_mutex_unlock(&tps->taskprocessor_lock);
+		}
+		ao2_ref(tps, -1);
 	}
 	return NULL;
 }
@@ -493,11 +992,18 @@ int ast_taskprocessor_push(struct ast_taskprocessor *tps, int (*task_exe)(void *
 		ast_log(LOG_ERROR, "failed to allocate task!  Can't push to '%s'\n", tps->name);
 		return -1;
 	}
-	ast_mutex_lock(&tps->taskprocessor_lock);
-	AST_LIST_INSERT_TAIL(&tps->tps_queue, t, list);
-	tps->tps_queue_size++;
-	ast_cond_signal(&tps->poll_cond);
-	ast_mutex_unlock(&tps->taskprocessor_lock);
+	t->when = ast_tvnow();
+	tps_queue_push(&tps->tps_queue, t);
+	if (ast_atomic_fetchadd_int(&tps->tps_queue_size, 1)) {
+		/* Already being run or about to be */
+		return 0;
+	}
+	if (tps->pooled) {
+		tps_pool_schedule(tps);
+	} else {
+		ast_mutex_lock(&tps->taskprocessor_lock);
+		ast_cond_signal(&tps->poll_cond);
+		ast_mutex_unlock(&tps->taskprocessor_lock);
+	}
 	return 0;
 }
-
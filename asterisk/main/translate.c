@@ -39,6 +39,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 308624 $")
 #include "asterisk/sched.h"
 #include "asterisk/cli.h"
 #include "asterisk/term.h"
+#include "asterisk/astobj2.h"
 
 /*! \todo
  * TODO: sample frames for each supported input format.
@@ -52,6 +53,44 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 308624 $")
 /*! \brief the list of translators */
 static AST_RWLIST_HEAD_STATIC(translators, ast_translator);
 
+/*! \brief A destination format of a translation cache */
+struct trans_cache_entry {
+	struct ast_format dst;
+	struct ast_trans_pvt *trans_pvt;
+	/*! The last translated frame, an ao2 object */
+	struct ast_frame *out;
+	/*! When out was translated */
+	struct timeval stamp;
+	/*! The frame out was translated from */
+	struct ast_format src;
+	int src_samples;
+	int src_datalen;
+	size_t src_size;
+	unsigned char *src_data;
+	/*! Frames translated */
+	unsigned long translated;
+	/*! Frames shared with a consumer instead of translated */
+	unsigned long hits;
+	/*! Frames left to the consumer because they were out of step */
+	unsigned long skipped;
+	AST_LIST_ENTRY(trans_cache_entry) list;
+};
+
+struct ast_trans_cache {
+	AST_LIST_HEAD_NOLOCK(, trans_cache_entry) entries;
+	AST_RWLIST_ENTRY(ast_trans_cache) list;
+	char name[0];
+};
+
+/*! \brief A frame translated by a cache, with its data */
+struct trans_cache_frame {
+	struct ast_frame f;
+	unsigned char data[0];
+};
+
+/*! \brief the list of translation caches */
+static AST_RWLIST_HEAD_STATIC(trans_caches, ast_trans_cache);
+
 struct translator_path {
 	struct ast_translator *step;       /*!< Next step translator */
 	uint32_t table_cost;               /*!< Complete table cost to destination */
@@ -800,6 +839,211 @@ const char *ast_translate_path_to_str(struct ast_trans_pvt *p, struct ast_str **
 	return ast_str_buffer(*str);
 }
 
+static void trans_cache_entry_free(struct trans_cache_entry *entry)
+{
+	if (entry->trans_pvt) {
+		ast_translator_free_path(entry->trans_pvt);
+	}
+	if (entry->out) {
+		ao2_ref(entry->out, -1);
+	}
+	ast_free(entry->src_data);
+	ast_free(entry);
+}
+
+static void trans_cache_destructor(void *obj)
+{
+	struct ast_trans_cache *cache = obj;
+	struct trans_cache_entry *entry;
+
+	while ((entry = AST_LIST_REMOVE_HEAD(&cache->entries, list))) {
+		trans_cache_entry_free(entry);
+	}
+}
+
+struct ast_trans_cache *ast_trans_cache_alloc(const char *name)
+{
+	struct ast_trans_cache *cache;
+
+	if (!(cache = ao2_alloc(sizeof(*cache) + strlen(name) + 1, trans_cache_destructor))) {
+		return NULL;
+	}
+	strcpy(cache->name, name); /* Safe */
+
+	AST_RWLIST_WRLOCK(&trans_caches);
+	AST_RWLIST_INSERT_TAIL(&trans_caches, cache, list);
+	AST_RWLIST_UNLOCK(&trans_caches);
+
+	return cache;
+}
+
+struct ast_trans_cache *ast_trans_cache_destroy(struct ast_trans_cache *cache)
+{
+	if (!cache) {
+		return NULL;
+	}
+
+	AST_RWLIST_WRLOCK(&trans_caches);
+	AST_RWLIST_REMOVE(&trans_caches, cache, list);
+	AST_RWLIST_UNLOCK(&trans_caches);
+
+	ao2_ref(cache, -1);
+	return NULL;
+}
+
+/*! \brief Copy a translated frame into one the consumers can share */
+static struct ast_frame *trans_cache_frame_alloc(struct ast_frame *out)
+{
+	struct trans_cache_frame *shared;
+
+	if (!(shared = ao2_alloc(sizeof(*shared) + out->datalen, NULL))) {
+		return NULL;
+	}
+
+	shared->f.frametype = out->frametype;
+	ast_format_copy(&shared->f.subclass.format, &out->subclass.format);
+	shared->f.datalen = out->datalen;
+	shared->f.samples = out->samples;
+	shared->f.data.ptr = shared->data;
+	memcpy(shared->data, out->data.ptr, out->datalen);
+	shared->f.src = "trans_cache";
+	shared->f.delivery = out->delivery;
+	ast_copy_flags(&shared->f, out, AST_FRFLAG_HAS_TIMING_INFO);
+	shared->f.ts = out->ts;
+	shared->f.len = out->len;
+	shared->f.seqno = out->seqno;
+
+	return &shared->f;
+}
+
+static int trans_cache_entry_matches(struct trans_cache_entry *entry, struct ast_frame *f)
+{
+	return entry->out && entry->src_samples == f->samples && entry->src_datalen == f->datalen
+		&& ast_format_cmp(&entry->src, &f->subclass.format) == AST_FORMAT_CMP_EQUAL
+		&& !memcmp(entry->src_data, f->data.ptr, f->datalen);
+}
+
+struct ast_frame *ast_trans_cache_translate(struct ast_trans_cache *cache, struct ast_frame *f, struct ast_format *dst)
+{
+	struct trans_cache_entry *entry;
+	struct ast_frame *out = NULL;
+	struct timeval now;
+	int rate;
+
+	if (f->frametype != AST_FRAME_VOICE || !f->datalen || !f->samples
+		|| ast_format_cmp(&f->subclass.format, dst) != AST_FORMAT_CMP_NOT_EQUAL) {
+		return NULL;
+	}
+
+	ao2_lock(cache);
+	AST_LIST_TRAVERSE(&cache->entries, entry, list) {
+		if (ast_format_cmp(&entry->dst, dst) == AST_FORMAT_CMP_EQUAL) {
+			break;
+		}
+	}
+	if (!entry) {
+		if (!(entry = ast_calloc(1, sizeof(*entry)))) {
+			ao2_unlock(cache);
+			return NULL;
+		}
+		ast_format_copy(&entry->dst, dst);
+		AST_LIST_INSERT_TAIL(&cache->entries, entry, list);
+	}
+
+	if (trans_cache_entry_matches(entry, f)) {
+		entry->hits++;
+		ao2_ref(entry->out, +1);
+		out = entry->out;
+		ao2_unlock(cache);
+		return out;
+	}
+
+	/* A different frame less than half its length after the last one comes
+	 * from a consumer out of step with the others.  Translating it here would
+	 * break up the stream the translator sees, so leave it to the consumer. */
+	now = ast_tvnow();
+	rate = ast_format_rate(&f->subclass.format);
+	if (entry->out && rate && ast_tvdiff_us(now, entry->stamp) < (int64_t) f->samples * 500000 / rate) {
+		entry->skipped++;
+		ao2_unlock(cache);
+		return NULL;
+	}
+
+	if (!entry->trans_pvt || ast_format_cmp(&entry->src, &f->subclass.format) != AST_FORMAT_CMP_EQUAL) {
+		if (entry->trans_pvt) {
+			ast_translator_free_path(entry->trans_pvt);
+		}
+		if (!(entry->trans_pvt = ast_translator_build_path(dst, &f->subclass.format))) {
+			ao2_unlock(cache);
+			return NULL;
+		}
+		ast_format_copy(&entry->src, &f->subclass.format);
+	}
+
+	if (entry->src_size < f->datalen) {
+		unsigned char *src_data;
+
+		if (!(src_data = ast_realloc(entry->src_data, f->datalen))) {
+			ao2_unlock(cache);
+			return NULL;
+		}
+		entry->src_data = src_data;
+		entry->src_size = f->datalen;
+	}
+
+	if (entry->out) {
+		ao2_ref(entry->out, -1);
+		entry->out = NULL;
+	}
+	entry->translated++;
+	entry->stamp = now;
+
+	if ((out = ast_translate(entry->trans_pvt, f, 0))) {
+		/* Translators returning several frames at once are not shared */
+		if (!AST_LIST_NEXT(out, frame_list) && (entry->out = trans_cache_frame_alloc(out))) {
+			memcpy(entry->src_data, f->data.ptr, f->datalen);
+			entry->src_samples = f->samples;
+			entry->src_datalen = f->datalen;
+		}
+		ast_frfree(out);
+		out = NULL;
+	}
+	if (entry->out) {
+		ao2_ref(entry->out, +1);
+		out = entry->out;
+	}
+	ao2_unlock(cache);
+
+	return out;
+}
+
+static void handle_show_translation_caches(struct ast_cli_args *a)
+{
+	struct ast_trans_cache *cache;
+	struct trans_cache_entry *entry;
+	int header = 0;
+
+	AST_RWLIST_RDLOCK(&trans_caches);
+	AST_RWLIST_TRAVERSE(&trans_caches, cache, list) {
+		ao2_lock(cache);
+		AST_LIST_TRAVERSE(&cache->entries, entry, list) {
+			unsigned long total = entry->translated + entry->hits;
+
+			if (!header) {
+				ast_cli(a->fd, "\n         Shared translations of streams sent to many channels\n\n");
+				ast_cli(a->fd, "%-24s %-10s %12s %12s %12s %8s\n",
+					"Stream", "Format", "Translated", "Shared", "Skipped", "Hit rate");
+				header = 1;
+			}
+			ast_cli(a->fd, "%-24.24s %-10.10s %12lu %12lu %12lu %7.1f%%\n",
+				cache->name, ast_getformatname(&entry->dst), entry->translated, entry->hits,
+				entry->skipped, total ? 100.0 * entry->hits / total : 0.0);
+		}
+		ao2_unlock(cache);
+	}
+	AST_RWLIST_UNLOCK(&trans_caches);
+}
+
 static char *complete_trans_path_choice(const char *line, const char *word, int pos, int state)
 {
 	int which = 0;
@@ -927,6 +1171,7 @@ static char *handle_show_translation_table(struct ast_cli_args *a)
 	ast_free(out);
 	AST_RWLIST_UNLOCK(&translators);
 	ast_format_list_destroy(f_list);
+	handle_show_translation_caches(a);
 	return CLI_SUCCESS;
 }
 
@@ -1004,7 +1249,9 @@ static char *handle_cli_core_show_translation(struct ast_cli_entry *e, int cmd,
 			"          Displays known codec translators and the cost associated\n"
 			"          with each conversion.  If the argument 'recalc' is supplied along\n"
 			"          with optional number of seconds to test a new test will be performed\n"
-			"          as the chart is being displayed.\n"
+			"          as the chart is being displayed.  Streams translated once for\n"
+			"          many channels are listed below the chart, with how often\n"
+			"          the translation was shared.\n"
 			"       2. 'core show translation paths [codec]'\n"
 			"           This will display all the translation paths associated with a codec\n";
 		return NULL;
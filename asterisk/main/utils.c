@@ -36,6 +36,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 359708 $")
 #endif
 
 #include <sys/syscall.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #if defined(__APPLE__)
 #include <mach/mach.h>
 #elif defined(HAVE_SYS_THR_H)
@@ -469,6 +474,73 @@ char *ast_escape_quoted(const char *string, char *outbuf, int buflen)
 
 	return outbuf;
 }
+
+/*
+ * The SIMD saturating instructions clamp to -32768, while the scalar
+ * functions clamp to -32767, so the results are clamped once more to match.
+ */
+void ast_slinear_saturated_add_buf(short *input, const short *value, unsigned int samples)
+{
+	unsigned int i = 0;
+
+#if defined(__AVX2__)
+	const __m256i min256 = _mm256_set1_epi16(-32767);
+
+	for (; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (input + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (value + i));
+
+		_mm256_storeu_si256((__m256i *) (input + i), _mm256_max_epi16(_mm256_adds_epi16(a, b), min256));
+	}
+#endif
+#if defined(__SSE2__)
+	{
+		const __m128i min128 = _mm_set1_epi16(-32767);
+
+		for (; i + 8 <= samples; i += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *) (input + i));
+			__m128i b = _mm_loadu_si128((const __m128i *) (value + i));
+
+			_mm_storeu_si128((__m128i *) (input + i), _mm_max_epi16(_mm_adds_epi16(a, b), min128));
+		}
+	}
+#endif
+	for (; i < samples; i++) {
+		ast_slinear_saturated_add(&input[i], (short *) &value[i]);
+	}
+}
+
+void ast_slinear_saturated_subtract_buf(short *input, const short *value, unsigned int samples)
+{
+	unsigned int i = 0;
+
+#if defined(__AVX2__)
+	const __m256i min256 = _mm256_set1_epi16(-32767);
+
+	for (; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (input + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (value + i));
+
+		_mm256_storeu_si256((__m256i *) (input + i), _mm256_max_epi16(_mm256_subs_epi16(a, b), min256));
+	}
+#endif
+#if defined(__SSE2__)
+	{
+		const __m128i min128 = _mm_set1_epi16(-32767);
+
+		for (; i + 8 <= samples; i += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *) (input + i));
+			__m128i b = _mm_loadu_si128((const __m128i *) (value + i));
+
+			_mm_storeu_si128((__m128i *) (input + i), _mm_max_epi16(_mm_subs_epi16(a, b), min128));
+		}
+	}
+#endif
+	for (; i < samples; i++) {
+		ast_slinear_saturated_subtract(&input[i], (short *) &value[i]);
+	}
+}
+
 /*! \brief  ast_inet_ntoa: Recursive thread safe replacement of inet_ntoa */
 const char *ast_inet_ntoa(struct in_addr ia)
 {
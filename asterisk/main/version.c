@@ -0,0 +1,23 @@
+/*
+ * version.c
+ * Automatically generated
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/ast_version.h"
+
+static const char asterisk_version[] = "UNKNOWN__and_probably_unsupported";
+
+static const char asterisk_version_num[] = "";
+
+const char *ast_get_version(void)
+{
+	return asterisk_version;
+}
+
+const char *ast_get_version_num(void)
+{
+	return asterisk_version_num;
+}
+
@@ -68,6 +68,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358907 $")
 #include "asterisk/poll-compat.h"
 
 #define INITIAL_NUM_FILES   8
+#define MOH_SHARED_FRAMES   16	/*!< Frames of a shared stream kept for listeners to catch up */
+#define MOH_SHARED_INTERVAL 20	/*!< Milliseconds between runs of the thread of a shared stream */
 #define HANDLE_REF	1
 #define DONT_UNREF	0
 
@@ -165,6 +167,8 @@ struct moh_files_state {
 	int save_pos;
 	int save_total;
 	char save_pos_filename[PATH_MAX];
+	/*! The next frame of the shared stream of the class to play */
+	unsigned int shared_seq;
 };
 
 #define MOH_QUIET		(1 << 0)
@@ -175,6 +179,7 @@ struct moh_files_state {
 
 #define MOH_CACHERTCLASSES      (1 << 5)        /*!< Should we use a separate instance of MOH for each user or not */
 #define MOH_ANNOUNCEMENT	(1 << 6)			/*!< Do we play announcement files between songs on this channel? */
+#define MOH_SHARED		(1 << 7)	/*!< Do all channels listen to one stream of a "files" class? */
 
 /* Custom astobj2 flag */
 #define MOH_NOTDELETED          (1 << 30)       /*!< Find only records that aren't deleted? */
@@ -205,6 +210,16 @@ struct mohclass {
 	int srcfd;
 	/*! Generic timer */
 	struct ast_timer *timer;
+	/*! Translations of the audio shared by the members, not applicable to "files" mode without a shared stream */
+	struct ast_trans_cache *trans_cache;
+	/*! Channels listening to the class */
+	int listeners;
+	/*! The last frames of the shared stream, by reference, "files" mode only */
+	struct ast_frame *shared_frames[MOH_SHARED_FRAMES];
+	/*! Frames the shared stream has played */
+	unsigned int shared_seq;
+	/*! Tells the thread of the shared stream to exit */
+	unsigned int shared_stop:1;
 	/*! Created on the fly, from RT engine */
 	unsigned int realtime:1;
 	unsigned int delete:1;
@@ -281,6 +296,7 @@ static void moh_files_release(struct ast_channel *chan, void *data)
 	state->save_pos = state->pos;
 	state->announcement = 0;
 
+	ast_atomic_fetchadd_int(&state->class->listeners, -1);
 	state->class = mohclass_unref(state->class, "Unreffing channel's music class upon deactivation of generator");
 }
 
@@ -401,12 +417,134 @@ static void moh_files_write_format_change(struct ast_channel *chan, void *data)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Writes a frame of the shared stream of a class to a listener
+ */
+static int moh_shared_write(struct ast_channel *chan, struct moh_files_state *state, struct ast_frame *f)
+{
+	struct ast_frame *out = NULL, *dup, copy;
+	int res;
+
+	if (ast_format_cmp(&f->subclass.format, &state->mohwfmt) == AST_FORMAT_CMP_NOT_EQUAL) {
+		ast_format_copy(&state->mohwfmt, &f->subclass.format);
+		ast_set_write_format(chan, &state->mohwfmt);
+	}
+
+	/* Listeners writing in the same format share one translation of the stream */
+	if (state->class->trans_cache
+		&& (out = ast_trans_cache_translate(state->class->trans_cache, f, ast_channel_rawwriteformat(chan)))) {
+		f = out;
+	}
+
+	/* The audio is shared, so audiohooks, which may change it in place, get a copy */
+	if (ast_channel_audiohooks(chan)) {
+		if ((dup = ast_frdup(f))) {
+			res = ast_write(chan, dup);
+			ast_frfree(dup);
+		} else {
+			res = 0;
+		}
+	} else {
+		copy = *f;
+		AST_LIST_NEXT(&copy, frame_list) = NULL;
+		res = ast_write(chan, &copy);
+	}
+	if (out) {
+		ao2_ref(out, -1);
+	}
+
+	if (res < 0) {
+		ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", ast_channel_name(chan), strerror(errno));
+	}
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Plays the shared stream of a class to a listener
+ *
+ * The class thread plays the stream; the listener writes the frames played
+ * since it last ran.  The announcement of the class is played to the
+ * listener on its own before it joins the stream where it is.
+ */
+static int moh_shared_generator(struct ast_channel *chan, struct moh_files_state *state, int samples)
+{
+	struct mohclass *class = state->class;
+	struct ast_frame *frames[MOH_SHARED_FRAMES], *f;
+	unsigned int count = 0, i;
+	int res = 0;
+
+	if (ast_test_flag(class, MOH_ANNOUNCEMENT) && !state->announcement) {
+		state->announcement = 1;
+		ast_channel_lock(chan);
+		ast_openstream_full(chan, class->announcement, ast_channel_language(chan), 1);
+		ast_channel_unlock(chan);
+	}
+
+	if (ast_channel_stream(chan)) {
+		state->sample_queue += samples;
+		while (state->sample_queue > 0) {
+			ast_channel_lock(chan);
+			if (!ast_channel_stream(chan) || !(f = ast_readframe(ast_channel_stream(chan)))) {
+				/* The announcement is over */
+				if (ast_channel_stream(chan)) {
+					ast_closestream(ast_channel_stream(chan));
+					ast_channel_stream_set(chan, NULL);
+				}
+				ast_channel_unlock(chan);
+				state->sample_queue = 0;
+				ao2_lock(class);
+				state->shared_seq = class->shared_seq;
+				ao2_unlock(class);
+				return 0;
+			}
+			ast_channel_unlock(chan);
+			state->sample_queue -= f->samples;
+			if (ast_format_cmp(&f->subclass.format, &state->mohwfmt) == AST_FORMAT_CMP_NOT_EQUAL) {
+				ast_format_copy(&state->mohwfmt, &f->subclass.format);
+			}
+			res = ast_write(chan, f);
+			ast_frfree(f);
+			if (res < 0) {
+				ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", ast_channel_name(chan), strerror(errno));
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	ao2_lock(class);
+	/* A listener left further behind than the frames kept skips to the last one */
+	if (class->shared_seq - state->shared_seq > MOH_SHARED_FRAMES) {
+		state->shared_seq = class->shared_seq - 1;
+	}
+	for (; state->shared_seq != class->shared_seq; state->shared_seq++) {
+		frames[count] = class->shared_frames[state->shared_seq % MOH_SHARED_FRAMES];
+		ao2_ref(frames[count++], +1);
+	}
+	ao2_unlock(class);
+
+	for (i = 0; i < count; i++) {
+		if (res >= 0) {
+			res = moh_shared_write(chan, state, frames[i]);
+		}
+		ao2_ref(frames[i], -1);
+	}
+
+	return res < 0 ? -1 : 0;
+}
+
 static int moh_files_generator(struct ast_channel *chan, void *data, int len, int samples)
 {
 	struct moh_files_state *state = ast_channel_music_state(chan);
 	struct ast_frame *f = NULL;
 	int res = 0;
 
+	if (ast_test_flag(state->class, MOH_SHARED)) {
+		return moh_shared_generator(chan, state, samples);
+	}
+
 	state->sample_queue += samples;
 
 	while (state->sample_queue > 0) {
@@ -452,6 +590,7 @@ static void *moh_files_alloc(struct ast_channel *chan, void *params)
 			return NULL;
 		}
 		if (state->class) {
+			ast_atomic_fetchadd_int(&state->class->listeners, -1);
 			mohclass_unref(state->class, "Uh Oh. Restarting MOH with an active class");
 			ast_log(LOG_WARNING, "Uh Oh. Restarting MOH with an active class\n");
 		}
@@ -470,9 +609,18 @@ static void *moh_files_alloc(struct ast_channel *chan, void *params)
 	}
 
 	state->class = mohclass_ref(class, "Reffing music class for channel");
+	ast_atomic_fetchadd_int(&class->listeners, +1);
 	ast_format_copy(&state->origwfmt, ast_channel_writeformat(chan));
 	ast_format_copy(&state->mohwfmt, ast_channel_writeformat(chan));
 
+	if (ast_test_flag(class, MOH_SHARED)) {
+		/* Join the shared stream where it is now */
+		state->announcement = 0;
+		ao2_lock(class);
+		state->shared_seq = class->shared_seq;
+		ao2_unlock(class);
+	}
+
 	/* For comparison on restart of MOH (see above) */
 	ast_copy_string(state->name, class->name, sizeof(state->name));
 	state->save_total = class->total_files;
@@ -931,6 +1079,7 @@ static struct mohdata *mohalloc(struct mohclass *cl)
 	ao2_lock(cl);
 	AST_LIST_INSERT_HEAD(&cl->members, moh, list);
 	ao2_unlock(cl);
+	ast_atomic_fetchadd_int(&cl->listeners, +1);
 	
 	return moh;
 }
@@ -944,6 +1093,7 @@ static void moh_release(struct ast_channel *chan, void *data)
 	ao2_lock(class);
 	AST_LIST_REMOVE(&moh->parent->members, moh, list);	
 	ao2_unlock(class);
+	ast_atomic_fetchadd_int(&class->listeners, -1);
 	
 	close(moh->pipe[0]);
 	close(moh->pipe[1]);
@@ -1010,6 +1160,7 @@ static int moh_generate(struct ast_channel *chan, void *data, int len, int sampl
 {
 	struct mohdata *moh = data;
 	short buf[1280 + AST_FRIENDLY_OFFSET / 2];
+	struct ast_frame *shared = NULL;
 	int res;
 
 	len = ast_codec_get_len(&moh->parent->format, samples);
@@ -1026,7 +1177,15 @@ static int moh_generate(struct ast_channel *chan, void *data, int len, int sampl
 	moh->f.data.ptr = buf + AST_FRIENDLY_OFFSET / 2;
 	moh->f.samples = ast_codec_get_samples(&moh->f);
 
-	if (ast_write(chan, &moh->f) < 0) {
+	/* Every member reads the same audio, so translate it once for all of them */
+	if (moh->parent->trans_cache) {
+		shared = ast_trans_cache_translate(moh->parent->trans_cache, &moh->f, ast_channel_rawwriteformat(chan));
+	}
+	res = ast_write(chan, shared ? shared : &moh->f);
+	if (shared) {
+		ao2_ref(shared, -1);
+	}
+	if (res < 0) {
 		ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", ast_channel_name(chan), strerror(errno));
 		return -1;
 	}
@@ -1156,6 +1315,164 @@ static int moh_scan_files(struct mohclass *class) {
 	return class->total_files;
 }
 
+/*! \brief Copies a frame of a shared stream into one handed to every listener by reference */
+static struct ast_frame *moh_shared_frame_alloc(struct ast_frame *f)
+{
+	struct ast_frame *shared;
+
+	if (!(shared = ao2_alloc(sizeof(*shared) + f->datalen, NULL))) {
+		return NULL;
+	}
+	shared->frametype = AST_FRAME_VOICE;
+	ast_format_copy(&shared->subclass.format, &f->subclass.format);
+	shared->datalen = f->datalen;
+	shared->samples = f->samples;
+	shared->data.ptr = shared + 1;
+	memcpy(shared->data.ptr, f->data.ptr, f->datalen);
+	shared->src = "moh";
+
+	return shared;
+}
+
+/*! \brief Opens the next file, or announcement, of the shared stream of a class */
+static struct ast_filestream *moh_shared_next(struct mohclass *class, int *pos, int *announcement)
+{
+	struct ast_filestream *stream;
+	int tries;
+
+	if (ast_test_flag(class, MOH_ANNOUNCEMENT) && !*announcement) {
+		*announcement = 1;
+		if ((stream = ast_openstream_nochan(class->announcement, NULL))) {
+			return stream;
+		}
+	}
+	*announcement = 0;
+
+	for (tries = 0; tries < class->total_files; tries++) {
+		if (ast_test_flag(class, MOH_RANDOMIZE)) {
+			*pos = ast_random() % class->total_files;
+		} else {
+			*pos = (*pos + 1) % class->total_files;
+		}
+		if ((stream = ast_openstream_nochan(class->filearray[*pos], NULL))) {
+			ast_debug(1, "Shared stream of class '%s' opened file %d '%s'\n", class->name, *pos, class->filearray[*pos]);
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Plays the files of a class as one stream all its listeners share
+ *
+ * The stream pauses while nobody listens.  Each frame is kept by reference
+ * for the listeners to write, until MOH_SHARED_FRAMES later frames replace it.
+ */
+static void *moh_shared_thread(void *data)
+{
+	struct mohclass *class = data;
+	struct ast_filestream *stream = NULL;
+	struct ast_frame *f, *shared;
+	struct timeval now, next = { 0, };
+	int pos = -1, announcement = 0;
+
+	while (!class->shared_stop) {
+		if (class->timer) {
+			struct pollfd pfd = { .fd = ast_timer_fd(class->timer), .events = POLLIN | POLLPRI, };
+
+			if (ast_poll(&pfd, 1, MOH_SHARED_INTERVAL * 2) > 0) {
+				ast_timer_ack(class->timer, 1);
+			}
+		} else {
+			usleep(MOH_SHARED_INTERVAL * 1000);
+		}
+
+		if (!class->listeners) {
+			next = ast_tv(0, 0);
+			continue;
+		}
+
+		now = ast_tvnow();
+		if (ast_tvzero(next) || ast_tvdiff_ms(now, next) > 1000) {
+			/* Starting, or too late for the listeners to catch up anyway */
+			next = now;
+		}
+
+		/* Play the frames due by now */
+		while (ast_tvcmp(next, now) <= 0 && !class->shared_stop) {
+			f = NULL;
+			if (!stream || !(f = ast_readframe(stream))) {
+				if (stream) {
+					ast_closestream(stream);
+				}
+				if ((stream = moh_shared_next(class, &pos, &announcement))) {
+					f = ast_readframe(stream);
+				}
+				if (!f) {
+					/* Try again in a while rather than every time */
+					next = ast_tvadd(now, ast_tv(1, 0));
+					break;
+				}
+			}
+
+			if (f->frametype == AST_FRAME_VOICE && f->samples) {
+				next = ast_tvadd(next, ast_samp2tv(f->samples, ast_format_rate(&f->subclass.format)));
+				if ((shared = moh_shared_frame_alloc(f))) {
+					struct ast_frame **slot;
+
+					ao2_lock(class);
+					slot = &class->shared_frames[class->shared_seq % MOH_SHARED_FRAMES];
+					if (*slot) {
+						ao2_ref(*slot, -1);
+					}
+					*slot = shared;
+					class->shared_seq++;
+					ao2_unlock(class);
+				}
+			}
+			ast_frfree(f);
+		}
+	}
+
+	if (stream) {
+		ast_closestream(stream);
+	}
+
+	return NULL;
+}
+
+static int moh_shared_start(struct mohclass *class)
+{
+	if (!class->trans_cache) {
+		char name[MAX_MUSICCLASS + 8];
+
+		snprintf(name, sizeof(name), "moh/%s", class->name);
+		class->trans_cache = ast_trans_cache_alloc(name);
+	}
+
+	if (!(class->timer = ast_timer_open())) {
+		ast_log(LOG_WARNING, "Unable to create timer: %s\n", strerror(errno));
+	}
+	if (class->timer && ast_timer_set_rate(class->timer, 1000 / MOH_SHARED_INTERVAL)) {
+		ast_log(LOG_WARNING, "Unable to set %dms frame rate: %s\n", MOH_SHARED_INTERVAL, strerror(errno));
+		ast_timer_close(class->timer);
+		class->timer = NULL;
+	}
+
+	if (ast_pthread_create_background(&class->thread, NULL, moh_shared_thread, class)) {
+		ast_log(LOG_WARNING, "Unable to create moh thread...\n");
+		if (class->timer) {
+			ast_timer_close(class->timer);
+			class->timer = NULL;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
 static int init_files_class(struct mohclass *class)
 {
 	int res;
@@ -1172,6 +1489,11 @@ static int init_files_class(struct mohclass *class)
 		return -1;
 	}
 
+	if (ast_test_flag(class, MOH_SHARED) && moh_shared_start(class)) {
+		ast_log(LOG_WARNING, "Each listener of class '%s' will play its own stream\n", class->name);
+		ast_clear_flag(class, MOH_SHARED);
+	}
+
 #if 0
 	/* XXX This isn't correct.  Args is an application for custom mode. XXX */
 	if (strchr(class->args, 'r')) {
@@ -1228,9 +1550,18 @@ static int init_app_class(struct mohclass *class)
 	} else if (!strcasecmp(class->mode, "quietmp3")) {
 		ast_set_flag(class, MOH_QUIET);
 	}
+	/* The application is always shared by the listeners */
+	ast_clear_flag(class, MOH_SHARED);
 
 	class->srcfd = -1;
 
+	if (!class->trans_cache) {
+		char name[MAX_MUSICCLASS + 8];
+
+		snprintf(name, sizeof(name), "moh/%s", class->name);
+		class->trans_cache = ast_trans_cache_alloc(name);
+	}
+
 	if (!(class->timer = ast_timer_open())) {
 		ast_log(LOG_WARNING, "Unable to create timer: %s\n", strerror(errno));
 		return -1;
@@ -1425,6 +1756,8 @@ static int local_ast_moh_start(struct ast_channel *chan, const char *mclass, con
 					ast_set_flag(mohclass, MOH_RANDOMIZE);
 				else if (!strcasecmp(tmp->name, "sort") && !strcasecmp(tmp->value, "alpha")) 
 					ast_set_flag(mohclass, MOH_SORTALPHA);
+				else if (!strcasecmp(tmp->name, "sharedstream"))
+					ast_set2_flag(mohclass, ast_true(tmp->value), MOH_SHARED);
 				else if (!strcasecmp(tmp->name, "format")) {
 					ast_getformatbyname(tmp->value, &mohclass->format);
 					if (!mohclass->format.id) {
@@ -1481,6 +1814,8 @@ static int local_ast_moh_start(struct ast_channel *chan, const char *mclass, con
 
 				time(&mohclass->start);
 				mohclass->start -= respawn_time;
+				/* Nobody else listens to a class made for this channel */
+				ast_clear_flag(mohclass, MOH_SHARED);
 
 				if (!strcasecmp(mohclass->mode, "files")) {
 					if (!moh_scan_files(mohclass)) {
@@ -1601,6 +1936,7 @@ static void moh_class_destructor(void *obj)
 	struct mohclass *class = obj;
 	struct mohdata *member;
 	pthread_t tid = 0;
+	int i;
 
 	ast_debug(1, "Destroying MOH class '%s'\n", class->name);
 
@@ -1610,6 +1946,18 @@ static void moh_class_destructor(void *obj)
 	}
 	ao2_unlock(class);
 
+	/* The thread of a shared stream finishes its frame and exits on its own */
+	if (ast_test_flag(class, MOH_SHARED) && class->thread != AST_PTHREADT_NULL && class->thread != 0) {
+		class->shared_stop = 1;
+		pthread_join(class->thread, NULL);
+		class->thread = AST_PTHREADT_NULL;
+	}
+	for (i = 0; i < MOH_SHARED_FRAMES; i++) {
+		if (class->shared_frames[i]) {
+			ao2_ref(class->shared_frames[i], -1);
+		}
+	}
+
 	/* Kill the thread first, so it cannot restart the child process while the
 	 * class is being destroyed */
 	if (class->thread != AST_PTHREADT_NULL && class->thread != 0) {
@@ -1665,7 +2013,6 @@ static void moh_class_destructor(void *obj)
 	}
 
 	if (class->filearray) {
-		int i;
 		for (i = 0; i < class->total_files; i++) {
 			free(class->filearray[i]);
 		}
@@ -1678,6 +2025,8 @@ static void moh_class_destructor(void *obj)
 		class->timer = NULL;
 	}
 
+	class->trans_cache = ast_trans_cache_destroy(class->trans_cache);
+
 	/* Finally, collect the exit status of the monitor thread */
 	if (tid > 0) {
 		pthread_join(tid, NULL);
@@ -1771,6 +2120,8 @@ static int load_moh_classes(int reload)
 				ast_set_flag(class, MOH_RANDOMIZE);
 			} else if (!strcasecmp(var->name, "sort") && !strcasecmp(var->value, "alpha")) {
 				ast_set_flag(class, MOH_SORTALPHA);
+			} else if (!strcasecmp(var->name, "sharedstream")) {
+				ast_set2_flag(class, ast_true(var->value), MOH_SHARED);
 			} else if (!strcasecmp(var->name, "format")) {
 				ast_getformatbyname(var->value, &class->format);
 				if (!class->format.id) {
@@ -1910,6 +2261,10 @@ static char *handle_cli_moh_show_classes(struct ast_cli_entry *e, int cmd, struc
 		if (strcasecmp(class->mode, "files")) {
 			ast_cli(a->fd, "\tFormat: %s\n", ast_getformatname(&class->format));
 		}
+		ast_cli(a->fd, "\tListeners: %d\n", class->listeners);
+		if (ast_test_flag(class, MOH_SHARED)) {
+			ast_cli(a->fd, "\tShared stream: %u frames played\n", class->shared_seq);
+		}
 	}
 	ao2_iterator_destroy(&i);
 
@@ -41,6 +41,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 357051 $")
 
 #include "asterisk/file.h"
+#include "asterisk/paths.h"
 #include "asterisk/channel.h"
 #include "asterisk/config.h"
 #include "asterisk/pbx.h"
@@ -1014,8 +1015,744 @@ static char *handle_cli_odbc_show(struct ast_cli_entry *e, int cmd, struct ast_c
 	return CLI_SUCCESS;
 }
 
+/*! Milliseconds between the tries of a batch that failed */
+#define ODBC_BATCH_RETRY_DELAY	1000
+/*! Seconds rows are spooled without trying the database after a batch could not be written */
+#define ODBC_BATCH_DOWN_TIME	10
+/*! Most full batches of rows queued before more rows are spooled to disk at once */
+#define ODBC_BATCH_MAX_QUEUED	100
+/*! odbc_batch_write() result when a statement failed on a connection that is up */
+#define ODBC_BATCH_REJECTED	1
+
+struct odbc_batch_row {
+	AST_LIST_ENTRY(odbc_batch_row) list;
+	/*! When the row was queued */
+	struct timeval queued;
+	/*! Already part of a statement of the batch being written */
+	unsigned int done:1;
+	/*! "INSERT INTO table (column, ...)", stored in data */
+	char *insert;
+	/*! "(value, ...)", stored in data */
+	char *values;
+	char data[0];
+};
+
+AST_LIST_HEAD_NOLOCK(odbc_batch_rows, odbc_batch_row);
+
+struct odbc_batch {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	pthread_t thread;
+	/*! Rows waiting to be written, oldest first */
+	struct odbc_batch_rows rows;
+	unsigned int queued;
+	unsigned int size;
+	unsigned int latency;
+	unsigned int retries;
+	unsigned int multirow:1;
+	unsigned int stop:1;
+	/*! The spool file may have rows, the thread writes them once the database is up */
+	unsigned int spool_pending:1;
+	/*! Spool rows without trying the database until then */
+	struct timeval down_until;
+	/* Statistics, written with the lock held */
+	unsigned int written;
+	unsigned int statements;
+	unsigned int commits;
+	unsigned int failures;
+	unsigned int spooled;
+	unsigned int replayed;
+	unsigned int dropped;
+	AST_LIST_ENTRY(odbc_batch) list;
+	char *connection;
+	char *name;
+	char *spool;
+	char data[0];
+};
+
+static AST_RWLIST_HEAD_STATIC(odbc_batches, odbc_batch);
+
+static void odbc_batch_rows_free(struct odbc_batch_rows *rows)
+{
+	struct odbc_batch_row *row;
+
+	while ((row = AST_LIST_REMOVE_HEAD(rows, list))) {
+		ast_free(row);
+	}
+}
+
+static struct odbc_batch_row *odbc_batch_row_alloc(const char *insert, const char *values)
+{
+	struct odbc_batch_row *row;
+	size_t insert_len = strlen(insert) + 1;
+
+	if (!(row = ast_calloc(1, sizeof(*row) + insert_len + strlen(values) + 1))) {
+		return NULL;
+	}
+	row->insert = row->data;
+	strcpy(row->insert, insert);
+	row->values = row->data + insert_len;
+	strcpy(row->values, values);
+	row->queued = ast_tvnow();
+
+	return row;
+}
+
+/*! \brief Execute a statement on a connection whose autocommit is off */
+static int odbc_batch_execute(struct odbc_obj *obj, const char *sql)
+{
+	SQLHSTMT stmt;
+	SQLINTEGER nativeerror = 0, numfields = 0;
+	SQLSMALLINT diagbytes = 0, i;
+	unsigned char state[10], diagnostic[256];
+	int res;
+
+	res = SQLAllocHandle(SQL_HANDLE_STMT, obj->con, &stmt);
+	if ((res != SQL_SUCCESS) && (res != SQL_SUCCESS_WITH_INFO)) {
+		ast_log(LOG_WARNING, "SQL Alloc Handle failed!\n");
+		return -1;
+	}
+
+	res = SQLExecDirect(stmt, (unsigned char *) sql, SQL_NTS);
+	if ((res != SQL_SUCCESS) && (res != SQL_SUCCESS_WITH_INFO) && (res != SQL_NO_DATA)) {
+		SQLGetDiagField(SQL_HANDLE_STMT, stmt, 1, SQL_DIAG_NUMBER, &numfields, SQL_IS_INTEGER, &diagbytes);
+		for (i = 0; i < numfields; i++) {
+			SQLGetDiagRec(SQL_HANDLE_STMT, stmt, i + 1, state, &nativeerror, diagnostic, sizeof(diagnostic), &diagbytes);
+			ast_log(LOG_WARNING, "SQL Execute returned an error %d: %s: %s (%d)\n", res, state, diagnostic, diagbytes);
+			if (i > 10) {
+				ast_log(LOG_WARNING, "Oh, that was good.  There are really %d diagnostics?\n", (int)numfields);
+				break;
+			}
+		}
+		SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+		return -1;
+	}
+
+	SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Write rows in one transaction.
+ *
+ * \param batch Batch of the rows.
+ * \param rows Rows to write.
+ * \param check Check the connection first, as after a failure.
+ *
+ * \retval 0 if the transaction was committed.
+ * \retval ODBC_BATCH_REJECTED if it was rolled back on a connection that is up.
+ * \retval -1 if it was rolled back because the connection is down, or no
+ * connection could be had.
+ */
+static int odbc_batch_write(struct odbc_batch *batch, struct odbc_batch_rows *rows, int check)
+{
+	struct ast_flags flags = { RES_ODBC_INDEPENDENT_CONNECTION | (check ? RES_ODBC_SANITY_CHECK : 0) };
+	struct odbc_obj *obj;
+	struct odbc_batch_row *row;
+	struct odbc_batch_row *next;
+	struct ast_str *sql;
+	unsigned int statements = 0;
+	unsigned int count = 0;
+	int res = 0;
+
+	if (!(sql = ast_str_create(512))) {
+		return -1;
+	}
+	if (!(obj = ast_odbc_request_obj2(batch->connection, flags))) {
+		ast_log(LOG_WARNING, "Unable to retrieve database handle for '%s'.  Batch '%s' not written.\n", batch->connection, batch->name);
+		ast_free(sql);
+		ast_mutex_lock(&batch->lock);
+		++batch->failures;
+		ast_mutex_unlock(&batch->lock);
+		return -1;
+	}
+
+	AST_LIST_TRAVERSE(rows, row, list) {
+		row->done = 0;
+	}
+	AST_LIST_TRAVERSE(rows, row, list) {
+		if (row->done) {
+			continue;
+		}
+		ast_str_set(&sql, 0, "%s VALUES %s", row->insert, row->values);
+		row->done = 1;
+		++count;
+		if (batch->multirow) {
+			/* Add the later rows with the same columns. */
+			for (next = AST_LIST_NEXT(row, list); next; next = AST_LIST_NEXT(next, list)) {
+				if (!next->done && !strcmp(next->insert, row->insert)) {
+					ast_str_append(&sql, 0, ",%s", next->values);
+					next->done = 1;
+					++count;
+				}
+			}
+		}
+		ast_verb(11, "[%s]\n", ast_str_buffer(sql));
+		if (odbc_batch_execute(obj, ast_str_buffer(sql))) {
+			res = -1;
+			break;
+		}
+		++statements;
+	}
+
+	if (!res && SQLEndTran(SQL_HANDLE_DBC, obj->con, SQL_COMMIT) == SQL_ERROR) {
+		ast_log(LOG_WARNING, "Unable to commit batch '%s' on '%s'\n", batch->name, batch->connection);
+		res = -1;
+	}
+	if (res) {
+		SQLEndTran(SQL_HANDLE_DBC, obj->con, SQL_ROLLBACK);
+		if (ast_odbc_sanity_check(obj)) {
+			/* The database refused a row, writing the rows again will not help. */
+			res = ODBC_BATCH_REJECTED;
+		}
+	}
+	/* Pooled connections keep their autocommit setting when released. */
+	SQLSetConnectAttr(obj->con, SQL_ATTR_AUTOCOMMIT, (void *) SQL_AUTOCOMMIT_ON, 0);
+	ast_odbc_release_obj(obj);
+	ast_free(sql);
+
+	ast_mutex_lock(&batch->lock);
+	if (res) {
+		++batch->failures;
+	} else {
+		batch->written += count;
+		batch->statements += statements;
+		++batch->commits;
+	}
+	ast_mutex_unlock(&batch->lock);
+
+	return res;
+}
+
+/*! \brief Write a spool file field, escaping line ends, tabs and backslashes */
+static void odbc_batch_spool_field(FILE *f, const char *field)
+{
+	for (; *field; ++field) {
+		switch (*field) {
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		case '\r':
+			fputs("\\r", f);
+			break;
+		case '\t':
+			fputs("\\t", f);
+			break;
+		default:
+			fputc(*field, f);
+			break;
+		}
+	}
+}
+
+/*! \brief Undo odbc_batch_spool_field() in place */
+static void odbc_batch_unspool_field(char *field)
+{
+	char *dst = field;
+
+	for (; *field; ++field) {
+		if (*field == '\\' && field[1]) {
+			++field;
+			*dst++ = *field == 'n' ? '\n' : *field == 'r' ? '\r' : *field == 't' ? '\t' : *field;
+		} else {
+			*dst++ = *field;
+		}
+	}
+	*dst = '\0';
+}
+
+/*!
+ * \internal
+ * \brief Append rows to the spool file of a batch, one line each.
+ *
+ * \retval 0 on success.
+ * \retval -1 if the rows are lost.
+ */
+static int odbc_batch_spool(struct odbc_batch *batch, struct odbc_batch_rows *rows)
+{
+	struct odbc_batch_row *row;
+	unsigned int count = 0;
+	int res = 0;
+	FILE *f;
+
+	/* Rows are spooled both by the batch thread and by ast_odbc_batch_add(). */
+	ast_mutex_lock(&batch->lock);
+	if (!(f = fopen(batch->spool, "a"))) {
+		ast_log(LOG_ERROR, "Unable to open spool file '%s': %s.  Rows of batch '%s' lost.\n", batch->spool, strerror(errno), batch->name);
+		ast_mutex_unlock(&batch->lock);
+		return -1;
+	}
+	AST_LIST_TRAVERSE(rows, row, list) {
+		odbc_batch_spool_field(f, row->insert);
+		fputc('\t', f);
+		odbc_batch_spool_field(f, row->values);
+		fputc('\n', f);
+		++count;
+	}
+	if (fclose(f)) {
+		ast_log(LOG_ERROR, "Unable to write spool file '%s': %s.  Rows of batch '%s' may be lost.\n", batch->spool, strerror(errno), batch->name);
+		res = -1;
+	}
+	batch->spooled += count;
+	batch->spool_pending = 1;
+	/* Wake the thread to write the spooled rows once the database is up. */
+	ast_cond_signal(&batch->cond);
+	ast_mutex_unlock(&batch->lock);
+
+	return res;
+}
+
+/*! \brief Read a line of any length, without its line end */
+static int odbc_batch_read_line(FILE *f, struct ast_str **line)
+{
+	char buf[1024];
+	size_t len;
+
+	ast_str_reset(*line);
+	while (fgets(buf, sizeof(buf), f)) {
+		len = strlen(buf);
+		if (len && buf[len - 1] == '\n') {
+			buf[len - 1] = '\0';
+			ast_str_append(line, 0, "%s", buf);
+			return 0;
+		}
+		ast_str_append(line, 0, "%s", buf);
+	}
+
+	return ast_str_strlen(*line) ? 0 : -1;
+}
+
+/*! \brief Read the next row of a spool file */
+static struct odbc_batch_row *odbc_batch_unspool(FILE *f, struct ast_str **line)
+{
+	char *values;
+
+	while (!odbc_batch_read_line(f, line)) {
+		if (!(values = strchr(ast_str_buffer(*line), '\t'))) {
+			continue;
+		}
+		*values++ = '\0';
+		odbc_batch_unspool_field(ast_str_buffer(*line));
+		odbc_batch_unspool_field(values);
+		return odbc_batch_row_alloc(ast_str_buffer(*line), values);
+	}
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Write rows one at a time after the database refused a batch of them.
+ *
+ * The rows the database still refuses are logged and dropped.
+ *
+ * \retval 0 if every row was written or dropped.
+ * \retval -1 if the connection went down, the rows not written are left in rows.
+ */
+static int odbc_batch_write_singly(struct odbc_batch *batch, struct odbc_batch_rows *rows)
+{
+	struct odbc_batch_rows single = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct odbc_batch_row *row;
+	int res;
+
+	while ((row = AST_LIST_REMOVE_HEAD(rows, list))) {
+		AST_LIST_INSERT_HEAD(&single, row, list);
+		if ((res = odbc_batch_write(batch, &single, 0)) < 0) {
+			AST_LIST_REMOVE_HEAD(&single, list);
+			AST_LIST_INSERT_HEAD(rows, row, list);
+			return -1;
+		}
+		if (res == ODBC_BATCH_REJECTED) {
+			ast_log(LOG_ERROR, "Batch '%s' on '%s' dropped a row the database refused: %s VALUES %s\n",
+				batch->name, batch->connection, row->insert, row->values);
+			ast_mutex_lock(&batch->lock);
+			++batch->dropped;
+			ast_mutex_unlock(&batch->lock);
+		}
+		odbc_batch_rows_free(&single);
+	}
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Write rows, one at a time if the database refuses them together.
+ *
+ * \retval 0 if every row was written or dropped.
+ * \retval -1 if the connection is down, the rows not written are left in rows.
+ */
+static int odbc_batch_write_rows(struct odbc_batch *batch, struct odbc_batch_rows *rows, int check)
+{
+	int res = odbc_batch_write(batch, rows, check);
+
+	if (res == ODBC_BATCH_REJECTED) {
+		ast_log(LOG_WARNING, "The database refused batch '%s' on '%s'.  Writing its rows one at a time.\n", batch->name, batch->connection);
+		res = odbc_batch_write_singly(batch, rows);
+	}
+	if (!res) {
+		odbc_batch_rows_free(rows);
+	}
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Write the rows of a renamed spool file, spooling them again if that fails.
+ *
+ * \retval 0 All rows were written and the file removed.
+ * \retval -1 The file could not be read, or its rows were spooled again.
+ */
+static int odbc_batch_replay_file(struct odbc_batch *batch, const char *replay)
+{
+	struct odbc_batch_rows rows = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct odbc_batch_row *row;
+	struct ast_str *line;
+	unsigned int count;
+	int failed = 0;
+	FILE *f;
+
+	if (!(f = fopen(replay, "r"))) {
+		ast_log(LOG_ERROR, "Unable to open spool file '%s': %s\n", replay, strerror(errno));
+		return -1;
+	}
+	if (!(line = ast_str_create(512))) {
+		fclose(f);
+		return -1;
+	}
+
+	ast_log(LOG_NOTICE, "Writing the rows spooled for batch '%s'\n", batch->name);
+	for (;;) {
+		/* The spool file may have many more rows than a batch. */
+		for (count = 0; count < batch->size && (row = odbc_batch_unspool(f, &line)); ++count) {
+			AST_LIST_INSERT_TAIL(&rows, row, list);
+		}
+		if (!count) {
+			break;
+		}
+		if (failed || odbc_batch_write_rows(batch, &rows, 0)) {
+			failed = 1;
+			odbc_batch_spool(batch, &rows);
+		} else {
+			ast_mutex_lock(&batch->lock);
+			batch->replayed += count;
+			ast_mutex_unlock(&batch->lock);
+		}
+		odbc_batch_rows_free(&rows);
+	}
+
+	if (failed) {
+		ast_log(LOG_WARNING, "Unable to write the rows spooled for batch '%s' on '%s'.  Spooling them again.\n", batch->name, batch->connection);
+	}
+	fclose(f);
+	unlink(replay);
+	ast_free(line);
+
+	return failed ? -1 : 0;
+}
+
+/*!
+ * \internal
+ * \brief Write the rows spooled to disk while the database could not be written.
+ *
+ * The spool file is renamed while its rows are written, so that rows that
+ * still can not be written are spooled to a new one.  A renamed file left
+ * by a replay that did not finish is written first, then the spool file.
+ *
+ * \return Nothing
+ */
+static void odbc_batch_replay(struct odbc_batch *batch)
+{
+	char replay[PATH_MAX];
+	int last;
+
+	snprintf(replay, sizeof(replay), "%s.replay", batch->spool);
+	do {
+		ast_mutex_lock(&batch->lock);
+		if ((last = access(replay, F_OK))) {
+			batch->spool_pending = 0;
+			if (rename(batch->spool, replay)) {
+				/* Nothing spooled. */
+				ast_mutex_unlock(&batch->lock);
+				return;
+			}
+		}
+		ast_mutex_unlock(&batch->lock);
+
+		if (odbc_batch_replay_file(batch, replay)) {
+			/* Try the rows left on disk again later. */
+			ast_mutex_lock(&batch->lock);
+			batch->spool_pending = 1;
+			batch->down_until = ast_tvadd(ast_tvnow(), ast_tv(ODBC_BATCH_DOWN_TIME, 0));
+			ast_mutex_unlock(&batch->lock);
+			return;
+		}
+	} while (!last);
+}
+
+/*!
+ * \internal
+ * \brief Write rows, trying again or spooling them to disk while the connection is down.
+ *
+ * \return Nothing
+ */
+static void odbc_batch_flush(struct odbc_batch *batch, struct odbc_batch_rows *rows)
+{
+	struct timespec ts;
+	struct timeval when;
+	unsigned int attempt;
+	int stop;
+
+	if (ast_tvcmp(batch->down_until, ast_tvnow()) > 0) {
+		/* Still failing, do not make the rows wait on the database. */
+		odbc_batch_spool(batch, rows);
+		return;
+	}
+
+	for (attempt = 0; ; ++attempt) {
+		if (!odbc_batch_write_rows(batch, rows, attempt)) {
+			batch->down_until = ast_tv(0, 0);
+			odbc_batch_replay(batch);
+			return;
+		}
+
+		ast_mutex_lock(&batch->lock);
+		if (attempt < batch->retries) {
+			/* Rows being queued also signal the condition. */
+			when = ast_tvadd(ast_tvnow(), ast_samp2tv(ODBC_BATCH_RETRY_DELAY, 1000));
+			ts.tv_sec = when.tv_sec;
+			ts.tv_nsec = when.tv_usec * 1000;
+			while (!batch->stop && ast_tvcmp(when, ast_tvnow()) > 0) {
+				ast_cond_timedwait(&batch->cond, &batch->lock, &ts);
+			}
+		}
+		stop = batch->stop;
+		ast_mutex_unlock(&batch->lock);
+
+		if (stop || attempt >= batch->retries) {
+			break;
+		}
+		ast_log(LOG_NOTICE, "Trying batch '%s' on '%s' again\n", batch->name, batch->connection);
+	}
+
+	ast_log(LOG_WARNING, "Unable to write batch '%s' on '%s'.  Spooling its rows to '%s'.\n", batch->name, batch->connection, batch->spool);
+	batch->down_until = ast_tvadd(ast_tvnow(), ast_tv(ODBC_BATCH_DOWN_TIME, 0));
+	odbc_batch_spool(batch, rows);
+}
+
+static void *odbc_batch_thread(void *data)
+{
+	struct odbc_batch *batch = data;
+	struct odbc_batch_rows rows = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct odbc_batch_row *row;
+	struct timespec ts;
+	struct timeval when;
+	unsigned int count;
+
+	ast_mutex_lock(&batch->lock);
+	for (;;) {
+		/*
+		 * Wait for a full batch, for the oldest row to have waited long enough,
+		 * for the database to be tried again with spooled rows, or to stop.
+		 */
+		while (!batch->stop && batch->queued < batch->size) {
+			if (!batch->queued && batch->spool_pending) {
+				when = batch->down_until;
+				if (ast_tvcmp(when, ast_tvnow()) <= 0) {
+					break;
+				}
+				ts.tv_sec = when.tv_sec;
+				ts.tv_nsec = when.tv_usec * 1000;
+				ast_cond_timedwait(&batch->cond, &batch->lock, &ts);
+				continue;
+			}
+			if (!batch->queued) {
+				ast_cond_wait(&batch->cond, &batch->lock);
+				continue;
+			}
+			when = ast_tvadd(AST_LIST_FIRST(&batch->rows)->queued, ast_samp2tv(batch->latency, 1000));
+			if (ast_tvcmp(when, ast_tvnow()) <= 0) {
+				break;
+			}
+			ts.tv_sec = when.tv_sec;
+			ts.tv_nsec = when.tv_usec * 1000;
+			ast_cond_timedwait(&batch->cond, &batch->lock, &ts);
+		}
+		if (!batch->queued && !batch->stop) {
+			/* Nothing queued, but rows were spooled while the database was down. */
+			ast_mutex_unlock(&batch->lock);
+			odbc_batch_replay(batch);
+			ast_mutex_lock(&batch->lock);
+			continue;
+		}
+		if (!batch->queued) {
+			/* Only stopping when all rows are written.  Spooled rows wait for the next start. */
+			break;
+		}
+
+		for (count = 0; count < batch->size && (row = AST_LIST_REMOVE_HEAD(&batch->rows, list)); ++count) {
+			AST_LIST_INSERT_TAIL(&rows, row, list);
+		}
+		batch->queued -= count;
+		ast_mutex_unlock(&batch->lock);
+
+		odbc_batch_flush(batch, &rows);
+		odbc_batch_rows_free(&rows);
+
+		ast_mutex_lock(&batch->lock);
+	}
+	ast_mutex_unlock(&batch->lock);
+
+	return NULL;
+}
+
+struct odbc_batch *ast_odbc_batch_create(const char *connection, const char *name, unsigned int size,
+	unsigned int latency, unsigned int retries, int multirow)
+{
+	struct odbc_batch *batch;
+	char spooldir[PATH_MAX];
+	char *c;
+
+	snprintf(spooldir, sizeof(spooldir), "%s/odbc", ast_config_AST_SPOOL_DIR);
+	if (ast_mkdir(spooldir, 0777)) {
+		ast_log(LOG_WARNING, "Unable to create spool directory '%s' for batch '%s'\n", spooldir, name);
+	}
+
+	if (!(batch = ast_calloc(1, sizeof(*batch) + strlen(connection) + 1 + strlen(name) + 1
+		+ strlen(spooldir) + 1 + strlen(name) + strlen(".spool") + 1))) {
+		return NULL;
+	}
+	batch->connection = batch->data;
+	strcpy(batch->connection, connection);
+	batch->name = batch->connection + strlen(connection) + 1;
+	strcpy(batch->name, name);
+	batch->spool = batch->name + strlen(name) + 1;
+	sprintf(batch->spool, "%s/%s.spool", spooldir, name);
+	/* The name is a file name in the spool directory. */
+	for (c = batch->spool + strlen(spooldir) + 1; *c; ++c) {
+		if (*c == '/') {
+			*c = '_';
+		}
+	}
+	batch->size = size ? size : 1;
+	batch->latency = latency;
+	batch->retries = retries;
+	batch->multirow = multirow ? 1 : 0;
+	/* Rows spooled before a restart are written once the database is up. */
+	batch->spool_pending = 1;
+	AST_LIST_HEAD_INIT_NOLOCK(&batch->rows);
+	ast_mutex_init(&batch->lock);
+	ast_cond_init(&batch->cond, NULL);
+
+	if (ast_pthread_create(&batch->thread, NULL, odbc_batch_thread, batch)) {
+		ast_log(LOG_ERROR, "Unable to start the thread of batch '%s'\n", name);
+		ast_cond_destroy(&batch->cond);
+		ast_mutex_destroy(&batch->lock);
+		ast_free(batch);
+		return NULL;
+	}
+
+	AST_RWLIST_WRLOCK(&odbc_batches);
+	AST_RWLIST_INSERT_TAIL(&odbc_batches, batch, list);
+	AST_RWLIST_UNLOCK(&odbc_batches);
+
+	return batch;
+}
+
+int ast_odbc_batch_add(struct odbc_batch *batch, const char *insert, const char *values)
+{
+	struct odbc_batch_rows rows = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct odbc_batch_row *row;
+	int res;
+
+	if (!(row = odbc_batch_row_alloc(insert, values))) {
+		return -1;
+	}
+
+	ast_mutex_lock(&batch->lock);
+	if (batch->queued >= batch->size * ODBC_BATCH_MAX_QUEUED) {
+		/* The database is not keeping up, do not let the rows take all memory. */
+		ast_mutex_unlock(&batch->lock);
+		AST_LIST_INSERT_TAIL(&rows, row, list);
+		res = odbc_batch_spool(batch, &rows);
+		odbc_batch_rows_free(&rows);
+		return res;
+	}
+	AST_LIST_INSERT_TAIL(&batch->rows, row, list);
+	/* Wake the thread to start the latency timer, or to write a full batch. */
+	if (++batch->queued == 1 || batch->queued == batch->size) {
+		ast_cond_signal(&batch->cond);
+	}
+	ast_mutex_unlock(&batch->lock);
+
+	return 0;
+}
+
+void ast_odbc_batch_destroy(struct odbc_batch *batch)
+{
+	AST_RWLIST_WRLOCK(&odbc_batches);
+	AST_RWLIST_REMOVE(&odbc_batches, batch, list);
+	AST_RWLIST_UNLOCK(&odbc_batches);
+
+	ast_mutex_lock(&batch->lock);
+	batch->stop = 1;
+	ast_cond_signal(&batch->cond);
+	ast_mutex_unlock(&batch->lock);
+	pthread_join(batch->thread, NULL);
+
+	ast_cond_destroy(&batch->cond);
+	ast_mutex_destroy(&batch->lock);
+	ast_free(batch);
+}
+
+static char *handle_cli_odbc_show_batches(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-30.30s %-15.15s %7s %10s %10s %10s %8s %8s %8s %8s %s\n"
+#define FORMAT2 "%-30.30s %-15.15s %7u %10u %10u %10u %8u %8u %8u %8u %s\n"
+	struct odbc_batch *batch;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "odbc show batches";
+		e->usage =
+				"Usage: odbc show batches\n"
+				"       List the tables written in batches, with the rows waiting\n"
+				"       to be written, the rows written, the rows spooled to disk\n"
+				"       when the database could not be written, and the rows dropped\n"
+				"       because the database refused them.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Batch", "Connection", "Queued", "Written", "Statements", "Commits", "Failures", "Spooled", "Replayed", "Dropped", "State");
+	AST_RWLIST_RDLOCK(&odbc_batches);
+	AST_RWLIST_TRAVERSE(&odbc_batches, batch, list) {
+		ast_mutex_lock(&batch->lock);
+		ast_cli(a->fd, FORMAT2, batch->name, batch->connection, batch->queued, batch->written,
+			batch->statements, batch->commits, batch->failures, batch->spooled, batch->replayed, batch->dropped,
+			ast_tvcmp(batch->down_until, ast_tvnow()) > 0 ? "Spooling" : "Up");
+		ast_mutex_unlock(&batch->lock);
+	}
+	AST_RWLIST_UNLOCK(&odbc_batches);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
 static struct ast_cli_entry cli_odbc[] = {
-	AST_CLI_DEFINE(handle_cli_odbc_show, "List ODBC DSN(s)")
+	AST_CLI_DEFINE(handle_cli_odbc_show, "List ODBC DSN(s)"),
+	AST_CLI_DEFINE(handle_cli_odbc_show_batches, "List the tables written in batches"),
 };
 
 static int odbc_register_class(struct odbc_class *class, int preconnect)
@@ -40,6 +40,13 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 356042 $")
 #include <signal.h>
 #include <fcntl.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+/*! Receive RTP on a pool of threads rather than on the channel threads */
+#define RTP_RX_POOL
+#endif
+
 #include "asterisk/stun.h"
 #include "asterisk/pbx.h"
 #include "asterisk/frame.h"
@@ -53,6 +60,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 356042 $")
 #include "asterisk/unaligned.h"
 #include "asterisk/module.h"
 #include "asterisk/rtp_engine.h"
+#include "asterisk/test.h"
 
 #define MAX_TIMESTAMP_SKEW	640
 
@@ -82,6 +90,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 356042 $")
 
 #define DEFAULT_LEARNING_MIN_SEQUENTIAL 4
 
+#define RTP_RX_RING_SIZE 16 /*!< Packets queued for an instance by a receive thread */
+#define RTP_RX_SLOT_SIZE 1500 /*!< Largest packet a receive thread accepts */
+#define RTP_RX_BATCH 32 /*!< Packets read with one recvmmsg() call */
+#define RTP_RX_RELAY_WAKE_MS 1000 /*!< How often a channel whose packets are relayed is woken anyway */
+
 extern struct ast_srtp_res *res_srtp;
 static int dtmftimeout = DEFAULT_DTMF_TIMEOUT;
 
@@ -100,6 +113,7 @@ static int nochecksums;
 #endif
 static int strictrtp;			/*< Only accept RTP frames from a defined source. If we receive an indication of a changing source, enter learning mode. */
 static int learning_min_sequential;	/*< Number of sequential RTP frames needed from a single source during learning mode to accept new source. */
+static unsigned int rxthreads;		/*< Number of threads receiving RTP for all instances, 0 to receive on the channel threads (read on load). */
 
 enum strict_rtp_state {
 	STRICT_RTP_OPEN = 0, /*! No RTP packets should be dropped, all sources accepted */
@@ -107,6 +121,17 @@ enum strict_rtp_state {
 	STRICT_RTP_CLOSED,   /*! Drop all RTP packets not coming from source that was learned */
 };
 
+#ifdef RTP_RX_POOL
+/*! \brief A packet queued for an instance by a receive thread */
+struct rtp_rx_slot {
+	int len;                                /*!< Length of the packet, -1 if it was truncated */
+	struct ast_sockaddr addr;               /*!< Where the packet came from */
+	unsigned char buf[RTP_RX_SLOT_SIZE];
+};
+
+struct rtp_rx;
+#endif
+
 #define FLAG_3389_WARNING               (1 << 0)
 #define FLAG_NAT_ACTIVE                 (3 << 1)
 #define FLAG_NAT_INACTIVE               (0 << 1)
@@ -187,6 +212,9 @@ struct ast_rtp {
 	int learning_probation;		/*!< Sequential packets untill source is valid */
 
 	struct rtp_red *red;
+#ifdef RTP_RX_POOL
+	struct rtp_rx *rx;              /*!< Receive ring, when a receive thread reads our socket */
+#endif
 };
 
 /*!
@@ -514,6 +542,553 @@ static int rtp_learning_rtp_seq_update(struct ast_rtp *rtp, uint16_t seq)
 	return probation;
 }
 
+#ifdef RTP_RX_POOL
+/*!
+ * \brief How a receive thread relays the packets of a locally bridged instance
+ *
+ * This is a snapshot of what bridge_p2p_rtp_write() would look up for each
+ * packet.  Packets it does not cover are queued for the channel as usual.
+ */
+struct rtp_rx_relay {
+	struct rtp_rx *peer;                    /*!< Receive ring of the bridged instance, NULL if not relaying */
+	struct ast_sockaddr them;               /*!< Where the bridged instance sends to */
+	struct ast_sockaddr from;               /*!< Only packets from here are relayed, from anywhere if null */
+	signed char payloads[128];              /*!< Payload type to send for each one received, -1 to leave to the channel */
+	unsigned int mark:1;                    /*!< Set the marker bit on the next packet relayed */
+};
+
+/*!
+ * \brief Packets received for an instance by a receive thread
+ *
+ * The receive thread fills slots at head and the channel thread empties them
+ * at tail, so the ring needs no lock.  The channel is woken through wakefd,
+ * at most once for each time it empties the ring.
+ *
+ * An instance and the instance it relays to are always on the same thread,
+ * so the thread lock covers both.
+ */
+struct rtp_rx {
+	int s;                                  /*!< RTP socket of the instance */
+	int wakefd;                             /*!< eventfd the channel polls instead of the socket */
+	volatile int signaled;                  /*!< Set when wakefd has been written to and not read yet */
+	int dead;                               /*!< Set when the instance is gone, under the thread lock */
+	volatile unsigned int head;             /*!< Next slot the receive thread fills */
+	volatile unsigned int tail;             /*!< Next slot the channel thread empties */
+	struct rtp_rx_thread *thread;           /*!< Changed under the locks of both threads and rx_move_lock */
+	AST_LIST_ENTRY(rtp_rx) list;
+	struct rtp_rx_relay relay;
+	struct rtp_rx *relayed_by;              /*!< Instance relaying to this one */
+	struct timeval lastwake;                /*!< When the channel was last woken while relaying */
+	struct timeval lastsync;                /*!< When the channel last refreshed the relay, channel thread only */
+	unsigned int relayed_in;                /*!< Packets received and relayed */
+	unsigned int relayed_out;               /*!< Packets relayed out through this socket */
+	struct rtp_rx_slot slots[RTP_RX_RING_SIZE];
+};
+
+AST_LIST_HEAD_NOLOCK(rtp_rx_list, rtp_rx);
+
+/*! \brief A thread receiving the RTP of the instances added to its epoll set */
+struct rtp_rx_thread {
+	pthread_t thread;
+	int epfd;
+	ast_mutex_t lock;                       /*!< Held while draining, so instances can be removed safely */
+	struct rtp_rx_list garbage;             /*!< Removed instances, freed once no event can refer to them */
+	unsigned int instances;
+	unsigned long packets;                  /*!< Packets received */
+	unsigned long syscalls;                 /*!< recvmmsg() calls that returned packets */
+	unsigned long wakeups;                  /*!< Times a channel was woken */
+	unsigned long dropped;                  /*!< Packets dropped because the ring of an instance was full */
+	unsigned long relayed;                  /*!< Packets relayed to a bridged instance */
+	struct rtp_rx_slot scratch;             /*!< Where packets that are dropped are read to */
+	struct rtp_rx_slot batch[RTP_RX_BATCH]; /*!< Where packets of instances that relay are read to */
+};
+
+static struct rtp_rx_thread *rx_threads;
+static unsigned int rx_thread_count;
+static unsigned int rx_next_thread;
+static int rx_stopfd = -1;
+static volatile int rx_stop;
+AST_MUTEX_DEFINE_STATIC(rx_move_lock);
+
+/*!
+ * \brief Send on the packets of a batch that can be relayed, and queue the others
+ *
+ * Called with the thread locked.
+ *
+ * \return non-zero if packets were queued for the channel
+ */
+static int rtp_rx_relay(struct rtp_rx_thread *thread, struct rtp_rx *rx, struct rtp_rx_slot **slots, int count)
+{
+	struct rtp_rx_relay *relay = &rx->relay;
+	struct mmsghdr msgs[RTP_RX_BATCH];
+	struct iovec iov[RTP_RX_BATCH];
+	struct rtp_rx_slot *slot, *queue;
+	unsigned int head = rx->head, header;
+	int i, num = 0, sent, res, payload;
+
+	for (i = 0; i < count; i++) {
+		slot = slots[i];
+		/* rtpdebug is checked here so that relayed packets are still shown */
+		if (slot->len >= 12 && !rtpdebug) {
+			header = ntohl(get_unaligned_uint32(slot->buf));
+			payload = relay->payloads[(header & 0x7f0000) >> 16];
+			if ((header >> 30) == 2 && payload > -1
+				&& (ast_sockaddr_isnull(&relay->from) || !ast_sockaddr_cmp(&relay->from, &slot->addr))) {
+				/* Rewrite the header in place, as bridge_p2p_rtp_write() does */
+				header = (header & 0xFF80FFFF) | (payload << 16);
+				if (relay->mark) {
+					header |= (1 << 23);
+					relay->mark = 0;
+				}
+				put_unaligned_uint32(slot->buf, htonl(header));
+
+				iov[num].iov_base = slot->buf;
+				iov[num].iov_len = slot->len;
+				memset(&msgs[num], 0, sizeof(msgs[num]));
+				msgs[num].msg_hdr.msg_name = &relay->them.ss;
+				msgs[num].msg_hdr.msg_namelen = relay->them.len;
+				msgs[num].msg_hdr.msg_iov = &iov[num];
+				msgs[num].msg_hdr.msg_iovlen = 1;
+				num++;
+				continue;
+			}
+		}
+
+		/* Anything else, such as STUN or an unexpected payload, goes to the channel */
+		if (head - rx->tail >= RTP_RX_RING_SIZE) {
+			thread->dropped++;
+			continue;
+		}
+		queue = &rx->slots[head++ % RTP_RX_RING_SIZE];
+		queue->len = slot->len;
+		ast_sockaddr_copy(&queue->addr, &slot->addr);
+		if (slot->len > 0) {
+			memcpy(queue->buf, slot->buf, slot->len);
+		}
+	}
+
+	for (sent = 0; sent < num; sent += res) {
+		if ((res = sendmmsg(relay->peer->s, msgs + sent, num - sent, MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR) {
+				res = 0;
+				continue;
+			}
+			/* As for bridge_p2p_rtp_write(), a failed send does not end the bridge */
+			ast_debug(1, "RTP relay transmission error to %s: %s\n",
+				ast_sockaddr_stringify(&relay->them), strerror(errno));
+			break;
+		}
+	}
+	rx->relayed_in += num;
+	relay->peer->relayed_out += sent;
+	thread->relayed += sent;
+
+	if (head == rx->head) {
+		return 0;
+	}
+	__sync_synchronize();
+	rx->head = head;
+	return 1;
+}
+
+/*! \brief Read everything queued on the socket of an instance into its ring.  Called with the thread locked. */
+static void rtp_rx_drain(struct rtp_rx_thread *thread, struct rtp_rx *rx)
+{
+	struct mmsghdr msgs[RTP_RX_BATCH];
+	struct iovec iov[RTP_RX_BATCH];
+	struct rtp_rx_slot *slots[RTP_RX_BATCH];
+	unsigned int head = rx->head, space, count, i;
+	int res, queued = 0;
+
+	for (;;) {
+		space = RTP_RX_RING_SIZE - (head - rx->tail);
+		count = space && !rx->relay.peer ? MIN(space, RTP_RX_BATCH) : RTP_RX_BATCH;
+		for (i = 0; i < count; i++) {
+			if (rx->relay.peer) {
+				slots[i] = &thread->batch[i];
+			} else {
+				slots[i] = space ? &rx->slots[(head + i) % RTP_RX_RING_SIZE] : &thread->scratch;
+			}
+			iov[i].iov_base = slots[i]->buf;
+			iov[i].iov_len = sizeof(slots[i]->buf);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &slots[i]->addr.ss;
+			msgs[i].msg_hdr.msg_namelen = sizeof(slots[i]->addr.ss);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		if ((res = recvmmsg(rx->s, msgs, count, MSG_DONTWAIT, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNREFUSED) {
+				/* The error has been consumed, there may be more packets */
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ast_log(LOG_WARNING, "RTP Read error: %s\n", strerror(errno));
+			}
+			break;
+		}
+		thread->syscalls++;
+		thread->packets += res;
+
+		for (i = 0; i < res; i++) {
+			slots[i]->len = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? -1 : msgs[i].msg_len;
+			slots[i]->addr.len = msgs[i].msg_hdr.msg_namelen;
+		}
+		if (rx->relay.peer) {
+			queued |= rtp_rx_relay(thread, rx, slots, res);
+			head = rx->head;
+		} else if (!space) {
+			thread->dropped += res;
+		} else {
+			/* The slots must be filled before the channel thread can see them */
+			__sync_synchronize();
+			rx->head = head += res;
+			queued = 1;
+		}
+
+		/* The socket is edge triggered, so keep going until it is empty */
+		if (res < count) {
+			break;
+		}
+	}
+
+	if (rx->relay.peer) {
+		struct timeval now = ast_tvnow();
+
+		/* Wake the channel now and then anyway, so that it sees RTP is still flowing */
+		if (queued || ast_tvdiff_ms(now, rx->lastwake) >= RTP_RX_RELAY_WAKE_MS) {
+			rx->lastwake = now;
+			queued = 1;
+		}
+	}
+
+	if (queued && __sync_bool_compare_and_swap(&rx->signaled, 0, 1)) {
+		uint64_t one = 1;
+
+		thread->wakeups++;
+		if (write(rx->wakefd, &one, sizeof(one)) < 0) {
+			ast_log(LOG_WARNING, "RTP wakeup write error: %s\n", strerror(errno));
+		}
+	}
+}
+
+static void rtp_rx_free(struct rtp_rx *rx)
+{
+	close(rx->wakefd);
+	ast_free(rx);
+}
+
+static void *rtp_rx_thread_run(void *data)
+{
+	struct rtp_rx_thread *thread = data;
+	struct epoll_event events[RTP_RX_BATCH];
+	struct rtp_rx_list garbage;
+	struct rtp_rx *rx;
+	int i, res;
+
+	while (!rx_stop) {
+		/* Anything removed before this point cannot be in the events returned below */
+		ast_mutex_lock(&thread->lock);
+		garbage = thread->garbage;
+		AST_LIST_HEAD_INIT_NOLOCK(&thread->garbage);
+		ast_mutex_unlock(&thread->lock);
+		while ((rx = AST_LIST_REMOVE_HEAD(&garbage, list))) {
+			rtp_rx_free(rx);
+		}
+
+		if ((res = epoll_wait(thread->epfd, events, ARRAY_LEN(events), 1000)) < 0) {
+			if (errno != EINTR) {
+				ast_log(LOG_WARNING, "epoll_wait() failed: %s\n", strerror(errno));
+				usleep(1000);
+			}
+			continue;
+		}
+
+		ast_mutex_lock(&thread->lock);
+		for (i = 0; i < res; i++) {
+			/* A NULL pointer is the stop eventfd.  An instance may have moved to another thread. */
+			if ((rx = events[i].data.ptr) && !rx->dead && rx->thread == thread) {
+				rtp_rx_drain(thread, rx);
+			}
+		}
+		ast_mutex_unlock(&thread->lock);
+	}
+
+	return NULL;
+}
+
+/*! \brief Stop the receive threads.  Instances added to them must have been removed. */
+static void rtp_rx_stop(void)
+{
+	struct rtp_rx *rx;
+	uint64_t one = 1;
+	unsigned int i;
+
+	if (!rx_threads) {
+		return;
+	}
+
+	rx_stop = 1;
+	if (write(rx_stopfd, &one, sizeof(one)) < 0) {
+		ast_log(LOG_WARNING, "Unable to wake RTP receive threads: %s\n", strerror(errno));
+	}
+	for (i = 0; i < rx_thread_count; i++) {
+		if (rx_threads[i].thread != AST_PTHREADT_NULL) {
+			pthread_join(rx_threads[i].thread, NULL);
+		}
+		while ((rx = AST_LIST_REMOVE_HEAD(&rx_threads[i].garbage, list))) {
+			rtp_rx_free(rx);
+		}
+		if (rx_threads[i].epfd > -1) {
+			close(rx_threads[i].epfd);
+		}
+		ast_mutex_destroy(&rx_threads[i].lock);
+	}
+
+	ast_free(rx_threads);
+	rx_threads = NULL;
+	rx_thread_count = 0;
+	close(rx_stopfd);
+	rx_stopfd = -1;
+}
+
+/*! \brief Start \a count receive threads */
+static int rtp_rx_start(unsigned int count)
+{
+	struct epoll_event ev = { .events = EPOLLIN, };
+	unsigned int i;
+
+	if (!count) {
+		return 0;
+	}
+
+	if ((rx_stopfd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		ast_log(LOG_ERROR, "Unable to create eventfd: %s\n", strerror(errno));
+		return -1;
+	}
+	if (!(rx_threads = ast_calloc(count, sizeof(*rx_threads)))) {
+		close(rx_stopfd);
+		rx_stopfd = -1;
+		return -1;
+	}
+	rx_stop = 0;
+	rx_thread_count = count;
+	for (i = 0; i < count; i++) {
+		rx_threads[i].thread = AST_PTHREADT_NULL;
+		ast_mutex_init(&rx_threads[i].lock);
+		if ((rx_threads[i].epfd = epoll_create(1024)) < 0
+			|| epoll_ctl(rx_threads[i].epfd, EPOLL_CTL_ADD, rx_stopfd, &ev)
+			|| ast_pthread_create_background(&rx_threads[i].thread, NULL, rtp_rx_thread_run, &rx_threads[i])) {
+			ast_log(LOG_ERROR, "Unable to start RTP receive thread: %s\n", strerror(errno));
+			rtp_rx_stop();
+			return -1;
+		}
+	}
+
+	ast_verb(2, "RTP receiving on %u threads\n", count);
+	return 0;
+}
+
+/*!
+ * \brief Hand the socket of an instance over to a receive thread
+ *
+ * \retval NULL if there are no receive threads or on failure, in which case
+ * the channel reads the socket itself
+ */
+static struct rtp_rx *rtp_rx_add(int s)
+{
+	struct rtp_rx_thread *thread;
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLET, };
+	struct rtp_rx *rx;
+
+	if (!rx_thread_count || !(rx = ast_calloc(1, sizeof(*rx)))) {
+		return NULL;
+	}
+	if ((rx->wakefd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		ast_log(LOG_WARNING, "Unable to create eventfd: %s\n", strerror(errno));
+		ast_free(rx);
+		return NULL;
+	}
+	rx->s = s;
+	rx->thread = thread = &rx_threads[(unsigned int) ast_atomic_fetchadd_int((int *) &rx_next_thread, 1) % rx_thread_count];
+
+	ev.data.ptr = rx;
+	ast_mutex_lock(&thread->lock);
+	if (epoll_ctl(thread->epfd, EPOLL_CTL_ADD, s, &ev)) {
+		ast_mutex_unlock(&thread->lock);
+		ast_log(LOG_WARNING, "Unable to add RTP socket to receive thread: %s\n", strerror(errno));
+		rtp_rx_free(rx);
+		return NULL;
+	}
+	thread->instances++;
+	ast_mutex_unlock(&thread->lock);
+
+	return rx;
+}
+
+/*! \brief Lock the thread of an instance, which may change until it is locked */
+static struct rtp_rx_thread *rtp_rx_lock(struct rtp_rx *rx)
+{
+	struct rtp_rx_thread *thread;
+
+	for (;;) {
+		thread = rx->thread;
+		ast_mutex_lock(&thread->lock);
+		if (thread == rx->thread) {
+			return thread;
+		}
+		ast_mutex_unlock(&thread->lock);
+	}
+}
+
+/*! \brief Stop relaying to and from an instance.  Called with its thread locked. */
+static void rtp_rx_unrelay(struct rtp_rx *rx)
+{
+	if (rx->relay.peer && rx->relay.peer->relayed_by == rx) {
+		rx->relay.peer->relayed_by = NULL;
+	}
+	rx->relay.peer = NULL;
+	if (rx->relayed_by) {
+		rx->relayed_by->relay.peer = NULL;
+		rx->relayed_by = NULL;
+	}
+}
+
+/*! \brief Take the socket of an instance back from its receive thread.  Must be called before it is closed. */
+static void rtp_rx_remove(struct rtp_rx *rx)
+{
+	struct rtp_rx_thread *thread = rtp_rx_lock(rx);
+
+	epoll_ctl(thread->epfd, EPOLL_CTL_DEL, rx->s, NULL);
+	rx->dead = 1;
+	rtp_rx_unrelay(rx);
+	thread->instances--;
+	AST_LIST_INSERT_TAIL(&thread->garbage, rx, list);
+	ast_mutex_unlock(&thread->lock);
+}
+
+/*! \brief Move an instance to another receive thread */
+static int rtp_rx_move(struct rtp_rx *rx, struct rtp_rx_thread *to)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = rx, };
+	struct rtp_rx_thread *from;
+	int res = 0;
+
+	ast_mutex_lock(&rx_move_lock);
+	if ((from = rx->thread) == to) {
+		ast_mutex_unlock(&rx_move_lock);
+		return 0;
+	}
+
+	/* Lock in a fixed order, the move lock keeps anyone else from taking two */
+	ast_mutex_lock(from < to ? &from->lock : &to->lock);
+	ast_mutex_lock(from < to ? &to->lock : &from->lock);
+
+	/* If the socket is readable when it is added the new thread gets an event for it */
+	if (epoll_ctl(to->epfd, EPOLL_CTL_ADD, rx->s, &ev)) {
+		ast_log(LOG_WARNING, "Unable to move RTP socket to another receive thread: %s\n", strerror(errno));
+		res = -1;
+	} else {
+		epoll_ctl(from->epfd, EPOLL_CTL_DEL, rx->s, NULL);
+		rtp_rx_unrelay(rx);
+		from->instances--;
+		to->instances++;
+		rx->thread = to;
+	}
+
+	ast_mutex_unlock(&to->lock);
+	ast_mutex_unlock(&from->lock);
+	ast_mutex_unlock(&rx_move_lock);
+
+	return res;
+}
+
+/*!
+ * \brief Set up relaying of the packets of an instance to the instance it is bridged to
+ *
+ * \param instance0 The instance receiving the packets
+ * \param instance1 The instance sending them on, or NULL to stop relaying
+ *
+ * The receive thread relays the packets bridge_p2p_rtp_write() would send on
+ * unchanged but for the header, as long as nothing they depend on changes.
+ * This is called again when something might have.
+ */
+static void rtp_rx_relay_set(struct ast_rtp_instance *instance0, struct ast_rtp_instance *instance1)
+{
+	struct ast_rtp *rtp0 = ast_rtp_instance_get_data(instance0);
+	struct ast_rtp *rtp1 = instance1 ? ast_rtp_instance_get_data(instance1) : NULL;
+	struct ast_rtp_codecs *codecs0 = ast_rtp_instance_get_codecs(instance0);
+	struct ast_rtp_codecs *codecs1 = instance1 ? ast_rtp_instance_get_codecs(instance1) : NULL;
+	struct ast_rtp_payload_type payload_type;
+	struct ast_sockaddr remote_address;
+	struct rtp_rx_relay relay = { NULL, };
+	struct rtp_rx_thread *thread;
+	int i, code;
+
+	if (rtp1 && rtp1->rx && !ast_rtp_instance_get_srtp(instance0) && !ast_rtp_instance_get_srtp(instance1)) {
+		relay.peer = rtp1->rx;
+		ast_rtp_instance_get_remote_address(instance1, &relay.them);
+		ast_rtp_instance_get_remote_address(instance0, &remote_address);
+
+		/* Packets strict RTP or symmetric RTP have to look at are left to the channel */
+		if (rtp0->strict_rtp_state == STRICT_RTP_LEARN) {
+			relay.peer = NULL;
+		} else if (rtp0->strict_rtp_state == STRICT_RTP_CLOSED) {
+			ast_sockaddr_copy(&relay.from, &rtp0->strict_rtp_address);
+		}
+		if (ast_rtp_instance_get_prop(instance0, AST_RTP_PROPERTY_NAT)) {
+			if (ast_sockaddr_isnull(&remote_address)) {
+				relay.peer = NULL;
+			} else if (ast_sockaddr_isnull(&relay.from)) {
+				ast_sockaddr_copy(&relay.from, &remote_address);
+			} else if (ast_sockaddr_cmp(&relay.from, &remote_address)) {
+				relay.peer = NULL;
+			}
+		}
+		if (ast_sockaddr_isnull(&relay.them)) {
+			relay.peer = NULL;
+		}
+
+		for (i = 0; i < ARRAY_LEN(relay.payloads); i++) {
+			payload_type = ast_rtp_codecs_payload_lookup(codecs0, i);
+			code = ast_rtp_codecs_payload_code(codecs1, payload_type.asterisk_format, &payload_type.format, payload_type.rtp_code);
+			if (code < 0 || code >= ARRAY_LEN(relay.payloads)
+				|| (!codecs1->payloads[code].rtp_code && !codecs1->payloads[code].asterisk_format)) {
+				code = -1;
+			}
+			relay.payloads[i] = code;
+		}
+	}
+
+	/* Relaying needs both instances on the same thread */
+	if (relay.peer && rtp_rx_move(rtp0->rx, relay.peer->thread)) {
+		relay.peer = NULL;
+	}
+
+	thread = rtp_rx_lock(rtp0->rx);
+	if (relay.peer && (relay.peer->thread != thread || relay.peer->dead)) {
+		relay.peer = NULL;
+	}
+	if (relay.peer && relay.peer == rtp0->rx->relay.peer) {
+		relay.mark = rtp0->rx->relay.mark;
+	} else if (relay.peer) {
+		/* Relaying takes over the marker bit from bridge_p2p_rtp_write() */
+		relay.mark = ast_test_flag(rtp0, FLAG_NEED_MARKER_BIT) ? 1 : 0;
+		ast_clear_flag(rtp0, FLAG_NEED_MARKER_BIT);
+		rtp0->rx->lastwake = ast_tvnow();
+	}
+	if (rtp0->rx->relay.peer && rtp0->rx->relay.peer->relayed_by == rtp0->rx) {
+		rtp0->rx->relay.peer->relayed_by = NULL;
+	}
+	if (relay.peer) {
+		relay.peer->relayed_by = rtp0->rx;
+	}
+	rtp0->rx->relay = relay;
+	ast_mutex_unlock(&thread->lock);
+}
+#endif
+
 static int ast_rtp_new(struct ast_rtp_instance *instance,
 		       struct ast_sched_context *sched, struct ast_sockaddr *addr,
 		       void *data)
@@ -570,6 +1145,10 @@ static int ast_rtp_new(struct ast_rtp_instance *instance,
 		}
 	}
 
+#ifdef RTP_RX_POOL
+	rtp->rx = rtp_rx_add(rtp->s);
+#endif
+
 	/* Record any information we may need */
 	rtp->sched = sched;
 
@@ -588,6 +1167,12 @@ static int ast_rtp_destroy(struct ast_rtp_instance *instance)
 		ast_smoother_free(rtp->smoother);
 	}
 
+#ifdef RTP_RX_POOL
+	if (rtp->rx) {
+		rtp_rx_remove(rtp->rx);
+	}
+#endif
+
 	/* Close our own socket so we no longer get packets */
 	if (rtp->s > -1) {
 		close(rtp->s);
@@ -2098,41 +2683,23 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance, unsigned int
 	return 0;
 }
 
-static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtcp)
+/*!
+ * \internal
+ * \brief Turn an RTP packet received into rtp->rawdata into frames
+ *
+ * \param instance The RTP instance
+ * \param res Length of the packet
+ * \param addr Address the packet came from
+ */
+static struct ast_frame *ast_rtp_read_packet(struct ast_rtp_instance *instance, int res, struct ast_sockaddr *addr)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
-	struct ast_sockaddr addr;
-	int res, hdrlen = 12, version, payloadtype, padding, mark, ext, cc, prev_seqno;
+	int hdrlen = 12, version, payloadtype, padding, mark, ext, cc, prev_seqno;
 	unsigned int *rtpheader = (unsigned int*)(rtp->rawdata + AST_FRIENDLY_OFFSET), seqno, ssrc, timestamp;
 	struct ast_rtp_payload_type payload;
 	struct ast_sockaddr remote_address = { {0,} };
 	struct frame_list frames;
 
-	/* If this is actually RTCP let's hop on over and handle it */
-	if (rtcp) {
-		if (rtp->rtcp) {
-			return ast_rtcp_read(instance);
-		}
-		return &ast_null_frame;
-	}
-
-	/* If we are currently sending DTMF to the remote party send a continuation packet */
-	if (rtp->sending_digit) {
-		ast_rtp_dtmf_continuation(instance);
-	}
-
-	/* Actually read in the data from the socket */
-	if ((res = rtp_recvfrom(instance, rtp->rawdata + AST_FRIENDLY_OFFSET,
-				sizeof(rtp->rawdata) - AST_FRIENDLY_OFFSET, 0,
-				&addr)) < 0) {
-		ast_assert(errno != EBADF);
-		if (errno != EAGAIN) {
-			ast_log(LOG_WARNING, "RTP Read error: %s. Hanging up.\n", strerror(errno));
-			return NULL;
-		}
-		return &ast_null_frame;
-	}
-
 	/* Make sure the data that was read in is actually enough to make up an RTP packet */
 	if (res < hdrlen) {
 		ast_log(LOG_WARNING, "RTP Read too short\n");
@@ -2141,9 +2708,9 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 
 	/* If strict RTP protection is enabled see if we need to learn the remote address or if we need to drop the packet */
 	if (rtp->strict_rtp_state == STRICT_RTP_LEARN) {
-		ast_debug(1, "%p -- start learning mode pass with addr = %s\n", rtp, ast_sockaddr_stringify(&addr));
+		ast_debug(1, "%p -- start learning mode pass with addr = %s\n", rtp, ast_sockaddr_stringify(addr));
 		/* For now, we always copy the address. */
-		ast_sockaddr_copy(&rtp->strict_rtp_address, &addr);
+		ast_sockaddr_copy(&rtp->strict_rtp_address, addr);
 
 		/* Send the rtp and the seqno from header to rtp_learning_rtp_seq_update to see whether we can exit or not*/
 		if (rtp_learning_rtp_seq_update(rtp, ntohl(rtpheader[0]))) {
@@ -2151,17 +2718,17 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 			return &ast_null_frame;
 		}
 
-		ast_debug(1, "%p -- Probation Ended. Set strict_rtp_state to STRICT_RTP_CLOSED with address %s\n", rtp, ast_sockaddr_stringify(&addr));
+		ast_debug(1, "%p -- Probation Ended. Set strict_rtp_state to STRICT_RTP_CLOSED with address %s\n", rtp, ast_sockaddr_stringify(addr));
 		rtp->strict_rtp_state = STRICT_RTP_CLOSED;
 	} else if (rtp->strict_rtp_state == STRICT_RTP_CLOSED) {
-		if (ast_sockaddr_cmp(&rtp->strict_rtp_address, &addr)) {
+		if (ast_sockaddr_cmp(&rtp->strict_rtp_address, addr)) {
 			/* Hmm, not the strict addres. Perhaps we're getting audio from the alternate? */
-			if (!ast_sockaddr_cmp(&rtp->alt_rtp_address, &addr)) {
+			if (!ast_sockaddr_cmp(&rtp->alt_rtp_address, addr)) {
 				/* ooh, we did! You're now the new expected address, son! */
 				ast_sockaddr_copy(&rtp->strict_rtp_address,
-						  &addr);
+						  addr);
 			} else  {
-				const char *real_addr = ast_strdupa(ast_sockaddr_stringify(&addr));
+				const char *real_addr = ast_strdupa(ast_sockaddr_stringify(addr));
 				const char *expected_addr = ast_strdupa(ast_sockaddr_stringify(&rtp->strict_rtp_address));
 
 				ast_debug(1, "Received RTP packet from %s, dropping due to strict RTP protection. Expected it to be from %s\n",
@@ -2180,33 +2747,33 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 	if (!(version = (seqno & 0xC0000000) >> 30)) {
 		struct sockaddr_in addr_tmp;
 		struct ast_sockaddr addr_v4;
-		if (ast_sockaddr_is_ipv4(&addr)) {
-			ast_sockaddr_to_sin(&addr, &addr_tmp);
-		} else if (ast_sockaddr_ipv4_mapped(&addr, &addr_v4)) {
+		if (ast_sockaddr_is_ipv4(addr)) {
+			ast_sockaddr_to_sin(addr, &addr_tmp);
+		} else if (ast_sockaddr_ipv4_mapped(addr, &addr_v4)) {
 			ast_debug(1, "Using IPv6 mapped address %s for STUN\n",
-				  ast_sockaddr_stringify(&addr));
+				  ast_sockaddr_stringify(addr));
 			ast_sockaddr_to_sin(&addr_v4, &addr_tmp);
 		} else {
 			ast_debug(1, "Cannot do STUN for non IPv4 address %s\n",
-				  ast_sockaddr_stringify(&addr));
+				  ast_sockaddr_stringify(addr));
 			return &ast_null_frame;
 		}
 		if ((ast_stun_handle_packet(rtp->s, &addr_tmp, rtp->rawdata + AST_FRIENDLY_OFFSET, res, NULL, NULL) == AST_STUN_ACCEPT) &&
 		    ast_sockaddr_isnull(&remote_address)) {
-			ast_sockaddr_from_sin(&addr, &addr_tmp);
-			ast_rtp_instance_set_remote_address(instance, &addr);
+			ast_sockaddr_from_sin(addr, &addr_tmp);
+			ast_rtp_instance_set_remote_address(instance, addr);
 		}
 		return &ast_null_frame;
 	}
 
 	/* If symmetric RTP is enabled see if the remote side is not what we expected and change where we are sending audio */
 	if (ast_rtp_instance_get_prop(instance, AST_RTP_PROPERTY_NAT)) {
-		if (ast_sockaddr_cmp(&remote_address, &addr)) {
-			ast_rtp_instance_set_remote_address(instance, &addr);
-			ast_sockaddr_copy(&remote_address, &addr);
+		if (ast_sockaddr_cmp(&remote_address, addr)) {
+			ast_rtp_instance_set_remote_address(instance, addr);
+			ast_sockaddr_copy(&remote_address, addr);
 			if (rtp->rtcp) {
-				ast_sockaddr_copy(&rtp->rtcp->them, &addr);
-				ast_sockaddr_set_port(&rtp->rtcp->them, ast_sockaddr_port(&addr) + 1);
+				ast_sockaddr_copy(&rtp->rtcp->them, addr);
+				ast_sockaddr_set_port(&rtp->rtcp->them, ast_sockaddr_port(addr) + 1);
 			}
 			rtp->rxseqno = 0;
 			ast_set_flag(rtp, FLAG_NAT_ACTIVE);
@@ -2312,9 +2879,9 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 		rtp->themssrc = ntohl(rtpheader[2]); /* Record their SSRC to put in future RR */
 	}
 
-	if (rtp_debug_test_addr(&addr)) {
+	if (rtp_debug_test_addr(addr)) {
 		ast_verbose("Got  RTP packet from    %s (type %-2.2d, seq %-6.6u, ts %-6.6u, len %-6.6u)\n",
-			    ast_sockaddr_stringify(&addr),
+			    ast_sockaddr_stringify(addr),
 			    payloadtype, seqno, timestamp,res - hdrlen);
 	}
 
@@ -2328,11 +2895,11 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 			 * by passing the pointer to the frame list to it so that the method
 			 * can append frames to the list as needed.
 			 */
-			process_dtmf_rfc2833(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, &addr, payloadtype, mark, &frames);
+			process_dtmf_rfc2833(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, addr, payloadtype, mark, &frames);
 		} else if (payload.rtp_code == AST_RTP_CISCO_DTMF) {
-			f = process_dtmf_cisco(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, &addr, payloadtype, mark);
+			f = process_dtmf_cisco(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, addr, payloadtype, mark);
 		} else if (payload.rtp_code == AST_RTP_CN) {
-			f = process_cn_rfc3389(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, &addr, payloadtype, mark);
+			f = process_cn_rfc3389(instance, rtp->rawdata + AST_FRIENDLY_OFFSET + hdrlen, res - hdrlen, seqno, timestamp, addr, payloadtype, mark);
 		} else {
 			ast_log(LOG_NOTICE, "Unknown RTP codec %d received from '%s'\n",
 				payloadtype,
@@ -2473,6 +3040,121 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 	return AST_LIST_FIRST(&frames);
 }
 
+#ifdef RTP_RX_POOL
+/*!
+ * \internal
+ * \brief Turn the packets a receive thread queued for an instance into frames
+ *
+ * All the packets queued are handled at once, so the channel only wakes up
+ * once for a burst of packets.  The frames are returned as a list.
+ */
+static struct ast_frame *rtp_rx_read(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct ast_srtp *srtp = ast_rtp_instance_get_srtp(instance);
+	struct rtp_rx *rx = rtp->rx;
+	struct rtp_rx_slot *slot;
+	struct ast_rtp_instance *bridged;
+	struct ast_sockaddr addr;
+	struct frame_list frames;
+	struct ast_frame *f, *next;
+	struct timeval now;
+	unsigned int head, tail = rx->tail;
+	uint64_t count;
+	int len;
+
+	/* Pick up changes to the bridge now and then, such as strict RTP having learned the source */
+	if ((bridged = ast_rtp_instance_get_bridged(instance))
+		&& ast_tvdiff_ms((now = ast_tvnow()), rx->lastsync) >= RTP_RX_RELAY_WAKE_MS) {
+		rx->lastsync = now;
+		rtp_rx_relay_set(instance, bridged);
+	}
+
+	/* Clear the wakeup before looking at the ring, so that a packet queued from now on wakes us again */
+	if (read(rx->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		ast_log(LOG_WARNING, "RTP wakeup read error: %s\n", strerror(errno));
+	}
+	rx->signaled = 0;
+	__sync_synchronize();
+	head = rx->head;
+	/* The slots up to head were filled before head was set */
+	__sync_synchronize();
+
+	AST_LIST_HEAD_INIT_NOLOCK(&frames);
+	while (tail != head) {
+		slot = &rx->slots[tail % RTP_RX_RING_SIZE];
+		if ((len = slot->len) > 0) {
+			memcpy(rtp->rawdata + AST_FRIENDLY_OFFSET, slot->buf, len);
+			ast_sockaddr_copy(&addr, &slot->addr);
+		}
+		__sync_synchronize();
+		rx->tail = ++tail;
+
+		if (len < 0) {
+			ast_log(LOG_WARNING, "RTP packet larger than %d bytes dropped\n", RTP_RX_SLOT_SIZE);
+			continue;
+		}
+		if (res_srtp && srtp && res_srtp->unprotect(srtp, rtp->rawdata + AST_FRIENDLY_OFFSET, &len, 0) < 0) {
+			continue;
+		}
+		if ((f = ast_rtp_read_packet(instance, len, &addr)) == &ast_null_frame) {
+			continue;
+		}
+		for (; f; f = next) {
+			next = AST_LIST_NEXT(f, frame_list);
+			AST_LIST_NEXT(f, frame_list) = NULL;
+			/* rtp->f is reused for the next packet */
+			if (f == &rtp->f && tail != head && !(f = ast_frdup(f))) {
+				continue;
+			}
+			AST_LIST_INSERT_TAIL(&frames, f, frame_list);
+		}
+	}
+
+	return AST_LIST_FIRST(&frames) ? AST_LIST_FIRST(&frames) : &ast_null_frame;
+}
+#endif
+
+static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtcp)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct ast_sockaddr addr;
+	int res;
+
+	/* If this is actually RTCP let's hop on over and handle it */
+	if (rtcp) {
+		if (rtp->rtcp) {
+			return ast_rtcp_read(instance);
+		}
+		return &ast_null_frame;
+	}
+
+	/* If we are currently sending DTMF to the remote party send a continuation packet */
+	if (rtp->sending_digit) {
+		ast_rtp_dtmf_continuation(instance);
+	}
+
+#ifdef RTP_RX_POOL
+	if (rtp->rx) {
+		return rtp_rx_read(instance);
+	}
+#endif
+
+	/* Actually read in the data from the socket */
+	if ((res = rtp_recvfrom(instance, rtp->rawdata + AST_FRIENDLY_OFFSET,
+				sizeof(rtp->rawdata) - AST_FRIENDLY_OFFSET, 0,
+				&addr)) < 0) {
+		ast_assert(errno != EBADF);
+		if (errno != EAGAIN) {
+			ast_log(LOG_WARNING, "RTP Read error: %s. Hanging up.\n", strerror(errno));
+			return NULL;
+		}
+		return &ast_null_frame;
+	}
+
+	return ast_rtp_read_packet(instance, res, &addr);
+}
+
 static void ast_rtp_prop_set(struct ast_rtp_instance *instance, enum ast_rtp_property property, int value)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
@@ -2546,12 +3228,21 @@ static int ast_rtp_fd(struct ast_rtp_instance *instance, int rtcp)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
 
+#ifdef RTP_RX_POOL
+	if (!rtcp && rtp->rx) {
+		return rtp->rx->wakefd;
+	}
+#endif
+
 	return rtcp ? (rtp->rtcp ? rtp->rtcp->s : -1) : rtp->s;
 }
 
 static void ast_rtp_remote_address_set(struct ast_rtp_instance *instance, struct ast_sockaddr *addr)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+#ifdef RTP_RX_POOL
+	struct ast_rtp_instance *bridged;
+#endif
 
 	if (rtp->rtcp) {
 		ast_debug(1, "Setting RTCP address on RTP instance '%p'\n", instance);
@@ -2569,6 +3260,16 @@ static void ast_rtp_remote_address_set(struct ast_rtp_instance *instance, struct
 		rtp_learning_seq_init(rtp, rtp->seqno);
 	}
 
+#ifdef RTP_RX_POOL
+	/* Both where we relay from and where the bridged instance relays to may have changed */
+	if (rtp->rx && (bridged = ast_rtp_instance_get_bridged(instance))) {
+		rtp_rx_relay_set(instance, bridged);
+		if (((struct ast_rtp *) ast_rtp_instance_get_data(bridged))->rx) {
+			rtp_rx_relay_set(bridged, instance);
+		}
+	}
+#endif
+
 	return;
 }
 
@@ -2652,19 +3353,34 @@ static int ast_rtp_local_bridge(struct ast_rtp_instance *instance0, struct ast_r
 
 	ast_set_flag(rtp, FLAG_NEED_MARKER_BIT);
 
+#ifdef RTP_RX_POOL
+	if (rtp->rx) {
+		rtp_rx_relay_set(instance0, instance1);
+	}
+#endif
+
 	return 0;
 }
 
 static int ast_rtp_get_stat(struct ast_rtp_instance *instance, struct ast_rtp_instance_stats *stats, enum ast_rtp_instance_stat stat)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	unsigned int relayed_in = 0, relayed_out = 0;
 
 	if (!rtp->rtcp) {
 		return -1;
 	}
 
-	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_TXCOUNT, -1, stats->txcount, rtp->txcount);
-	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_RXCOUNT, -1, stats->rxcount, rtp->rxcount);
+#ifdef RTP_RX_POOL
+	/* Packets relayed by a receive thread are counted as sent and received */
+	if (rtp->rx) {
+		relayed_in = rtp->rx->relayed_in;
+		relayed_out = rtp->rx->relayed_out;
+	}
+#endif
+
+	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_TXCOUNT, -1, stats->txcount, rtp->txcount + relayed_out);
+	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_RXCOUNT, -1, stats->rxcount, rtp->rxcount + relayed_in);
 
 	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_TXPLOSS, AST_RTP_INSTANCE_STAT_COMBINED_LOSS, stats->txploss, rtp->rtcp->reported_lost);
 	AST_RTP_STAT_SET(AST_RTP_INSTANCE_STAT_RXPLOSS, AST_RTP_INSTANCE_STAT_COMBINED_LOSS, stats->rxploss, rtp->rtcp->expected_prior - rtp->rtcp->received_prior);
@@ -2933,10 +3649,59 @@ static char *handle_cli_rtcp_set_stats(struct ast_cli_entry *e, int cmd, struct
 	return CLI_SUCCESS;
 }
 
+#ifdef RTP_RX_POOL
+static char *handle_cli_rtp_show_rxthreads(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT_HEADER "%-6s %9s %12s %12s %9s %12s %12s %9s\n"
+#define FORMAT "%-6u %9u %12lu %12lu %9.2f %12lu %12lu %9lu\n"
+	struct rtp_rx_thread *thread;
+	unsigned int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rtp show rxthreads";
+		e->usage =
+			"Usage: rtp show rxthreads\n"
+			"       Show how many instances each RTP receive thread serves,\n"
+			"       how many packets it received with how many system calls, and\n"
+			"       how many it relayed between natively bridged instances.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!rx_thread_count) {
+		ast_cli(a->fd, "RTP is received on the channel threads (rxthreads=0)\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, FORMAT_HEADER, "Thread", "Instances", "Packets", "Syscalls", "Pkts/call", "Wakeups", "Relayed", "Dropped");
+	for (i = 0; i < rx_thread_count; i++) {
+		thread = &rx_threads[i];
+		ast_mutex_lock(&thread->lock);
+		ast_cli(a->fd, FORMAT, i, thread->instances, thread->packets, thread->syscalls,
+			thread->syscalls ? (double) thread->packets / thread->syscalls : 0.0,
+			thread->wakeups, thread->relayed, thread->dropped);
+		ast_mutex_unlock(&thread->lock);
+	}
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT_HEADER
+}
+#endif
+
 static struct ast_cli_entry cli_rtp[] = {
 	AST_CLI_DEFINE(handle_cli_rtp_set_debug,  "Enable/Disable RTP debugging"),
 	AST_CLI_DEFINE(handle_cli_rtcp_set_debug, "Enable/Disable RTCP debugging"),
 	AST_CLI_DEFINE(handle_cli_rtcp_set_stats, "Enable/Disable RTCP stats"),
+#ifdef RTP_RX_POOL
+	AST_CLI_DEFINE(handle_cli_rtp_show_rxthreads, "Show RTP receive thread statistics"),
+#endif
 };
 
 static int rtp_reload(int reload)
@@ -2955,6 +3720,7 @@ static int rtp_reload(int reload)
 	dtmftimeout = DEFAULT_DTMF_TIMEOUT;
 	strictrtp = STRICT_RTP_CLOSED;
 	learning_min_sequential = DEFAULT_LEARNING_MIN_SEQUENTIAL;
+	rxthreads = 0;
 	if (cfg) {
 		if ((s = ast_variable_retrieve(cfg, "general", "rtpstart"))) {
 			rtpstart = atoi(s);
@@ -3004,6 +3770,17 @@ static int rtp_reload(int reload)
 					DEFAULT_LEARNING_MIN_SEQUENTIAL);
 			}
 		}
+		if ((s = ast_variable_retrieve(cfg, "general", "rxthreads"))) {
+			if (sscanf(s, "%u", &rxthreads) != 1 || rxthreads > 64) {
+				ast_log(LOG_WARNING, "Invalid rxthreads value '%s', receiving RTP on the channel threads\n", s);
+				rxthreads = 0;
+			}
+#ifndef RTP_RX_POOL
+			if (rxthreads) {
+				ast_log(LOG_WARNING, "RTP receive threads are not supported on this operating system!\n");
+			}
+#endif
+		}
 		ast_config_destroy(cfg);
 	}
 	if (rtpstart >= rtpend) {
@@ -3015,6 +3792,184 @@ static int rtp_reload(int reload)
 	return 0;
 }
 
+#if defined(TEST_FRAMEWORK) && defined(RTP_RX_POOL)
+/*! \brief Send an RTP packet with the given payload type from a test socket */
+static int rtp_relay_test_send(int s, struct ast_rtp_instance *instance, int payload, unsigned short seqno)
+{
+	unsigned char packet[12 + 160];
+	struct ast_sockaddr addr;
+
+	ast_rtp_instance_get_local_address(instance, &addr);
+	put_unaligned_uint32(packet, htonl((2 << 30) | (payload << 16) | seqno));
+	put_unaligned_uint32(packet + 4, htonl(seqno * 160));
+	put_unaligned_uint32(packet + 8, htonl(0x12345678));
+	memset(packet + 12, 0xff, 160);
+
+	return ast_sendto(s, packet, sizeof(packet), 0, &addr) == sizeof(packet) ? 0 : -1;
+}
+
+/*! \brief Receive a packet on a test socket, returning its header or 0 if none came in time */
+static unsigned int rtp_relay_test_recv(int s, int timeout)
+{
+	struct pollfd pfd = { .fd = s, .events = POLLIN, };
+	unsigned char packet[1500];
+
+	if (ast_poll(&pfd, 1, timeout) != 1 || recv(s, packet, sizeof(packet), 0) < 12) {
+		return 0;
+	}
+	return ntohl(get_unaligned_uint32(packet));
+}
+
+/*! \brief Read what an instance queued for its channel, returning the format of the first voice frame */
+static struct ast_format *rtp_relay_test_read(struct ast_rtp_instance *instance, struct ast_format *format, int timeout)
+{
+	struct pollfd pfd = { .fd = ast_rtp_instance_fd(instance, 0), .events = POLLIN, };
+	struct ast_frame *frames, *f;
+	struct ast_format *res = NULL;
+
+	if (ast_poll(&pfd, 1, timeout) != 1 || !(frames = ast_rtp_instance_read(instance, 0))) {
+		return NULL;
+	}
+	for (f = frames; f; f = AST_LIST_NEXT(f, frame_list)) {
+		if (f->frametype == AST_FRAME_VOICE) {
+			ast_format_copy(format, &f->subclass.format);
+			res = format;
+			break;
+		}
+	}
+	ast_frfree(frames);
+
+	return res;
+}
+
+AST_TEST_DEFINE(rtp_relay_test)
+{
+	struct ast_sched_context *sched = NULL;
+	struct ast_rtp_instance *instance0 = NULL, *instance1 = NULL;
+	struct ast_sockaddr addr, addr0, addr1;
+	struct ast_format format;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	unsigned int header;
+	int s0 = -1, s1 = -1;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "rtp_relay_test";
+		info->category = "/res/res_rtp_asterisk/";
+		info->summary = "Test relaying of locally bridged RTP by the receive threads";
+		info->description =
+			"Bridges two RTP instances and checks that the receive thread sends "
+			"on packets of mapped payload types with the payload type of the "
+			"bridged instance and the marker bit set on the first, that other "
+			"payload types are left to the channel, and that packets go to the "
+			"channel again once the instances are unbridged.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!rx_threads) {
+		ast_test_status_update(test, "RTP receive threads are not running (rxthreads=0)\n");
+		return AST_TEST_NOT_RUN;
+	}
+
+	/* The far ends of the two calls */
+	ast_sockaddr_parse(&addr, "127.0.0.1", PARSE_PORT_FORBID);
+	if ((s0 = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || ast_bind(s0, &addr) || ast_getsockname(s0, &addr0)
+		|| (s1 = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || ast_bind(s1, &addr) || ast_getsockname(s1, &addr1)) {
+		ast_test_status_update(test, "Failed to create the test sockets: %s\n", strerror(errno));
+		goto return_cleanup;
+	}
+
+	if (!(sched = ast_sched_context_create())
+		|| !(instance0 = ast_rtp_instance_new("asterisk", sched, &addr, NULL))
+		|| !(instance1 = ast_rtp_instance_new("asterisk", sched, &addr, NULL))) {
+		ast_test_status_update(test, "Failed to create the RTP instances\n");
+		goto return_cleanup;
+	}
+	ast_rtp_instance_set_remote_address(instance0, &addr0);
+	ast_rtp_instance_set_remote_address(instance1, &addr1);
+	((struct ast_rtp *) ast_rtp_instance_get_data(instance0))->strict_rtp_state = STRICT_RTP_OPEN;
+	((struct ast_rtp *) ast_rtp_instance_get_data(instance1))->strict_rtp_state = STRICT_RTP_OPEN;
+
+	/* Call 0 offers u-law and a-law, call 1 only u-law on a dynamic payload type */
+	ast_rtp_codecs_payloads_set_m_type(ast_rtp_instance_get_codecs(instance0), instance0, 0);
+	ast_rtp_codecs_payloads_set_m_type(ast_rtp_instance_get_codecs(instance0), instance0, 8);
+	ast_rtp_codecs_payloads_set_rtpmap_type_rate(ast_rtp_instance_get_codecs(instance1), instance1, 100,
+		"audio", "PCMU", 0, 8000);
+
+	/* As local_bridge_loop() does */
+	ast_rtp_local_bridge(instance0, instance1);
+	ast_rtp_local_bridge(instance1, instance0);
+
+	if (rtp_relay_test_send(s0, instance0, 0, 1)
+		|| !((header = rtp_relay_test_recv(s1, 1000)))) {
+		ast_test_status_update(test, "First u-law packet was not relayed\n");
+		goto return_cleanup;
+	}
+	if (((header >> 16) & 0x7f) != 100 || !(header & (1 << 23)) || (header & 0xffff) != 1) {
+		ast_test_status_update(test, "First relayed packet has header %08x, expected payload type 100 and the marker bit\n", header);
+		goto return_cleanup;
+	}
+	if (rtp_relay_test_send(s0, instance0, 0, 2)
+		|| ((header = rtp_relay_test_recv(s1, 1000)) & 0x7fffff) != ((100 << 16) | 2)) {
+		ast_test_status_update(test, "Second relayed packet has header %08x, expected payload type 100 only\n", header);
+		goto return_cleanup;
+	}
+
+	/* A-law is not mapped, so it goes to the channel */
+	if (rtp_relay_test_send(s0, instance0, 8, 3)) {
+		ast_test_status_update(test, "Failed to send a-law packet\n");
+		goto return_cleanup;
+	}
+	if (!rtp_relay_test_read(instance0, &format, 1000) || format.id != AST_FORMAT_ALAW) {
+		ast_test_status_update(test, "A-law packet was not queued for the channel\n");
+		goto return_cleanup;
+	}
+	if (rtp_relay_test_recv(s1, 100)) {
+		ast_test_status_update(test, "A-law packet was relayed\n");
+		goto return_cleanup;
+	}
+
+	/* Once unbridged, everything goes to the channel again */
+	ast_rtp_local_bridge(instance0, NULL);
+	ast_rtp_local_bridge(instance1, NULL);
+	if (rtp_relay_test_send(s0, instance0, 0, 4)) {
+		ast_test_status_update(test, "Failed to send u-law packet\n");
+		goto return_cleanup;
+	}
+	if (!rtp_relay_test_read(instance0, &format, 1000) || format.id != AST_FORMAT_ULAW) {
+		ast_test_status_update(test, "U-law packet was not queued for the channel after unbridging\n");
+		goto return_cleanup;
+	}
+	if (rtp_relay_test_recv(s1, 100)) {
+		ast_test_status_update(test, "U-law packet was relayed after unbridging\n");
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	if (instance0) {
+		ast_rtp_instance_destroy(instance0);
+	}
+	if (instance1) {
+		ast_rtp_instance_destroy(instance1);
+	}
+	if (sched) {
+		ast_sched_context_destroy(sched);
+	}
+	if (s0 > -1) {
+		close(s0);
+	}
+	if (s1 > -1) {
+		close(s1);
+	}
+
+	return res;
+}
+#endif
+
 static int reload_module(void)
 {
 	rtp_reload(1);
@@ -3034,6 +3989,17 @@ static int load_module(void)
 
 	rtp_reload(0);
 
+#if defined(TEST_FRAMEWORK) && defined(RTP_RX_POOL)
+	AST_TEST_REGISTER(rtp_relay_test);
+#endif
+
+#ifdef RTP_RX_POOL
+	/* The threads are not restarted on reload, as instances may be using them */
+	if (rtp_rx_start(rxthreads)) {
+		ast_log(LOG_WARNING, "Receiving RTP on the channel threads\n");
+	}
+#endif
+
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -3041,6 +4007,12 @@ static int unload_module(void)
 {
 	ast_rtp_engine_unregister(&asterisk_rtp_engine);
 	ast_cli_unregister_multiple(cli_rtp, ARRAY_LEN(cli_rtp));
+#if defined(TEST_FRAMEWORK) && defined(RTP_RX_POOL)
+	AST_TEST_UNREGISTER(rtp_relay_test);
+#endif
+#ifdef RTP_RX_POOL
+	rtp_rx_stop();
+#endif
 
 	return 0;
 }
@@ -105,7 +105,7 @@ static int test_hash_cb(const void *obj, const int flags)
 	}
 }
 
-static int astobj2_test_helper(int use_hash, int use_cmp, unsigned int lim, struct ast_test *test)
+static int astobj2_test_helper(int use_hash, int use_cmp, unsigned int lim, unsigned int options, struct ast_test *test)
 {
 	struct ao2_container *c1;
 	struct ao2_container *c2;
@@ -127,8 +127,8 @@ static int astobj2_test_helper(int use_hash, int use_cmp, unsigned int lim, stru
 	}
 
 	bucket_size = (ast_random() % ((lim / 4) + 1)) + 1;
-	c1 = ao2_t_container_alloc(bucket_size, use_hash ? test_hash_cb : NULL, use_cmp ? test_cmp_cb : NULL, "test");
-	c2 = ao2_t_container_alloc(bucket_size, test_hash_cb, test_cmp_cb, "test");
+	c1 = ao2_t_container_alloc_options(options, bucket_size, use_hash ? test_hash_cb : NULL, use_cmp ? test_cmp_cb : NULL, "test");
+	c2 = ao2_t_container_alloc_options(options, bucket_size, test_hash_cb, test_cmp_cb, "test");
 
 	if (!c1 || !c2) {
 		ast_test_status_update(test, "ao2_container_alloc failed.\n");
@@ -412,25 +412,25 @@ AST_TEST_DEFINE(astobj2_test_1)
 
 	/* Test 1, 500 items with custom hash and cmp functions */
 	ast_test_status_update(test, "Test 1, astobj2 test with 500 items.\n");
-	if ((res = astobj2_test_helper(1, 1, 500, test)) == AST_TEST_FAIL) {
+	if ((res = astobj2_test_helper(1, 1, 500, AO2_ALLOC_OPT_LOCK_MUTEX, test)) == AST_TEST_FAIL) {
 		return res;
 	}
 
 	/* Test 2, 1000 items with custom hash and default cmp functions */
 	ast_test_status_update(test, "Test 2, astobj2 test with 1000 items.\n");
-	if ((res = astobj2_test_helper(1, 0, 1000, test)) == AST_TEST_FAIL) {
+	if ((res = astobj2_test_helper(1, 0, 1000, AO2_ALLOC_OPT_LOCK_MUTEX, test)) == AST_TEST_FAIL) {
 		return res;
 	}
 
 	/* Test 3, 10000 items with default hash and custom cmp functions */
 	ast_test_status_update(test, "Test 3, astobj2 test with 10000 items.\n");
-	if ((res = astobj2_test_helper(0, 1, 10000, test)) == AST_TEST_FAIL) {
+	if ((res = astobj2_test_helper(0, 1, 10000, AO2_ALLOC_OPT_LOCK_MUTEX, test)) == AST_TEST_FAIL) {
 		return res;
 	}
 
 	/* Test 4, 100000 items with default hash and cmp functions */
 	ast_test_status_update(test, "Test 4, astobj2 test with 100000 items.\n");
-	if ((res = astobj2_test_helper(0, 0, 100000, test)) == AST_TEST_FAIL) {
+	if ((res = astobj2_test_helper(0, 0, 100000, AO2_ALLOC_OPT_LOCK_MUTEX, test)) == AST_TEST_FAIL) {
 		return res;
 	}
 
@@ -567,10 +567,203 @@ cleanup:
 	return res;
 }
 
+/*! \brief Try to read lock a container from another thread, which fails while it is write locked */
+static void *test_tryrdlock_thread(void *data)
+{
+	struct ao2_container *c = data;
+
+	if (ao2_tryrdlock(c)) {
+		return (void *) -1;
+	}
+	ao2_unlock(c);
+	return NULL;
+}
+
+/*! \brief Whether the container is write locked, or only read locked, by the calling thread */
+static int test_write_locked(struct ao2_container *c)
+{
+	pthread_t thread;
+	void *locked = NULL;
+
+	if (ast_pthread_create(&thread, NULL, test_tryrdlock_thread, c)) {
+		return -1;
+	}
+	pthread_join(thread, &locked);
+	return locked ? 1 : 0;
+}
+
+AST_TEST_DEFINE(astobj2_test_3)
+{
+	int res = AST_TEST_PASS;
+	struct ao2_container *c = NULL;
+	struct ao2_iterator i;
+	struct test_obj *obj;
+	int num;
+	int seen;
+	static const int NUM_OBJS = 5000;
+	int destructor_count = NUM_OBJS;
+	static const unsigned int options[] = {
+		AO2_ALLOC_OPT_LOCK_MUTEX | AO2_CONTAINER_ALLOC_OPT_RESIZE,
+		AO2_ALLOC_OPT_LOCK_RWLOCK | AO2_CONTAINER_ALLOC_OPT_STRIPED,
+		AO2_ALLOC_OPT_LOCK_RWLOCK | AO2_CONTAINER_ALLOC_OPT_RESIZE | AO2_CONTAINER_ALLOC_OPT_STRIPED,
+	};
+	int opt;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "astobj2_test3";
+		info->category = "/main/astobj2/";
+		info->summary = "Test resizable and striped ao2 containers";
+		info->description =
+			"Runs the astobj2_test1 tests on resizable and striped containers.  Then "
+			"grows a resizable container from a single bucket, finding, iterating "
+			"and unlinking objects while it is being resized, and verifies that "
+			"every object is seen exactly once.  Finally finds and unlinks objects "
+			"with OBJ_NOLOCK, and verifies the caller keeps the lock it held.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (opt = 0; opt < ARRAY_LEN(options); opt++) {
+		ast_test_status_update(test, "Test with container options 0x%x.\n", options[opt]);
+		if (astobj2_test_helper(1, 1, 1000, options[opt], test) == AST_TEST_FAIL
+			|| astobj2_test_helper(1, 0, 1000, options[opt], test) == AST_TEST_FAIL
+			|| astobj2_test_helper(0, 1, 1000, options[opt], test) == AST_TEST_FAIL) {
+			return AST_TEST_FAIL;
+		}
+	}
+
+	c = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_RWLOCK | AO2_CONTAINER_ALLOC_OPT_RESIZE
+		| AO2_CONTAINER_ALLOC_OPT_STRIPED, 1, test_hash_cb, test_cmp_cb);
+	if (!c) {
+		ast_test_status_update(test, "ao2_container_alloc failed.\n");
+		res = AST_TEST_FAIL;
+		goto cleanup;
+	}
+
+	/* Every link may move objects, check that all objects linked so far can be found */
+	for (num = 1; num <= NUM_OBJS; num++) {
+		if (!(obj = ao2_alloc(sizeof(struct test_obj), test_obj_destructor))) {
+			ast_test_status_update(test, "ao2_alloc failed.\n");
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+		obj->destructor_count = &destructor_count;
+		obj->i = num;
+		ao2_link(c, obj);
+		ao2_ref(obj, -1);
+
+		seen = ast_random() % num + 1;
+		if (!(obj = ao2_find(c, &seen, OBJ_KEY))) {
+			ast_test_status_update(test, "object %d not found after linking %d objects\n", seen, num);
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+		ao2_ref(obj, -1);
+	}
+	if (ao2_container_count(c) != NUM_OBJS) {
+		ast_test_status_update(test, "container did not link correctly\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* Unlink every other object while iterating, the iterator must see each object once */
+	seen = 0;
+	i = ao2_iterator_init(c, 0);
+	while ((obj = ao2_iterator_next(&i))) {
+		seen++;
+		if (obj->i % 2) {
+			ao2_unlink(c, obj);
+		}
+		ao2_ref(obj, -1);
+	}
+	ao2_iterator_destroy(&i);
+	if (seen != NUM_OBJS) {
+		ast_test_status_update(test, "iterator expected '%d', saw '%d' objects\n", NUM_OBJS, seen);
+		res = AST_TEST_FAIL;
+	}
+	if (ao2_container_count(c) != NUM_OBJS / 2 || destructor_count != NUM_OBJS / 2) {
+		ast_test_status_update(test, "unlinking while iterating left %d objects\n", ao2_container_count(c));
+		res = AST_TEST_FAIL;
+	}
+
+	for (num = 1; num <= NUM_OBJS; num++) {
+		obj = ao2_find(c, &num, OBJ_KEY);
+		if ((obj == NULL) != (num % 2)) {
+			ast_test_status_update(test, "object %d %s\n", num, obj ? "found after unlink" : "not found");
+			res = AST_TEST_FAIL;
+		}
+		if (obj) {
+			ao2_ref(obj, -1);
+		}
+	}
+
+	/* OBJ_NOLOCK leaves the caller holding the lock it took */
+	num = 2;
+	ao2_rdlock(c);
+	if (!(obj = ao2_find(c, &num, OBJ_KEY | OBJ_NOLOCK))) {
+		ast_test_status_update(test, "object %d not found with OBJ_NOLOCK\n", num);
+		res = AST_TEST_FAIL;
+	} else {
+		ao2_ref(obj, -1);
+	}
+	if (test_write_locked(c)) {
+		ast_test_status_update(test, "finding with OBJ_NOLOCK under a read lock left a write lock\n");
+		res = AST_TEST_FAIL;
+	}
+	num = 4;
+	ao2_find(c, &num, OBJ_KEY | OBJ_NOLOCK | OBJ_UNLINK | OBJ_NODATA);
+	if (test_write_locked(c)) {
+		ast_test_status_update(test, "unlinking with OBJ_NOLOCK under a read lock left a write lock\n");
+		res = AST_TEST_FAIL;
+	}
+	ao2_unlock(c);
+
+	ao2_wrlock(c);
+	num = 6;
+	ao2_find(c, &num, OBJ_KEY | OBJ_NOLOCK | OBJ_UNLINK | OBJ_NODATA);
+	num = 8;
+	if (!(obj = ao2_find(c, &num, OBJ_KEY | OBJ_NOLOCK))) {
+		ast_test_status_update(test, "object %d not found with OBJ_NOLOCK\n", num);
+		res = AST_TEST_FAIL;
+	} else {
+		ao2_ref(obj, -1);
+	}
+	if (test_write_locked(c) != 1) {
+		ast_test_status_update(test, "OBJ_NOLOCK under a write lock did not keep it\n");
+		res = AST_TEST_FAIL;
+	}
+	ao2_unlock(c);
+
+	for (num = 4; num <= 6; num += 2) {
+		if ((obj = ao2_find(c, &num, OBJ_KEY))) {
+			ast_test_status_update(test, "object %d found after unlink with OBJ_NOLOCK\n", num);
+			ao2_ref(obj, -1);
+			res = AST_TEST_FAIL;
+		}
+	}
+	if (ao2_container_count(c) != NUM_OBJS / 2 - 2) {
+		ast_test_status_update(test, "unlinking with OBJ_NOLOCK left %d objects\n", ao2_container_count(c));
+		res = AST_TEST_FAIL;
+	}
+
+cleanup:
+	if (c) {
+		ao2_ref(c, -1);
+	}
+	if (destructor_count) {
+		ast_test_status_update(test, "destructor count is %d\n", destructor_count);
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(astobj2_test_1);
 	AST_TEST_UNREGISTER(astobj2_test_2);
+	AST_TEST_UNREGISTER(astobj2_test_3);
 	return 0;
 }
 
@@ -578,6 +771,7 @@ static int load_module(void)
 {
 	AST_TEST_REGISTER(astobj2_test_1);
 	AST_TEST_REGISTER(astobj2_test_2);
+	AST_TEST_REGISTER(astobj2_test_3);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
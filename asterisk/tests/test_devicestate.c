@@ -32,6 +32,8 @@
 
 #include "asterisk.h"
 
+#include <inttypes.h>
+
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358945 $")
 
 #include "asterisk/utils.h"
@@ -39,6 +41,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 358945 $")
 #include "asterisk/test.h"
 #include "asterisk/devicestate.h"
 #include "asterisk/pbx.h"
+#include "asterisk/event.h"
+#include "asterisk/cli.h"
+#include "asterisk/lock.h"
 
 
 /* These arrays are the result of the 'core show device2extenstate' output. */
@@ -274,15 +279,291 @@ AST_TEST_DEFINE(device2extenstate_test)
 	return res;
 }
 
+#define DEVSTATE_BENCH_PROVIDER "DevstateBench"
+
+struct devstate_bench_device {
+	/*! \brief When the device first changed since its state was last seen in an event */
+	struct timeval changed;
+	/*! \brief Whether the device is in use */
+	int inuse;
+	/*! \brief Number of changes */
+	unsigned int seq;
+	/*! \brief Number of changes when the state was last asked for */
+	unsigned int queried;
+	/*! \brief Times the state was asked for but not seen in an event yet */
+	unsigned int pending;
+};
+
+/*! \brief Devices whose state changes are propagated by the device state engine */
+static struct {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	struct devstate_bench_device *devices;
+	unsigned int num_devices;
+	/*! \brief Devices whose state was not seen in an event yet */
+	unsigned int outstanding;
+	/*! \brief Device state events seen */
+	unsigned int events;
+	/*! \brief Device states seen in an event, and how long after the change */
+	unsigned int propagated;
+	int64_t latency_total;
+	int64_t latency_max;
+} bench;
+
+static enum ast_device_state devstate_bench_state(unsigned int i)
+{
+	return bench.devices[i].inuse ? AST_DEVICE_INUSE : AST_DEVICE_NOT_INUSE;
+}
+
+static enum ast_device_state devstate_bench_provider_cb(const char *data)
+{
+	unsigned int i;
+	enum ast_device_state state = AST_DEVICE_INVALID;
+
+	ast_mutex_lock(&bench.lock);
+	if (sscanf(data, "%u", &i) == 1 && i < bench.num_devices) {
+		bench.devices[i].queried = bench.devices[i].seq;
+		bench.devices[i].pending++;
+		state = devstate_bench_state(i);
+	}
+	ast_mutex_unlock(&bench.lock);
+
+	return state;
+}
+
+static void devstate_bench_event_cb(const struct ast_event *event, void *data)
+{
+	const char *device = ast_event_get_ie_str(event, AST_EVENT_IE_DEVICE);
+	struct devstate_bench_device *dev;
+	unsigned int i;
+	int64_t latency;
+
+	if (!device || strncmp(device, DEVSTATE_BENCH_PROVIDER ":", strlen(DEVSTATE_BENCH_PROVIDER ":"))
+		|| sscanf(device + strlen(DEVSTATE_BENCH_PROVIDER ":"), "%u", &i) != 1) {
+		return;
+	}
+
+	ast_mutex_lock(&bench.lock);
+	if (i < bench.num_devices) {
+		dev = &bench.devices[i];
+		bench.events++;
+		if (dev->pending) {
+			dev->pending--;
+		}
+		/*
+		 * The events of a device come in the order its state was asked for,
+		 * so this one is for the last time, and shows every change if that
+		 * was after the last change.
+		 */
+		if (!dev->pending && dev->queried == dev->seq && !ast_tvzero(dev->changed)) {
+			latency = ast_tvdiff_us(ast_tvnow(), dev->changed);
+			bench.propagated++;
+			bench.latency_total += latency;
+			if (latency > bench.latency_max) {
+				bench.latency_max = latency;
+			}
+			dev->changed = ast_tv(0, 0);
+			if (!--bench.outstanding) {
+				ast_cond_signal(&bench.cond);
+			}
+		}
+	}
+	ast_mutex_unlock(&bench.lock);
+}
+
+/*!
+ * \internal
+ * \brief Change the state of \a num_devices devices \a changes times in turn
+ * and wait for the last state of every device to be propagated.
+ *
+ * \retval 0 on success, with the benchmark results left in \a bench
+ * \retval -1 if the states were not all propagated within \a timeout ms
+ */
+static int devstate_bench_run(unsigned int changes, unsigned int num_devices, int timeout,
+	int64_t *fire_us, int64_t *total_us)
+{
+	struct ast_event_sub *sub;
+	struct timeval start, deadline;
+	struct timespec end;
+	unsigned int n, i;
+	int res = 0;
+
+	if (!(bench.devices = ast_calloc(num_devices, sizeof(*bench.devices)))) {
+		return -1;
+	}
+	bench.num_devices = num_devices;
+	bench.outstanding = 0;
+	bench.events = 0;
+	bench.propagated = 0;
+	bench.latency_total = 0;
+	bench.latency_max = 0;
+
+	if (ast_devstate_prov_add(DEVSTATE_BENCH_PROVIDER, devstate_bench_provider_cb)) {
+		ast_free(bench.devices);
+		return -1;
+	}
+	if (!(sub = ast_event_subscribe(AST_EVENT_DEVICE_STATE, devstate_bench_event_cb,
+			"devstate benchmark", NULL, AST_EVENT_IE_END))) {
+		ast_devstate_prov_del(DEVSTATE_BENCH_PROVIDER);
+		ast_free(bench.devices);
+		return -1;
+	}
+
+	start = ast_tvnow();
+	for (n = 0; n < changes; n++) {
+		i = n % num_devices;
+		ast_mutex_lock(&bench.lock);
+		bench.devices[i].inuse = !bench.devices[i].inuse;
+		bench.devices[i].seq++;
+		if (ast_tvzero(bench.devices[i].changed)) {
+			bench.devices[i].changed = ast_tvnow();
+			bench.outstanding++;
+		}
+		ast_mutex_unlock(&bench.lock);
+		ast_devstate_changed(AST_DEVICE_UNKNOWN, DEVSTATE_BENCH_PROVIDER ":%u", i);
+	}
+	*fire_us = ast_tvdiff_us(ast_tvnow(), start);
+
+	deadline = ast_tvadd(start, ast_tv(timeout / 1000, (timeout % 1000) * 1000));
+	end.tv_sec = deadline.tv_sec;
+	end.tv_nsec = deadline.tv_usec * 1000;
+	ast_mutex_lock(&bench.lock);
+	while (bench.outstanding) {
+		if (ast_cond_timedwait(&bench.cond, &bench.lock, &end) == ETIMEDOUT) {
+			res = -1;
+			break;
+		}
+	}
+	*total_us = ast_tvdiff_us(ast_tvnow(), start);
+	ast_mutex_unlock(&bench.lock);
+
+	ast_event_unsubscribe(sub);
+	ast_devstate_prov_del(DEVSTATE_BENCH_PROVIDER);
+
+	return res;
+}
+
+static void devstate_bench_cleanup(void)
+{
+	ast_mutex_lock(&bench.lock);
+	ast_free(bench.devices);
+	bench.devices = NULL;
+	bench.num_devices = 0;
+	ast_mutex_unlock(&bench.lock);
+}
+
+AST_TEST_DEFINE(devstate_changes_test)
+{
+	int64_t fire_us = 0, total_us = 0;
+	enum ast_device_state state;
+	char device[64];
+	unsigned int i;
+	int res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "devstate_changes_test";
+		info->category = "/main/devicestate/";
+		info->summary = "Tests that the last of many device state changes is propagated.";
+		info->description =
+			"Changes the state of a few devices many times over without waiting, "
+			"and verifies that the last state of every device is seen in a device "
+			"state event and cached, however many of the changes were coalesced.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (devstate_bench_run(1001, 10, 10000, &fire_us, &total_us)) {
+		ast_test_status_update(test, "The last states of %u devices were not all propagated\n",
+			bench.outstanding);
+		devstate_bench_cleanup();
+		return AST_TEST_FAIL;
+	}
+
+	for (i = 0; i < bench.num_devices; i++) {
+		snprintf(device, sizeof(device), DEVSTATE_BENCH_PROVIDER ":%u", i);
+		if ((state = ast_device_state(device)) != devstate_bench_state(i)) {
+			ast_test_status_update(test, "Device %s is cached as %s instead of %s\n", device,
+				ast_devstate2str(state), ast_devstate2str(devstate_bench_state(i)));
+			res = AST_TEST_FAIL;
+		}
+	}
+	ast_test_status_update(test, "%u changes gave %u device state events\n", 1001, bench.events);
+
+	devstate_bench_cleanup();
+
+	return res;
+}
+
+static char *handle_cli_devstate_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	unsigned int changes = 100000, num_devices = 10000;
+	int64_t fire_us = 0, total_us = 0;
+	int res;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "devstate benchmark";
+		e->usage = ""
+			"Usage: devstate benchmark [<changes> [<devices>]]\n"
+			"       Changes the state of <devices> (default 10000) devices in\n"
+			"       turn, <changes> (default 100000) times in all, as fast as it\n"
+			"       can, and waits for the last state of every device to reach\n"
+			"       a device state event subscriber.  Reports how many events\n"
+			"       the changes gave and the latency from a device changing to\n"
+			"       its state reaching the subscriber.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc > e->args + 2) {
+		return CLI_SHOWUSAGE;
+	}
+	if ((a->argc > e->args && (sscanf(a->argv[e->args], "%u", &changes) != 1 || !changes))
+		|| (a->argc > e->args + 1 && (sscanf(a->argv[e->args + 1], "%u", &num_devices) != 1 || !num_devices))) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, "Testing device state propagation - %u changes of %u devices\n", changes, num_devices);
+	res = devstate_bench_run(changes, num_devices, 120000, &fire_us, &total_us);
+
+	ast_mutex_lock(&bench.lock);
+	ast_cli(a->fd, "Changes made in %" PRIi64 " us, all propagated in %" PRIi64 " us%s\n",
+		fire_us, total_us, res ? " (timed out)" : "");
+	ast_cli(a->fd, "%u events for %u changes, %u new states seen - latency avg %" PRIi64 " us, max %" PRIi64 " us\n",
+		bench.events, changes, bench.propagated,
+		bench.propagated ? bench.latency_total / bench.propagated : 0, bench.latency_max);
+	ast_mutex_unlock(&bench.lock);
+
+	devstate_bench_cleanup();
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_devstate_bench[] = {
+	AST_CLI_DEFINE(handle_cli_devstate_bench, "Benchmark device state propagation"),
+};
+
 static int unload_module(void)
 {
+	ast_cli_unregister_multiple(cli_devstate_bench, ARRAY_LEN(cli_devstate_bench));
 	AST_TEST_UNREGISTER(device2extenstate_test);
+	AST_TEST_UNREGISTER(devstate_changes_test);
+	ast_cond_destroy(&bench.cond);
+	ast_mutex_destroy(&bench.lock);
 	return 0;
 }
 
 static int load_module(void)
 {
+	ast_mutex_init(&bench.lock);
+	ast_cond_init(&bench.cond, NULL);
 	AST_TEST_REGISTER(device2extenstate_test);
+	AST_TEST_REGISTER(devstate_changes_test);
+	ast_cli_register_multiple(cli_devstate_bench, ARRAY_LEN(cli_devstate_bench));
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -0,0 +1,595 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief DSP tone detector tests and benchmark
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+#include <math.h>
+#include <inttypes.h>
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/test.h"
+#include "asterisk/cli.h"
+#include "asterisk/frame.h"
+#include "asterisk/dsp.h"
+
+#define TEST_RATE 8000
+#define TEST_SAMPLES 160	/*!< Samples in each frame, 20 ms at 8 kHz */
+#define TEST_MAX_EVENTS 128
+
+static const char *kernel_names[] = {
+	[AST_DSP_KERNEL_FIXED] = "fixed",
+	[AST_DSP_KERNEL_FLOAT] = "float",
+	[AST_DSP_KERNEL_SCALAR] = "scalar",
+};
+
+static const float dtmf_rows[] = { 697.0, 770.0, 852.0, 941.0 };
+static const float dtmf_cols[] = { 1209.0, 1336.0, 1477.0, 1633.0 };
+static const char dtmf_digits[] = "123A456B789C*0#D";
+static const float mf_freqs[] = { 700.0, 900.0, 1100.0, 1300.0, 1500.0, 1700.0 };
+static const char mf_digits[] = "1247C-358A--69*---0B----#";
+
+/*! \brief Audio the detectors are run over, and what they should find in it */
+struct dsp_test_vector {
+	int16_t *samples;
+	int len;
+	int pos;
+};
+
+/*! \brief A frame the detectors returned, for comparing the kernels */
+struct dsp_test_event {
+	int frametype;
+	int digit;
+	long len;
+	int frame;
+};
+
+static int dsp_test_vector_init(struct dsp_test_vector *v, int ms)
+{
+	v->len = ms * TEST_RATE / 1000;
+	v->pos = 0;
+	return (v->samples = ast_calloc(v->len, sizeof(*v->samples))) ? 0 : -1;
+}
+
+/*! \brief Adds a tone of up to two frequencies and some noise, or noise alone, to the vector */
+static void dsp_test_vector_add(struct dsp_test_vector *v, int ms, float f1, float f2, int amp1, int amp2, int noise)
+{
+	int count = MIN(ms * TEST_RATE / 1000, v->len - v->pos);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		double sample = 0.0;
+
+		if (f1) {
+			sample += amp1 * sin(2.0 * M_PI * f1 * i / TEST_RATE);
+		}
+		if (f2) {
+			sample += amp2 * sin(2.0 * M_PI * f2 * i / TEST_RATE);
+		}
+		if (noise) {
+			sample += (int) (ast_random() % (2 * noise + 1)) - noise;
+		}
+		v->samples[v->pos + i] = MAX(-32768, MIN(32767, lrint(sample)));
+	}
+	v->pos += count;
+}
+
+/*! \brief Frequencies of an MF digit */
+static int mf_digit_freqs(char digit, float *f1, float *f2)
+{
+	int best, second;
+
+	for (best = 0; best < ARRAY_LEN(mf_freqs); best++) {
+		for (second = best + 1; second < ARRAY_LEN(mf_freqs); second++) {
+			if (mf_digits[best * 5 + second - 1] == digit) {
+				*f1 = mf_freqs[best];
+				*f2 = mf_freqs[second];
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+/*!
+ * \brief Runs a vector through a new DSP frame by frame, with the given kernel
+ * \return the number of events, or -1 on error
+ */
+static int dsp_test_run(const struct dsp_test_vector *v, enum ast_dsp_kernel kernel, int features,
+	int digitmode, int faxmode, struct dsp_test_event *events)
+{
+	struct ast_dsp *dsp;
+	struct ast_frame f = { 0, }, *out;
+	int16_t buf[TEST_SAMPLES];
+	int count = 0, frame, res;
+
+	if (!(dsp = ast_dsp_new())) {
+		return -1;
+	}
+	ast_dsp_set_features(dsp, features);
+	ast_dsp_set_digitmode(dsp, digitmode);
+	ast_dsp_set_faxmode(dsp, faxmode);
+	ast_dsp_set_call_progress_zone(dsp, "us");
+	if (ast_dsp_set_kernel(dsp, kernel)) {
+		ast_dsp_free(dsp);
+		return -1;
+	}
+
+	for (frame = 0; (frame + 1) * TEST_SAMPLES <= v->len; frame++) {
+		memcpy(buf, v->samples + frame * TEST_SAMPLES, sizeof(buf));
+		memset(&f, 0, sizeof(f));
+		f.frametype = AST_FRAME_VOICE;
+		ast_format_set(&f.subclass.format, AST_FORMAT_SLINEAR, 0);
+		f.data.ptr = buf;
+		f.datalen = sizeof(buf);
+		f.samples = TEST_SAMPLES;
+		f.src = "dsp_test";
+
+		if (features & DSP_FEATURE_CALL_PROGRESS) {
+			/* Call progress is reported by queueing a frame, which needs a channel */
+			if ((res = ast_dsp_call_progress(dsp, &f)) && count < TEST_MAX_EVENTS) {
+				events[count].frametype = AST_FRAME_CONTROL;
+				events[count].digit = res;
+				events[count].len = 0;
+				events[count++].frame = frame;
+			}
+			if (res && res != AST_CONTROL_RINGING) {
+				/* ast_dsp_process() stops calling the detector after a final answer */
+				break;
+			}
+			continue;
+		}
+
+		out = ast_dsp_process(NULL, dsp, &f);
+		if (out != &f) {
+			if (out && out->frametype != AST_FRAME_NULL && count < TEST_MAX_EVENTS) {
+				events[count].frametype = out->frametype;
+				events[count].digit = out->subclass.integer;
+				events[count].len = out->len;
+				events[count++].frame = frame;
+			}
+			ast_frfree(out);
+		}
+	}
+
+	ast_dsp_free(dsp);
+	return count;
+}
+
+/*! \brief The digits of the events that end them and of fax tones, and 'r' or 'b' for ringing and busy */
+static void dsp_test_digits(const struct dsp_test_event *events, int count, char *buf)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (events[i].frametype == AST_FRAME_DTMF_END || events[i].frametype == AST_FRAME_DTMF) {
+			*buf++ = events[i].digit;
+		} else if (events[i].frametype == AST_FRAME_CONTROL) {
+			*buf++ = events[i].digit == AST_CONTROL_RINGING ? 'r' : events[i].digit == AST_CONTROL_BUSY ? 'b' : '?';
+		}
+	}
+	*buf = '\0';
+}
+
+/*!
+ * \brief Checks each kernel finds what the scalar kernel finds in a vector
+ *
+ * The fixed point kernel must give the very same frames at the same
+ * positions.  The floating point kernel must find the same digits.
+ */
+static enum ast_test_result_state dsp_test_kernels(struct ast_test *test, const char *name,
+	const struct dsp_test_vector *v, int features, int digitmode, int faxmode, const char *expected)
+{
+	struct dsp_test_event reference[TEST_MAX_EVENTS], events[TEST_MAX_EVENTS];
+	char digits[TEST_MAX_EVENTS + 1], reference_digits[TEST_MAX_EVENTS + 1];
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int count, reference_count, kernel, i;
+
+	if ((reference_count = dsp_test_run(v, AST_DSP_KERNEL_SCALAR, features, digitmode, faxmode, reference)) < 0) {
+		ast_test_status_update(test, "%s: could not run the scalar kernel\n", name);
+		return AST_TEST_FAIL;
+	}
+	dsp_test_digits(reference, reference_count, reference_digits);
+	if (strcmp(reference_digits, expected)) {
+		ast_test_status_update(test, "%s: scalar kernel found '%s', expected '%s'\n",
+			name, reference_digits, expected);
+		res = AST_TEST_FAIL;
+	}
+
+	for (kernel = AST_DSP_KERNEL_FIXED; kernel < AST_DSP_KERNEL_SCALAR; kernel++) {
+		if ((count = dsp_test_run(v, kernel, features, digitmode, faxmode, events)) < 0) {
+			ast_test_status_update(test, "%s: could not run the %s kernel\n", name, kernel_names[kernel]);
+			res = AST_TEST_FAIL;
+			continue;
+		}
+		dsp_test_digits(events, count, digits);
+		if (strcmp(digits, reference_digits)) {
+			ast_test_status_update(test, "%s: %s kernel found '%s', scalar kernel '%s'\n",
+				name, kernel_names[kernel], digits, reference_digits);
+			res = AST_TEST_FAIL;
+			continue;
+		}
+		if (kernel != AST_DSP_KERNEL_FIXED) {
+			continue;
+		}
+		if (count != reference_count) {
+			ast_test_status_update(test, "%s: fixed kernel gave %d frames, scalar kernel %d\n",
+				name, count, reference_count);
+			res = AST_TEST_FAIL;
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			if (events[i].frametype != reference[i].frametype || events[i].digit != reference[i].digit
+				|| events[i].len != reference[i].len || events[i].frame != reference[i].frame) {
+				ast_test_status_update(test, "%s: fixed kernel gave frame %d/%d '%c' at %d, scalar kernel %d/%d '%c' at %d\n",
+					name, events[i].frametype, events[i].digit, events[i].digit, events[i].frame,
+					reference[i].frametype, reference[i].digit, reference[i].digit, reference[i].frame);
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+	}
+
+	return res;
+}
+
+AST_TEST_DEFINE(dsp_dtmf_test)
+{
+	struct dsp_test_vector v;
+	enum ast_test_result_state res;
+	const char *digit;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "dsp_dtmf_test";
+		info->category = "/main/dsp/";
+		info->summary = "Test the goertzel kernels detect DTMF alike";
+		info->description =
+			"This test runs DTMF digits, at several levels and with twist "
+			"and noise, through the DTMF detector with each goertzel kernel. "
+			"The fixed point kernel must give the same frames as the scalar "
+			"kernel, and the floating point kernel the same digits.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	/* Each digit three times: quiet with reverse twist, loud with noise, and near full scale */
+	if (dsp_test_vector_init(&v, strlen(dtmf_digits) * 3 * 200 + 200)) {
+		return AST_TEST_FAIL;
+	}
+	dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 0);
+	for (digit = dtmf_digits; *digit; digit++) {
+		int pos = digit - dtmf_digits;
+		float row = dtmf_rows[pos / 4], col = dtmf_cols[pos % 4];
+
+		dsp_test_vector_add(&v, 100, row, col, 1000, 1400, 0);
+		dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 10);
+		dsp_test_vector_add(&v, 100, row, col, 8000, 6000, 300);
+		dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 300);
+		dsp_test_vector_add(&v, 100, row, col, 16000, 16000, 0);
+		dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 0);
+	}
+
+	{
+		char expected[ARRAY_LEN(dtmf_digits) * 3];
+		int i;
+
+		for (i = 0; i < strlen(dtmf_digits) * 3; i++) {
+			expected[i] = dtmf_digits[i / 3];
+		}
+		expected[i] = '\0';
+		res = dsp_test_kernels(test, "DTMF", &v, DSP_FEATURE_DIGIT_DETECT, DSP_DIGITMODE_DTMF, 0, expected);
+	}
+
+	ast_free(v.samples);
+	return res;
+}
+
+AST_TEST_DEFINE(dsp_mf_test)
+{
+	static const char sequence[] = "*1234567890#";
+	struct dsp_test_vector v;
+	enum ast_test_result_state res;
+	const char *digit;
+	float f1, f2;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "dsp_mf_test";
+		info->category = "/main/dsp/";
+		info->summary = "Test the goertzel kernels detect MF alike";
+		info->description =
+			"This test runs an MF digit sequence through the MF detector "
+			"with each goertzel kernel. The fixed point kernel must give "
+			"the same frames as the scalar kernel, and the floating point "
+			"kernel the same digits.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (dsp_test_vector_init(&v, strlen(sequence) * 200 + 200)) {
+		return AST_TEST_FAIL;
+	}
+	dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 0);
+	for (digit = sequence; *digit; digit++) {
+		if (mf_digit_freqs(*digit, &f1, &f2)) {
+			ast_free(v.samples);
+			return AST_TEST_FAIL;
+		}
+		dsp_test_vector_add(&v, 100, f1, f2, 7000, 7000, 100);
+		dsp_test_vector_add(&v, 100, 0, 0, 0, 0, 100);
+	}
+
+	res = dsp_test_kernels(test, "MF", &v, DSP_FEATURE_DIGIT_DETECT, DSP_DIGITMODE_MF, 0, sequence);
+
+	ast_free(v.samples);
+	return res;
+}
+
+AST_TEST_DEFINE(dsp_fax_progress_test)
+{
+	struct dsp_test_vector v;
+	enum ast_test_result_state res;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "dsp_fax_progress_test";
+		info->category = "/main/dsp/";
+		info->summary = "Test the goertzel kernels detect fax and call progress tones alike";
+		info->description =
+			"This test runs fax CNG and CED tones through the fax detector, "
+			"and ringing and busy tones through the call progress detector, "
+			"with each goertzel kernel, and checks they give what the "
+			"scalar kernel gives.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (dsp_test_vector_init(&v, 7000)) {
+		return AST_TEST_FAIL;
+	}
+	dsp_test_vector_add(&v, 500, 0, 0, 0, 0, 50);
+	dsp_test_vector_add(&v, 500, 1100, 0, 6000, 0, 50);
+	dsp_test_vector_add(&v, 3000, 0, 0, 0, 0, 50);
+	dsp_test_vector_add(&v, 3000, 2100, 0, 6000, 0, 50);
+	res = dsp_test_kernels(test, "fax", &v, DSP_FEATURE_FAX_DETECT, DSP_DIGITMODE_DTMF, DSP_FAXMODE_DETECT_ALL, "fe");
+	ast_free(v.samples);
+
+	if (dsp_test_vector_init(&v, 8000)) {
+		return AST_TEST_FAIL;
+	}
+	dsp_test_vector_add(&v, 2000, 440, 480, 4000, 4000, 20);
+	dsp_test_vector_add(&v, 4000, 0, 0, 0, 0, 20);
+	dsp_test_vector_add(&v, 2000, 480, 620, 4000, 4000, 20);
+	if (dsp_test_kernels(test, "call progress", &v, DSP_FEATURE_CALL_PROGRESS, DSP_DIGITMODE_DTMF, 0, "rb") != AST_TEST_PASS) {
+		res = AST_TEST_FAIL;
+	}
+	ast_free(v.samples);
+
+	return res;
+}
+
+AST_TEST_DEFINE(dsp_silence_test)
+{
+	struct dsp_test_vector v;
+	struct ast_dsp *dsp[AST_DSP_KERNEL_SCALAR + 1];
+	struct ast_frame f = { 0, };
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int frame, kernel, silent[ARRAY_LEN(dsp)], total[ARRAY_LEN(dsp)], energy[ARRAY_LEN(dsp)];
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "dsp_silence_test";
+		info->category = "/main/dsp/";
+		info->summary = "Test silence detection with each goertzel kernel";
+		info->description =
+			"This test runs talk and silence through the silence detector "
+			"of a DSP for each goertzel kernel, and checks they all find "
+			"the same silence and energy in each frame.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (dsp_test_vector_init(&v, 2000)) {
+		return AST_TEST_FAIL;
+	}
+	dsp_test_vector_add(&v, 500, 300, 1100, 3000, 2000, 2000);
+	dsp_test_vector_add(&v, 500, 0, 0, 0, 0, 100);
+	dsp_test_vector_add(&v, 500, 0, 0, 0, 0, 32767);
+	dsp_test_vector_add(&v, 500, 0, 0, 0, 0, 0);
+
+	for (kernel = 0; kernel < ARRAY_LEN(dsp); kernel++) {
+		dsp[kernel] = ast_dsp_new();
+		if (!dsp[kernel] || ast_dsp_set_kernel(dsp[kernel], kernel)) {
+			res = AST_TEST_FAIL;
+		}
+	}
+
+	for (frame = 0; res == AST_TEST_PASS && (frame + 1) * TEST_SAMPLES <= v.len; frame++) {
+		f.frametype = AST_FRAME_VOICE;
+		ast_format_set(&f.subclass.format, AST_FORMAT_SLINEAR, 0);
+		f.data.ptr = v.samples + frame * TEST_SAMPLES;
+		f.datalen = TEST_SAMPLES * 2;
+		f.samples = TEST_SAMPLES;
+
+		for (kernel = 0; kernel < ARRAY_LEN(dsp); kernel++) {
+			silent[kernel] = ast_dsp_silence_with_energy(dsp[kernel], &f, &total[kernel], &energy[kernel]);
+			if (kernel && (silent[kernel] != silent[0] || total[kernel] != total[0] || energy[kernel] != energy[0])) {
+				ast_test_status_update(test, "Frame %d: %s kernel found silence %d, %d ms, energy %d; %s kernel %d, %d ms, energy %d\n",
+					frame, kernel_names[kernel], silent[kernel], total[kernel], energy[kernel],
+					kernel_names[0], silent[0], total[0], energy[0]);
+				res = AST_TEST_FAIL;
+			}
+		}
+	}
+
+	for (kernel = 0; kernel < ARRAY_LEN(dsp); kernel++) {
+		if (dsp[kernel]) {
+			ast_dsp_free(dsp[kernel]);
+		}
+	}
+	ast_free(v.samples);
+	return res;
+}
+
+static char *handle_cli_dsp_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct dsp_test_vector v;
+	struct ast_dsp **dsps;
+	struct ast_frame *frames, *f;
+	int16_t *buf;
+	unsigned int channels, i, kernel, frame, frame_count;
+	const char *digit;
+	struct timeval start;
+	int64_t us;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "dsp benchmark";
+		e->usage = ""
+			"Usage: dsp benchmark <channels>\n"
+			"       Runs ten seconds of 8 kHz audio with DTMF digits through\n"
+			"       the DTMF and fax detectors of <channels> DSPs, one frame\n"
+			"       from each at a time, on the calling thread.\n"
+			"       Times each goertzel kernel, and reports how many channels\n"
+			"       one core could run the detectors on in real time.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 1) {
+		return CLI_SHOWUSAGE;
+	}
+	if (sscanf(a->argv[e->args], "%u", &channels) != 1 || !channels) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (dsp_test_vector_init(&v, 10000)) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+	while (v.pos < v.len) {
+		for (digit = dtmf_digits; *digit; digit++) {
+			int pos = digit - dtmf_digits;
+
+			dsp_test_vector_add(&v, 100, dtmf_rows[pos / 4], dtmf_cols[pos % 4], 6000, 6000, 200);
+			dsp_test_vector_add(&v, 400, 300, 1100, 3000, 2000, 2000);
+		}
+	}
+	frame_count = v.len / TEST_SAMPLES;
+
+	dsps = ast_calloc(channels, sizeof(*dsps));
+	frames = ast_calloc(channels, sizeof(*frames));
+	buf = ast_calloc(channels * TEST_SAMPLES, sizeof(*buf));
+	if (!dsps || !frames || !buf) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		ast_free(dsps);
+		ast_free(frames);
+		ast_free(buf);
+		ast_free(v.samples);
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, "Testing DSP performance - %u channels, %u frames of %d samples each\n",
+		channels, frame_count, TEST_SAMPLES);
+	for (kernel = AST_DSP_KERNEL_FIXED; kernel <= AST_DSP_KERNEL_SCALAR; kernel++) {
+		for (i = 0; i < channels; i++) {
+			if ((dsps[i] = ast_dsp_new())) {
+				ast_dsp_set_features(dsps[i], DSP_FEATURE_DIGIT_DETECT | DSP_FEATURE_FAX_DETECT);
+				ast_dsp_set_kernel(dsps[i], kernel);
+			}
+		}
+
+		us = 0;
+		for (frame = 0; frame < frame_count; frame++) {
+			for (i = 0; i < channels; i++) {
+				memcpy(buf + i * TEST_SAMPLES, v.samples + frame * TEST_SAMPLES, TEST_SAMPLES * sizeof(*buf));
+				memset(&frames[i], 0, sizeof(frames[i]));
+				frames[i].frametype = AST_FRAME_VOICE;
+				ast_format_set(&frames[i].subclass.format, AST_FORMAT_SLINEAR, 0);
+				frames[i].data.ptr = buf + i * TEST_SAMPLES;
+				frames[i].datalen = TEST_SAMPLES * 2;
+				frames[i].samples = TEST_SAMPLES;
+			}
+			start = ast_tvnow();
+			for (i = 0; i < channels; i++) {
+				if (dsps[i] && (f = ast_dsp_process(NULL, dsps[i], &frames[i])) && f != &frames[i]) {
+					ast_frfree(f);
+				}
+			}
+			us += ast_tvdiff_us(ast_tvnow(), start);
+		}
+
+		for (i = 0; i < channels; i++) {
+			if (dsps[i]) {
+				ast_dsp_free(dsps[i]);
+			}
+		}
+
+		ast_cli(a->fd, "%-7s %" PRIi64 " us, %.3f us per frame, channels per core %.0f\n",
+			kernel_names[kernel], us, (double) us / (frame_count * channels),
+			us ? (double) channels * frame_count * TEST_SAMPLES * 1000000 / TEST_RATE / us : 0.0);
+	}
+
+	ast_free(dsps);
+	ast_free(frames);
+	ast_free(buf);
+	ast_free(v.samples);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_dsp_bench[] = {
+	AST_CLI_DEFINE(handle_cli_dsp_bench, "Benchmark the DSP tone detectors"),
+};
+
+static int unload_module(void)
+{
+	ast_cli_unregister_multiple(cli_dsp_bench, ARRAY_LEN(cli_dsp_bench));
+	AST_TEST_UNREGISTER(dsp_dtmf_test);
+	AST_TEST_UNREGISTER(dsp_mf_test);
+	AST_TEST_UNREGISTER(dsp_fax_progress_test);
+	AST_TEST_UNREGISTER(dsp_silence_test);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(dsp_dtmf_test);
+	AST_TEST_REGISTER(dsp_mf_test);
+	AST_TEST_REGISTER(dsp_fax_progress_test);
+	AST_TEST_REGISTER(dsp_silence_test);
+	ast_cli_register_multiple(cli_dsp_bench, ARRAY_LEN(cli_dsp_bench));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "DSP tone detector test module");
@@ -966,10 +966,225 @@ return_cleanup:
 	return res;
 }
 
+struct event_queue_data {
+	/*! Events handled */
+	int count;
+	/*! Milliseconds to take for each event */
+	unsigned int delay;
+	/*! Events being handled */
+	int busy;
+	/*! Set if an event was handled while another one was */
+	int overlapped;
+};
+
+static void event_queue_cb(const struct ast_event *event, void *d)
+{
+	struct event_queue_data *data = d;
+
+	if (ast_atomic_fetchadd_int(&data->busy, 1)) {
+		data->overlapped = 1;
+	}
+	if (data->delay) {
+		usleep(data->delay * 1000);
+	}
+	ast_atomic_fetchadd_int(&data->count, 1);
+	ast_atomic_fetchadd_int(&data->busy, -1);
+}
+
+static void *event_queue_stop_thread(void *data)
+{
+	ast_event_queue_subs(AST_EVENT_CUSTOM, 0);
+
+	return NULL;
+}
+
+struct event_queue_stats {
+	const char *description;
+	struct ast_event_sub_stats stats;
+	int found;
+};
+
+static void event_queue_stats_cb(const struct ast_event_sub_stats *stats, void *d)
+{
+	struct event_queue_stats *data = d;
+
+	if (!strcmp(stats->description, data->description)) {
+		data->stats = *stats;
+		data->found = 1;
+	}
+}
+
+static int queue_custom_events(unsigned int num)
+{
+	struct ast_event *event;
+
+	while (num--) {
+		if (!(event = ast_event_new(AST_EVENT_CUSTOM, AST_EVENT_IE_END))) {
+			return -1;
+		}
+		if (ast_event_queue(event)) {
+			ast_event_destroy(event);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \internal
+ */
+AST_TEST_DEFINE(event_sub_queue_test)
+{
+	enum ast_test_result_state res = AST_TEST_PASS;
+	struct event_queue_data slow = { .delay = 200, };
+	struct event_queue_data fast = { .delay = 0, };
+	struct event_queue_stats stats = { .description = "Slow queued subscriber", };
+	struct ast_event_sub *slow_sub = NULL;
+	struct ast_event_sub *fast_sub = NULL;
+	pthread_t stopper;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "ast_event_sub_queue_test";
+		info->category = "/main/event/";
+		info->summary = "Test subscriptions with queues of their own";
+		info->description =
+			"This test checks that a slow subscriber with a queue does not "
+			"hold up the others, gets all its events when unsubscribing, "
+			"drops events when its queue is full, and gets the events "
+			"waiting when queueing stops.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (ast_event_queue_subs(AST_EVENT_CUSTOM, 100)) {
+		ast_test_status_update(test, "Failed to queue CUSTOM subscriptions\n");
+		return AST_TEST_FAIL;
+	}
+
+	slow_sub = ast_event_subscribe(AST_EVENT_CUSTOM, event_queue_cb,
+		stats.description, &slow, AST_EVENT_IE_END);
+	fast_sub = ast_event_subscribe(AST_EVENT_CUSTOM, event_queue_cb,
+		"Fast queued subscriber", &fast, AST_EVENT_IE_END);
+	if (!slow_sub || !fast_sub) {
+		ast_test_status_update(test, "Failed to create the subscriptions\n");
+		res = AST_TEST_FAIL;
+		goto return_cleanup;
+	}
+
+	if (queue_custom_events(5)) {
+		ast_test_status_update(test, "Failed to queue the events\n");
+		res = AST_TEST_FAIL;
+		goto return_cleanup;
+	}
+
+	/* The fast subscriber gets all of them long before the slow one. */
+	for (i = 0; i < 50 && ast_atomic_fetchadd_int(&fast.count, 0) < 5; i++) {
+		usleep(10000);
+	}
+	if (ast_atomic_fetchadd_int(&fast.count, 0) != 5) {
+		ast_test_status_update(test, "Fast subscriber got %d of 5 events\n", fast.count);
+		res = AST_TEST_FAIL;
+	}
+	if (5 <= ast_atomic_fetchadd_int(&slow.count, 0)) {
+		ast_test_status_update(test, "Slow subscriber was not slow\n");
+		res = AST_TEST_FAIL;
+	}
+
+	ast_event_sub_queue_stats(AST_EVENT_CUSTOM, event_queue_stats_cb, &stats);
+	if (!stats.found || !stats.stats.depth || stats.stats.size != 100) {
+		ast_test_status_update(test, "Unexpected statistics of the slow subscriber\n");
+		res = AST_TEST_FAIL;
+	}
+
+	/* Unsubscribing delivers the events still waiting. */
+	slow_sub = ast_event_unsubscribe(slow_sub);
+	if (slow.count != 5) {
+		ast_test_status_update(test, "Slow subscriber got %d of 5 events\n", slow.count);
+		res = AST_TEST_FAIL;
+	}
+
+	/* With one event allowed to wait, the one being handled, the others are dropped. */
+	slow.count = 0;
+	ast_event_queue_subs(AST_EVENT_CUSTOM, 1);
+	slow_sub = ast_event_subscribe(AST_EVENT_CUSTOM, event_queue_cb,
+		stats.description, &slow, AST_EVENT_IE_END);
+	if (!slow_sub || queue_custom_events(3)) {
+		ast_test_status_update(test, "Failed to subscribe or queue the events\n");
+		res = AST_TEST_FAIL;
+		goto return_cleanup;
+	}
+	usleep(100000);
+	stats.found = 0;
+	ast_event_sub_queue_stats(AST_EVENT_CUSTOM, event_queue_stats_cb, &stats);
+	if (!stats.found || stats.stats.dropped != 2) {
+		ast_test_status_update(test, "Slow subscriber dropped %u of 3 events, expected 2\n",
+			stats.stats.dropped);
+		res = AST_TEST_FAIL;
+	}
+	slow_sub = ast_event_unsubscribe(slow_sub);
+	if (slow.count != 1) {
+		ast_test_status_update(test, "Slow subscriber got %d events, expected 1\n", slow.count);
+		res = AST_TEST_FAIL;
+	}
+
+	/* Queueing stops once the events waiting are delivered. */
+	slow.count = 0;
+	ast_event_queue_subs(AST_EVENT_CUSTOM, 100);
+	slow_sub = ast_event_subscribe(AST_EVENT_CUSTOM, event_queue_cb,
+		stats.description, &slow, AST_EVENT_IE_END);
+	if (!slow_sub || queue_custom_events(3)) {
+		ast_test_status_update(test, "Failed to subscribe or queue the events\n");
+		res = AST_TEST_FAIL;
+		goto return_cleanup;
+	}
+	for (i = 0; i < 50 && ast_atomic_fetchadd_int(&fast.count, 0) < 11; i++) {
+		usleep(10000);
+	}
+	/* An event dispatched while the queue drains waits its turn. */
+	if (ast_pthread_create(&stopper, NULL, event_queue_stop_thread, NULL)) {
+		ast_test_status_update(test, "Failed to start a thread to stop queueing\n");
+		res = AST_TEST_FAIL;
+		goto return_cleanup;
+	}
+	usleep(50000);
+	queue_custom_events(1);
+	pthread_join(stopper, NULL);
+	for (i = 0; i < 100 && ast_atomic_fetchadd_int(&slow.count, 0) < 4; i++) {
+		usleep(10000);
+	}
+	if (slow.count != 4 || slow.overlapped) {
+		ast_test_status_update(test, "Slow subscriber got %d of 4 events%s when queueing stopped\n",
+			slow.count, slow.overlapped ? ", not one at a time," : "");
+		res = AST_TEST_FAIL;
+	}
+	stats.found = 0;
+	ast_event_sub_queue_stats(AST_EVENT_CUSTOM, event_queue_stats_cb, &stats);
+	if (stats.found) {
+		ast_test_status_update(test, "Slow subscriber kept its queue when queueing stopped\n");
+		res = AST_TEST_FAIL;
+	}
+
+return_cleanup:
+	ast_event_queue_subs(AST_EVENT_CUSTOM, 0);
+	if (slow_sub) {
+		slow_sub = ast_event_unsubscribe(slow_sub);
+	}
+	if (fast_sub) {
+		fast_sub = ast_event_unsubscribe(fast_sub);
+	}
+
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(event_new_test);
 	AST_TEST_UNREGISTER(event_sub_test);
+	AST_TEST_UNREGISTER(event_sub_queue_test);
 
 	return 0;
 }
@@ -978,6 +1193,7 @@ static int load_module(void)
 {
 	AST_TEST_REGISTER(event_new_test);
 	AST_TEST_REGISTER(event_sub_test);
+	AST_TEST_REGISTER(event_sub_queue_test);
 
 	return AST_MODULE_LOAD_SUCCESS;
 }
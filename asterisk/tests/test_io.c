@@ -0,0 +1,311 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief I/O context test and benchmark module
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+#include <inttypes.h>
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/io.h"
+#include "asterisk/test.h"
+#include "asterisk/cli.h"
+
+#define TEST_PIPES 16
+
+struct io_test_pipe {
+	int fds[2];
+	int *id;
+	int calls;
+	int keep;
+};
+
+static int io_test_cb(int *id, int fd, short events, void *data)
+{
+	struct io_test_pipe *p = data;
+	char c;
+
+	p->calls++;
+	if (read(fd, &c, 1) < 0) {
+		return 0;
+	}
+	return p->keep;
+}
+
+static void io_test_close(struct io_test_pipe *pipes, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		close(pipes[i].fds[0]);
+		close(pipes[i].fds[1]);
+	}
+}
+
+static enum ast_test_result_state io_test_backend(struct ast_test *test, enum ast_io_backend backend)
+{
+	struct io_context *ioc;
+	struct io_test_pipe pipes[TEST_PIPES];
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	int count = 0;
+	int i, fd, events;
+
+	memset(pipes, 0, sizeof(pipes));
+	if (!(ioc = io_context_create_backend(backend))) {
+		ast_test_status_update(test, "Failed to create I/O context\n");
+		return AST_TEST_FAIL;
+	}
+	ast_test_status_update(test, "Testing the %s backend\n", io_context_backend(ioc));
+
+	for (count = 0; count < TEST_PIPES; count++) {
+		if (pipe(pipes[count].fds)) {
+			ast_test_status_update(test, "Failed to create pipe\n");
+			goto return_cleanup;
+		}
+		pipes[count].keep = 1;
+		if (!(pipes[count].id = ast_io_add(ioc, pipes[count].fds[0], io_test_cb, AST_IO_IN, &pipes[count]))) {
+			ast_test_status_update(test, "Failed to add pipe %d\n", count);
+			close(pipes[count].fds[0]);
+			close(pipes[count].fds[1]);
+			goto return_cleanup;
+		}
+	}
+
+	if ((events = ast_io_wait(ioc, 0))) {
+		ast_test_status_update(test, "Expected no events, got %d\n", events);
+		goto return_cleanup;
+	}
+
+	/* Make three pipes ready, one of which asks to be removed */
+	pipes[7].keep = 0;
+	if (write(pipes[2].fds[1], "x", 1) != 1 || write(pipes[7].fds[1], "x", 1) != 1
+		|| write(pipes[11].fds[1], "x", 1) != 1) {
+		ast_test_status_update(test, "Failed to write to pipe\n");
+		goto return_cleanup;
+	}
+	if ((events = ast_io_wait(ioc, 1000)) != 3) {
+		ast_test_status_update(test, "Expected 3 events, got %d\n", events);
+		goto return_cleanup;
+	}
+	for (i = 0; i < TEST_PIPES; i++) {
+		if (pipes[i].calls != (i == 2 || i == 7 || i == 11)) {
+			ast_test_status_update(test, "Callback of pipe %d ran %d times\n", i, pipes[i].calls);
+			goto return_cleanup;
+		}
+	}
+
+	/* The removed pipe and one removed here must not be dispatched again */
+	if (ast_io_remove(ioc, pipes[11].id)) {
+		ast_test_status_update(test, "Failed to remove pipe 11\n");
+		goto return_cleanup;
+	}
+	if (write(pipes[7].fds[1], "x", 1) != 1 || write(pipes[11].fds[1], "x", 1) != 1
+		|| write(pipes[2].fds[1], "x", 1) != 1) {
+		ast_test_status_update(test, "Failed to write to pipe\n");
+		goto return_cleanup;
+	}
+	if ((events = ast_io_wait(ioc, 1000)) != 1 || pipes[2].calls != 2
+		|| pipes[7].calls != 1 || pipes[11].calls != 1) {
+		ast_test_status_update(test, "Removed pipes were dispatched, %d events\n", events);
+		goto return_cleanup;
+	}
+
+	/* Move an id over to the write end of a pipe, which is always ready */
+	if (!ast_io_change(ioc, pipes[3].id, pipes[3].fds[1], NULL, AST_IO_OUT, NULL)) {
+		ast_test_status_update(test, "Failed to change pipe 3\n");
+		goto return_cleanup;
+	}
+	if ((events = ast_io_wait(ioc, 1000)) != 1 || pipes[3].calls != 1) {
+		ast_test_status_update(test, "Changed pipe was not dispatched, %d events\n", events);
+		goto return_cleanup;
+	}
+
+	/* Reopen pipe 4 under the same descriptor number, as a reload does with its socket */
+	fd = pipes[4].fds[0];
+	close(pipes[4].fds[0]);
+	close(pipes[4].fds[1]);
+	if (pipe(pipes[4].fds) || pipes[4].fds[0] != fd) {
+		ast_test_status_update(test, "Failed to reopen pipe 4 under the same descriptor\n");
+		goto return_cleanup;
+	}
+	if (!ast_io_change(ioc, pipes[4].id, pipes[4].fds[0], NULL, 0, NULL)) {
+		ast_test_status_update(test, "Failed to change pipe 4\n");
+		goto return_cleanup;
+	}
+	if (write(pipes[4].fds[1], "x", 1) != 1) {
+		ast_test_status_update(test, "Failed to write to pipe\n");
+		goto return_cleanup;
+	}
+	if ((events = ast_io_wait(ioc, 1000)) < 1 || pipes[4].calls != 1) {
+		ast_test_status_update(test, "Reopened pipe was not dispatched, %d events\n", events);
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	io_context_destroy(ioc);
+	io_test_close(pipes, count);
+
+	return res;
+}
+
+AST_TEST_DEFINE(io_test_dispatch)
+{
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "io_test_dispatch";
+		info->category = "/main/io/";
+		info->summary = "Test dispatching of events in the I/O context API";
+		info->description =
+			"This test ensures that ast_io_wait() runs the callbacks of the "
+			"file descriptors that are ready and only those, with both the "
+			"poll and the epoll backends.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (io_test_backend(test, AST_IO_BACKEND_POLL) != AST_TEST_PASS) {
+		return AST_TEST_FAIL;
+	}
+	return io_test_backend(test, AST_IO_BACKEND_EPOLL);
+}
+
+static int io_bench_cb(int *id, int fd, short events, void *data)
+{
+	/* Leave the byte in the pipe so that it stays ready */
+	return 1;
+}
+
+static void io_bench_backend(int fd, enum ast_io_backend backend, struct io_test_pipe *pipes, unsigned int num, unsigned int waits)
+{
+	struct io_context *ioc;
+	struct timeval start;
+	unsigned int i;
+	int64_t us;
+
+	if (!(ioc = io_context_create_backend(backend))) {
+		ast_cli(fd, "Test failed - could not create I/O context\n");
+		return;
+	}
+	for (i = 0; i < num; i++) {
+		if (!ast_io_add(ioc, pipes[i].fds[0], io_bench_cb, AST_IO_IN, NULL)) {
+			ast_cli(fd, "Test failed - ast_io_add() returned NULL\n");
+			io_context_destroy(ioc);
+			return;
+		}
+	}
+
+	start = ast_tvnow();
+	for (i = 0; i < waits; i++) {
+		ast_io_wait(ioc, 0);
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+	ast_cli(fd, "%-6s %u waits - %" PRIi64 " us, %.2f us per wait\n",
+		io_context_backend(ioc), waits, us, (double) us / waits);
+
+	io_context_destroy(ioc);
+}
+
+static char *handle_cli_io_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct io_test_pipe *pipes;
+	unsigned int num, i;
+	unsigned int waits = 1000;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "io benchmark";
+		e->usage = ""
+			"Usage: io benchmark <num>\n"
+			"       Registers <num> pipes with an I/O context, one of which is\n"
+			"       always ready, and times ast_io_wait() with each backend.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 1) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (sscanf(a->argv[e->args], "%u", &num) != 1 || !num) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!(pipes = ast_calloc(num, sizeof(*pipes)))) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (pipe(pipes[i].fds)) {
+			unsigned int keep = i > 8 ? i - 8 : 0;
+
+			ast_cli(a->fd, "Only %u pipes could be created: %s\n", i, strerror(errno));
+			/* Leave some descriptors for the I/O contexts */
+			while (i > keep) {
+				i--;
+				close(pipes[i].fds[0]);
+				close(pipes[i].fds[1]);
+			}
+			break;
+		}
+	}
+	if ((num = i) && write(pipes[num / 2].fds[1], "x", 1) == 1) {
+		ast_cli(a->fd, "Testing ast_io_wait() performance - timing %u waits with "
+				"%u registered file descriptors, one of which is ready\n", waits, num);
+		io_bench_backend(a->fd, AST_IO_BACKEND_POLL, pipes, num, waits);
+		io_bench_backend(a->fd, AST_IO_BACKEND_EPOLL, pipes, num, waits);
+	}
+
+	io_test_close(pipes, num);
+	ast_free(pipes);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_io[] = {
+	AST_CLI_DEFINE(handle_cli_io_bench, "Benchmark ast_io_wait() dispatch performance"),
+};
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(io_test_dispatch);
+	ast_cli_unregister_multiple(cli_io, ARRAY_LEN(cli_io));
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(io_test_dispatch);
+	ast_cli_register_multiple(cli_io, ARRAY_LEN(cli_io));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "I/O context test module");
@@ -138,6 +138,17 @@ static char *handle_cli_dynamic_level_test(struct ast_cli_entry *e, int cmd, str
 	return CLI_SUCCESS;
 }
 
+static void *performance_test_thread(void *data)
+{
+	unsigned int level = *(unsigned int *) data;
+	unsigned int x;
+
+	for (x = 0; x < 10000; x++) {
+		ast_log_dynamic_level(level, "Performance test log message\n");
+	}
+	return NULL;
+}
+
 static char *handle_cli_performance_test(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	unsigned int level;
@@ -145,19 +156,29 @@ static char *handle_cli_performance_test(struct ast_cli_entry *e, int cmd, struc
 	struct test tests[] = {
 		{ .name = "Log 10,000 messages",
 		},
+		{ .name = "Log 10,000 messages from each of several threads at once",
+		},
 	};
+	int threads = 8;
 
 	switch (cmd) {
 	case CLI_INIT:
 		e->command = "logger test performance";
 		e->usage = ""
-			"Usage: logger test performance\n"
+			"Usage: logger test performance [<threads>]\n"
+			"       The second test logs from <threads> threads, 8 by default.\n"
 			"";
 		return NULL;
 	case CLI_GENERATE:
 		return NULL;
 	}
 
+	if (a->argc == 4 && (sscanf(a->argv[3], "%30d", &threads) != 1 || threads < 1 || threads > 256)) {
+		return CLI_SHOWUSAGE;
+	} else if (a->argc > 4) {
+		return CLI_SHOWUSAGE;
+	}
+
 	for (test = 0; test < ARRAY_LEN(tests); test++) {
 		ast_cli(a->fd, "Test %d: %s.\n", test + 1, tests[test].name);
 		switch (test) {
@@ -182,6 +203,33 @@ static char *handle_cli_performance_test(struct ast_cli_entry *e, int cmd, struc
 				tests[test].u_failure++;
 			}
 			break;
+		case 1:
+			if ((level = ast_logger_register_level("perftest")) != -1) {
+				pthread_t thread[threads];
+				struct timeval start;
+				int elapsed;
+				int x;
+
+				start = ast_tvnow();
+				for (x = 0; x < threads; x++) {
+					if (ast_pthread_create(&thread[x], NULL, performance_test_thread, &level)) {
+						break;
+					}
+				}
+				threads = x;
+				for (x = 0; x < threads; x++) {
+					pthread_join(thread[x], NULL);
+				}
+				elapsed = ast_tvdiff_ms(ast_tvnow(), start);
+				ast_cli(a->fd, "Test: %d threads logged %d messages in %f seconds.\n",
+					threads, threads * 10000, (float) elapsed / 1000);
+				ast_logger_unregister_level("perftest");
+				tests[test].x_success++;
+			} else {
+				ast_cli(a->fd, "Test: Failed, could not register level 'perftest'.\n");
+				tests[test].u_failure++;
+			}
+			break;
 		}
 	}
 
@@ -33,11 +33,15 @@
 
 #include "asterisk.h"
 
+#include <inttypes.h>
+
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 337063 $")
 
 #include "asterisk/module.h"
 #include "asterisk/pbx.h"
 #include "asterisk/test.h"
+#include "asterisk/cli.h"
+#include "asterisk/time.h"
 
 /*!
  * If we determine that we really need
@@ -328,15 +332,220 @@ cleanup:
 	return res;
 }
 
+static int find_exten_name(const char *context, const char *exten, int priority, const char *cid,
+	const char *expected, const char *expected_cid, struct ast_test *test, int new_engine)
+{
+	struct pbx_find_info pfi = { { 0 }, };
+	struct ast_exten *found;
+
+	found = pbx_find_extension(NULL, NULL, &pfi, context, exten, priority, NULL, cid, E_MATCH);
+	if (!found || strcmp(ast_get_extension_name(found), expected)
+		|| (expected_cid ? !ast_get_extension_matchcid(found) || strcmp(ast_get_extension_cidmatch(found), expected_cid)
+			: ast_get_extension_matchcid(found))) {
+		ast_test_status_update(test, "Expected %s/%s priority %d to match %s/%s but got %s/%s with the %s pattern match engine\n",
+			exten, S_OR(cid, ""), priority, expected, S_OR(expected_cid, ""),
+			found ? ast_get_extension_name(found) : "nothing",
+			found && ast_get_extension_matchcid(found) ? ast_get_extension_cidmatch(found) : "",
+			new_engine ? "new" : "old");
+		return -1;
+	}
+	return 0;
+}
+
+AST_TEST_DEFINE(dialplan_change_test)
+{
+	static const char registrar[] = "test_pbx";
+	static const char TEST_CONTEXT[] = "test_dialplan_change";
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	struct ast_context *con;
+	int old_engine, j;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "dialplan_change_test";
+		info->category = "/main/pbx/";
+		info->summary = "Test matching extensions as the dialplan changes";
+		info->description = "Match an extension repeatedly while extensions that\n"
+			"take precedence over the earlier match are added and removed,\n"
+			"and check that every lookup sees the current dialplan.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(con = ast_context_find_or_create(NULL, NULL, TEST_CONTEXT, registrar))) {
+		ast_test_status_update(test, "Failed to create context %s\n", TEST_CONTEXT);
+		return AST_TEST_FAIL;
+	}
+	old_engine = pbx_set_extenpatternmatchnew(0);
+
+	if (ast_add_extension(TEST_CONTEXT, 0, "_2.", 1, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| ast_add_extension(TEST_CONTEXT, 0, "_2XX", 1, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| ast_add_extension(TEST_CONTEXT, 0, "_2XX", 2, NULL, NULL, "Noop", NULL, NULL, registrar)) {
+		ast_test_status_update(test, "Failed to add extensions to context %s\n", TEST_CONTEXT);
+		goto cleanup;
+	}
+
+	for (j = 0; j < 2; j++) {
+		pbx_set_extenpatternmatchnew(j);
+
+		/* Twice, so the second lookup can reuse the first match */
+		if (find_exten_name(TEST_CONTEXT, "200", 1, NULL, "_2XX", NULL, test, j)
+			|| find_exten_name(TEST_CONTEXT, "200", 2, NULL, "_2XX", NULL, test, j)
+			|| find_exten_name(TEST_CONTEXT, "2000", 1, NULL, "_2.", NULL, test, j)) {
+			goto cleanup;
+		}
+	}
+
+	/*
+	 * The rest is left to the old engine.  The new one only looks for the
+	 * priority in the best matching extension, and its pattern tree does
+	 * not pick up literal extensions added once it is built, with or
+	 * without the cache.
+	 */
+	pbx_set_extenpatternmatchnew(0);
+
+	/* A priority the first match does not have is looked for further on */
+	if (ast_add_extension(TEST_CONTEXT, 0, "_2.", 3, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| find_exten_name(TEST_CONTEXT, "200", 3, NULL, "_2.", NULL, test, 0)) {
+		goto cleanup;
+	}
+
+	/* A pattern added later that sorts first replaces the remembered match */
+	if (find_exten_name(TEST_CONTEXT, "2000", 1, NULL, "_2.", NULL, test, 0)
+		|| ast_add_extension(TEST_CONTEXT, 0, "_20XX", 1, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| find_exten_name(TEST_CONTEXT, "2000", 1, NULL, "_20XX", NULL, test, 0)) {
+		goto cleanup;
+	}
+
+	/* An exact match added later takes precedence, until it is removed */
+	if (ast_add_extension(TEST_CONTEXT, 0, "200", 1, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| ast_add_extension(TEST_CONTEXT, 0, "200", 2, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| find_exten_name(TEST_CONTEXT, "200", 2, NULL, "200", NULL, test, 0)
+		|| find_exten_name(TEST_CONTEXT, "200", 3, NULL, "_2.", NULL, test, 0)) {
+		goto cleanup;
+	}
+	if (ast_context_remove_extension(TEST_CONTEXT, "200", 0, registrar)
+		|| find_exten_name(TEST_CONTEXT, "200", 2, NULL, "_2XX", NULL, test, 0)) {
+		goto cleanup;
+	}
+
+	/* Once an extension matches on Caller*ID, the Caller*ID decides */
+	if (ast_add_extension(TEST_CONTEXT, 0, "200", 1, NULL, NULL, "Noop", NULL, NULL, registrar)
+		|| find_exten_name(TEST_CONTEXT, "200", 1, "123", "200", NULL, test, 0)
+		|| ast_add_extension(TEST_CONTEXT, 0, "200", 1, NULL, "123", "Noop", NULL, NULL, registrar)
+		|| find_exten_name(TEST_CONTEXT, "200", 1, "555", "200", NULL, test, 0)
+		|| find_exten_name(TEST_CONTEXT, "200", 1, "123", "200", "123", test, 0)
+		|| find_exten_name(TEST_CONTEXT, "200", 1, "555", "200", NULL, test, 0)) {
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	pbx_set_extenpatternmatchnew(old_engine);
+	ast_context_destroy(con, registrar);
+
+	return res;
+}
+
+static char *handle_cli_dialplan_benchmark(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	char **numbers = NULL, **tmp, line[AST_MAX_EXTENSION];
+	unsigned int num = 0, size = 0, passes = 1000, i, pass, matched = 0;
+	struct timeval start;
+	int64_t us;
+	FILE *f;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "dialplan benchmark";
+		e->usage = ""
+			"Usage: dialplan benchmark <context> <file> [<passes>]\n"
+			"       Looks up each number listed in <file>, one per line, in\n"
+			"       <context> of the loaded dialplan, <passes> (default 1000)\n"
+			"       times over, the way a channel executing priority 1 of the\n"
+			"       number would, and reports the lookups per second.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 2 && a->argc != e->args + 3) {
+		return CLI_SHOWUSAGE;
+	}
+	if (a->argc == e->args + 3 && (sscanf(a->argv[e->args + 2], "%u", &passes) != 1 || !passes)) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!(f = fopen(a->argv[e->args + 1], "r"))) {
+		ast_cli(a->fd, "Unable to open '%s': %s\n", a->argv[e->args + 1], strerror(errno));
+		return CLI_FAILURE;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		ast_strip(line);
+		if (ast_strlen_zero(line)) {
+			continue;
+		}
+		if (num == size) {
+			size = size ? size * 2 : 64;
+			if (!(tmp = ast_realloc(numbers, size * sizeof(*numbers)))) {
+				break;
+			}
+			numbers = tmp;
+		}
+		if (!(numbers[num] = ast_strdup(line))) {
+			break;
+		}
+		num++;
+	}
+	fclose(f);
+
+	if (!num) {
+		ast_cli(a->fd, "No numbers to look up in '%s'\n", a->argv[e->args + 1]);
+		ast_free(numbers);
+		return CLI_FAILURE;
+	}
+
+	start = ast_tvnow();
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < num; i++) {
+			if (ast_exists_extension(NULL, a->argv[e->args], numbers[i], 1, NULL)) {
+				matched++;
+			}
+		}
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+
+	ast_cli(a->fd, "%u numbers, %u passes - %u of %u lookups matched in %" PRIi64 " us, %.0f lookups per second\n",
+		num, passes, matched, num * passes, us, us ? (double) num * passes * 1000000 / us : 0.0);
+
+	for (i = 0; i < num; i++) {
+		ast_free(numbers[i]);
+	}
+	ast_free(numbers);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_pbx_bench[] = {
+	AST_CLI_DEFINE(handle_cli_dialplan_benchmark, "Benchmark dialplan extension lookups"),
+};
+
 static int unload_module(void)
 {
+	ast_cli_unregister_multiple(cli_pbx_bench, ARRAY_LEN(cli_pbx_bench));
 	AST_TEST_UNREGISTER(pattern_match_test);
+	AST_TEST_UNREGISTER(dialplan_change_test);
 	return 0;
 }
 
 static int load_module(void)
 {
 	AST_TEST_REGISTER(pattern_match_test);
+	AST_TEST_REGISTER(dialplan_change_test);
+	ast_cli_register_multiple(cli_pbx_bench, ARRAY_LEN(cli_pbx_bench));
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -0,0 +1,231 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief RTP receive benchmark module
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+#include <sys/resource.h>
+#include <inttypes.h>
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/cli.h"
+#include "asterisk/config.h"
+#include "asterisk/frame.h"
+#include "asterisk/sched.h"
+#include "asterisk/netsock2.h"
+#include "asterisk/rtp_engine.h"
+
+#define BENCH_PTIME 20      /*!< Milliseconds of audio in each packet */
+#define BENCH_SAMPLES 160   /*!< Samples in each packet, 20 ms of G.711 */
+
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD RUSAGE_SELF
+#endif
+
+struct rtp_bench_call {
+	struct ast_rtp_instance *instance;
+	struct ast_sockaddr addr;
+	unsigned short seqno;
+	unsigned int timestamp;
+	unsigned int ssrc;
+};
+
+static int64_t rusage_us(int who)
+{
+	struct rusage usage;
+
+	if (getrusage(who, &usage)) {
+		return 0;
+	}
+	return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int rtp_bench_send(int s, struct rtp_bench_call *call)
+{
+	unsigned char packet[12 + BENCH_SAMPLES];
+	unsigned int *header = (unsigned int *) packet;
+
+	header[0] = htonl((2 << 30) | (0 << 16) | call->seqno++);
+	header[1] = htonl(call->timestamp);
+	header[2] = htonl(call->ssrc);
+	call->timestamp += BENCH_SAMPLES;
+	memset(packet + 12, 0xff, BENCH_SAMPLES);
+
+	return ast_sendto(s, packet, sizeof(packet), 0, &call->addr) == sizeof(packet) ? 0 : -1;
+}
+
+static char *handle_cli_rtp_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct ast_sched_context *sched;
+	struct rtp_bench_call *calls;
+	struct pollfd *fds;
+	struct ast_sockaddr addr;
+	struct ast_frame *f, *frames;
+	struct timeval start, next;
+	unsigned int num, seconds, burst = 1, ticks, tick, i, j;
+	unsigned long sent = 0, received = 0, reads = 0, wakeups = 0;
+	int64_t us, cpu, thread_cpu;
+	int s = -1, res;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rtp benchmark";
+		e->usage = ""
+			"Usage: rtp benchmark <calls> <seconds> [<burst>]\n"
+			"       Sends <burst> (default 1) 20 ms G.711 packets every 20 ms over\n"
+			"       loopback to each of <calls> RTP instances, and reads them the way\n"
+			"       a channel does, by polling the file descriptor of each instance.\n"
+			"       Reports how often the instances were woken and read for each\n"
+			"       packet, and the CPU time used for each call.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 2 && a->argc != e->args + 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (sscanf(a->argv[e->args], "%u", &num) != 1 || !num
+		|| sscanf(a->argv[e->args + 1], "%u", &seconds) != 1 || !seconds
+		|| (a->argc == e->args + 3 && (sscanf(a->argv[e->args + 2], "%u", &burst) != 1 || !burst))) {
+		return CLI_SHOWUSAGE;
+	}
+
+	calls = ast_calloc(num, sizeof(*calls));
+	fds = ast_calloc(num, sizeof(*fds));
+	if (!calls || !fds || !(sched = ast_sched_context_create())) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		ast_free(calls);
+		ast_free(fds);
+		return CLI_FAILURE;
+	}
+
+	ast_sockaddr_parse(&addr, "127.0.0.1", PARSE_PORT_FORBID);
+	if ((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || ast_bind(s, &addr)) {
+		ast_cli(a->fd, "Test failed - could not create the sending socket: %s\n", strerror(errno));
+		goto return_cleanup;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (!(calls[i].instance = ast_rtp_instance_new("asterisk", sched, &addr, NULL))) {
+			ast_cli(a->fd, "Test failed - could not create RTP instance %u\n", i);
+			goto return_cleanup;
+		}
+		ast_rtp_codecs_payloads_set_m_type(ast_rtp_instance_get_codecs(calls[i].instance), calls[i].instance, 0);
+		ast_rtp_instance_get_local_address(calls[i].instance, &calls[i].addr);
+		calls[i].seqno = ast_random();
+		calls[i].ssrc = ast_random();
+		fds[i].fd = ast_rtp_instance_fd(calls[i].instance, 0);
+		fds[i].events = POLLIN;
+	}
+
+	ast_cli(a->fd, "Testing RTP receive performance - %u calls for %u seconds, %u packets per call every %d ms\n",
+		num, seconds, burst, BENCH_PTIME);
+
+	ticks = seconds * (1000 / BENCH_PTIME);
+	cpu = rusage_us(RUSAGE_SELF);
+	thread_cpu = rusage_us(RUSAGE_THREAD);
+	start = next = ast_tvnow();
+	for (tick = 0; tick < ticks; tick++) {
+		for (i = 0; i < num; i++) {
+			for (j = 0; j < burst; j++) {
+				if (!rtp_bench_send(s, &calls[i])) {
+					sent++;
+				}
+			}
+		}
+
+		/* Read until the next packets are due */
+		next = ast_tvadd(next, ast_samp2tv(BENCH_PTIME, 1000));
+		while ((res = ast_tvdiff_ms(next, ast_tvnow())) > 0) {
+			if ((res = poll(fds, num, res)) <= 0) {
+				continue;
+			}
+			for (i = 0; i < num; i++) {
+				if (!(fds[i].revents & POLLIN)) {
+					continue;
+				}
+				wakeups++;
+				if (!(frames = ast_rtp_instance_read(calls[i].instance, 0))) {
+					continue;
+				}
+				reads++;
+				for (f = frames; f; f = AST_LIST_NEXT(f, frame_list)) {
+					if (f->frametype == AST_FRAME_VOICE) {
+						received++;
+					}
+				}
+				ast_frfree(frames);
+			}
+		}
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+	cpu = rusage_us(RUSAGE_SELF) - cpu;
+	thread_cpu = rusage_us(RUSAGE_THREAD) - thread_cpu;
+
+	ast_cli(a->fd, "Sent %lu packets, received %lu voice frames in %" PRIi64 " us\n", sent, received, us);
+	ast_cli(a->fd, "Wakeups per packet:  %.2f\n", sent ? (double) wakeups / sent : 0.0);
+	ast_cli(a->fd, "Reads per packet:    %.2f\n", sent ? (double) reads / sent : 0.0);
+	ast_cli(a->fd, "CPU per call:        %.1f us/s (%.1f us/s on the reading thread)\n",
+		(double) cpu / num / (us / 1000000.0), (double) thread_cpu / num / (us / 1000000.0));
+	ast_cli_command(a->fd, "rtp show rxthreads");
+
+return_cleanup:
+	for (i = 0; i < num; i++) {
+		if (calls[i].instance) {
+			ast_rtp_instance_destroy(calls[i].instance);
+		}
+	}
+	if (s > -1) {
+		close(s);
+	}
+	ast_sched_context_destroy(sched);
+	ast_free(calls);
+	ast_free(fds);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_rtp_bench[] = {
+	AST_CLI_DEFINE(handle_cli_rtp_bench, "Benchmark RTP receive performance"),
+};
+
+static int unload_module(void)
+{
+	ast_cli_unregister_multiple(cli_rtp_bench, ARRAY_LEN(cli_rtp_bench));
+	return 0;
+}
+
+static int load_module(void)
+{
+	ast_cli_register_multiple(cli_rtp_bench, ARRAY_LEN(cli_rtp_bench));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "RTP receive benchmark module");
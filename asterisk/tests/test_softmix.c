@@ -0,0 +1,220 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Conference mixing benchmark module
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+#include <inttypes.h>
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/cli.h"
+#include "asterisk/frame.h"
+#include "asterisk/translate.h"
+
+#define BENCH_INTERVAL 20   /*!< Milliseconds of audio mixed in each iteration */
+#define BENCH_SAMPLES 160   /*!< Samples mixed in each iteration, 20 ms at 8 kHz */
+
+struct softmix_bench_participant {
+	short audio[BENCH_SAMPLES];
+	short mix[BENCH_SAMPLES];
+	unsigned char encoded[BENCH_SAMPLES * 2];
+};
+
+/*!
+ * \internal
+ * \brief Mix one interval the way the mixer did before, sample by sample and
+ * encoding the mix of each participant that is not talking on its own.
+ */
+static void softmix_bench_scalar(struct softmix_bench_participant *participants, unsigned int num,
+	unsigned int talkers, struct ast_trans_pvt *trans_pvt, struct ast_frame *frame)
+{
+	short buf[BENCH_SAMPLES] = { 0, };
+	struct ast_frame *out;
+	unsigned int i, x;
+
+	for (i = 0; i < talkers; i++) {
+		for (x = 0; x < BENCH_SAMPLES; x++) {
+			ast_slinear_saturated_add(&buf[x], &participants[i].audio[x]);
+		}
+	}
+	for (i = 0; i < num; i++) {
+		memcpy(participants[i].mix, buf, sizeof(buf));
+		if (i < talkers) {
+			for (x = 0; x < BENCH_SAMPLES; x++) {
+				ast_slinear_saturated_subtract(&participants[i].mix[x], &participants[i].audio[x]);
+			}
+		} else if (trans_pvt) {
+			frame->data.ptr = participants[i].mix;
+			if ((out = ast_translate(trans_pvt, frame, 0))) {
+				memcpy(participants[i].encoded, out->data.ptr, MIN(out->datalen, sizeof(participants[i].encoded)));
+				ast_frfree(out);
+			}
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Mix one interval the way the mixer does now, with the buffer kernels
+ * and one encoding of the mix shared by all participants that are not talking.
+ */
+static void softmix_bench_buf(struct softmix_bench_participant *participants, unsigned int num,
+	unsigned int talkers, struct ast_trans_pvt *trans_pvt, struct ast_frame *frame)
+{
+	short buf[BENCH_SAMPLES] = { 0, };
+	struct ast_frame *out = NULL;
+	unsigned int i;
+
+	for (i = 0; i < talkers; i++) {
+		ast_slinear_saturated_add_buf(buf, participants[i].audio, BENCH_SAMPLES);
+	}
+	if (trans_pvt) {
+		frame->data.ptr = buf;
+		out = ast_translate(trans_pvt, frame, 0);
+	}
+	for (i = 0; i < num; i++) {
+		if (i < talkers) {
+			memcpy(participants[i].mix, buf, sizeof(buf));
+			ast_slinear_saturated_subtract_buf(participants[i].mix, participants[i].audio, BENCH_SAMPLES);
+		} else if (out) {
+			memcpy(participants[i].encoded, out->data.ptr, MIN(out->datalen, sizeof(participants[i].encoded)));
+		} else {
+			memcpy(participants[i].mix, buf, sizeof(buf));
+		}
+	}
+	if (out) {
+		ast_frfree(out);
+	}
+}
+
+static void softmix_bench_run(int fd, const char *name,
+	void (*mix)(struct softmix_bench_participant *, unsigned int, unsigned int, struct ast_trans_pvt *, struct ast_frame *),
+	struct softmix_bench_participant *participants, unsigned int num, unsigned int talkers,
+	struct ast_trans_pvt *trans_pvt, struct ast_frame *frame, unsigned int iterations)
+{
+	struct timeval start;
+	unsigned int i;
+	int64_t us;
+
+	start = ast_tvnow();
+	for (i = 0; i < iterations; i++) {
+		mix(participants, num, talkers, trans_pvt, frame);
+	}
+	us = ast_tvdiff_us(ast_tvnow(), start);
+
+	ast_cli(fd, "%-7s %u iterations - %" PRIi64 " us, %.2f us per iteration, max conference size per core %.0f\n",
+		name, iterations, us, (double) us / iterations,
+		us ? (double) num * BENCH_INTERVAL * 1000 / ((double) us / iterations) : 0.0);
+}
+
+static char *handle_cli_softmix_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct softmix_bench_participant *participants;
+	struct ast_trans_pvt *trans_pvt;
+	struct ast_format slin, ulaw;
+	struct ast_frame frame = {
+		.frametype = AST_FRAME_VOICE,
+		.datalen = BENCH_SAMPLES * 2,
+		.samples = BENCH_SAMPLES,
+		.src = "softmix benchmark",
+	};
+	unsigned int num, talkers = 3, iterations = 1000, i, x;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "softmix benchmark";
+		e->usage = ""
+			"Usage: softmix benchmark <participants> [<talkers>]\n"
+			"       Mixes 20 ms of 8 kHz audio from <talkers> (default 3) of\n"
+			"       <participants> synthetic conference participants, and gives\n"
+			"       each its mix encoded as G.711 ulaw, on the calling thread.\n"
+			"       Times mixing sample by sample and encoding for each\n"
+			"       participant against mixing with the buffer kernels and\n"
+			"       encoding once for all participants not talking, and reports\n"
+			"       the largest conference one core could mix in real time.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 1 && a->argc != e->args + 2) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (sscanf(a->argv[e->args], "%u", &num) != 1 || !num
+		|| (a->argc == e->args + 2 && sscanf(a->argv[e->args + 1], "%u", &talkers) != 1)) {
+		return CLI_SHOWUSAGE;
+	}
+	talkers = MIN(talkers, num);
+
+	if (!(participants = ast_calloc(num, sizeof(*participants)))) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+	for (i = 0; i < num; i++) {
+		for (x = 0; x < BENCH_SAMPLES; x++) {
+			participants[i].audio[x] = ast_random();
+		}
+	}
+
+	ast_format_set(&slin, AST_FORMAT_SLINEAR, 0);
+	ast_format_set(&ulaw, AST_FORMAT_ULAW, 0);
+	ast_format_copy(&frame.subclass.format, &slin);
+	if (!(trans_pvt = ast_translator_build_path(&ulaw, &slin))) {
+		ast_cli(a->fd, "No slin to ulaw translator is loaded, the mix will not be encoded\n");
+	}
+
+	ast_cli(a->fd, "Testing conference mixing performance - %u participants, %u talking, %d ms per iteration\n",
+		num, talkers, BENCH_INTERVAL);
+	softmix_bench_run(a->fd, "scalar", softmix_bench_scalar, participants, num, talkers, trans_pvt, &frame, iterations);
+	softmix_bench_run(a->fd, "buffer", softmix_bench_buf, participants, num, talkers, trans_pvt, &frame, iterations);
+
+	if (trans_pvt) {
+		ast_translator_free_path(trans_pvt);
+	}
+	ast_free(participants);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_softmix_bench[] = {
+	AST_CLI_DEFINE(handle_cli_softmix_bench, "Benchmark conference mixing performance"),
+};
+
+static int unload_module(void)
+{
+	ast_cli_unregister_multiple(cli_softmix_bench, ARRAY_LEN(cli_softmix_bench));
+	return 0;
+}
+
+static int load_module(void)
+{
+	ast_cli_register_multiple(cli_softmix_bench, ARRAY_LEN(cli_softmix_bench));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Conference mixing benchmark module");
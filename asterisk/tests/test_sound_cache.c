@@ -0,0 +1,346 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Sound cache test module
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/test.h"
+#include "asterisk/file.h"
+#include "asterisk/frame.h"
+#include "asterisk/options.h"
+#include "asterisk/paths.h"
+#include "asterisk/channel.h"
+#include "asterisk/mod_format.h"
+
+#define TEST_SAMPLES 160
+
+static int sound_cache_test_write(const char *name)
+{
+	struct ast_filestream *s;
+	struct ast_frame f = { 0, };
+	unsigned char data[TEST_SAMPLES];
+	int res;
+
+	memset(data, 0xff, sizeof(data));
+	f.frametype = AST_FRAME_VOICE;
+	ast_format_set(&f.subclass.format, AST_FORMAT_ULAW, 0);
+	f.data.ptr = data;
+	f.datalen = sizeof(data);
+	f.samples = TEST_SAMPLES;
+	f.src = "sound_cache_test";
+
+	if (!(s = ast_writefile(name, "ulaw", NULL, 0, 0, AST_FILE_MODE))) {
+		return -1;
+	}
+	res = ast_writestream(s, &f);
+	ast_closestream(s);
+	return res;
+}
+
+AST_TEST_DEFINE(sound_cache_test)
+{
+	char name[64], fn[PATH_MAX];
+	unsigned char data[TEST_SAMPLES];
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	FILE *f;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sound_cache_test";
+		info->category = "/main/file/";
+		info->summary = "Test that the sound cache follows sounds changing";
+		info->description =
+			"This test ensures that sounds written and deleted through "
+			"the file API are found, or not, right away, however "
+			"recently they were looked up, and that sounds which were "
+			"not found are found once they are written by other means.  It needs the ulaw file format "
+			"of format_pcm.  Set soundcachesize in asterisk.conf to test "
+			"the cache rather than the disk.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_test_status_update(test, "Sound cache is %s\n", ast_sound_cache_size ? "enabled" : "disabled");
+
+	snprintf(name, sizeof(name), "sound_cache_test_%ld", ast_random());
+	memset(data, 0xff, sizeof(data));
+	if (ast_fileexists(name, NULL, NULL) > 0) {
+		ast_test_status_update(test, "Sound %s already exists\n", name);
+		return AST_TEST_FAIL;
+	}
+	if (sound_cache_test_write(name)) {
+		ast_test_status_update(test, "Failed to write sound %s\n", name);
+		return AST_TEST_FAIL;
+	}
+
+	/* Look it up twice, the second time it is remembered */
+	if (ast_fileexists(name, NULL, NULL) <= 0 || ast_fileexists(name, NULL, NULL) <= 0) {
+		ast_test_status_update(test, "The written sound was not found\n");
+		goto return_cleanup;
+	}
+
+	ast_filedelete(name, NULL);
+	if (ast_fileexists(name, NULL, NULL) > 0) {
+		ast_test_status_update(test, "The deleted sound was still found\n");
+		goto return_cleanup;
+	}
+
+	/* A sound looked up while missing must be found once it is written */
+	if (sound_cache_test_write(name) || ast_fileexists(name, NULL, NULL) <= 0) {
+		ast_test_status_update(test, "The sound written again was not found\n");
+		goto return_cleanup;
+	}
+	ast_filedelete(name, NULL);
+
+	/* Even when it is written behind the back of the file API */
+	if (ast_fileexists(name, NULL, NULL) > 0) {
+		ast_test_status_update(test, "The deleted sound was still found\n");
+		goto return_cleanup;
+	}
+	snprintf(fn, sizeof(fn), "%s/sounds/%s.ulaw", ast_config_AST_DATA_DIR, name);
+	if (!(f = fopen(fn, "w")) || fwrite(data, 1, sizeof(data), f) != sizeof(data)) {
+		ast_test_status_update(test, "Failed to write %s\n", fn);
+		if (f) {
+			fclose(f);
+		}
+		goto return_cleanup;
+	}
+	fclose(f);
+	if (ast_fileexists(name, NULL, NULL) <= 0) {
+		ast_test_status_update(test, "The sound written outside of the file API was not found\n");
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	ast_filedelete(name, NULL);
+
+	return res;
+}
+
+/*! \brief Allocates a channel whose native format is the given one */
+static struct ast_channel *sound_cache_test_channel(enum ast_format_id id)
+{
+	struct ast_channel *chan;
+	struct ast_format format;
+
+	if (!(chan = ast_channel_alloc(0, AST_STATE_DOWN, NULL, NULL, NULL, NULL, NULL, 0, 0, "TestChannel/sound_cache"))) {
+		return NULL;
+	}
+	ast_format_set(&format, id, 0);
+	ast_format_cap_set(ast_channel_nativeformats(chan), &format);
+	ast_format_copy(ast_channel_rawwriteformat(chan), &format);
+	ast_format_copy(ast_channel_writeformat(chan), &format);
+
+	return chan;
+}
+
+/*! \brief Reads the first byte of the sound a channel plays, -1 if it cannot */
+static int sound_cache_test_first_byte(struct ast_channel *chan, const char *name, const char *preflang)
+{
+	struct ast_filestream *s;
+	struct ast_frame *f;
+	int res = -1;
+
+	if (!(s = ast_openstream(chan, name, preflang))) {
+		return -1;
+	}
+	if ((f = ast_readframe(s)) && f->datalen) {
+		res = *(unsigned char *) f->data.ptr;
+	}
+	if (f) {
+		ast_frfree(f);
+	}
+	ast_stopstream(chan);
+
+	return res;
+}
+
+AST_TEST_DEFINE(sound_cache_language_test)
+{
+	char name[64], lname[80], fn[PATH_MAX];
+	unsigned char data[TEST_SAMPLES];
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	struct ast_channel *chan = NULL;
+	FILE *f;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sound_cache_language_test";
+		info->category = "/main/file/";
+		info->summary = "Test that invalidating a sound drops its language variants";
+		info->description =
+			"This test plays a sound cached for a language, changes it on "
+			"disk and invalidates it by the name it is played by, which "
+			"must drop the cached sound of that language.  It needs "
+			"soundcachesize set in asterisk.conf and the ulaw file format "
+			"of format_pcm.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!ast_sound_cache_size) {
+		ast_test_status_update(test, "Sound cache is disabled\n");
+		return AST_TEST_NOT_RUN;
+	}
+
+	snprintf(name, sizeof(name), "sound_cache_test_%ld", ast_random());
+	snprintf(lname, sizeof(lname), "en/%s", name);
+	snprintf(fn, sizeof(fn), "%s/sounds/en", ast_config_AST_DATA_DIR);
+	if (ast_mkdir(fn, 0777) || sound_cache_test_write(lname)) {
+		ast_test_status_update(test, "Failed to write sound %s\n", lname);
+		return AST_TEST_FAIL;
+	}
+	if (!(chan = sound_cache_test_channel(AST_FORMAT_ULAW))) {
+		ast_test_status_update(test, "Failed to allocate a channel\n");
+		goto return_cleanup;
+	}
+
+	if (sound_cache_test_first_byte(chan, name, "en") != 0xff) {
+		ast_test_status_update(test, "The sound was not played in English\n");
+		goto return_cleanup;
+	}
+
+	/* Change it in place, which the cache notices only when it next checks the disk */
+	snprintf(fn, sizeof(fn), "%s/sounds/%s.ulaw", ast_config_AST_DATA_DIR, lname);
+	memset(data, 0, sizeof(data));
+	if (!(f = fopen(fn, "r+")) || fwrite(data, 1, sizeof(data), f) != sizeof(data)) {
+		ast_test_status_update(test, "Failed to write %s\n", fn);
+		if (f) {
+			fclose(f);
+		}
+		goto return_cleanup;
+	}
+	fclose(f);
+
+	ast_sound_cache_invalidate(name);
+	if (sound_cache_test_first_byte(chan, name, "en") != 0) {
+		ast_test_status_update(test, "The English sound was not dropped from the cache\n");
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	if (chan) {
+		ast_hangup(chan);
+	}
+	ast_filedelete(lname, NULL);
+
+	return res;
+}
+
+AST_TEST_DEFINE(sound_cache_encode_test)
+{
+	char name[64];
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	struct ast_channel *chan = NULL;
+	struct ast_filestream *s;
+	int i, encoded = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sound_cache_encode_test";
+		info->category = "/main/file/";
+		info->summary = "Test that sounds are encoded in the background";
+		info->description =
+			"This test plays a u-law sound on an a-law channel.  The first "
+			"play must be transcoded while the sound is encoded in the "
+			"background, and later plays must use the encoding.  It needs "
+			"soundcachesize and soundcacheencode set in asterisk.conf, "
+			"format_pcm, codec_ulaw and codec_alaw.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!ast_sound_cache_size || !ast_sound_cache_encode) {
+		ast_test_status_update(test, "Sounds are not cached encoded\n");
+		return AST_TEST_NOT_RUN;
+	}
+
+	snprintf(name, sizeof(name), "sound_cache_test_%ld", ast_random());
+	if (sound_cache_test_write(name)) {
+		ast_test_status_update(test, "Failed to write sound %s\n", name);
+		return AST_TEST_FAIL;
+	}
+	if (!(chan = sound_cache_test_channel(AST_FORMAT_ALAW))) {
+		ast_test_status_update(test, "Failed to allocate a channel\n");
+		goto return_cleanup;
+	}
+
+	for (i = 0; i < 100 && !encoded; i++) {
+		if (!(s = ast_openstream(chan, name, NULL))) {
+			ast_test_status_update(test, "Failed to open the sound\n");
+			goto return_cleanup;
+		}
+		encoded = !strcmp(s->fmt->name, "sound cache");
+		ast_stopstream(chan);
+		if (!i && encoded) {
+			ast_test_status_update(test, "The first play waited for the sound to be encoded\n");
+			goto return_cleanup;
+		}
+		if (!encoded) {
+			usleep(10000);
+		}
+	}
+	if (!encoded) {
+		ast_test_status_update(test, "The sound was never played encoded\n");
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	if (chan) {
+		ast_hangup(chan);
+	}
+	ast_filedelete(name, NULL);
+
+	return res;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(sound_cache_encode_test);
+	AST_TEST_UNREGISTER(sound_cache_language_test);
+	AST_TEST_UNREGISTER(sound_cache_test);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(sound_cache_test);
+	AST_TEST_REGISTER(sound_cache_language_test);
+	AST_TEST_REGISTER(sound_cache_encode_test);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Sound cache test module");
@@ -0,0 +1,166 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Translation cache test module
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/test.h"
+#include "asterisk/frame.h"
+#include "asterisk/translate.h"
+#include "asterisk/astobj2.h"
+
+#define TEST_SAMPLES 160
+
+static void trans_cache_test_fill(struct ast_frame *f, short *data)
+{
+	int i;
+
+	for (i = 0; i < TEST_SAMPLES; i++) {
+		data[i] = ast_random();
+	}
+	f->frametype = AST_FRAME_VOICE;
+	ast_format_set(&f->subclass.format, AST_FORMAT_SLINEAR, 0);
+	f->data.ptr = data;
+	f->datalen = TEST_SAMPLES * 2;
+	f->samples = TEST_SAMPLES;
+	f->src = "trans_cache_test";
+}
+
+AST_TEST_DEFINE(trans_cache_test)
+{
+	struct ast_trans_cache *cache;
+	struct ast_trans_pvt *trans_pvt = NULL;
+	struct ast_frame f = { 0, }, *first = NULL, *second = NULL, *next = NULL, *direct = NULL;
+	struct ast_format slin, ulaw;
+	short data[TEST_SAMPLES], other[TEST_SAMPLES];
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "trans_cache_test";
+		info->category = "/main/translate/";
+		info->summary = "Test sharing translations through a translation cache";
+		info->description =
+			"This test ensures that a frame translated through a cache is "
+			"translated once and shared by all consumers sending it, that "
+			"frames out of step with the stream are left to the caller, and "
+			"that the shared frame is the same as translating it directly.  "
+			"It needs the slin to ulaw translator of codec_ulaw.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_format_set(&slin, AST_FORMAT_SLINEAR, 0);
+	ast_format_set(&ulaw, AST_FORMAT_ULAW, 0);
+	if (!(trans_pvt = ast_translator_build_path(&ulaw, &slin))) {
+		ast_test_status_update(test, "No slin to ulaw translator is loaded\n");
+		return AST_TEST_FAIL;
+	}
+	if (!(cache = ast_trans_cache_alloc("trans_cache_test"))) {
+		ast_test_status_update(test, "Failed to allocate translation cache\n");
+		ast_translator_free_path(trans_pvt);
+		return AST_TEST_FAIL;
+	}
+
+	trans_cache_test_fill(&f, data);
+	if (ast_trans_cache_translate(cache, &f, &slin)) {
+		ast_test_status_update(test, "A frame already in the destination format was translated\n");
+		goto return_cleanup;
+	}
+	if (!(first = ast_trans_cache_translate(cache, &f, &ulaw))
+		|| first->subclass.format.id != AST_FORMAT_ULAW || first->datalen != TEST_SAMPLES) {
+		ast_test_status_update(test, "Failed to translate the first frame\n");
+		goto return_cleanup;
+	}
+	if (!(direct = ast_translate(trans_pvt, &f, 0)) || direct->datalen != first->datalen
+		|| memcmp(direct->data.ptr, first->data.ptr, first->datalen)) {
+		ast_test_status_update(test, "The shared frame differs from a direct translation\n");
+		goto return_cleanup;
+	}
+
+	/* A second consumer sending the same audio must get the same frame */
+	if ((second = ast_trans_cache_translate(cache, &f, &ulaw)) != first) {
+		ast_test_status_update(test, "The translation of the same frame was not shared\n");
+		goto return_cleanup;
+	}
+
+	/* Other audio right away comes from a consumer out of step */
+	trans_cache_test_fill(&f, other);
+	if ((next = ast_trans_cache_translate(cache, &f, &ulaw))) {
+		ast_test_status_update(test, "A frame out of step with the stream was translated\n");
+		goto return_cleanup;
+	}
+
+	/* ...but once half a frame has passed it is the next frame of the stream */
+	usleep(TEST_SAMPLES * 1000 / 8 / 2 + 1000);
+	if (!(next = ast_trans_cache_translate(cache, &f, &ulaw)) || next == first) {
+		ast_test_status_update(test, "The next frame of the stream was not translated\n");
+		goto return_cleanup;
+	}
+
+	/* Shared frames outlive the cache */
+	cache = ast_trans_cache_destroy(cache);
+	if (first->datalen != TEST_SAMPLES || next->datalen != TEST_SAMPLES) {
+		ast_test_status_update(test, "Shared frames did not outlive the cache\n");
+		goto return_cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+return_cleanup:
+	ast_trans_cache_destroy(cache);
+	if (first) {
+		ao2_ref(first, -1);
+	}
+	if (second) {
+		ao2_ref(second, -1);
+	}
+	if (next) {
+		ao2_ref(next, -1);
+	}
+	if (direct) {
+		ast_frfree(direct);
+	}
+	ast_translator_free_path(trans_pvt);
+
+	return res;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(trans_cache_test);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(trans_cache_test);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Translation cache test module");
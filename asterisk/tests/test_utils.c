@@ -309,6 +309,69 @@ AST_TEST_DEFINE(base64_test)
 	return res;
 }
 
+AST_TEST_DEFINE(slinear_saturated_buf_test)
+{
+	static const short extremes[] = { 32767, -32768, -32767, 16384, -16384, 1, -1, 0 };
+	short input[67], value[67], add[67];
+	int i, length;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "slinear_saturated_buf_test";
+		info->category = "/main/utils/";
+		info->summary = "Test saturated buffer add and subtract";
+		info->description =
+			"This test ensures that ast_slinear_saturated_add_buf() and "
+			"ast_slinear_saturated_subtract_buf() give the same results as "
+			"ast_slinear_saturated_add() and ast_slinear_saturated_subtract() "
+			"on each sample, for buffers of any length.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (length = 0; length <= ARRAY_LEN(input); length++) {
+		for (i = 0; i < length; i++) {
+			/* Pair the extremes with each other, and random samples otherwise */
+			if (i < ARRAY_LEN(extremes) * ARRAY_LEN(extremes)) {
+				input[i] = extremes[i / ARRAY_LEN(extremes)];
+				value[i] = extremes[i % ARRAY_LEN(extremes)];
+			} else {
+				input[i] = ast_random();
+				value[i] = ast_random();
+			}
+			add[i] = input[i];
+			ast_slinear_saturated_add(&add[i], &value[i]);
+		}
+
+		ast_slinear_saturated_add_buf(input, value, length);
+		for (i = 0; i < length; i++) {
+			if (input[i] != add[i]) {
+				ast_test_status_update(test, "Adding %d samples gave %d at %d, expected %d\n",
+					length, input[i], i, add[i]);
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+
+		ast_slinear_saturated_subtract_buf(input, value, length);
+		for (i = 0; i < length; i++) {
+			short expected = add[i];
+
+			ast_slinear_saturated_subtract(&expected, &value[i]);
+			if (input[i] != expected) {
+				ast_test_status_update(test, "Subtracting %d samples gave %d at %d, expected %d\n",
+					length, input[i], i, expected);
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+	}
+
+	return res;
+}
+
 AST_TEST_DEFINE(crypto_loaded_test)
 {
 	switch (cmd) {
@@ -428,6 +491,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(md5_test);
 	AST_TEST_UNREGISTER(sha1_test);
 	AST_TEST_UNREGISTER(base64_test);
+	AST_TEST_UNREGISTER(slinear_saturated_buf_test);
 	AST_TEST_UNREGISTER(crypto_loaded_test);
 	AST_TEST_UNREGISTER(adsi_loaded_test);
 	AST_TEST_UNREGISTER(agi_loaded_test);
@@ -441,6 +505,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(md5_test);
 	AST_TEST_REGISTER(sha1_test);
 	AST_TEST_REGISTER(base64_test);
+	AST_TEST_REGISTER(slinear_saturated_buf_test);
 	AST_TEST_REGISTER(crypto_loaded_test);
 	AST_TEST_REGISTER(adsi_loaded_test);
 	AST_TEST_REGISTER(agi_loaded_test);
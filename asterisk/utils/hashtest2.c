@@ -25,6 +25,10 @@
  *         be good code! Even features some global counters
  *         that will get slightly behind because they aren't lock-protected.
  *
+ *         Run with -b to measure the lookup, link and unlink rates of
+ *         a fixed size container and of a resizable, striped one at
+ *         1, 4 and 16 threads instead.
+ *
  *  \author Steve Murphy <murf@digium.com>
  */
 
@@ -307,11 +311,160 @@ static void run_hashtest(int numthr)
 }
 
 
+/* the benchmark */
+
+enum bench_op {
+	BENCH_LOOKUP,
+	BENCH_LINK,
+	BENCH_UNLINK,
+};
+
+struct bench_thread {
+	pthread_t thread;
+	enum bench_op op;
+	int id;
+	int objects;	/*!< Objects in the container before linking */
+	int ops;	/*!< Operations to run */
+	unsigned int seed;
+};
+
+static struct ht_element *bench_element(const char *prefix, int num)
+{
+	char keybuf[100];
+	struct ht_element *x = ao2_alloc(sizeof(struct ht_element), ht_destroy);
+
+	if (x) {
+		snprintf(keybuf, sizeof(keybuf), "%s%08d", prefix, num);
+		x->key = strdup(keybuf);
+		x->val = NULL;
+	}
+	return x;
+}
+
+static void *bench_thread_run(void *data)
+{
+	struct bench_thread *bt = data;
+	struct ht_element *el, lookup;
+	char keybuf[100];
+	int i;
+
+	lookup.key = keybuf;
+	for (i = 0; i < bt->ops; i++) {
+		switch (bt->op) {
+		case BENCH_LOOKUP:
+			snprintf(keybuf, sizeof(keybuf), "key%08d", rand_r(&bt->seed) % bt->objects);
+			if ((el = ao2_find(glob_hashtab, &lookup, OBJ_POINTER))) {
+				ao2_ref(el, -1);
+			}
+			break;
+		case BENCH_LINK:
+			snprintf(keybuf, sizeof(keybuf), "t%02d-", bt->id);
+			if ((el = bench_element(keybuf, i))) {
+				ao2_link(glob_hashtab, el);
+				ao2_ref(el, -1);
+			}
+			break;
+		case BENCH_UNLINK:
+			snprintf(keybuf, sizeof(keybuf), "t%02d-%08d", bt->id, i);
+			if ((el = ao2_find(glob_hashtab, &lookup, OBJ_POINTER | OBJ_UNLINK))) {
+				ao2_ref(el, -1);
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*! \brief Run an operation on numthr threads at once, return operations per second */
+static double run_bench_op(enum bench_op op, int numthr, int objects, int ops)
+{
+	struct bench_thread bt[numthr];
+	struct timeval start;
+	int64_t usecs;
+	int i;
+
+	start = ast_tvnow();
+	for (i = 0; i < numthr; i++) {
+		bt[i].op = op;
+		bt[i].id = i;
+		bt[i].objects = objects;
+		bt[i].ops = ops / numthr;
+		bt[i].seed = glob_seed + i;
+		if (ast_pthread_create(&bt[i].thread, NULL, bench_thread_run, &bt[i])) {
+			printf("Sorry, couldn't create thread #%d\n", i + 1);
+			exit(1);
+		}
+	}
+	for (i = 0; i < numthr; i++) {
+		pthread_join(bt[i].thread, NULL);
+	}
+	usecs = ast_tvdiff_us(ast_tvnow(), start);
+
+	return usecs > 0 ? (double) (ops / numthr) * numthr * 1000000 / usecs : 0;
+}
+
+static void run_benchmark(int objects)
+{
+	static const int threads[] = { 1, 4, 16 };
+	static const struct {
+		const char *name;
+		unsigned int options;
+	} configs[] = {
+		{ "fixed size, mutex", AO2_ALLOC_OPT_LOCK_MUTEX },
+		{ "resizable, striped rwlock", AO2_ALLOC_OPT_LOCK_RWLOCK | AO2_CONTAINER_ALLOC_OPT_RESIZE | AO2_CONTAINER_ALLOC_OPT_STRIPED },
+	};
+	struct ht_element *el;
+	int ops = objects * 4;
+	int c, t, i;
+	enum bench_op op;
+
+	glob_seed = (unsigned int)time(0);
+	printf("%d objects in a container starting with 563 buckets, %d operations per test\n\n", objects, ops);
+	printf("%-28s %8s %16s %16s %16s\n", "container", "threads", "lookups/sec", "links/sec", "unlinks/sec");
+
+	for (c = 0; c < ARRAY_LEN(configs); c++) {
+		for (t = 0; t < ARRAY_LEN(threads); t++) {
+			glob_hashtab = ao2_container_alloc_options(configs[c].options, 563, hash_string, hashtab_compare_strings);
+			if (!glob_hashtab) {
+				printf("Sorry, couldn't allocate the container\n");
+				exit(1);
+			}
+			for (i = 0; i < objects; i++) {
+				if ((el = bench_element("key", i))) {
+					ao2_link(glob_hashtab, el);
+					ao2_ref(el, -1);
+				}
+			}
+
+			printf("%-28s %8d", configs[c].name, threads[t]);
+			for (op = BENCH_LOOKUP; op <= BENCH_UNLINK; op++) {
+				printf(" %16.0f", run_bench_op(op, threads[t], objects, op == BENCH_LOOKUP ? ops : objects));
+				fflush(stdout);
+			}
+			printf("\n");
+
+			if (ao2_container_count(glob_hashtab) != objects) {
+				printf("Container has %d objects after unlinking, expected %d\n",
+					ao2_container_count(glob_hashtab), objects);
+			}
+			ao2_ref(glob_hashtab, -1);
+			glob_hashtab = NULL;
+		}
+	}
+}
+
 int main(int argc,char **argv)
 {
+	if (argc >= 2 && !strcmp(argv[1], "-b")) {
+		/* benchmark, optional arg == number of objects */
+		run_benchmark(argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 50000);
+		return 0;
+	}
+
 	if (argc < 2 || argc > 2 || atoi(argv[1]) < 1)
 	{
 		printf("Usage: hashtest <number of threads>\n");
+		printf("       hashtest -b [number of objects]\n");
 		exit(1);
 	}
 	
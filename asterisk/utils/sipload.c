@@ -0,0 +1,212 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief A SIP UDP load generator
+ *
+ * This utility acts as a very simple UAC that sends a stream of SIP OPTIONS
+ * requests over UDP to a SIP server (normally chan_sip on the loopback
+ * interface) and counts the responses.  It keeps a fixed number of requests
+ * outstanding, spreads them over a configurable number of Call-IDs, and
+ * reports the number of messages per second handled by the server.  It is
+ * intended for comparing the udpthreads settings of chan_sip.
+ *
+ * The server must answer out-of-dialog OPTIONS requests, e.g. with
+ * allowguest=yes in sip.conf.
+ */
+
+/*** MODULEINFO
+	<support_level>extended</support_level>
+ ***/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void usage(void)
+{
+	fprintf(stderr, "sipload -- A SIP UDP load generator.\n");
+	fprintf(stderr, "Written for use with Asterisk (http://www.asterisk.org)\n\n");
+	fprintf(stderr, "Usage: ./sipload [-h host] [-p port] [-n requests] [-w window] [-c callids] [-t timeout]\n");
+	fprintf(stderr, "  -h  SIP server address (default: 127.0.0.1)\n");
+	fprintf(stderr, "  -p  SIP server port (default: 5060)\n");
+	fprintf(stderr, "  -n  Number of requests to send (default: 100000)\n");
+	fprintf(stderr, "  -w  Number of requests outstanding at once (default: 100)\n");
+	fprintf(stderr, "  -c  Number of distinct Call-IDs to use (default: 1000)\n");
+	fprintf(stderr, "  -t  Milliseconds to wait for a response before giving up on it (default: 1000)\n");
+	exit(1);
+}
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int send_options(int s, const struct sockaddr_in *local, const char *host, int port, int callid, int cseq)
+{
+	char buf[1024];
+	int len;
+
+	len = snprintf(buf, sizeof(buf),
+		"OPTIONS sip:sipload@%s:%d SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP %s:%d;branch=z9hG4bK-sipload-%d-%d;rport\r\n"
+		"Max-Forwards: 70\r\n"
+		"From: <sip:sipload@%s:%d>;tag=sipload-%d\r\n"
+		"To: <sip:sipload@%s:%d>\r\n"
+		"Call-ID: sipload-%d-%d@%s\r\n"
+		"CSeq: %d OPTIONS\r\n"
+		"Contact: <sip:sipload@%s:%d>\r\n"
+		"Accept: application/sdp\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n",
+		host, port,
+		inet_ntoa(local->sin_addr), ntohs(local->sin_port), callid, cseq,
+		inet_ntoa(local->sin_addr), ntohs(local->sin_port), callid,
+		host, port,
+		(int) getpid(), callid, inet_ntoa(local->sin_addr),
+		cseq,
+		inet_ntoa(local->sin_addr), ntohs(local->sin_port));
+
+	return send(s, buf, len, 0) == len ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sin;
+	struct sockaddr_in local;
+	socklen_t locallen = sizeof(local);
+	struct hostent *hp;
+	struct pollfd pfd;
+	struct timeval start;
+	const char *host = "127.0.0.1";
+	int port = 5060;
+	int requests = 100000;
+	int window = 100;
+	int callids = 1000;
+	int timeout = 1000;
+	int sent = 0, received = 0, lost = 0, outstanding = 0;
+	char buf[65535];
+	double secs;
+	int s, c, res;
+
+	while ((c = getopt(argc, argv, "h:p:n:w:c:t:")) != -1) {
+		switch (c) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			requests = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'c':
+			callids = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (port < 1 || requests < 1 || window < 1 || callids < 1 || timeout < 1) {
+		usage();
+	}
+
+	hp = gethostbyname(host);
+	if (!hp) {
+		fprintf(stderr, "Unable to lookup IP for host '%s'\n", host);
+		exit(1);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	memcpy(&sin.sin_addr, hp->h_addr, sizeof(sin.sin_addr));
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s < 0) {
+		fprintf(stderr, "Unable to allocate socket!\n");
+		exit(1);
+	}
+	if (connect(s, (struct sockaddr *) &sin, sizeof(sin))
+		|| getsockname(s, (struct sockaddr *) &local, &locallen)) {
+		fprintf(stderr, "Unable to connect to host: %s\n", strerror(errno));
+		close(s);
+		exit(1);
+	}
+
+	pfd.fd = s;
+	pfd.events = POLLIN;
+
+	gettimeofday(&start, NULL);
+	while (received + lost < requests) {
+		while (outstanding < window && sent < requests) {
+			if (send_options(s, &local, host, port, sent % callids, sent / callids + 1)) {
+				fprintf(stderr, "Unable to send request: %s\n", strerror(errno));
+				close(s);
+				exit(1);
+			}
+			sent++;
+			outstanding++;
+		}
+
+		res = poll(&pfd, 1, timeout);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		} else if (!res) {
+			/* Nothing came back in time; count what is outstanding as lost */
+			lost += outstanding;
+			outstanding = 0;
+			continue;
+		}
+
+		while ((res = recv(s, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+			buf[res] = '\0';
+			if (!strncmp(buf, "SIP/2.0 ", 8) && outstanding) {
+				received++;
+				outstanding--;
+			}
+		}
+	}
+	secs = elapsed(&start);
+	close(s);
+
+	printf("Sent %d requests to %s:%d over %d Call-IDs in %.3f seconds\n", sent, host, port, callids, secs);
+	printf("Received %d responses, %d requests timed out\n", received, lost);
+	printf("%.0f messages/second\n", secs > 0 ? received / secs : 0);
+
+	exit(received ? 0 : 1);
+}
@@ -0,0 +1,332 @@
+/*
+ * libpri: An implementation of Primary Rate ISDN
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+/*!
+ * \file
+ * \brief Q.931 call load test program
+ *
+ * Like testprilib, connects a network and a CPE D channel controller
+ * back to back through a socketpair.  The network side keeps a number of
+ * calls in progress (500 by default), each call going through SETUP,
+ * CALL PROCEEDING, CONNECT, CONNECT ACKNOWLEDGE, DISCONNECT, RELEASE and
+ * RELEASE COMPLETE, and reports the Q.931 messages handled per second.
+ *
+ * Usage: calltest [<calls in progress> [<total calls>]]
+ */
+
+
+#include "compat.h"
+#include "libpri.h"
+#include "pri_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#ifndef AF_LOCAL
+#define AF_LOCAL AF_UNIX
+#endif
+
+#define PRI_DEF_SWITCHTYPE	PRI_SWITCH_EUROISDN_E1
+
+
+/* ------------------------------------------------------------------- */
+
+
+/*! Network side D channel controller placing the calls. */
+static struct pri *network;
+/*! CPE side D channel controller answering the calls. */
+static struct pri *cpe;
+/*! Number of D channels up. */
+static int dchans_up;
+/*! Number of calls started. */
+static unsigned calls_started;
+/*! Number of calls completely cleared. */
+static unsigned calls_done;
+/*! Number of calls that could not be started or got an unexpected event. */
+static unsigned calls_failed;
+
+static void call_pri_message(struct pri *ctrl, char *stuff)
+{
+	/* Too much to print with this many calls. */
+}
+
+static void call_pri_error(struct pri *ctrl, char *stuff)
+{
+	fprintf(stderr, "%s", stuff);
+}
+
+/*!
+ * \internal
+ * \brief Start a new call from the network side.
+ *
+ * \return Nothing
+ */
+static void call_start(void)
+{
+	q931_call *call;
+	char num[32];
+	char dest[32];
+
+	call = pri_new_call(network);
+	if (!call) {
+		++calls_failed;
+		return;
+	}
+	snprintf(num, sizeof(num), "25642860%04u", calls_started % 10000);
+	snprintf(dest, sizeof(dest), "60%04u", calls_started % 10000);
+	if (pri_call(network, call, PRI_TRANS_CAP_SPEECH, calls_started % 30 + 1, 1, 1, num,
+		PRI_NATIONAL_ISDN, "Load test", PRES_ALLOWED_USER_NUMBER_PASSED_SCREEN,
+		dest, PRI_NATIONAL_ISDN, PRI_LAYER_1_ALAW)) {
+		++calls_failed;
+		return;
+	}
+	++calls_started;
+}
+
+static void event_network(struct pri *ctrl, pri_event *e)
+{
+	switch (e->gen.e) {
+	case PRI_EVENT_DCHAN_UP:
+		++dchans_up;
+		break;
+	case PRI_EVENT_PROCEEDING:
+		break;
+	case PRI_EVENT_ANSWER:
+		pri_hangup(ctrl, e->answer.call, PRI_CAUSE_NORMAL_CLEARING);
+		break;
+	case PRI_EVENT_HANGUP:
+		/* The RELEASE answering our DISCONNECT. */
+		pri_hangup(ctrl, e->hangup.call, e->hangup.cause);
+		++calls_done;
+		break;
+	case PRI_EVENT_HANGUP_ACK:
+		++calls_done;
+		break;
+	default:
+		pri_error(ctrl, "Network: Unexpected %s (%d)\n", pri_event2str(e->gen.e), e->gen.e);
+		++calls_failed;
+		break;
+	}
+}
+
+static void event_cpe(struct pri *ctrl, pri_event *e)
+{
+	switch (e->gen.e) {
+	case PRI_EVENT_DCHAN_UP:
+		++dchans_up;
+		break;
+	case PRI_EVENT_RING:
+		pri_proceeding(ctrl, e->ring.call, e->ring.channel, 0);
+		pri_answer(ctrl, e->ring.call, e->ring.channel, 1);
+		break;
+	case PRI_EVENT_HANGUP_REQ:
+		pri_hangup(ctrl, e->hangup.call, e->hangup.cause);
+		break;
+	case PRI_EVENT_HANGUP:
+		pri_hangup(ctrl, e->hangup.call, e->hangup.cause);
+		break;
+	case PRI_EVENT_HANGUP_ACK:
+		break;
+	default:
+		pri_error(ctrl, "CPE: Unexpected %s (%d)\n", pri_event2str(e->gen.e), e->gen.e);
+		++calls_failed;
+		break;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Run the expired timers of a D channel controller.
+ *
+ * \param ctrl D channel controller.
+ * \param handler Event handler of the controller.
+ * \param tv Latest time a timer may expire without waiting.  Updated to the
+ * time the next timer expires.
+ *
+ * \return Nothing
+ */
+static void call_run_timers(struct pri *ctrl, void (*handler)(struct pri *ctrl, pri_event *e), struct timeval *tv)
+{
+	struct timeval *next;
+	struct timeval now;
+	pri_event *e;
+
+	gettimeofday(&now, NULL);
+	while ((next = pri_schedule_next(ctrl))
+		&& (next->tv_sec < now.tv_sec
+			|| (next->tv_sec == now.tv_sec && next->tv_usec <= now.tv_usec))) {
+		e = pri_schedule_run(ctrl);
+		if (e) {
+			handler(ctrl, e);
+		}
+	}
+	if (next && (next->tv_sec < tv->tv_sec
+		|| (next->tv_sec == tv->tv_sec && next->tv_usec < tv->tv_usec))) {
+		*tv = *next;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Handle D channel activity on both controllers until a condition is met.
+ *
+ * \param calls_active Calls to keep in progress, 0 to only wait for the D channels.
+ * \param total_calls Calls to complete.
+ *
+ * \retval 0 on success.
+ * \retval -1 on error.
+ */
+static int call_loop(unsigned calls_active, unsigned total_calls)
+{
+	struct timeval now;
+	struct timeval next;
+	struct timeval tv;
+	pri_event *e;
+	fd_set fds;
+	int max_fd;
+	int res;
+
+	for (;;) {
+		if (!calls_active) {
+			if (dchans_up == 2) {
+				return 0;
+			}
+		} else {
+			if (total_calls <= calls_done) {
+				return 0;
+			}
+			while (calls_started - calls_done < calls_active && calls_started < total_calls) {
+				call_start();
+			}
+		}
+		if (calls_failed) {
+			return -1;
+		}
+
+		/* Run expired timers and find when the next timer expires. */
+		gettimeofday(&now, NULL);
+		next = now;
+		next.tv_sec += 1;
+		call_run_timers(network, event_network, &next);
+		call_run_timers(cpe, event_cpe, &next);
+		tv.tv_sec = next.tv_sec - now.tv_sec;
+		tv.tv_usec = next.tv_usec - now.tv_usec;
+		if (tv.tv_usec < 0) {
+			tv.tv_usec += 1000000;
+			tv.tv_sec -= 1;
+		}
+		if (tv.tv_sec < 0) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(pri_fd(network), &fds);
+		FD_SET(pri_fd(cpe), &fds);
+		max_fd = pri_fd(network) < pri_fd(cpe) ? pri_fd(cpe) : pri_fd(network);
+		res = select(max_fd + 1, &fds, NULL, NULL, &tv);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("select");
+			return -1;
+		}
+		if (FD_ISSET(pri_fd(network), &fds)) {
+			e = pri_check_event(network);
+			if (e) {
+				event_network(network, e);
+			}
+		}
+		if (FD_ISSET(pri_fd(cpe), &fds)) {
+			e = pri_check_event(cpe);
+			if (e) {
+				event_cpe(cpe, e);
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int pair[2];
+	unsigned calls_active;
+	unsigned total_calls;
+	unsigned messages;
+	struct timeval start;
+	struct timeval end;
+	double secs;
+
+	pri_set_message(call_pri_message);
+	pri_set_error(call_pri_error);
+
+	calls_active = 1 < argc ? atoi(argv[1]) : 500;
+	total_calls = 2 < argc ? atoi(argv[2]) : 100000;
+	if (!calls_active || !total_calls) {
+		fprintf(stderr, "Usage: calltest [<calls in progress> [<total calls>]]\n");
+		return 1;
+	}
+
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, pair)) {
+		perror("socketpair");
+		return 1;
+	}
+	network = pri_new(pair[0], PRI_NETWORK, PRI_DEF_SWITCHTYPE);
+	cpe = pri_new(pair[1], PRI_CPE, PRI_DEF_SWITCHTYPE);
+	if (!network || !cpe) {
+		perror("pri_new");
+		return 1;
+	}
+
+	/* For sanity specify what version of libpri we are testing. */
+	printf("libpri version tested: %s\n", pri_get_version());
+
+	if (call_loop(0, 0)) {
+		return 1;
+	}
+	printf("D channels up.  Placing %u calls, %u at a time.\n", total_calls, calls_active);
+
+	gettimeofday(&start, NULL);
+	if (call_loop(calls_active, total_calls)) {
+		fprintf(stderr, "Failed after %u of %u calls\n", calls_done, total_calls);
+		return 1;
+	}
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	messages = network->q931_rxcount + cpe->q931_rxcount;
+	printf("%u calls, %u Q.931 messages in %.3f seconds: %.0f calls/sec, %.0f messages/sec\n",
+		calls_done, messages, secs, calls_done / secs, messages / secs);
+
+	close(pair[0]);
+	close(pair[1]);
+	return 0;
+}
+
+/* ------------------------------------------------------------------- */
+/* end calltest.c */
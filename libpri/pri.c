@@ -501,6 +501,7 @@ static void pri_ctrl_destroy(struct pri *ctrl)
 		}
 		free(ctrl->msg_line);
 		free(ctrl->sched.timer);
+		free(ctrl->sched.heap);
 		free(ctrl);
 	}
 }
@@ -573,6 +574,7 @@ static struct pri *pri_ctrl_new(int fd, int node, int switchtype, pri_io_cb rd,
 	ctrl->cref = 1;
 	ctrl->nsf = PRI_NSF_NONE;
 	ctrl->callpool = &ctrl->localpool;
+	ctrl->callindex = &ctrl->localindex;
 	pri_default_timers(ctrl, switchtype);
 	ctrl->q921_rxcount = 0;
 	ctrl->q921_txcount = 0;
@@ -1902,6 +1904,7 @@ void pri_enslave(struct pri *master, struct pri *slave)
 	master->nfas = 1;
 	slave->nfas = 1;
 	slave->callpool = &master->localpool;
+	slave->callindex = &master->localindex;
 
 	/* Link the slave to the master on the end of the master's list. */
 	slave->master = master;
@@ -48,6 +48,11 @@ struct pri_sched {
 	struct timeval when;
 	void (*callback)(void *data);
 	void *data;
+	/*!
+	 * \brief Position in the timer heap while scheduled.
+	 * \note Next free timer slot plus one while not scheduled. (0 if no more)
+	 */
+	unsigned pos;
 };
 
 /*
@@ -71,6 +76,17 @@ struct pri_msg_line {
 	char str[2048];
 };
 
+/*! Number of call pool hash buckets. (Must be a power of 2) */
+#define Q931_CALL_HASH_SIZE	256
+
+/*! \brief Index of the call records in a call pool. */
+struct q931_call_index {
+	/*! Last call record in the call pool. */
+	struct q931_call *tail;
+	/*! Call records hashed by call reference value, oldest first in each bucket. */
+	struct q931_call *hash[Q931_CALL_HASH_SIZE];
+};
+
 /*! \brief D channel controller structure */
 struct pri {
 	int fd;				/* File descriptor for D-Channel */
@@ -86,10 +102,16 @@ struct pri {
 	struct {
 		/*! Dynamically allocated array of timers that can grow as needed. */
 		struct pri_sched *timer;
+		/*! Scheduled timer slots kept as a binary min-heap on expiration time. */
+		unsigned *heap;
 		/*! Numer of timer slots in the allocated array of timers. */
 		unsigned num_slots;
-		/*! Maximum timer slots currently needed. */
+		/*! Number of timer slots ever used.  Slots above have never been used. */
 		unsigned max_used;
+		/*! Number of scheduled timers in the heap. */
+		unsigned num_active;
+		/*! First free timer slot below max_used plus one. (0 if none) */
+		unsigned free_slot;
 		/*! First timer id in this timer pool. */
 		unsigned first_id;
 	} sched;
@@ -141,6 +163,9 @@ struct pri {
 	/* Q.931 calls */
 	struct q931_call **callpool;
 	struct q931_call *localpool;
+	/*! Tail and hash index of the callpool. (Shared the same way as the callpool) */
+	struct q931_call_index *callindex;
+	struct q931_call_index localindex;
 
 	/* q921/q931 packet counters */
 	unsigned int q921_txcount;
@@ -432,6 +457,10 @@ struct q931_call {
 	struct pri *pri;	/* D channel controller (master) */
 	struct q921_link *link;	/* Q.921 link associated with this call. */
 	struct q931_call *next;
+	/*! Previous call record in the call pool. */
+	struct q931_call *prev;
+	/*! Next call record in the same call pool hash bucket. */
+	struct q931_call *hash_next;
 	int cr;				/* Call Reference */
 	/* Slotmap specified (bitmap of channels 31/24-1) (Channel Identifier IE) (-1 means not specified) */
 	int slotmap;
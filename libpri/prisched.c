@@ -41,7 +41,7 @@
  * \brief Maximum number of scheduled timer slots.
  * \note Should be a power of 2 and at least SCHED_EVENTS_INITIAL.
  */
-#define SCHED_EVENTS_MAX		8192
+#define SCHED_EVENTS_MAX		65536
 
 /*! \brief The maximum number of timers that were active at once. */
 static unsigned maxsched = 0;
@@ -63,6 +63,7 @@ static int pri_schedule_grow(struct pri *ctrl)
 {
 	unsigned num_slots;
 	struct pri_sched *timers;
+	unsigned *heap;
 
 	/* Determine how many slots in the new timer table. */
 	if (ctrl->sched.num_slots) {
@@ -78,17 +79,25 @@ static int pri_schedule_grow(struct pri *ctrl)
 		num_slots = SCHED_EVENTS_INITIAL;
 	}
 
-	/* Get and initialize the new timer table. */
+	/* Get and initialize the new timer table and heap. */
 	timers = calloc(num_slots, sizeof(struct pri_sched));
 	if (!timers) {
 		/* Could not get a new timer table. */
 		return -1;
 	}
+	heap = calloc(num_slots, sizeof(unsigned));
+	if (!heap) {
+		/* Could not get a new timer heap. */
+		free(timers);
+		return -1;
+	}
 	if (ctrl->sched.timer) {
-		/* Copy over the old timer table. */
+		/* Copy over the old timer table and heap. */
 		memcpy(timers, ctrl->sched.timer,
 			ctrl->sched.num_slots * sizeof(struct pri_sched));
 		free(ctrl->sched.timer);
+		memcpy(heap, ctrl->sched.heap, ctrl->sched.num_active * sizeof(unsigned));
+		free(ctrl->sched.heap);
 	} else {
 		/* Creating the timer pool. */
 		pool_id += SCHED_EVENTS_MAX;
@@ -110,10 +119,135 @@ static int pri_schedule_grow(struct pri *ctrl)
 
 	/* Put the new timer table in place. */
 	ctrl->sched.timer = timers;
+	ctrl->sched.heap = heap;
 	ctrl->sched.num_slots = num_slots;
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Determine if the first time is before the second time.
+ *
+ * \param left First time to compare.
+ * \param right Second time to compare.
+ *
+ * \return TRUE if left is before right.
+ */
+static int pri_schedule_before(const struct timeval *left, const struct timeval *right)
+{
+	return left->tv_sec < right->tv_sec
+		|| (left->tv_sec == right->tv_sec && left->tv_usec < right->tv_usec);
+}
+
+/*!
+ * \internal
+ * \brief Put a timer slot at a heap position.
+ *
+ * \param ctrl D channel controller.
+ * \param pos Heap position.
+ * \param x Timer slot.
+ *
+ * \return Nothing
+ */
+static void pri_schedule_heap_set(struct pri *ctrl, unsigned pos, unsigned x)
+{
+	ctrl->sched.heap[pos] = x;
+	ctrl->sched.timer[x].pos = pos;
+}
+
+/*!
+ * \internal
+ * \brief Move the timer at a heap position up until its parent expires first.
+ *
+ * \param ctrl D channel controller.
+ * \param pos Heap position of the timer.
+ *
+ * \return Nothing
+ */
+static void pri_schedule_heap_up(struct pri *ctrl, unsigned pos)
+{
+	unsigned x;
+	unsigned parent;
+
+	x = ctrl->sched.heap[pos];
+	while (pos) {
+		parent = (pos - 1) / 2;
+		if (!pri_schedule_before(&ctrl->sched.timer[x].when,
+			&ctrl->sched.timer[ctrl->sched.heap[parent]].when)) {
+			break;
+		}
+		pri_schedule_heap_set(ctrl, pos, ctrl->sched.heap[parent]);
+		pos = parent;
+	}
+	pri_schedule_heap_set(ctrl, pos, x);
+}
+
+/*!
+ * \internal
+ * \brief Move the timer at a heap position down until its children expire later.
+ *
+ * \param ctrl D channel controller.
+ * \param pos Heap position of the timer.
+ *
+ * \return Nothing
+ */
+static void pri_schedule_heap_down(struct pri *ctrl, unsigned pos)
+{
+	unsigned x;
+	unsigned child;
+	unsigned num_active;
+
+	num_active = ctrl->sched.num_active;
+	x = ctrl->sched.heap[pos];
+	while ((child = pos * 2 + 1) < num_active) {
+		if (child + 1 < num_active
+			&& pri_schedule_before(&ctrl->sched.timer[ctrl->sched.heap[child + 1]].when,
+				&ctrl->sched.timer[ctrl->sched.heap[child]].when)) {
+			/* The right child expires first. */
+			++child;
+		}
+		if (!pri_schedule_before(&ctrl->sched.timer[ctrl->sched.heap[child]].when,
+			&ctrl->sched.timer[x].when)) {
+			break;
+		}
+		pri_schedule_heap_set(ctrl, pos, ctrl->sched.heap[child]);
+		pos = child;
+	}
+	pri_schedule_heap_set(ctrl, pos, x);
+}
+
+/*!
+ * \internal
+ * \brief Unschedule an active timer and free its slot.
+ *
+ * \param ctrl D channel controller.
+ * \param x Timer slot.
+ *
+ * \return Nothing
+ */
+static void pri_schedule_remove(struct pri *ctrl, unsigned x)
+{
+	unsigned pos;
+	unsigned last;
+
+	pos = ctrl->sched.timer[x].pos;
+	last = ctrl->sched.heap[--ctrl->sched.num_active];
+	if (pos < ctrl->sched.num_active) {
+		/* Fill the hole with the last timer in the heap. */
+		pri_schedule_heap_set(ctrl, pos, last);
+		if (pos && pri_schedule_before(&ctrl->sched.timer[last].when,
+			&ctrl->sched.timer[ctrl->sched.heap[(pos - 1) / 2]].when)) {
+			pri_schedule_heap_up(ctrl, pos);
+		} else {
+			pri_schedule_heap_down(ctrl, pos);
+		}
+	}
+
+	ctrl->sched.timer[x].callback = NULL;
+	ctrl->sched.timer[x].pos = ctrl->sched.free_slot;
+	ctrl->sched.free_slot = x + 1;
+}
+
 /*!
  * \brief Start a timer to schedule an event.
  *
@@ -127,36 +261,35 @@ static int pri_schedule_grow(struct pri *ctrl)
  */
 unsigned pri_schedule_event(struct pri *ctrl, int ms, void (*function)(void *data), void *data)
 {
-	unsigned max_used;
 	unsigned x;
 	struct timeval tv;
 
-	max_used = ctrl->sched.max_used;
-	for (x = 0; x < max_used; ++x) {
-		if (!ctrl->sched.timer[x].callback) {
-			break;
+	if (ctrl->sched.free_slot) {
+		/* Reuse a freed timer slot. */
+		x = ctrl->sched.free_slot - 1;
+		ctrl->sched.free_slot = ctrl->sched.timer[x].pos;
+	} else {
+		if (ctrl->sched.max_used == ctrl->sched.num_slots && pri_schedule_grow(ctrl)) {
+			pri_error(ctrl, "No more room in scheduler\n");
+			return 0;
 		}
+		x = ctrl->sched.max_used++;
 	}
-	if (x == ctrl->sched.num_slots && pri_schedule_grow(ctrl)) {
-		pri_error(ctrl, "No more room in scheduler\n");
-		return 0;
-	}
-	if (ctrl->sched.max_used <= x) {
-		ctrl->sched.max_used = x + 1;
-	}
-	if (x >= maxsched) {
-		maxsched = x + 1;
+	if (++ctrl->sched.num_active > maxsched) {
+		maxsched = ctrl->sched.num_active;
 	}
 	gettimeofday(&tv, NULL);
 	tv.tv_sec += ms / 1000;
 	tv.tv_usec += (ms % 1000) * 1000;
-	if (tv.tv_usec > 1000000) {
+	if (tv.tv_usec >= 1000000) {
 		tv.tv_usec -= 1000000;
 		tv.tv_sec += 1;
 	}
 	ctrl->sched.timer[x].when = tv;
 	ctrl->sched.timer[x].callback = function;
 	ctrl->sched.timer[x].data = data;
+	ctrl->sched.heap[ctrl->sched.num_active - 1] = x;
+	pri_schedule_heap_up(ctrl, ctrl->sched.num_active - 1);
 	return ctrl->sched.first_id + x;
 }
 
@@ -169,28 +302,11 @@ unsigned pri_schedule_event(struct pri *ctrl, int ms, void (*function)(void *dat
  */
 struct timeval *pri_schedule_next(struct pri *ctrl)
 {
-	struct timeval *closest = NULL;
-	unsigned x;
-
-	/* Scan the scheduled timer slots backwards so we can update the max_used value. */
-	for (x = ctrl->sched.max_used; x--;) {
-		if (ctrl->sched.timer[x].callback) {
-			if (!closest) {
-				/* This is the highest sheduled timer slot in use. */
-				closest = &ctrl->sched.timer[x].when;
-				ctrl->sched.max_used = x + 1;
-			} else if ((closest->tv_sec > ctrl->sched.timer[x].when.tv_sec)
-				|| ((closest->tv_sec == ctrl->sched.timer[x].when.tv_sec)
-					&& (closest->tv_usec > ctrl->sched.timer[x].when.tv_usec))) {
-				closest = &ctrl->sched.timer[x].when;
-			}
-		}
-	}
-	if (!closest) {
+	if (!ctrl->sched.num_active) {
 		/* No scheduled timer slots are active. */
-		ctrl->sched.max_used = 0;
+		return NULL;
 	}
-	return closest;
+	return &ctrl->sched.timer[ctrl->sched.heap[0]].when;
 }
 
 /*!
@@ -200,30 +316,31 @@ struct timeval *pri_schedule_next(struct pri *ctrl)
  * \param ctrl D channel controller.
  * \param tv Current time.
  *
+ * \note Expired timers are run in the order they expire.
+ *
  * \return Event for upper layer to process or NULL if all expired timers run.
  */
 static pri_event *__pri_schedule_run(struct pri *ctrl, struct timeval *tv)
 {
 	unsigned x;
-	unsigned max_used;
 	void (*callback)(void *);
 	void *data;
 
-	max_used = ctrl->sched.max_used;
-	for (x = 0; x < max_used; ++x) {
-		if (ctrl->sched.timer[x].callback
-			&& ((ctrl->sched.timer[x].when.tv_sec < tv->tv_sec)
-			|| ((ctrl->sched.timer[x].when.tv_sec == tv->tv_sec)
-			&& (ctrl->sched.timer[x].when.tv_usec <= tv->tv_usec)))) {
-			/* This timer has expired. */
-			ctrl->schedev = 0;
-			callback = ctrl->sched.timer[x].callback;
-			data = ctrl->sched.timer[x].data;
-			ctrl->sched.timer[x].callback = NULL;
-			callback(data);
-			if (ctrl->schedev) {
-				return &ctrl->ev;
-			}
+	while (ctrl->sched.num_active) {
+		x = ctrl->sched.heap[0];
+		if (pri_schedule_before(tv, &ctrl->sched.timer[x].when)) {
+			/* The next timer has not expired yet. */
+			break;
+		}
+
+		/* This timer has expired. */
+		ctrl->schedev = 0;
+		callback = ctrl->sched.timer[x].callback;
+		data = ctrl->sched.timer[x].data;
+		pri_schedule_remove(ctrl, x);
+		callback(data);
+		if (ctrl->schedev) {
+			return &ctrl->ev;
 		}
 	}
 	return NULL;
@@ -244,6 +361,31 @@ pri_event *pri_schedule_run(struct pri *ctrl)
 	return __pri_schedule_run(ctrl, &tv);
 }
 
+/*!
+ * \internal
+ * \brief Unschedule a timer in this D channel timer pool if it is active.
+ *
+ * \param ctrl D channel controller.
+ * \param id Scheduled event id to delete.
+ *
+ * \retval 0 if the id belongs to this timer pool.
+ * \retval -1 if the id is from another timer pool.
+ */
+static int pri_schedule_del_pool(struct pri *ctrl, unsigned id)
+{
+	unsigned x;
+
+	if (id < ctrl->sched.first_id
+		|| ctrl->sched.first_id + (SCHED_EVENTS_MAX - 1) < id) {
+		return -1;
+	}
+	x = id - ctrl->sched.first_id;
+	if (x < ctrl->sched.max_used && ctrl->sched.timer[x].callback) {
+		pri_schedule_remove(ctrl, x);
+	}
+	return 0;
+}
+
 /*!
  * \brief Delete a scheduled event.
  *
@@ -261,17 +403,13 @@ void pri_schedule_del(struct pri *ctrl, unsigned id)
 		/* Disabled/unscheduled event id. */
 		return;
 	}
-	if (ctrl->sched.first_id <= id
-		&& id <= ctrl->sched.first_id + (SCHED_EVENTS_MAX - 1)) {
-		ctrl->sched.timer[id - ctrl->sched.first_id].callback = NULL;
+	if (!pri_schedule_del_pool(ctrl, id)) {
 		return;
 	}
 	if (ctrl->nfas) {
 		/* Try to find the timer on another D channel. */
 		for (nfas = PRI_NFAS_MASTER(ctrl); nfas; nfas = nfas->slave) {
-			if (nfas->sched.first_id <= id
-				&& id <= nfas->sched.first_id + (SCHED_EVENTS_MAX - 1)) {
-				nfas->sched.timer[id - nfas->sched.first_id].callback = NULL;
+			if (!pri_schedule_del_pool(nfas, id)) {
 				return;
 			}
 		}
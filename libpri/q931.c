@@ -4214,6 +4214,119 @@ void q931_init_call_record(struct q921_link *link, struct q931_call *call, int c
 	}
 }
 
+/*!
+ * \internal
+ * \brief Get the call pool hash bucket of a call reference value.
+ *
+ * \param ctrl D channel controller.
+ * \param cr Call Reference identifier.
+ *
+ * \return Hash bucket head.
+ */
+static struct q931_call **q931_call_bucket(struct pri *ctrl, int cr)
+{
+	/* Mix in the high bits so both ends allocating the same value use different buckets. */
+	return &ctrl->callindex->hash[(cr ^ (cr >> 8)) & (Q931_CALL_HASH_SIZE - 1)];
+}
+
+/*!
+ * \internal
+ * \brief Add a call record to the end of its call pool hash bucket.
+ *
+ * \param ctrl D channel controller.
+ * \param call Q.931 call leg.
+ *
+ * \return Nothing
+ */
+static void q931_call_hash_add(struct pri *ctrl, struct q931_call *call)
+{
+	struct q931_call **prev;
+
+	for (prev = q931_call_bucket(ctrl, call->cr); *prev; prev = &(*prev)->hash_next) {
+	}
+	call->hash_next = NULL;
+	*prev = call;
+}
+
+/*!
+ * \internal
+ * \brief Remove a call record from its call pool hash bucket.
+ *
+ * \param ctrl D channel controller.
+ * \param call Q.931 call leg.
+ *
+ * \retval 0 on success.
+ * \retval -1 if the call record is not in the call pool.
+ */
+static int q931_call_hash_remove(struct pri *ctrl, struct q931_call *call)
+{
+	struct q931_call **prev;
+
+	for (prev = q931_call_bucket(ctrl, call->cr); *prev; prev = &(*prev)->hash_next) {
+		if (*prev == call) {
+			*prev = call->hash_next;
+			call->hash_next = NULL;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*!
+ * \internal
+ * \brief Append a call record to the call pool.
+ *
+ * \param ctrl D channel controller.
+ * \param call Q.931 call leg.
+ *
+ * \return Nothing
+ */
+static void q931_call_pool_add(struct pri *ctrl, struct q931_call *call)
+{
+	struct q931_call_index *index = ctrl->callindex;
+
+	call->next = NULL;
+	call->prev = index->tail;
+	if (index->tail) {
+		index->tail->next = call;
+	} else {
+		/* List was empty. */
+		*ctrl->callpool = call;
+	}
+	index->tail = call;
+	q931_call_hash_add(ctrl, call);
+}
+
+/*!
+ * \internal
+ * \brief Remove a call record from the call pool.
+ *
+ * \param ctrl D channel controller.
+ * \param call Q.931 call leg.
+ *
+ * \retval 0 on success.
+ * \retval -1 if the call record is not in the call pool.
+ */
+static int q931_call_pool_remove(struct pri *ctrl, struct q931_call *call)
+{
+	if (q931_call_hash_remove(ctrl, call)) {
+		return -1;
+	}
+	if (call->prev) {
+		call->prev->next = call->next;
+	} else {
+		*ctrl->callpool = call->next;
+	}
+	if (call->next) {
+		call->next->prev = call->prev;
+	} else {
+		ctrl->callindex->tail = call->prev;
+	}
+	call->next = NULL;
+	call->prev = NULL;
+	return 0;
+}
+
 /*!
  * \internal
  * \brief Create a new call record.
@@ -4227,7 +4340,6 @@ void q931_init_call_record(struct q921_link *link, struct q931_call *call, int c
 static struct q931_call *q931_create_call_record(struct q921_link *link, int cr)
 {
 	struct q931_call *call;
-	struct q931_call *prev;
 	struct pri *ctrl;
 
 	ctrl = link->ctrl;
@@ -4245,15 +4357,7 @@ static struct q931_call *q931_create_call_record(struct q921_link *link, int cr)
 	q931_init_call_record(link, call, cr);
 
 	/* Append to the list end */
-	if (*ctrl->callpool) {
-		/* Find the list end. */
-		for (prev = *ctrl->callpool; prev->next; prev = prev->next) {
-		}
-		prev->next = call;
-	} else {
-		/* List was empty. */
-		*ctrl->callpool = call;
-	}
+	q931_call_pool_add(ctrl, call);
 
 	return call;
 }
@@ -4287,14 +4391,14 @@ static struct q931_call *q931_find_call(struct q921_link *link, int cr)
 		}
 
 		/* We are looking for a call reference value that the other side allocated. */
-		for (cur = *ctrl->callpool; cur; cur = cur->next) {
+		for (cur = *q931_call_bucket(ctrl, cr); cur; cur = cur->hash_next) {
 			if (cur->cr == cr && cur->link == link) {
 				/* Found existing call.  The call reference and link matched. */
 				break;
 			}
 		}
 	} else {
-		for (cur = *ctrl->callpool; cur; cur = cur->next) {
+		for (cur = *q931_call_bucket(ctrl, cr); cur; cur = cur->hash_next) {
 			if (cur->cr == cr) {
 				/* Found existing call. */
 				switch (ctrl->switchtype) {
@@ -4375,7 +4479,7 @@ struct q931_call *q931_new_call(struct pri *ctrl)
 		}
 
 		/* Is the call reference value in use? */
-		for (cur = *ctrl->callpool; cur; cur = cur->next) {
+		for (cur = *q931_call_bucket(ctrl, cref); cur; cur = cur->hash_next) {
 			if (cur->cr == cref) {
 				/* Yes it is in use. */
 				if (first_cref == ctrl->cref) {
@@ -4554,7 +4658,6 @@ static void q931_destroy_subcall(struct q931_call *master, int idx)
 void q931_destroycall(struct pri *ctrl, q931_call *c)
 {
 	struct q931_call *cur;
-	struct q931_call *prev;
 	struct q931_call *slave;
 	int i;
 	int slavesleft;
@@ -4570,9 +4673,7 @@ void q931_destroycall(struct pri *ctrl, q931_call *c)
 		slave = NULL;
 	}
 
-	prev = NULL;
-	cur = *ctrl->callpool;
-	while (cur) {
+	for (cur = *q931_call_bucket(ctrl, c->cr); cur; cur = cur->hash_next) {
 		if (cur == c) {
 			if (slave) {
 				/* Destroying a slave. */
@@ -4636,10 +4737,7 @@ void q931_destroycall(struct pri *ctrl, q931_call *c)
 			}
 
 			/* Master call or normal call destruction. */
-			if (prev)
-				prev->next = cur->next;
-			else
-				*ctrl->callpool = cur->next;
+			q931_call_pool_remove(ctrl, cur);
 			if (ctrl->debug & PRI_DEBUG_Q931_STATE)
 				pri_message(ctrl,
 					"Destroying call %p, ourstate %s, peerstate %s, hold-state %s\n",
@@ -4650,8 +4748,6 @@ void q931_destroycall(struct pri *ctrl, q931_call *c)
 			cleanup_and_free_call(cur);
 			return;
 		}
-		prev = cur;
-		cur = cur->next;
 	}
 	pri_error(ctrl, "Can't destroy call %p cref:%d!\n", c, c->cr);
 }
@@ -7288,6 +7384,8 @@ static struct q931_call *q931_get_subcall(struct q921_link *link, struct q931_ca
 	//cur->pri = ctrl;/* We get this assignment for free. */
 	cur->link = link;
 	cur->next = NULL;
+	cur->prev = NULL;
+	cur->hash_next = NULL;
 	cur->apdus = NULL;
 	cur->bridged_call = NULL;
 	//cur->master_call = master_call; /* We get this assignment for free. */
@@ -9812,8 +9910,15 @@ int q931_call_setcrv(struct pri *ctrl, q931_call *call, int crv, int callmode)
 {
 	/* Do not allow changing the dummy call reference */
 	if (!q931_is_dummy_call(call)) {
+		int in_pool;
+
+		/* Rehash the call record under the new call reference. */
+		in_pool = !q931_call_hash_remove(ctrl, call);
 		call->cr = (crv << 3) & 0x7fff;
 		call->cr |= (callmode & 0x7);
+		if (in_pool) {
+			q931_call_hash_add(ctrl, call);
+		}
 	}
 	return 0;
 }
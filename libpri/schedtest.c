@@ -0,0 +1,221 @@
+/*
+ * libpri: An implementation of Primary Rate ISDN
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2 as published by the
+ * Free Software Foundation. See the LICENSE file included with
+ * this program for more details.
+ *
+ * In addition, when this program is distributed with Asterisk in
+ * any form that would qualify as a 'combined work' or as a
+ * 'derivative work' (but not mere aggregation), you can redistribute
+ * and/or modify the combination under the terms of the license
+ * provided with that copy of Asterisk, instead of the license
+ * terms granted here.
+ */
+
+/*!
+ * \file
+ * \brief Timer scheduler test and benchmark program
+ *
+ * Keeps a number of timers active (10000 by default) and measures how many
+ * timer operations per second the scheduler does with that many timers,
+ * while checking that timers expire in order.
+ *
+ * Usage: schedtest [<active timers> [<operations>]]
+ */
+
+
+#include "compat.h"
+#include "libpri.h"
+#include "pri_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* ------------------------------------------------------------------- */
+
+
+/*! D channel controller owning the timers. */
+static struct pri dummy_ctrl;
+/*! Timer ids of the active timers. */
+static unsigned *timer_ids;
+/*! Number of timers that expired. */
+static unsigned num_expired;
+/*! Number of timers that expired before a timer that expired earlier. */
+static unsigned num_out_of_order;
+/*! Expiration time of the last expired timer. */
+static struct timeval last_expired;
+
+static void sched_pri_message(struct pri *ctrl, char *stuff)
+{
+	fprintf(stdout, "%s", stuff);
+}
+
+static void sched_pri_error(struct pri *ctrl, char *stuff)
+{
+	fprintf(stdout, "%s", stuff);
+	fprintf(stderr, "%s", stuff);
+}
+
+/*!
+ * \internal
+ * \brief Count an expired timer and check it expired in order.
+ *
+ * \param data Timer slot in timer_ids.
+ *
+ * \return Nothing
+ */
+static void sched_test_expired(void *data)
+{
+	unsigned index = (unsigned long) data;
+	struct timeval when;
+
+	/* The expired timer slot still has the expiration time. */
+	when = dummy_ctrl.sched.timer[timer_ids[index] - dummy_ctrl.sched.first_id].when;
+	if (when.tv_sec < last_expired.tv_sec
+		|| (when.tv_sec == last_expired.tv_sec && when.tv_usec < last_expired.tv_usec)) {
+		++num_out_of_order;
+	}
+	last_expired = when;
+	timer_ids[index] = 0;
+	++num_expired;
+}
+
+/*!
+ * \internal
+ * \brief Elapsed microseconds since a start time.
+ *
+ * \param start Start time.
+ *
+ * \return Elapsed microseconds. (At least 1)
+ */
+static double sched_test_elapsed(const struct timeval *start)
+{
+	struct timeval now;
+	double usecs;
+
+	gettimeofday(&now, NULL);
+	usecs = (now.tv_sec - start->tv_sec) * 1000000.0 + (now.tv_usec - start->tv_usec);
+	return usecs < 1 ? 1 : usecs;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval start;
+	struct timeval *next;
+	unsigned num_timers;
+	unsigned num_ops;
+	unsigned index;
+	unsigned op;
+	double usecs;
+	int failed;
+
+	pri_set_message(sched_pri_message);
+	pri_set_error(sched_pri_error);
+
+	num_timers = 1 < argc ? atoi(argv[1]) : 10000;
+	num_ops = 2 < argc ? atoi(argv[2]) : 1000000;
+	if (!num_timers || !num_ops) {
+		fprintf(stderr, "Usage: schedtest [<active timers> [<operations>]]\n");
+		return 1;
+	}
+
+	memset(&dummy_ctrl, 0, sizeof(dummy_ctrl));
+
+	/* For sanity specify what version of libpri we are testing. */
+	pri_message(&dummy_ctrl, "libpri version tested: %s\n", pri_get_version());
+
+	timer_ids = calloc(num_timers, sizeof(unsigned));
+	if (!timer_ids) {
+		return 1;
+	}
+	srandom(num_timers);
+	failed = 0;
+
+	/* Start the timers, like T303/T305/T308/T313 and T200/T203 running for many calls. */
+	gettimeofday(&start, NULL);
+	for (index = 0; index < num_timers; ++index) {
+		timer_ids[index] = pri_schedule_event(&dummy_ctrl, 10000 + random() % 30000,
+			sched_test_expired, (void *) (unsigned long) index);
+		if (!timer_ids[index]) {
+			pri_error(&dummy_ctrl, "Could not start timer %u\n", index);
+			return 1;
+		}
+	}
+	usecs = sched_test_elapsed(&start);
+	pri_message(&dummy_ctrl, "Started %u timers: %.0f starts/sec\n",
+		num_timers, num_timers * 1000000.0 / usecs);
+
+	/* Restart random timers, the way protocol timers mostly end up. */
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; ++op) {
+		index = random() % num_timers;
+		pri_schedule_del(&dummy_ctrl, timer_ids[index]);
+		timer_ids[index] = pri_schedule_event(&dummy_ctrl, 10000 + random() % 30000,
+			sched_test_expired, (void *) (unsigned long) index);
+	}
+	usecs = sched_test_elapsed(&start);
+	pri_message(&dummy_ctrl,
+		"Restarted %u timers with %u active: %.0f delete+start pairs/sec\n",
+		num_ops, num_timers, num_ops * 1000000.0 / usecs);
+
+	/* Ask for the next timeout, as the D channel loop does on every pass. */
+	gettimeofday(&start, NULL);
+	next = NULL;
+	for (op = 0; op < num_ops; ++op) {
+		next = pri_schedule_next(&dummy_ctrl);
+		if (!next) {
+			break;
+		}
+	}
+	usecs = sched_test_elapsed(&start);
+	pri_message(&dummy_ctrl, "Next timeout with %u active: %.0f lookups/sec\n",
+		num_timers, op * 1000000.0 / usecs);
+	if (!next) {
+		pri_error(&dummy_ctrl, "No next timeout with %u timers active\n", num_timers);
+		failed = 1;
+	}
+
+	/* Make all the timers have expired, in random order, and run them. */
+	for (index = 0; index < num_timers; ++index) {
+		pri_schedule_del(&dummy_ctrl, timer_ids[index]);
+		timer_ids[index] = pri_schedule_event(&dummy_ctrl, -1000 * (int) (random() % 30),
+			sched_test_expired, (void *) (unsigned long) index);
+	}
+	gettimeofday(&start, NULL);
+	while (pri_schedule_run(&dummy_ctrl)) {
+	}
+	usecs = sched_test_elapsed(&start);
+	pri_message(&dummy_ctrl, "Expired %u timers: %.0f expirations/sec\n",
+		num_expired, num_expired * 1000000.0 / usecs);
+
+	if (num_expired != num_timers) {
+		pri_error(&dummy_ctrl, "%u of %u timers expired\n", num_expired, num_timers);
+		failed = 1;
+	}
+	if (num_out_of_order) {
+		pri_error(&dummy_ctrl, "%u timers expired out of order\n", num_out_of_order);
+		failed = 1;
+	}
+	if (pri_schedule_next(&dummy_ctrl)) {
+		pri_error(&dummy_ctrl, "Timers still active after all expired\n");
+		failed = 1;
+	}
+
+	free(timer_ids);
+	free(dummy_ctrl.sched.timer);
+	free(dummy_ctrl.sched.heap);
+	return failed;
+}
+
+/* ------------------------------------------------------------------- */
+/* end schedtest.c */
@@ -0,0 +1,14 @@
+/*
+ * version.c
+ * Automatically generated
+ */
+
+#include "libpri.h"
+
+static const char pri_version[] = "UNKNOWN__and_probably_unsupported";
+
+const char *pri_get_version(void)
+{
+	return pri_version;
+}
+